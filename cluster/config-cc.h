@@ -131,6 +131,10 @@ configEntry configKeysRestartCC[] = {
     ,
     {"MAX_INSTANCES_PER_CC", NULL}
     ,
+    {"NC_PUSH_ENABLE", "N"}
+    ,
+    {"NC_PUSH_PORT", "8779"}
+    ,
     {NULL, NULL}
     ,
 };
@@ -142,6 +146,8 @@ configEntry configKeysNoRestartCC[] = {
     ,
     {"CLC_POLLING_FREQUENCY", "6"}
     ,
+    {"NC_ANTI_ENTROPY_INTERVAL", "60"}
+    ,
     {"CC_ARBITRATORS", NULL}
     ,
     {"LOGLEVEL", "INFO"}
@@ -87,6 +87,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <math.h>
 #include <assert.h>
 #include <json/json.h>
@@ -104,6 +107,10 @@
 #include <fault.h>
 #include <euca_string.h>
 #include <euca_network.h>
+#include <euca_index.h>
+#include <euca_rwlock.h>
+#include <sched_engine.h>
+#include <euca_fanout.h>
 #include <euca_auth.h>
 #include <euca_axis.h>
 #include <axutil_error.h>
@@ -120,6 +127,7 @@
 #include <message_stats.h>
 #include <message_sensor.h>
 #include <service_sensor.h>
+#include <lock_sensor.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -131,6 +139,12 @@
 #define POLL_INTERVAL_MINIMUM_SEC                6
 #define STATS_INTERVAL_SEC                       60
 
+#define MYLOCK_WRITE                             1  //!< mylocks[] value of a lock held exclusively
+#define MYLOCK_READ                              2  //!< mylocks[] value of a lock held for reading
+
+#define NC_WORKER_MAX_REQUEST                    (16 * 1024 * 1024) //!< largest request a persistent NC worker accepts, in bytes
+#define NC_WORKER_MAX_CALLS                      1000   //!< calls after which a persistent NC worker exits and gets replaced
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -143,12 +157,61 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! The operations fanned out to every node
+enum {
+    NC_FANOUT_BROADCAST,
+    NC_FANOUT_RESOURCES,
+    NC_FANOUT_INSTANCES,
+    NC_FANOUT_SENSORS,
+    NC_FANOUT_LAST,
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Entry in the per-process cache of warm NC client stubs (see ncStubCacheGet())
+typedef struct ncStubCacheEntry_t {
+    char ncURL[384];                   //!< NC endpoint the stub was created for
+    char policyFile[EUCA_MAX_PATH];    //!< WS-Security policy the stub was initialized with
+    int use_wssec;                     //!< set if WS-Security was initialized on the stub
+    ncStub *stub;                      //!< the warm stub, NULL if the entry is free
+    time_t lastUsed;                   //!< last time the stub was handed out, used for eviction
+    pid_t workerPid;                   //!< persistent worker making the polling calls with this stub, 0 if none
+    pid_t workerOwner;                 //!< process that forked the worker, the only one that reaps and respawns it
+    int workerReq;                     //!< write end of the pipe the worker reads its requests from
+    int workerRsp;                     //!< read end of the pipe the worker writes its replies to
+} ncStubCacheEntry;
+
+//! A request to a persistent NC worker, as it is built up by the caller and parsed by the worker (see ncWorkerRequest())
+typedef struct ncWorkerBuf_t {
+    char *data;                        //!< the bytes of the request
+    int len;                           //!< number of bytes in data
+    int pos;                           //!< how far the worker has parsed
+    boolean bad;                       //!< set if the request could not be built or parsed
+} ncWorkerBuf;
+
+//! An instance a describe call reported to the CLC (see instanceCache_mark_described())
+typedef struct ccDescribedSlot_t {
+    int slot;                          //!< the instanceCache slot the instance was read from
+    char instanceId[16];               //!< the instance, in case the slot was reused since
+} ccDescribedSlot;
+
+//! What the per-node tasks of an NC fan-out need (see nc_fanout())
+typedef struct ncFanoutCtx_t {
+    int kind;                          //!< which NC_FANOUT_* operation this is
+    euca_fanout_task_fn task;          //!< the per-node task
+    ncMetadata *pMeta;                 //!< metadata for the NC calls
+    time_t op_start;                   //!< when the operation started
+    int timeout;                       //!< seconds for the whole operation
+    char *networkInfo;                 //!< broadcast_network_info() only, what to send
+    int historySize;                   //!< refresh_sensors() only, sensor history size
+    long long collectionIntervalMs;    //!< refresh_sensors() only, sensor collection interval
+    char *slotHeld;                    //!< per resourceCacheStage slot, set while its task holds a REFRESHLOCK slot (shared with the tasks)
+} ncFanoutCtx;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -179,6 +242,8 @@ int stats_initd = 0;
 ccConfig *config = NULL;
 ccInstanceCache *instanceCache = NULL; // canonical source for latest information about instances
 ccInstanceCacheMetadata *instanceCacheMetadata = NULL; // metadata for the cache
+ccCacheLocks *cacheLocks = NULL;       // reader/writer locks of instanceCache and resourceCache
+ccPushCache *pushCache = NULL;         // sequence tracking of the nodes pushing their state changes
 euca_network *gpEucaNet = NULL;
 globalNetworkInfo *globalnetworkinfo = NULL;
 ccResourceCache *resourceCache = NULL; // canonical source for latest information about resources
@@ -206,6 +271,8 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
     "ROUNDROBIN",
     "POWERSAVE",
     "USER",
+    "BESTFIT",
+    "SPREAD",
 };
 
 /*----------------------------------------------------------------------------*\
@@ -214,6 +281,33 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! @{
+//! @name warm NC stubs of this process, inherited by the children forked in ncClientCall()
+static ncStubCacheEntry ncStubCache[MAXNODES];
+static pthread_mutex_t ncStubCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+//! @}
+
+//! @{
+//! @name the polling calls ncClientCall() hands to the persistent worker of a node, when it has one
+static const char *ncWorkerOps[] = { "ncDescribeResource", "ncDescribeInstances", "ncDescribeInstancesDelta", "ncDescribeSensors", NULL };
+static int ncWorkerSeq = 0;            //!< numbers the requests of this process to the workers
+//! @}
+
+//! @{
+//! @name instanceCache indexes, mapped right after the instanceCache array in the same shared segment
+static euca_index *instanceIdIndex = NULL;   //!< instanceId -> instanceCache slot
+static euca_index *instanceIpIndex = NULL;   //!< publicIp and privateIp -> instanceCache slot
+static int instanceCacheFreeHint = 0;   //!< where this process starts looking for a free instanceCache slot
+//! @}
+
+//! @{
+//! @name NC fan-outs (see nc_fanout())
+static const char *ncFanoutNames[NC_FANOUT_LAST] = { "broadcast_network_info", "refresh_resources", "refresh_instances", "refresh_sensors" };
+static int ncFanoutFirst[NC_FANOUT_LAST] = { 0 };  //!< node each kind of fan-out starts with next time
+static boolean termDeferred = FALSE;   //!< set in fan-out children, which block SIGTERM while holding locks
+static int termHeldLocks = 0;          //!< number of locks held by a fan-out child
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -227,6 +321,58 @@ static int schedule_instance_migration(ncInstance * instance, char **includeNode
                                        ccResourceCache * resourceCacheLocal, char **replyString);
 static int migration_handler(ccInstance * myInstance, char *host, char *src, char *dst, migration_states migration_state, char **node, char **instance, char **action);
 static int populateOutboundMeta(ncMetadata * pMeta);
+static ncStub *ncStubCacheGet(char *ncURL, boolean withWorker);
+static void ncStubCacheInvalidate(char *ncURL);
+static void ncStubCacheWarm(ccResourceCache * cache);
+static int ncWorkerStart(ncStubCacheEntry * entry);
+static void ncWorkerStop(ncStubCacheEntry * entry);
+static boolean ncWorkerAlive(ncStubCacheEntry * entry);
+static boolean ncWorkerGet(char *ncURL, int *pid, int *reqFd, int *rspFd);
+static boolean ncWorkerOp(const char *ncOp);
+static void ncWorkerPut(ncWorkerBuf * wb, const void *src, int len);
+static void ncWorkerPutStr(ncWorkerBuf * wb, const char *str);
+static void ncWorkerPutStrs(ncWorkerBuf * wb, char **strs, int len);
+static void ncWorkerTake(ncWorkerBuf * wb, void *dst, int len);
+static char *ncWorkerTakeStr(ncWorkerBuf * wb);
+static char **ncWorkerTakeStrs(ncWorkerBuf * wb, int *len);
+static void ncWorkerFreeStrs(char ***strs, int len);
+static int ncWorkerSend(int fd, const char *buf, int len, int timeout);
+static int ncWorkerRequest(ncMetadata * localmeta, int timeout, int fd, int seq, char *ncOp, va_list al);
+static int ncWorkerServe(ncStub * stub, ncWorkerBuf * wb, int fd);
+static void ncWorkerMain(ncStub * stub, int reqFd, int rspFd, pid_t owner);
+static int ncWorkerCall(ncStub * ncs, ncMetadata * localmeta, int timeout, int fd, int seq, char *ncOp, ...);
+static ncMetadata *ncClientCallMeta(ncMetadata * pMeta);
+static void ncClientCallMetaFree(ncMetadata ** ppMeta);
+static int ncClientCallStub(ncStub * ncs, ncMetadata * localmeta, int timeout, int fd, char *ncOp, va_list al);
+static int ncClientRead(int fd, void *buf, size_t bytes, int timeout);
+static euca_rwlock *cache_rwlock(int lockno);
+static json_object *lock_stats_getter();
+static size_t instanceCache_size(int max);
+static boolean instanceCache_id_match(int slot, const char *key, void *ctx);
+static boolean instanceCache_ip_match(int slot, const char *key, void *ctx);
+static boolean instanceCache_ip_indexable(const char *ip);
+static void instanceCache_index_slot(int slot);
+static void instanceCache_unindex_slot(int slot);
+static void instanceCache_index_rebuild(void);
+static void instanceCache_count_slot(int slot, int sign);
+static int instanceCache_lookup_id(const char *instanceId);
+static void instanceCache_mark_described(const ccDescribedSlot * described, int describedLen);
+static int instanceCache_lookup_ip(const char *ip);
+static int refresh_resources_nodes(ncMetadata * pMeta, int timeout, int dolock, const char *nodeMask);
+static int refresh_instances_nodes(ncMetadata * pMeta, int timeout, int dolock, const char *nodeMask);
+static int nc_fanout_timeout(int idx, void *ctx);
+static int nc_fanout_task(int idx, void *ctx);
+static void nc_fanout_done(int idx, int result, void *ctx);
+static int nc_fanout(int kind, ncFanoutCtx * fctx, const char *nodeMask, euca_fanout_task_fn task);
+static void nc_fanout_lock_taken(void);
+static void nc_fanout_lock_released(void);
+static int broadcast_network_info_node(int idx, void *ctx);
+static int refresh_resources_node(int idx, void *ctx);
+static int refresh_instances_node(int idx, void *ctx);
+static int refresh_sensors_node(int idx, void *ctx);
+static int apply_push_message(nc_push_message * msg, const char *fromIp);
+static void push_nodes_described(const char *nodeMask, time_t when);
+static time_t anti_entropy_interval(time_t requested, time_t ncPollingFrequency, time_t instanceTimeout);
 static int initialize_stats_system(int interval_sec);
 static json_object **message_stats_getter();
 static void message_stats_setter();
@@ -333,6 +479,13 @@ static int initialize_stats_system(int interval_sec)
             goto cleanup;
         }
 
+        //Init the lock contention sensor with the counters of the cache locks
+        ret = initialize_lock_stats_sensor(euca_this_component_name, interval_sec, stats_ttl, lock_stats_getter);
+        if (ret != EUCA_OK) {
+            LOGERROR("Error initializing internal lock stats sensor: %d\n", ret);
+            goto cleanup;
+        }
+
         ret = init_stats(config->eucahome, euca_this_component_name, lock_stats, unlock_stats);
         if (ret != EUCA_OK) {
             LOGERROR("Could not initialize CC stats system: %d\n", ret);
@@ -374,12 +527,10 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
 {
     int i, j, rc, start = 0, stop = 0, ret = 0, timeout, done;
     char internalObjectStorageURL[EUCA_MAX_PATH], theObjectStorageURL[EUCA_MAX_PATH];
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = j = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -411,18 +562,13 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
         strncpy(theObjectStorageURL, objectStorageURL, strlen(objectStorageURL) + 1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -469,7 +615,6 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
     int ret = 0;
     int timeout = 0;
     int done = 0;
-    ccInstance *myInstance = NULL;
     time_t op_start = time(NULL);
     ccResourceCache resourceCacheLocal;
 
@@ -484,20 +629,15 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-            myInstance = NULL;
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -535,12 +675,10 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
 int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
 {
     int i, rc, start = 0, stop = 0, ret = 0, done, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -554,18 +692,13 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -622,421 +755,1403 @@ void filter_services(ncMetadata * meta, char *filter_partition)
 }
 
 //!
+//! Returns a warm NC stub for the given endpoint, creating it (and initializing
+//! WS-Security on it) only if this process does not have one cached already.
+//! Building a stub loads the Axis2 client configuration and the security policy,
+//! which dominates the cost of a short NC call, so the stub is created once in
+//! the long-lived process and inherited by every child that ncClientCall() forks.
+//! With withWorker set, the entry also gets a persistent worker (see ncWorkerStart())
+//! if it has none, or if the one this process started has gone away.
 //!
+//! @param[in] ncURL the NC endpoint URL
+//! @param[in] withWorker set to also start the persistent worker of the endpoint
 //!
-//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in] timeout
-//! @param[in] ncLock
-//! @param[in] ncURL
-//! @param[in] ncOp
-//! @param[in] ...
+//! @return a pointer to the cached stub or NULL if it could not be created
 //!
-//! @return
+//! @note the returned stub must only be used by a forked child, never by the calling process
 //!
-//! @pre
+static ncStub *ncStubCacheGet(char *ncURL, boolean withWorker)
+{
+    int i = 0;
+    int rc = 0;
+    int idx = -1;
+    ncStub *stub = NULL;
+    ncStubCacheEntry *entry = NULL;
+
+    if (!ncURL || !config)
+        return (NULL);
+
+    pthread_mutex_lock(&ncStubCacheMutex);
+    {
+        for (i = 0; i < MAXNODES; i++) {
+            if (ncStubCache[i].stub && !strcmp(ncStubCache[i].ncURL, ncURL)) {
+                idx = i;
+                break;
+            }
+            // remember a free entry, or else the least recently used one
+            if ((idx < 0) || (ncStubCache[idx].stub && (!ncStubCache[i].stub || (ncStubCache[i].lastUsed < ncStubCache[idx].lastUsed)))) {
+                idx = i;
+            }
+        }
+
+        entry = &(ncStubCache[idx]);
+        if (entry->stub && (strcmp(entry->ncURL, ncURL) || (entry->use_wssec != config->use_wssec) || strcmp(entry->policyFile, config->policyFile))) {
+            // evicted, or the security configuration changed since the stub was built
+            LOGTRACE("dropping cached stub for %s\n", entry->ncURL);
+            ncWorkerStop(entry);
+            ncStubDestroy(entry->stub);
+            bzero(entry, sizeof(ncStubCacheEntry));
+        }
+
+        if (!entry->stub) {
+            if ((stub = ncStubCreate(ncURL, NULL, NULL)) != NULL) {
+                if (config->use_wssec && ((rc = InitWSSEC(stub->env, stub->stub, config->policyFile)) != 0)) {
+                    LOGERROR("cannot initialize WS-SEC policy from %s for %s\n", config->policyFile, ncURL);
+                    ncStubDestroy(stub);
+                    stub = NULL;
+                }
+            }
+
+            if (stub) {
+                euca_strncpy(entry->ncURL, ncURL, sizeof(entry->ncURL));
+                euca_strncpy(entry->policyFile, config->policyFile, sizeof(entry->policyFile));
+                entry->use_wssec = config->use_wssec;
+                entry->stub = stub;
+                LOGTRACE("created cached stub for %s\n", ncURL);
+            }
+        }
+
+        if (entry->stub) {
+            entry->lastUsed = time(NULL);
+
+            // only the process that started a worker replaces it
+            if (withWorker && (!entry->workerPid || (entry->workerOwner == getpid()))) {
+                if (entry->workerPid && !ncWorkerAlive(entry)) {
+                    ncWorkerStop(entry);
+                }
+                if (!entry->workerPid) {
+                    ncWorkerStart(entry);
+                }
+            }
+        }
+        stub = entry->stub;
+    }
+    pthread_mutex_unlock(&ncStubCacheMutex);
+
+    return (stub);
+}
+
 //!
-//! @note
+//! Drops the cached stub of the given endpoint, if any, so that the next call
+//! to ncStubCacheGet() builds a fresh one. Its persistent worker goes with it.
 //!
-int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...)
+//! @param[in] ncURL the NC endpoint URL
+//!
+static void ncStubCacheInvalidate(char *ncURL)
 {
-#define WRITE_REPLY_STRING                                                                \
-{                                                                                         \
-    if (timeout) {                                                                        \
-        int __len = 0;                                                                    \
-        if (localmeta->replyString) {                                                     \
-            __len = strlen(localmeta->replyString);                                       \
-        }                                                                                 \
-        int __bytes = write(filedes[1], &__len, sizeof(int));                             \
-        if (__len > 0) {                                                                  \
-            __bytes += write(filedes[1], localmeta->replyString, (sizeof(char) * __len)); \
-        }                                                                                 \
-        LOGTRACE("child process wrote %d bytes (len=%d)\n", __bytes, __len);              \
-    }                                                                                     \
+    int i = 0;
+
+    if (!ncURL)
+        return;
+
+    pthread_mutex_lock(&ncStubCacheMutex);
+    {
+        for (i = 0; i < MAXNODES; i++) {
+            if (ncStubCache[i].stub && !strcmp(ncStubCache[i].ncURL, ncURL)) {
+                ncWorkerStop(&(ncStubCache[i]));
+                ncStubDestroy(ncStubCache[i].stub);
+                bzero(&(ncStubCache[i]), sizeof(ncStubCacheEntry));
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ncStubCacheMutex);
 }
 
-#define READ_REPLY_STRING                                                      \
-{                                                                              \
-    if (timeout) {                                                             \
-        int __len = 0;                                                         \
-        rbytes = timeread(filedes[0], &__len, sizeof(int), timeout);           \
-        LOGTRACE("parent process read %d bytes (len=%d)\n", rbytes, __len);    \
-        if (rbytes <= 0) {                                                     \
-            killwait(pid);                                                     \
-            opFail = 1;                                                        \
-        } else if (__len > 0) {                                                \
-            pMeta->replyString = EUCA_ALLOC(__len, sizeof(char));              \
-            if (pMeta->replyString == NULL) {                                  \
-                LOGFATAL("out of memory! ncOps=%s\n", ncOp);                   \
-                unlock_exit(1);                                                \
-            }                                                                  \
-            rbytes = timeread(filedes[0], pMeta->replyString, __len, timeout); \
-            if (rbytes <= 0) {                                                 \
-                killwait(pid);                                                 \
-                opFail = 1;                                                    \
-            }                                                                  \
-        }                                                                      \
-    }                                                                          \
+//!
+//! Makes sure this process holds a warm stub and a persistent worker for every
+//! node in the given cache before fanning out, so that the per-node children
+//! inherit them instead of each building its own.
+//!
+//! @param[in] cache the resource cache whose nodes will be called
+//!
+static void ncStubCacheWarm(ccResourceCache * cache)
+{
+    int i = 0;
+
+    for (i = 0; i < cache->numResources; i++) {
+        if (cache->resources[i].ncURL[0] != '\0') {
+            ncStubCacheGet(cache->resources[i].ncURL, TRUE);
+        }
+    }
+}
+
+//!
+//! Tells whether ncClientCall() may hand the given call to the persistent worker
+//! of a node. Only the polling calls of the fan-outs go there.
+//!
+//! @param[in] ncOp the name of the NC call
+//!
+//! @return TRUE if the call goes to the worker of the node when it has one
+//!
+static boolean ncWorkerOp(const char *ncOp)
+{
+    int i = 0;
+
+    for (i = 0; ncWorkerOps[i] != NULL; i++) {
+        if (!strcmp(ncOp, ncWorkerOps[i])) {
+            return (TRUE);
+        }
+    }
+    return (FALSE);
 }
 
+//!
+//! Forks the persistent worker of a cache entry. The worker inherits the warm stub
+//! and keeps its connection and WS-Security context from call to call, reading the
+//! requests of ncClientCall() from one pipe and answering on another. Must be called
+//! with ncStubCacheMutex held.
+//!
+//! @param[in] entry the cache entry, which must hold a stub and no worker
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the pipes or the process could not be created
+//!
+static int ncWorkerStart(ncStubCacheEntry * entry)
+{
     int i = 0;
-    int pid = 0;
-    int rc = 0;
-    int ret = 0;
-    int status = 0;
-    int opFail = 0;
-    int len = 0;
-    int rbytes = 0;
-    int filedes[2] = { 0 };
-    va_list al = { {0} };
+    int reqPipe[2] = { -1, -1 };
+    int rspPipe[2] = { -1, -1 };
+    pid_t pid = 0;
+    pid_t owner = getpid();
+    struct sigaction newsigact = { {0} };
+    sigset_t set;
+
+    if (pipe(reqPipe) != 0) {
+        LOGERROR("cannot create pipe for the worker of %s\n", entry->ncURL);
+        return (EUCA_ERROR);
+    }
 
-    LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", ncOp, ncURL, timeout);  // these are common
+    if (pipe(rspPipe) != 0) {
+        LOGERROR("cannot create pipe for the worker of %s\n", entry->ncURL);
+        close(reqPipe[0]);
+        close(reqPipe[1]);
+        return (EUCA_ERROR);
+    }
 
-    if ((rc = pipe(filedes)) != 0) {
-        LOGERROR("cannot create pipe ncOps=%s\n", ncOp);
-        return (1);
+    if ((pid = fork()) < 0) {
+        LOGERROR("cannot fork the worker of %s\n", entry->ncURL);
+        close(reqPipe[0]);
+        close(reqPipe[1]);
+        close(rspPipe[0]);
+        close(rspPipe[1]);
+        return (EUCA_ERROR);
     }
 
-    va_start(al, ncOp);
+    if (pid == 0) {
+        // the worker only keeps its own ends of its own pipes
+        for (i = 0; i < MAXNODES; i++) {
+            if (ncStubCache[i].workerPid) {
+                close(ncStubCache[i].workerReq);
+                close(ncStubCache[i].workerRsp);
+            }
+        }
+        close(reqPipe[1]);
+        close(rspPipe[0]);
+
+        // killwait() must be able to terminate the worker, and a caller going away must not
+        newsigact.sa_handler = SIG_DFL;
+        sigemptyset(&newsigact.sa_mask);
+        sigaction(SIGTERM, &newsigact, NULL);
+        sigaction(SIGINT, &newsigact, NULL);
+        newsigact.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &newsigact, NULL);
+        sigemptyset(&set);
+        sigaddset(&set, SIGTERM);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        termDeferred = FALSE;
+        bzero(mylocks, sizeof(int) * ENDLOCK);
 
-    // grab the lock
-    sem_mywait(ncLock);
+        ncWorkerMain(entry->stub, reqPipe[0], rspPipe[1], owner);
+        exit(0);
+    }
 
-    if ((pid = fork()) == 0) {
-        ncStub *ncs;
-        ncMetadata *localmeta = NULL;
+    close(reqPipe[0]);
+    close(rspPipe[1]);
+    fcntl(reqPipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(rspPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(reqPipe[1], F_SETFL, (fcntl(reqPipe[1], F_GETFL) | O_NONBLOCK));
+    fcntl(rspPipe[0], F_SETFL, (fcntl(rspPipe[0], F_GETFL) | O_NONBLOCK));
 
-        LOGTRACE("forked to service NC invocation: %s\n", ncOp);
-        localmeta = EUCA_ZALLOC(1, sizeof(ncMetadata));
-        if (!localmeta) {
-            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-            unlock_exit(1);
-        }
-        memcpy(localmeta, pMeta, sizeof(ncMetadata));
-        if (pMeta->correlationId) {
-            localmeta->correlationId = strdup(pMeta->correlationId);
-        } else {
-            localmeta->correlationId = strdup("unset");
+    entry->workerPid = pid;
+    entry->workerOwner = owner;
+    entry->workerReq = reqPipe[1];
+    entry->workerRsp = rspPipe[0];
+    LOGDEBUG("started worker %d for %s\n", pid, entry->ncURL);
+    return (EUCA_OK);
+}
+
+//!
+//! Gets rid of the persistent worker of a cache entry, if it has one. A worker still
+//! running is terminated, so a call that timed out cannot leave it stuck on the node;
+//! only the process that started it reaps it. Must be called with ncStubCacheMutex held.
+//!
+//! @param[in] entry the cache entry
+//!
+static void ncWorkerStop(ncStubCacheEntry * entry)
+{
+    int status = 0;
+    struct pollfd pfd = { 0 };
+
+    if (!entry->workerPid)
+        return;
+
+    if (entry->workerOwner == getpid()) {
+        if (waitpid(entry->workerPid, &status, WNOHANG) == 0) {
+            killwait(entry->workerPid);
         }
-        if (pMeta->userId) {
-            localmeta->userId = strdup(pMeta->userId);
-        } else {
-            localmeta->userId = strdup("eucalyptus");
+    } else {
+        // the worker is not our child, so only signal it while its end of the pipe shows it is still there
+        pfd.fd = entry->workerRsp;
+        pfd.events = POLLIN;
+        if ((poll(&pfd, 1, 0) >= 0) && !(pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+            kill(entry->workerPid, SIGKILL);
         }
+    }
 
-        //TODO: zhill, change this to only be invoked on DescribeInstances and/or DescribeResources?
-        //Update meta from config
-        if (populateOutboundMeta(localmeta)) {
-            LOGERROR("Failed to update output service metadata\n");
-        }
-        //Don't need to filter, CC should only have received.
-        //filter_services(localmeta, config->ccStatus.serviceId.partition);
+    LOGDEBUG("stopped worker %d for %s\n", entry->workerPid, entry->ncURL);
+    close(entry->workerReq);
+    close(entry->workerRsp);
+    entry->workerPid = 0;
+    entry->workerOwner = 0;
+    entry->workerReq = -1;
+    entry->workerRsp = -1;
+}
 
-        close(filedes[0]);
-        ncs = ncStubCreate(ncURL, NULL, NULL);
-        if (config->use_wssec) {
-            rc = InitWSSEC(ncs->env, ncs->stub, config->policyFile);
-        }
+//!
+//! Tells whether the persistent worker of a cache entry can take a request. A worker
+//! that exited, or that has a reply pending that nobody read, cannot.
+//!
+//! @param[in] entry the cache entry
+//!
+//! @return TRUE if the worker is there and idle, FALSE otherwise
+//!
+static boolean ncWorkerAlive(ncStubCacheEntry * entry)
+{
+    int status = 0;
+    struct pollfd pfd = { 0 };
 
-        LOGTRACE("\tncOps=%s ppid=%d client calling '%s'\n", ncOp, getppid(), ncOp);
-        if (!strcmp(ncOp, "ncGetConsoleOutput")) {
-            // args: char *instId
-            char *instId = va_arg(al, char *);
-            char **consoleOutput = va_arg(al, char **);
-
-            rc = ncGetConsoleOutputStub(ncs, localmeta, instId, consoleOutput);
-            if (timeout && consoleOutput) {
-                if (!rc && *consoleOutput) {
-                    len = strlen(*consoleOutput) + 1;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *consoleOutput, sizeof(char) * len);
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-        } else if (!strcmp(ncOp, "ncAttachVolume")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-            char *localDev = va_arg(al, char *);
-
-            rc = ncAttachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev);
-        } else if (!strcmp(ncOp, "ncDetachVolume")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-            char *localDev = va_arg(al, char *);
-            int force = va_arg(al, int);
-
-            rc = ncDetachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev, force);
-        }else if (!strcmp(ncOp, "ncAttachNetworkInterface")) {
-            char *instanceId = va_arg(al, char *);
-            netConfig *netCfg = va_arg(al, netConfig *);
-
-            rc = ncAttachNetworkInterfaceStub(ncs, localmeta, instanceId, netCfg);
-        } else if (!strcmp(ncOp, "ncDetachNetworkInterface")) {
-            char *instanceId = va_arg(al, char *);
-            char *attachmentId = va_arg(al, char *);
-            int force = va_arg(al, int);
-
-            rc = ncDetachNetworkInterfaceStub(ncs, localmeta, instanceId, attachmentId, force);
-        } else if (!strcmp(ncOp, "ncCreateImage")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-
-            rc = ncCreateImageStub(ncs, localmeta, instanceId, volumeId, remoteDev);
-        } else if (!strcmp(ncOp, "ncPowerDown")) {
-            rc = ncPowerDownStub(ncs, localmeta);
-        } else if (!strcmp(ncOp, "ncAssignAddress")) {
-            char *instanceId = va_arg(al, char *);
-            char *publicIp = va_arg(al, char *);
-
-            rc = ncAssignAddressStub(ncs, localmeta, instanceId, publicIp);
-        } else if (!strcmp(ncOp, "ncBroadcastNetworkInfo")) {
-            char *networkInfo = va_arg(al, char *);
-            rc = ncBroadcastNetworkInfoStub(ncs, localmeta, networkInfo);
-        } else if (!strcmp(ncOp, "ncRebootInstance")) {
-            char *instId = va_arg(al, char *);
-
-            rc = ncRebootInstanceStub(ncs, localmeta, instId);
-        } else if (!strcmp(ncOp, "ncTerminateInstance")) {
-            char *instId = va_arg(al, char *);
-            int force = va_arg(al, int);
-            int *shutdownState = va_arg(al, int *);
-            int *previousState = va_arg(al, int *);
+    if (!entry->workerPid)
+        return (FALSE);
 
-            rc = ncTerminateInstanceStub(ncs, localmeta, instId, force, shutdownState, previousState);
+    if ((entry->workerOwner == getpid()) && (waitpid(entry->workerPid, &status, WNOHANG) != 0))
+        return (FALSE);
 
-            if (timeout) {
-                if (!rc) {
-                    len = 2;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], shutdownState, sizeof(int));
-                    rc = write(filedes[1], previousState, sizeof(int));
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-        } else if (!strcmp(ncOp, "ncStartNetwork")) {   //! @TODO remove this NC call logic, since it is not used any more
-            char *uuid = va_arg(al, char *);
-            char **peers = va_arg(al, char **);
-            int peersLen = va_arg(al, int);
-            int port = va_arg(al, int);
-            int vlan = va_arg(al, int);
-            char **outStatus = va_arg(al, char **);
-
-            rc = ncStartNetworkStub(ncs, localmeta, uuid, peers, peersLen, port, vlan, outStatus);
-            if (timeout && outStatus) {
-                if (!rc && *outStatus) {
-                    len = strlen(*outStatus) + 1;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outStatus, sizeof(char) * len);
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
+    pfd.fd = entry->workerRsp;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) != 0)
+        return (FALSE);
 
-            if (outStatus)
-                EUCA_FREE(*outStatus);
-        } else if (!strcmp(ncOp, "ncRunInstance")) {
-            char *uuid = va_arg(al, char *);
-            char *instId = va_arg(al, char *);
-            char *reservationId = va_arg(al, char *);
-            virtualMachine *ncvm = va_arg(al, virtualMachine *);
-            char *imageId = va_arg(al, char *);
-            char *imageURL = va_arg(al, char *);
-            char *kernelId = va_arg(al, char *);
-            char *kernelURL = va_arg(al, char *);
-            char *ramdiskId = va_arg(al, char *);
-            char *ramdiskURL = va_arg(al, char *);
-            char *ownerId = va_arg(al, char *);
-            char *accountId = va_arg(al, char *);
-            char *keyName = va_arg(al, char *);
-            netConfig *ncnet = va_arg(al, netConfig *);
-            char *userData = va_arg(al, char *);
-            char *credential = va_arg(al, char *);
-            char *launchIndex = va_arg(al, char *);
-            char *platform = va_arg(al, char *);
-            int expiryTime = va_arg(al, int);
-            char **netNames = va_arg(al, char **);
-            int netNamesLen = va_arg(al, int);
-            char *rootDirective = va_arg(al, char *);
-            char **netIds = va_arg(al, char **);
-            int netIdsLen = va_arg(al, int);
-            netConfig * secNetCfgs = va_arg(al, netConfig *);
-            int secNetCfgsLen = va_arg(al, int);
-            ncInstance **outInst = va_arg(al, ncInstance **);
-
-            rc = ncRunInstanceStub(ncs, localmeta, uuid, instId, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
-                                   ownerId, accountId, keyName, ncnet, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, netIds,
-                                   netIdsLen, secNetCfgs, secNetCfgsLen, outInst);
-            if (timeout && outInst) {
-                if (!rc && *outInst) {
-                    len = sizeof(ncInstance);
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outInst, sizeof(ncInstance));
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
+    return (TRUE);
+}
 
-            if (outInst)
-                EUCA_FREE(*outInst);
-        } else if (!strcmp(ncOp, "ncDescribeInstances")) {
-            char **instIds = va_arg(al, char **);
-            int instIdsLen = va_arg(al, int);
-            ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
-            int *ncOutInstsLen = va_arg(al, int *);
+//!
+//! Looks up the persistent worker of the given endpoint, dropping it if it cannot
+//! take a request any more.
+//!
+//! @param[in]  ncURL the NC endpoint URL
+//! @param[out] pid the process of the worker
+//! @param[out] reqFd where to write the request
+//! @param[out] rspFd where to read the reply
+//!
+//! @return TRUE if the endpoint has a worker ready for a request, FALSE otherwise
+//!
+static boolean ncWorkerGet(char *ncURL, int *pid, int *reqFd, int *rspFd)
+{
+    int i = 0;
+    boolean ret = FALSE;
 
-            rc = ncDescribeInstancesStub(ncs, localmeta, instIds, instIdsLen, ncOutInsts, ncOutInstsLen);
-            if (timeout && ncOutInsts && ncOutInstsLen) {
-                if (!rc) {
-                    len = *ncOutInstsLen;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    for (i = 0; i < len; i++) {
-                        ncInstance *inst;
-                        inst = (*ncOutInsts)[i];
-                        rc = write(filedes[1], inst, sizeof(ncInstance));
-                    }
-                    rc = 0;
+    pthread_mutex_lock(&ncStubCacheMutex);
+    {
+        for (i = 0; i < MAXNODES; i++) {
+            if (ncStubCache[i].stub && ncStubCache[i].workerPid && !strcmp(ncStubCache[i].ncURL, ncURL)) {
+                if (ncWorkerAlive(&(ncStubCache[i]))) {
+                    *pid = ncStubCache[i].workerPid;
+                    *reqFd = ncStubCache[i].workerReq;
+                    *rspFd = ncStubCache[i].workerRsp;
+                    ret = TRUE;
                 } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
+                    ncWorkerStop(&(ncStubCache[i]));
                 }
+                break;
             }
+        }
+    }
+    pthread_mutex_unlock(&ncStubCacheMutex);
 
-            if (ncOutInsts) {
-                if (ncOutInstsLen) {
-                    for (i = 0; i < (*ncOutInstsLen); i++) {
-                        EUCA_FREE((*ncOutInsts)[i]);
-                    }
-                }
-                EUCA_FREE(*ncOutInsts);
-            }
-        } else if (!strcmp(ncOp, "ncDescribeResource")) {
-            char *resourceType = va_arg(al, char *);
-            ncResource **outRes = va_arg(al, ncResource **);
-            char **errMsg = va_arg(al, char **);
+    return (ret);
+}
 
-            LOGTRACE("\tcalling ncDescribeResourceStub with resourceType=%s outRes=%lx errMsg=%lx\n", resourceType, (unsigned long)outRes, (unsigned long)errMsg);
-            rc = ncDescribeResourceStub(ncs, localmeta, resourceType, outRes);
-            LOGTRACE("\tcalled  ncDescribeResourceStub, rc = %d, timeout = %d\n", rc, timeout);
-            if (timeout && outRes) {
-                if (!rc && *outRes) {
-                    len = sizeof(ncResource);
-                    rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outRes, sizeof(ncResource));
-                    rc = 0;
-                } else {
-                    (*errMsg) = (char *)axutil_error_get_message(ncs->env->error);
-                    LOGTRACE("\terrMsg = %s\n", *errMsg);
-                    if (*errMsg && (len = strnlen(*errMsg, 1024 - 1))) {
-                        len += 1;
-                        rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                        rc = write(filedes[1], &len, sizeof(int));
-                        rc = write(filedes[1], *errMsg, sizeof(char) * len);
-                    } else {
-                        len = 0;
-                        rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                        rc = write(filedes[1], &len, sizeof(int));
-                    }
-                    rc = 1;
+//!
+//! Appends bytes to a worker request
+//!
+//! @param[in] wb the request
+//! @param[in] src the bytes to append
+//! @param[in] len the number of bytes
+//!
+static void ncWorkerPut(ncWorkerBuf * wb, const void *src, int len)
+{
+    char *data = NULL;
+
+    if (wb->bad || (len <= 0))
+        return;
+
+    if ((data = EUCA_REALLOC(wb->data, (wb->len + len), sizeof(char))) == NULL) {
+        wb->bad = TRUE;
+        return;
+    }
+    memcpy(data + wb->len, src, len);
+    wb->data = data;
+    wb->len += len;
+}
+
+//!
+//! Appends a string, which may be NULL, to a worker request
+//!
+//! @param[in] wb the request
+//! @param[in] str the string
+//!
+static void ncWorkerPutStr(ncWorkerBuf * wb, const char *str)
+{
+    int len = ((str != NULL) ? strlen(str) : -1);
+
+    ncWorkerPut(wb, &len, sizeof(int));
+    ncWorkerPut(wb, str, len);
+}
+
+//!
+//! Appends an array of strings to a worker request
+//!
+//! @param[in] wb the request
+//! @param[in] strs the strings
+//! @param[in] len the number of strings
+//!
+static void ncWorkerPutStrs(ncWorkerBuf * wb, char **strs, int len)
+{
+    int i = 0;
+
+    if (strs == NULL)
+        len = 0;
+
+    ncWorkerPut(wb, &len, sizeof(int));
+    for (i = 0; i < len; i++) {
+        ncWorkerPutStr(wb, strs[i]);
+    }
+}
+
+//!
+//! Takes the next bytes out of a worker request
+//!
+//! @param[in]  wb the request
+//! @param[out] dst where to copy the bytes
+//! @param[in]  len the number of bytes
+//!
+static void ncWorkerTake(ncWorkerBuf * wb, void *dst, int len)
+{
+    if (wb->bad || (len < 0) || (len > (wb->len - wb->pos))) {
+        wb->bad = TRUE;
+        return;
+    }
+    memcpy(dst, wb->data + wb->pos, len);
+    wb->pos += len;
+}
+
+//!
+//! Takes the next string out of a worker request
+//!
+//! @param[in] wb the request
+//!
+//! @return a newly allocated string, or NULL if the string was NULL or the request is malformed
+//!
+static char *ncWorkerTakeStr(ncWorkerBuf * wb)
+{
+    int len = 0;
+    char *str = NULL;
+
+    ncWorkerTake(wb, &len, sizeof(int));
+    if (wb->bad || (len == -1))
+        return (NULL);
+
+    if ((len < -1) || (len > (wb->len - wb->pos)) || ((str = EUCA_ALLOC((len + 1), sizeof(char))) == NULL)) {
+        wb->bad = TRUE;
+        return (NULL);
+    }
+    ncWorkerTake(wb, str, len);
+    str[len] = '\0';
+    return (str);
+}
+
+//!
+//! Takes the next array of strings out of a worker request
+//!
+//! @param[in]  wb the request
+//! @param[out] len the number of strings
+//!
+//! @return a newly allocated array of strings, or NULL if it is empty or the request is malformed
+//!
+static char **ncWorkerTakeStrs(ncWorkerBuf * wb, int *len)
+{
+    int i = 0;
+    int n = 0;
+    char **strs = NULL;
+
+    *len = 0;
+    ncWorkerTake(wb, &n, sizeof(int));
+    if (wb->bad || (n == 0))
+        return (NULL);
+
+    // every string takes at least its length
+    if ((n < 0) || (n > ((wb->len - wb->pos) / (int)sizeof(int))) || ((strs = EUCA_ZALLOC(n, sizeof(char *))) == NULL)) {
+        wb->bad = TRUE;
+        return (NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+        strs[i] = ncWorkerTakeStr(wb);
+    }
+    *len = n;
+    return (strs);
+}
+
+//!
+//! Frees an array of strings taken out of a worker request
+//!
+//! @param[in,out] strs the array, set to NULL
+//! @param[in]     len the number of strings
+//!
+static void ncWorkerFreeStrs(char ***strs, int len)
+{
+    int i = 0;
+
+    if (*strs) {
+        for (i = 0; i < len; i++) {
+            EUCA_FREE((*strs)[i]);
+        }
+        EUCA_FREE(*strs);
+    }
+}
+
+//!
+//! Writes a request to the non-blocking pipe of a worker. A worker that went away
+//! is reported as an error rather than by SIGPIPE.
+//!
+//! @param[in] fd the write end of the request pipe
+//! @param[in] buf the request
+//! @param[in] len the number of bytes in the request
+//! @param[in] timeout how long to wait for the worker to make room in the pipe, in seconds
+//!
+//! @return EUCA_OK if the whole request was written or EUCA_ERROR otherwise
+//!
+static int ncWorkerSend(int fd, const char *buf, int len, int timeout)
+{
+    int rc = 0;
+    int sent = 0;
+    sigset_t set;
+    sigset_t oldset;
+    struct pollfd pfd = { 0 };
+    struct timespec zero = { 0 };
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, &oldset);
+
+    while (sent < len) {
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if ((rc = poll(&pfd, 1, (timeout * 1000))) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        } else if (rc == 0) {
+            LOGERROR("poll() timed out for write: timeout=%d\n", timeout);
+            break;
+        }
+
+        if ((rc = write(fd, buf + sent, (len - sent))) < 0) {
+            if ((errno == EAGAIN) || (errno == EINTR))
+                continue;
+            break;
+        }
+        sent += rc;
+    }
+
+    // consume the SIGPIPE of a worker that went away before letting the signal through again
+    if ((sent < len) && !sigismember(&oldset, SIGPIPE)) {
+        while (sigtimedwait(&set, NULL, &zero) > 0) ;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    return ((sent == len) ? EUCA_OK : EUCA_ERROR);
+}
+
+//!
+//! Sends one of the polling calls to the persistent worker of a node. The request
+//! carries the metadata, already completed by ncClientCallMeta(), and the input
+//! arguments of the call, and tells the worker which outputs the caller wants.
+//!
+//! @param[in] localmeta the metadata of the call
+//! @param[in] timeout the timeout of the call
+//! @param[in] fd the write end of the request pipe of the worker
+//! @param[in] seq the sequence number the worker echoes at the start of its reply
+//! @param[in] ncOp the name of the NC call
+//! @param[in] al the arguments of the call, as given to ncClientCall()
+//!
+//! @return EUCA_OK if the request was sent or EUCA_ERROR otherwise
+//!
+static int ncWorkerRequest(ncMetadata * localmeta, int timeout, int fd, int seq, char *ncOp, va_list al)
+{
+    int rc = 0;
+    int len = 0;
+    int hasOut = 0;
+    ncWorkerBuf wb = { 0 };
+
+    // the length of the request goes first, filled in once it is known
+    ncWorkerPut(&wb, &len, sizeof(int));
+    ncWorkerPutStr(&wb, ncOp);
+    ncWorkerPut(&wb, &timeout, sizeof(int));
+    ncWorkerPut(&wb, &seq, sizeof(int));
+    ncWorkerPut(&wb, localmeta, sizeof(ncMetadata));
+    ncWorkerPutStr(&wb, localmeta->correlationId);
+    ncWorkerPutStr(&wb, localmeta->userId);
+    ncWorkerPutStr(&wb, localmeta->nodeName);
+
+    if (!strcmp(ncOp, "ncDescribeResource")) {
+        char *resourceType = va_arg(al, char *);
+        ncResource **outRes = va_arg(al, ncResource **);
+
+        hasOut = (outRes != NULL);
+        ncWorkerPutStr(&wb, resourceType);
+        ncWorkerPut(&wb, &hasOut, sizeof(int));
+    } else if (!strcmp(ncOp, "ncDescribeInstances")) {
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+
+        hasOut = (ncOutInsts && ncOutInstsLen);
+        ncWorkerPutStrs(&wb, instIds, instIdsLen);
+        ncWorkerPut(&wb, &hasOut, sizeof(int));
+    } else if (!strcmp(ncOp, "ncDescribeInstancesDelta")) {
+        long long sinceGeneration = va_arg(al, long long);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+        char ***removedIds = va_arg(al, char ***);
+        int *removedIdsLen = va_arg(al, int *);
+        long long *generation = va_arg(al, long long *);
+        boolean *delta = va_arg(al, boolean *);
+
+        hasOut = (ncOutInsts && ncOutInstsLen && removedIds && removedIdsLen && generation && delta);
+        ncWorkerPut(&wb, &sinceGeneration, sizeof(long long));
+        ncWorkerPut(&wb, &hasOut, sizeof(int));
+    } else if (!strcmp(ncOp, "ncDescribeSensors")) {
+        int history_size = va_arg(al, int);
+        long long collection_interval_time_ms = va_arg(al, long long);
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        char **sensorIds = va_arg(al, char **);
+        int sensorIdsLen = va_arg(al, int);
+        sensorResource ***srs = va_arg(al, sensorResource ***);
+        int *srsLen = va_arg(al, int *);
+
+        hasOut = (srs && srsLen);
+        ncWorkerPut(&wb, &history_size, sizeof(int));
+        ncWorkerPut(&wb, &collection_interval_time_ms, sizeof(long long));
+        ncWorkerPutStrs(&wb, instIds, instIdsLen);
+        ncWorkerPutStrs(&wb, sensorIds, sensorIdsLen);
+        ncWorkerPut(&wb, &hasOut, sizeof(int));
+    } else {
+        LOGERROR("BUG: '%s' cannot be sent to a worker\n", ncOp);
+        wb.bad = TRUE;
+    }
+
+    if (wb.bad) {
+        rc = EUCA_ERROR;
+    } else {
+        len = wb.len - sizeof(int);
+        memcpy(wb.data, &len, sizeof(int));
+        rc = ncWorkerSend(fd, wb.data, wb.len, timeout);
+    }
+    EUCA_FREE(wb.data);
+    return (rc);
+}
+
+//!
+//! Serves one request in a persistent worker: rebuilds the call sent by
+//! ncWorkerRequest() and makes it with the warm stub.
+//!
+//! @param[in] stub the warm stub of the worker
+//! @param[in] wb the request, without its length
+//! @param[in] fd the write end of the reply pipe
+//!
+//! @return EUCA_OK if the request was served or EUCA_ERROR if it was malformed
+//!
+static int ncWorkerServe(ncStub * stub, ncWorkerBuf * wb, int fd)
+{
+    int seq = 0;
+    int timeout = 0;
+    int hasOut = 0;
+    char *ncOp = NULL;
+    ncMetadata meta = { 0 };
+
+    ncOp = ncWorkerTakeStr(wb);
+    ncWorkerTake(wb, &timeout, sizeof(int));
+    ncWorkerTake(wb, &seq, sizeof(int));
+    ncWorkerTake(wb, &meta, sizeof(ncMetadata));
+    meta.correlationId = ncWorkerTakeStr(wb);
+    meta.userId = ncWorkerTakeStr(wb);
+    meta.nodeName = ncWorkerTakeStr(wb);
+    meta.replyString = NULL;
+
+    if (wb->bad || (ncOp == NULL)) {
+        wb->bad = TRUE;
+    } else if (!strcmp(ncOp, "ncDescribeResource")) {
+        char *resourceType = ncWorkerTakeStr(wb);
+        ncResource *outRes = NULL;
+        char *errMsg = NULL;
+
+        ncWorkerTake(wb, &hasOut, sizeof(int));
+        if (!wb->bad) {
+            ncWorkerCall(stub, &meta, timeout, fd, seq, ncOp, resourceType, (hasOut ? &outRes : NULL), &errMsg);
+        }
+        EUCA_FREE(resourceType);
+    } else if (!strcmp(ncOp, "ncDescribeInstances")) {
+        int instIdsLen = 0;
+        char **instIds = ncWorkerTakeStrs(wb, &instIdsLen);
+        ncInstance **outInsts = NULL;
+        int outInstsLen = 0;
+
+        ncWorkerTake(wb, &hasOut, sizeof(int));
+        if (!wb->bad) {
+            ncWorkerCall(stub, &meta, timeout, fd, seq, ncOp, instIds, instIdsLen, (hasOut ? &outInsts : NULL), (hasOut ? &outInstsLen : NULL));
+        }
+        ncWorkerFreeStrs(&instIds, instIdsLen);
+    } else if (!strcmp(ncOp, "ncDescribeInstancesDelta")) {
+        long long sinceGeneration = 0;
+        ncInstance **outInsts = NULL;
+        int outInstsLen = 0;
+        char **removedIds = NULL;
+        int removedIdsLen = 0;
+        long long generation = 0;
+        boolean delta = FALSE;
+
+        ncWorkerTake(wb, &sinceGeneration, sizeof(long long));
+        ncWorkerTake(wb, &hasOut, sizeof(int));
+        if (!wb->bad) {
+            ncWorkerCall(stub, &meta, timeout, fd, seq, ncOp, sinceGeneration, (hasOut ? &outInsts : NULL), (hasOut ? &outInstsLen : NULL),
+                         (hasOut ? &removedIds : NULL), (hasOut ? &removedIdsLen : NULL), (hasOut ? &generation : NULL), (hasOut ? &delta : NULL));
+        }
+    } else if (!strcmp(ncOp, "ncDescribeSensors")) {
+        int history_size = 0;
+        long long collection_interval_time_ms = 0L;
+        int instIdsLen = 0;
+        char **instIds = NULL;
+        int sensorIdsLen = 0;
+        char **sensorIds = NULL;
+        sensorResource **srs = NULL;
+        int srsLen = 0;
+
+        ncWorkerTake(wb, &history_size, sizeof(int));
+        ncWorkerTake(wb, &collection_interval_time_ms, sizeof(long long));
+        instIds = ncWorkerTakeStrs(wb, &instIdsLen);
+        sensorIds = ncWorkerTakeStrs(wb, &sensorIdsLen);
+        ncWorkerTake(wb, &hasOut, sizeof(int));
+        if (!wb->bad) {
+            ncWorkerCall(stub, &meta, timeout, fd, seq, ncOp, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen,
+                         (hasOut ? &srs : NULL), (hasOut ? &srsLen : NULL));
+        }
+        ncWorkerFreeStrs(&instIds, instIdsLen);
+        ncWorkerFreeStrs(&sensorIds, sensorIdsLen);
+    } else {
+        LOGERROR("worker got a request for '%s', which it does not serve\n", ncOp);
+        wb->bad = TRUE;
+    }
+
+    EUCA_FREE(ncOp);
+    EUCA_FREE(meta.correlationId);
+    EUCA_FREE(meta.userId);
+    EUCA_FREE(meta.nodeName);
+    EUCA_FREE(meta.replyString);
+    return ((wb->bad) ? EUCA_ERROR : EUCA_OK);
+}
+
+//!
+//! Main loop of a persistent worker. Serves requests until the request pipe is
+//! closed, a request is malformed, it has served NC_WORKER_MAX_CALLS calls, or
+//! the process that started it is gone.
+//!
+//! @param[in] stub the warm stub inherited from the owner
+//! @param[in] reqFd the read end of the request pipe
+//! @param[in] rspFd the write end of the reply pipe
+//! @param[in] owner the process that started the worker
+//!
+static void ncWorkerMain(ncStub * stub, int reqFd, int rspFd, pid_t owner)
+{
+    int rc = 0;
+    int len = 0;
+    int calls = 0;
+    ncWorkerBuf wb = { 0 };
+    struct pollfd pfd = { 0 };
+
+    while (calls < NC_WORKER_MAX_CALLS) {
+        pfd.fd = reqFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        rc = poll(&pfd, 1, 1000);
+        if (getppid() != owner) {
+            break;
+        } else if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        } else if (rc == 0) {
+            continue;
+        }
+
+        if ((ncClientRead(reqFd, &len, sizeof(int), OP_TIMEOUT) <= 0) || (len <= 0) || (len > NC_WORKER_MAX_REQUEST))
+            break;
+
+        bzero(&wb, sizeof(ncWorkerBuf));
+        if ((wb.data = EUCA_ALLOC(len, sizeof(char))) == NULL)
+            break;
+        wb.len = len;
+
+        if (ncClientRead(reqFd, wb.data, len, OP_TIMEOUT) <= 0) {
+            EUCA_FREE(wb.data);
+            break;
+        }
+
+        rc = ncWorkerServe(stub, &wb, rspFd);
+        EUCA_FREE(wb.data);
+        if (rc != EUCA_OK)
+            break;
+        calls++;
+    }
+
+    close(reqFd);
+    close(rspFd);
+}
+
+//!
+//! Makes one call in a persistent worker and writes its reply: the sequence number
+//! of the request, the outputs as ncClientCallStub() writes them, and the return
+//! code of the call.
+//!
+//! @param[in] ncs the warm stub of the worker
+//! @param[in] localmeta the metadata of the call
+//! @param[in] timeout the timeout of the call
+//! @param[in] fd the write end of the reply pipe
+//! @param[in] seq the sequence number of the request
+//! @param[in] ncOp the name of the NC call
+//! @param[in] ... the arguments of the call
+//!
+//! @return the return code of the call
+//!
+static int ncWorkerCall(ncStub * ncs, ncMetadata * localmeta, int timeout, int fd, int seq, char *ncOp, ...)
+{
+    int rc = 0;
+    va_list al = { {0} };
+
+    rc = write(fd, &seq, sizeof(int));
+
+    va_start(al, ncOp);
+    rc = ncClientCallStub(ncs, localmeta, timeout, fd, ncOp, al);
+    va_end(al);
+
+    if (write(fd, &rc, sizeof(int)) != sizeof(int)) {
+        LOGWARN("cannot write the reply to '%s'\n", ncOp);
+    }
+    return (rc);
+}
+
+//!
+//! Builds the metadata an NC call goes out with: a copy of the caller's, with the
+//! defaults filled in and the services updated from the configuration.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//!
+//! @return the new metadata, to be freed with ncClientCallMetaFree(), or NULL if out of memory
+//!
+static ncMetadata *ncClientCallMeta(ncMetadata * pMeta)
+{
+    ncMetadata *localmeta = NULL;
+
+    if ((localmeta = EUCA_ZALLOC(1, sizeof(ncMetadata))) == NULL)
+        return (NULL);
+
+    memcpy(localmeta, pMeta, sizeof(ncMetadata));
+    localmeta->replyString = NULL;
+    if (pMeta->correlationId) {
+        localmeta->correlationId = strdup(pMeta->correlationId);
+    } else {
+        localmeta->correlationId = strdup("unset");
+    }
+    if (pMeta->userId) {
+        localmeta->userId = strdup(pMeta->userId);
+    } else {
+        localmeta->userId = strdup("eucalyptus");
+    }
+
+    //TODO: zhill, change this to only be invoked on DescribeInstances and/or DescribeResources?
+    //Update meta from config
+    if (populateOutboundMeta(localmeta)) {
+        LOGERROR("Failed to update output service metadata\n");
+    }
+    //Don't need to filter, CC should only have received.
+    //filter_services(localmeta, config->ccStatus.serviceId.partition);
+
+    return (localmeta);
+}
+
+//!
+//! Frees metadata built by ncClientCallMeta()
+//!
+//! @param[in,out] ppMeta the metadata, set to NULL
+//!
+static void ncClientCallMetaFree(ncMetadata ** ppMeta)
+{
+    if (*ppMeta) {
+        EUCA_FREE((*ppMeta)->replyString);
+        EUCA_FREE((*ppMeta)->correlationId);
+        EUCA_FREE((*ppMeta)->userId);
+        EUCA_FREE(*ppMeta);
+    }
+}
+
+//!
+//! Makes an NC call with the given stub and writes its outputs to a pipe, for
+//! ncClientCall() to read back. Runs in the child forked for the call or in the
+//! persistent worker of the node.
+//!
+//! @param[in] ncs the stub to call with
+//! @param[in] localmeta the metadata of the call
+//! @param[in] timeout the timeout of the call, the outputs are only written if nonzero
+//! @param[in] fd where to write the outputs
+//! @param[in] ncOp the name of the NC call
+//! @param[in] al the arguments of the call
+//!
+//! @return the return code of the call
+//!
+static int ncClientCallStub(ncStub * ncs, ncMetadata * localmeta, int timeout, int fd, char *ncOp, va_list al)
+{
+#define WRITE_REPLY_STRING                                                         \
+{                                                                                  \
+    if (timeout) {                                                                 \
+        int __len = 0;                                                             \
+        if (localmeta->replyString) {                                              \
+            __len = strlen(localmeta->replyString);                                \
+        }                                                                          \
+        int __bytes = write(fd, &__len, sizeof(int));                              \
+        if (__len > 0) {                                                           \
+            __bytes += write(fd, localmeta->replyString, (sizeof(char) * __len));  \
+        }                                                                          \
+        LOGTRACE("child process wrote %d bytes (len=%d)\n", __bytes, __len);       \
+    }                                                                              \
+}
+
+    int i = 0;
+    int len = 0;
+    int rc = 0;
+
+    if (!strcmp(ncOp, "ncGetConsoleOutput")) {
+        // args: char *instId
+        char *instId = va_arg(al, char *);
+        char **consoleOutput = va_arg(al, char **);
+
+        rc = ncGetConsoleOutputStub(ncs, localmeta, instId, consoleOutput);
+        if (timeout && consoleOutput) {
+            if (!rc && *consoleOutput) {
+                len = strlen(*consoleOutput) + 1;
+                rc = write(fd, &len, sizeof(int));
+                rc = write(fd, *consoleOutput, sizeof(char) * len);
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+    } else if (!strcmp(ncOp, "ncAttachVolume")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+        char *localDev = va_arg(al, char *);
+
+        rc = ncAttachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev);
+    } else if (!strcmp(ncOp, "ncDetachVolume")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+        char *localDev = va_arg(al, char *);
+        int force = va_arg(al, int);
+
+        rc = ncDetachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev, force);
+    }else if (!strcmp(ncOp, "ncAttachNetworkInterface")) {
+        char *instanceId = va_arg(al, char *);
+        netConfig *netCfg = va_arg(al, netConfig *);
+
+        rc = ncAttachNetworkInterfaceStub(ncs, localmeta, instanceId, netCfg);
+    } else if (!strcmp(ncOp, "ncDetachNetworkInterface")) {
+        char *instanceId = va_arg(al, char *);
+        char *attachmentId = va_arg(al, char *);
+        int force = va_arg(al, int);
+
+        rc = ncDetachNetworkInterfaceStub(ncs, localmeta, instanceId, attachmentId, force);
+    } else if (!strcmp(ncOp, "ncCreateImage")) {
+        char *instanceId = va_arg(al, char *);
+        char *volumeId = va_arg(al, char *);
+        char *remoteDev = va_arg(al, char *);
+
+        rc = ncCreateImageStub(ncs, localmeta, instanceId, volumeId, remoteDev);
+    } else if (!strcmp(ncOp, "ncPowerDown")) {
+        rc = ncPowerDownStub(ncs, localmeta);
+    } else if (!strcmp(ncOp, "ncAssignAddress")) {
+        char *instanceId = va_arg(al, char *);
+        char *publicIp = va_arg(al, char *);
+
+        rc = ncAssignAddressStub(ncs, localmeta, instanceId, publicIp);
+    } else if (!strcmp(ncOp, "ncBroadcastNetworkInfo")) {
+        char *networkInfo = va_arg(al, char *);
+        rc = ncBroadcastNetworkInfoStub(ncs, localmeta, networkInfo);
+    } else if (!strcmp(ncOp, "ncRebootInstance")) {
+        char *instId = va_arg(al, char *);
+
+        rc = ncRebootInstanceStub(ncs, localmeta, instId);
+    } else if (!strcmp(ncOp, "ncTerminateInstance")) {
+        char *instId = va_arg(al, char *);
+        int force = va_arg(al, int);
+        int *shutdownState = va_arg(al, int *);
+        int *previousState = va_arg(al, int *);
+
+        rc = ncTerminateInstanceStub(ncs, localmeta, instId, force, shutdownState, previousState);
+
+        if (timeout) {
+            if (!rc) {
+                len = 2;
+                rc = write(fd, &len, sizeof(int));
+                rc = write(fd, shutdownState, sizeof(int));
+                rc = write(fd, previousState, sizeof(int));
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+    } else if (!strcmp(ncOp, "ncStartNetwork")) {   //! @TODO remove this NC call logic, since it is not used any more
+        char *uuid = va_arg(al, char *);
+        char **peers = va_arg(al, char **);
+        int peersLen = va_arg(al, int);
+        int port = va_arg(al, int);
+        int vlan = va_arg(al, int);
+        char **outStatus = va_arg(al, char **);
+
+        rc = ncStartNetworkStub(ncs, localmeta, uuid, peers, peersLen, port, vlan, outStatus);
+        if (timeout && outStatus) {
+            if (!rc && *outStatus) {
+                len = strlen(*outStatus) + 1;
+                rc = write(fd, &len, sizeof(int));
+                rc = write(fd, *outStatus, sizeof(char) * len);
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+
+        if (outStatus)
+            EUCA_FREE(*outStatus);
+    } else if (!strcmp(ncOp, "ncRunInstance")) {
+        char *uuid = va_arg(al, char *);
+        char *instId = va_arg(al, char *);
+        char *reservationId = va_arg(al, char *);
+        virtualMachine *ncvm = va_arg(al, virtualMachine *);
+        char *imageId = va_arg(al, char *);
+        char *imageURL = va_arg(al, char *);
+        char *kernelId = va_arg(al, char *);
+        char *kernelURL = va_arg(al, char *);
+        char *ramdiskId = va_arg(al, char *);
+        char *ramdiskURL = va_arg(al, char *);
+        char *ownerId = va_arg(al, char *);
+        char *accountId = va_arg(al, char *);
+        char *keyName = va_arg(al, char *);
+        netConfig *ncnet = va_arg(al, netConfig *);
+        char *userData = va_arg(al, char *);
+        char *credential = va_arg(al, char *);
+        char *launchIndex = va_arg(al, char *);
+        char *platform = va_arg(al, char *);
+        int expiryTime = va_arg(al, int);
+        char **netNames = va_arg(al, char **);
+        int netNamesLen = va_arg(al, int);
+        char *rootDirective = va_arg(al, char *);
+        char **netIds = va_arg(al, char **);
+        int netIdsLen = va_arg(al, int);
+        netConfig * secNetCfgs = va_arg(al, netConfig *);
+        int secNetCfgsLen = va_arg(al, int);
+        ncInstance **outInst = va_arg(al, ncInstance **);
+
+        rc = ncRunInstanceStub(ncs, localmeta, uuid, instId, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
+                               ownerId, accountId, keyName, ncnet, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, netIds,
+                               netIdsLen, secNetCfgs, secNetCfgsLen, outInst);
+        if (timeout && outInst) {
+            if (!rc && *outInst) {
+                len = sizeof(ncInstance);
+                rc = write(fd, &len, sizeof(int));
+                rc = write(fd, *outInst, sizeof(ncInstance));
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+
+        if (outInst)
+            EUCA_FREE(*outInst);
+    } else if (!strcmp(ncOp, "ncDescribeInstances")) {
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+
+        rc = ncDescribeInstancesStub(ncs, localmeta, instIds, instIdsLen, ncOutInsts, ncOutInstsLen);
+        if (timeout && ncOutInsts && ncOutInstsLen) {
+            if (!rc) {
+                len = *ncOutInstsLen;
+                rc = write(fd, &len, sizeof(int));
+                for (i = 0; i < len; i++) {
+                    ncInstance *inst;
+                    inst = (*ncOutInsts)[i];
+                    rc = write(fd, inst, sizeof(ncInstance));
                 }
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
             }
+        }
 
-            if (outRes)
-                EUCA_FREE(*outRes);
-        } else if (!strcmp(ncOp, "ncDescribeSensors")) {
-            int history_size = va_arg(al, int);
-            long long collection_interval_time_ms = va_arg(al, long long);
-            char **instIds = va_arg(al, char **);
-            int instIdsLen = va_arg(al, int);
-            char **sensorIds = va_arg(al, char **);
-            int sensorIdsLen = va_arg(al, int);
-            sensorResource ***srs = va_arg(al, sensorResource ***);
-            int *srsLen = va_arg(al, int *);
-
-            rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, srs, srsLen);
-            if (timeout && srs && srsLen) {
-                if (!rc) {
-                    len = *srsLen;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    for (i = 0; i < len; i++) {
-                        sensorResource *sr;
-                        sr = (*srs)[i];
-                        rc = write(filedes[1], sr, sizeof(sensorResource));
-                    }
-                    rc = 0;
+        if (ncOutInsts) {
+            if (ncOutInstsLen) {
+                for (i = 0; i < (*ncOutInstsLen); i++) {
+                    EUCA_FREE((*ncOutInsts)[i]);
+                }
+            }
+            EUCA_FREE(*ncOutInsts);
+        }
+    } else if (!strcmp(ncOp, "ncDescribeInstancesDelta")) {
+        long long sinceGeneration = va_arg(al, long long);
+        ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
+        int *ncOutInstsLen = va_arg(al, int *);
+        char ***removedIds = va_arg(al, char ***);
+        int *removedIdsLen = va_arg(al, int *);
+        long long *generation = va_arg(al, long long *);
+        boolean *delta = va_arg(al, boolean *);
+
+        rc = ncDescribeInstancesDeltaStub(ncs, localmeta, sinceGeneration, ncOutInsts, ncOutInstsLen, removedIds, removedIdsLen, generation, delta);
+        if (timeout && ncOutInsts && ncOutInstsLen && removedIds && removedIdsLen && generation && delta) {
+            if (!rc) {
+                len = *ncOutInstsLen;
+                rc = write(fd, &len, sizeof(int));
+                for (i = 0; i < len; i++) {
+                    rc = write(fd, (*ncOutInsts)[i], sizeof(ncInstance));
+                }
+                rc = write(fd, removedIdsLen, sizeof(int));
+                for (i = 0; i < (*removedIdsLen); i++) {
+                    len = strlen((*removedIds)[i]) + 1;
+                    rc = write(fd, &len, sizeof(int));
+                    rc = write(fd, (*removedIds)[i], sizeof(char) * len);
+                }
+                rc = write(fd, generation, sizeof(long long));
+                rc = write(fd, delta, sizeof(boolean));
+                rc = 0;
+            } else {
+                // no instances and a removed count of -1 mark the error
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                len = -1;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+
+        if (ncOutInsts) {
+            if (ncOutInstsLen) {
+                for (i = 0; i < (*ncOutInstsLen); i++) {
+                    EUCA_FREE((*ncOutInsts)[i]);
+                }
+            }
+            EUCA_FREE(*ncOutInsts);
+        }
+        if (removedIds) {
+            if (removedIdsLen) {
+                for (i = 0; i < (*removedIdsLen); i++) {
+                    EUCA_FREE((*removedIds)[i]);
+                }
+            }
+            EUCA_FREE(*removedIds);
+        }
+    } else if (!strcmp(ncOp, "ncDescribeResource")) {
+        char *resourceType = va_arg(al, char *);
+        ncResource **outRes = va_arg(al, ncResource **);
+        char **errMsg = va_arg(al, char **);
+
+        LOGTRACE("\tcalling ncDescribeResourceStub with resourceType=%s outRes=%lx errMsg=%lx\n", resourceType, (unsigned long)outRes, (unsigned long)errMsg);
+        rc = ncDescribeResourceStub(ncs, localmeta, resourceType, outRes);
+        LOGTRACE("\tcalled  ncDescribeResourceStub, rc = %d, timeout = %d\n", rc, timeout);
+        if (timeout && outRes) {
+            if (!rc && *outRes) {
+                len = sizeof(ncResource);
+                rc = write(fd, &rc, sizeof(int));   //NOTE: we write back rc as well
+                rc = write(fd, &len, sizeof(int));
+                rc = write(fd, *outRes, sizeof(ncResource));
+                rc = 0;
+            } else {
+                (*errMsg) = (char *)axutil_error_get_message(ncs->env->error);
+                LOGTRACE("\terrMsg = %s\n", *errMsg);
+                if (*errMsg && (len = strnlen(*errMsg, 1024 - 1))) {
+                    len += 1;
+                    rc = write(fd, &rc, sizeof(int));   //NOTE: we write back rc as well
+                    rc = write(fd, &len, sizeof(int));
+                    rc = write(fd, *errMsg, sizeof(char) * len);
                 } else {
                     len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
+                    rc = write(fd, &rc, sizeof(int));   //NOTE: we write back rc as well
+                    rc = write(fd, &len, sizeof(int));
                 }
+                rc = 1;
             }
+        }
 
-            if (srs) {
-                if (srsLen) {
-                    for (i = 0; i < (*srsLen); i++) {
-                        EUCA_FREE((*srs)[i]);
-                    }
+        if (outRes)
+            EUCA_FREE(*outRes);
+    } else if (!strcmp(ncOp, "ncDescribeSensors")) {
+        int history_size = va_arg(al, int);
+        long long collection_interval_time_ms = va_arg(al, long long);
+        char **instIds = va_arg(al, char **);
+        int instIdsLen = va_arg(al, int);
+        char **sensorIds = va_arg(al, char **);
+        int sensorIdsLen = va_arg(al, int);
+        sensorResource ***srs = va_arg(al, sensorResource ***);
+        int *srsLen = va_arg(al, int *);
+
+        rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, srs, srsLen);
+        if (timeout && srs && srsLen) {
+            if (!rc) {
+                len = *srsLen;
+                rc = write(fd, &len, sizeof(int));
+                for (i = 0; i < len; i++) {
+                    sensorResource *sr;
+                    sr = (*srs)[i];
+                    rc = write(fd, sr, sizeof(sensorResource));
                 }
-                EUCA_FREE(*srs);
-            }
-        } else if (!strcmp(ncOp, "ncBundleInstance")) {
-            char *instanceId = va_arg(al, char *);
-            char *bucketName = va_arg(al, char *);
-            char *filePrefix = va_arg(al, char *);
-            char *objectStorageURL = va_arg(al, char *);
-            char *userPublicKey = va_arg(al, char *);
-            char *S3Policy = va_arg(al, char *);
-            char *S3PolicySig = va_arg(al, char *);
-            char *architecture = va_arg(al, char *);
-
-            rc = ncBundleInstanceStub(ncs, localmeta, instanceId, bucketName, filePrefix, objectStorageURL, userPublicKey, S3Policy, S3PolicySig, architecture);
-        } else if (!strcmp(ncOp, "ncBundleRestartInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncBundleRestartInstanceStub(ncs, localmeta, instanceId);
-        } else if (!strcmp(ncOp, "ncCancelBundleTask")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncCancelBundleTaskStub(ncs, localmeta, instanceId);
-        } else if (!strcmp(ncOp, "ncModifyNode")) {
-            char *stateName = va_arg(al, char *);
-            rc = ncModifyNodeStub(ncs, localmeta, stateName);
-        } else if (!strcmp(ncOp, "ncMigrateInstances")) {
-            ncInstance **instances = va_arg(al, ncInstance **);
-            int instancesLen = va_arg(al, int);
-            char *action = va_arg(al, char *);
-            char *credentials = va_arg(al, char *);
-            char **resourceLocations = va_arg(al, char **);
-            int resourceLocationsLen = va_arg(al, int);
-            rc = ncMigrateInstancesStub(ncs, localmeta, instances, instancesLen, action, credentials, resourceLocations, resourceLocationsLen);
-            WRITE_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStartInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncStartInstanceStub(ncs, localmeta, instanceId);
-            WRITE_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStopInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncStopInstanceStub(ncs, localmeta, instanceId);
-            WRITE_REPLY_STRING;
+                rc = 0;
+            } else {
+                len = 0;
+                rc = write(fd, &len, sizeof(int));
+                rc = 1;
+            }
+        }
+
+        if (srs) {
+            if (srsLen) {
+                for (i = 0; i < (*srsLen); i++) {
+                    EUCA_FREE((*srs)[i]);
+                }
+            }
+            EUCA_FREE(*srs);
+        }
+    } else if (!strcmp(ncOp, "ncBundleInstance")) {
+        char *instanceId = va_arg(al, char *);
+        char *bucketName = va_arg(al, char *);
+        char *filePrefix = va_arg(al, char *);
+        char *objectStorageURL = va_arg(al, char *);
+        char *userPublicKey = va_arg(al, char *);
+        char *S3Policy = va_arg(al, char *);
+        char *S3PolicySig = va_arg(al, char *);
+        char *architecture = va_arg(al, char *);
+
+        rc = ncBundleInstanceStub(ncs, localmeta, instanceId, bucketName, filePrefix, objectStorageURL, userPublicKey, S3Policy, S3PolicySig, architecture);
+    } else if (!strcmp(ncOp, "ncBundleRestartInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncBundleRestartInstanceStub(ncs, localmeta, instanceId);
+    } else if (!strcmp(ncOp, "ncCancelBundleTask")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncCancelBundleTaskStub(ncs, localmeta, instanceId);
+    } else if (!strcmp(ncOp, "ncModifyNode")) {
+        char *stateName = va_arg(al, char *);
+        rc = ncModifyNodeStub(ncs, localmeta, stateName);
+    } else if (!strcmp(ncOp, "ncMigrateInstances")) {
+        ncInstance **instances = va_arg(al, ncInstance **);
+        int instancesLen = va_arg(al, int);
+        char *action = va_arg(al, char *);
+        char *credentials = va_arg(al, char *);
+        char **resourceLocations = va_arg(al, char **);
+        int resourceLocationsLen = va_arg(al, int);
+        rc = ncMigrateInstancesStub(ncs, localmeta, instances, instancesLen, action, credentials, resourceLocations, resourceLocationsLen);
+        WRITE_REPLY_STRING;
+    } else if (!strcmp(ncOp, "ncStartInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncStartInstanceStub(ncs, localmeta, instanceId);
+        WRITE_REPLY_STRING;
+    } else if (!strcmp(ncOp, "ncStopInstance")) {
+        char *instanceId = va_arg(al, char *);
+        rc = ncStopInstanceStub(ncs, localmeta, instanceId);
+        WRITE_REPLY_STRING;
+    } else {
+        LOGWARN("\tncOps=%s ppid=%d operation '%s' not found\n", ncOp, getppid(), ncOp);
+        rc = 1;
+    }
+    return (rc);
+
+#undef WRITE_REPLY_STRING
+}
+
+//!
+//! Reads exactly the given number of bytes from a pipe. Unlike timeread(), which
+//! returns what its one read() got, keeps reading until it has them all.
+//!
+//! @param[in]  fd the read end of the pipe
+//! @param[out] buf where to store the bytes
+//! @param[in]  bytes the number of bytes to read
+//! @param[in]  timeout how long each read may wait, in seconds
+//!
+//! @return the number of bytes read, or what the failing timeread() returned (0 or less)
+//!
+static int ncClientRead(int fd, void *buf, size_t bytes, int timeout)
+{
+    int rc = 0;
+    size_t done = 0;
+
+    while (done < bytes) {
+        if ((rc = timeread(fd, ((char *)buf) + done, (bytes - done), timeout)) <= 0)
+            return (rc);
+        done += rc;
+    }
+    return (done);
+}
+
+//!
+//!
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] ncLock
+//! @param[in] ncURL
+//! @param[in] ncOp
+//! @param[in] ...
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...)
+{
+#define READ_REPLY_STRING                                                      \
+{                                                                              \
+    if (timeout) {                                                             \
+        int __len = 0;                                                         \
+        rbytes = timeread(filedes[0], &__len, sizeof(int), timeout);           \
+        LOGTRACE("parent process read %d bytes (len=%d)\n", rbytes, __len);    \
+        if (rbytes <= 0) {                                                     \
+            killwait(pid);                                                     \
+            opFail = 1;                                                        \
+            stubSuspect = TRUE;                                                \
+        } else if (__len > 0) {                                                \
+            pMeta->replyString = EUCA_ALLOC(__len, sizeof(char));              \
+            if (pMeta->replyString == NULL) {                                  \
+                LOGFATAL("out of memory! ncOps=%s\n", ncOp);                   \
+                unlock_exit(1);                                                \
+            }                                                                  \
+            rbytes = timeread(filedes[0], pMeta->replyString, __len, timeout); \
+            if (rbytes <= 0) {                                                 \
+                killwait(pid);                                                 \
+                opFail = 1;                                                    \
+                stubSuspect = TRUE;                                            \
+            }                                                                  \
+        }                                                                      \
+    }                                                                          \
+}
+
+    int i = 0;
+    int pid = 0;
+    int rc = 0;
+    int ret = 0;
+    int status = 0;
+    int opFail = 0;
+    int len = 0;
+    int rbytes = 0;
+    int seq = 0;
+    int workerSeq = 0;
+    int workerReq = -1;
+    int filedes[2] = { 0 };
+    boolean pooled = FALSE;
+    boolean stubSuspect = FALSE;
+    ncStub *warmStub = NULL;
+    ncMetadata *poolMeta = NULL;
+    va_list al = { {0} };
+    va_list wal;
+
+    LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", ncOp, ncURL, timeout);  // these are common
+
+    // look up (or build) the stub in this process so the child below and all later ones inherit it
+    warmStub = ncStubCacheGet(ncURL, FALSE);
+
+    va_start(al, ncOp);
+
+    // grab the lock
+    sem_mywait(ncLock);
+
+    // the polling calls go to the persistent worker of the node, when it has one ready;
+    // the lock keeps the other processes off the worker until this call is done with it
+    if ((timeout > 0) && warmStub && ncWorkerOp(ncOp) && ncWorkerGet(ncURL, &pid, &workerReq, &(filedes[0]))) {
+        if ((poolMeta = ncClientCallMeta(pMeta)) != NULL) {
+            pooled = TRUE;
+        }
+    }
+
+    if (!pooled && ((rc = pipe(filedes)) != 0)) {
+        LOGERROR("cannot create pipe ncOps=%s\n", ncOp);
+        sem_mypost(ncLock);
+        va_end(al);
+        return (1);
+    }
+
+    if (!pooled && ((pid = fork()) == 0)) {
+        ncStub *ncs;
+        ncMetadata *localmeta = NULL;
+
+        LOGTRACE("forked to service NC invocation: %s\n", ncOp);
+        if ((localmeta = ncClientCallMeta(pMeta)) == NULL) {
+            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+            unlock_exit(1);
+        }
+
+        close(filedes[0]);
+        if (warmStub) {
+            ncs = warmStub;
         } else {
-            LOGWARN("\tncOps=%s ppid=%d operation '%s' not found\n", ncOp, getppid(), ncOp);
-            rc = 1;
+            ncs = ncStubCreate(ncURL, NULL, NULL);
+            if (config->use_wssec) {
+                rc = InitWSSEC(ncs->env, ncs->stub, config->policyFile);
+            }
         }
+
+        LOGTRACE("\tncOps=%s ppid=%d client calling '%s'\n", ncOp, getppid(), ncOp);
+        rc = ncClientCallStub(ncs, localmeta, timeout, filedes[1], ncOp, al);
         LOGTRACE("\tncOps=%s ppid=%d done calling '%s' with exit code '%d'\n", ncOp, getppid(), ncOp, rc);
         if (localmeta->replyString != NULL) {
             LOGDEBUG("NC replied to '%s' with '%s'\n", ncOp, localmeta->replyString);
@@ -1049,22 +2164,36 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
         close(filedes[1]);
 
         // Free our local meta data structure and associated memory
-        EUCA_FREE(localmeta->replyString);
-        EUCA_FREE(localmeta->correlationId);
-        EUCA_FREE(localmeta->userId);
-        EUCA_FREE(localmeta);
+        ncClientCallMetaFree(&localmeta);
 
-        // ditch our stub
-        if (ncs != NULL) {
+        // ditch our stub (an inherited warm one belongs to the parent's cache)
+        if ((ncs != NULL) && (ncs != warmStub)) {
             ncStubDestroy(ncs);
             ncs = NULL;
         }
         exit(ret);
     } else {
         // returns for each client call
-        close(filedes[1]);
+        if (pooled) {
+            // the worker echoes the sequence number first, so a reply left over from an earlier call is never taken for this one
+            seq = ((getpid() << 16) ^ (++ncWorkerSeq));
+            va_copy(wal, al);
+            rc = ncWorkerRequest(poolMeta, timeout, workerReq, seq, ncOp, wal);
+            va_end(wal);
+            if ((rc != EUCA_OK) || (ncClientRead(filedes[0], &workerSeq, sizeof(int), timeout) <= 0) || (workerSeq != seq)) {
+                LOGWARN("worker %d of %s did not take '%s'\n", pid, ncURL, ncOp);
+                killwait(pid);
+                opFail = 1;
+                stubSuspect = TRUE;
+            }
+            rc = 0;
+        } else {
+            close(filedes[1]);
+        }
 
-        if (!strcmp(ncOp, "ncGetConsoleOutput")) {
+        if (stubSuspect) {
+            // the worker did not take the call, there is no reply to read
+        } else if (!strcmp(ncOp, "ncGetConsoleOutput")) {
             char *instId = NULL;
             char **outConsoleOutput = NULL;
 
@@ -1078,6 +2207,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     *outConsoleOutput = EUCA_ALLOC(len, sizeof(char));
                     if (!*outConsoleOutput) {
@@ -1088,6 +2218,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                 }
             }
@@ -1109,16 +2240,19 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     rbytes = timeread(filedes[0], shutdownState, sizeof(int), timeout);
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                     rbytes = timeread(filedes[0], previousState, sizeof(int), timeout);
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                 }
             }
@@ -1145,6 +2279,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     *outStatus = EUCA_ALLOC(len, sizeof(char));
                     if (!*outStatus) {
@@ -1155,6 +2290,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                 }
             }
@@ -1222,6 +2358,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     *outInst = EUCA_ZALLOC(1, sizeof(ncInstance));
                     if (!*outInst) {
@@ -1232,6 +2369,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                 }
             }
@@ -1250,10 +2388,65 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 *ncOutInsts = NULL;
             }
             if (timeout && ncOutInsts && ncOutInstsLen) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
+                rbytes = ncClientRead(filedes[0], &len, sizeof(int), timeout);
+                if (rbytes <= 0) {
+                    killwait(pid);
+                    opFail = 1;
+                    stubSuspect = TRUE;
+                } else {
+                    *ncOutInsts = EUCA_ZALLOC(len, sizeof(ncInstance *));
+                    if (!*ncOutInsts) {
+                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                        unlock_exit(1);
+                    }
+                    *ncOutInstsLen = len;
+                    for (i = 0; i < len; i++) {
+                        ncInstance *inst;
+                        inst = EUCA_ZALLOC(1, sizeof(ncInstance));
+                        if (!inst) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        (*ncOutInsts)[i] = inst;
+                        if (ncClientRead(filedes[0], inst, sizeof(ncInstance), timeout) <= 0) {
+                            killwait(pid);
+                            opFail = 1;
+                            stubSuspect = TRUE;
+                            *ncOutInstsLen = i + 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        } else if (!strcmp(ncOp, "ncDescribeInstancesDelta")) {
+            ncInstance ***ncOutInsts = NULL;
+            int *ncOutInstsLen = NULL;
+            char ***removedIds = NULL;
+            int *removedIdsLen = NULL;
+            long long *generation = NULL;
+            boolean *delta = NULL;
+
+            va_arg(al, long long);
+            ncOutInsts = va_arg(al, ncInstance ***);
+            ncOutInstsLen = va_arg(al, int *);
+            removedIds = va_arg(al, char ***);
+            removedIdsLen = va_arg(al, int *);
+            generation = va_arg(al, long long *);
+            delta = va_arg(al, boolean *);
+            if (ncOutInstsLen && ncOutInsts && removedIds && removedIdsLen && generation && delta) {
+                *ncOutInstsLen = 0;
+                *ncOutInsts = NULL;
+                *removedIdsLen = 0;
+                *removedIds = NULL;
+                *generation = 0;
+                *delta = FALSE;
+            }
+            if (timeout && ncOutInsts && ncOutInstsLen && removedIds && removedIdsLen && generation && delta) {
+                rbytes = ncClientRead(filedes[0], &len, sizeof(int), timeout);
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     *ncOutInsts = EUCA_ZALLOC(len, sizeof(ncInstance *));
                     if (!*ncOutInsts) {
@@ -1268,8 +2461,57 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                             LOGFATAL("out of memory! ncOps=%s\n", ncOp);
                             unlock_exit(1);
                         }
-                        rbytes = timeread(filedes[0], inst, sizeof(ncInstance), timeout);
                         (*ncOutInsts)[i] = inst;
+                        if (ncClientRead(filedes[0], inst, sizeof(ncInstance), timeout) <= 0) {
+                            killwait(pid);
+                            opFail = 1;
+                            stubSuspect = TRUE;
+                            *ncOutInstsLen = i + 1;
+                            break;
+                        }
+                    }
+
+                    // an error reply has no instances and a removed count of -1
+                    if (opFail) {
+                        // the reply is cut short, nothing more to read
+                    } else if (ncClientRead(filedes[0], &len, sizeof(int), timeout) <= 0) {
+                        killwait(pid);
+                        opFail = 1;
+                        stubSuspect = TRUE;
+                    } else if (len >= 0) {
+                        *removedIds = EUCA_ZALLOC(len, sizeof(char *));
+                        if ((len > 0) && !*removedIds) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        *removedIdsLen = len;
+                        for (i = 0; i < (*removedIdsLen); i++) {
+                            len = 0;
+                            if ((ncClientRead(filedes[0], &len, sizeof(int), timeout) <= 0) || (len <= 0)) {
+                                killwait(pid);
+                                opFail = 1;
+                                stubSuspect = TRUE;
+                                *removedIdsLen = i;
+                                break;
+                            }
+                            if (((*removedIds)[i] = EUCA_ZALLOC(len + 1, sizeof(char))) == NULL) {
+                                LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                                unlock_exit(1);
+                            }
+                            if (ncClientRead(filedes[0], (*removedIds)[i], sizeof(char) * len, timeout) <= 0) {
+                                killwait(pid);
+                                opFail = 1;
+                                stubSuspect = TRUE;
+                                *removedIdsLen = i + 1;
+                                break;
+                            }
+                        }
+                        if (!opFail && ((ncClientRead(filedes[0], generation, sizeof(long long), timeout) <= 0)
+                                        || (ncClientRead(filedes[0], delta, sizeof(boolean), timeout) <= 0))) {
+                            killwait(pid);
+                            opFail = 1;
+                            stubSuspect = TRUE;
+                        }
                     }
                 }
             }
@@ -1286,31 +2528,37 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
             }
             if (timeout && outRes) {
                 // first int we read back is the 'rc', then the 'len'
-                rbytes = timeread(filedes[0], &opFail, sizeof(int), timeout);
-                if (rbytes <= 0 || (rbytes = timeread(filedes[0], &len, sizeof(int), timeout)) <= 0) {
+                rbytes = ncClientRead(filedes[0], &opFail, sizeof(int), timeout);
+                if (rbytes <= 0 || (rbytes = ncClientRead(filedes[0], &len, sizeof(int), timeout)) <= 0) {
                     killwait(pid);
                     opFail = 1;
-                } else if (opFail && len) {
-                    *errMsg = EUCA_ZALLOC(len, sizeof(char));
-                    if (*errMsg == NULL) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *errMsg, len * sizeof(char), timeout);
-                    if (rbytes <= 0 || opFail) {
-                        kill(pid, SIGKILL);
-                        opFail = 1;
+                    stubSuspect = TRUE;
+                } else if (opFail) {
+                    // an error reported by the NC leaves the stub as good as it was
+                    if (len > 0) {
+                        *errMsg = EUCA_ZALLOC(len, sizeof(char));
+                        if (*errMsg == NULL) {
+                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
+                            unlock_exit(1);
+                        }
+                        rbytes = ncClientRead(filedes[0], *errMsg, len * sizeof(char), timeout);
+                        if (rbytes <= 0) {
+                            killwait(pid);
+                            stubSuspect = TRUE;
+                        }
                     }
+                    opFail = 1;
                 } else {
                     *outRes = EUCA_ZALLOC(1, sizeof(ncResource));
                     if (*outRes == NULL) {
                         LOGFATAL("out of memory! ncOps=%s\n", ncOp);
                         unlock_exit(1);
                     }
-                    rbytes = timeread(filedes[0], *outRes, sizeof(ncResource), timeout);
+                    rbytes = ncClientRead(filedes[0], *outRes, sizeof(ncResource), timeout);
                     if (rbytes <= 0) {
                         killwait(pid);
                         opFail = 1;
+                        stubSuspect = TRUE;
                     }
                 }
             }
@@ -1338,10 +2586,11 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                 *srsLen = 0;
             }
             if (timeout && srs && srsLen) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
+                rbytes = ncClientRead(filedes[0], &len, sizeof(int), timeout);
                 if (rbytes <= 0) {
                     killwait(pid);
                     opFail = 1;
+                    stubSuspect = TRUE;
                 } else {
                     *srs = EUCA_ZALLOC(len, sizeof(sensorResource *));
                     if (*srs == NULL) {
@@ -1356,8 +2605,14 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                             LOGFATAL("out of memory! ncOps=%s\n", ncOp);
                             unlock_exit(1);
                         }
-                        rbytes = timeread(filedes[0], sr, sizeof(sensorResource), timeout);
                         (*srs)[i] = sr;
+                        if (ncClientRead(filedes[0], sr, sizeof(sensorResource), timeout) <= 0) {
+                            killwait(pid);
+                            opFail = 1;
+                            stubSuspect = TRUE;
+                            *srsLen = i + 1;
+                            break;
+                        }
                     }
                 }
             }
@@ -1371,8 +2626,17 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
             // nothing to do in default case (succ/fail encoded in exit code)
         }
 
-        close(filedes[0]);
-        if (timeout) {
+        if (pooled) {
+            // the worker ends its reply with the return code of the call
+            if (!stubSuspect && (ncClientRead(filedes[0], &rc, sizeof(int), timeout) <= 0)) {
+                killwait(pid);
+                stubSuspect = TRUE;
+            }
+            if (stubSuspect) {
+                rc = 1;
+            }
+        } else if (timeout) {
+            close(filedes[0]);
             rc = timewait(pid, &status, timeout);
             if (WIFEXITED(status)) {
                 rc = WEXITSTATUS(status);
@@ -1389,12 +2653,20 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
                     LOGERROR("BUG: child process %d handling '%s' was terminated with %d (core=%d)\n", pid, ncOp, sig, dump);
                 }
                 rc = 1;
+                stubSuspect = TRUE;
             }
         } else {
+            close(filedes[0]);
             rc = 0;
         }
     }
 
+    // a call that timed out, came back short or crashed may have been caused by the stub itself,
+    // so rebuild it next time; errors reported by the NC do not reflect on the stub
+    if (stubSuspect) {
+        ncStubCacheInvalidate(ncURL);
+    }
+
     LOGTRACE("done ncOps=%s clientrc=%d opFail=%d\n", ncOp, rc, opFail);
     if (rc || opFail) {
         ret = 1;
@@ -1406,42 +2678,207 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
     sem_mypost(ncLock);
 
     va_end(al);
+    ncClientCallMetaFree(&poolMeta);
 
     return (ret);
 
-#undef WRITE_REPLY_STRING
 #undef READ_REPLY_STRING
 }
 
 //!
-//! Calculate nc call timeout, based on when operation was started (op_start), the total
-//! number of calls to make (numCalls), and the current progress (idx)
+//! Calculate nc call timeout, based on when operation was started (op_start), the total
+//! number of calls to make (numCalls), and the current progress (idx)
+//!
+//! @param[in] op_start
+//! @param[in] op_max
+//! @param[in] numCalls
+//! @param[in] idx
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+{
+    time_t op_timer, op_pernode;
+    int numLeft;
+
+    numLeft = numCalls - idx;
+    if (numLeft <= 0) {
+        numLeft = 1;
+    }
+
+    op_timer = op_max - (time(NULL) - op_start);
+    op_pernode = op_timer / numLeft;
+
+    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
+}
+
+//!
+//! Computes how long the task of one node may run: the NC call timeout it
+//! will use, plus some slack for the fork and for the cache updates.
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the number of seconds
+//!
+static int nc_fanout_timeout(int idx, void *ctx)
+{
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+
+    return (ncGetTimeout(fctx->op_start, fctx->timeout, 1, 1) + OP_TIMEOUT_MIN);
+}
+
+//!
+//! Entry point of every per-node child of nc_fanout(). Makes the child hold off
+//! SIGTERM, sent when it runs past its deadline, for as long as it holds a lock.
+//! The task only runs once the child holds one of the CC_NC_FANOUT slots of
+//! REFRESHLOCK, which all CC processes share, so that the fan-outs of several
+//! processes together make no more NC calls at a time than configured. Holding
+//! a slot does not hold off SIGTERM: the slot is recorded in fctx->slotHeld and
+//! nc_fanout_done() gives it back if the child dies with it.
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the exit code of the child, EUCA_TIMEOUT_ERROR if no slot freed up before its deadline
+//!
+static int nc_fanout_task(int idx, void *ctx)
+{
+    int rc = 0;
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+    struct sigaction newsigact = { {0} };
+    struct timespec deadline = { 0 };
+
+    newsigact.sa_handler = SIG_DFL;
+    sigemptyset(&newsigact.sa_mask);
+    sigaction(SIGTERM, &newsigact, NULL);
+    termHeldLocks = 0;
+    termDeferred = TRUE;
+
+    if ((locks[REFRESHLOCK] == NULL) || (fctx->slotHeld == NULL)) {
+        return (fctx->task(idx, ctx));
+    }
+
+    // SIGTERM is only held off until the slot is recorded, so the wait must end by the deadline of the child
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += nc_fanout_timeout(idx, ctx);
+    nc_fanout_lock_taken();
+    while (((rc = sem_timedwait(locks[REFRESHLOCK], &deadline)) != 0) && (errno == EINTR)) ;
+    if (rc == 0)
+        fctx->slotHeld[idx] = 1;
+    nc_fanout_lock_released();
+    if (rc != 0) {
+        LOGWARN("%s: no free NC call slot for node %s before its deadline\n", ncFanoutNames[fctx->kind], resourceCacheStage->resources[idx].hostname);
+        return (EUCA_TIMEOUT_ERROR);
+    }
+
+    rc = fctx->task(idx, ctx);
+
+    nc_fanout_lock_taken();
+    sem_post(locks[REFRESHLOCK]);
+    fctx->slotHeld[idx] = 0;
+    nc_fanout_lock_released();
+    return (rc);
+}
+
+//!
+//! Logs the tasks of nc_fanout() that did not complete, and gives back the
+//! REFRESHLOCK slot of a task whose process died holding it. The fan-out only
+//! reports a task once its process is gone, so the slot cannot be in use.
 //!
-//! @param[in] op_start
-//! @param[in] op_max
-//! @param[in] numCalls
-//! @param[in] idx
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] result the exit code of the task or one of the EUCA_FANOUT_* results
+//! @param[in] ctx the ncFanoutCtx of the fan-out
 //!
-//! @return
+static void nc_fanout_done(int idx, int result, void *ctx)
+{
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+
+    if (fctx->slotHeld && fctx->slotHeld[idx]) {
+        LOGDEBUG("%s: giving back the NC call slot of node %s\n", ncFanoutNames[fctx->kind], resourceCacheStage->resources[idx].hostname);
+        sem_post(locks[REFRESHLOCK]);
+        fctx->slotHeld[idx] = 0;
+    }
+
+    if (result == EUCA_FANOUT_TIMEDOUT) {
+        LOGWARN("%s: node %s did not answer in time\n", ncFanoutNames[fctx->kind], resourceCacheStage->resources[idx].hostname);
+    } else if (result == EUCA_FANOUT_CANCELLED) {
+        LOGDEBUG("%s: node %s skipped, out of time\n", ncFanoutNames[fctx->kind], resourceCacheStage->resources[idx].hostname);
+    } else if (result != 0) {
+        LOGWARN("%s: task of node %s failed (%d)\n", ncFanoutNames[fctx->kind], resourceCacheStage->resources[idx].hostname, result);
+    }
+}
+
 //!
-//! @pre
+//! Runs a task per node of resourceCacheStage, at most config->ncFanout of them
+//! at a time, each in its own child process. The tasks also take a slot of the
+//! REFRESHLOCK semaphore, which bounds the fan-outs of all CC processes together. The tasks store what they learn in
+//! the shared resourceCacheStage and caches, which the caller then merges. A task
+//! gets the NC call timeout plus some slack; the whole fan-out gets the timeout of
+//! the operation, after which the nodes not contacted yet are skipped and will be
+//! contacted first by the next fan-out of the same kind. Tasks past their deadline
+//! are terminated, or killed if they do not exit, before this returns, so none
+//! is left to write to resourceCacheStage once the caller merges it.
 //!
-//! @note
+//! @param[in] kind which of the NC_FANOUT_* operations this is
+//! @param[in] fctx the context of the operation, passed to the task
+//! @param[in] nodeMask per resourceCacheStage slot, nonzero to run the task for that node (NULL for all nodes)
+//! @param[in] task the task to run per node
 //!
-int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+//! @return EUCA_OK if every task completed, EUCA_ERROR otherwise
+//!
+static int nc_fanout(int kind, ncFanoutCtx * fctx, const char *nodeMask, euca_fanout_task_fn task)
 {
-    time_t op_timer, op_pernode;
-    int numLeft;
+    int rc = 0;
+    size_t slotBytes = 0;
+    euca_fanout fo = { 0 };
 
-    numLeft = numCalls - idx;
-    if (numLeft <= 0) {
-        numLeft = 1;
+    // build the NC stubs here once, so the per-node children inherit them
+    ncStubCacheWarm(resourceCacheStage);
+
+    // the process that initialized the configuration created the NC call slots, the others open them here
+    if (locks[REFRESHLOCK] == NULL) {
+        if ((locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout)) == SEM_FAILED) {
+            LOGERROR("cannot open the NC call slots, fan-outs are only bounded per process\n");
+            locks[REFRESHLOCK] = NULL;
+        }
     }
 
-    op_timer = op_max - (time(NULL) - op_start);
-    op_pernode = op_timer / numLeft;
+    fctx->kind = kind;
+    fctx->task = task;
+    fctx->slotHeld = NULL;
+    if ((locks[REFRESHLOCK] != NULL) && ((slotBytes = resourceCacheStage->numResources) > 0)) {
+        fctx->slotHeld = mmap(NULL, slotBytes, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_ANONYMOUS), -1, 0);
+        if (fctx->slotHeld == MAP_FAILED) {
+            LOGERROR("cannot map the NC call slot flags, fan-outs are only bounded per process\n");
+            fctx->slotHeld = NULL;
+        }
+    }
 
-    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
+    fo.numTasks = resourceCacheStage->numResources;
+    fo.mask = nodeMask;
+    fo.first = ncFanoutFirst[kind];
+    fo.maxRunning = config->ncFanout;
+    fo.totalTimeout = maxint(fctx->timeout, OP_TIMEOUT_MIN);
+    fo.taskTimeout = nc_fanout_timeout;
+    fo.task = nc_fanout_task;
+    fo.done = nc_fanout_done;
+    fo.ctx = fctx;
+
+    rc = euca_fanout_run(&fo);
+    ncFanoutFirst[kind] = ((fo.firstCancelled >= 0) ? fo.firstCancelled : 0);
+    if (fctx->slotHeld != NULL) {
+        munmap(fctx->slotHeld, slotBytes);
+        fctx->slotHeld = NULL;
+    }
+
+    LOGDEBUG("%s: %d nodes, %d ok, %d failed, %d timed out, %d skipped, slowest %s (%lld ms)\n", ncFanoutNames[kind], fo.launched, fo.succeeded, fo.failed,
+             fo.timedOut, fo.cancelled, ((fo.slowestIdx >= 0) ? resourceCacheStage->resources[fo.slowestIdx].hostname : "none"), fo.slowestMs);
+    return (rc);
 }
 
 //!
@@ -1462,12 +2899,10 @@ int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
 int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *remoteDev, char *localDev)
 {
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -1483,18 +2918,13 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -1542,12 +2972,10 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
 int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *remoteDev, char *localDev, int force)
 {
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -1562,18 +2990,13 @@ int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -1704,11 +3127,11 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     ret = 1;
     if ((rc = find_instanceCacheIP(dst, &myInstance)) == 0) {
@@ -1784,11 +3207,11 @@ int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     ret = 0;
     if ((rc = find_instanceCacheIP(src, &myInstance)) == 0) {
@@ -1941,9 +3364,9 @@ int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen,
         }
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
     {
         *outNodes = EUCA_ZALLOC(resourceCacheLocal.numResources, sizeof(ccResource));
         if (*outNodes == NULL) {
@@ -2062,6 +3485,26 @@ int changeState(ccResource * in, int newstate)
     return (0);
 }
 
+//!
+//! Sends the network information to one node. Runs in a child process, see nc_fanout().
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the exit code of the child, always 0
+//!
+static int broadcast_network_info_node(int idx, void *ctx)
+{
+    int rc = 0;
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+
+    rc = ncClientCall(fctx->pMeta, 0, resourceCacheStage->resources[idx].lockidx, resourceCacheStage->resources[idx].ncURL, "ncBroadcastNetworkInfo", fctx->networkInfo);
+    if (rc != 0) {
+        LOGERROR("bad return from ncBroadcastNetworkInfo(%s) (%d)\n", resourceCacheStage->resources[idx].hostname, rc);
+    }
+    return (0);
+}
+
 //!
 //!
 //!
@@ -2080,10 +3523,8 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
 #define EUCANETD_GNI_FILE         EUCALYPTUS_RUN_DIR "/cc_global_network_info.xml"
     int i = 0;
     int rc = 0;
-    int pid = 0;
-    int *pids = NULL;
-    int status = 0;
     time_t op_start = { 0 };
+    ncFanoutCtx fctx = { 0 };
     char *networkInfo = NULL;
     char *xmlbuf = NULL;
     char xmlfile[EUCA_MAX_PATH] = "";
@@ -2189,66 +3630,21 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
     }
 
     // now, broadcast the network XML to NCs
+    fctx.pMeta = pMeta;
+    fctx.op_start = op_start;
+    fctx.timeout = timeout;
+    fctx.networkInfo = networkInfo;
 
     // critical NC call section
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+    sem_myrdpost(RESCACHE);
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-
-        pid = fork();
-        if (!pid) {
-            // do the broadcast
-            rc = ncClientCall(pMeta, 0, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL, "ncBroadcastNetworkInfo", networkInfo);
-            if (rc != 0) {
-                LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[i].hostname, rc);
-            }
-
-            sem_mypost(REFRESHLOCK);
-            exit(0);
-        } else {
-            pids[i] = pid;
-        }
-    }
+    nc_fanout(NC_FANOUT_BROADCAST, &fctx, NULL, broadcast_network_info_node);
 
     // free the broadcast string
     EUCA_FREE(networkInfo);
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
-
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 #undef EUCANETD_GNI_FILE
@@ -2269,150 +3665,141 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
 //!
 int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
 {
-    int i, rc, nctimeout, pid, *pids = NULL;
-    int status;
-    time_t op_start;
-    ncResource *ncResDst = NULL;
-
-    if (timeout <= 0)
-        timeout = 1;
-
-    op_start = time(NULL);
-    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
-
-    // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
-
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
+    return (refresh_resources_nodes(pMeta, timeout, dolock, NULL));
+}
 
-        pid = fork();
-        if (!pid) {
-            ncResDst = NULL;
-            if (resourceCacheStage->resources[i].state != RESASLEEP && resourceCacheStage->resources[i].running == 0) {
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-                char *errMsg = NULL;
-                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeResource", NULL, &ncResDst, &errMsg);
-                if (rc != 0) {
-                    powerUp(&(resourceCacheStage->resources[i]));
+//!
+//! Describes the resources of one node into its resourceCacheStage slot.
+//! Runs in a child process, see nc_fanout().
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the exit code of the child, always 0
+//!
+static int refresh_resources_node(int idx, void *ctx)
+{
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+    ncMetadata *pMeta = fctx->pMeta;
+    int rc, nctimeout;
+    time_t op_start = fctx->op_start;
+    int timeout = fctx->timeout;
+    ncResource *ncResDst = NULL;
 
-                    if (resourceCacheStage->resources[i].state == RESWAKING && ((time(NULL) - resourceCacheStage->resources[i].stateChange) < config->wakeThresh)) {
-                        LOGDEBUG("resource still waking up (%ld more seconds until marked as down)\n",
-                                 config->wakeThresh - (time(NULL) - resourceCacheStage->resources[i].stateChange));
-                    } else {
-                        LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[i].hostname, rc);
-                        resourceCacheStage->resources[i].maxMemory = 0;
-                        resourceCacheStage->resources[i].availMemory = 0;
-                        resourceCacheStage->resources[i].maxDisk = 0;
-                        resourceCacheStage->resources[i].availDisk = 0;
-                        resourceCacheStage->resources[i].maxCores = 0;
-                        resourceCacheStage->resources[i].availCores = 0;
-                        changeState(&(resourceCacheStage->resources[i]), RESDOWN);
-                        resourceCacheStage->resources[i].ncState = NOTREADY;
-                        resourceCacheStage->resources[i].migrationCapable = FALSE;
-                        euca_strncpy(resourceCacheStage->resources[i].nodeMessage, SP(errMsg), 1024);
-                        LOGERROR("error message from ncDescribeResource: %s\n", resourceCacheStage->resources[i].nodeMessage);
-                    }
-                } else {
-                    LOGDEBUG("received data from node=%s status=%s mem=%d/%d disk=%d/%d cores=%d/%d migrationCapable=%s\n",
-                             resourceCacheStage->resources[i].hostname,
-                             ncResDst->nodeStatus,
-                             ncResDst->memorySizeAvailable, ncResDst->memorySizeMax,
-                             ncResDst->diskSizeAvailable, ncResDst->diskSizeMax, ncResDst->numberOfCoresAvailable, ncResDst->numberOfCoresMax,
-                             (ncResDst->migrationCapable == TRUE) ? "TRUE" : "FALSE");
-                    resourceCacheStage->resources[i].maxMemory = ncResDst->memorySizeMax;
-                    resourceCacheStage->resources[i].availMemory = ncResDst->memorySizeAvailable;
-                    resourceCacheStage->resources[i].maxDisk = ncResDst->diskSizeMax;
-                    resourceCacheStage->resources[i].availDisk = ncResDst->diskSizeAvailable;
-                    resourceCacheStage->resources[i].maxCores = ncResDst->numberOfCoresMax;
-                    resourceCacheStage->resources[i].availCores = ncResDst->numberOfCoresAvailable;
-                    if (!strcmp(ncResDst->nodeStatus, "enabled")) {
-                        resourceCacheStage->resources[i].ncState = ENABLED;
-                    } else if (!strcmp(ncResDst->nodeStatus, "disabled")) {
-                        resourceCacheStage->resources[i].ncState = STOPPED;
-                    }
-                    resourceCacheStage->resources[i].migrationCapable = ncResDst->migrationCapable;
-                    euca_strncpy(resourceCacheStage->resources[i].nodeStatus, ncResDst->nodeStatus, 24);
-////                    // temporarily duplicate the NC reported value in the node message for debugging
-                    strcpy(resourceCacheStage->resources[i].nodeMessage, "");
-                    // set iqn, if set
-                    if (strlen(ncResDst->iqn)) {
-                        snprintf(resourceCacheStage->resources[i].iqn, 128, "%s", ncResDst->iqn);
-                    }
-                    if (strlen(ncResDst->hypervisor)) {
-                        euca_strncpy(resourceCacheStage->resources[i].hypervisor, ncResDst->hypervisor, 16);
-                    }
-                    changeState(&(resourceCacheStage->resources[i]), RESUP);
-                }
-                if (errMsg != NULL) {
-                    EUCA_FREE(errMsg);
-                }
+    if (resourceCacheStage->resources[idx].state != RESASLEEP && resourceCacheStage->resources[idx].running == 0) {
+        nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
+        char *errMsg = NULL;
+        rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[idx].lockidx, resourceCacheStage->resources[idx].ncURL,
+                          "ncDescribeResource", NULL, &ncResDst, &errMsg);
+        if (rc != 0) {
+            powerUp(&(resourceCacheStage->resources[idx]));
+
+            if (resourceCacheStage->resources[idx].state == RESWAKING && ((time(NULL) - resourceCacheStage->resources[idx].stateChange) < config->wakeThresh)) {
+                LOGDEBUG("resource still waking up (%ld more seconds until marked as down)\n",
+                         config->wakeThresh - (time(NULL) - resourceCacheStage->resources[idx].stateChange));
             } else {
-                LOGDEBUG("resource asleep/running instances (%d), skipping resource update\n", resourceCacheStage->resources[i].running);
-            }
-
-            // try to discover the mac address of the resource
-            if (resourceCacheStage->resources[i].mac[0] == '\0' && resourceCacheStage->resources[i].ip[0] != '\0') {
-                char *mac;
-                rc = IP2MAC(resourceCacheStage->resources[i].ip, &mac);
-                if (!rc) {
-                    euca_strncpy(resourceCacheStage->resources[i].mac, mac, 24);
-                    EUCA_FREE(mac);
-                    LOGDEBUG("discovered MAC '%s' for host %s(%s)\n", resourceCacheStage->resources[i].mac,
-                             resourceCacheStage->resources[i].hostname, resourceCacheStage->resources[i].ip);
-                }
+                LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[idx].hostname, rc);
+                resourceCacheStage->resources[idx].maxMemory = 0;
+                resourceCacheStage->resources[idx].availMemory = 0;
+                resourceCacheStage->resources[idx].maxDisk = 0;
+                resourceCacheStage->resources[idx].availDisk = 0;
+                resourceCacheStage->resources[idx].maxCores = 0;
+                resourceCacheStage->resources[idx].availCores = 0;
+                changeState(&(resourceCacheStage->resources[idx]), RESDOWN);
+                resourceCacheStage->resources[idx].ncState = NOTREADY;
+                resourceCacheStage->resources[idx].migrationCapable = FALSE;
+                euca_strncpy(resourceCacheStage->resources[idx].nodeMessage, SP(errMsg), 1024);
+                LOGERROR("error message from ncDescribeResource: %s\n", resourceCacheStage->resources[idx].nodeMessage);
             }
-
-            EUCA_FREE(ncResDst);
-            sem_mypost(REFRESHLOCK);
-            exit(0);
         } else {
-            pids[i] = pid;
+            LOGDEBUG("received data from node=%s status=%s mem=%d/%d disk=%d/%d cores=%d/%d migrationCapable=%s\n",
+                     resourceCacheStage->resources[idx].hostname,
+                     ncResDst->nodeStatus,
+                     ncResDst->memorySizeAvailable, ncResDst->memorySizeMax,
+                     ncResDst->diskSizeAvailable, ncResDst->diskSizeMax, ncResDst->numberOfCoresAvailable, ncResDst->numberOfCoresMax,
+                     (ncResDst->migrationCapable == TRUE) ? "TRUE" : "FALSE");
+            resourceCacheStage->resources[idx].maxMemory = ncResDst->memorySizeMax;
+            resourceCacheStage->resources[idx].availMemory = ncResDst->memorySizeAvailable;
+            resourceCacheStage->resources[idx].maxDisk = ncResDst->diskSizeMax;
+            resourceCacheStage->resources[idx].availDisk = ncResDst->diskSizeAvailable;
+            resourceCacheStage->resources[idx].maxCores = ncResDst->numberOfCoresMax;
+            resourceCacheStage->resources[idx].availCores = ncResDst->numberOfCoresAvailable;
+            if (!strcmp(ncResDst->nodeStatus, "enabled")) {
+                resourceCacheStage->resources[idx].ncState = ENABLED;
+            } else if (!strcmp(ncResDst->nodeStatus, "disabled")) {
+                resourceCacheStage->resources[idx].ncState = STOPPED;
+            }
+            resourceCacheStage->resources[idx].migrationCapable = ncResDst->migrationCapable;
+            euca_strncpy(resourceCacheStage->resources[idx].nodeStatus, ncResDst->nodeStatus, 24);
+////            // temporarily duplicate the NC reported value in the node message for debugging
+            strcpy(resourceCacheStage->resources[idx].nodeMessage, "");
+            // set iqn, if set
+            if (strlen(ncResDst->iqn)) {
+                snprintf(resourceCacheStage->resources[idx].iqn, 128, "%s", ncResDst->iqn);
+            }
+            if (strlen(ncResDst->hypervisor)) {
+                euca_strncpy(resourceCacheStage->resources[idx].hypervisor, ncResDst->hypervisor, 16);
+            }
+            changeState(&(resourceCacheStage->resources[idx]), RESUP);
+        }
+        if (errMsg != NULL) {
+            EUCA_FREE(errMsg);
         }
+    } else {
+        LOGDEBUG("resource asleep/running instances (%d), skipping resource update\n", resourceCacheStage->resources[idx].running);
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
+    // try to discover the mac address of the resource
+    if (resourceCacheStage->resources[idx].mac[0] == '\0' && resourceCacheStage->resources[idx].ip[0] != '\0') {
+        char *mac;
+        rc = IP2MAC(resourceCacheStage->resources[idx].ip, &mac);
         if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
+            euca_strncpy(resourceCacheStage->resources[idx].mac, mac, 24);
+            EUCA_FREE(mac);
+            LOGDEBUG("discovered MAC '%s' for host %s(%s)\n", resourceCacheStage->resources[idx].mac,
+                     resourceCacheStage->resources[idx].hostname, resourceCacheStage->resources[idx].ip);
         }
     }
 
+    EUCA_FREE(ncResDst);
+    return (0);
+}
+
+//!
+//! Describes the resources of some of the nodes; refresh_resources() describes them all.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] dolock
+//! @param[in] nodeMask per resourceCache slot, nonzero to describe that node (NULL for all nodes)
+//!
+//! @return Always return 0
+//!
+static int refresh_resources_nodes(ncMetadata * pMeta, int timeout, int dolock, const char *nodeMask)
+{
+    ncFanoutCtx fctx = { 0 };
+
+    if (timeout <= 0)
+        timeout = 1;
+
+    fctx.pMeta = pMeta;
+    fctx.op_start = time(NULL);
+    fctx.timeout = timeout;
+    LOGDEBUG("invoked: timeout=%d, dolock=%d, all=%s\n", timeout, dolock, (nodeMask) ? "no" : "yes");
+
+    // critical NC call section
+    sem_myrdwait(RESCACHE);
+    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
+    sem_myrdpost(RESCACHE);
+
+    nc_fanout(NC_FANOUT_RESOURCES, &fctx, nodeMask, refresh_resources_node);
+
     // resourceCacheStage[] entries were updated based on replies from NC,
     // so merge them into the canonical location: resourceCache[] (no
     // need to try removing hosts, since instanceCache membership
     // does not change as part of the update)
     refresh_resourceCache(resourceCacheStage, FALSE);
 
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
@@ -2536,193 +3923,214 @@ static int migration_handler(ccInstance * myInstance, char *host, char *src, cha
 //!
 int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 {
+    return (refresh_instances_nodes(pMeta, timeout, dolock, NULL));
+}
+
+//!
+//! Describes the instances of one node and stores them in the instance cache.
+//! Runs in a child process, see nc_fanout().
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the exit code of the child, always 0
+//!
+static int refresh_instances_node(int idx, void *ctx)
+{
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+    ncMetadata *pMeta = fctx->pMeta;
     ccInstance *myInstance = NULL;
-    int i, numInsts = 0, found, ncOutInstsLen, rc, pid, nctimeout, *pids = NULL, status;
-    time_t op_start;
+    int numInsts = 0, found, ncOutInstsLen, rc, nctimeout;
+    time_t op_start = fctx->op_start;
+    int timeout = fctx->timeout;
     char *migration_host = NULL;
     char *migration_instance = NULL;
     char *migration_action = NULL;
 
     ncInstance **ncOutInsts = NULL;
 
-    op_start = time(NULL);
+    if (resourceCacheStage->resources[idx].state == RESUP) {
+        int j;
+        int numUnchanged = 0;
+        int removedIdsLen = 0;
+        char **removedIds = NULL;
+        long long sinceGeneration = 0;
+        long long generation = 0;
+        boolean delta = FALSE;
 
-    LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
-    set_clean_instanceCache();
+        // only ask for what changed, unless the node has not listed all of its instances for a while
+        if ((op_start - resourceCacheStage->resources[idx].describeFullTime) < (config->instanceTimeout / 2)) {
+            sinceGeneration = resourceCacheStage->resources[idx].describeGeneration;
+        }
 
-    // critical NC call section
-    sem_mywait(RESCACHE);
-    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+        nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
+        rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[idx].lockidx, resourceCacheStage->resources[idx].ncURL,
+                          "ncDescribeInstancesDelta", sinceGeneration, &ncOutInsts, &ncOutInstsLen, &removedIds, &removedIdsLen, &generation, &delta);
+        if (!rc) {
+            if (delta) {
+                // what the node left out has not changed
+                numUnchanged = touch_instanceCache_node(idx, resourceCacheStage->resources[idx].describeFullTime, removedIds, removedIdsLen);
+                LOGDEBUG("node %s: %d changed, %d unchanged and %d removed instances since generation %lld\n", resourceCacheStage->resources[idx].hostname,
+                         ncOutInstsLen, numUnchanged, removedIdsLen, sinceGeneration);
+            } else {
+                resourceCacheStage->resources[idx].describeFullTime = op_start;
+            }
+            resourceCacheStage->resources[idx].describeGeneration = generation;
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
+            // if idle, power down
+            if ((ncOutInstsLen + numUnchanged) == 0) {
+                LOGDEBUG("node %s idle since %ld: (%ld/%d) seconds\n", resourceCacheStage->resources[idx].hostname,
+                         resourceCacheStage->resources[idx].idleStart, time(NULL) - resourceCacheStage->resources[idx].idleStart, config->idleThresh);
+                if (!resourceCacheStage->resources[idx].idleStart) {
+                    resourceCacheStage->resources[idx].idleStart = time(NULL);
+                } else if ((time(NULL) - resourceCacheStage->resources[idx].idleStart) > config->idleThresh) {
+                    // call powerdown
 
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+                    if (powerDown(pMeta, &(resourceCacheStage->resources[idx]))) {
+                        LOGWARN("powerDown for %s failed\n", resourceCacheStage->resources[idx].hostname);
+                    }
+                }
+            } else {
+                resourceCacheStage->resources[idx].idleStart = 0;
+            }
 
-    invalidate_instanceCache();
+            // populate instanceCache
+            for (j = 0; j < ncOutInstsLen; j++) {
+                found = 1;
+                if (found) {
+                    myInstance = NULL;
+                    // add it
+                    LOGDEBUG("describing instance %s, %s, %d\n", ncOutInsts[j]->instanceId, ncOutInsts[j]->stateName, j);
+                    numInsts++;
+
+                    // grab instance from cache, if available.  otherwise, start from scratch
+                    rc = find_instanceCacheId(ncOutInsts[j]->instanceId, &myInstance);
+                    if (rc || !myInstance) {
+                        myInstance = EUCA_ZALLOC(1, sizeof(ccInstance));
+                        if (!myInstance) {
+                            LOGFATAL("out of memory!\n");
+                            unlock_exit(1);
+                        }
+                    }
+                    // update CC instance with instance state from NC
+                    rc = ncInstance_to_ccInstance(myInstance, ncOutInsts[j]);
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid = fork();
-        if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
-                int j;
+                    // migration-related logic
+                    if (ncOutInsts[j]->migration_state != NOT_MIGRATING) {
 
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeInstances", NULL, 0, &ncOutInsts, &ncOutInstsLen);
-                if (!rc) {
+                        rc = migration_handler(myInstance,
+                                               resourceCacheStage->resources[idx].hostname,
+                                               ncOutInsts[j]->migration_src,
+                                               ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &migration_host, &migration_instance, &migration_action);
 
-                    // if idle, power down
-                    if (ncOutInstsLen == 0) {
-                        LOGDEBUG("node %s idle since %ld: (%ld/%d) seconds\n", resourceCacheStage->resources[i].hostname,
-                                 resourceCacheStage->resources[i].idleStart, time(NULL) - resourceCacheStage->resources[i].idleStart, config->idleThresh);
-                        if (!resourceCacheStage->resources[i].idleStart) {
-                            resourceCacheStage->resources[i].idleStart = time(NULL);
-                        } else if ((time(NULL) - resourceCacheStage->resources[i].idleStart) > config->idleThresh) {
-                            // call powerdown
-
-                            if (powerDown(pMeta, &(resourceCacheStage->resources[i]))) {
-                                LOGWARN("powerDown for %s failed\n", resourceCacheStage->resources[i].hostname);
-                            }
+                        // For now just ignore updates from destination while migrating.
+                        if (!strcmp(resourceCacheStage->resources[idx].hostname, ncOutInsts[j]->migration_dst)) {
+                            LOGTRACE("[%s] ignoring update from destination node %s during migration (host=%s, instance=%s, action=%s)\n",
+                                     myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(migration_host), SP(migration_instance), SP(migration_action));
+                            EUCA_FREE(myInstance);
+                            continue;
                         }
-                    } else {
-                        resourceCacheStage->resources[i].idleStart = 0;
                     }
+                    // instance info that the CC maintains
+                    myInstance->ncHostIdx = idx;
 
-                    // populate instanceCache
-                    for (j = 0; j < ncOutInstsLen; j++) {
-                        found = 1;
-                        if (found) {
-                            myInstance = NULL;
-                            // add it
-                            LOGDEBUG("describing instance %s, %s, %d\n", ncOutInsts[j]->instanceId, ncOutInsts[j]->stateName, j);
-                            numInsts++;
-
-                            // grab instance from cache, if available.  otherwise, start from scratch
-                            rc = find_instanceCacheId(ncOutInsts[j]->instanceId, &myInstance);
-                            if (rc || !myInstance) {
-                                myInstance = EUCA_ZALLOC(1, sizeof(ccInstance));
-                                if (!myInstance) {
-                                    LOGFATAL("out of memory!\n");
-                                    unlock_exit(1);
-                                }
-                            }
-                            // update CC instance with instance state from NC
-                            rc = ncInstance_to_ccInstance(myInstance, ncOutInsts[j]);
-
-                            // migration-related logic
-                            if (ncOutInsts[j]->migration_state != NOT_MIGRATING) {
-
-                                rc = migration_handler(myInstance,
-                                                       resourceCacheStage->resources[i].hostname,
-                                                       ncOutInsts[j]->migration_src,
-                                                       ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &migration_host, &migration_instance, &migration_action);
-
-                                // For now just ignore updates from destination while migrating.
-                                if (!strcmp(resourceCacheStage->resources[i].hostname, ncOutInsts[j]->migration_dst)) {
-                                    LOGTRACE("[%s] ignoring update from destination node %s during migration (host=%s, instance=%s, action=%s)\n",
-                                             myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(migration_host), SP(migration_instance), SP(migration_action));
-                                    EUCA_FREE(myInstance);
-                                    continue;
-                                }
-                            }
-                            // instance info that the CC maintains
-                            myInstance->ncHostIdx = i;
-
-                            // Is this redundant?
-                            myInstance->migration_state = ncOutInsts[j]->migration_state;
-
-                            euca_strncpy(myInstance->serviceTag, resourceCacheStage->resources[i].ncURL, 384);
-                            {
-                                char *ip = NULL;
-                                if (!strcmp(myInstance->ccnet.privateIp, "0.0.0.0")) {
-                                    if ((rc = MAC2IP(myInstance->ccnet.privateMac, &ip)) == 0) {
-                                        euca_strncpy(myInstance->ccnet.privateIp, ip, INET_ADDR_LEN);
-                                    }
-                                }
-                                EUCA_FREE(ip);
-                            }
+                    // Is this redundant?
+                    myInstance->migration_state = ncOutInsts[j]->migration_state;
 
-                            if ((myInstance->ccnet.publicIp[0] != '\0' && strcmp(myInstance->ccnet.publicIp, "0.0.0.0"))
-                                && (myInstance->ncnet.publicIp[0] == '\0' || !strcmp(myInstance->ncnet.publicIp, "0.0.0.0"))) {
-                                // CC has network info, NC does not
-                                LOGDEBUG("sending ncAssignAddress to sync NC\n");
-                                rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                                  "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
-                                if (rc) {
-                                    // problem, but will retry next time
-                                    LOGWARN("could not send AssignAddress to NC\n");
-                                }
+                    euca_strncpy(myInstance->serviceTag, resourceCacheStage->resources[idx].ncURL, 384);
+                    {
+                        char *ip = NULL;
+                        if (!strcmp(myInstance->ccnet.privateIp, "0.0.0.0")) {
+                            if ((rc = MAC2IP(myInstance->ccnet.privateMac, &ip)) == 0) {
+                                euca_strncpy(myInstance->ccnet.privateIp, ip, INET_ADDR_LEN);
                             }
-
-                            refresh_instanceCache(myInstance->instanceId, myInstance);
-                            LOGDEBUG("storing instance state: %s/%s/%s/%s\n", myInstance->instanceId, myInstance->state, myInstance->ccnet.publicIp, myInstance->ccnet.privateIp);
-                            print_ccInstance("refresh_instances(): ", myInstance);
-                            sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
-                            // TODO swathi should this account for secondary enis?
-                            EUCA_FREE(myInstance);
                         }
+                        EUCA_FREE(ip);
                     }
-                }
-                if (ncOutInsts) {
-                    for (j = 0; j < ncOutInstsLen; j++) {
-                        free_instance(&(ncOutInsts[j]));
+
+                    if ((myInstance->ccnet.publicIp[0] != '\0' && strcmp(myInstance->ccnet.publicIp, "0.0.0.0"))
+                        && (myInstance->ncnet.publicIp[0] == '\0' || !strcmp(myInstance->ncnet.publicIp, "0.0.0.0"))) {
+                        // CC has network info, NC does not
+                        LOGDEBUG("sending ncAssignAddress to sync NC\n");
+                        rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[idx].lockidx, resourceCacheStage->resources[idx].ncURL,
+                                          "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
+                        if (rc) {
+                            // problem, but will retry next time
+                            LOGWARN("could not send AssignAddress to NC\n");
+                        }
                     }
-                    EUCA_FREE(ncOutInsts);
-                }
-            }
-            sem_mypost(REFRESHLOCK);
 
-            if (migration_host) {
-                if (!strcmp(migration_action, "commit")) {
-                    LOGDEBUG("[%s] notifying source %s to commit migration\n", migration_instance, migration_host);
-                    // Note: Really only need to specify the instance here.
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "commit", NULL, 0);
-                } else if (!strcmp(migration_action, "rollback")) {
-                    LOGDEBUG("[%s] notifying node %s to roll back migration\n", migration_instance, migration_host);
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "rollback", NULL, 0);
-                } else {
-                    LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", migration_action, migration_host);
+                    refresh_instanceCache(myInstance->instanceId, myInstance);
+                    LOGDEBUG("storing instance state: %s/%s/%s/%s\n", myInstance->instanceId, myInstance->state, myInstance->ccnet.publicIp, myInstance->ccnet.privateIp);
+                    print_ccInstance("refresh_instances(): ", myInstance);
+                    sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
+                    // TODO swathi should this account for secondary enis?
+                    EUCA_FREE(myInstance);
                 }
-                EUCA_FREE(migration_host);
             }
-            EUCA_FREE(migration_instance);
-            EUCA_FREE(migration_action);
-
-            exit(0);
-        } else {
-            pids[i] = pid;
+        }
+        if (ncOutInsts) {
+            for (j = 0; j < ncOutInstsLen; j++) {
+                free_instance(&(ncOutInsts[j]));
+            }
+            EUCA_FREE(ncOutInsts);
+        }
+        if (removedIds) {
+            for (j = 0; j < removedIdsLen; j++) {
+                EUCA_FREE(removedIds[j]);
+            }
+            EUCA_FREE(removedIds);
         }
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
+    if (migration_host) {
+        if (!strcmp(migration_action, "commit")) {
+            LOGDEBUG("[%s] notifying source %s to commit migration\n", migration_instance, migration_host);
+            // Note: Really only need to specify the instance here.
+            doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "commit", NULL, 0);
+        } else if (!strcmp(migration_action, "rollback")) {
+            LOGDEBUG("[%s] notifying node %s to roll back migration\n", migration_instance, migration_host);
+            doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "rollback", NULL, 0);
         } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
+            LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", migration_action, migration_host);
         }
+        EUCA_FREE(migration_host);
     }
+    EUCA_FREE(migration_instance);
+    EUCA_FREE(migration_action);
+
+    return (0);
+}
+
+//!
+//! Describes the instances of some of the nodes; refresh_instances() describes them all.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//! @param[in] dolock
+//! @param[in] nodeMask per resourceCache slot, nonzero to describe that node (NULL for all nodes)
+//!
+//! @return Always return 0
+//!
+static int refresh_instances_nodes(ncMetadata * pMeta, int timeout, int dolock, const char *nodeMask)
+{
+    ncFanoutCtx fctx = { 0 };
+
+    fctx.pMeta = pMeta;
+    fctx.op_start = time(NULL);
+    fctx.timeout = timeout;
+
+    LOGDEBUG("invoked: timeout=%d, dolock=%d, all=%s\n", timeout, dolock, (nodeMask) ? "no" : "yes");
+    set_clean_instanceCache();
+
+    // critical NC call section
+    sem_myrdwait(RESCACHE);
+    memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
+    sem_myrdpost(RESCACHE);
+
+    invalidate_instanceCache();
+
+    nc_fanout(NC_FANOUT_INSTANCES, &fctx, nodeMask, refresh_instances_node);
 
     invalidate_instanceCache();        // purge old instances from cache
 
@@ -2730,12 +4138,55 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
     // to resourceCacheStage (.idleStart may have changed) and
     // remove any unconfigured hosts if they have no instances
     refresh_resourceCache(resourceCacheStage, TRUE);
-    EUCA_FREE(pids);
 
     LOGTRACE("done\n");
     return (0);
 }
 
+//!
+//! Fetches the sensor data of one node and merges it into the sensor cache.
+//! Runs in a child process, see nc_fanout().
+//!
+//! @param[in] idx the resourceCacheStage slot of the node
+//! @param[in] ctx the ncFanoutCtx of the fan-out
+//!
+//! @return the exit code of the child, always 0
+//!
+static int refresh_sensors_node(int idx, void *ctx)
+{
+    ncFanoutCtx *fctx = ((ncFanoutCtx *) ctx);
+    ncMetadata *pMeta = fctx->pMeta;
+    time_t op_start = fctx->op_start;
+    int timeout = fctx->timeout;
+    int history_size = fctx->historySize;
+    long long collection_interval_time_ms = fctx->collectionIntervalMs;
+
+    if (resourceCacheStage->resources[idx].state == RESUP) {
+        int nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
+
+        sensorResource **srs;
+        int srsLen;
+        int rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[idx].lockidx, resourceCacheStage->resources[idx].ncURL,
+                              "ncDescribeSensors", history_size, collection_interval_time_ms,
+                              NULL, 0, NULL, 0, &srs, &srsLen);
+
+        if (!rc) {
+            // update our cache
+            if (sensor_merge_records(srs, srsLen, TRUE) != EUCA_OK) {
+                LOGWARN("failed to store all sensor data due to lack of space");
+            }
+
+            if (srsLen > 0) {
+                for (int j = 0; j < srsLen; j++) {
+                    EUCA_FREE(srs[j]);
+                }
+                EUCA_FREE(srs);
+            }
+        }
+    }
+    return (0);
+}
+
 //!
 //!
 //!
@@ -2751,8 +4202,8 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 //!
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 {
+    ncFanoutCtx fctx = { 0 };
 
-    time_t op_start = time(NULL);
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
 
     int history_size;
@@ -2760,80 +4211,19 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
     if ((sensor_get_config(&history_size, &collection_interval_time_ms) != 0) || history_size < 1 || collection_interval_time_ms == 0)
         return (1);                    // sensor system not configured yet
 
+    fctx.pMeta = pMeta;
+    fctx.op_start = time(NULL);
+    fctx.timeout = timeout;
+    fctx.historySize = history_size;
+    fctx.collectionIntervalMs = collection_interval_time_ms;
+
     // critical NC call section
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    int *pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
-
-    for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid_t pid = fork();
-        if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
-                int nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
-
-                sensorResource **srs;
-                int srsLen;
-                int rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                      "ncDescribeSensors", history_size, collection_interval_time_ms,
-                                      NULL, 0, NULL, 0, &srs, &srsLen);
-
-                if (!rc) {
-                    // update our cache
-                    if (sensor_merge_records(srs, srsLen, TRUE) != EUCA_OK) {
-                        LOGWARN("failed to store all sensor data due to lack of space");
-                    }
-
-                    if (srsLen > 0) {
-                        for (int j = 0; j < srsLen; j++) {
-                            EUCA_FREE(srs[j]);
-                        }
-                        EUCA_FREE(srs);
-                    }
-                }
-            }
-            sem_mypost(REFRESHLOCK);
-            exit(0);
-        } else {
-            pids[i] = pid;
-        }
-    }
-
-    for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        int status;
+    sem_myrdpost(RESCACHE);
 
-        int rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
+    nc_fanout(NC_FANOUT_SENSORS, &fctx, NULL, refresh_sensors_node);
 
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
@@ -2856,7 +4246,9 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen)
 {
     int i, rc, count;
+    int describedLen = 0;
     time_t op_start;
+    ccDescribedSlot *described = NULL;
 
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen);
 
@@ -2872,12 +4264,13 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
     *outInsts = NULL;
     *outInstsLen = 0;
 
-    sem_mywait(INSTCACHE);
-    sem_mywait(INSTCACHEMD);
+    // the instance counts only change under the INSTCACHE writer lock
+    sem_myrdwait(INSTCACHE);
     count = 0;
     if (instanceCacheMetadata->numInsts) {
         *outInsts = EUCA_ZALLOC(instanceCacheMetadata->numInsts, sizeof(ccInstance));
-        if (!*outInsts) {
+        described = EUCA_ZALLOC(instanceCacheMetadata->numInsts, sizeof(ccDescribedSlot));
+        if (!*outInsts || !described) {
             LOGFATAL("out of memory!\n");
             unlock_exit(1);
         }
@@ -2889,7 +4282,11 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
                     count = 0;
                 }
                 memcpy(&((*outInsts)[count]), &(instanceCache[i].instance), sizeof(ccInstance));
-                instanceCache[i].described = 1;
+                if (describedLen < instanceCacheMetadata->numInsts) {
+                    described[describedLen].slot = i;
+                    euca_strncpy(described[describedLen].instanceId, instanceCache[i].instance.instanceId, sizeof(described[describedLen].instanceId));
+                    describedLen++;
+                }
 
                 // We only report a subset of possible migration statuses upstream to the CLC.
                 if ((*outInsts)[count].migration_state == MIGRATION_READY) {
@@ -2903,8 +4300,10 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
 
         *outInstsLen = instanceCacheMetadata->numInsts;
     }
-    sem_mypost(INSTCACHEMD);
-    sem_mypost(INSTCACHE);
+    sem_myrdpost(INSTCACHE);
+
+    instanceCache_mark_described(described, describedLen);
+    EUCA_FREE(described);
 
     for (i = 0; i < (*outInstsLen); i++) {
         LOGDEBUG("instances summary: instanceId=%s, state=%s, migration_state=%s, publicIp=%s, privateIp=%s\n",
@@ -2919,6 +4318,92 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
     return (0);
 }
 
+//!
+//! Walks the valid instances of the cache in place, so that the caller can marshal
+//! them without first copying the whole cache to the heap as doDescribeInstances()
+//! does. The instances handed to the visitor are the cached ones, with the migration
+//! state already folded into what is reported to the CLC through the reported
+//! parameter. The cache stays locked while the visitor runs: it must not modify the
+//! instance, keep pointers into it, or call anything that takes the INSTCACHE lock.
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds a list of instance identifier string (unused, all instances are described)
+//! @param[in]  instIdsLen the number of instance identifiers in the instIds list
+//! @param[in]  visit the visitor, called once per valid cached instance
+//! @param[in]  visitParam opaque pointer handed to the visitor
+//! @param[out] outInstsLen the number of instances visited
+//!
+//! @return 0 on success or 1 on failure
+//!
+int doDescribeInstancesVisit(ncMetadata * pMeta, char **instIds, int instIdsLen, int (*visit) (ccInstance *, migration_states, void *), void *visitParam,
+                             int *outInstsLen)
+{
+    int i, rc;
+    int describedLen = 0;
+    int describedMax = 0;
+    migration_states reported = NOT_MIGRATING;
+    ccDescribedSlot *described = NULL;
+
+    LOGDEBUG("invoked: userId=%s, instIdsLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen);
+
+    if (!visit || !outInstsLen) {
+        return (1);
+    }
+
+    rc = initialize(pMeta, FALSE);
+    if (rc || ccIsEnabled()) {
+        return (1);
+    }
+
+    print_instanceCache();
+
+    *outInstsLen = 0;
+
+    sem_myrdwait(INSTCACHE);
+    if ((describedMax = instanceCacheMetadata->numInsts) > 0) {
+        if ((described = EUCA_ZALLOC(describedMax, sizeof(ccDescribedSlot))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
+        }
+    }
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        if (instanceCache[i].cacheState == INSTVALID) {
+            // We only report a subset of possible migration statuses upstream to the CLC.
+            reported = instanceCache[i].instance.migration_state;
+            if (reported == MIGRATION_READY) {
+                reported = MIGRATION_PREPARING;
+            } else if (reported == MIGRATION_CLEANING) {
+                reported = MIGRATION_IN_PROGRESS;
+            }
+
+            if (visit(&(instanceCache[i].instance), reported, visitParam)) {
+                LOGWARN("failed to describe instance %s\n", instanceCache[i].instance.instanceId);
+                continue;
+            }
+            if (describedLen < describedMax) {
+                described[describedLen].slot = i;
+                euca_strncpy(described[describedLen].instanceId, instanceCache[i].instance.instanceId, sizeof(described[describedLen].instanceId));
+                describedLen++;
+            }
+            (*outInstsLen)++;
+
+            LOGDEBUG("instances summary: instanceId=%s, state=%s, migration_state=%s, publicIp=%s, privateIp=%s\n",
+                     instanceCache[i].instance.instanceId, instanceCache[i].instance.state, migration_state_names[reported],
+                     instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp);
+        }
+    }
+    sem_myrdpost(INSTCACHE);
+
+    instanceCache_mark_described(described, describedLen);
+    EUCA_FREE(described);
+
+    LOGTRACE("done\n");
+
+    shawn();
+
+    return (0);
+}
+
 //!
 //!
 //!
@@ -3136,6 +4621,8 @@ int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ra
         ret = schedule_instance_greedy(vm, outresid);
     } else if (config->schedPolicy == SCHEDUSER) {
         ret = schedule_instance_user(vm, amiId, kernelId, ramdiskId, instId, userData, platform, outresid);
+    } else if ((config->schedPolicy == SCHEDBESTFIT) || (config->schedPolicy == SCHEDSPREAD)) {
+        ret = ((schedule_instances(vm, amiId, kernelId, ramdiskId, instId, userData, platform, NULL, 1, outresid) == 1) ? 0 : 1);
     } else {
         ret = schedule_instance_greedy(vm, outresid);
     }
@@ -3143,6 +4630,95 @@ int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ra
     return (ret);
 }
 
+//!
+//! Chooses the resources for a batch of identical instances in one pass over a
+//! capacity index built from the resource cache, instead of scanning every
+//! resource for every instance. Explicit and user-defined scheduling still go
+//! through schedule_instance(), one instance at a time.
+//!
+//! @param[in]  vm the instance parameters (cores, memory and disk are used)
+//! @param[in]  amiId
+//! @param[in]  kernelId
+//! @param[in]  ramdiskId
+//! @param[in]  instId the ID of the first instance of the batch
+//! @param[in]  userData
+//! @param[in]  platform
+//! @param[in]  targetNode the node requested by the user, if any
+//! @param[in]  count the number of instances to place
+//! @param[out] outresids the resource-cache index chosen for each placed instance, must hold count entries
+//!
+//! @return the number of instances placed, from 0 to count
+//!
+//! @pre Both the RESCACHE and CONFIG locks must be held by the caller.
+//!
+//! @note Only the index is updated with the placed instances; the caller takes
+//!       their capacity out of the resource cache once they actually run, and
+//!       wakes up a sleeping resource only once an instance is sent to it.
+//!
+int schedule_instances(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, char *targetNode, int count,
+                       int *outresids)
+{
+    int i = 0;
+    int placed = 0;
+    sched_policy policy = SCHED_POLICY_FIRSTFIT;
+    sched_index *idx = NULL;
+    sched_capacity cap = { 0 };
+    sched_node_state state = SCHED_NODE_OFFLINE;
+    ccResource *res = NULL;
+
+    if ((count < 1) || (outresids == NULL))
+        return (0);
+
+    if ((targetNode != NULL) || (config->schedPolicy == SCHEDUSER)) {
+        return ((schedule_instance(vm, amiId, kernelId, ramdiskId, instId, userData, platform, targetNode, &(outresids[0])) == 0) ? 1 : 0);
+    }
+
+    switch (config->schedPolicy) {
+    case SCHEDROUNDROBIN:
+        policy = SCHED_POLICY_ROUNDROBIN;
+        break;
+    case SCHEDBESTFIT:
+        policy = SCHED_POLICY_BESTFIT;
+        break;
+    case SCHEDSPREAD:
+        policy = SCHED_POLICY_SPREAD;
+        break;
+    default:
+        policy = SCHED_POLICY_FIRSTFIT;
+        break;
+    }
+
+    if ((resourceCache->numResources < 1) || ((idx = sched_index_alloc(resourceCache->numResources)) == NULL))
+        return (0);
+
+    for (i = 0; i < resourceCache->numResources; i++) {
+        res = &(resourceCache->resources[i]);
+        if ((res->state == RESDOWN) || (res->ncState != ENABLED)) {
+            state = SCHED_NODE_OFFLINE;
+        } else if (res->state == RESASLEEP) {
+            state = SCHED_NODE_STANDBY;
+        } else {
+            state = SCHED_NODE_READY;
+        }
+        cap.cores = res->availCores;
+        cap.mem = res->availMemory;
+        cap.disk = res->availDisk;
+        sched_index_set_node(idx, i, state, &cap);
+    }
+
+    cap.cores = vm->cores;
+    cap.mem = vm->mem;
+    cap.disk = vm->disk;
+    idx->cursor = config->schedState;
+    placed = sched_index_place_batch(idx, policy, &cap, count, outresids);
+    if (policy == SCHED_POLICY_ROUNDROBIN)
+        config->schedState = idx->cursor;
+    sched_index_free(&idx);
+
+    LOGDEBUG("scheduler using %s policy placed %d of %d instance(s)\n", SCHEDPOLICIES[config->schedPolicy], placed, count);
+    return (placed);
+}
+
 //!
 //!
 //!
@@ -3255,10 +4831,10 @@ static int schedule_instance_migration(ncInstance * instance, char **includeNode
     } else {
         if (config->schedPolicy == SCHEDROUNDROBIN) {
             LOGDEBUG("[%s] scheduling migration using ROUNDROBIN scheduler\n", instance->instanceId);
-        } else if (config->schedPolicy == SCHEDGREEDY || config->schedPolicy == SCHEDPOWERSAVE) {
+        } else if (config->schedPolicy == SCHEDGREEDY || config->schedPolicy == SCHEDPOWERSAVE || config->schedPolicy == SCHEDBESTFIT || config->schedPolicy == SCHEDSPREAD) {
             LOGINFO
-                ("[%s] scheduling migration using ROUNDROBIN scheduler, despite GREEDY or POWERSAVE scheduler specification in Eucalyptus configuration file; GREEDY scheduling can be emulated by selecting specific destination nodes for migrations\n",
-                 instance->instanceId);
+                ("[%s] scheduling migration using ROUNDROBIN scheduler, despite %s scheduler specification in Eucalyptus configuration file; GREEDY scheduling can be emulated by selecting specific destination nodes for migrations\n",
+                 instance->instanceId, SCHEDPOLICIES[config->schedPolicy]);
         } else {
             LOGWARN("[%s] unsupported scheduler configuration--scheduling migration using ROUNDROBIN scheduler\n", instance->instanceId);
         }
@@ -3644,6 +5220,7 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                    ccInstance ** outInsts, int *outInstsLen)
 {
     int rc = 0, i = 0, done = 0, runCount = 0, resid = 0, foundnet = 0, error = 0, nidx = 0, thenidx = 0, pid = 0;
+    int planLen = 0, planNext = 0, *plan = NULL;
     ccInstance *myInstance = NULL, *retInsts = NULL;
     char instId[16], uuid[48];
     ccResource *res = NULL;
@@ -3719,7 +5296,8 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
     }
 
     retInsts = EUCA_ZALLOC(maxCount, sizeof(ccInstance));
-    if (!retInsts) {
+    plan = EUCA_ZALLOC(maxCount, sizeof(int));
+    if (!retInsts || !plan) {
         LOGFATAL("out of memory!\n");
         unlock_exit(1);
     }
@@ -3815,9 +5393,27 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
             resid = 0;
 
-            sem_mywait(CONFIG);
-            rc = schedule_instance(ccvm, amiId, kernelId, ramdiskId, instId, userData, platform, targetNode, &resid);
-            sem_mypost(CONFIG);
+            // place the rest of the batch in one pass, and only do it again once the plan runs out
+            // or when the planned resource can no longer take the instance (e.g., its run failed)
+            if (planNext < planLen) {
+                res = &(resourceCache->resources[plan[planNext]]);
+                if ((res->state == RESDOWN) || (res->ncState != ENABLED) || (res->availMemory < ccvm->mem) || (res->availDisk < ccvm->disk)
+                    || (res->availCores < ccvm->cores)) {
+                    planNext = planLen = 0;
+                }
+            }
+            if (planNext >= planLen) {
+                sem_mywait(CONFIG);
+                planLen = schedule_instances(ccvm, amiId, kernelId, ramdiskId, instId, userData, platform, targetNode, (maxCount - i), plan);
+                sem_mypost(CONFIG);
+                planNext = 0;
+            }
+            if (planNext < planLen) {
+                resid = plan[planNext++];
+                rc = 0;
+            } else {
+                rc = 1;
+            }
 
             res = &(resourceCache->resources[resid]);
             if (rc) {
@@ -3830,6 +5426,9 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
                 // try to run the instance on the chosen resource
                 LOGINFO("scheduler decided to run instance %s on resource %s, running count %d\n", instId, res->ncURL, res->running);
+                if (res->state == RESASLEEP) {
+                    powerUp(res);
+                }
 
                 outInst = NULL;
 
@@ -3943,6 +5542,7 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
     }
     *outInstsLen = runCount;
     *outInsts = retInsts;
+    EUCA_FREE(plan);
 
     LOGTRACE("done\n");
 
@@ -3983,7 +5583,6 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
     char *rawconsole = NULL;
     char pwfile[EUCA_MAX_PATH] = "";
     time_t op_start = 0;
-    ccInstance *myInstance = NULL;
     ccResourceCache resourceCacheLocal = { {{{0}}} };
 
     op_start = time(NULL);
@@ -3997,17 +5596,15 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
     LOGINFO("[%s] requesting console output\n", SP(instanceId));
     LOGDEBUG("invoked: instId=%s\n", SP(instanceId));
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        start = myInstance->ncHostIdx;
         stop = start + 1;
-        EUCA_FREE(myInstance);
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -4049,13 +5646,11 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
 {
     int i, j, rc, numInsts, start, stop, done, timeout = 0, ret = 0;
     char *instId;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = j = numInsts = 0;
     instId = NULL;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -4066,18 +5661,15 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
     LOGINFO("rebooting %d instances\n", instIdsLen);
     LOGDEBUG("invoked: instIdsLen=%d\n", instIdsLen);
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     for (i = 0; i < instIdsLen; i++) {
         instId = instIds[i];
-        rc = find_instanceCacheId(instId, &myInstance);
-        if (!rc) {
+        if ((rc = view_instanceCacheId(instId, instHostIdxGet, &start)) == 0) {
             // found the instance in the cache
-            start = myInstance->ncHostIdx;
             stop = start + 1;
-            EUCA_FREE(myInstance);
         } else {
             start = 0;
             stop = resourceCacheLocal.numResources;
@@ -4139,9 +5731,9 @@ int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int
     LOGINFO("terminating instances\n");
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d, firstInstId=%s, force=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen, SP(instIdsLen ? instIds[0] : "UNSET"), force);
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     for (i = 0; i < instIdsLen; i++) {
         instId = instIds[i];
@@ -4213,12 +5805,10 @@ int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int
 int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *remoteDev)
 {
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -4233,18 +5823,13 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -4425,9 +6010,9 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
     }
     LOGINFO("modifying node %s with state=%s\n", SP(nodeName), SP(stateName));
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     for (i = 0; i < resourceCacheLocal.numResources && (src_index == -1); i++) {
         if (resourceCacheLocal.resources[i].state != RESASLEEP) {
@@ -4543,9 +6128,9 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
     if (!instanceId) {
         for (i = 0; i < resourceCacheLocal.numResources && (src_index == -1); i++) {
@@ -4564,8 +6149,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         }
     }
 
-    sem_mywait(INSTCACHE);
-    sem_mywait(INSTCACHEMD);
+    sem_myrdwait(INSTCACHE);
     if (instanceCacheMetadata->numInsts) {
         for (i = 0; i < config->ccMaxInstances; i++) {
             if (instanceCache[i].cacheState == INSTVALID && (instanceId || instanceCache[i].instance.ncHostIdx == src_index)
@@ -4596,8 +6180,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
             }
         }
     }
-    sem_mypost(INSTCACHEMD);
-    sem_mypost(INSTCACHE);
+    sem_myrdpost(INSTCACHE);
 
     if (!found_instances) {
         if (instanceId) {
@@ -4832,7 +6415,6 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
     int ret = 0;
     int timeout = 0;
     int done = 0;
-    ccInstance *myInstance = NULL;
     time_t op_start = time(NULL);
     ccResourceCache resourceCacheLocal;
 
@@ -4847,20 +6429,15 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-            myInstance = NULL;
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -4904,7 +6481,6 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
     int ret = 0;
     int timeout = 0;
     int done = 0;
-    ccInstance *myInstance = NULL;
     time_t op_start = time(NULL);
     ccResourceCache resourceCacheLocal;
 
@@ -4919,20 +6495,15 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     {
         memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
     }
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-            myInstance = NULL;
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -5444,9 +7015,9 @@ void *monitor_thread(void *in)
 
         if (config->ccState == ENABLED) {
 
-            // NC Polling operations
+            // NC Polling operations (when nodes push their changes, the full sweep is only an anti-entropy pass)
             if (cycleStartTime >= nextNcPullRunTime) {
-                 nextNcPullRunTime = cycleStartTime + config->ncPollingFrequency;
+                 nextNcPullRunTime = cycleStartTime + ((config->ncPushEnabled) ? config->ncAntiEntropyInterval : config->ncPollingFrequency);
                  ncRefresh = 1;
             }
 
@@ -5460,6 +7031,13 @@ void *monitor_thread(void *in)
                 if (rc) {
                     LOGWARN("call to refresh_instances() failed in monitor thread\n");
                 }
+
+                if (config->ncPushEnabled) {
+                    push_nodes_described(NULL, cycleStartTime);
+                }
+            } else if (config->ncPushEnabled) {
+                // describe the nodes whose pushed changes could not be applied or that stopped pushing
+                ncRefresh = refresh_pushed_nodes(&pMeta, 60);
             }
 
             if (config->kick_broadcast_network_info) {
@@ -5474,7 +7052,7 @@ void *monitor_thread(void *in)
                 static time_t last_log_update = 0;
 
                 int res_idle = 0, res_busy = 0, res_bad = 0;
-                sem_mywait(RESCACHE);
+                sem_myrdwait(RESCACHE);
                 for (int i = 0; i < resourceCache->numResources; i++) {
                     ccResource *res = &(resourceCache->resources[i]);
                     if (res->state == RESDOWN) {
@@ -5487,13 +7065,12 @@ void *monitor_thread(void *in)
                         }
                     }
                 }
-                sem_mypost(RESCACHE);
+                sem_myrdpost(RESCACHE);
 
                 time_t now = time(NULL);
                 if ((now - last_log_update) > LOG_INTERVAL_SUMMARY_SEC) {
                     int num_pending = 0, num_extant = 0, num_teardown = 0;
-                    sem_mywait(INSTCACHE);
-                    sem_mywait(INSTCACHEMD);
+                    sem_myrdwait(INSTCACHE);
                     if (instanceCacheMetadata->numInsts) {
                         for (int i = 0; i < config->ccMaxInstances; i++) {
                             if (!strcmp(instanceCache[i].instance.state, "Pending")) {
@@ -5506,8 +7083,7 @@ void *monitor_thread(void *in)
                         }
                         //                        instanceCacheMetadata->numInstsActive = num_pending+num_extant;
                     }
-                    sem_mypost(INSTCACHEMD);
-                    sem_mypost(INSTCACHE);
+                    sem_myrdpost(INSTCACHE);
 
                     last_log_update = now;
                     LOGINFO("instances: %04d (%04d extant + %04d pending + %04d terminated)\n", (num_pending + num_extant + num_teardown), num_extant, num_pending, num_teardown);
@@ -5601,28 +7177,314 @@ void *monitor_thread(void *in)
             }
             config->kick_monitor_running = 1;
         }
-        // do state checks under CONFIG lock
-        sem_mywait(CONFIG);
-        if (ccCheckState(ccCheck)) {
-            LOGERROR("ccCheckState() returned failures\n");
-            config->kick_enabled = 0;
-            ccChangeState(NOTREADY);
-        } else if (config->ccState == NOTREADY) {
-            ccChangeState(DISABLED);
+        // do state checks under CONFIG lock
+        sem_mywait(CONFIG);
+        if (ccCheckState(ccCheck)) {
+            LOGERROR("ccCheckState() returned failures\n");
+            config->kick_enabled = 0;
+            ccChangeState(NOTREADY);
+        } else if (config->ccState == NOTREADY) {
+            ccChangeState(DISABLED);
+        }
+        sem_mypost(CONFIG);
+        shawn();
+
+        LOGTRACE("localState=%s - done.\n", config->ccStatus.localState);
+        ncRefresh = 0;
+        sleep(1);
+    }
+
+    EUCA_FREE(pMeta.correlationId);
+    EUCA_FREE(pMeta.userId);
+    return (NULL);
+}
+
+//!
+//! Bounds the interval of the full sweep done when the nodes push their changes: no shorter
+//! than the polling frequency and short enough for the sweep to refresh every instance at
+//! least twice before invalidate_instanceCache() would drop it.
+//!
+//! @param[in] requested NC_ANTI_ENTROPY_INTERVAL, 0 if not set
+//! @param[in] ncPollingFrequency NC_POLLING_FREQUENCY
+//! @param[in] instanceTimeout INSTANCE_TIMEOUT
+//!
+//! @return the interval to use, in seconds
+//!
+static time_t anti_entropy_interval(time_t requested, time_t ncPollingFrequency, time_t instanceTimeout)
+{
+    time_t interval = ((requested > 0) ? requested : 60);
+
+    if (interval > (instanceTimeout / 2)) {
+        LOGDEBUG("NC_ANTI_ENTROPY_INTERVAL (%ld seconds) too close to INSTANCE_TIMEOUT, using %ld seconds\n", interval, (instanceTimeout / 2));
+        interval = (instanceTimeout / 2);
+    }
+    if (interval < ncPollingFrequency) {
+        interval = ncPollingFrequency;
+    }
+    return (interval);
+}
+
+//!
+//! Records that the monitor described some of the nodes, so that the changes they pushed
+//! before that no longer need a describe of their own.
+//!
+//! @param[in] nodeMask per resourceCache slot, nonzero for the nodes described (NULL for all nodes)
+//! @param[in] when when the describe started
+//!
+static void push_nodes_described(const char *nodeMask, time_t when)
+{
+    int i = 0;
+
+    sem_mywait(PUSHCACHE);
+    for (i = 0; i < MAXNODES; i++) {
+        if (nodeMask && !nodeMask[i])
+            continue;
+
+        pushCache->nodes[i].lastDescribe = when;
+        if (pushCache->nodes[i].resyncRequested && (pushCache->nodes[i].resyncRequested <= when)) {
+            pushCache->nodes[i].resyncRequested = 0;
+        }
+    }
+    if (nodeMask == NULL) {
+        LOGDEBUG("since startup: %lld datagrams received, %lld instance changes applied, %lld gaps, %lld single node describes\n", pushCache->received,
+                 pushCache->applied, pushCache->gaps, pushCache->describes);
+    }
+    sem_mypost(PUSHCACHE);
+}
+
+//!
+//! Applies the changes a node pushed to the resource and instance caches. Only the fields
+//! the datagram carries are applied, in place under the INSTCACHE writer lock, so that what
+//! other threads changed in the same entries is kept; anything else (an instance the CC does
+//! not know about yet, a migration, lost datagrams...) has the monitor describe the node.
+//!
+//! @param[in] msg the decoded datagram
+//! @param[in] fromIp the address the datagram came from
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the sender is not one of our nodes
+//!
+static int apply_push_message(nc_push_message * msg, const char *fromIp)
+{
+    int i = 0;
+    int idx = -1;
+    int slot = -1;
+    int accept = 0;
+    int applied = 0;
+    boolean resync = FALSE;
+    ccResource *res = NULL;
+    ccPushNode *node = NULL;
+    ccInstance *myInstance = NULL;
+    nc_push_instance *rec = NULL;
+
+    sem_myrdwait(RESCACHE);
+    for (i = 0; i < resourceCache->numResources; i++) {
+        if (!strcmp(resourceCache->resources[i].ip, fromIp)) {
+            idx = i;
+            break;
+        }
+    }
+    sem_myrdpost(RESCACHE);
+
+    if (idx < 0) {
+        LOGDEBUG("ignoring pushed state from unknown node %s\n", fromIp);
+        return (EUCA_NOT_FOUND_ERROR);
+    }
+
+    sem_mywait(PUSHCACHE);
+    node = &(pushCache->nodes[idx]);
+    if (strcmp(node->ip, fromIp)) {
+        // the slot belonged to another node
+        bzero(node, sizeof(ccPushNode));
+        euca_strncpy(node->ip, fromIp, sizeof(node->ip));
+    }
+    accept = nc_push_peer_accept(&(node->peer), &(msg->hdr));
+    pushCache->received++;
+    if (accept == NC_PUSH_GAP)
+        pushCache->gaps++;
+    sem_mypost(PUSHCACHE);
+
+    if (accept == NC_PUSH_STALE) {
+        LOGTRACE("dropping stale datagram %u/%u from %s\n", msg->hdr.epoch, msg->hdr.seq, fromIp);
+        return (EUCA_OK);
+    }
+    resync = (accept != NC_PUSH_IN_ORDER);
+
+    // waking up or marking down nodes is left to refresh_resources()
+    sem_mywait(RESCACHE);
+    res = &(resourceCache->resources[idx]);
+    if ((idx < resourceCache->numResources) && !strcmp(res->ip, fromIp) && (res->state == RESUP)) {
+        res->maxMemory = msg->res.memMax;
+        res->availMemory = msg->res.memAvail;
+        res->maxDisk = msg->res.diskMax;
+        res->availDisk = msg->res.diskAvail;
+        res->maxCores = msg->res.coresMax;
+        res->availCores = msg->res.coresAvail;
+        if (!strcmp(msg->res.nodeStatus, "enabled")) {
+            res->ncState = ENABLED;
+        } else if (!strcmp(msg->res.nodeStatus, "disabled")) {
+            res->ncState = STOPPED;
+        }
+        euca_strncpy(res->nodeStatus, msg->res.nodeStatus, 24);
+    }
+    sem_mypost(RESCACHE);
+
+    // the ncnet addresses are not indexed, only the counts need to follow the state
+    sem_mywait(INSTCACHE);
+    sem_mywait(INSTCACHEMD);
+    for (i = 0; i < (int)msg->hdr.numInstances; i++) {
+        rec = &(msg->instances[i]);
+        if (rec->flags & NC_PUSH_REMOVED) {
+            // dropped by invalidate_instanceCache() once no describe reports it, as before
+            continue;
+        }
+
+        slot = instanceCache_lookup_id(rec->instanceId);
+        myInstance = ((slot >= 0) ? &(instanceCache[slot].instance) : NULL);
+        if ((rec->flags & NC_PUSH_PULL) || !myInstance || (instanceCache[slot].cacheState != INSTVALID) || (myInstance->ncHostIdx != idx)
+            || (myInstance->migration_state != NOT_MIGRATING)) {
+            LOGDEBUG("[%s] pushed by %s needs a describe of the node\n", rec->instanceId, fromIp);
+            resync = TRUE;
+        } else {
+            instanceCache_count_slot(slot, -1);
+            euca_strncpy(myInstance->state, rec->stateName, sizeof(myInstance->state));
+            euca_strncpy(myInstance->guestStateName, rec->guestStateName, sizeof(myInstance->guestStateName));
+            euca_strncpy(myInstance->bundleTaskStateName, rec->bundleTaskStateName, sizeof(myInstance->bundleTaskStateName));
+            euca_strncpy(myInstance->createImageTaskStateName, rec->createImageTaskStateName, sizeof(myInstance->createImageTaskStateName));
+            myInstance->bundleTaskProgress = (rec->bundleTaskProgress / 1000.0);
+            euca_strncpy(myInstance->ncnet.publicIp, rec->publicIp, INET_ADDR_LEN);
+            euca_strncpy(myInstance->ncnet.privateIp, rec->privateIp, INET_ADDR_LEN);
+            instanceCache_count_slot(slot, 1);
+            instanceCache[slot].lastseen = time(NULL);
+            LOGDEBUG("[%s] pushed state %s by %s\n", myInstance->instanceId, myInstance->state, fromIp);
+            applied++;
         }
-        sem_mypost(CONFIG);
-        shawn();
+    }
+    sem_mypost(INSTCACHEMD);
+    sem_mypost(INSTCACHE);
 
-        LOGTRACE("localState=%s - done.\n", config->ccStatus.localState);
-        ncRefresh = 0;
-        sleep(1);
+    sem_mywait(PUSHCACHE);
+    if (resync && !node->resyncRequested)
+        node->resyncRequested = time(NULL);
+    if (applied) {
+        pushCache->changed = 1;
+        pushCache->applied += applied;
+    }
+    sem_mypost(PUSHCACHE);
+    return (EUCA_OK);
+}
+
+//!
+//! Receives the changes pushed by the nodes (see util/nc_push.c) and applies them to the
+//! caches, so that the monitor thread does not need to poll every node to notice them.
+//!
+//! @param[in] in unused
+//!
+//! @return Never returns unless the socket cannot be opened
+//!
+void *push_thread(void *in)
+{
+    int rc = 0;
+    int fd = -1;
+    char fromIp[INET_ADDRSTRLEN] = "";
+    char keyPath[EUCA_MAX_PATH] = "";
+    unsigned char key[NC_PUSH_KEY_LEN] = { 0 };
+    nc_push_message *msg = NULL;
+
+    // the source address of a datagram proves nothing, only holders of the node key are listened to
+    snprintf(keyPath, sizeof(keyPath), NC_PUSH_KEY_FILE, config->eucahome);
+    if (nc_push_key_load(keyPath, key) != EUCA_OK) {
+        LOGERROR("cannot authenticate pushed node state without %s, falling back to polling\n", keyPath);
+        return (NULL);
     }
 
-    EUCA_FREE(pMeta.correlationId);
-    EUCA_FREE(pMeta.userId);
+    if ((msg = EUCA_ZALLOC(1, sizeof(nc_push_message))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+
+    if ((fd = nc_push_listen(NULL, config->ncPushPort)) < 0) {
+        // nodes that do not get through are described at NC_POLLING_FREQUENCY
+        LOGERROR("cannot receive pushed node state on port %d, falling back to polling\n", config->ncPushPort);
+        EUCA_FREE(msg);
+        return (NULL);
+    }
+
+    LOGINFO("receiving pushed node state on port %d\n", config->ncPushPort);
+    while (1) {
+        rc = nc_push_recv(fd, key, 1000, msg, fromIp, sizeof(fromIp));
+        if (rc == EUCA_OK) {
+            apply_push_message(msg, fromIp);
+        } else if (rc == EUCA_INVALID_ERROR) {
+            LOGDEBUG("dropping malformed datagram from %s\n", fromIp);
+        } else if (rc == EUCA_ACCESS_ERROR) {
+            LOGDEBUG("dropping datagram from %s that does not authenticate with the node key\n", fromIp);
+        } else if (rc == EUCA_ERROR) {
+            LOGWARN("cannot receive pushed node state\n");
+            sleep(1);
+        }
+    }
+
+    close(fd);
+    EUCA_FREE(msg);
     return (NULL);
 }
 
+//!
+//! Between full sweeps, describes only the nodes whose pushed changes could not be applied
+//! and the nodes that have not pushed anything for a while (not pushing at all, or their
+//! datagrams not getting through), the latter no more often than NC_POLLING_FREQUENCY.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout
+//!
+//! @return 1 if the instance cache changed since the last call, 0 otherwise
+//!
+int refresh_pushed_nodes(ncMetadata * pMeta, int timeout)
+{
+    int i = 0;
+    int numNodes = 0;
+    int numResources = 0;
+    int changed = 0;
+    time_t now = time(NULL);
+    char nodeMask[MAXNODES] = { 0 };
+    char ips[MAXNODES][24];
+    ccPushNode *node = NULL;
+
+    sem_myrdwait(RESCACHE);
+    numResources = resourceCache->numResources;
+    for (i = 0; i < numResources; i++) {
+        euca_strncpy(ips[i], resourceCache->resources[i].ip, 24);
+    }
+    sem_myrdpost(RESCACHE);
+
+    sem_mywait(PUSHCACHE);
+    for (i = 0; i < numResources; i++) {
+        node = &(pushCache->nodes[i]);
+        if (strcmp(node->ip, ips[i])) {
+            // a node we have not heard from yet
+            bzero(node, sizeof(ccPushNode));
+            euca_strncpy(node->ip, ips[i], sizeof(node->ip));
+        }
+
+        if (node->resyncRequested || (((now - node->peer.lastSeen) > (3 * NC_PUSH_HEARTBEAT_SEC)) && ((now - node->lastDescribe) >= config->ncPollingFrequency))) {
+            nodeMask[i] = 1;
+            numNodes++;
+        }
+    }
+    changed = pushCache->changed;
+    pushCache->changed = 0;
+    pushCache->describes += numNodes;
+    sem_mypost(PUSHCACHE);
+
+    if (numNodes) {
+        LOGDEBUG("describing %d of %d nodes\n", numNodes, numResources);
+        refresh_resources_nodes(pMeta, timeout, 1, nodeMask);
+        refresh_instances_nodes(pMeta, timeout, 1, nodeMask);
+        push_nodes_described(nodeMask, now);
+    }
+    return ((numNodes || changed) ? 1 : 0);
+}
+
 //!
 //!
 //!
@@ -5704,6 +7566,24 @@ int init_pthreads(void)
 
         sensor_initd = 1;
     }
+    // the listener for the changes pushed by the nodes
+    if (config->ncPushEnabled && (config->threads[PUSH] == 0 || check_process(config->threads[PUSH], "httpd-cc.conf"))) {
+        int pid;
+        pid = fork();
+        if (!pid) {
+            // set up default signal handler for this child process (for SIGTERM)
+            struct sigaction newsigact = { {NULL} };
+            newsigact.sa_handler = SIG_DFL;
+            newsigact.sa_flags = 0;
+            sigemptyset(&newsigact.sa_mask);
+            sigprocmask(SIG_SETMASK, &newsigact.sa_mask, NULL);
+            sigaction(SIGTERM, &newsigact, NULL);
+            push_thread(NULL);
+            exit(0);
+        } else {
+            config->threads[PUSH] = pid;
+        }
+    }
     // sensor initialization should preceed monitor thread creation so
     // that monitor thread has its sensor subsystem initialized
     if (config->threads[MONITOR] == 0 || check_process(config->threads[MONITOR], "httpd-cc.conf")) {
@@ -5829,6 +7709,38 @@ int init_thread(void)
             locks[i] = sem_open(lockname, O_CREAT, 0644, 1);
         }
 
+        // the cache reader/writer locks must not survive a reboot, so they are not file backed
+        if (cacheLocks == NULL) {
+            rc = setup_shared_buffer((void **)&cacheLocks, "/eucalyptusCCCacheLocks", sizeof(ccCacheLocks), &(locks[CACHELOCKS]), "/eucalyptusCCCacheLocksLock",
+                                     SHARED_MEM);
+            if (rc != 0) {
+                fprintf(stderr, "Cannot set up shared memory region for ccCacheLocks, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+            // INIT is held, so only one process initializes the locks
+            if (!euca_rwlock_is_initialized(&(cacheLocks->instanceCache)) && (euca_rwlock_init(&(cacheLocks->instanceCache)) != EUCA_OK)) {
+                fprintf(stderr, "Cannot initialize the instanceCache lock, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+            if (!euca_rwlock_is_initialized(&(cacheLocks->resourceCache)) && (euca_rwlock_init(&(cacheLocks->resourceCache)) != EUCA_OK)) {
+                fprintf(stderr, "Cannot initialize the resourceCache lock, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+        }
+
+        // which pushed changes the CC has seen only matters while the nodes keep running, so it is not file backed either
+        if (pushCache == NULL) {
+            rc = setup_shared_buffer((void **)&pushCache, "/eucalyptusCCPushCache", sizeof(ccPushCache), &(locks[PUSHCACHE]), "/eucalyptusCCPushCacheLock", SHARED_MEM);
+            if (rc != 0) {
+                fprintf(stderr, "Cannot set up shared memory region for ccPushCache, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+        }
+
         if (config == NULL) {
             rc = setup_shared_buffer((void **)&config, "/eucalyptusCCConfig", sizeof(ccConfig), &(locks[CONFIG]), "/eucalyptusCCConfigLock", SHARED_FILE);
             if (rc != 0) {
@@ -5926,13 +7838,23 @@ int init_dynamicCaches(void) {
         LOGDEBUG("ccSensorResourceCache NULL: %d\n", instanceCache==NULL);
 
         if (instanceCache == NULL) {
-            rc = setup_shared_buffer((void **)&instanceCache, "/eucalyptusCCInstanceCache", sizeof(ccInstanceCache) * config->ccMaxInstances, &(locks[INSTCACHE]),
+            rc = setup_shared_buffer((void **)&instanceCache, "/eucalyptusCCInstanceCache", instanceCache_size(config->ccMaxInstances), &(locks[INSTCACHE]),
                                      "/eucalyptusCCInstanceCacheLock", SHARED_FILE);
             if (rc != 0) {
                 fprintf(stderr, "Cannot set up shared memory region for ccInstanceCache, exiting...\n");
                 sem_mypost(INIT);
                 exit(1);
             }
+
+            // the indexes follow the array of cached instances in the same segment
+            instanceIdIndex = (euca_index *) ((char *)instanceCache + (sizeof(ccInstanceCache) * config->ccMaxInstances));
+            instanceIpIndex = (euca_index *) ((char *)instanceIdIndex + euca_index_size(config->ccMaxInstances));
+
+            // rebuilding on attach picks up caches written before the indexes existed or
+            // left behind by a process that died in the middle of an update
+            sem_mywait(INSTCACHE);
+            instanceCache_index_rebuild();
+            sem_mypost(INSTCACHE);
         }
 
         //
@@ -5997,6 +7919,41 @@ static void message_stats_setter()
     return;
 }
 
+//! Builds the values of the lock stats sensor from the counters of the cache locks.
+//! The counters live in shared memory, so they cover all the CC processes.
+static json_object *lock_stats_getter()
+{
+    int i = 0;
+    json_object *values = NULL;
+    json_object *lock_json = NULL;
+    euca_rwlock_stats stats = { 0 };
+    struct {
+        const char *name;
+        int lockno;
+    } cache_locks[] = { {"instanceCache", INSTCACHE}, {"resourceCache", RESCACHE} };
+
+    if (cacheLocks == NULL) {
+        return NULL;
+    }
+
+    values = json_object_new_object();
+    for (i = 0; i < (sizeof(cache_locks) / sizeof(cache_locks[0])); i++) {
+        euca_rwlock_get_stats(cache_rwlock(cache_locks[i].lockno), &stats);
+        lock_json = json_object_new_object();
+        json_object_object_add(lock_json, "read_acquired", json_object_new_int64(stats.rd_acquired));
+        json_object_object_add(lock_json, "read_contended", json_object_new_int64(stats.rd_contended));
+        json_object_object_add(lock_json, "read_wait_usec", json_object_new_int64(stats.rd_wait_usec));
+        json_object_object_add(lock_json, "write_acquired", json_object_new_int64(stats.wr_acquired));
+        json_object_object_add(lock_json, "write_contended", json_object_new_int64(stats.wr_contended));
+        json_object_object_add(lock_json, "write_wait_usec", json_object_new_int64(stats.wr_wait_usec));
+        json_object_object_add(lock_json, "write_hold_usec", json_object_new_int64(stats.wr_hold_usec));
+        json_object_object_add(lock_json, "write_hold_max_usec", json_object_new_int64(stats.wr_hold_max_usec));
+        json_object_object_add(lock_json, "generation", json_object_new_int64(stats.generation));
+        json_object_object_add(values, cache_locks[i].name, lock_json);
+    }
+    return values;
+}
+
 //! Update the message stat structure
 //! Wraps the message stats update with the necessary caching copies and locking
 int cached_message_stats_update(const char *message_name, long call_time, int msg_failed)
@@ -6117,6 +8074,11 @@ int update_config(void)
             } else {
                 config->ncPollingFrequency = 6;
             }
+
+            // NC anti-entropy sweep, when the nodes push their changes
+            tmpstr = configFileValue("NC_ANTI_ENTROPY_INTERVAL");
+            config->ncAntiEntropyInterval = anti_entropy_interval((tmpstr) ? atoi(tmpstr) : 0, config->ncPollingFrequency, config->instanceTimeout);
+            EUCA_FREE(tmpstr);
         }
     }
 
@@ -6162,6 +8124,9 @@ int init_config(void)
     time_t ncPollingFrequency = 0;
     time_t clcPollingFrequency = 0;
     time_t ncFanout;
+    time_t ncAntiEntropyInterval = 0;
+    int ncPushEnabled = 0;
+    int ncPushPort = NC_PUSH_DEFAULT_PORT;
     ccResource *res = NULL;
 
     // read in base config information
@@ -6261,6 +8226,10 @@ int init_config(void)
             schedPolicy = SCHEDROUNDROBIN;
         else if (!strcmp(tmpstr, "POWERSAVE"))
             schedPolicy = SCHEDPOWERSAVE;
+        else if (!strcmp(tmpstr, "BESTFIT"))
+            schedPolicy = SCHEDBESTFIT;
+        else if (!strcmp(tmpstr, "SPREAD"))
+            schedPolicy = SCHEDSPREAD;
         else if (access(tmpstr, X_OK) == 0) {   // scheduler is an executable path, assumed to be user scheduler
             LOGWARN("will use user-defined scheduler at '%s'\n", tmpstr);
             euca_strncpy(schedPath, tmpstr, sizeof(schedPath));
@@ -6363,6 +8332,32 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    // nodes pushing their state changes
+    tmpstr = configFileValue("NC_PUSH_ENABLE");
+    if (tmpstr) {
+        if (!strcmp(tmpstr, "Y")) {
+            ncPushEnabled = 1;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    tmpstr = configFileValue("NC_PUSH_PORT");
+    if (tmpstr) {
+        ncPushPort = atoi(tmpstr);
+        if (ncPushPort <= 0 || ncPushPort > 65535) {
+            LOGWARN("NC_PUSH_PORT set out of bounds (%d), resetting to default (%d)\n", ncPushPort, NC_PUSH_DEFAULT_PORT);
+            ncPushPort = NC_PUSH_DEFAULT_PORT;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    tmpstr = configFileValue("NC_ANTI_ENTROPY_INTERVAL");
+    if (tmpstr) {
+        ncAntiEntropyInterval = atoi(tmpstr);
+        EUCA_FREE(tmpstr);
+    }
+    ncAntiEntropyInterval = anti_entropy_interval(ncAntiEntropyInterval, ncPollingFrequency, instanceTimeout);
+
     // WS-Security
     use_wssec = 0;
     tmpstr = configFileValue("ENABLE_WS_SECURITY");
@@ -6458,10 +8453,20 @@ int init_config(void)
     config->instanceTimeout = instanceTimeout;
     config->ncPollingFrequency = ncPollingFrequency;
     config->ncSensorsPollingInterval = ncPollingFrequency;  // initially poll sensors with the same frequency as other NC ops
+    config->ncPushEnabled = ncPushEnabled;
+    config->ncPushPort = ncPushPort;
+    config->ncAntiEntropyInterval = ncAntiEntropyInterval;
     config->clcPollingFrequency = clcPollingFrequency;
     config->ncFanout = ncFanout;
     config->ccMaxInstances = ccMaxInstances;
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
+
+    // CC_NC_FANOUT slots shared by the fan-outs of all CC processes (see nc_fanout_task()); one left
+    // over from an earlier run may have another size, or slots its processes never gave back
+    sem_unlink("/eucalyptusCCrefreshLock");
+    if ((locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout)) == SEM_FAILED) {
+        LOGERROR("cannot create the NC call slots, fan-outs are only bounded per process\n");
+        locks[REFRESHLOCK] = NULL;
+    }
     config->initialized = 1;
     ccChangeState(LOADED);
     config->ccStatus.localEpoch = 0;
@@ -6746,7 +8751,7 @@ void shawn(void)
     }
 
     if (instanceCache)
-        msync(instanceCache, sizeof(ccInstanceCache) * config->ccMaxInstances, MS_ASYNC);
+        msync(instanceCache, instanceCache_size(config->ccMaxInstances), MS_ASYNC);
     if (instanceCacheMetadata)
         msync(instanceCacheMetadata, sizeof(ccInstanceCacheMetadata), MS_ASYNC);
     if (resourceCache)
@@ -6844,7 +8849,7 @@ int free_instanceNetwork(char *mac, int vlan, int force, int dolock)
     }
 
     if (dolock) {
-        sem_mywait(INSTCACHE);
+        sem_myrdwait(INSTCACHE);
     }
 
     inuse = FALSE;
@@ -6860,7 +8865,7 @@ int free_instanceNetwork(char *mac, int vlan, int force, int dolock)
     // TODO swathi should this account for macs and private ips of secondary enis?
 
     if (dolock) {
-        sem_mypost(INSTCACHE);
+        sem_myrdpost(INSTCACHE);
     }
     return (0);
 }
@@ -6996,102 +9001,333 @@ int allocate_ccInstance(ccInstance * out, char *id, char *amiId, char *kernelId,
 //! @param[in] inst
 //! @param[in] ip
 //!
-//! @return
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int pubIpCmp(ccInstance * inst, void *ip)
+{
+    if (!ip || !inst) {
+        return (1);
+    }
+
+    if (!strcmp((char *)ip, inst->ccnet.publicIp)) {
+        return (0);
+    }
+    return (1);
+}
+
+//!
+//!
+//!
+//! @param[in] inst
+//! @param[in] ip
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int privIpCmp(ccInstance * inst, void *ip)
+{
+    if (!ip || !inst) {
+        return (1);
+    }
+
+    if (!strcmp((char *)ip, inst->ccnet.privateIp)) {
+        return (0);
+    }
+    return (1);
+}
+
+//!
+//!
+//!
+//! @param[in] inst
+//! @param[in] ip
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int privIpSet(ccInstance * inst, void *ip)
+{
+    if (!ip || !inst) {
+        return (1);
+    }
+
+    if ((strcmp(inst->state, "Pending") && strcmp(inst->state, "Extant"))) {
+        snprintf(inst->ccnet.privateIp, INET_ADDR_LEN, "0.0.0.0");
+        return (0);
+    }
+
+    LOGDEBUG("privIpSet(): set: %s/%s\n", inst->ccnet.privateIp, (char *)ip);
+    snprintf(inst->ccnet.privateIp, INET_ADDR_LEN, "%s", (char *)ip);
+    return (0);
+}
+
+//!
+//!
+//!
+//! @param[in] inst
+//! @param[in] ip
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int pubIpSet(ccInstance * inst, void *ip)
+{
+    if (!ip || !inst) {
+        return (1);
+    }
+
+    if ((strcmp(inst->state, "Pending") && strcmp(inst->state, "Extant"))) {
+        snprintf(inst->ccnet.publicIp, INET_ADDR_LEN, "0.0.0.0");
+        return (0);
+    }
+
+    LOGDEBUG("pubIpSet(): set: %s/%s\n", inst->ccnet.publicIp, (char *)ip);
+    snprintf(inst->ccnet.publicIp, INET_ADDR_LEN, "%s", (char *)ip);
+    return (0);
+}
+
+//!
+//! Visitor for view_instanceCacheId() retrieving the index of the node
+//! running the instance
+//!
+//! @param[in]  inst the cached instance
+//! @param[out] idx pointer to the integer receiving the node index
+//!
+//! @return 0 on success, 1 on invalid parameters
+//!
+int instHostIdxGet(ccInstance * inst, void *idx)
+{
+    if (!idx || !inst) {
+        return (1);
+    }
+
+    *((int *)idx) = inst->ncHostIdx;
+    return (0);
+}
+
+//!
+//! Computes the size of the instanceCache shared segment: the array of cached
+//! instances followed by the instanceId and IP address indexes.
+//!
+//! @param[in] max the number of instanceCache slots
+//!
+//! @return the size of the segment in bytes
+//!
+static size_t instanceCache_size(int max)
+{
+    return ((sizeof(ccInstanceCache) * max) + euca_index_size(max) + euca_index_size(2 * max));
+}
+
+//!
+//! Index callback confirming that an instanceCache slot holds the given instanceId
+//!
+//! @param[in] slot the instanceCache slot
+//! @param[in] key the instanceId looked up
+//! @param[in] ctx unused
+//!
+//! @return TRUE if the slot matches, FALSE otherwise
+//!
+static boolean instanceCache_id_match(int slot, const char *key, void *ctx)
+{
+    return ((strcmp(instanceCache[slot].instance.instanceId, key) == 0) ? TRUE : FALSE);
+}
+
+//!
+//! Index callback confirming that an instanceCache slot holds the given public or private IP
+//!
+//! @param[in] slot the instanceCache slot
+//! @param[in] key the IP address looked up
+//! @param[in] ctx unused
+//!
+//! @return TRUE if the slot matches, FALSE otherwise
+//!
+static boolean instanceCache_ip_match(int slot, const char *key, void *ctx)
+{
+    if (!strcmp(instanceCache[slot].instance.ccnet.publicIp, key) || !strcmp(instanceCache[slot].instance.ccnet.privateIp, key))
+        return (TRUE);
+    return (FALSE);
+}
+
+//!
+//! Tells whether an address goes in the IP index. Unassigned addresses are shared
+//! by many instances and are left out, so looking them up falls back to a scan.
+//!
+//! @param[in] ip the address
+//!
+//! @return TRUE if the address is indexed, FALSE otherwise
+//!
+static boolean instanceCache_ip_indexable(const char *ip)
+{
+    return (((ip[0] != '\0') && strcmp(ip, "0.0.0.0")) ? TRUE : FALSE);
+}
+
 //!
-//! @pre
+//! Adds the instanceId and addresses of a slot to the indexes. Must be called with
+//! INSTCACHE held, after the slot has been written.
 //!
-//! @note
+//! @param[in] slot the instanceCache slot
 //!
-int pubIpCmp(ccInstance * inst, void *ip)
+static void instanceCache_index_slot(int slot)
 {
-    if (!ip || !inst) {
-        return (1);
-    }
+    ccInstance *inst = &(instanceCache[slot].instance);
 
-    if (!strcmp((char *)ip, inst->ccnet.publicIp)) {
-        return (0);
+    if (inst->instanceId[0] != '\0') {
+        if (euca_index_insert(instanceIdIndex, inst->instanceId, slot) != EUCA_OK)
+            LOGWARN("cannot index instance %s at slot %d\n", inst->instanceId, slot);
     }
-    return (1);
+    if (instanceCache_ip_indexable(inst->ccnet.publicIp))
+        euca_index_insert(instanceIpIndex, inst->ccnet.publicIp, slot);
+    if (instanceCache_ip_indexable(inst->ccnet.privateIp))
+        euca_index_insert(instanceIpIndex, inst->ccnet.privateIp, slot);
 }
 
 //!
+//! Removes the instanceId and addresses of a slot from the indexes. Must be called
+//! with INSTCACHE held, before the slot is overwritten.
 //!
+//! @param[in] slot the instanceCache slot
 //!
-//! @param[in] inst
-//! @param[in] ip
-//!
-//! @return
-//!
-//! @pre
+static void instanceCache_unindex_slot(int slot)
+{
+    ccInstance *inst = &(instanceCache[slot].instance);
+
+    if (inst->instanceId[0] != '\0')
+        euca_index_remove(instanceIdIndex, inst->instanceId, slot);
+    if (instanceCache_ip_indexable(inst->ccnet.publicIp))
+        euca_index_remove(instanceIpIndex, inst->ccnet.publicIp, slot);
+    if (instanceCache_ip_indexable(inst->ccnet.privateIp))
+        euca_index_remove(instanceIpIndex, inst->ccnet.privateIp, slot);
+}
+
 //!
-//! @note
+//! Rebuilds both indexes from the content of the instanceCache. Must be called
+//! with INSTCACHE held.
 //!
-int privIpCmp(ccInstance * inst, void *ip)
+static void instanceCache_index_rebuild(void)
 {
-    if (!ip || !inst) {
-        return (1);
-    }
+    int i = 0;
 
-    if (!strcmp((char *)ip, inst->ccnet.privateIp)) {
-        return (0);
+    euca_index_init(instanceIdIndex, config->ccMaxInstances);
+    euca_index_init(instanceIpIndex, (2 * config->ccMaxInstances));
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        instanceCache_index_slot(i);
     }
-    return (1);
 }
 
 //!
+//! Adds (sign > 0) or removes (sign < 0) the contribution of a slot to the instance
+//! counts of the cache metadata. Must be called with INSTCACHEMD held.
 //!
+//! @param[in] slot the instanceCache slot
+//! @param[in] sign whether the slot is counted in or out
 //!
-//! @param[in] inst
-//! @param[in] ip
+static void instanceCache_count_slot(int slot, int sign)
+{
+    if (instanceCache[slot].cacheState == INSTVALID) {
+        if (!strcmp(instanceCache[slot].instance.state, "Extant") || !strcmp(instanceCache[slot].instance.state, "Pending")) {
+            instanceCacheMetadata->numInstsActive += sign;
+        }
+        instanceCacheMetadata->numInsts += sign;
+    }
+}
+
 //!
-//! @return
+//! Finds the instanceCache slot holding an instance. Must be called with INSTCACHE held.
 //!
-//! @pre
+//! @param[in] instanceId the instance identifier
 //!
-//! @note
+//! @return the lowest matching slot or -1 if the instance is not cached
 //!
-int privIpSet(ccInstance * inst, void *ip)
+static int instanceCache_lookup_id(const char *instanceId)
 {
-    if (!ip || !inst) {
-        return (1);
-    }
+    int i = 0;
+    int slot = -1;
+    int cursor = 0;
 
-    if ((strcmp(inst->state, "Pending") && strcmp(inst->state, "Extant"))) {
-        snprintf(inst->ccnet.privateIp, INET_ADDR_LEN, "0.0.0.0");
-        return (0);
+    if (instanceId[0] == '\0') {
+        // empty identifiers are not indexed, only unused slots have them
+        for (i = 0; i < config->ccMaxInstances; i++) {
+            if (instanceCache[i].instance.instanceId[0] == '\0')
+                return (i);
+        }
+        return (-1);
     }
 
-    LOGDEBUG("privIpSet(): set: %s/%s\n", inst->ccnet.privateIp, (char *)ip);
-    snprintf(inst->ccnet.privateIp, INET_ADDR_LEN, "%s", (char *)ip);
-    return (0);
+    while ((i = euca_index_find(instanceIdIndex, instanceId, instanceCache_id_match, NULL, &cursor)) >= 0) {
+        if ((slot < 0) || (i < slot))
+            slot = i;
+    }
+    return (slot);
 }
 
 //!
+//! Flags the instances a describe call reported to the CLC, which add_instanceCache()
+//! looks at when it picks a Teardown slot to reuse. The describe calls read the cache
+//! under the reader lock, so the flags are set afterwards under a short writer section,
+//! skipping any slot that went to another instance in between.
 //!
+//! @param[in] described the slots and instances that were reported
+//! @param[in] describedLen the number of entries in described
 //!
-//! @param[in] inst
-//! @param[in] ip
+static void instanceCache_mark_described(const ccDescribedSlot * described, int describedLen)
+{
+    int i = 0;
+    int slot = 0;
+
+    if (!described || (describedLen < 1))
+        return;
+
+    sem_mywait(INSTCACHE);
+    for (i = 0; i < describedLen; i++) {
+        slot = described[i].slot;
+        if ((slot >= 0) && (slot < config->ccMaxInstances) && (instanceCache[slot].cacheState == INSTVALID)
+            && !strcmp(instanceCache[slot].instance.instanceId, described[i].instanceId)) {
+            instanceCache[slot].described = 1;
+        }
+    }
+    sem_mypost(INSTCACHE);
+}
+
 //!
-//! @return
+//! Finds the instanceCache slot holding a public or private IP address. Must be
+//! called with INSTCACHE held.
 //!
-//! @pre
+//! @param[in] ip the IP address
 //!
-//! @note
+//! @return the lowest matching slot or -1 if no cached instance has the address
 //!
-int pubIpSet(ccInstance * inst, void *ip)
+static int instanceCache_lookup_ip(const char *ip)
 {
-    if (!ip || !inst) {
-        return (1);
-    }
+    int i = 0;
+    int slot = -1;
+    int cursor = 0;
 
-    if ((strcmp(inst->state, "Pending") && strcmp(inst->state, "Extant"))) {
-        snprintf(inst->ccnet.publicIp, INET_ADDR_LEN, "0.0.0.0");
-        return (0);
+    if (!instanceCache_ip_indexable(ip)) {
+        for (i = 0; i < config->ccMaxInstances; i++) {
+            if ((instanceCache[i].instance.ccnet.publicIp[0] != '\0' || instanceCache[i].instance.ccnet.privateIp[0] != '\0') && instanceCache_ip_match(i, ip, NULL))
+                return (i);
+        }
+        return (-1);
     }
 
-    LOGDEBUG("pubIpSet(): set: %s/%s\n", inst->ccnet.publicIp, (char *)ip);
-    snprintf(inst->ccnet.publicIp, INET_ADDR_LEN, "%s", (char *)ip);
-    return (0);
+    while ((i = euca_index_find(instanceIpIndex, ip, instanceCache_ip_match, NULL, &cursor)) >= 0) {
+        if ((slot < 0) || (i < slot))
+            slot = i;
+    }
+    return (slot);
 }
 
 //!
@@ -7116,10 +9352,13 @@ int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int
 
     for (i = 0; i < config->ccMaxInstances; i++) {
         if (!match(&(instanceCache[i].instance), matchParam)) {
+            // operate() may change the instance addresses
+            instanceCache_unindex_slot(i);
             if (operate(&(instanceCache[i].instance), operateParam)) {
                 LOGWARN("instance cache mapping failed to operate at index %d\n", i);
                 ret++;
             }
+            instanceCache_index_slot(i);
         }
     }
 
@@ -7139,14 +9378,14 @@ void print_instanceCache(void)
     if (log_level_get() > EUCA_LOG_DEBUG) {
         return;
     }
-    sem_mywait(INSTCACHE);
+    sem_myrdwait(INSTCACHE);
     for (i = 0; i < config->ccMaxInstances; i++) {
         if (instanceCache[i].cacheState == INSTVALID) {
             LOGDEBUG("\tcache: %d/%d/%d %s %s %s %s\n", i, instanceCacheMetadata->numInsts, instanceCacheMetadata->numInstsActive, instanceCache[i].instance.instanceId,
                      instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp, instanceCache[i].instance.state);
         }
     }
-    sem_mypost(INSTCACHE);
+    sem_myrdpost(INSTCACHE);
 }
 
 //!
@@ -7315,6 +9554,7 @@ void invalidate_instanceCache(void)
                 //                if (!strcmp(instanceCache[i].instance.state, "Pending") || !strcmp(instanceCache[i].instance.state, "Extant")) {
                     //                    instanceCache->numInstsActive--;
                 //                }
+                instanceCache_unindex_slot(i);
                 bzero(&(instanceCache[i].instance), sizeof(ccInstance));
                 instanceCache[i].described = 0;
                 instanceCache[i].lastseen = 0;
@@ -7335,6 +9575,44 @@ void invalidate_instanceCache(void)
     sem_mypost(INSTCACHE);
 }
 
+//!
+//! Marks the instances of a node as seen when an incremental describe of the node left them
+//! out because they did not change. Only instances that the node listed since its last full
+//! describe count, so that instances the node does not know about still time out.
+//!
+//! @param[in] ncHostIdx the resourceCache slot of the node
+//! @param[in] since when the node last listed all of its instances
+//! @param[in] skipIds the instances the node reported as gone
+//! @param[in] skipIdsLen the number of identifiers in skipIds
+//!
+//! @return the number of instances marked as seen
+//!
+int touch_instanceCache_node(int ncHostIdx, time_t since, char **skipIds, int skipIdsLen)
+{
+    int i = 0;
+    int j = 0;
+    int touched = 0;
+    time_t now = time(NULL);
+
+    sem_mywait(INSTCACHE);
+    for (i = 0; i < config->ccMaxInstances; i++) {
+        if ((instanceCache[i].cacheState != INSTVALID) || (instanceCache[i].instance.ncHostIdx != ncHostIdx) || (instanceCache[i].lastseen < since))
+            continue;
+
+        for (j = 0; j < skipIdsLen; j++) {
+            if (skipIds[j] && !strcmp(skipIds[j], instanceCache[i].instance.instanceId))
+                break;
+        }
+        if (j < skipIdsLen)
+            continue;
+
+        instanceCache[i].lastseen = now;
+        touched++;
+    }
+    sem_mypost(INSTCACHE);
+    return (touched);
+}
+
 //!
 //!
 //!
@@ -7349,7 +9627,7 @@ void invalidate_instanceCache(void)
 //!
 int refresh_instanceCache(char *instanceId, ccInstance * in)
 {
-    int i, done;
+    int i;
 
     if (!instanceId || !in) {
         return (1);
@@ -7357,41 +9635,28 @@ int refresh_instanceCache(char *instanceId, ccInstance * in)
 
     sem_mywait(INSTCACHE);
     sem_mywait(INSTCACHEMD);
-    done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if (!strcmp(instanceCache[i].instance.instanceId, instanceId)) {
-            // in cache
-            // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
-            if (strcmp(in->serviceTag, instanceCache[i].instance.serviceTag) && strcmp(in->state, instanceCache[i].instance.state)
-                && !strcmp(in->state, "Teardown")) {
-                // skip
-                LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
-            } else {
-                // update cached instance info
-                memcpy(&(instanceCache[i].instance), in, sizeof(ccInstance));
-                instanceCache[i].lastseen = time(NULL);
-            }
-            //            sem_mypost(INSTCACHE);
-            //            return (0);
-            done++;
+    if ((i = instanceCache_lookup_id(instanceId)) >= 0) {
+        // in cache
+        // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
+        if (strcmp(in->serviceTag, instanceCache[i].instance.serviceTag) && strcmp(in->state, instanceCache[i].instance.state)
+            && !strcmp(in->state, "Teardown")) {
+            // skip
+            LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
+        } else {
+            // update cached instance info
+            instanceCache_count_slot(i, -1);
+            instanceCache_unindex_slot(i);
+            memcpy(&(instanceCache[i].instance), in, sizeof(ccInstance));
+            instanceCache_index_slot(i);
+            instanceCache_count_slot(i, 1);
+            instanceCache[i].lastseen = time(NULL);
         }
-    }
-
-    if (!done) {
+    } else {
         // did not find the instance already in cache
         add_instanceCache(instanceId, in);
     }
 
-
-    instanceCacheMetadata->numInsts = instanceCacheMetadata->numInstsActive = 0;
-    for (i = 0; i < config->ccMaxInstances; i++) {
-        if ((instanceCache[i].cacheState == INSTVALID)) {
-            if ( !strcmp(instanceCache[i].instance.state, "Extant") || !strcmp(instanceCache[i].instance.state, "Pending") ) {
-                instanceCacheMetadata->numInstsActive++;
-            }
-            instanceCacheMetadata->numInsts++;
-        }
-    }
+    // the counts are kept up to date by the calls above and recomputed by invalidate_instanceCache()
     LOGDEBUG("instance counts: %d/%d\n", instanceCacheMetadata->numInsts, instanceCacheMetadata->numInstsActive);
 
     sem_mypost(INSTCACHEMD);
@@ -7424,16 +9689,20 @@ int add_instanceCache(char *instanceId, ccInstance * in)
 
     //    sem_mywait(INSTCACHE);
     firstNull = idxDescribedTeardown = idxNotDescribedTeardown = idxDescribedExtant = -1;
+    if (((i = instanceCache_lookup_id(instanceId)) >= 0) && (instanceCache[i].cacheState == INSTVALID)) {
+        // already in cache
+        LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
+        instanceCache[i].lastseen = time(NULL);
+        //            sem_mypost(INSTCACHE);
+        return (0);
+    }
+
+    // look for a free slot starting where the last one was found, then for a Teardown instance to replace
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if ((instanceCache[i].cacheState == INSTVALID) && (!strcmp(instanceCache[i].instance.instanceId, instanceId))) {
-            // already in cache
-            LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
-            instanceCache[i].lastseen = time(NULL);
-            //            sem_mypost(INSTCACHE);
-            return (0);
-        } else if (instanceCache[i].cacheState == INSTINVALID) {
-            firstNull = i;
+    for (cacheIdx = 0; cacheIdx < config->ccMaxInstances && !done; cacheIdx++) {
+        i = (instanceCacheFreeHint + cacheIdx) % config->ccMaxInstances;
+        if (instanceCache[i].cacheState == INSTINVALID) {
+            firstNull = instanceCacheFreeHint = i;
             done++;
         } else if (!strcmp(instanceCache[i].instance.state, "Teardown") && instanceCache[i].described == 1) {
             idxDescribedTeardown = i;
@@ -7464,6 +9733,8 @@ int add_instanceCache(char *instanceId, ccInstance * in)
         //            instanceCacheMetadata->numInsts++;
         //        }
 
+        instanceCache_count_slot(cacheIdx, -1);
+        instanceCache_unindex_slot(cacheIdx);
         allocate_ccInstance(&(instanceCache[cacheIdx].instance), in->instanceId, in->amiId, in->kernelId, in->ramdiskId, in->amiURL, in->kernelURL,
                             in->ramdiskURL, in->ownerId, in->accountId, in->state, in->ccState, in->ts, in->reservationId, &(in->ccnet), &(in->ncnet),
                             &(in->ccvm), in->ncHostIdx, in->keyName, in->serviceTag, in->userData, in->launchIndex, in->platform, in->guestStateName, in->bundleTaskStateName,
@@ -7471,6 +9742,8 @@ int add_instanceCache(char *instanceId, ccInstance * in)
         instanceCache[cacheIdx].described = 0;
         instanceCache[cacheIdx].lastseen = time(NULL);
         instanceCache[cacheIdx].cacheState = INSTVALID;
+        instanceCache_index_slot(cacheIdx);
+        instanceCache_count_slot(cacheIdx, 1);
     } else {
         LOGERROR("not enough cache space for storing instance [%s]: skipping update\n", instanceId);
         ret = 1;
@@ -7494,24 +9767,56 @@ int del_instanceCacheId(char *instanceId)
 {
     int i;
 
+    if (!instanceId) {
+        return (1);
+    }
+
     sem_mywait(INSTCACHE);
-    for (i = 0; i < config->ccMaxInstances; i++) {
-        if ((instanceCache[i].cacheState == INSTVALID) && (!strcmp(instanceCache[i].instance.instanceId, instanceId))) {
-            // del from cache
-            bzero(&(instanceCache[i].instance), sizeof(ccInstance));
-            instanceCache[i].described = 0;
-            instanceCache[i].lastseen = 0;
-            instanceCache[i].cacheState = INSTINVALID;
-            //            instanceCache->numInsts--;
-            //            instanceCache->numInstsActive = instanceCache->numInsts;
-            sem_mypost(INSTCACHE);
-            return (0);
-        }
+    sem_mywait(INSTCACHEMD);
+    if (((i = instanceCache_lookup_id(instanceId)) >= 0) && (instanceCache[i].cacheState == INSTVALID)) {
+        // del from cache
+        instanceCache_count_slot(i, -1);
+        instanceCache_unindex_slot(i);
+        bzero(&(instanceCache[i].instance), sizeof(ccInstance));
+        instanceCache[i].described = 0;
+        instanceCache[i].lastseen = 0;
+        instanceCache[i].cacheState = INSTINVALID;
     }
+    sem_mypost(INSTCACHEMD);
     sem_mypost(INSTCACHE);
     return (0);
 }
 
+//!
+//! Runs a read-only visitor on a cached instance in place, under the cache lock,
+//! instead of handing out a heap copy of it like find_instanceCacheId() does.
+//! The visitor must not modify the instance nor keep pointers into it, and must
+//! not call anything that takes the INSTCACHE lock.
+//!
+//! @param[in] instanceId the instance identifier
+//! @param[in] visit the visitor, called once if the instance is cached
+//! @param[in] visitParam opaque pointer handed to the visitor
+//!
+//! @return 0 if the instance was found and visited successfully, 1 if it is not cached,
+//!         or the non-zero value returned by the visitor
+//!
+int view_instanceCacheId(char *instanceId, int (*visit) (ccInstance *, void *), void *visitParam)
+{
+    int i = 0;
+    int ret = 1;
+
+    if (!instanceId || !visit) {
+        return (1);
+    }
+
+    sem_myrdwait(INSTCACHE);
+    if ((i = instanceCache_lookup_id(instanceId)) >= 0) {
+        ret = visit(&(instanceCache[i].instance), visitParam);
+    }
+    sem_myrdpost(INSTCACHE);
+    return (ret);
+}
+
 //!
 //!
 //!
@@ -7532,38 +9837,36 @@ int find_instanceCacheId(char *instanceId, ccInstance ** out)
         return (1);
     }
 
-    sem_mywait(INSTCACHE);
+    sem_myrdwait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if (!strcmp(instanceCache[i].instance.instanceId, instanceId)) {
-            // found it
-            *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-            if (!*out) {
-                LOGFATAL("out of memory!\n");
-                unlock_exit(1);
-            }
-            allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId, instanceCache[i].instance.kernelId,
-                                instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL, instanceCache[i].instance.kernelURL,
-                                instanceCache[i].instance.ramdiskURL, instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId,
-                                instanceCache[i].instance.state, instanceCache[i].instance.ccState, instanceCache[i].instance.ts,
-                                instanceCache[i].instance.reservationId, &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet),
-                                &(instanceCache[i].instance.ccvm), instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
-                                instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData, instanceCache[i].instance.launchIndex,
-                                instanceCache[i].instance.platform, instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName,
-                                instanceCache[i].instance.groupNames, instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes,
-                                instanceCache[i].instance.volumesSize, instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs,
-                                instanceCache[i].instance.secNetCfgsSize);
-            LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache[i].instance.instanceId,
-                     instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp);
-            // migration-related
-            // TO-DO: move to allocate_ccInstance() ?
-            (*out)->migration_state = instanceCache[i].instance.migration_state;
-            LOGTRACE("instance %s migration state=%s\n", instanceCache[i].instance.instanceId, migration_state_names[(*out)->migration_state]);
-            done++;
+    if ((i = instanceCache_lookup_id(instanceId)) >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
-    }
-    sem_mypost(INSTCACHE);
+        allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId, instanceCache[i].instance.kernelId,
+                            instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL, instanceCache[i].instance.kernelURL,
+                            instanceCache[i].instance.ramdiskURL, instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId,
+                            instanceCache[i].instance.state, instanceCache[i].instance.ccState, instanceCache[i].instance.ts,
+                            instanceCache[i].instance.reservationId, &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet),
+                            &(instanceCache[i].instance.ccvm), instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
+                            instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData, instanceCache[i].instance.launchIndex,
+                            instanceCache[i].instance.platform, instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName,
+                            instanceCache[i].instance.groupNames, instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes,
+                            instanceCache[i].instance.volumesSize, instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs,
+                            instanceCache[i].instance.secNetCfgsSize);
+        LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache[i].instance.instanceId,
+                 instanceCache[i].instance.ccnet.publicIp, instanceCache[i].instance.ccnet.privateIp);
+        // migration-related
+        // TO-DO: move to allocate_ccInstance() ?
+        (*out)->migration_state = instanceCache[i].instance.migration_state;
+        LOGTRACE("instance %s migration state=%s\n", instanceCache[i].instance.instanceId, migration_state_names[(*out)->migration_state]);
+        done++;
+    }
+    sem_myrdpost(INSTCACHE);
     if (done) {
         return (0);
     }
@@ -7590,36 +9893,32 @@ int find_instanceCacheIP(char *ip, ccInstance ** out)
         return (1);
     }
 
-    sem_mywait(INSTCACHE);
+    sem_myrdwait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < config->ccMaxInstances && !done; i++) {
-        if ((instanceCache[i].instance.ccnet.publicIp[0] != '\0' || instanceCache[i].instance.ccnet.privateIp[0] != '\0')) {
-            if (!strcmp(instanceCache[i].instance.ccnet.publicIp, ip) || !strcmp(instanceCache[i].instance.ccnet.privateIp, ip)) {
-                // found it
-                *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-                if (!*out) {
-                    LOGFATAL("out of memory!\n");
-                    unlock_exit(1);
-                }
-                allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId,
-                                    instanceCache[i].instance.kernelId, instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL,
-                                    instanceCache[i].instance.kernelURL, instanceCache[i].instance.ramdiskURL,
-                                    instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId, instanceCache[i].instance.state,
-                                    instanceCache[i].instance.ccState, instanceCache[i].instance.ts, instanceCache[i].instance.reservationId,
-                                    &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet), &(instanceCache[i].instance.ccvm),
-                                    instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
-                                    instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData,
-                                    instanceCache[i].instance.launchIndex, instanceCache[i].instance.platform,
-                                    instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName, instanceCache[i].instance.groupNames,
-                                    instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes, instanceCache[i].instance.volumesSize,
-                                    instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs, instanceCache[i].instance.secNetCfgsSize);
-                done++;
-            }
+    if ((i = instanceCache_lookup_ip(ip)) >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
-    }
-
-    sem_mypost(INSTCACHE);
+        allocate_ccInstance(*out, instanceCache[i].instance.instanceId, instanceCache[i].instance.amiId,
+                            instanceCache[i].instance.kernelId, instanceCache[i].instance.ramdiskId, instanceCache[i].instance.amiURL,
+                            instanceCache[i].instance.kernelURL, instanceCache[i].instance.ramdiskURL,
+                            instanceCache[i].instance.ownerId, instanceCache[i].instance.accountId, instanceCache[i].instance.state,
+                            instanceCache[i].instance.ccState, instanceCache[i].instance.ts, instanceCache[i].instance.reservationId,
+                            &(instanceCache[i].instance.ccnet), &(instanceCache[i].instance.ncnet), &(instanceCache[i].instance.ccvm),
+                            instanceCache[i].instance.ncHostIdx, instanceCache[i].instance.keyName,
+                            instanceCache[i].instance.serviceTag, instanceCache[i].instance.userData,
+                            instanceCache[i].instance.launchIndex, instanceCache[i].instance.platform,
+                            instanceCache[i].instance.guestStateName, instanceCache[i].instance.bundleTaskStateName, instanceCache[i].instance.groupNames,
+                            instanceCache[i].instance.groupIds, instanceCache[i].instance.volumes, instanceCache[i].instance.volumesSize,
+                            instanceCache[i].instance.bundleTaskProgress, instanceCache[i].instance.secNetCfgs, instanceCache[i].instance.secNetCfgsSize);
+        done++;
+    }
+
+    sem_myrdpost(INSTCACHE);
     if (done) {
         return (0);
     }
@@ -7840,7 +10139,13 @@ void unlock_exit(int code)
     for (i = 0; i < ENDLOCK; i++) {
         if (mylocks[i]) {
             LOGWARN("unlocking index '%d'\n", i);
-            sem_post(locks[i]);
+            if (cache_rwlock(i) == NULL) {
+                sem_post(locks[i]);
+            } else if (mylocks[i] == MYLOCK_READ) {
+                euca_rwlock_rdunlock(cache_rwlock(i));
+            } else {
+                euca_rwlock_wrunlock(cache_rwlock(i));
+            }
         }
     }
     exit(code);
@@ -7860,8 +10165,15 @@ void unlock_exit(int code)
 int sem_mywait(int lockno)
 {
     int rc;
-    rc = sem_wait(locks[lockno]);
-    mylocks[lockno] = 1;
+    euca_rwlock *rwl = NULL;
+
+    nc_fanout_lock_taken();
+    if ((rwl = cache_rwlock(lockno)) != NULL) {
+        rc = euca_rwlock_wrlock(rwl);
+    } else {
+        rc = sem_wait(locks[lockno]);
+    }
+    mylocks[lockno] = MYLOCK_WRITE;
     return (rc);
 }
 
@@ -7878,8 +10190,119 @@ int sem_mywait(int lockno)
 //!
 int sem_mypost(int lockno)
 {
+    int rc;
+    euca_rwlock *rwl = NULL;
+
+    mylocks[lockno] = 0;
+    if ((rwl = cache_rwlock(lockno)) != NULL) {
+        rc = euca_rwlock_wrunlock(rwl);
+    } else {
+        rc = sem_post(locks[lockno]);
+    }
+    nc_fanout_lock_released();
+    return (rc);
+}
+
+//!
+//! Takes a lock for reading. For the instanceCache and resourceCache locks, any
+//! number of readers may hold the lock at the same time and only writers (taking
+//! it through sem_mywait()) are exclusive. All other locks are exclusive anyway.
+//!
+//! @param[in] lockno the lock index
+//!
+//! @return 0 on success, -1 or an error code on failure
+//!
+int sem_myrdwait(int lockno)
+{
+    int rc;
+    euca_rwlock *rwl = NULL;
+
+    nc_fanout_lock_taken();
+    if ((rwl = cache_rwlock(lockno)) != NULL) {
+        rc = euca_rwlock_rdlock(rwl);
+    } else {
+        rc = sem_wait(locks[lockno]);
+    }
+    mylocks[lockno] = MYLOCK_READ;
+    return (rc);
+}
+
+//!
+//! Releases a lock taken with sem_myrdwait()
+//!
+//! @param[in] lockno the lock index
+//!
+//! @return 0 on success, -1 or an error code on failure
+//!
+int sem_myrdpost(int lockno)
+{
+    int rc;
+    euca_rwlock *rwl = NULL;
+
     mylocks[lockno] = 0;
-    return (sem_post(locks[lockno]));
+    if ((rwl = cache_rwlock(lockno)) != NULL) {
+        rc = euca_rwlock_rdunlock(rwl);
+    } else {
+        rc = sem_post(locks[lockno]);
+    }
+    nc_fanout_lock_released();
+    return (rc);
+}
+
+//!
+//! Called before taking a lock. In a fan-out child, blocks SIGTERM while the
+//! first lock is held, so that a child terminated at its deadline never dies
+//! holding a lock that other CC processes wait for.
+//!
+static void nc_fanout_lock_taken(void)
+{
+    sigset_t set;
+
+    if (termDeferred && (termHeldLocks++ == 0)) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGTERM);
+        sigprocmask(SIG_BLOCK, &set, NULL);
+    }
+}
+
+//!
+//! Called after releasing a lock. In a fan-out child, lets a pending SIGTERM
+//! through once the last lock is released.
+//!
+static void nc_fanout_lock_released(void)
+{
+    sigset_t set;
+
+    if (termDeferred && (termHeldLocks > 0) && (--termHeldLocks == 0)) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGTERM);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+    }
+}
+
+//!
+//! Maps a lock index to its reader/writer lock, if it has one
+//!
+//! @param[in] lockno the lock index
+//!
+//! @return the reader/writer lock of INSTCACHE and RESCACHE once the shared locks are
+//!         set up, NULL for the locks that are plain semaphores
+//!
+static euca_rwlock *cache_rwlock(int lockno)
+{
+    if (cacheLocks == NULL) {
+        return (NULL);
+    }
+
+    switch (lockno) {
+    case INSTCACHE:
+        return (&(cacheLocks->instanceCache));
+    case RESCACHE:
+        return (&(cacheLocks->resourceCache));
+    default:
+        break;
+    }
+    return (NULL);
 }
 
 //!
@@ -8050,12 +10473,10 @@ int image_cache_proxykick(ccResource * res, int *numHosts)
 int doAttachNetworkInterface(ncMetadata * pMeta, char *instanceId, netConfig * netCfg){
     return (-1);
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -8072,18 +10493,13 @@ int doAttachNetworkInterface(ncMetadata * pMeta, char *instanceId, netConfig * n
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
@@ -8128,12 +10544,10 @@ int doAttachNetworkInterface(ncMetadata * pMeta, char *instanceId, netConfig * n
 int doDetachNetworkInterface(ncMetadata * pMeta, char *instanceId, char *attachmentId, int force){
     return (-1);
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
-    ccInstance *myInstance;
     time_t op_start;
     ccResourceCache resourceCacheLocal;
 
     i = 0;
-    myInstance = NULL;
     op_start = time(NULL);
 
     rc = initialize(pMeta, FALSE);
@@ -8148,18 +10562,13 @@ int doDetachNetworkInterface(ncMetadata * pMeta, char *instanceId, char *attachm
         return (1);
     }
 
-    sem_mywait(RESCACHE);
+    sem_myrdwait(RESCACHE);
     memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    sem_myrdpost(RESCACHE);
 
-    rc = find_instanceCacheId(instanceId, &myInstance);
-    if (!rc) {
+    if ((rc = view_instanceCacheId(instanceId, instHostIdxGet, &start)) == 0) {
         // found the instance in the cache
-        if (myInstance) {
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
-        }
+        stop = start + 1;
     } else {
         start = 0;
         stop = resourceCacheLocal.numResources;
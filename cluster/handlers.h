@@ -82,6 +82,8 @@
 #include <data.h>
 #include <client-marshal.h>
 #include <linux/limits.h>
+#include <euca_rwlock.h>
+#include <nc_push.h>
 #include "config.h"
 
 /*----------------------------------------------------------------------------*\
@@ -128,7 +130,7 @@ enum {
     INSTCACHEMD,
     RESCACHE,
     RESCACHESTAGE,
-    REFRESHLOCK,
+    REFRESHLOCK,                       //!< CC_NC_FANOUT slots for the NC fan-outs of all CC processes (see nc_fanout_task())
     BUNDLECACHE,
     SENSORCACHE,
     STATSCACHE,
@@ -165,6 +167,8 @@ enum {
     NCCALL29,
     NCCALL30,
     NCCALL31,
+    CACHELOCKS,
+    PUSHCACHE,
     ENDLOCK,
 };
 
@@ -202,6 +206,7 @@ enum {
     MONITOR = 0,
     SENSOR,
     STATS,
+    PUSH,
     NUM_THREADS,
 };
 
@@ -216,6 +221,8 @@ enum {
     SCHEDROUNDROBIN,
     SCHEDPOWERSAVE,
     SCHEDUSER,
+    SCHEDBESTFIT,
+    SCHEDSPREAD,
     SCHEDLAST,
 };
 
@@ -305,6 +312,8 @@ typedef struct resource_t {
     char nodeStatus[24];
     boolean migrationCapable;
     char hypervisor[16];
+    long long describeGeneration;      // generation returned by the last ncDescribeInstances, 0 to get all instances
+    time_t describeFullTime;           // when ncDescribeInstances last returned all instances of the node
 } ccResource;
 
 typedef struct ccResourceCache_t {
@@ -332,6 +341,34 @@ typedef struct ccInstanceCacheMetadata_t {
     int dirty;
 } ccInstanceCacheMetadata;
 
+//
+// Reader/writer locks taken through sem_mywait()/sem_myrdwait() for INSTCACHE and RESCACHE
+//
+typedef struct ccCacheLocks_t {
+    euca_rwlock instanceCache;
+    euca_rwlock resourceCache;
+} ccCacheLocks;
+
+//
+// What the CC knows about the nodes pushing their state changes (see util/nc_push.c),
+// in the same order as resourceCache->resources
+//
+typedef struct ccPushNode_t {
+    char ip[24];
+    nc_push_peer peer;
+    time_t lastDescribe;               //!< when the CC last described the node
+    time_t resyncRequested;            //!< when a pushed change could not be applied (0 if none)
+} ccPushNode;
+
+typedef struct ccPushCache_t {
+    ccPushNode nodes[MAXNODES];
+    int changed;
+    long long received;
+    long long applied;
+    long long gaps;
+    long long describes;
+} ccPushCache;
+
 typedef struct ccConfig_t {
     char eucahome[EUCA_MAX_PATH];
     char log_file_path[EUCA_MAX_PATH];
@@ -359,6 +396,9 @@ typedef struct ccConfig_t {
     time_t ncPollingFrequency;
     time_t clcPollingFrequency;
     time_t ncSensorsPollingInterval;
+    int ncPushEnabled;
+    int ncPushPort;
+    time_t ncAntiEntropyInterval;
     int threads[NUM_THREADS];
     int ncFanout;
     int ccState;
@@ -416,15 +456,20 @@ int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen,
 int changeState(ccResource * in, int newstate);
 int refresh_resources(ncMetadata * pMeta, int timeout, int dolock);
 int refresh_instances(ncMetadata * pMeta, int timeout, int dolock);
+int refresh_pushed_nodes(ncMetadata * pMeta, int timeout);
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock);
 int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock);
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen);
+int doDescribeInstancesVisit(ncMetadata * pMeta, char **instIds, int instIdsLen, int (*visit) (ccInstance *, migration_states, void *), void *visitParam,
+                             int *outInstsLen);
 int powerUp(ccResource * res);
 int powerDown(ncMetadata * pMeta, ccResource * node);
 void print_netConfig(char *prestr, netConfig * in);
 int ncInstance_to_ccInstance(ccInstance * dst, ncInstance * src);
 int ccInstance_to_ncInstance(ncInstance * dst, ccInstance * src);
 int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, char *targetNode, int *outresid);
+int schedule_instances(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, char *targetNode, int count,
+                       int *outresids);
 int schedule_instance_roundrobin(virtualMachine * vm, int *outresid);
 int schedule_instance_explicit(virtualMachine * vm, char *targetNode, int *outresid, boolean is_migration);
 int schedule_instance_user(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, int *outresid);
@@ -454,6 +499,7 @@ int ccGetStateString(char *statestr, int n);
 int ccCheckState(int clcTimer);
 int doBrokerPairing(void);
 void *monitor_thread(void *in);
+void *push_thread(void *in);
 int init_pthreads(void);
 int init_log(void);
 int init_thread(void);
@@ -479,6 +525,7 @@ int pubIpCmp(ccInstance * inst, void *ip);
 int privIpCmp(ccInstance * inst, void *ip);
 int privIpSet(ccInstance * inst, void *ip);
 int pubIpSet(ccInstance * inst, void *ip);
+int instHostIdxGet(ccInstance * inst, void *idx);
 int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int (*operate) (ccInstance *, void *), void *operateParam);
 void print_instanceCache(void);
 void print_ccInstance(char *tag, ccInstance * in);
@@ -486,14 +533,18 @@ void set_clean_instanceCache(void);
 void set_dirty_instanceCache(void);
 int is_clean_instanceCache(void);
 void invalidate_instanceCache(void);
+int touch_instanceCache_node(int ncHostIdx, time_t since, char **skipIds, int skipIdsLen);
 int refresh_instanceCache(char *instanceId, ccInstance * in);
 int add_instanceCache(char *instanceId, ccInstance * in);
 int del_instanceCacheId(char *instanceId);
+int view_instanceCacheId(char *instanceId, int (*visit) (ccInstance *, void *), void *visitParam);
 int find_instanceCacheId(char *instanceId, ccInstance ** out);
 int find_instanceCacheIP(char *ip, ccInstance ** out);
 void unlock_exit(int code);
 int sem_mywait(int lockno);
 int sem_mypost(int lockno);
+int sem_myrdwait(int lockno);
+int sem_myrdpost(int lockno);
 int image_cache(char *id, char *url);
 int image_cache_invalidate(void);
 int image_cache_proxykick(ccResource * res, int *numHosts);
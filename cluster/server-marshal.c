@@ -114,6 +114,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Where describeInstanceVisitor() adds the instances it marshals
+typedef struct describeInstancesCtx_t {
+    adb_describeInstancesResponseType_t *dirt;  //!< the response being built
+    const axutil_env_t *env;           //!< the AXIS2 environment of the request
+} describeInstancesCtx;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -141,6 +147,9 @@ extern euca_network *gpEucaNet;
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int describeInstanceVisitor(ccInstance * inst, migration_states reported, void *ctx);
+static int ccInstanceUnmarshalState(adb_ccInstanceType_t * dst, ccInstance * src, migration_states migration_state, const axutil_env_t * env);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -1283,7 +1292,6 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     adb_DescribeInstancesResponse_t *ret = NULL;
     adb_describeInstancesResponseType_t *dirt = NULL;
     adb_describeInstancesType_t *dit = NULL;
-    adb_ccInstanceType_t *it = NULL;
     char **instIds = NULL;
     int instIdsLen = 0;
     int outInstsLen = 0;
@@ -1291,9 +1299,8 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     int rc = 0;
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256] = { 0 };
-    ccInstance *outInsts = NULL;
-    ccInstance *myInstance = NULL;
     ncMetadata ccMeta = { 0 };
+    describeInstancesCtx ctx = { 0 };
     long long call_time = time_ms();
 
     dit = adb_DescribeInstances_get_DescribeInstances(describeInstances, env);
@@ -1307,27 +1314,22 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
 
     dirt = adb_describeInstancesResponseType_create(env);
 
+    // the instances are marshalled straight from the shared cache
+    ctx.dirt = dirt;
+    ctx.env = env;
+
     rc = 1;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
-        rc = doDescribeInstances(&ccMeta, instIds, instIdsLen, &outInsts, &outInstsLen);
+        rc = doDescribeInstancesVisit(&ccMeta, instIds, instIdsLen, describeInstanceVisitor, &ctx, &outInstsLen);
         unset_corrid(corr_id);
     }
 
     EUCA_FREE(instIds);
     if (rc) {
-        LOGERROR("doDescribeInstances() failed: %d (%d)\n", rc, instIdsLen);
+        LOGERROR("doDescribeInstancesVisit() failed: %d (%d)\n", rc, instIdsLen);
         status = AXIS2_FALSE;
         snprintf(statusMessage, 255, "ERROR");
-    } else {
-        for (i = 0; i < outInstsLen; i++) {
-            myInstance = &(outInsts[i]);
-
-            it = adb_ccInstanceType_create(env);
-            rc = ccInstanceUnmarshal(it, myInstance, env);
-            adb_describeInstancesResponseType_add_instances(dirt, env, it);
-        }
-        EUCA_FREE(outInsts);
     }
 
     adb_describeInstancesResponseType_set_correlationId(dirt, env, ccMeta.correlationId);
@@ -1345,6 +1347,30 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     return (ret);
 }
 
+//!
+//! Visitor for doDescribeInstancesVisit() marshalling a cached instance into
+//! the DescribeInstances response
+//!
+//! @param[in] inst the cached instance, read-only
+//! @param[in] reported the migration state to report for the instance
+//! @param[in] ctx the describeInstancesCtx of the request
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int describeInstanceVisitor(ccInstance * inst, migration_states reported, void *ctx)
+{
+    adb_ccInstanceType_t *it = NULL;
+    describeInstancesCtx *pCtx = ((describeInstancesCtx *) ctx);
+
+    if ((it = adb_ccInstanceType_create(pCtx->env)) == NULL) {
+        return (1);
+    }
+
+    ccInstanceUnmarshalState(it, inst, reported, pCtx->env);
+    adb_describeInstancesResponseType_add_instances(pCtx->dirt, pCtx->env, it);
+    return (0);
+}
+
 //!
 //! Converts an instance structure to an AXIS2 instance structure.
 //!
@@ -1359,6 +1385,23 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
 //! @note
 //!
 int ccInstanceUnmarshal(adb_ccInstanceType_t * dst, ccInstance * src, const axutil_env_t * env)
+{
+    return (ccInstanceUnmarshalState(dst, src, src->migration_state, env));
+}
+
+//!
+//! Converts an instance structure to an AXIS2 instance structure, reporting the
+//! given migration state rather than the one of the instance. The instance is
+//! only read, so it may be an entry of the shared instance cache.
+//!
+//! @param[in] dst a pointer to the AXIS2 instance structure
+//! @param[in] src a pointer to the instance structure to convert
+//! @param[in] migration_state the migration state to report
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return Always return 0
+//!
+static int ccInstanceUnmarshalState(adb_ccInstanceType_t * dst, ccInstance * src, migration_states migration_state, const axutil_env_t * env)
 {
     axutil_date_time_t *dt = NULL;
     adb_virtualMachineType_t *vm = NULL;
@@ -1396,13 +1439,13 @@ int ccInstanceUnmarshal(adb_ccInstanceType_t * dst, ccInstance * src, const axut
     }
     adb_ccInstanceType_set_bundleTaskProgress(dst, env, src->bundleTaskProgress);
     //GRZE: these strings should be made an enum indexed by the migration_states_t
-    if (src->migration_state == MIGRATION_PREPARING) {
+    if (migration_state == MIGRATION_PREPARING) {
         adb_ccInstanceType_set_migrationStateName(dst, env, "preparing");
         if (strlen(src->migration_src) && strlen(src->migration_dst)) {
             adb_ccInstanceType_set_migrationDestination(dst, env, src->migration_dst);
             adb_ccInstanceType_set_migrationSource(dst, env, src->migration_src);
         }
-    } else if (src->migration_state == MIGRATION_IN_PROGRESS) {
+    } else if (migration_state == MIGRATION_IN_PROGRESS) {
         adb_ccInstanceType_set_migrationStateName(dst, env, "migrating");
         if (strlen(src->migration_src) && strlen(src->migration_dst)) {
             adb_ccInstanceType_set_migrationDestination(dst, env, src->migration_dst);
@@ -96,6 +96,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define EBT_MIN_CAPACITY                         16     //!< Chains or rules allocated at once the first time, doubled after that
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -140,12 +142,18 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static boolean ebt_chain_match(int slot, const char *key, void *ctx);
+static boolean ebt_rule_match(int slot, const char *key, void *ctx);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Capacity to grow an array to so that it can hold one more element
+#define EBT_GROW(_capacity)                      (((_capacity) < EBT_MIN_CAPACITY) ? EBT_MIN_CAPACITY : ((_capacity) * 2))
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -582,13 +590,24 @@ int ebt_table_add_chain(ebt_handler * ebth, char *tablename, char *chainname, ch
 
     chain = ebt_table_find_chain(ebth, tablename, chainname);
     if (!chain) {
-        table->chains = realloc(table->chains, sizeof(ebt_chain) * (table->max_chains + 1));
-        if (!table->chains) {
+        if (table->max_chains == table->chain_capacity) {
+            table->chain_capacity = EBT_GROW(table->chain_capacity);
+            table->chains = realloc(table->chains, sizeof(ebt_chain) * table->chain_capacity);
+            if (!table->chains) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+        }
+        if (table->chain_index == NULL) {
+            table->chain_index = euca_index_alloc(table->chain_capacity);
+        }
+        if (!table->chain_index || (euca_index_reserve(&(table->chain_index), table->chain_capacity) != EUCA_OK)) {
             LOGFATAL("out of memory!\n");
             exit(1);
         }
         bzero(&(table->chains[table->max_chains]), sizeof(ebt_chain));
         snprintf(table->chains[table->max_chains].name, 64, "%s", chainname);
+        euca_index_insert(table->chain_index, table->chains[table->max_chains].name, table->max_chains);
         snprintf(table->chains[table->max_chains].policyname, 64, "%s", policyname);
         snprintf(table->chains[table->max_chains].counters, 64, "%s", counters);
         if (!strcmp(table->chains[table->max_chains].name, "INPUT") ||
@@ -646,13 +665,24 @@ int ebt_chain_add_rule(ebt_handler * ebth, char *tablename, char *chainname, cha
 
     rule = ebt_chain_find_rule(ebth, tablename, chainname, newrule);
     if (!rule) {
-        chain->rules = realloc(chain->rules, sizeof(ebt_rule) * (chain->max_rules + 1));
-        if (!chain->rules) {
+        if (chain->max_rules == chain->rule_capacity) {
+            chain->rule_capacity = EBT_GROW(chain->rule_capacity);
+            chain->rules = realloc(chain->rules, sizeof(ebt_rule) * chain->rule_capacity);
+            if (!chain->rules) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+        }
+        if (chain->rule_index == NULL) {
+            chain->rule_index = euca_index_alloc(chain->rule_capacity);
+        }
+        if (!chain->rule_index || (euca_index_reserve(&(chain->rule_index), chain->rule_capacity) != EUCA_OK)) {
             LOGFATAL("out of memory!\n");
             exit(1);
         }
         bzero(&(chain->rules[chain->max_rules]), sizeof(ebt_rule));
         snprintf(chain->rules[chain->max_rules].ebtrule, 1024, "%s", newrule);
+        euca_index_insert(chain->rule_index, chain->rules[chain->max_rules].ebtrule, chain->max_rules);
         chain->max_rules++;
     }
     return (0);
@@ -707,6 +737,36 @@ int ebt_handler_update_refcounts(ebt_handler * ebth)
     return (0);
 }
 
+//!
+//! Confirms that a chain slot found in a table's chain index holds the given name.
+//!
+//! @param[in] slot the slot in the table's chains
+//! @param[in] key the chain name looked up
+//! @param[in] ctx pointer to the table
+//!
+//! @return TRUE if the chain at slot has that name
+//!
+static boolean ebt_chain_match(int slot, const char *key, void *ctx)
+{
+    ebt_table *table = ((ebt_table *) ctx);
+    return ((slot < table->max_chains) && !strcmp(table->chains[slot].name, key));
+}
+
+//!
+//! Confirms that a rule slot found in a chain's rule index holds the given rule.
+//!
+//! @param[in] slot the slot in the chain's rules
+//! @param[in] key the rule looked up
+//! @param[in] ctx pointer to the chain
+//!
+//! @return TRUE if the rule at slot is that rule
+//!
+static boolean ebt_rule_match(int slot, const char *key, void *ctx)
+{
+    ebt_chain *chain = ((ebt_chain *) ctx);
+    return ((slot < chain->max_rules) && !strcmp(chain->rules[slot].ebtrule, key));
+}
+
 //!
 //! Function description.
 //!
@@ -761,7 +821,7 @@ ebt_table *ebt_handler_find_table(ebt_handler * ebth, char *findtable)
 //!
 ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findchain)
 {
-    int i, found = 0, chainidx = 0;
+    int chainidx = 0;
     ebt_table *table = NULL;
 
     if (!ebth || !tablename || !findchain || !ebth->init) {
@@ -773,14 +833,7 @@ ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findc
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < table->max_chains && !found; i++) {
-        chainidx = i;
-        if (!strcmp(table->chains[i].name, findchain))
-            found++;
-    }
-
-    if (!found) {
+    if ((chainidx = euca_index_find(table->chain_index, findchain, ebt_chain_match, table, NULL)) < 0) {
         return (NULL);
     }
 
@@ -807,7 +860,7 @@ ebt_chain *ebt_table_find_chain(ebt_handler * ebth, char *tablename, char *findc
 //!
 ebt_rule *ebt_chain_find_rule(ebt_handler * ebth, char *tablename, char *chainname, char *findrule)
 {
-    int i, found = 0;
+    int ruleidx = 0;
     ebt_chain *chain;
 
     if (!ebth || !tablename || !chainname || !findrule || !ebth->init) {
@@ -819,14 +872,10 @@ ebt_rule *ebt_chain_find_rule(ebt_handler * ebth, char *tablename, char *chainna
         return (NULL);
     }
 
-    for (i = 0; i < chain->max_rules; i++) {
-        if (!strcmp(chain->rules[i].ebtrule, findrule))
-            found++;
-    }
-    if (!found) {
+    if ((ruleidx = euca_index_find(chain->rule_index, findrule, ebt_rule_match, chain, NULL)) < 0) {
         return (NULL);
     }
-    return (&(chain->rules[i]));
+    return (&(chain->rules[ruleidx]));
 }
 
 //!
@@ -906,7 +955,9 @@ int ebt_table_deletechainmatch(ebt_handler * ebth, char *tablename, char *chainm
     found = 0;
     for (i = 0; i < table->max_chains && !found; i++) {
         if (strstr(table->chains[i].name, chainmatch)) {
+            euca_index_remove(table->chain_index, table->chains[i].name, i);
             EUCA_FREE(table->chains[i].rules);
+            EUCA_FREE(table->chains[i].rule_index);
             bzero(&(table->chains[i]), sizeof(ebt_chain));
             snprintf(table->chains[i].name, 64, "EMPTY");
         }
@@ -951,7 +1002,9 @@ int ebt_chain_flush(ebt_handler * ebth, char *tablename, char *chainname)
     }
 
     EUCA_FREE(chain->rules);
+    EUCA_FREE(chain->rule_index);
     chain->max_rules = 0;
+    chain->rule_capacity = 0;
     chain->counters[0] = '\0';
 
     return (0);
@@ -979,9 +1032,8 @@ int ebt_chain_flush_rule(ebt_handler * ebth, char *tablename, char *chainname, c
     ebt_table *table = NULL;
     ebt_chain *chain = NULL;
     ebt_rule *rule = NULL;
-    ebt_rule *newrules = NULL;
     int i;
-    int nridx;
+    int slot;
 
     if (!ebth || !tablename || !chainname || !findrule || !ebth->init) {
         return (EUCA_INVALID_ERROR);
@@ -1000,26 +1052,19 @@ int ebt_chain_flush_rule(ebt_handler * ebth, char *tablename, char *chainname, c
     rule = ebt_chain_find_rule(ebth, tablename, chainname, findrule);
     if (rule) {
         if (chain->max_rules > 1) {
-            newrules = realloc(newrules, sizeof (ebt_rule) * (chain->max_rules - 1));
-            if (!newrules) {
-                LOGFATAL("out of memory!\n");
-                exit(1);
-            }
-
-            bzero(newrules, sizeof (ebt_rule) * (chain->max_rules - 1));
-            nridx = 0;
+            // close the gap in place, the rules after it move down one slot so reindex them
+            slot = (rule - chain->rules);
+            memmove(&(chain->rules[slot]), &(chain->rules[slot + 1]), sizeof(ebt_rule) * (chain->max_rules - slot - 1));
+            chain->max_rules--;
+            euca_index_clear(chain->rule_index);
             for (i = 0; i < chain->max_rules; i++) {
-                if (strcmp(chain->rules[i].ebtrule, findrule)) {
-                    snprintf(newrules[nridx].ebtrule, 1024, "%s", chain->rules[i].ebtrule);
-                    nridx++;
-                }
+                euca_index_insert(chain->rule_index, chain->rules[i].ebtrule, i);
             }
-            EUCA_FREE(chain->rules);
-            chain->rules = newrules;
-            chain->max_rules = nridx;
         } else {
             EUCA_FREE(chain->rules);
+            EUCA_FREE(chain->rule_index);
             chain->max_rules = 0;
+            chain->rule_capacity = 0;
             chain->counters[0] = '\0';
         }
     } else {
@@ -1057,8 +1102,10 @@ int ebt_handler_free(ebt_handler * ebth)
     for (i = 0; i < ebth->max_tables; i++) {
         for (j = 0; j < ebth->tables[i].max_chains; j++) {
             EUCA_FREE(ebth->tables[i].chains[j].rules);
+            EUCA_FREE(ebth->tables[i].chains[j].rule_index);
         }
         EUCA_FREE(ebth->tables[i].chains);
+        EUCA_FREE(ebth->tables[i].chain_index);
     }
     EUCA_FREE(ebth->tables);
 
@@ -1096,8 +1143,10 @@ int ebt_handler_close(ebt_handler * ebth)
     for (i = 0; i < ebth->max_tables; i++) {
         for (j = 0; j < ebth->tables[i].max_chains; j++) {
             EUCA_FREE(ebth->tables[i].chains[j].rules);
+            EUCA_FREE(ebth->tables[i].chains[j].rule_index);
         }
         EUCA_FREE(ebth->tables[i].chains);
+        EUCA_FREE(ebth->tables[i].chain_index);
     }
     EUCA_FREE(ebth->tables);
 
@@ -1145,3 +1194,59 @@ int ebt_handler_print(ebt_handler * ebth)
 
     return (0);
 }
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+
+#define TEST_RULES                               100000 //!< Rules in the chain of the build benchmark
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    char rule[1024] = "";
+    struct timeval tv = { 0 };
+    ebt_chain *chain = NULL;
+    ebt_handler ebt = { 0 };
+
+    log_file_set(NULL, NULL);
+    ebt.init = 1;
+    ebt_handler_add_table(&ebt, "filter");
+    ebt_table_add_chain(&ebt, "filter", "FORWARD", "ACCEPT", "");
+    ebt_table_add_chain(&ebt, "filter", "EU_BIG", "ACCEPT", "");
+
+    eucanetd_timer_usec(&tv);
+    for (i = 0; i < TEST_RULES; i++) {
+        snprintf(rule, sizeof(rule), "-p IPv4 -i vn_i-%08x --ip-src 10.%d.%d.%d -j ACCEPT", i, (i >> 16), ((i >> 8) & 0xff), (i & 0xff));
+        ebt_chain_add_rule(&ebt, "filter", "EU_BIG", rule);
+    }
+    printf("built a %d-rule chain: %.2f ms\n", TEST_RULES, eucanetd_timer_usec(&tv) / 1000.0);
+
+    // rules are found where they are and adding one twice keeps a single copy
+    chain = ebt_table_find_chain(&ebt, "filter", "EU_BIG");
+    assert(chain && (chain->max_rules == TEST_RULES));
+    assert(ebt_chain_find_rule(&ebt, "filter", "EU_BIG", rule) == &(chain->rules[TEST_RULES - 1]));
+    assert(ebt_chain_find_rule(&ebt, "filter", "EU_BIG", "-j DROP") == NULL);
+    ebt_chain_add_rule(&ebt, "filter", "EU_BIG", rule);
+    assert(chain->max_rules == TEST_RULES);
+
+    // flushing one rule keeps the others in order and still findable
+    snprintf(rule, sizeof(rule), "-p IPv4 -i vn_i-%08x --ip-src 10.%d.%d.%d -j ACCEPT", 10, 0, 0, 10);
+    assert(ebt_chain_flush_rule(&ebt, "filter", "EU_BIG", rule) == 0);
+    assert(ebt_chain_find_rule(&ebt, "filter", "EU_BIG", rule) == NULL);
+    assert((chain->max_rules == (TEST_RULES - 1)) && strstr(chain->rules[10].ebtrule, "vn_i-0000000b"));
+    snprintf(rule, sizeof(rule), "-p IPv4 -i vn_i-%08x --ip-src 10.%d.%d.%d -j ACCEPT", 11, 0, 0, 11);
+    assert(ebt_chain_find_rule(&ebt, "filter", "EU_BIG", rule) == &(chain->rules[10]));
+
+    // deleted chains can no longer be found and can be added back
+    assert(ebt_table_deletechainmatch(&ebt, "filter", "EU_BIG") == 0);
+    assert(ebt_table_find_chain(&ebt, "filter", "EU_BIG") == NULL);
+    assert(ebt_table_find_chain(&ebt, "filter", "FORWARD") != NULL);
+    ebt_table_add_chain(&ebt, "filter", "EU_BIG", "ACCEPT", "");
+    assert(ebt_table_find_chain(&ebt, "filter", "EU_BIG")->max_rules == 0);
+
+    ebt_handler_close(&ebt);
+    printf("functional tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
@@ -77,6 +77,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <euca_index.h>
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -111,6 +113,8 @@ typedef struct ebt_chain_t {
     char counters[64];
     ebt_rule *rules;
     int max_rules;
+    int rule_capacity;                 //!< number of rules allocated, grown by doubling
+    euca_index *rule_index;            //!< rule text -> slot in rules
     int ref_count;
 } ebt_chain;
 
@@ -118,6 +122,8 @@ typedef struct ebt_table_t {
     char name[64];
     ebt_chain *chains;
     int max_chains;
+    int chain_capacity;                //!< number of chains allocated, grown by doubling
+    euca_index *chain_index;           //!< chain name -> slot in chains
 } ebt_table;
 
 typedef struct ebt_handler_t {
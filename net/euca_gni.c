@@ -79,7 +79,11 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
 #include <linux/limits.h>
 #include <sys/socket.h>
@@ -94,6 +98,9 @@
 #include <euca_string.h>
 #include <euca_network.h>
 #include <atomic_file.h>
+#include <euca_index.h>
+
+#include <libxml/xmlreader.h>
 
 #include "ipt_handler.h"
 #include "ips_handler.h"
@@ -109,6 +116,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define GNI_MIN_CAPACITY                         16     //!< Entries allocated at once the first time a streamed list grows, doubled after that
+
+#define GNI_CACHE_MAGIC                  0x474e4943     //!< "GNIC", first bytes of a GNI cache file
+#define GNI_CACHE_FORMAT                          1     //!< Bump whenever the cache payload layout changes
+#define GNI_CACHE_MIN_BUF                     65536     //!< Initial size of the cache serialization buffer
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -127,6 +140,39 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! State shared by the streaming (xmlTextReader) populators
+typedef struct gni_stream_t {
+    xmlTextReaderPtr reader;           //!< Reader positioned somewhere in the GNI XML file
+    globalNetworkInfo *gni;            //!< Structure being populated
+    int instance_capacity;             //!< Allocated entries in gni->instances
+    int ifs_capacity;                  //!< Allocated entries in gni->ifs
+    int secgroup_capacity;             //!< Allocated entries in gni->secgroups
+} gni_stream;
+
+//! Header of a GNI cache file (see gni_cache_save())
+typedef struct gni_cache_header_t {
+    u32 magic;                         //!< Always GNI_CACHE_MAGIC
+    u32 format;                        //!< Payload format version (GNI_CACHE_FORMAT)
+    u32 layout;                        //!< Fingerprint of the structures copied as-is (see gni_cache_layout())
+    u32 reserved;                      //!< Unused, keeps the header 64-bit aligned
+    u64 length;                        //!< Length of the payload following the header
+    char xmlhash[64];                  //!< MD5 of the XML file the cached structure was populated from
+} gni_cache_header;
+
+//! Growable buffer a GNI is serialized into
+typedef struct gni_cache_buf_t {
+    char *data;                        //!< Serialized bytes
+    size_t len;                        //!< Bytes used
+    size_t size;                       //!< Bytes allocated
+} gni_cache_buf;
+
+//! Read position in a mapped GNI cache file
+typedef struct gni_cache_cursor_t {
+    const char *p;                     //!< Next byte to read
+    const char *end;                   //!< End of the payload
+    boolean error;                     //!< Set once a read ran past the end or met an invalid count
+} gni_cache_cursor;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -163,12 +209,59 @@ static boolean xml_initialized = FALSE;    //!< To determine if the XML library
 //! Static prototypes
 static int map_proto_to_names(int proto_number, char *out_proto_name, int out_proto_len);
 
+static boolean gni_instance_name_match(int slot, const char *key, void *ctx);
+static boolean gni_interface_owner_match(int slot, const char *key, void *ctx);
+static boolean gni_secgroup_name_match(int slot, const char *key, void *ctx);
+static boolean gni_vpc_name_match(int slot, const char *key, void *ctx);
+static boolean gni_vpcsubnet_name_match(int slot, const char *key, void *ctx);
+static int gni_link_nodes(globalNetworkInfo *gni);
+static int gni_link_secgroups(globalNetworkInfo *gni);
+static int gni_link_vpcs(globalNetworkInfo *gni);
+static int gni_drop_interfaces(globalNetworkInfo *gni);
+
+static int gni_stream_child(xmlTextReaderPtr reader, int depth, const xmlChar **name);
+static xmlChar *gni_stream_text(xmlTextReaderPtr reader);
+static int gni_stream_values(gni_stream *stream, char ***values, int *max_values);
+static int gni_stream_instance(gni_stream *stream, gni_instance *instance);
+static int gni_stream_interfaces(gni_stream *stream, gni_instance *instance);
+static int gni_stream_instances(gni_stream *stream);
+static int gni_stream_rule(gni_stream *stream, gni_rule *rule);
+static int gni_stream_rules(gni_stream *stream, gni_rule **rules, int *max_rules);
+static int gni_stream_sg(gni_stream *stream, gni_secgroup *secgroup);
+static int gni_stream_sgs(gni_stream *stream);
+
+static u32 gni_cache_layout(void);
+static void gni_cache_put(gni_cache_buf *buf, const void *data, size_t len);
+static void gni_cache_put_int(gni_cache_buf *buf, int val);
+static void gni_cache_put_str(gni_cache_buf *buf, const char *str);
+static void gni_cache_put_names(gni_cache_buf *buf, gni_name *names, int max_names);
+static void gni_cache_put_array(gni_cache_buf *buf, const void *array, int max_elems, size_t size);
+static void gni_cache_get(gni_cache_cursor *cur, void *data, size_t len);
+static int gni_cache_get_int(gni_cache_cursor *cur);
+static int gni_cache_get_count(gni_cache_cursor *cur);
+static void gni_cache_get_str(gni_cache_cursor *cur, char *str, size_t size);
+static gni_name *gni_cache_get_names(gni_cache_cursor *cur, int *max_names);
+static void *gni_cache_get_array(gni_cache_cursor *cur, int *max_elems, size_t size);
+static void gni_cache_put_instance(gni_cache_buf *buf, gni_instance *instance);
+static gni_instance *gni_cache_get_instance(gni_cache_cursor *cur);
+static void gni_cache_scrub_secgroup(gni_secgroup *secgroup);
+static void gni_cache_scrub_cluster(gni_cluster *cluster);
+static void gni_cache_scrub_vpc(gni_vpc *vpc);
+static void gni_cache_scrub_vpcsubnet(gni_vpcsubnet *vpcsubnet);
+static void gni_cache_scrub_networkacl(gni_network_acl *netacl);
+static void gni_cache_scrub_routetable(gni_route_table *routetable);
+static void gni_cache_scrub_dhcpos(gni_dhcp_os *dhcpos);
+static int gni_cache_serialize(globalNetworkInfo *gni, gni_cache_buf *buf);
+static int gni_cache_deserialize(globalNetworkInfo *gni, gni_cache_cursor *cur);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define GNI_GROW(_capacity)                      (((_capacity) < GNI_MIN_CAPACITY) ? GNI_MIN_CAPACITY : ((_capacity) * 2))
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -2042,212 +2135,1942 @@ int evaluate_xpath_element(xmlXPathContextPtr ctxptr, xmlDocPtr doc, xmlNodePtr
                 }
             }
         }
-        xmlXPathFreeObject(objptr);
+        xmlXPathFreeObject(objptr);
+    }
+
+    return (res);
+}
+
+/**
+ * Evaluates XPATH and retrieves the xmlNodeSet of the query.
+ * @param ctxptr [in] pointer to the xmlXPathContext
+ * @param doc [in] a pointer to the XML document
+ * @param startnode [in] xmlNodePtr where the search should start
+ * @param expression [in] expression a string pointer to the expression we want to evaluate
+ * @param nodeset [out] xmlNodeSetPtr of the query.
+ * @return 0 on success. 1 otherwise.
+ */
+int evaluate_xpath_nodeset(xmlXPathContextPtr ctxptr, xmlDocPtr doc, xmlNodePtr startnode, char *expression, xmlNodeSetPtr nodeset) {
+    xmlXPathObjectPtr objptr;
+    int res = 0;
+
+    if (!nodeset) {
+        LOGWARN("cannot return nodeset to NULL\n");
+        return (1);
+    }
+    bzero(nodeset, sizeof (xmlNodeSet));
+    if ((!ctxptr) || (!doc) || (!nodeset)) {
+        LOGERROR("Invalid argument: NULL xpath context, xmlDoc, or nodeset\n");
+        res = 1;
+    } else {
+        ctxptr->node = startnode;
+        objptr = xmlXPathEvalExpression((unsigned char *) expression, ctxptr);
+        if (objptr == NULL) {
+            LOGERROR("unable to evaluate xpath expression '%s'\n", expression);
+            res = 1;
+        } else {
+            if (objptr->nodesetval) {
+                nodeset->nodeNr = objptr->nodesetval->nodeNr;
+                nodeset->nodeMax = objptr->nodesetval->nodeMax;
+                nodeset->nodeTab = EUCA_ZALLOC_C(nodeset->nodeMax, sizeof (xmlNodePtr));
+                memcpy(nodeset->nodeTab, objptr->nodesetval->nodeTab, nodeset->nodeMax * sizeof (xmlNodePtr));
+            }
+        }
+        xmlXPathFreeObject(objptr);
+    }
+    return (res);
+}
+
+/**
+ * Allocates and initializes a new globalNetworkInfo structure.
+ * @return A pointer to the newly allocated structure or NULL if any failure occurred.
+ */
+globalNetworkInfo *gni_init() {
+    globalNetworkInfo *gni = NULL;
+    gni = EUCA_ZALLOC_C(1, sizeof (globalNetworkInfo));
+
+    gni->init = 1;
+    return (gni);
+}
+
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
+    return (gni_populate_v(GNI_POPULATE_ALL, gni, host_info, xmlpath));
+}
+
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file.
+ * The file is read once with an xmlTextReader. Instances (and their interfaces)
+ * and security groups, which grow with the cloud, are built straight from the
+ * reader. The other sections are small: each one is expanded on its own and
+ * handed to its XPath populator, so no DOM of the whole document is ever built.
+ * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate_v(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
+    int rc = 0;
+    int ret = 0;
+    int nodetype = GNI_XPATH_INVALID;
+    boolean skip = FALSE;
+    boolean done = FALSE;
+    xmlChar *attr = NULL;
+    xmlNodePtr xmlnode = NULL;
+    xmlXPathContextPtr ctxptr = NULL;
+    gni_stream stream = { 0 };
+    struct timeval tv, ttv;
+
+    if (mode == GNI_POPULATE_NONE) {
+        return (0);
+    }
+
+    eucanetd_timer_usec(&ttv);
+    eucanetd_timer_usec(&tv);
+    if (!gni) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
+
+    gni_clear(gni);
+    LOGTRACE("gni cleared in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    XML_INIT();
+    LIBXML_TEST_VERSION
+    stream.gni = gni;
+    stream.reader = xmlReaderForFile(xmlpath, NULL, 0);
+    if (stream.reader == NULL) {
+        LOGERROR("unable to open XML file (%s)\n", xmlpath);
+        return (1);
+    }
+
+    LOGTRACE("begin parsing XML into data structures\n");
+    rc = xmlTextReaderRead(stream.reader);
+    while ((rc == 1) && !done && !ret) {
+        skip = FALSE;
+        if (xmlTextReaderNodeType(stream.reader) != XML_READER_TYPE_ELEMENT) {
+            // nothing to do with text, comments or closing tags at this level
+        } else if (xmlTextReaderDepth(stream.reader) == 0) {
+            if (xmlStrcmp(xmlTextReaderConstLocalName(stream.reader), (const xmlChar *) "network-data")) {
+                LOGERROR("network-data node not found in GNI xml\n");
+                ret = 1;
+                break;
+            }
+            // GNI version and applied version
+            if ((attr = xmlTextReaderGetAttribute(stream.reader, (const xmlChar *) "version")) != NULL) {
+                snprintf(gni->version, 32, "%s", (char *) attr);
+                xmlFree(attr);
+            }
+            if ((attr = xmlTextReaderGetAttribute(stream.reader, (const xmlChar *) "applied-version")) != NULL) {
+                snprintf(gni->appliedVersion, 32, "%s", (char *) attr);
+                xmlFree(attr);
+            }
+        } else if (xmlTextReaderDepth(stream.reader) == 1) {
+            skip = TRUE;
+            nodetype = gni_xmlstr2type(xmlTextReaderConstLocalName(stream.reader));
+            if ((nodetype == GNI_XPATH_INVALID) || ((mode != GNI_POPULATE_ALL) && (nodetype != GNI_XPATH_CONFIGURATION))) {
+                LOGTRACE("Skipping GNI xml node %s\n", xmlTextReaderConstLocalName(stream.reader));
+            } else if (nodetype == GNI_XPATH_INSTANCES) {
+                skip = FALSE;
+                ret = gni_stream_instances(&stream);
+                LOGTRACE("gni instances populated in %ld us.\n", eucanetd_timer_usec(&tv));
+            } else if (nodetype == GNI_XPATH_SECURITYGROUPS) {
+                skip = FALSE;
+                ret = gni_stream_sgs(&stream);
+                LOGTRACE("gni sgs populated in %ld us.\n", eucanetd_timer_usec(&tv));
+            } else if ((xmlnode = xmlTextReaderExpand(stream.reader)) == NULL) {
+                ret = 1;
+            } else {
+                if (ctxptr == NULL) {
+                    if ((ctxptr = xmlXPathNewContext(xmlnode->doc)) == NULL) {
+                        LOGERROR("unable to get new xml context\n");
+                        ret = 1;
+                        break;
+                    }
+                }
+                switch (nodetype) {
+                case GNI_XPATH_CONFIGURATION:
+                    gni_populate_gnidata(gni, xmlnode, ctxptr, xmlnode->doc);
+                    gni_populate_configuration(gni, host_info, xmlnode, ctxptr, xmlnode->doc);
+                    LOGTRACE("gni configuration populated in %ld us.\n", eucanetd_timer_usec(&tv));
+                    done = (mode == GNI_POPULATE_CONFIG);
+                    break;
+                case GNI_XPATH_VPCS:
+                    gni_populate_vpcs(gni, xmlnode, ctxptr, xmlnode->doc);
+                    LOGTRACE("gni vpcs populated in %ld us.\n", eucanetd_timer_usec(&tv));
+                    break;
+                case GNI_XPATH_INTERNETGATEWAYS:
+                    gni_populate_internetgateways(gni, xmlnode, ctxptr, xmlnode->doc);
+                    LOGTRACE("gni Internet Gateways populated in %ld us.\n", eucanetd_timer_usec(&tv));
+                    break;
+                case GNI_XPATH_DHCPOPTIONSETS:
+                    gni_populate_dhcpos(gni, xmlnode, ctxptr, xmlnode->doc);
+                    LOGTRACE("gni DHCP Option Sets populated in %ld us.\n", eucanetd_timer_usec(&tv));
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        rc = (skip ? xmlTextReaderNext(stream.reader) : xmlTextReaderRead(stream.reader));
+    }
+
+    if (ctxptr) {
+        xmlXPathFreeContext(ctxptr);
+    }
+    xmlFreeTextReader(stream.reader);
+
+    if ((rc < 0) || ret) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        return (1);
+    }
+
+    if (mode == GNI_POPULATE_ALL) {
+        // The configuration section comes first in the file, so the references that the XPath
+        // populators resolve in document order are resolved here, once everything has been read.
+        if (!IS_NETMODE_VPCMIDO(gni)) {
+            gni_drop_interfaces(gni);
+        }
+        gni_link_nodes(gni);
+        gni_link_secgroups(gni);
+        gni_link_vpcs(gni);
+        LOGTRACE("gni references resolved in %ld us.\n", eucanetd_timer_usec(&tv));
+    }
+    LOGTRACE("end parsing XML into data structures\n");
+
+    eucanetd_timer_usec(&tv);
+    rc = gni_validate(gni);
+    if (rc) {
+        LOGDEBUG("could not validate GNI after XML parse: check network config\n");
+        return (1);
+    }
+    LOGDEBUG("gni validated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    LOGINFO("gni populated in %.2f ms.\n", eucanetd_timer_usec(&ttv) / 1000.0);
+    return (0);
+}
+
+/**
+ * Reads the version of a global network information document, without parsing
+ * more than its root element.
+ * @param xmlpath [in] path to the XML file
+ * @param version [out] where to copy the version (empty if the root element has none)
+ * @param size [in] size of version
+ * @return 0 on success or 1 on failure
+ */
+int gni_read_version(char *xmlpath, char *version, size_t size) {
+    int rc = 0;
+    int ret = 1;
+    xmlChar *attr = NULL;
+    xmlTextReaderPtr reader = NULL;
+
+    if (!xmlpath || !version || (size == 0)) {
+        LOGWARN("Invalid argument: cannot read version of NULL GNI file\n");
+        return (1);
+    }
+    version[0] = '\0';
+
+    XML_INIT();
+    if ((reader = xmlReaderForFile(xmlpath, NULL, 0)) == NULL) {
+        LOGERROR("unable to open XML file (%s)\n", xmlpath);
+        return (1);
+    }
+    while ((rc = xmlTextReaderRead(reader)) == 1) {
+        if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+            if (!xmlStrcmp(xmlTextReaderConstLocalName(reader), (const xmlChar *) "network-data")) {
+                if ((attr = xmlTextReaderGetAttribute(reader, (const xmlChar *) "version")) != NULL) {
+                    snprintf(version, size, "%s", (char *) attr);
+                    xmlFree(attr);
+                }
+                ret = 0;
+            } else {
+                LOGERROR("network-data node not found in GNI xml\n");
+            }
+            break;
+        }
+    }
+    xmlFreeTextReader(reader);
+    return (ret);
+}
+
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file,
+ * loading the whole document in a DOM and querying it with XPath. Kept as the
+ * reference for gni_populate_v(), which must build the exact same structure.
+ * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate_dom(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
+    int rc = 0;
+    xmlDocPtr docptr;
+    xmlXPathContextPtr ctxptr;
+    struct timeval tv, ttv;
+    xmlNode * gni_nodes[GNI_XPATH_INVALID] = {0};
+
+    if (mode == GNI_POPULATE_NONE) {
+        return (0);
+    }
+
+    eucanetd_timer_usec(&ttv);
+    eucanetd_timer_usec(&tv);
+    if (!gni) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
+
+    gni_clear(gni);
+    LOGTRACE("gni cleared in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    XML_INIT();
+    LIBXML_TEST_VERSION
+    docptr = xmlParseFile(xmlpath);
+    if (docptr == NULL) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        return (1);
+    }
+
+    ctxptr = xmlXPathNewContext(docptr);
+    if (ctxptr == NULL) {
+        LOGERROR("unable to get new xml context\n");
+        xmlFreeDoc(docptr);
+        return (1);
+    }
+    LOGTRACE("xml Xpath context - %ld us.\n", eucanetd_timer_usec(&tv));
+
+    eucanetd_timer_usec(&tv);
+    rc = gni_populate_xpathnodes(docptr, gni_nodes);
+
+    LOGTRACE("begin parsing XML into data structures\n");
+
+    // GNI version
+    rc = gni_populate_gnidata(gni, gni_nodes[GNI_XPATH_CONFIGURATION], ctxptr, docptr);
+    LOGTRACE("gni version populated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    if (mode == GNI_POPULATE_ALL) {
+        // Instances
+        rc = gni_populate_instances(gni, gni_nodes[GNI_XPATH_INSTANCES], ctxptr, docptr);
+        LOGTRACE("gni instances populated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+        // Security Groups
+        rc = gni_populate_sgs(gni, gni_nodes[GNI_XPATH_SECURITYGROUPS], ctxptr, docptr);
+        LOGTRACE("gni sgs populated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+        // VPCs
+        rc = gni_populate_vpcs(gni, gni_nodes[GNI_XPATH_VPCS], ctxptr, docptr);
+        LOGTRACE("gni vpcs populated in %ld us.\n", eucanetd_timer_usec(&tv));
+        
+        // Internet Gateways
+        rc = gni_populate_internetgateways(gni, gni_nodes[GNI_XPATH_INTERNETGATEWAYS], ctxptr, docptr);
+        LOGTRACE("gni Internet Gateways populated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+        // DHCP Option Sets
+        rc = gni_populate_dhcpos(gni, gni_nodes[GNI_XPATH_DHCPOPTIONSETS], ctxptr, docptr);
+        LOGTRACE("gni DHCP Option Sets populated in %ld us.\n", eucanetd_timer_usec(&tv));
+    }
+
+    // Configuration
+    rc = gni_populate_configuration(gni, host_info, gni_nodes[GNI_XPATH_CONFIGURATION], ctxptr, docptr);
+    LOGTRACE("gni configuration populated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    xmlXPathFreeContext(ctxptr);
+    xmlFreeDoc(docptr);
+
+    if (mode == GNI_POPULATE_ALL) {
+        // Find VPC and subnet interfaces
+        gni_link_vpcs(gni);
+    }
+    LOGTRACE("end parsing XML into data structures\n");
+
+    eucanetd_timer_usec(&tv);
+    rc = gni_validate(gni);
+    if (rc) {
+        LOGDEBUG("could not validate GNI after XML parse: check network config\n");
+        return (1);
+    }
+    LOGDEBUG("gni validated in %ld us.\n", eucanetd_timer_usec(&tv));
+
+    LOGINFO("gni populated in %.2f ms.\n", eucanetd_timer_usec(&ttv) / 1000.0);
+
+/*
+    for (int i = 0; i < gni->max_instances; i++) {
+        gni_instance_interface_print(&(gni->instances[i]), EUCA_LOG_INFO);
+    }
+    for (int i = 0; i < gni->max_interfaces; i++) {
+        gni_instance_interface_print(&(gni->interfaces[i]), EUCA_LOG_INFO);
+    }
+    for (int j = 0; j < gni->max_secgroups; j++) {
+        gni_sg_print(&(gni->secgroups[j]), EUCA_LOG_INFO);
+    }
+    for (int i = 0; i < gni->max_vpcs; i++) {
+        gni_vpc_print(&(gni->vpcs[i]), EUCA_LOG_INFO);
+    }
+    for (int i = 0; i < gni->max_vpcIgws; i++) {
+        gni_internetgateway_print(&(gni->vpcIgws[i]), EUCA_LOG_INFO);
+    }
+    for (int i = 0; i < gni->max_dhcpos; i++) {
+        gni_dhcpos_print(&(gni->dhcpos[i]), EUCA_LOG_INFO);
+    }
+*/
+
+    return (0);
+}
+
+//!
+//! Index match callback: confirms that gni->instances[slot] is named 'key'.
+//!
+//! @param[in] slot position in gni->instances
+//! @param[in] key instance name looked up
+//! @param[in] ctx the globalNetworkInfo structure
+//!
+//! @return TRUE if the instance at slot is named key
+//!
+static boolean gni_instance_name_match(int slot, const char *key, void *ctx)
+{
+    globalNetworkInfo *gni = (globalNetworkInfo *) ctx;
+    return (!strcmp(gni->instances[slot]->name, key));
+}
+
+//!
+//! Index match callback: confirms that gni->ifs[slot] belongs to the instance named 'key'.
+//!
+//! @param[in] slot position in gni->ifs
+//! @param[in] key instance name looked up
+//! @param[in] ctx the globalNetworkInfo structure
+//!
+//! @return TRUE if the interface at slot is attached to instance key
+//!
+static boolean gni_interface_owner_match(int slot, const char *key, void *ctx)
+{
+    globalNetworkInfo *gni = (globalNetworkInfo *) ctx;
+    return (!strcmp(gni->ifs[slot]->instance_name.name, key));
+}
+
+//!
+//! Index match callback: confirms that gni->secgroups[slot] is named 'key'.
+//!
+//! @param[in] slot position in gni->secgroups
+//! @param[in] key security group name looked up
+//! @param[in] ctx the globalNetworkInfo structure
+//!
+//! @return TRUE if the security group at slot is named key
+//!
+static boolean gni_secgroup_name_match(int slot, const char *key, void *ctx)
+{
+    globalNetworkInfo *gni = (globalNetworkInfo *) ctx;
+    return (!strcmp(gni->secgroups[slot].name, key));
+}
+
+//!
+//! Records, in VPCMIDO mode, the node each instance and interface runs on, as listed
+//! in the clusters section. Same result as the lookup done by gni_populate_configuration()
+//! when the instances are already known, using an index instead of a scan per instance ID.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int gni_link_nodes(globalNetworkInfo *gni)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int slot = 0;
+    int cursor = 0;
+    gni_node *node = NULL;
+    euca_index *instidx = NULL;
+    euca_index *ifidx = NULL;
+
+    if (!IS_NETMODE_VPCMIDO(gni) || ((gni->max_instances == 0) && (gni->max_ifs == 0))) {
+        return (0);
+    }
+
+    instidx = euca_index_alloc(gni->max_instances);
+    ifidx = euca_index_alloc(gni->max_ifs);
+    if (!instidx || !ifidx) {
+        LOGERROR("out of memory indexing %d instances\n", gni->max_instances);
+        EUCA_FREE(instidx);
+        EUCA_FREE(ifidx);
+        return (1);
+    }
+    for (i = 0; i < gni->max_instances; i++) {
+        euca_index_insert(instidx, gni->instances[i]->name, i);
+    }
+    for (i = 0; i < gni->max_ifs; i++) {
+        euca_index_insert(ifidx, gni->ifs[i]->instance_name.name, i);
+    }
+
+    for (i = 0; i < gni->max_clusters; i++) {
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            node = &(gni->clusters[i].nodes[j]);
+            for (k = 0; k < node->max_instance_names; k++) {
+                cursor = 0;
+                while ((slot = euca_index_find(instidx, node->instance_names[k].name, gni_instance_name_match, gni, &cursor)) >= 0) {
+                    snprintf(gni->instances[slot]->node, HOSTNAME_LEN, "%s", node->name);
+                }
+                cursor = 0;
+                while ((slot = euca_index_find(ifidx, node->instance_names[k].name, gni_interface_owner_match, gni, &cursor)) >= 0) {
+                    snprintf(gni->ifs[slot]->node, HOSTNAME_LEN, "%s", node->name);
+                }
+            }
+        }
+    }
+
+    EUCA_FREE(instidx);
+    EUCA_FREE(ifidx);
+    return (0);
+}
+
+//!
+//! Fills the instance and interface lists of every security group (and, in VPCMIDO mode,
+//! the gnisgs back references of the interfaces) from the group names listed by each
+//! instance and interface. Same lists, in the same order, as gni_populate_sgs() builds,
+//! without comparing every group against every instance.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int gni_link_secgroups(globalNetworkInfo *gni)
+{
+    int i = 0;
+    int j = 0;
+    int slot = 0;
+    int last = 0;
+    int cursor = 0;
+    gni_instance *gi = NULL;
+    gni_secgroup *gsg = NULL;
+    euca_index *sgidx = NULL;
+
+    if (gni->max_secgroups == 0) {
+        return (0);
+    }
+
+    if ((sgidx = euca_index_alloc(gni->max_secgroups)) == NULL) {
+        LOGERROR("out of memory indexing %d security groups\n", gni->max_secgroups);
+        return (1);
+    }
+    for (i = 0; i < gni->max_secgroups; i++) {
+        gsg = &(gni->secgroups[i]);
+        EUCA_FREE(gsg->instances);
+        EUCA_FREE(gsg->interfaces);
+        gsg->max_instances = 0;
+        gsg->max_interfaces = 0;
+        euca_index_insert(sgidx, gsg->name, i);
+    }
+
+    // Size each member list first so that it gets allocated only once
+    for (i = 0; i < gni->max_instances; i++) {
+        gi = gni->instances[i];
+        for (j = 0; j < gi->max_secgroup_names; j++) {
+            cursor = 0;
+            while ((slot = euca_index_find(sgidx, gi->secgroup_names[j].name, gni_secgroup_name_match, gni, &cursor)) >= 0) {
+                gni->secgroups[slot].max_instances++;
+            }
+        }
+    }
+    if (IS_NETMODE_VPCMIDO(gni)) {
+        for (i = 0; i < gni->max_ifs; i++) {
+            gi = gni->ifs[i];
+            for (j = 0; j < gi->max_secgroup_names; j++) {
+                cursor = 0;
+                while ((slot = euca_index_find(sgidx, gi->secgroup_names[j].name, gni_secgroup_name_match, gni, &cursor)) >= 0) {
+                    gni->secgroups[slot].max_interfaces++;
+                }
+            }
+        }
+    }
+    for (i = 0; i < gni->max_secgroups; i++) {
+        gsg = &(gni->secgroups[i]);
+        if (gsg->max_instances) {
+            gsg->instances = EUCA_ZALLOC_C(gsg->max_instances, sizeof (gni_instance *));
+        }
+        if (gsg->max_interfaces) {
+            gsg->interfaces = EUCA_ZALLOC_C(gsg->max_interfaces, sizeof (gni_instance *));
+        }
+        gsg->max_instances = 0;
+        gsg->max_interfaces = 0;
+    }
+
+    for (i = 0; i < gni->max_instances; i++) {
+        gi = gni->instances[i];
+        for (j = 0; j < gi->max_secgroup_names; j++) {
+            cursor = 0;
+            while ((slot = euca_index_find(sgidx, gi->secgroup_names[j].name, gni_secgroup_name_match, gni, &cursor)) >= 0) {
+                gsg = &(gni->secgroups[slot]);
+                gsg->instances[gsg->max_instances++] = gi;
+            }
+        }
+    }
+    if (IS_NETMODE_VPCMIDO(gni)) {
+        for (i = 0; i < gni->max_ifs; i++) {
+            gi = gni->ifs[i];
+            for (j = 0; j < gi->max_secgroup_names; j++) {
+                // with duplicate group names, the last group wins like in gni_populate_sgs()
+                last = -1;
+                cursor = 0;
+                while ((slot = euca_index_find(sgidx, gi->secgroup_names[j].name, gni_secgroup_name_match, gni, &cursor)) >= 0) {
+                    gsg = &(gni->secgroups[slot]);
+                    gsg->interfaces[gsg->max_interfaces++] = gi;
+                    last = ((slot > last) ? slot : last);
+                }
+                if (last >= 0) {
+                    gi->gnisgs[j] = &(gni->secgroups[last]);
+                }
+            }
+        }
+    }
+
+    EUCA_FREE(sgidx);
+    return (0);
+}
+
+//!
+//! Index match callback: confirms that gni->vpcs[slot] is named 'key'.
+//!
+//! @param[in] slot position in gni->vpcs
+//! @param[in] key VPC name looked up
+//! @param[in] ctx the globalNetworkInfo structure
+//!
+//! @return TRUE if the VPC at slot is named key
+//!
+static boolean gni_vpc_name_match(int slot, const char *key, void *ctx)
+{
+    globalNetworkInfo *gni = (globalNetworkInfo *) ctx;
+    return (!strcmp(gni->vpcs[slot].name, key));
+}
+
+//!
+//! Index match callback: confirms that the VPC subnet at 'slot' is named 'key'.
+//!
+//! @param[in] slot position in the list of all VPC subnets
+//! @param[in] key subnet name looked up
+//! @param[in] ctx the list of all VPC subnets (gni_vpcsubnet **)
+//!
+//! @return TRUE if the subnet at slot is named key
+//!
+static boolean gni_vpcsubnet_name_match(int slot, const char *key, void *ctx)
+{
+    gni_vpcsubnet **subnets = (gni_vpcsubnet **) ctx;
+    return (!strcmp(subnets[slot]->name, key));
+}
+
+//!
+//! Resolves the VPC references once instances, VPCs and DHCP option sets are all
+//! populated: interfaces of each VPC and subnet, DHCP option set of each VPC and
+//! network ACL of each subnet. The interface lists are the ones gni_vpc_get_interfaces()
+//! and gni_vpcsubnet_get_interfaces() return, in the same order, built in two passes
+//! over the interfaces instead of one scan of all interfaces per VPC.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int gni_link_vpcs(globalNetworkInfo *gni)
+{
+    int i = 0;
+    int j = 0;
+    int pass = 0;
+    int slot = 0;
+    int cursor = 0;
+    int max_subnets = 0;
+    gni_vpc *vpc = NULL;
+    gni_vpc **owners = NULL;
+    gni_vpcsubnet *gnisubnet = NULL;
+    gni_vpcsubnet **subnets = NULL;
+    gni_instance *gi = NULL;
+    euca_index *vpcidx = NULL;
+    euca_index *subnetidx = NULL;
+
+    for (i = 0; i < gni->max_vpcs; i++) {
+        vpc = &(gni->vpcs[i]);
+        vpc->dhcpOptionSet = gni_get_dhcpos(gni, vpc->dhcpOptionSet_name, NULL);
+        for (j = 0; j < vpc->max_subnets; j++) {
+            gnisubnet = &(vpc->subnets[j]);
+            gnisubnet->networkAcl = gni_get_networkacl(vpc, gnisubnet->networkAcl_name, NULL);
+        }
+        max_subnets += vpc->max_subnets;
+    }
+    if (gni->max_vpcs == 0) {
+        return (0);
+    }
+
+    vpcidx = euca_index_alloc(gni->max_vpcs);
+    subnetidx = euca_index_alloc(max_subnets);
+    if (!vpcidx || !subnetidx) {
+        LOGERROR("out of memory indexing %d VPCs\n", gni->max_vpcs);
+        EUCA_FREE(vpcidx);
+        EUCA_FREE(subnetidx);
+        return (1);
+    }
+    subnets = EUCA_ZALLOC_C(max_subnets, sizeof (gni_vpcsubnet *));
+    owners = EUCA_ZALLOC_C(max_subnets, sizeof (gni_vpc *));
+    for (i = 0, max_subnets = 0; i < gni->max_vpcs; i++) {
+        vpc = &(gni->vpcs[i]);
+        EUCA_FREE(vpc->interfaces);
+        vpc->max_interfaces = 0;
+        euca_index_insert(vpcidx, vpc->name, i);
+        for (j = 0; j < vpc->max_subnets; j++, max_subnets++) {
+            gnisubnet = &(vpc->subnets[j]);
+            EUCA_FREE(gnisubnet->interfaces);
+            gnisubnet->max_interfaces = 0;
+            subnets[max_subnets] = gnisubnet;
+            owners[max_subnets] = vpc;
+            euca_index_insert(subnetidx, gnisubnet->name, max_subnets);
+        }
+    }
+
+    // The first pass sizes each list, the second one fills it
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < gni->max_ifs; i++) {
+            gi = gni->ifs[i];
+            cursor = 0;
+            while ((slot = euca_index_find(vpcidx, gi->vpc, gni_vpc_name_match, gni, &cursor)) >= 0) {
+                vpc = &(gni->vpcs[slot]);
+                if (pass) {
+                    vpc->interfaces[vpc->max_interfaces] = gi;
+                }
+                vpc->max_interfaces++;
+            }
+            cursor = 0;
+            while ((slot = euca_index_find(subnetidx, gi->subnet, gni_vpcsubnet_name_match, subnets, &cursor)) >= 0) {
+                // only subnets of the interface VPC, as looked up in the VPC interfaces
+                if (!strcmp(owners[slot]->name, gi->vpc)) {
+                    gnisubnet = subnets[slot];
+                    if (pass) {
+                        gnisubnet->interfaces[gnisubnet->max_interfaces] = gi;
+                    }
+                    gnisubnet->max_interfaces++;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (i = 0; i < gni->max_vpcs; i++) {
+                if (gni->vpcs[i].max_interfaces) {
+                    gni->vpcs[i].interfaces = EUCA_ZALLOC_C(gni->vpcs[i].max_interfaces, sizeof (gni_instance *));
+                }
+                gni->vpcs[i].max_interfaces = 0;
+            }
+            for (i = 0; i < max_subnets; i++) {
+                if (subnets[i]->max_interfaces) {
+                    subnets[i]->interfaces = EUCA_ZALLOC_C(subnets[i]->max_interfaces, sizeof (gni_instance *));
+                }
+                subnets[i]->max_interfaces = 0;
+            }
+        }
+    }
+
+    EUCA_FREE(subnets);
+    EUCA_FREE(owners);
+    EUCA_FREE(vpcidx);
+    EUCA_FREE(subnetidx);
+    return (0);
+}
+
+//!
+//! Releases the interfaces read along with the instances. They are only relevant in
+//! VPCMIDO mode, which is not known for sure until the whole file has been read.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+//! @return Always 0
+//!
+static int gni_drop_interfaces(globalNetworkInfo *gni)
+{
+    int i = 0;
+
+    for (i = 0; i < gni->max_ifs; i++) {
+        gni_instance_clear(gni->ifs[i]);
+        EUCA_FREE(gni->ifs[i]);
+    }
+    EUCA_FREE(gni->ifs);
+    gni->max_ifs = 0;
+    for (i = 0; i < gni->max_instances; i++) {
+        EUCA_FREE(gni->instances[i]->interfaces);
+        gni->instances[i]->max_interfaces = 0;
+    }
+    return (0);
+}
+
+
+/**
+ * Moves the reader to the next child element of the element at 'depth'.
+ * @param reader [in] xmlTextReader positioned inside (or on) the parent element
+ * @param depth [in] depth of the parent element, which must not be empty
+ * @param name [out] local name of the child element found
+ * @return 1 if a child element was found, 0 once the parent element is closed, -1 on parse error
+ */
+static int gni_stream_child(xmlTextReaderPtr reader, int depth, const xmlChar **name) {
+    int rc = 0;
+    int type = 0;
+
+    while ((rc = xmlTextReaderRead(reader)) == 1) {
+        type = xmlTextReaderNodeType(reader);
+        if ((type == XML_READER_TYPE_END_ELEMENT) && (xmlTextReaderDepth(reader) == depth)) {
+            return (0);
+        }
+        if ((type == XML_READER_TYPE_ELEMENT) && (xmlTextReaderDepth(reader) == (depth + 1))) {
+            *name = xmlTextReaderConstLocalName(reader);
+            return (1);
+        }
+    }
+    // the document cannot end before the parent element is closed
+    return (-1);
+}
+
+/**
+ * Reads the text of the element the reader is positioned on.
+ * @param reader [in] xmlTextReader positioned on an element
+ * @return the text (to be released with xmlFree()) or NULL if the element has none
+ */
+static xmlChar *gni_stream_text(xmlTextReaderPtr reader) {
+    xmlChar *text = NULL;
+
+    text = xmlTextReaderReadString(reader);
+    if (text && (text[0] == '\0')) {
+        xmlFree(text);
+        text = NULL;
+    }
+    return (text);
+}
+
+/**
+ * Appends the text of each "value" child of the current element to a list of strings.
+ * @param stream [in] streaming state, positioned on the parent element
+ * @param values [in,out] list the values are appended to (each released with EUCA_FREE())
+ * @param max_values [in,out] number of strings in the list
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_values(gni_stream *stream, char ***values, int *max_values) {
+    int rc = 0;
+    int depth = 0;
+    const xmlChar *name = NULL;
+    xmlChar *text = NULL;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if (!xmlStrcmp(name, (const xmlChar *) "value") && ((text = gni_stream_text(stream->reader)) != NULL)) {
+            *values = EUCA_REALLOC_C(*values, *max_values + 1, sizeof (char *));
+            (*values)[(*max_values)++] = strdup((char *) text);
+            xmlFree(text);
+        }
+    }
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates a gni_instance structure from the "instance" or "networkInterface" element
+ * the reader is positioned on. Reads the same fields as gni_populate_instance_interface()
+ * plus, for instances, the network interfaces (see gni_populate_interfaces()).
+ * @param stream [in] streaming state, positioned on the element
+ * @param instance [in] a pointer to the instance/interface structure to populate (clean)
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_instance(gni_stream *stream, gni_instance *instance) {
+    int rc = 0;
+    int i = 0;
+    int depth = 0;
+    int empty = 0;
+    int max_values = 0;
+    char **values = NULL;
+    const xmlChar *name = NULL;
+    xmlChar *text = NULL;
+    boolean is_instance = TRUE;
+
+    if ((text = xmlTextReaderGetAttribute(stream->reader, (const xmlChar *) "name")) != NULL) {
+        LOGTRACE("going to populate gni: %s\n", (char *) text);
+        snprintf(instance->name, INTERFACE_ID_LEN, "%s", (char *) text);
+        xmlFree(text);
+    }
+    if (strlen(instance->name) == 0) {
+        LOGERROR("Invalid argument: invalid instance name.\n");
+    }
+    is_instance = ((strstr(instance->name, "eni-") == NULL) ? TRUE : FALSE);
+
+    depth = xmlTextReaderDepth(stream->reader);
+    empty = xmlTextReaderIsEmptyElement(stream->reader);
+    while (!empty && ((rc = gni_stream_child(stream->reader, depth, &name)) == 1)) {
+        if (!xmlStrcmp(name, (const xmlChar *) "securityGroups")) {
+            rc = (gni_stream_values(stream, &values, &max_values) ? -1 : 0);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "networkInterfaces")) {
+            rc = (gni_stream_interfaces(stream, instance) ? -1 : 0);
+        } else if ((text = gni_stream_text(stream->reader)) != NULL) {
+            if (!xmlStrcmp(name, (const xmlChar *) "ownerId")) {
+                snprintf(instance->accountId, 128, "%s", (char *) text);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "macAddress")) {
+                mac2hex((char *) text, instance->macAddress);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "publicIp")) {
+                instance->publicIp = dot2hex((char *) text);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "privateIp")) {
+                instance->privateIp = dot2hex((char *) text);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "vpc")) {
+                snprintf(instance->vpc, 16, "%s", (char *) text);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "subnet")) {
+                snprintf(instance->subnet, 16, "%s", (char *) text);
+            } else if (!xmlStrcmp(name, (const xmlChar *) "attachmentId")) {
+                snprintf(instance->attachmentId, ENI_ATTACHMENT_ID_LEN, "%s", (char *) text);
+            } else if (!is_instance && !xmlStrcmp(name, (const xmlChar *) "sourceDestCheck")) {
+                euca_strtolower((char *) text);
+                instance->srcdstcheck = (!strcmp((char *) text, "true") ? TRUE : FALSE);
+            } else if (!is_instance && !xmlStrcmp(name, (const xmlChar *) "deviceIndex")) {
+                instance->deviceidx = atoi((char *) text);
+            }
+            xmlFree(text);
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+
+    instance->secgroup_names = EUCA_ZALLOC_C(max_values, sizeof (gni_name));
+    instance->gnisgs = EUCA_ZALLOC_C(max_values, sizeof (gni_secgroup *));
+    for (i = 0; i < max_values; i++) {
+        snprintf(instance->secgroup_names[i].name, 1024, "%s", values[i]);
+        EUCA_FREE(values[i]);
+    }
+    instance->max_secgroup_names = max_values;
+    EUCA_FREE(values);
+
+    if (!is_instance) {
+        // Use the instance name for primary interfaces
+        snprintf(instance->ifname, INTERFACE_ID_LEN, "%s", instance->name);
+        if (instance->deviceidx == 0) {
+            snprintf(instance->name, INTERFACE_ID_LEN, "%s", instance->instance_name.name);
+        }
+    }
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates the interfaces of an instance from the "networkInterfaces" element the
+ * reader is positioned on, appending them to gni->ifs as gni_populate_interfaces() does.
+ * @param stream [in] streaming state, positioned on the element
+ * @param instance [in] instance that has the interfaces of interest
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_interfaces(gni_stream *stream, gni_instance *instance) {
+    int rc = 0;
+    int depth = 0;
+    int capacity = 0;
+    const xmlChar *name = NULL;
+    gni_instance *interface = NULL;
+    globalNetworkInfo *gni = stream->gni;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if (xmlStrcmp(name, (const xmlChar *) "networkInterface")) {
+            continue;
+        }
+        if (instance->max_interfaces == capacity) {
+            capacity = GNI_GROW(capacity);
+            instance->interfaces = EUCA_REALLOC_C(instance->interfaces, capacity, sizeof (gni_instance *));
+        }
+        if (gni->max_ifs == stream->ifs_capacity) {
+            stream->ifs_capacity = GNI_GROW(stream->ifs_capacity);
+            gni->ifs = EUCA_REALLOC_C(gni->ifs, stream->ifs_capacity, sizeof (gni_instance *));
+        }
+        interface = EUCA_ZALLOC_C(1, sizeof (gni_instance));
+        snprintf(interface->instance_name.name, 1024, "%s", instance->name);
+        gni->ifs[gni->max_ifs++] = interface;
+        instance->interfaces[instance->max_interfaces++] = interface;
+        if (gni_stream_instance(stream, interface)) {
+            return (1);
+        }
+    }
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates globalNetworkInfo instances from the "instances" element the reader is
+ * positioned on. Streaming counterpart of gni_populate_instances().
+ * @param stream [in] streaming state, positioned on the element
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_instances(gni_stream *stream) {
+    int rc = 0;
+    int depth = 0;
+    const xmlChar *name = NULL;
+    gni_instance *instance = NULL;
+    globalNetworkInfo *gni = stream->gni;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if (xmlStrcmp(name, (const xmlChar *) "instance")) {
+            continue;
+        }
+        if (gni->max_instances == stream->instance_capacity) {
+            stream->instance_capacity = GNI_GROW(stream->instance_capacity);
+            gni->instances = EUCA_REALLOC_C(gni->instances, stream->instance_capacity, sizeof (gni_instance *));
+        }
+        instance = EUCA_ZALLOC_C(1, sizeof (gni_instance));
+        gni->instances[gni->max_instances++] = instance;
+        if (gni_stream_instance(stream, instance)) {
+            return (1);
+        }
+    }
+    LOGTRACE("Found %d instances\n", gni->max_instances);
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates a security group rule from the "rule" element the reader is positioned on.
+ * Streaming counterpart of gni_populate_rule().
+ * @param stream [in] streaming state, positioned on the element
+ * @param rule [in] a pointer to the rule structure to populate (clean)
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_rule(gni_stream *stream, gni_rule *rule) {
+    int rc = 0;
+    int depth = 0;
+    char *scidrnetaddr = NULL;
+    const xmlChar *name = NULL;
+    xmlChar *text = NULL;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if ((text = gni_stream_text(stream->reader)) == NULL) {
+            continue;
+        }
+        if (!xmlStrcmp(name, (const xmlChar *) "protocol")) {
+            rule->protocol = atoi((char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "groupId")) {
+            snprintf(rule->groupId, SECURITY_GROUP_ID_LEN, "%s", (char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "groupOwnerId")) {
+            snprintf(rule->groupOwnerId, 16, "%s", (char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "cidr")) {
+            snprintf(rule->cidr, NETWORK_ADDR_LEN, "%s", (char *) text);
+            cidrsplit(rule->cidr, &scidrnetaddr, &(rule->cidrSlashnet));
+            rule->cidrNetaddr = dot2hex(scidrnetaddr);
+            EUCA_FREE(scidrnetaddr);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "fromPort")) {
+            rule->fromPort = atoi((char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "toPort")) {
+            rule->toPort = atoi((char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "icmpType")) {
+            rule->icmpType = atoi((char *) text);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "icmpCode")) {
+            rule->icmpCode = atoi((char *) text);
+        }
+        xmlFree(text);
+    }
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates a list of rules from the "ingressRules" or "egressRules" element the
+ * reader is positioned on.
+ * @param stream [in] streaming state, positioned on the element
+ * @param rules [out] the rules read
+ * @param max_rules [out] number of rules read
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_rules(gni_stream *stream, gni_rule **rules, int *max_rules) {
+    int rc = 0;
+    int depth = 0;
+    int capacity = 0;
+    const xmlChar *name = NULL;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if (xmlStrcmp(name, (const xmlChar *) "rule")) {
+            continue;
+        }
+        if (*max_rules == capacity) {
+            capacity = GNI_GROW(capacity);
+            *rules = EUCA_REALLOC_C(*rules, capacity, sizeof (gni_rule));
+        }
+        bzero(&((*rules)[*max_rules]), sizeof (gni_rule));
+        if (gni_stream_rule(stream, &((*rules)[(*max_rules)++]))) {
+            return (1);
+        }
+    }
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates a security group from the "securityGroup" element the reader is
+ * positioned on. The instance and interface lists are filled by gni_link_secgroups().
+ * @param stream [in] streaming state, positioned on the element
+ * @param secgroup [in] a pointer to the security group structure to populate (clean)
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_sg(gni_stream *stream, gni_secgroup *secgroup) {
+    int rc = 0;
+    int i = 0;
+    int depth = 0;
+    int empty = 0;
+    int max_values = 0;
+    char **values = NULL;
+    char newrule[2048];
+    const xmlChar *name = NULL;
+    xmlChar *text = NULL;
+
+    if ((text = xmlTextReaderGetAttribute(stream->reader, (const xmlChar *) "name")) != NULL) {
+        snprintf(secgroup->name, SECURITY_GROUP_ID_LEN, "%s", (char *) text);
+        xmlFree(text);
+    }
+
+    depth = xmlTextReaderDepth(stream->reader);
+    empty = xmlTextReaderIsEmptyElement(stream->reader);
+    while (!empty && ((rc = gni_stream_child(stream->reader, depth, &name)) == 1)) {
+        if (!xmlStrcmp(name, (const xmlChar *) "rules")) {
+            rc = (gni_stream_values(stream, &values, &max_values) ? -1 : 0);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "ingressRules")) {
+            rc = (gni_stream_rules(stream, &(secgroup->ingress_rules), &(secgroup->max_ingress_rules)) ? -1 : 0);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "egressRules")) {
+            rc = (gni_stream_rules(stream, &(secgroup->egress_rules), &(secgroup->max_egress_rules)) ? -1 : 0);
+        } else if (!xmlStrcmp(name, (const xmlChar *) "ownerId") && ((text = gni_stream_text(stream->reader)) != NULL)) {
+            snprintf(secgroup->accountId, 128, "%s", (char *) text);
+            xmlFree(text);
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+
+    secgroup->grouprules = EUCA_ZALLOC_C(max_values, sizeof (gni_name));
+    for (i = 0; i < max_values; i++) {
+        if (!ruleconvert(values[i], newrule)) {
+            snprintf(secgroup->grouprules[i].name, 1024, "%s", newrule);
+        }
+        EUCA_FREE(values[i]);
+    }
+    secgroup->max_grouprules = max_values;
+    EUCA_FREE(values);
+    return ((rc < 0) ? 1 : 0);
+}
+
+/**
+ * Populates globalNetworkInfo security groups from the "securityGroups" element the
+ * reader is positioned on. Streaming counterpart of gni_populate_sgs().
+ * @param stream [in] streaming state, positioned on the element
+ * @return 0 on success or 1 on parse error
+ */
+static int gni_stream_sgs(gni_stream *stream) {
+    int rc = 0;
+    int depth = 0;
+    const xmlChar *name = NULL;
+    globalNetworkInfo *gni = stream->gni;
+
+    if (xmlTextReaderIsEmptyElement(stream->reader)) {
+        return (0);
+    }
+    depth = xmlTextReaderDepth(stream->reader);
+    while ((rc = gni_stream_child(stream->reader, depth, &name)) == 1) {
+        if (xmlStrcmp(name, (const xmlChar *) "securityGroup")) {
+            continue;
+        }
+        if (gni->max_secgroups == stream->secgroup_capacity) {
+            stream->secgroup_capacity = GNI_GROW(stream->secgroup_capacity);
+            gni->secgroups = EUCA_REALLOC_C(gni->secgroups, stream->secgroup_capacity, sizeof (gni_secgroup));
+        }
+        bzero(&(gni->secgroups[gni->max_secgroups]), sizeof (gni_secgroup));
+        if (gni_stream_sg(stream, &(gni->secgroups[gni->max_secgroups++]))) {
+            return (1);
+        }
+    }
+    LOGTRACE("Found %d security groups\n", gni->max_secgroups);
+    return ((rc < 0) ? 1 : 0);
+}
+
+
+/**
+ * Fingerprint of the structures a GNI cache copies as-is, so that a cache written
+ * by a build with different structure layouts is never loaded.
+ * @return the layout fingerprint
+ */
+static u32 gni_cache_layout(void) {
+    u32 layout = 0;
+    size_t sizes[] = {
+        sizeof (globalNetworkInfo), sizeof (gni_instance), sizeof (gni_secgroup), sizeof (gni_rule), sizeof (gni_subnet),
+        sizeof (gni_managedsubnet), sizeof (gni_cluster), sizeof (gni_node), sizeof (gni_vpc), sizeof (gni_vpcsubnet),
+        sizeof (gni_network_acl), sizeof (gni_acl_entry), sizeof (gni_route_table), sizeof (gni_route_entry),
+        sizeof (gni_nat_gateway), sizeof (gni_internet_gateway), sizeof (gni_dhcp_os),
+    };
+    int i = 0;
+
+    for (i = 0; i < (int) (sizeof (sizes) / sizeof (sizes[0])); i++) {
+        layout = (layout * 31) + (u32) sizes[i];
+    }
+    return (layout);
+}
+
+/**
+ * Appends bytes to a cache serialization buffer.
+ * @param buf [in] the buffer
+ * @param data [in] bytes to append
+ * @param len [in] number of bytes to append
+ */
+static void gni_cache_put(gni_cache_buf *buf, const void *data, size_t len) {
+    if ((buf->len + len) > buf->size) {
+        while ((buf->len + len) > buf->size) {
+            buf->size = ((buf->size < GNI_CACHE_MIN_BUF) ? GNI_CACHE_MIN_BUF : (buf->size * 2));
+        }
+        buf->data = EUCA_REALLOC_C(buf->data, buf->size, sizeof (char));
+    }
+    if (len) {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+}
+
+/**
+ * Appends an integer to a cache serialization buffer.
+ * @param buf [in] the buffer
+ * @param val [in] the integer
+ */
+static void gni_cache_put_int(gni_cache_buf *buf, int val) {
+    gni_cache_put(buf, &val, sizeof (int));
+}
+
+/**
+ * Appends a string (length then characters) to a cache serialization buffer.
+ * @param buf [in] the buffer
+ * @param str [in] the string
+ */
+static void gni_cache_put_str(gni_cache_buf *buf, const char *str) {
+    int len = strlen(str);
+
+    gni_cache_put_int(buf, len);
+    gni_cache_put(buf, str, len);
+}
+
+/**
+ * Appends a list of GNI names to a cache serialization buffer.
+ * @param buf [in] the buffer
+ * @param names [in] the names
+ * @param max_names [in] number of names in the list
+ */
+static void gni_cache_put_names(gni_cache_buf *buf, gni_name *names, int max_names) {
+    int i = 0;
+
+    gni_cache_put_int(buf, max_names);
+    for (i = 0; i < max_names; i++) {
+        gni_cache_put_str(buf, names[i].name);
+    }
+}
+
+/**
+ * Appends an array of structures without pointers to a cache serialization buffer.
+ * @param buf [in] the buffer
+ * @param array [in] the array
+ * @param max_elems [in] number of elements in the array
+ * @param size [in] size of one element
+ */
+static void gni_cache_put_array(gni_cache_buf *buf, const void *array, int max_elems, size_t size) {
+    gni_cache_put_int(buf, max_elems);
+    gni_cache_put(buf, array, max_elems * size);
+}
+
+/**
+ * Reads bytes from a mapped cache. Past the end of the payload, or after any previous
+ * error, the bytes read are zeroes and the cursor is flagged in error.
+ * @param cur [in] read position
+ * @param data [out] where to copy the bytes
+ * @param len [in] number of bytes to read
+ */
+static void gni_cache_get(gni_cache_cursor *cur, void *data, size_t len) {
+    if (cur->error || ((size_t) (cur->end - cur->p) < len)) {
+        cur->error = TRUE;
+        memset(data, 0, len);
+        return;
+    }
+    memcpy(data, cur->p, len);
+    cur->p += len;
+}
+
+/**
+ * Reads an integer from a mapped cache.
+ * @param cur [in] read position
+ * @return the integer (0 on error)
+ */
+static int gni_cache_get_int(gni_cache_cursor *cur) {
+    int val = 0;
+
+    gni_cache_get(cur, &val, sizeof (int));
+    return (val);
+}
+
+/**
+ * Reads an element count from a mapped cache. Every element takes at least one byte,
+ * so a count larger than what is left of the payload means the cache is corrupt.
+ * @param cur [in] read position
+ * @return the count (0 on error)
+ */
+static int gni_cache_get_count(gni_cache_cursor *cur) {
+    int count = gni_cache_get_int(cur);
+
+    if ((count < 0) || (count > (cur->end - cur->p))) {
+        cur->error = TRUE;
+        return (0);
+    }
+    return (count);
+}
+
+/**
+ * Reads a string from a mapped cache.
+ * @param cur [in] read position
+ * @param str [out] where to copy the string
+ * @param size [in] size of str
+ */
+static void gni_cache_get_str(gni_cache_cursor *cur, char *str, size_t size) {
+    int len = gni_cache_get_count(cur);
+
+    if ((size_t) len >= size) {
+        cur->error = TRUE;
+        len = 0;
+    }
+    gni_cache_get(cur, str, len);
+    str[(cur->error ? 0 : len)] = '\0';
+}
+
+/**
+ * Reads a list of GNI names from a mapped cache.
+ * @param cur [in] read position
+ * @param max_names [out] number of names read
+ * @return the names (to be released with EUCA_FREE())
+ */
+static gni_name *gni_cache_get_names(gni_cache_cursor *cur, int *max_names) {
+    int i = 0;
+    gni_name *names = NULL;
+
+    *max_names = gni_cache_get_count(cur);
+    names = EUCA_ZALLOC_C(*max_names, sizeof (gni_name));
+    for (i = 0; i < *max_names; i++) {
+        gni_cache_get_str(cur, names[i].name, sizeof (names[i].name));
+    }
+    return (names);
+}
+
+/**
+ * Reads an array of structures without pointers from a mapped cache.
+ * @param cur [in] read position
+ * @param max_elems [out] number of elements read
+ * @param size [in] size of one element
+ * @return the array (to be released with EUCA_FREE())
+ */
+static void *gni_cache_get_array(gni_cache_cursor *cur, int *max_elems, size_t size) {
+    void *array = NULL;
+
+    *max_elems = gni_cache_get_count(cur);
+    if ((size_t) (cur->end - cur->p) < (*max_elems * size)) {
+        cur->error = TRUE;
+        *max_elems = 0;
+    }
+    array = EUCA_ZALLOC_C(*max_elems, size);
+    gni_cache_get(cur, array, *max_elems * size);
+    return (array);
+}
+
+/**
+ * Appends an instance or interface to a cache serialization buffer, field by field
+ * since most of its fixed size strings are empty. The interfaces of an instance and
+ * the resolved security groups are not written.
+ * @param buf [in] the buffer
+ * @param instance [in] the instance or interface
+ */
+static void gni_cache_put_instance(gni_cache_buf *buf, gni_instance *instance) {
+    gni_cache_put_str(buf, instance->name);
+    gni_cache_put_str(buf, instance->ifname);
+    gni_cache_put_str(buf, instance->attachmentId);
+    gni_cache_put_str(buf, instance->accountId);
+    gni_cache_put_str(buf, instance->vpc);
+    gni_cache_put_str(buf, instance->subnet);
+    gni_cache_put_str(buf, instance->node);
+    gni_cache_put_str(buf, instance->nodehostname);
+    gni_cache_put_str(buf, instance->instance_name.name);
+    gni_cache_put(buf, instance->macAddress, sizeof (instance->macAddress));
+    gni_cache_put(buf, &(instance->publicIp), sizeof (u32));
+    gni_cache_put(buf, &(instance->privateIp), sizeof (u32));
+    gni_cache_put_int(buf, instance->srcdstcheck);
+    gni_cache_put_int(buf, instance->deviceidx);
+    gni_cache_put_names(buf, instance->secgroup_names, instance->max_secgroup_names);
+}
+
+/**
+ * Reads an instance or interface written by gni_cache_put_instance().
+ * @param cur [in] read position
+ * @return the instance (to be released with gni_instance_clear() and EUCA_FREE())
+ */
+static gni_instance *gni_cache_get_instance(gni_cache_cursor *cur) {
+    gni_instance *instance = EUCA_ZALLOC_C(1, sizeof (gni_instance));
+
+    gni_cache_get_str(cur, instance->name, sizeof (instance->name));
+    gni_cache_get_str(cur, instance->ifname, sizeof (instance->ifname));
+    gni_cache_get_str(cur, instance->attachmentId, sizeof (instance->attachmentId));
+    gni_cache_get_str(cur, instance->accountId, sizeof (instance->accountId));
+    gni_cache_get_str(cur, instance->vpc, sizeof (instance->vpc));
+    gni_cache_get_str(cur, instance->subnet, sizeof (instance->subnet));
+    gni_cache_get_str(cur, instance->node, sizeof (instance->node));
+    gni_cache_get_str(cur, instance->nodehostname, sizeof (instance->nodehostname));
+    gni_cache_get_str(cur, instance->instance_name.name, sizeof (instance->instance_name.name));
+    gni_cache_get(cur, instance->macAddress, sizeof (instance->macAddress));
+    gni_cache_get(cur, &(instance->publicIp), sizeof (u32));
+    gni_cache_get(cur, &(instance->privateIp), sizeof (u32));
+    instance->srcdstcheck = gni_cache_get_int(cur);
+    instance->deviceidx = gni_cache_get_int(cur);
+    instance->secgroup_names = gni_cache_get_names(cur, &(instance->max_secgroup_names));
+    instance->gnisgs = EUCA_ZALLOC_C(instance->max_secgroup_names, sizeof (gni_secgroup *));
+    return (instance);
+}
+
+/**
+ * Resets the pointers of a security group copied as-is (and their counts).
+ * @param secgroup [in] the security group
+ */
+static void gni_cache_scrub_secgroup(gni_secgroup *secgroup) {
+    secgroup->grouprules = NULL;
+    secgroup->max_grouprules = 0;
+    secgroup->ingress_rules = NULL;
+    secgroup->max_ingress_rules = 0;
+    secgroup->egress_rules = NULL;
+    secgroup->max_egress_rules = 0;
+    secgroup->instances = NULL;
+    secgroup->max_instances = 0;
+    secgroup->interfaces = NULL;
+    secgroup->max_interfaces = 0;
+    secgroup->mido_present = NULL;
+}
+
+/**
+ * Resets the pointers of a cluster copied as-is (and their counts).
+ * @param cluster [in] the cluster
+ */
+static void gni_cache_scrub_cluster(gni_cluster *cluster) {
+    cluster->private_ips = NULL;
+    cluster->max_private_ips = 0;
+    cluster->nodes = NULL;
+    cluster->max_nodes = 0;
+}
+
+/**
+ * Resets the pointers of a VPC copied as-is (and their counts).
+ * @param vpc [in] the VPC
+ */
+static void gni_cache_scrub_vpc(gni_vpc *vpc) {
+    vpc->dhcpOptionSet = NULL;
+    vpc->subnets = NULL;
+    vpc->max_subnets = 0;
+    vpc->networkAcls = NULL;
+    vpc->max_networkAcls = 0;
+    vpc->routeTables = NULL;
+    vpc->max_routeTables = 0;
+    vpc->natGateways = NULL;
+    vpc->max_natGateways = 0;
+    vpc->internetGatewayNames = NULL;
+    vpc->max_internetGatewayNames = 0;
+    vpc->interfaces = NULL;
+    vpc->max_interfaces = 0;
+    vpc->mido_present = NULL;
+}
+
+/**
+ * Resets the pointers of a VPC subnet copied as-is (and their counts).
+ * @param vpcsubnet [in] the VPC subnet
+ */
+static void gni_cache_scrub_vpcsubnet(gni_vpcsubnet *vpcsubnet) {
+    vpcsubnet->interfaces = NULL;
+    vpcsubnet->max_interfaces = 0;
+    vpcsubnet->routeTable = NULL;
+    vpcsubnet->networkAcl = NULL;
+    vpcsubnet->mido_present = NULL;
+}
+
+/**
+ * Resets the pointers of a network ACL copied as-is (and their counts).
+ * @param netacl [in] the network ACL
+ */
+static void gni_cache_scrub_networkacl(gni_network_acl *netacl) {
+    netacl->ingress = NULL;
+    netacl->max_ingress = 0;
+    netacl->egress = NULL;
+    netacl->max_egress = 0;
+}
+
+/**
+ * Resets the pointers of a route table copied as-is (and their counts).
+ * @param routetable [in] the route table
+ */
+static void gni_cache_scrub_routetable(gni_route_table *routetable) {
+    routetable->entries = NULL;
+    routetable->max_entries = 0;
+}
+
+/**
+ * Resets the pointers of a DHCP option set copied as-is (and their counts).
+ * @param dhcpos [in] the DHCP option set
+ */
+static void gni_cache_scrub_dhcpos(gni_dhcp_os *dhcpos) {
+    dhcpos->dns = NULL;
+    dhcpos->max_dns = 0;
+    dhcpos->ntp = NULL;
+    dhcpos->max_ntp = 0;
+    dhcpos->netbios_ns = NULL;
+    dhcpos->max_netbios_ns = 0;
+    dhcpos->domains = NULL;
+    dhcpos->max_domains = 0;
+}
+
+/**
+ * Serializes a populated globalNetworkInfo structure. Structures with pointers are
+ * copied with their pointers reset, followed by the lists they point to. References
+ * between structures (security group members, VPC interfaces, ...) are not written:
+ * they are resolved again when the cache is loaded.
+ * @param gni [in] a pointer to the global network information structure
+ * @param buf [in] buffer the serialized structure is appended to
+ * @return 0 on success or 1 if an instance refers to an interface missing from gni->ifs
+ */
+static int gni_cache_serialize(globalNetworkInfo *gni, gni_cache_buf *buf) {
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int pos = 0;
+    gni_instance *gi = NULL;
+    gni_secgroup secgroup = { { 0 } };
+    gni_cluster cluster = { { 0 } };
+    gni_node node = { { 0 } };
+    gni_vpc vpc = { { 0 } };
+    gni_vpcsubnet vpcsubnet = { { 0 } };
+    gni_network_acl netacl = { { 0 } };
+    gni_route_table routetable = { { 0 } };
+    gni_nat_gateway natg = { { 0 } };
+    gni_dhcp_os dhcpos = { { 0 } };
+
+    gni_cache_put_str(buf, gni->version);
+    gni_cache_put_str(buf, gni->appliedVersion);
+    gni_cache_put_str(buf, gni->sMode);
+    gni_cache_put_int(buf, gni->nmCode);
+    gni_cache_put(buf, &(gni->enabledCLCIp), sizeof (u32));
+    gni_cache_put_str(buf, gni->EucanetdHost);
+    gni_cache_put_str(buf, gni->GatewayHosts);
+    gni_cache_put_str(buf, gni->PublicNetworkCidr);
+    gni_cache_put_str(buf, gni->PublicGatewayIP);
+    gni_cache_put_str(buf, gni->instanceDNSDomain);
+#ifdef USE_IP_ROUTE_HANDLER
+    gni_cache_put(buf, &(gni->publicGateway), sizeof (u32));
+#endif /* USE_IP_ROUTE_HANDLER */
+    gni_cache_put_array(buf, gni->instanceDNSServers, gni->max_instanceDNSServers, sizeof (u32));
+    gni_cache_put_array(buf, gni->public_ips, gni->max_public_ips, sizeof (u32));
+    gni_cache_put_array(buf, gni->subnets, gni->max_subnets, sizeof (gni_subnet));
+    gni_cache_put_array(buf, gni->managedSubnet, gni->max_managedSubnets, sizeof (gni_managedsubnet));
+
+    gni_cache_put_int(buf, gni->max_clusters);
+    for (i = 0; i < gni->max_clusters; i++) {
+        memcpy(&cluster, &(gni->clusters[i]), sizeof (gni_cluster));
+        gni_cache_scrub_cluster(&cluster);
+        gni_cache_put(buf, &cluster, sizeof (gni_cluster));
+        gni_cache_put_array(buf, gni->clusters[i].private_ips, gni->clusters[i].max_private_ips, sizeof (u32));
+        gni_cache_put_int(buf, gni->clusters[i].max_nodes);
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            memcpy(&node, &(gni->clusters[i].nodes[j]), sizeof (gni_node));
+            node.instance_names = NULL;
+            node.max_instance_names = 0;
+            gni_cache_put(buf, &node, sizeof (gni_node));
+            gni_cache_put_names(buf, gni->clusters[i].nodes[j].instance_names, gni->clusters[i].nodes[j].max_instance_names);
+        }
+    }
+
+    // Interfaces go first so that instances can refer to them by position
+    gni_cache_put_int(buf, gni->max_ifs);
+    for (i = 0; i < gni->max_ifs; i++) {
+        gni_cache_put_instance(buf, gni->ifs[i]);
+    }
+    gni_cache_put_int(buf, gni->max_instances);
+    gni_cache_put_int(buf, gni->sorted_instances);
+    for (i = 0; i < gni->max_instances; i++) {
+        gi = gni->instances[i];
+        gni_cache_put_instance(buf, gi);
+        gni_cache_put_int(buf, gi->max_interfaces);
+        for (j = 0; j < gi->max_interfaces; j++) {
+            // interfaces are stored in gni->ifs in instance order, look where the last one was found first
+            for (k = pos; (k < gni->max_ifs) && (gni->ifs[k] != gi->interfaces[j]); k++) ;
+            if (k == gni->max_ifs) {
+                for (k = 0; (k < pos) && (gni->ifs[k] != gi->interfaces[j]); k++) ;
+                if (k == pos) {
+                    LOGERROR("interface %d of %s not found in gni\n", j, gi->name);
+                    return (1);
+                }
+            }
+            gni_cache_put_int(buf, k);
+            pos = k + 1;
+        }
     }
 
-    return (res);
+    gni_cache_put_int(buf, gni->max_secgroups);
+    for (i = 0; i < gni->max_secgroups; i++) {
+        memcpy(&secgroup, &(gni->secgroups[i]), sizeof (gni_secgroup));
+        gni_cache_scrub_secgroup(&secgroup);
+        gni_cache_put(buf, &secgroup, sizeof (gni_secgroup));
+        gni_cache_put_names(buf, gni->secgroups[i].grouprules, gni->secgroups[i].max_grouprules);
+        gni_cache_put_array(buf, gni->secgroups[i].ingress_rules, gni->secgroups[i].max_ingress_rules, sizeof (gni_rule));
+        gni_cache_put_array(buf, gni->secgroups[i].egress_rules, gni->secgroups[i].max_egress_rules, sizeof (gni_rule));
+    }
+
+    gni_cache_put_int(buf, gni->max_vpcs);
+    for (i = 0; i < gni->max_vpcs; i++) {
+        memcpy(&vpc, &(gni->vpcs[i]), sizeof (gni_vpc));
+        gni_cache_scrub_vpc(&vpc);
+        gni_cache_put(buf, &vpc, sizeof (gni_vpc));
+        gni_cache_put_int(buf, gni->vpcs[i].max_subnets);
+        for (j = 0; j < gni->vpcs[i].max_subnets; j++) {
+            memcpy(&vpcsubnet, &(gni->vpcs[i].subnets[j]), sizeof (gni_vpcsubnet));
+            gni_cache_scrub_vpcsubnet(&vpcsubnet);
+            gni_cache_put(buf, &vpcsubnet, sizeof (gni_vpcsubnet));
+        }
+        gni_cache_put_int(buf, gni->vpcs[i].max_networkAcls);
+        for (j = 0; j < gni->vpcs[i].max_networkAcls; j++) {
+            memcpy(&netacl, &(gni->vpcs[i].networkAcls[j]), sizeof (gni_network_acl));
+            gni_cache_scrub_networkacl(&netacl);
+            gni_cache_put(buf, &netacl, sizeof (gni_network_acl));
+            gni_cache_put_array(buf, gni->vpcs[i].networkAcls[j].ingress, gni->vpcs[i].networkAcls[j].max_ingress, sizeof (gni_acl_entry));
+            gni_cache_put_array(buf, gni->vpcs[i].networkAcls[j].egress, gni->vpcs[i].networkAcls[j].max_egress, sizeof (gni_acl_entry));
+        }
+        gni_cache_put_int(buf, gni->vpcs[i].max_routeTables);
+        for (j = 0; j < gni->vpcs[i].max_routeTables; j++) {
+            memcpy(&routetable, &(gni->vpcs[i].routeTables[j]), sizeof (gni_route_table));
+            gni_cache_scrub_routetable(&routetable);
+            gni_cache_put(buf, &routetable, sizeof (gni_route_table));
+            gni_cache_put_array(buf, gni->vpcs[i].routeTables[j].entries, gni->vpcs[i].routeTables[j].max_entries, sizeof (gni_route_entry));
+        }
+        gni_cache_put_int(buf, gni->vpcs[i].max_natGateways);
+        for (j = 0; j < gni->vpcs[i].max_natGateways; j++) {
+            memcpy(&natg, &(gni->vpcs[i].natGateways[j]), sizeof (gni_nat_gateway));
+            natg.mido_present = NULL;
+            gni_cache_put(buf, &natg, sizeof (gni_nat_gateway));
+        }
+        gni_cache_put_names(buf, gni->vpcs[i].internetGatewayNames, gni->vpcs[i].max_internetGatewayNames);
+    }
+
+    gni_cache_put_array(buf, gni->vpcIgws, gni->max_vpcIgws, sizeof (gni_internet_gateway));
+
+    gni_cache_put_int(buf, gni->max_dhcpos);
+    for (i = 0; i < gni->max_dhcpos; i++) {
+        memcpy(&dhcpos, &(gni->dhcpos[i]), sizeof (gni_dhcp_os));
+        gni_cache_scrub_dhcpos(&dhcpos);
+        gni_cache_put(buf, &dhcpos, sizeof (gni_dhcp_os));
+        gni_cache_put_array(buf, gni->dhcpos[i].dns, gni->dhcpos[i].max_dns, sizeof (u32));
+        gni_cache_put_array(buf, gni->dhcpos[i].ntp, gni->dhcpos[i].max_ntp, sizeof (u32));
+        gni_cache_put_array(buf, gni->dhcpos[i].netbios_ns, gni->dhcpos[i].max_netbios_ns, sizeof (u32));
+        gni_cache_put_names(buf, gni->dhcpos[i].domains, gni->dhcpos[i].max_domains);
+    }
+    return (0);
 }
 
 /**
- * Evaluates XPATH and retrieves the xmlNodeSet of the query.
- * @param ctxptr [in] pointer to the xmlXPathContext
- * @param doc [in] a pointer to the XML document
- * @param startnode [in] xmlNodePtr where the search should start
- * @param expression [in] expression a string pointer to the expression we want to evaluate
- * @param nodeset [out] xmlNodeSetPtr of the query.
- * @return 0 on success. 1 otherwise.
+ * Rebuilds a globalNetworkInfo structure written by gni_cache_serialize(). Every list
+ * is allocated with its count set together, so that a truncated or corrupt payload
+ * leaves a structure gni_clear() can release.
+ * @param gni [in] a pointer to the global network information structure (clean)
+ * @param cur [in] read position at the start of the payload
+ * @return 0 on success or 1 if the payload is corrupt
  */
-int evaluate_xpath_nodeset(xmlXPathContextPtr ctxptr, xmlDocPtr doc, xmlNodePtr startnode, char *expression, xmlNodeSetPtr nodeset) {
-    xmlXPathObjectPtr objptr;
-    int res = 0;
-
-    if (!nodeset) {
-        LOGWARN("cannot return nodeset to NULL\n");
+static int gni_cache_deserialize(globalNetworkInfo *gni, gni_cache_cursor *cur) {
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int max = 0;
+    gni_instance *gi = NULL;
+    gni_vpc *vpc = NULL;
+    gni_vpcsubnet *vpcsubnet = NULL;
+
+    gni_cache_get_str(cur, gni->version, sizeof (gni->version));
+    gni_cache_get_str(cur, gni->appliedVersion, sizeof (gni->appliedVersion));
+    gni_cache_get_str(cur, gni->sMode, sizeof (gni->sMode));
+    gni->nmCode = gni_cache_get_int(cur);
+    gni_cache_get(cur, &(gni->enabledCLCIp), sizeof (u32));
+    gni_cache_get_str(cur, gni->EucanetdHost, sizeof (gni->EucanetdHost));
+    gni_cache_get_str(cur, gni->GatewayHosts, sizeof (gni->GatewayHosts));
+    gni_cache_get_str(cur, gni->PublicNetworkCidr, sizeof (gni->PublicNetworkCidr));
+    gni_cache_get_str(cur, gni->PublicGatewayIP, sizeof (gni->PublicGatewayIP));
+    gni_cache_get_str(cur, gni->instanceDNSDomain, sizeof (gni->instanceDNSDomain));
+#ifdef USE_IP_ROUTE_HANDLER
+    gni_cache_get(cur, &(gni->publicGateway), sizeof (u32));
+#endif /* USE_IP_ROUTE_HANDLER */
+    gni->instanceDNSServers = gni_cache_get_array(cur, &(gni->max_instanceDNSServers), sizeof (u32));
+    gni->public_ips = gni_cache_get_array(cur, &(gni->max_public_ips), sizeof (u32));
+    gni->subnets = gni_cache_get_array(cur, &(gni->max_subnets), sizeof (gni_subnet));
+    gni->managedSubnet = gni_cache_get_array(cur, &(gni->max_managedSubnets), sizeof (gni_managedsubnet));
+
+    max = gni_cache_get_count(cur);
+    gni->clusters = EUCA_ZALLOC_C(max, sizeof (gni_cluster));
+    for (i = 0; i < max; i++, gni->max_clusters++) {
+        gni_cache_get(cur, &(gni->clusters[i]), sizeof (gni_cluster));
+        gni_cache_scrub_cluster(&(gni->clusters[i]));
+        gni->clusters[i].private_ips = gni_cache_get_array(cur, &(gni->clusters[i].max_private_ips), sizeof (u32));
+        gni->clusters[i].max_nodes = gni_cache_get_count(cur);
+        gni->clusters[i].nodes = EUCA_ZALLOC_C(gni->clusters[i].max_nodes, sizeof (gni_node));
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            gni_cache_get(cur, &(gni->clusters[i].nodes[j]), sizeof (gni_node));
+            gni->clusters[i].nodes[j].instance_names = gni_cache_get_names(cur, &(gni->clusters[i].nodes[j].max_instance_names));
+        }
+    }
+
+    max = gni_cache_get_count(cur);
+    gni->ifs = EUCA_ZALLOC_C(max, sizeof (gni_instance *));
+    for (i = 0; i < max; i++) {
+        gni->ifs[gni->max_ifs++] = gni_cache_get_instance(cur);
+    }
+    max = gni_cache_get_count(cur);
+    gni->sorted_instances = gni_cache_get_int(cur);
+    gni->instances = EUCA_ZALLOC_C(max, sizeof (gni_instance *));
+    for (i = 0; i < max; i++) {
+        gi = gni_cache_get_instance(cur);
+        gni->instances[gni->max_instances++] = gi;
+        gi->max_interfaces = gni_cache_get_count(cur);
+        gi->interfaces = EUCA_ZALLOC_C(gi->max_interfaces, sizeof (gni_instance *));
+        for (j = 0; j < gi->max_interfaces; j++) {
+            k = gni_cache_get_int(cur);
+            if ((k < 0) || (k >= gni->max_ifs)) {
+                cur->error = TRUE;
+                break;
+            }
+            gi->interfaces[j] = gni->ifs[k];
+        }
+    }
+
+    max = gni_cache_get_count(cur);
+    gni->secgroups = EUCA_ZALLOC_C(max, sizeof (gni_secgroup));
+    for (i = 0; i < max; i++, gni->max_secgroups++) {
+        gni_cache_get(cur, &(gni->secgroups[i]), sizeof (gni_secgroup));
+        gni_cache_scrub_secgroup(&(gni->secgroups[i]));
+        gni->secgroups[i].grouprules = gni_cache_get_names(cur, &(gni->secgroups[i].max_grouprules));
+        gni->secgroups[i].ingress_rules = gni_cache_get_array(cur, &(gni->secgroups[i].max_ingress_rules), sizeof (gni_rule));
+        gni->secgroups[i].egress_rules = gni_cache_get_array(cur, &(gni->secgroups[i].max_egress_rules), sizeof (gni_rule));
+    }
+
+    max = gni_cache_get_count(cur);
+    gni->vpcs = EUCA_ZALLOC_C(max, sizeof (gni_vpc));
+    for (i = 0; i < max; i++, gni->max_vpcs++) {
+        vpc = &(gni->vpcs[i]);
+        gni_cache_get(cur, vpc, sizeof (gni_vpc));
+        gni_cache_scrub_vpc(vpc);
+        vpc->max_subnets = gni_cache_get_count(cur);
+        vpc->subnets = EUCA_ZALLOC_C(vpc->max_subnets, sizeof (gni_vpcsubnet));
+        for (j = 0; j < vpc->max_subnets; j++) {
+            gni_cache_get(cur, &(vpc->subnets[j]), sizeof (gni_vpcsubnet));
+            gni_cache_scrub_vpcsubnet(&(vpc->subnets[j]));
+        }
+        vpc->max_networkAcls = gni_cache_get_count(cur);
+        vpc->networkAcls = EUCA_ZALLOC_C(vpc->max_networkAcls, sizeof (gni_network_acl));
+        for (j = 0; j < vpc->max_networkAcls; j++) {
+            gni_cache_get(cur, &(vpc->networkAcls[j]), sizeof (gni_network_acl));
+            gni_cache_scrub_networkacl(&(vpc->networkAcls[j]));
+            vpc->networkAcls[j].ingress = gni_cache_get_array(cur, &(vpc->networkAcls[j].max_ingress), sizeof (gni_acl_entry));
+            vpc->networkAcls[j].egress = gni_cache_get_array(cur, &(vpc->networkAcls[j].max_egress), sizeof (gni_acl_entry));
+        }
+        vpc->max_routeTables = gni_cache_get_count(cur);
+        vpc->routeTables = EUCA_ZALLOC_C(vpc->max_routeTables, sizeof (gni_route_table));
+        for (j = 0; j < vpc->max_routeTables; j++) {
+            gni_cache_get(cur, &(vpc->routeTables[j]), sizeof (gni_route_table));
+            gni_cache_scrub_routetable(&(vpc->routeTables[j]));
+            vpc->routeTables[j].entries = gni_cache_get_array(cur, &(vpc->routeTables[j].max_entries), sizeof (gni_route_entry));
+        }
+        vpc->max_natGateways = gni_cache_get_count(cur);
+        vpc->natGateways = EUCA_ZALLOC_C(vpc->max_natGateways, sizeof (gni_nat_gateway));
+        for (j = 0; j < vpc->max_natGateways; j++) {
+            gni_cache_get(cur, &(vpc->natGateways[j]), sizeof (gni_nat_gateway));
+            vpc->natGateways[j].mido_present = NULL;
+        }
+        vpc->internetGatewayNames = gni_cache_get_names(cur, &(vpc->max_internetGatewayNames));
+    }
+
+    gni->vpcIgws = gni_cache_get_array(cur, &(gni->max_vpcIgws), sizeof (gni_internet_gateway));
+
+    max = gni_cache_get_count(cur);
+    gni->dhcpos = EUCA_ZALLOC_C(max, sizeof (gni_dhcp_os));
+    for (i = 0; i < max; i++, gni->max_dhcpos++) {
+        gni_cache_get(cur, &(gni->dhcpos[i]), sizeof (gni_dhcp_os));
+        gni_cache_scrub_dhcpos(&(gni->dhcpos[i]));
+        gni->dhcpos[i].dns = gni_cache_get_array(cur, &(gni->dhcpos[i].max_dns), sizeof (u32));
+        gni->dhcpos[i].ntp = gni_cache_get_array(cur, &(gni->dhcpos[i].max_ntp), sizeof (u32));
+        gni->dhcpos[i].netbios_ns = gni_cache_get_array(cur, &(gni->dhcpos[i].max_netbios_ns), sizeof (u32));
+        gni->dhcpos[i].domains = gni_cache_get_names(cur, &(gni->dhcpos[i].max_domains));
+    }
+
+    if (cur->error || (cur->p != cur->end)) {
         return (1);
     }
-    bzero(nodeset, sizeof (xmlNodeSet));
-    if ((!ctxptr) || (!doc) || (!nodeset)) {
-        LOGERROR("Invalid argument: NULL xpath context, xmlDoc, or nodeset\n");
-        res = 1;
-    } else {
-        ctxptr->node = startnode;
-        objptr = xmlXPathEvalExpression((unsigned char *) expression, ctxptr);
-        if (objptr == NULL) {
-            LOGERROR("unable to evaluate xpath expression '%s'\n", expression);
-            res = 1;
-        } else {
-            if (objptr->nodesetval) {
-                nodeset->nodeNr = objptr->nodesetval->nodeNr;
-                nodeset->nodeMax = objptr->nodesetval->nodeMax;
-                nodeset->nodeTab = EUCA_ZALLOC_C(nodeset->nodeMax, sizeof (xmlNodePtr));
-                memcpy(nodeset->nodeTab, objptr->nodesetval->nodeTab, nodeset->nodeMax * sizeof (xmlNodePtr));
+
+    // Resolve the references between structures, as the populators do
+    for (i = 0; i < gni->max_vpcs; i++) {
+        for (j = 0; j < gni->vpcs[i].max_subnets; j++) {
+            vpcsubnet = &(gni->vpcs[i].subnets[j]);
+            if (strlen(vpcsubnet->routeTable_name)) {
+                vpcsubnet->routeTable = gni_vpc_get_routeTable(&(gni->vpcs[i]), vpcsubnet->routeTable_name);
             }
         }
-        xmlXPathFreeObject(objptr);
     }
-    return (res);
-}
-
-/**
- * Allocates and initializes a new globalNetworkInfo structure.
- * @return A pointer to the newly allocated structure or NULL if any failure occurred.
- */
-globalNetworkInfo *gni_init() {
-    globalNetworkInfo *gni = NULL;
-    gni = EUCA_ZALLOC_C(1, sizeof (globalNetworkInfo));
-
-    gni->init = 1;
-    return (gni);
-}
-
-/**
- * Populates a given globalNetworkInfo structure from the content of an XML file
- * @param gni [in] a pointer to the global network information structure
- * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
- * @param xmlpath [in] path to the XML file to be used to populate
- * @return 0 on success or 1 on failure
- */
-int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
-    return (gni_populate_v(GNI_POPULATE_ALL, gni, host_info, xmlpath));
+    gni_link_secgroups(gni);
+    gni_link_vpcs(gni);
+    return (0);
 }
 
 /**
- * Populates a given globalNetworkInfo structure from the content of an XML file
- * @param mode [in] mode what to populate GNI_POPULATE_ALL || GNI_POPULATE_CONFIG || GNI_POPULATE_NONE
+ * Writes a compact binary image of a populated globalNetworkInfo structure, keyed by
+ * the hash of the XML file it was populated from. The file is replaced atomically.
  * @param gni [in] a pointer to the global network information structure
- * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
- * @param xmlpath [in] path to the XML file to be used to populate
+ * @param cachepath [in] path of the cache file
+ * @param xmlhash [in] hash of the XML file gni was populated from (see file2md5str())
  * @return 0 on success or 1 on failure
  */
-int gni_populate_v(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath) {
-    int rc = 0;
-    xmlDocPtr docptr;
-    xmlXPathContextPtr ctxptr;
-    struct timeval tv, ttv;
-    xmlNode * gni_nodes[GNI_XPATH_INVALID] = {0};
+int gni_cache_save(globalNetworkInfo *gni, const char *cachepath, const char *xmlhash) {
+    int fd = -1;
+    int ret = 0;
+    char tmppath[EUCA_MAX_PATH] = "";
+    gni_cache_header header = { 0 };
+    gni_cache_buf buf = { 0 };
 
-    if (mode == GNI_POPULATE_NONE) {
-        return (0);
+    if (!gni || !cachepath || !xmlhash) {
+        LOGWARN("Invalid argument: cannot cache NULL gni\n");
+        return (1);
     }
 
-    eucanetd_timer_usec(&ttv);
-    eucanetd_timer_usec(&tv);
-    if (!gni) {
-        LOGERROR("invalid input\n");
+    if (gni_cache_serialize(gni, &buf)) {
+        EUCA_FREE(buf.data);
         return (1);
     }
+    header.magic = GNI_CACHE_MAGIC;
+    header.format = GNI_CACHE_FORMAT;
+    header.layout = gni_cache_layout();
+    header.length = buf.len;
+    snprintf(header.xmlhash, sizeof (header.xmlhash), "%s", xmlhash);
 
-    gni_clear(gni);
-    LOGTRACE("gni cleared in %ld us.\n", eucanetd_timer_usec(&tv));
-
-    XML_INIT();
-    LIBXML_TEST_VERSION
-    docptr = xmlParseFile(xmlpath);
-    if (docptr == NULL) {
-        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+    snprintf(tmppath, EUCA_MAX_PATH, "%s.tmp", cachepath);
+    if ((fd = open(tmppath, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0) {
+        LOGWARN("cannot open GNI cache %s: %s\n", tmppath, strerror(errno));
+        EUCA_FREE(buf.data);
         return (1);
     }
+    if ((write(fd, &header, sizeof (header)) != sizeof (header)) || (write(fd, buf.data, buf.len) != (ssize_t) buf.len)) {
+        LOGWARN("cannot write GNI cache %s: %s\n", tmppath, strerror(errno));
+        ret = 1;
+    }
+    close(fd);
+    EUCA_FREE(buf.data);
 
-    ctxptr = xmlXPathNewContext(docptr);
-    if (ctxptr == NULL) {
-        LOGERROR("unable to get new xml context\n");
-        xmlFreeDoc(docptr);
+    if (!ret && rename(tmppath, cachepath)) {
+        LOGWARN("cannot rename GNI cache %s to %s: %s\n", tmppath, cachepath, strerror(errno));
+        ret = 1;
+    }
+    if (ret) {
+        unlink(tmppath);
         return (1);
     }
-    LOGTRACE("xml Xpath context - %ld us.\n", eucanetd_timer_usec(&tv));
-
-    eucanetd_timer_usec(&tv);
-    rc = gni_populate_xpathnodes(docptr, gni_nodes);
-
-    LOGTRACE("begin parsing XML into data structures\n");
-
-    // GNI version
-    rc = gni_populate_gnidata(gni, gni_nodes[GNI_XPATH_CONFIGURATION], ctxptr, docptr);
-    LOGTRACE("gni version populated in %ld us.\n", eucanetd_timer_usec(&tv));
-
-    if (mode == GNI_POPULATE_ALL) {
-        // Instances
-        rc = gni_populate_instances(gni, gni_nodes[GNI_XPATH_INSTANCES], ctxptr, docptr);
-        LOGTRACE("gni instances populated in %ld us.\n", eucanetd_timer_usec(&tv));
+    LOGTRACE("gni cached in %s (%ld bytes)\n", cachepath, (long) (sizeof (header) + header.length));
+    return (0);
+}
 
-        // Security Groups
-        rc = gni_populate_sgs(gni, gni_nodes[GNI_XPATH_SECURITYGROUPS], ctxptr, docptr);
-        LOGTRACE("gni sgs populated in %ld us.\n", eucanetd_timer_usec(&tv));
+/**
+ * Populates a globalNetworkInfo structure from a cache written by gni_cache_save(),
+ * provided the cache was written from the XML file whose hash is given.
+ * @param gni [in] a pointer to the global network information structure
+ * @param cachepath [in] path of the cache file
+ * @param xmlhash [in] hash of the current XML file (see file2md5str())
+ * @return 0 on success or 1 if the cache is missing, stale or corrupt (gni is then clean)
+ */
+int gni_cache_load(globalNetworkInfo *gni, const char *cachepath, const char *xmlhash) {
+    int fd = -1;
+    int ret = 0;
+    char *map = NULL;
+    struct stat mystat = { 0 };
+    gni_cache_header header = { 0 };
+    gni_cache_cursor cur = { 0 };
 
-        // VPCs
-        rc = gni_populate_vpcs(gni, gni_nodes[GNI_XPATH_VPCS], ctxptr, docptr);
-        LOGTRACE("gni vpcs populated in %ld us.\n", eucanetd_timer_usec(&tv));
-        
-        // Internet Gateways
-        rc = gni_populate_internetgateways(gni, gni_nodes[GNI_XPATH_INTERNETGATEWAYS], ctxptr, docptr);
-        LOGTRACE("gni Internet Gateways populated in %ld us.\n", eucanetd_timer_usec(&tv));
+    if (!gni || !cachepath || !xmlhash) {
+        LOGWARN("Invalid argument: cannot load NULL gni\n");
+        return (1);
+    }
 
-        // DHCP Option Sets
-        rc = gni_populate_dhcpos(gni, gni_nodes[GNI_XPATH_DHCPOPTIONSETS], ctxptr, docptr);
-        LOGTRACE("gni DHCP Option Sets populated in %ld us.\n", eucanetd_timer_usec(&tv));
+    if ((fd = open(cachepath, O_RDONLY)) < 0) {
+        LOGTRACE("no GNI cache in %s\n", cachepath);
+        return (1);
+    }
+    if ((fstat(fd, &mystat) < 0) || (mystat.st_size < (off_t) sizeof (header))
+        || ((map = mmap(NULL, mystat.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+        close(fd);
+        return (1);
     }
+    close(fd);
 
-    // Configuration
-    rc = gni_populate_configuration(gni, host_info, gni_nodes[GNI_XPATH_CONFIGURATION], ctxptr, docptr);
-    LOGTRACE("gni configuration populated in %ld us.\n", eucanetd_timer_usec(&tv));
+    memcpy(&header, map, sizeof (header));
+    header.xmlhash[sizeof (header.xmlhash) - 1] = '\0';
+    if ((header.magic != GNI_CACHE_MAGIC) || (header.format != GNI_CACHE_FORMAT) || (header.layout != gni_cache_layout())
+        || (header.length != (u64) (mystat.st_size - sizeof (header)))) {
+        LOGDEBUG("ignoring GNI cache %s written by another version\n", cachepath);
+        ret = 1;
+    } else if (strcmp(header.xmlhash, xmlhash)) {
+        LOGTRACE("GNI cache %s is stale\n", cachepath);
+        ret = 1;
+    } else {
+        gni_clear(gni);
+        cur.p = map + sizeof (header);
+        cur.end = map + mystat.st_size;
+        if (gni_cache_deserialize(gni, &cur)) {
+            LOGWARN("ignoring corrupt GNI cache %s\n", cachepath);
+            gni_clear(gni);
+            ret = 1;
+        }
+    }
+    munmap(map, mystat.st_size);
+    return (ret);
+}
 
-    xmlXPathFreeContext(ctxptr);
-    xmlFreeDoc(docptr);
+/**
+ * Populates a given globalNetworkInfo structure from the content of an XML file, going
+ * through a binary cache: when the cache was written from the same XML content it is
+ * loaded instead of parsing the file, otherwise the file is parsed and the cache rewritten.
+ * @param gni [in] a pointer to the global network information structure
+ * @param host_info [in] a pointer to the hostname info data structure (only relevant to VPCMIDO - to be deprecated)
+ * @param xmlpath [in] path to the XML file to be used to populate
+ * @param cachepath [in] path of the cache file (NULL to always parse)
+ * @return 0 on success or 1 on failure
+ */
+int gni_populate_cached(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath, char *cachepath) {
+    int rc = 0;
+    char *xmlhash = NULL;
+    struct timeval tv;
 
-    if (mode == GNI_POPULATE_ALL) {
-        // Find VPC and subnet interfaces
-        for (int i = 0; i < gni->max_vpcs; i++) {
-            gni_vpc *vpc = &(gni->vpcs[i]);
-            rc = gni_vpc_get_interfaces(gni, vpc, &(vpc->interfaces), &(vpc->max_interfaces));
-            if (rc) {
-                LOGWARN("Failed to populate gni %s interfaces.\n", vpc->name);
-            }
-            vpc->dhcpOptionSet = gni_get_dhcpos(gni, vpc->dhcpOptionSet_name, NULL);
-            for (int j = 0; j < vpc->max_subnets; j++) {
-                gni_vpcsubnet *gnisubnet = &(vpc->subnets[j]);
-                rc = gni_vpcsubnet_get_interfaces(gni, gnisubnet, vpc->interfaces, vpc->max_interfaces,
-                        &(gnisubnet->interfaces), &(gnisubnet->max_interfaces));
-                if (rc) {
-                    LOGWARN("Failed to populate gni %s interfaces.\n", gnisubnet->name);
-                }
-                gnisubnet->networkAcl = gni_get_networkacl(vpc, gnisubnet->networkAcl_name, NULL);
-            }
-        }
+    if (!cachepath || ((xmlhash = file2md5str(xmlpath)) == NULL)) {
+        return (gni_populate(gni, host_info, xmlpath));
     }
-    LOGTRACE("end parsing XML into data structures\n");
 
     eucanetd_timer_usec(&tv);
-    rc = gni_validate(gni);
-    if (rc) {
-        LOGDEBUG("could not validate GNI after XML parse: check network config\n");
-        return (1);
+    if (gni_cache_load(gni, cachepath, xmlhash) == 0) {
+        LOGINFO("gni loaded from cache in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
+        EUCA_FREE(xmlhash);
+        return (0);
     }
-    LOGDEBUG("gni validated in %ld us.\n", eucanetd_timer_usec(&tv));
-
-    LOGINFO("gni populated in %.2f ms.\n", eucanetd_timer_usec(&ttv) / 1000.0);
 
-/*
-    for (int i = 0; i < gni->max_instances; i++) {
-        gni_instance_interface_print(&(gni->instances[i]), EUCA_LOG_INFO);
-    }
-    for (int i = 0; i < gni->max_interfaces; i++) {
-        gni_instance_interface_print(&(gni->interfaces[i]), EUCA_LOG_INFO);
-    }
-    for (int j = 0; j < gni->max_secgroups; j++) {
-        gni_sg_print(&(gni->secgroups[j]), EUCA_LOG_INFO);
-    }
-    for (int i = 0; i < gni->max_vpcs; i++) {
-        gni_vpc_print(&(gni->vpcs[i]), EUCA_LOG_INFO);
-    }
-    for (int i = 0; i < gni->max_vpcIgws; i++) {
-        gni_internetgateway_print(&(gni->vpcIgws[i]), EUCA_LOG_INFO);
+    rc = gni_populate(gni, host_info, xmlpath);
+    if (rc == 0) {
+        gni_cache_save(gni, cachepath, xmlhash);
     }
-    for (int i = 0; i < gni->max_dhcpos; i++) {
-        gni_dhcpos_print(&(gni->dhcpos[i]), EUCA_LOG_INFO);
-    }
-*/
-
-    return (0);
+    EUCA_FREE(xmlhash);
+    return (rc);
 }
 
 /**
@@ -6908,3 +8731,321 @@ int compare_gni_instance_name(const void *p1, const void *p2) {
     return (strcmp(name1, name2));
 }
 
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+
+#define TEST_SIZES                               3      //!< Number of GNI sizes benchmarked
+#define TEST_MAX_DOM                             10000  //!< Largest GNI also populated through the DOM (quadratic)
+
+static const int test_sizes[TEST_SIZES] = { 1000, 10000, 50000 };   //!< Instances in each benchmarked GNI
+
+//!
+//! Writes a VPCMIDO global network information document with 'instances' instances (one
+//! interface each, plus a secondary interface for every fourth one), spread over nodes,
+//! VPCs, subnets and security groups that grow with it.
+//!
+static void test_write_gni(const char *xmlpath, int instances)
+{
+    int i = 0;
+    int j = 0;
+    int vpcs = (instances / 100) + 1;
+    int sgs = (instances / 10) + 1;
+    int nodes = (instances / 20) + 1;
+    FILE *pFh = NULL;
+
+    assert((pFh = fopen(xmlpath, "w")) != NULL);
+    fprintf(pFh, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n");
+    fprintf(pFh, "<network-data version=\"%d\" applied-version=\"%d\" applied-time=\"2016-01-01T00:00:00.000Z\">\n", instances, instances - 1);
+    fprintf(pFh, "  <configuration>\n");
+    fprintf(pFh, "    <property name=\"mode\"><value>VPCMIDO</value></property>\n");
+    fprintf(pFh, "    <property name=\"enabledCLCIp\"><value>10.111.5.11</value></property>\n");
+    fprintf(pFh, "    <property name=\"instanceDNSDomain\"><value>eucalyptus.internal</value></property>\n");
+    fprintf(pFh, "    <property name=\"instanceDNSServers\"><value>10.1.1.254</value><value>10.1.1.253</value></property>\n");
+    fprintf(pFh, "    <property name=\"mido\">\n");
+    fprintf(pFh, "      <property name=\"eucanetdHost\"><value>clc.internal</value></property>\n");
+    fprintf(pFh, "      <property name=\"publicNetworkCidr\"><value>10.116.0.0/16</value></property>\n");
+    fprintf(pFh, "      <property name=\"publicGatewayIP\"><value>10.116.0.1</value></property>\n");
+    fprintf(pFh, "      <property name=\"gateways\">\n");
+    fprintf(pFh, "        <gateway><property name=\"gatewayHost\"><value>gw1</value></property><property name=\"gatewayIP\"><value>10.116.0.2</value></property>");
+    fprintf(pFh, "<property name=\"gatewayInterface\"><value>em1</value></property></gateway>\n");
+    fprintf(pFh, "      </property>\n");
+    fprintf(pFh, "    </property>\n");
+    fprintf(pFh, "    <property name=\"clusters\">\n");
+    fprintf(pFh, "      <cluster name=\"cluster0\">\n");
+    fprintf(pFh, "        <property name=\"enabledCCIp\"><value>10.111.5.16</value></property>\n");
+    fprintf(pFh, "        <property name=\"macPrefix\"><value>d0:0d</value></property>\n");
+    fprintf(pFh, "        <property name=\"nodes\">\n");
+    for (i = 0; i < nodes; i++) {
+        fprintf(pFh, "          <node name=\"10.112.%d.%d\">\n            <instanceIds>\n", (i / 256), (i % 256));
+        for (j = i; j < instances; j += nodes) {
+            fprintf(pFh, "              <value>i-%08x</value>\n", j);
+        }
+        fprintf(pFh, "            </instanceIds>\n          </node>\n");
+    }
+    fprintf(pFh, "        </property>\n      </cluster>\n    </property>\n  </configuration>\n");
+
+    fprintf(pFh, "  <vpcs>\n");
+    for (i = 0; i < vpcs; i++) {
+        fprintf(pFh, "    <vpc name=\"vpc-%08x\">\n      <ownerId>%012d</ownerId>\n      <cidr>172.%d.0.0/16</cidr>\n", i, i, (16 + (i % 16)));
+        fprintf(pFh, "      <dhcpOptionSet>dopt-%08x</dhcpOptionSet>\n", (i % 4));
+        fprintf(pFh, "      <subnets>\n");
+        for (j = 0; j < 2; j++) {
+            fprintf(pFh, "        <subnet name=\"subnet-%06x%02x\"><ownerId>%012d</ownerId><cidr>172.%d.%d.0/24</cidr><cluster>cluster0</cluster>", i, j, i, (16 + (i % 16)), j);
+            fprintf(pFh, "<networkAcl>acl-%08x</networkAcl><routeTable>rtb-%08x</routeTable></subnet>\n", i, i);
+        }
+        fprintf(pFh, "      </subnets>\n      <networkAcls>\n        <networkAcl name=\"acl-%08x\"><ownerId>%012d</ownerId>\n", i, i);
+        fprintf(pFh, "          <ingressEntries><entry number=\"100\"><action>allow</action><protocol>-1</protocol><cidr>0.0.0.0/0</cidr></entry>");
+        fprintf(pFh, "<entry number=\"200\"><action>deny</action><protocol>6</protocol><cidr>10.0.0.0/8</cidr><portRangeFrom>22</portRangeFrom><portRangeTo>22</portRangeTo></entry></ingressEntries>\n");
+        fprintf(pFh, "          <egressEntries><entry number=\"100\"><action>allow</action><protocol>-1</protocol><cidr>0.0.0.0/0</cidr></entry></egressEntries>\n");
+        fprintf(pFh, "        </networkAcl>\n      </networkAcls>\n");
+        fprintf(pFh, "      <routeTables>\n        <routeTable name=\"rtb-%08x\"><ownerId>%012d</ownerId><routes>", i, i);
+        fprintf(pFh, "<route><destinationCidr>172.%d.0.0/16</destinationCidr><gatewayId>local</gatewayId></route>", (16 + (i % 16)));
+        fprintf(pFh, "<route><destinationCidr>0.0.0.0/0</destinationCidr><gatewayId>igw-%08x</gatewayId></route></routes></routeTable>\n      </routeTables>\n", i);
+        fprintf(pFh, "      <natGateways>\n        <natGateway name=\"nat-%08x\"><ownerId>%012d</ownerId><macAddress>d0:0d:ff:00:%02x:%02x</macAddress>", i, i, (i / 256), (i % 256));
+        fprintf(pFh, "<publicIp>10.116.%d.%d</publicIp><privateIp>172.%d.0.5</privateIp><vpc>vpc-%08x</vpc><subnet>subnet-%06x00</subnet></natGateway>\n", (i / 256), (i % 256), (16 + (i % 16)), i, i);
+        fprintf(pFh, "      </natGateways>\n      <internetGateways><value>igw-%08x</value></internetGateways>\n    </vpc>\n", i);
+    }
+    fprintf(pFh, "  </vpcs>\n");
+
+    fprintf(pFh, "  <instances>\n");
+    for (i = 0; i < instances; i++) {
+        fprintf(pFh, "    <instance name=\"i-%08x\">\n      <ownerId>%012d</ownerId>\n      <macAddress>d0:0d:00:%02x:%02x:%02x</macAddress>\n", i, (i % vpcs), (i >> 16), ((i >> 8) & 0xff), (i & 0xff));
+        fprintf(pFh, "      <publicIp>10.116.%d.%d</publicIp>\n      <privateIp>172.%d.%d.%d</privateIp>\n", (i >> 8), (i & 0xff), (16 + ((i % vpcs) % 16)), ((i / vpcs) % 2), (10 + ((i / vpcs) % 200)));
+        fprintf(pFh, "      <vpc>vpc-%08x</vpc>\n      <subnet>subnet-%06x%02x</subnet>\n", (i % vpcs), (i % vpcs), ((i / vpcs) % 2));
+        fprintf(pFh, "      <networkInterfaces>\n");
+        for (j = 0; j < (((i % 4) == 0) ? 2 : 1); j++) {
+            fprintf(pFh, "        <networkInterface name=\"eni-%07x%d\">\n", i, j);
+            fprintf(pFh, "          <ownerId>%012d</ownerId>\n          <macAddress>d0:0d:%02x:%02x:%02x:%02x</macAddress>\n", (i % vpcs), (j + 1), (i >> 16), ((i >> 8) & 0xff), (i & 0xff));
+            if (j == 0) {
+                fprintf(pFh, "          <publicIp>10.116.%d.%d</publicIp>\n", (i >> 8), (i & 0xff));
+            }
+            fprintf(pFh, "          <privateIp>172.%d.%d.%d</privateIp>\n", (16 + ((i % vpcs) % 16)), ((i / vpcs) % 2), (10 + j + ((i / vpcs) % 200)));
+            fprintf(pFh, "          <vpc>vpc-%08x</vpc>\n          <subnet>subnet-%06x%02x</subnet>\n", (i % vpcs), (i % vpcs), ((i / vpcs) % 2));
+            fprintf(pFh, "          <securityGroups><value>sg-%08x</value><value>sg-%08x</value></securityGroups>\n", (i % sgs), ((i + 1) % sgs));
+            fprintf(pFh, "          <attachmentId>eni-attach-%07x%d</attachmentId>\n", i, j);
+            fprintf(pFh, "          <sourceDestCheck>%s</sourceDestCheck>\n          <deviceIndex>%d</deviceIndex>\n", (j ? "false" : "true"), j);
+            fprintf(pFh, "        </networkInterface>\n");
+        }
+        fprintf(pFh, "      </networkInterfaces>\n");
+        fprintf(pFh, "      <securityGroups>\n        <value>sg-%08x</value>\n        <value>sg-%08x</value>\n      </securityGroups>\n    </instance>\n", (i % sgs), ((i + 1) % sgs));
+    }
+    fprintf(pFh, "  </instances>\n");
+
+    fprintf(pFh, "  <dhcpOptionSets>\n");
+    for (i = 0; i < 4; i++) {
+        fprintf(pFh, "    <dhcpOptionSet name=\"dopt-%08x\"><ownerId>%012d</ownerId>", i, i);
+        fprintf(pFh, "<property name=\"domain-name\"><value>d%d.internal</value><value>internal</value></property>", i);
+        fprintf(pFh, "<property name=\"domain-name-servers\"><value>10.1.1.%d</value></property>", (i + 1));
+        fprintf(pFh, "<property name=\"ntp-servers\"><value>10.1.2.%d</value></property></dhcpOptionSet>\n", (i + 1));
+    }
+    fprintf(pFh, "  </dhcpOptionSets>\n");
+
+    fprintf(pFh, "  <internetGateways>\n");
+    for (i = 0; i < vpcs; i++) {
+        fprintf(pFh, "    <internetGateway name=\"igw-%08x\"><ownerId>%012d</ownerId></internetGateway>\n", i, i);
+    }
+    fprintf(pFh, "  </internetGateways>\n");
+
+    fprintf(pFh, "  <securityGroups>\n");
+    for (i = 0; i < sgs; i++) {
+        fprintf(pFh, "    <securityGroup name=\"sg-%08x\">\n      <ownerId>%012d</ownerId>\n", i, (i % vpcs));
+        fprintf(pFh, "      <rules>\n        <value>-P tcp -p 22-22  -s 0.0.0.0/0</value>\n        <value>-P icmp -t -1:-1  -o sg-%08x -u %012d</value>\n      </rules>\n", ((i + 1) % sgs), (i % vpcs));
+        fprintf(pFh, "      <ingressRules>\n        <rule><protocol>6</protocol><cidr>10.%d.0.0/16</cidr><fromPort>22</fromPort><toPort>22</toPort></rule>\n", (i % 256));
+        fprintf(pFh, "        <rule><protocol>1</protocol><groupId>sg-%08x</groupId><groupOwnerId>%012d</groupOwnerId><icmpType>-1</icmpType><icmpCode>-1</icmpCode></rule>\n", ((i + 1) % sgs), (i % vpcs));
+        fprintf(pFh, "      </ingressRules>\n      <egressRules>\n        <rule><protocol>-1</protocol><cidr>0.0.0.0/0</cidr></rule>\n      </egressRules>\n    </securityGroup>\n");
+    }
+    fprintf(pFh, "  </securityGroups>\n</network-data>\n");
+    fclose(pFh);
+}
+
+//!
+//! Serializes a GNI the way the cache does, to compare two of them byte for byte.
+//!
+static gni_cache_buf test_serialize(globalNetworkInfo * gni)
+{
+    gni_cache_buf buf = { 0 };
+
+    assert(gni_cache_serialize(gni, &buf) == 0);
+    return (buf);
+}
+
+//!
+//! Checks that the references between two GNIs built from the same document point to the
+//! same names, which the serialized image leaves out.
+//!
+static void test_same_links(globalNetworkInfo * a, globalNetworkInfo * b)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+
+    assert(a->max_secgroups == b->max_secgroups);
+    for (i = 0; i < a->max_secgroups; i++) {
+        assert(a->secgroups[i].max_instances == b->secgroups[i].max_instances);
+        for (j = 0; j < a->secgroups[i].max_instances; j++) {
+            assert(!strcmp(a->secgroups[i].instances[j]->name, b->secgroups[i].instances[j]->name));
+        }
+        assert(a->secgroups[i].max_interfaces == b->secgroups[i].max_interfaces);
+        for (j = 0; j < a->secgroups[i].max_interfaces; j++) {
+            assert(!strcmp(a->secgroups[i].interfaces[j]->name, b->secgroups[i].interfaces[j]->name));
+        }
+    }
+    for (i = 0; i < a->max_ifs; i++) {
+        for (j = 0; j < a->ifs[i]->max_secgroup_names; j++) {
+            assert((a->ifs[i]->gnisgs[j] == NULL) == (b->ifs[i]->gnisgs[j] == NULL));
+            assert(!a->ifs[i]->gnisgs[j] || !strcmp(a->ifs[i]->gnisgs[j]->name, b->ifs[i]->gnisgs[j]->name));
+        }
+    }
+    assert(a->max_vpcs == b->max_vpcs);
+    for (i = 0; i < a->max_vpcs; i++) {
+        assert(a->vpcs[i].max_interfaces == b->vpcs[i].max_interfaces);
+        assert(!strcmp(a->vpcs[i].dhcpOptionSet->name, b->vpcs[i].dhcpOptionSet->name));
+        for (j = 0; j < a->vpcs[i].max_subnets; j++) {
+            assert(a->vpcs[i].subnets[j].max_interfaces == b->vpcs[i].subnets[j].max_interfaces);
+            for (k = 0; k < a->vpcs[i].subnets[j].max_interfaces; k++) {
+                assert(!strcmp(a->vpcs[i].subnets[j].interfaces[k]->name, b->vpcs[i].subnets[j].interfaces[k]->name));
+            }
+            assert(!strcmp(a->vpcs[i].subnets[j].routeTable->name, b->vpcs[i].subnets[j].routeTable->name));
+            assert(!strcmp(a->vpcs[i].subnets[j].networkAcl->name, b->vpcs[i].subnets[j].networkAcl->name));
+        }
+    }
+}
+
+//!
+//! Checks two GNIs hold the same content and references.
+//!
+static void test_same_gni(globalNetworkInfo * a, globalNetworkInfo * b)
+{
+    gni_cache_buf bufa = test_serialize(a);
+    gni_cache_buf bufb = test_serialize(b);
+
+    assert((bufa.len == bufb.len) && !memcmp(bufa.data, bufb.data, bufa.len));
+    EUCA_FREE(bufa.data);
+    EUCA_FREE(bufb.data);
+    test_same_links(a, b);
+}
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int j = 0;
+    int fd = 0;
+    int members = 0;
+    int ifmembers = 0;
+    int instances = 0;
+    long domUsec = 0;
+    long streamUsec = 0;
+    long saveUsec = 0;
+    long loadUsec = 0;
+    char *xmlhash = NULL;
+    char xmlpath[EUCA_MAX_PATH] = "";
+    char cachepath[EUCA_MAX_PATH] = "";
+    char version[32] = "";
+    struct stat mystat = { 0 };
+    struct timeval tv = { 0 };
+    gni_cache_header header = { 0 };
+    globalNetworkInfo *dom = NULL;
+    globalNetworkInfo *gni = NULL;
+    globalNetworkInfo *cached = NULL;
+
+    log_file_set(NULL, NULL);
+    log_params_set(EUCA_LOG_WARN, 0, 0);
+    snprintf(xmlpath, EUCA_MAX_PATH, "/tmp/gni_xml-XXXXXX");
+    assert((fd = safe_mkstemp(xmlpath)) >= 0);
+    close(fd);
+    snprintf(cachepath, EUCA_MAX_PATH, "%s.cache", xmlpath);
+
+    assert((dom = gni_init()) != NULL);
+    assert((gni = gni_init()) != NULL);
+    assert((cached = gni_init()) != NULL);
+
+    for (i = 0; i < TEST_SIZES; i++) {
+        instances = test_sizes[i];
+        test_write_gni(xmlpath, instances);
+        assert(stat(xmlpath, &mystat) == 0);
+        assert((xmlhash = file2md5str(xmlpath)) != NULL);
+        printf("%d instances (%ld KB of XML):\n", instances, (long) (mystat.st_size / 1024));
+
+        eucanetd_timer_usec(&tv);
+        assert(gni_populate(gni, NULL, xmlpath) == 0);
+        streamUsec = eucanetd_timer_usec(&tv);
+        assert(gni->max_instances == instances);
+        assert(gni->max_ifs == (instances + ((instances + 3) / 4)));
+        for (j = 0, members = 0, ifmembers = 0; j < instances; j++) {
+            if (((j % gni->max_secgroups) == 7) || (((j + 1) % gni->max_secgroups) == 7)) {
+                members++;
+                ifmembers += (((j % 4) == 0) ? 2 : 1);
+            }
+        }
+        assert((gni->secgroups[7].max_instances == members) && (gni->secgroups[7].max_interfaces == ifmembers));
+        assert(gni->instances[0]->max_interfaces == 2);
+        assert(!strcmp(gni->instances[0]->interfaces[0]->name, "i-00000000") && !strcmp(gni->instances[0]->interfaces[1]->name, "eni-00000001"));
+        assert(!strcmp(gni->instances[instances - 1]->node, gni->ifs[gni->max_ifs - 1]->node) && strlen(gni->ifs[gni->max_ifs - 1]->node));
+        assert(gni->ifs[0]->gnisgs[1] == &(gni->secgroups[1]));
+        printf("\tstreamed:         %8.2f ms\n", streamUsec / 1000.0);
+
+        if (instances <= TEST_MAX_DOM) {
+            eucanetd_timer_usec(&tv);
+            assert(gni_populate_dom(GNI_POPULATE_ALL, dom, NULL, xmlpath) == 0);
+            domUsec = eucanetd_timer_usec(&tv);
+            printf("\tDOM and XPath:    %8.2f ms\n", domUsec / 1000.0);
+            test_same_gni(dom, gni);
+        }
+
+        unlink(cachepath);
+        eucanetd_timer_usec(&tv);
+        assert(gni_cache_save(gni, cachepath, xmlhash) == 0);
+        saveUsec = eucanetd_timer_usec(&tv);
+        assert(stat(cachepath, &mystat) == 0);
+        eucanetd_timer_usec(&tv);
+        assert(gni_cache_load(cached, cachepath, xmlhash) == 0);
+        loadUsec = eucanetd_timer_usec(&tv);
+        printf("\tcache saved:      %8.2f ms (%ld KB)\n", saveUsec / 1000.0, (long) (mystat.st_size / 1024));
+        printf("\tcache loaded:     %8.2f ms\n", loadUsec / 1000.0);
+        test_same_gni(gni, cached);
+
+        // a cache written from another document is never loaded
+        assert(gni_cache_load(cached, cachepath, "0123456789abcdef0123456789abcdef") == 1);
+        EUCA_FREE(xmlhash);
+    }
+
+    // the cache is only reused while the document does not change
+    unlink(cachepath);
+    test_write_gni(xmlpath, 100);
+    assert(gni_populate_cached(gni, NULL, xmlpath, cachepath) == 0);
+    assert(access(cachepath, R_OK) == 0);
+    assert(gni_populate_cached(cached, NULL, xmlpath, cachepath) == 0);
+    test_same_gni(gni, cached);
+    test_write_gni(xmlpath, 101);
+    assert(gni_populate_cached(cached, NULL, xmlpath, cachepath) == 0);
+    assert(cached->max_instances == 101);
+
+    // the version is read without populating anything
+    assert((gni_read_version(xmlpath, version, sizeof (version)) == 0) && !strcmp(version, "101"));
+    assert((gni_read_version(cachepath, version, sizeof (version)) == 1) && !strlen(version));
+
+    // a truncated cache is rejected and leaves a clean structure
+    assert(stat(cachepath, &mystat) == 0);
+    assert(truncate(cachepath, mystat.st_size / 2) == 0);
+    assert((xmlhash = file2md5str(xmlpath)) != NULL);
+    assert(gni_cache_load(cached, cachepath, xmlhash) == 1);
+    assert(cached->max_instances == 101);
+    assert(((fd = open(cachepath, O_RDWR)) >= 0) && (pread(fd, &header, sizeof (header), 0) == sizeof (header)));
+    header.length = (mystat.st_size / 2) - sizeof (gni_cache_header);
+    assert(pwrite(fd, &header, sizeof (header), 0) == sizeof (header));
+    close(fd);
+    assert(gni_cache_load(cached, cachepath, xmlhash) == 1);
+    assert((cached->max_instances == 0) && (cached->max_secgroups == 0) && (cached->max_vpcs == 0));
+    EUCA_FREE(xmlhash);
+
+    unlink(cachepath);
+    unlink(xmlpath);
+    gni_free(dom);
+    gni_free(gni);
+    gni_free(cached);
+    printf("functional tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
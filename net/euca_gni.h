@@ -427,6 +427,11 @@ int gni_print(globalNetworkInfo * gni);
 int gni_iterate(globalNetworkInfo * gni, int mode);
 int gni_populate(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
 int gni_populate_v(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
+int gni_populate_dom(int mode, globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath);
+int gni_read_version(char *xmlpath, char *version, size_t size);
+int gni_populate_cached(globalNetworkInfo *gni, gni_hostname_info *host_info, char *xmlpath, char *cachepath);
+int gni_cache_save(globalNetworkInfo *gni, const char *cachepath, const char *xmlhash);
+int gni_cache_load(globalNetworkInfo *gni, const char *cachepath, const char *xmlhash);
 int gni_populate_xpathnodes(xmlDocPtr doc, xmlNode **gni_nodes);
 gni_xpath_node_type gni_xmlstr2type(const xmlChar *nodename);
 int gni_populate_gnidata(globalNetworkInfo *gni, xmlNodePtr xmlnode, xmlXPathContextPtr ctxptr, xmlDocPtr doc);
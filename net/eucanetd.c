@@ -339,6 +339,7 @@ int main(int argc, char **argv)
     int epoch_updates = 0;
     int lni_rc = 0;
     int epoch_failed_updates = 0;
+    int epoch_skipped_updates = 0;
     int epoch_checks = 0;
     time_t epoch_timer = 0;
     struct timeval tv = { 0 };
@@ -619,6 +620,9 @@ int main(int argc, char **argv)
 
         if (update_globalnet) {
             rc = eucanetd_read_latest_network(pGni, &update_globalnet);
+            if (!rc && !update_globalnet) {
+                epoch_skipped_updates++;
+            }
         }
         if (rc) {
             LOGWARN("Failed to populate GNI. skipping update\n");
@@ -779,9 +783,9 @@ int main(int argc, char **argv)
         }
 
         if (epoch_timer >= 300) {
-            LOGINFO("eucanetd report: tot_checks=%d tot_update_attempts=%d\n\tsuccess_update_attempts=%d fail_update_attempts=%d duty_cycle_minutes=%f\n", epoch_checks,
-                    epoch_updates + epoch_failed_updates, epoch_updates, epoch_failed_updates, (float)epoch_timer / 60.0);
-            epoch_checks = epoch_updates = epoch_failed_updates = epoch_timer = 0;
+            LOGINFO("eucanetd report: tot_checks=%d tot_update_attempts=%d\n\tsuccess_update_attempts=%d fail_update_attempts=%d skipped_update_attempts=%d duty_cycle_minutes=%f\n", epoch_checks,
+                    epoch_updates + epoch_failed_updates, epoch_updates, epoch_failed_updates, epoch_skipped_updates, (float)epoch_timer / 60.0);
+            epoch_checks = epoch_updates = epoch_failed_updates = epoch_skipped_updates = epoch_timer = 0;
         }
 
         if ((update_globalnet_failed == FALSE) && (update_globalnet == FALSE) && (gIsRunning == TRUE)) {
@@ -1695,6 +1699,8 @@ static int eucanetd_read_latest_network(globalNetworkInfo *pGni, boolean *update
     char *strptrb = NULL;
     char *strptrc = NULL;
     char *strptrd = NULL;
+    char cacheFile[EUCA_MAX_PATH] = "";
+    char version[32] = "";
     boolean found_ip = FALSE;
     gni_cluster *mycluster = NULL;
 
@@ -1704,7 +1710,17 @@ static int eucanetd_read_latest_network(globalNetworkInfo *pGni, boolean *update
         LOGWARN("Invalid argument: update_globalnet is null.\n");
         return (1);
     }
-    rc = gni_populate(pGni, host_info, config->global_network_info_file.dest);
+    // a new document still carrying the last successfully applied version needs no parsing
+    // (SIGHUP clears the last applied version to force a full update)
+    if (strlen(config->lastAppliedVersion) && !gni_read_version(config->global_network_info_file.dest, version, sizeof (version))) {
+        if (strlen(version) && !strcmp(version, config->lastAppliedVersion)) {
+            LOGINFO("global network version (%s) already applied, skipping update\n", version);
+            *update_globalnet = FALSE;
+            return (0);
+        }
+    }
+    snprintf(cacheFile, EUCA_MAX_PATH, EUCALYPTUS_RUN_DIR "/eucanetd_global_network_info.cache", config->eucahome);
+    rc = gni_populate_cached(pGni, host_info, config->global_network_info_file.dest, cacheFile);
     if (rc) {
         LOGERROR("failed to initialize global network info data structures from XML file: check network config settings\n");
         ret = 1;
@@ -97,6 +97,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define IPS_MIN_CAPACITY                         16     //!< Sets or members allocated at once the first time, doubled after that
+#define IPS_RESYNC_SEC                           60     //!< Longest we go on the applied state before reading the sets back with ipset save
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -115,6 +118,13 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Member looked up in a set's member index
+typedef struct ips_member_key_t {
+    ips_set *set;                      //!< set the member index belongs to
+    u32 ip;                            //!< network address of the member
+    int nm;                            //!< netmask length of the member
+} ips_member_key;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -141,12 +151,33 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static boolean ips_set_match(int slot, const char *key, void *ctx);
+static boolean ips_member_match(int slot, const char *key, void *ctx);
+static int ips_set_find_member(ips_set * set, u32 ip, int nm);
+static void ips_set_add_member(ips_set * set, u32 ip, int nm);
+static void ips_set_release(ips_set * set);
+static int ips_member_cmp(const void *p1, const void *p2);
+static unsigned long long *ips_set_sorted_members(ips_set * set);
+static int ips_set_write_diff(FILE * FH, ips_set * set);
+static int ips_handler_write(ips_handler * ipsh, int dodelete);
+static void ips_handler_mark_applied(ips_handler * ipsh, int dodelete);
+static int ips_handler_reload(ips_handler * ipsh);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Capacity to grow an array to so that it can hold one more element
+#define IPS_GROW(_capacity)                      (((_capacity) < IPS_MIN_CAPACITY) ? IPS_MIN_CAPACITY : ((_capacity) * 2))
+
+//! Sortable value of a set member: its network address, then its netmask length
+#define IPS_MEMBER(_ip, _nm)                     ((((unsigned long long)(_ip)) << 8) | (((unsigned long long)(_nm)) & 0xff))
+
+//! Index key of a set member, at least 16 bytes
+#define IPS_MEMBER_KEY(_key, _ip, _nm)           snprintf((_key), 16, "%08x/%d", (_ip), (_nm))
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -294,6 +325,8 @@ int ips_system_restore(ips_handler * ipsh)
 //! @post
 //!
 //! @note
+//!     - Within IPS_RESYNC_SEC of the last ipset save, the sets are rebuilt from what we last
+//!       applied instead of being dumped from the kernel again.
 //!
 int ips_handler_repopulate(ips_handler * ipsh)
 {
@@ -310,6 +343,13 @@ int ips_handler_repopulate(ips_handler * ipsh)
         return (1);
     }
 
+    // we wrote the sets ourselves a moment ago, no need to dump them all from the kernel again
+    if (ipsh->baseline && ((time(NULL) - ipsh->synced) < IPS_RESYNC_SEC)) {
+        rc = ips_handler_reload(ipsh);
+        LOGINFO("ips populated from the applied state in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
+        return (rc);
+    }
+
     rc = ips_handler_free(ipsh);
     if (rc) {
         return (1);
@@ -363,6 +403,10 @@ int ips_handler_repopulate(ips_handler * ipsh)
     }
     fclose(FH);
 
+    // what we just read is what the system holds, the next deploy only needs to apply the difference
+    ips_handler_mark_applied(ipsh, FALSE);
+    ipsh->synced = time(NULL);
+
     LOGINFO("ips populated in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
     return (0);
 }
@@ -382,42 +426,349 @@ int ips_handler_repopulate(ips_handler * ipsh)
 //! @post
 //!
 //! @note
+//!     - Once the handler knows what the system holds, sets that did not change are left alone
+//!       and changed sets only get add/del commands for the members that differ. ipset restore
+//!       is not run at all when nothing changed.
 //!
 int ips_handler_deploy(ips_handler * ipsh, int dodelete)
 {
-    int i = 0;
-    int j = 0;
-    FILE *FH = NULL;
-    char *strptra = NULL;
+    int rc = 0;
+    int changes = 0;
+    struct timeval tv = { 0 };
 
     if (!ipsh || !ipsh->init) {
         return (1);
     }
 
+    eucanetd_timer_usec(&tv);
+    if ((changes = ips_handler_write(ipsh, dodelete)) < 0) {
+        return (1);
+    }
+
+    if (changes == 0) {
+        unlink(ipsh->ips_file);
+        LOGDEBUG("no ipset changed, skipping ipset restore\n");
+        return (0);
+    }
+
+    if ((rc = ips_system_restore(ipsh)) != 0) {
+        ipsh->baseline = 0;
+        return (rc);
+    }
+    ips_handler_mark_applied(ipsh, dodelete);
+    LOGDEBUG("ips deployed %d change(s) in %.2f ms.\n", changes, eucanetd_timer_usec(&tv) / 1000.0);
+    return (0);
+}
+
+//!
+//! Confirms that a set slot found in the handler's set index holds the given name.
+//!
+//! @param[in] slot the slot in the handler's sets
+//! @param[in] key the set name looked up
+//! @param[in] ctx pointer to the IP set handler structure
+//!
+//! @return TRUE if the set at slot has that name
+//!
+static boolean ips_set_match(int slot, const char *key, void *ctx)
+{
+    ips_handler *ipsh = ((ips_handler *) ctx);
+    return ((slot < ipsh->max_sets) && !strcmp(ipsh->sets[slot].name, key));
+}
+
+//!
+//! Confirms that a member slot found in a set's member index holds the member looked up.
+//!
+//! @param[in] slot the slot in the set's members
+//! @param[in] key the member index key looked up
+//! @param[in] ctx pointer to the ips_member_key looked up
+//!
+//! @return TRUE if the member at slot is that member
+//!
+static boolean ips_member_match(int slot, const char *key, void *ctx)
+{
+    ips_member_key *member = ((ips_member_key *) ctx);
+    return ((slot < member->set->max_member_ips) && (member->set->member_ips[slot] == member->ip) && (member->set->member_nms[slot] == member->nm));
+}
+
+//!
+//! Looks up a member of a set.
+//!
+//! @param[in] set pointer to the set
+//! @param[in] ip the network address of the member
+//! @param[in] nm the netmask length of the member
+//!
+//! @return the slot of the member in member_ips and member_nms or -1 if it is not in the set
+//!
+static int ips_set_find_member(ips_set * set, u32 ip, int nm)
+{
+    char key[16] = "";
+    ips_member_key member = { set, ip, nm };
+
+    IPS_MEMBER_KEY(key, ip, nm);
+    return (euca_index_find(set->member_index, key, ips_member_match, &member, NULL));
+}
+
+//!
+//! Adds a member to a set unless it is already in it.
+//!
+//! @param[in] set pointer to the set
+//! @param[in] ip the network address of the member
+//! @param[in] nm the netmask length of the member
+//!
+static void ips_set_add_member(ips_set * set, u32 ip, int nm)
+{
+    char key[16] = "";
+
+    if (ips_set_find_member(set, ip, nm) >= 0) {
+        return;
+    }
+
+    if (set->max_member_ips == set->member_capacity) {
+        set->member_capacity = IPS_GROW(set->member_capacity);
+        set->member_ips = realloc(set->member_ips, sizeof(u32) * set->member_capacity);
+        if (!set->member_ips) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        set->member_nms = realloc(set->member_nms, sizeof(int) * set->member_capacity);
+        if (!set->member_nms) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+    }
+    if (set->member_index == NULL) {
+        set->member_index = euca_index_alloc(set->member_capacity);
+    }
+    if (!set->member_index || (euca_index_reserve(&(set->member_index), set->member_capacity) != EUCA_OK)) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+
+    set->member_ips[set->max_member_ips] = ip;
+    set->member_nms[set->max_member_ips] = nm;
+    IPS_MEMBER_KEY(key, ip, nm);
+    euca_index_insert(set->member_index, key, set->max_member_ips);
+    set->max_member_ips++;
+    set->ref_count++;
+    set->dirty = 1;
+}
+
+//!
+//! Releases the memory held by a set, not the set itself.
+//!
+//! @param[in] set pointer to the set
+//!
+static void ips_set_release(ips_set * set)
+{
+    EUCA_FREE(set->member_ips);
+    EUCA_FREE(set->member_nms);
+    EUCA_FREE(set->member_index);
+    EUCA_FREE(set->applied_members);
+}
+
+//!
+//! Compares two IPS_MEMBER() values, for qsort()
+//!
+//! @param[in] p1 a pointer to the left hand side member
+//! @param[in] p2 a pointer to the right hand side member
+//!
+//! @return -1, 0 or 1 as p1 sorts before, with or after p2
+//!
+static int ips_member_cmp(const void *p1, const void *p2)
+{
+    unsigned long long a = *((const unsigned long long *)p1);
+    unsigned long long b = *((const unsigned long long *)p2);
+
+    return ((a > b) - (a < b));
+}
+
+//!
+//! Lists the members of a set in IPS_MEMBER() order.
+//!
+//! @param[in] set pointer to the set
+//!
+//! @return an array of max_member_ips IPS_MEMBER() values the caller must free, NULL if the set is empty
+//!
+static unsigned long long *ips_set_sorted_members(ips_set * set)
+{
+    int i = 0;
+    unsigned long long *members = NULL;
+
+    if (set->max_member_ips == 0) {
+        return (NULL);
+    }
+
+    if ((members = EUCA_ALLOC(set->max_member_ips, sizeof(unsigned long long))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    for (i = 0; i < set->max_member_ips; i++) {
+        members[i] = IPS_MEMBER(set->member_ips[i], set->member_nms[i]);
+    }
+    qsort(members, set->max_member_ips, sizeof(unsigned long long), ips_member_cmp);
+    return (members);
+}
+
+//!
+//! Writes the ipset restore commands that take a set from its applied members to its current ones.
+//!
+//! @param[in] FH the ipset restore file being written
+//! @param[in] set pointer to the set, which must be applied
+//!
+//! @return the number of members added or removed
+//!
+static int ips_set_write_diff(FILE * FH, ips_set * set)
+{
+    int i = 0;
+    int j = 0;
+    int changes = 0;
+    char *strptra = NULL;
+    unsigned long long *members = ips_set_sorted_members(set);
+
+    while ((i < set->max_applied_members) || (j < set->max_member_ips)) {
+        if ((j >= set->max_member_ips) || ((i < set->max_applied_members) && (set->applied_members[i] < members[j]))) {
+            strptra = hex2dot((u32) (set->applied_members[i] >> 8));
+            LOGDEBUG("removing ip/nm %s/%d from ipset %s\n", strptra, (int)(set->applied_members[i] & 0xff), set->name);
+            fprintf(FH, "del %s %s/%d\n", set->name, strptra, (int)(set->applied_members[i] & 0xff));
+            EUCA_FREE(strptra);
+            changes++;
+            i++;
+        } else if ((i >= set->max_applied_members) || (members[j] < set->applied_members[i])) {
+            strptra = hex2dot((u32) (members[j] >> 8));
+            LOGDEBUG("adding ip/nm %s/%d to ipset %s\n", strptra, (int)(members[j] & 0xff), set->name);
+            fprintf(FH, "add %s %s/%d\n", set->name, strptra, (int)(members[j] & 0xff));
+            EUCA_FREE(strptra);
+            changes++;
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+    EUCA_FREE(members);
+    return (changes);
+}
+
+//!
+//! Writes the ipset restore commands for a deploy to the configured file: every set in use is
+//! created and filled unless the system already has it, in which case only its changed members
+//! are added or removed, and sets no longer in use are destroyed if asked to.
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set to 1 to destroy the sets no longer referenced
+//!
+//! @return the number of changes written or -1 if the file could not be written
+//!
+static int ips_handler_write(ips_handler * ipsh, int dodelete)
+{
+    int i = 0;
+    int j = 0;
+    int changes = 0;
+    FILE *FH = NULL;
+    char *strptra = NULL;
+    ips_set *set = NULL;
+
     FH = fopen(ipsh->ips_file, "w");
     if (!FH) {
         LOGERROR("could not open file for write '%s': check permissions\n", ipsh->ips_file);
-        return (1);
+        return (-1);
     }
     for (i = 0; i < ipsh->max_sets; i++) {
-        if (ipsh->sets[i].ref_count) {
-            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", ipsh->sets[i].name);
-            fprintf(FH, "flush %s\n", ipsh->sets[i].name);
-            for (j = 0; j < ipsh->sets[i].max_member_ips; j++) {
-                strptra = hex2dot(ipsh->sets[i].member_ips[j]);
-                LOGDEBUG("adding ip/nm %s/%d to ipset %s\n", strptra, ipsh->sets[i].member_nms[j], ipsh->sets[i].name);
-                fprintf(FH, "add %s %s/%d\n", ipsh->sets[i].name, strptra, ipsh->sets[i].member_nms[j]);
+        set = &(ipsh->sets[i]);
+        if (set->ref_count) {
+            if (ipsh->baseline && set->applied) {
+                if (set->dirty) {
+                    changes += ips_set_write_diff(FH, set);
+                }
+                continue;
+            }
+            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", set->name);
+            fprintf(FH, "flush %s\n", set->name);
+            for (j = 0; j < set->max_member_ips; j++) {
+                strptra = hex2dot(set->member_ips[j]);
+                LOGDEBUG("adding ip/nm %s/%d to ipset %s\n", strptra, set->member_nms[j], set->name);
+                fprintf(FH, "add %s %s/%d\n", set->name, strptra, set->member_nms[j]);
                 EUCA_FREE(strptra);
             }
-        } else if ((ipsh->sets[i].ref_count == 0) && dodelete) {
-            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", ipsh->sets[i].name);
-            fprintf(FH, "flush %s\n", ipsh->sets[i].name);
-            fprintf(FH, "destroy %s\n", ipsh->sets[i].name);
+            changes++;
+        } else if ((set->ref_count == 0) && dodelete && (!ipsh->baseline || set->applied)) {
+            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", set->name);
+            fprintf(FH, "flush %s\n", set->name);
+            fprintf(FH, "destroy %s\n", set->name);
+            changes++;
         }
     }
     fclose(FH);
+    return (changes);
+}
 
-    return (ips_system_restore(ipsh));
+//!
+//! Records the sets as the system holds them after a repopulate or a successful deploy.
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set if the sets no longer referenced were destroyed
+//!
+static void ips_handler_mark_applied(ips_handler * ipsh, int dodelete)
+{
+    int i = 0;
+    ips_set *set = NULL;
+
+    for (i = 0; i < ipsh->max_sets; i++) {
+        set = &(ipsh->sets[i]);
+        if (set->ref_count) {
+            if (set->dirty || !set->applied) {
+                EUCA_FREE(set->applied_members);
+                set->applied_members = ips_set_sorted_members(set);
+                set->max_applied_members = set->max_member_ips;
+            }
+            set->applied = 1;
+            set->dirty = 0;
+        } else if (dodelete) {
+            EUCA_FREE(set->applied_members);
+            set->max_applied_members = 0;
+            set->applied = 0;
+        }
+    }
+    ipsh->baseline = 1;
+}
+
+//!
+//! Resets the handler to the sets and members we last applied, as if they had just been read
+//! back from the system with ipset save.
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//!
+//! @return Always returns 0
+//!
+static int ips_handler_reload(ips_handler * ipsh)
+{
+    int i = 0;
+    int j = 0;
+    int nsets = ipsh->max_sets;
+    ips_set *sets = ipsh->sets;
+    ips_set *set = NULL;
+
+    EUCA_FREE(ipsh->set_index);
+    ipsh->sets = NULL;
+    ipsh->max_sets = ipsh->set_capacity = 0;
+
+    for (i = 0; i < nsets; i++) {
+        if (sets[i].applied) {
+            ips_handler_add_set(ipsh, sets[i].name);
+            set = ips_handler_find_set(ipsh, sets[i].name);
+            for (j = 0; j < sets[i].max_applied_members; j++) {
+                ips_set_add_member(set, (u32) (sets[i].applied_members[j] >> 8), (int)(sets[i].applied_members[j] & 0xff));
+            }
+            set->applied = 1;
+            set->dirty = 0;
+            set->applied_members = sets[i].applied_members;
+            set->max_applied_members = sets[i].max_applied_members;
+            sets[i].applied_members = NULL;
+        }
+        ips_set_release(&(sets[i]));
+    }
+    EUCA_FREE(sets);
+    return (0);
 }
 
 //!
@@ -446,14 +797,26 @@ int ips_handler_add_set(ips_handler * ipsh, char *setname)
 
     set = ips_handler_find_set(ipsh, setname);
     if (!set) {
-        ipsh->sets = realloc(ipsh->sets, sizeof(ips_set) * (ipsh->max_sets + 1));
-        if (!ipsh->sets) {
+        if (ipsh->max_sets == ipsh->set_capacity) {
+            ipsh->set_capacity = IPS_GROW(ipsh->set_capacity);
+            ipsh->sets = realloc(ipsh->sets, sizeof(ips_set) * ipsh->set_capacity);
+            if (!ipsh->sets) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+        }
+        if (ipsh->set_index == NULL) {
+            ipsh->set_index = euca_index_alloc(ipsh->set_capacity);
+        }
+        if (!ipsh->set_index || (euca_index_reserve(&(ipsh->set_index), ipsh->set_capacity) != EUCA_OK)) {
             LOGFATAL("out of memory!\n");
             exit(1);
         }
         bzero(&(ipsh->sets[ipsh->max_sets]), sizeof(ips_set));
         snprintf(ipsh->sets[ipsh->max_sets].name, 64, setname);
         ipsh->sets[ipsh->max_sets].ref_count = 1;
+        ipsh->sets[ipsh->max_sets].dirty = 1;
+        euca_index_insert(ipsh->set_index, ipsh->sets[ipsh->max_sets].name, ipsh->max_sets);
         ipsh->max_sets++;
     }
     return (0);
@@ -477,18 +840,12 @@ int ips_handler_add_set(ips_handler * ipsh, char *setname)
 //!
 ips_set *ips_handler_find_set(ips_handler * ipsh, char *findset)
 {
-    int i, setidx = 0, found = 0;
+    int setidx = 0;
     if (!ipsh || !findset || !ipsh->init) {
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < ipsh->max_sets && !found; i++) {
-        setidx = i;
-        if (!strcmp(ipsh->sets[i].name, findset))
-            found++;
-    }
-    if (!found) {
+    if ((setidx = euca_index_find(ipsh->set_index, findset, ips_set_match, ipsh, NULL)) < 0) {
         return (NULL);
     }
     return (&(ipsh->sets[setidx]));
@@ -537,7 +894,6 @@ int ips_set_add_ip(ips_handler * ipsh, char *setname, char *ipname)
 int ips_set_add_net(ips_handler * ipsh, char *setname, char *ipname, int nmname)
 {
     ips_set *set = NULL;
-    u32 *ip = NULL;
     if (!ipsh || !setname || !ipname || !ipsh->init) {
         return (1);
     }
@@ -547,26 +903,7 @@ int ips_set_add_net(ips_handler * ipsh, char *setname, char *ipname, int nmname)
         return (1);
     }
 
-    ip = ips_set_find_net(ipsh, setname, ipname, nmname);
-    if (!ip) {
-        set->member_ips = realloc(set->member_ips, sizeof(u32) * (set->max_member_ips + 1));
-        if (!set->member_ips) {
-            LOGFATAL("out of memory!\n");
-            exit(1);
-        }
-        set->member_nms = realloc(set->member_nms, sizeof(int) * (set->max_member_ips + 1));
-        if (!set->member_nms) {
-            LOGFATAL("out of memory!\n");
-            exit(1);
-        }
-
-        bzero(&(set->member_ips[set->max_member_ips]), sizeof(u32));
-        bzero(&(set->member_nms[set->max_member_ips]), sizeof(int));
-        set->member_ips[set->max_member_ips] = dot2hex(ipname);
-        set->member_nms[set->max_member_ips] = nmname;
-        set->max_member_ips++;
-        set->ref_count++;
-    }
+    ips_set_add_member(set, dot2hex(ipname), nmname);
     return (0);
 }
 
@@ -612,9 +949,8 @@ u32 *ips_set_find_ip(ips_handler * ipsh, char *setname, char *findipstr)
 //!
 u32 *ips_set_find_net(ips_handler * ipsh, char *setname, char *findipstr, int findnm)
 {
-    int i, found = 0, ipidx = 0;
+    int ipidx = 0;
     ips_set *set = NULL;
-    u32 findip;
 
     if (!ipsh || !setname || !findipstr || !ipsh->init) {
         return (NULL);
@@ -625,15 +961,7 @@ u32 *ips_set_find_net(ips_handler * ipsh, char *setname, char *findipstr, int fi
         return (NULL);
     }
 
-    findip = dot2hex(findipstr);
-    found = 0;
-    for (i = 0; i < set->max_member_ips && !found; i++) {
-        ipidx = i;
-        if (set->member_ips[i] == findip && set->member_nms[i] == findnm)
-            found++;
-    }
-
-    if (!found) {
+    if ((ipidx = ips_set_find_member(set, dot2hex(findipstr), findnm)) < 0) {
         return (NULL);
     }
 
@@ -671,7 +999,9 @@ int ips_set_flush(ips_handler * ipsh, char *setname)
 
     EUCA_FREE(set->member_ips);
     EUCA_FREE(set->member_nms);
-    set->max_member_ips = set->ref_count = 0;
+    EUCA_FREE(set->member_index);
+    set->max_member_ips = set->member_capacity = set->ref_count = 0;
+    set->dirty = 1;
 
     return (0);
 }
@@ -706,8 +1036,11 @@ int ips_handler_deletesetmatch(ips_handler * ipsh, char *setmatch)
         if (strstr(ipsh->sets[i].name, setmatch)) {
             EUCA_FREE(ipsh->sets[i].member_ips);
             EUCA_FREE(ipsh->sets[i].member_nms);
+            EUCA_FREE(ipsh->sets[i].member_index);
             ipsh->sets[i].max_member_ips = 0;
+            ipsh->sets[i].member_capacity = 0;
             ipsh->sets[i].ref_count = 0;
+            ipsh->sets[i].dirty = 1;
         }
     }
 
@@ -740,10 +1073,10 @@ int ips_handler_free(ips_handler * ipsh)
     snprintf(saved_cmdprefix, EUCA_MAX_PATH, "%s", ipsh->cmdprefix);
 
     for (i = 0; i < ipsh->max_sets; i++) {
-        EUCA_FREE(ipsh->sets[i].member_ips);
-        EUCA_FREE(ipsh->sets[i].member_nms);
+        ips_set_release(&(ipsh->sets[i]));
     }
     EUCA_FREE(ipsh->sets);
+    EUCA_FREE(ipsh->set_index);
 
     unlink(ipsh->ips_file);
 
@@ -773,10 +1106,10 @@ int ips_handler_close(ips_handler * ipsh)
         return (1);
     }
     for (i = 0; i < ipsh->max_sets; i++) {
-        EUCA_FREE(ipsh->sets[i].member_ips);
-        EUCA_FREE(ipsh->sets[i].member_nms);
+        ips_set_release(&(ipsh->sets[i]));
     }
     EUCA_FREE(ipsh->sets);
+    EUCA_FREE(ipsh->set_index);
 
     unlink(ipsh->ips_file);
     return (0);
@@ -818,3 +1151,114 @@ int ips_handler_print(ips_handler * ipsh)
     }
     return (0);
 }
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+
+#define TEST_SETS                                200    //!< Security group sets in the benchmark
+#define TEST_MEMBERS                             250    //!< Members per set, 50k in all
+
+//!
+//! Fills the sets the way eucanetd does on every cycle: reset them, then add every member back.
+//!
+static void test_fill(ips_handler * ipsh, int joinIdx, int leaveIdx)
+{
+    int i = 0;
+    int j = 0;
+    char setname[64] = "";
+    char ip[32] = "";
+
+    ips_handler_deletesetmatch(ipsh, "EU_");
+    for (i = 0; i < TEST_SETS; i++) {
+        snprintf(setname, sizeof(setname), "EU_%04d", i);
+        ips_handler_add_set(ipsh, setname);
+        for (j = 0; j < TEST_MEMBERS + (i == joinIdx); j++) {
+            if ((i != leaveIdx) || (j != 0)) {
+                snprintf(ip, sizeof(ip), "10.%d.%d.%d", (i / 256), (i % 256), (j + 1));
+                ips_set_add_ip(ipsh, setname, ip);
+            }
+        }
+    }
+}
+
+//!
+//! Counts the lines written to the handler file and checks for one of them.
+//!
+static int test_lines(ips_handler * ipsh, const char *find, int *found)
+{
+    int lines = 0;
+    char buf[1024] = "";
+    FILE *FH = NULL;
+
+    *found = 0;
+    assert((FH = fopen(ipsh->ips_file, "r")) != NULL);
+    while (fgets(buf, sizeof(buf), FH)) {
+        if (!strncmp(buf, find, strlen(find)))
+            (*found)++;
+        lines++;
+    }
+    fclose(FH);
+    return (lines);
+}
+
+int main(int argc, char **argv)
+{
+    int fd = 0;
+    int found = 0;
+    int lines = 0;
+    struct timeval tv = { 0 };
+    ips_handler ips = { 0 };
+
+    log_file_set(NULL, NULL);
+    snprintf(ips.ips_file, EUCA_MAX_PATH, "/tmp/ips_file-XXXXXX");
+    assert((fd = safe_mkstemp(ips.ips_file)) >= 0);
+    close(fd);
+    ips.init = 1;
+
+    // the first deploy writes every set in full
+    test_fill(&ips, -1, -1);
+    eucanetd_timer_usec(&tv);
+    assert(ips_handler_write(&ips, 1) == TEST_SETS);
+    lines = test_lines(&ips, "add ", &found);
+    assert(found == (TEST_SETS * TEST_MEMBERS));
+    printf("full deploy of %d sets, %d members: %d lines written in %.2f ms\n", TEST_SETS, (TEST_SETS * TEST_MEMBERS), lines, eucanetd_timer_usec(&tv) / 1000.0);
+    ips_handler_mark_applied(&ips, 1);
+    ips.synced = time(NULL);
+
+    // the next cycle starts from the applied state without asking the kernel
+    assert(ips_handler_repopulate(&ips) == 0);
+    assert((ips.max_sets == TEST_SETS) && (ips.sets[0].max_member_ips == TEST_MEMBERS) && !ips.sets[0].dirty);
+    assert(ips_set_find_ip(&ips, "EU_0000", "10.0.0.1") != NULL);
+
+    // the same membership again leaves nothing to do
+    test_fill(&ips, -1, -1);
+    assert(ips_handler_write(&ips, 1) == 0);
+
+    // one instance joins a group and another one leaves: two commands
+    test_fill(&ips, 42, 7);
+    eucanetd_timer_usec(&tv);
+    assert(ips_handler_write(&ips, 1) == 2);
+    lines = test_lines(&ips, "add EU_0042 10.0.42.251/32", &found);
+    assert((lines == 2) && (found == 1));
+    test_lines(&ips, "del EU_0007 10.0.7.1/32", &found);
+    assert(found == 1);
+    printf("one member added and one removed: %d lines written in %.2f ms\n", lines, eucanetd_timer_usec(&tv) / 1000.0);
+    ips_handler_mark_applied(&ips, 1);
+
+    // a set nobody references any more is destroyed, and only once
+    ips_handler_deletesetmatch(&ips, "EU_0099");
+    assert(ips_handler_write(&ips, 0) == 0);
+    assert(ips_handler_write(&ips, 1) == 1);
+    test_lines(&ips, "destroy EU_0099", &found);
+    assert(found == 1);
+    ips_handler_mark_applied(&ips, 1);
+    assert(ips_handler_repopulate(&ips) == 0);
+    assert((ips.max_sets == (TEST_SETS - 1)) && (ips_handler_find_set(&ips, "EU_0099") == NULL));
+    assert(ips_set_find_ip(&ips, "EU_0042", "10.0.42.251") != NULL);
+
+    ips_handler_close(&ips);
+    printf("functional tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
@@ -77,6 +77,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <time.h>
+
+#include <euca_index.h>
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -106,15 +110,25 @@ typedef struct ips_set_t {
     u32 *member_ips;
     int *member_nms;
     int max_member_ips;
+    int member_capacity;               //!< number of members allocated, grown by doubling
+    euca_index *member_index;          //!< member ip/nm -> slot in member_ips and member_nms
     int ref_count;
+    int dirty;                         //!< set when the members changed since the set was last applied
+    int applied;                       //!< set when the set is known to exist in the system
+    unsigned long long *applied_members;    //!< sorted members the system holds, valid when applied is set
+    int max_applied_members;
 } ips_set;
 
 typedef struct ips_handler_t {
     ips_set *sets;
     int max_sets;
+    int set_capacity;                  //!< number of sets allocated, grown by doubling
+    euca_index *set_index;             //!< set name -> slot in sets
     char ips_file[EUCA_MAX_PATH];
     char cmdprefix[EUCA_MAX_PATH];
     int init;
+    int baseline;                      //!< set when the sets' applied state reflects the system
+    time_t synced;                     //!< when the sets were last read back from the system
 } ips_handler;
 
 /*----------------------------------------------------------------------------*\
@@ -97,6 +97,11 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define IPT_HASH_OFFSET                          0xcbf29ce484222325ULL  //!< FNV-1a 64-bit offset basis used to fingerprint chains
+#define IPT_HASH_PRIME                           0x100000001b3ULL   //!< FNV-1a 64-bit prime used to fingerprint chains
+#define IPT_CHAIN_USER_POLICY                    "-"    //!< Policy iptables-save reports for user defined chains
+#define IPT_MIN_CAPACITY                         16     //!< Chains or rules allocated at once the first time, doubled after that
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -141,12 +146,30 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static unsigned long long ipt_hash_str(unsigned long long hash, const char *str);
+static unsigned long long ipt_chain_hash(ipt_chain * chain);
+static int ipt_chain_dirty(ipt_chain * chain);
+static int ipt_handler_hash_chains(ipt_handler * pIpt);
+static void ipt_handler_mark_applied(ipt_handler * pIpt);
+static int ipt_handler_write(ipt_handler * pIpt, int incremental);
+static int ipt_system_restore_noflush(ipt_handler * pIpt);
+static boolean ipt_chain_match(int slot, const char *key, void *ctx);
+static boolean ipt_rule_match(int slot, const char *key, void *ctx);
+static void ipt_rule_unlink(ipt_chain * chain, int slot);
+static void ipt_rule_link_after(ipt_chain * chain, int slot, int after);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Whether or not a chain is part of what ipt_handler_deploy() puts in the system
+#define IPT_CHAIN_DEPLOYED(_pChain)              (!(_pChain)->flushed && ((_pChain)->ref_count > 0))
+
+//! Capacity to grow an array to so that it can hold one more element
+#define IPT_GROW(_capacity)                      (((_capacity) < IPT_MIN_CAPACITY) ? IPT_MIN_CAPACITY : ((_capacity) * 2))
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -314,47 +337,181 @@ int ipt_system_restore(ipt_handler * pIpt)
 }
 
 //!
-//! Takes our latest IP table virtual content and puts it into a file in IP tables format that
-//! will be passed to ip_system_restore(). Once completed, the system IP tables should contain
-//! the latest changes we made.
+//! Runs iptables-restore in --noflush mode on our configured IP table file. Only the tables
+//! and chains named in the file are touched, which is what an incremental deploy writes.
 //!
 //! @param[in] pIpt pointer to the IP table handler structure
 //!
 //! @return 0 on success or any other value if any failure occured
 //!
-//! @see ipt_system_restore()
+//! @see ipt_system_restore(), ipt_handler_deploy()
 //!
 //! @pre
-//!     - Our given pointers must not be NULL
-//!     - The IP table structure must have been intialized
-//!     - The system must allow us to write to the file configured in the IP table structure
+//!     - pIpt MUST not be NULL
+//!     - The IP table structure temporary file must exists on the system
 //!
 //! @post
-//!     On success, the system IP tables will contain what we put in our structure. On failure, the
-//!     system IP tables should remain unchanged.
+//!     On success, the chains listed in the file have been replaced and the chains deleted in
+//!     it are gone. On failure, the system IP tables should remain unchanged and the content of
+//!     the file saved in /tmp/euca_ipt_file_failed.
 //!
 //! @note
 //!
-int ipt_handler_deploy(ipt_handler * pIpt)
+static int ipt_system_restore_noflush(ipt_handler * pIpt)
+{
+    int rc = EUCA_OK;
+    if (euca_execlp_redirect(NULL, pIpt->ipt_file, NULL, FALSE, NULL, FALSE, pIpt->cmdprefix, "iptables-restore", "--noflush", "-c", NULL) != EUCA_OK) {
+        copy_file(pIpt->ipt_file, "/tmp/euca_ipt_file_failed");
+        LOGERROR("iptables-restore --noflush failed. copying failed input file to '/tmp/euca_ipt_file_failed' for manual retry.\n");
+        rc = EUCA_ERROR;
+    }
+    unlink(pIpt->ipt_file);
+    return (rc);
+}
+
+//!
+//! Folds a string into a running FNV-1a fingerprint.
+//!
+//! @param[in] hash the fingerprint so far
+//! @param[in] str the string to fold in
+//!
+//! @return the updated fingerprint
+//!
+static unsigned long long ipt_hash_str(unsigned long long hash, const char *str)
+{
+    const unsigned char *p = NULL;
+
+    for (p = (const unsigned char *)str; *p; p++) {
+        hash ^= *p;
+        hash *= IPT_HASH_PRIME;
+    }
+    hash ^= '\n';
+    return (hash * IPT_HASH_PRIME);
+}
+
+//!
+//! Computes the fingerprint of what a chain would contain once deployed: its policy and its
+//! non-flushed rules, in deploy order. Counters are left out on purpose so
+//! that traffic alone never makes a chain look changed.
+//!
+//! @param[in] chain pointer to the chain to fingerprint
+//!
+//! @return the chain fingerprint
+//!
+static unsigned long long ipt_chain_hash(ipt_chain * chain)
+{
+    int i = 0;
+    unsigned long long hash = IPT_HASH_OFFSET;
+
+    hash = ipt_hash_str(hash, chain->policyname);
+    for (i = chain->first_rule; i >= 0; i = chain->rules[i].next) {
+        if (!chain->rules[i].flushed) {
+            hash = ipt_hash_str(hash, chain->rules[i].iptrule);
+        }
+    }
+    return (hash);
+}
+
+//!
+//! Tells whether a chain differs from what the system holds. Only meaningful once
+//! ipt_handler_hash_chains() has run for the current deploy.
+//!
+//! @param[in] chain pointer to the chain to check
+//!
+//! @return 1 if the chain needs to be written (or removed) and 0 otherwise
+//!
+static int ipt_chain_dirty(ipt_chain * chain)
+{
+    if (IPT_CHAIN_DEPLOYED(chain)) {
+        return (!chain->applied || (chain->hash != chain->applied_hash));
+    }
+    return (chain->applied);
+}
+
+//!
+//! Computes the fingerprint of every chain we deploy.
+//!
+//! @param[in] pIpt pointer to the IP table handler structure
+//!
+//! @return the number of chains that differ from what the system holds
+//!
+static int ipt_handler_hash_chains(ipt_handler * pIpt)
 {
     int i = 0;
     int j = 0;
-    int k = 0;
-    char *psPreload = NULL;
-    FILE *pFh = NULL;
+    int dirty = 0;
+    ipt_chain *chain = NULL;
 
-    if (!pIpt || !pIpt->init) {
-        return (1);
+    for (i = 0; i < pIpt->max_tables; i++) {
+        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
+            chain = &(pIpt->tables[i].chains[j]);
+            if (IPT_CHAIN_DEPLOYED(chain)) {
+                chain->hash = ipt_chain_hash(chain);
+            }
+            if (ipt_chain_dirty(chain)) {
+                dirty++;
+            }
+        }
     }
+    return (dirty);
+}
 
-    ipt_handler_update_refcounts(pIpt);
+//!
+//! Records the chains we just deployed as the system state the next deploy is diffed against.
+//!
+//! @param[in] pIpt pointer to the IP table handler structure
+//!
+static void ipt_handler_mark_applied(ipt_handler * pIpt)
+{
+    int i = 0;
+    int j = 0;
+    ipt_chain *chain = NULL;
+
+    for (i = 0; i < pIpt->max_tables; i++) {
+        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
+            chain = &(pIpt->tables[i].chains[j]);
+            chain->applied = IPT_CHAIN_DEPLOYED(chain);
+            chain->applied_hash = chain->hash;
+        }
+    }
+    pIpt->baseline = 1;
+}
+
+//!
+//! Writes our IP table virtual content in iptables-restore format to the configured file.
+//!
+//! In incremental mode only the tables with changes are written and, within them, only the
+//! chains that differ from the system. Under --noflush, declaring a user defined chain
+//! flushes it but declaring a built-in one only sets its policy, so written built-in chains
+//! are flushed explicitly with -F; either way each written chain is replaced as a whole.
+//! Chains the system has but we no longer deploy are flushed the same way and user defined
+//! ones are then deleted; anything still jumping to them has changed too and is rewritten
+//! ahead of the deletion in the same transaction.
+//!
+//! @param[in] pIpt pointer to the IP table handler structure
+//! @param[in] incremental set to write only what changed since the last repopulate or deploy
+//!
+//! @return 0 on success or 1 if the file could not be written
+//!
+//! @pre ipt_handler_hash_chains() has run for this deploy
+//!
+static int ipt_handler_write(ipt_handler * pIpt, int incremental)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int dirty = 0;
+    char *psPreload = NULL;
+    FILE *pFh = NULL;
+    ipt_table *table = NULL;
+    ipt_chain *chain = NULL;
 
     if ((pFh = fopen(pIpt->ipt_file, "w")) == NULL) {
         LOGERROR("could not open file for write '%s': check permissions\n", pIpt->ipt_file);
         return (1);
     }
     // do the preload stuff first if needed
-    if (strlen(pIpt->preloadPath)) {
+    if (!incremental && strlen(pIpt->preloadPath)) {
         if ((psPreload = file2str(pIpt->preloadPath)) == NULL) {
             LOGTRACE("Fail to load IP table preload content from '%s'.\n", pIpt->preloadPath);
         } else {
@@ -364,27 +521,117 @@ int ipt_handler_deploy(ipt_handler * pIpt)
     }
 
     for (i = 0; i < pIpt->max_tables; i++) {
-        fprintf(pFh, "*%s\n", pIpt->tables[i].name);
-        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
-            if (!pIpt->tables[i].chains[j].flushed && pIpt->tables[i].chains[j].ref_count) {
-                fprintf(pFh, ":%s %s %s\n", pIpt->tables[i].chains[j].name, pIpt->tables[i].chains[j].policyname, pIpt->tables[i].chains[j].counters);
+        table = &(pIpt->tables[i]);
+        if (incremental) {
+            for (j = 0, dirty = 0; j < table->max_chains && !dirty; j++) {
+                dirty = ipt_chain_dirty(&(table->chains[j]));
+            }
+            if (!dirty) {
+                continue;
             }
         }
-        for (j = 0; j < pIpt->tables[i].max_chains; j++) {
-            if (!pIpt->tables[i].chains[j].flushed && pIpt->tables[i].chains[j].ref_count) {
-                // qsort!
-                qsort(pIpt->tables[i].chains[j].rules, pIpt->tables[i].chains[j].max_rules, sizeof(ipt_rule), ipt_ruleordercmp);
-                for (k = 0; k < pIpt->tables[i].chains[j].max_rules; k++) {
-                    if (!pIpt->tables[i].chains[j].rules[k].flushed) {
-                        fprintf(pFh, "%s %s\n", pIpt->tables[i].chains[j].rules[k].counterstr, pIpt->tables[i].chains[j].rules[k].iptrule);
+
+        fprintf(pFh, "*%s\n", table->name);
+        for (j = 0; j < table->max_chains; j++) {
+            chain = &(table->chains[j]);
+            if (incremental ? ipt_chain_dirty(chain) : IPT_CHAIN_DEPLOYED(chain)) {
+                fprintf(pFh, ":%s %s %s\n", chain->name, chain->policyname, chain->counters);
+            }
+        }
+        if (incremental) {
+            for (j = 0; j < table->max_chains; j++) {
+                chain = &(table->chains[j]);
+                if (ipt_chain_dirty(chain) && strcmp(chain->policyname, IPT_CHAIN_USER_POLICY)) {
+                    fprintf(pFh, "-F %s\n", chain->name);
+                }
+            }
+        }
+        for (j = 0; j < table->max_chains; j++) {
+            chain = &(table->chains[j]);
+            if (IPT_CHAIN_DEPLOYED(chain) && (!incremental || ipt_chain_dirty(chain))) {
+                for (k = chain->first_rule; k >= 0; k = chain->rules[k].next) {
+                    if (!chain->rules[k].flushed) {
+                        fprintf(pFh, "%s %s\n", chain->rules[k].counterstr, chain->rules[k].iptrule);
                     }
                 }
             }
         }
+        if (incremental) {
+            for (j = 0; j < table->max_chains; j++) {
+                chain = &(table->chains[j]);
+                if (!IPT_CHAIN_DEPLOYED(chain) && chain->applied && !strcmp(chain->policyname, IPT_CHAIN_USER_POLICY)) {
+                    fprintf(pFh, "-X %s\n", chain->name);
+                }
+            }
+        }
         fprintf(pFh, "COMMIT\n");
     }
     fclose(pFh);
-    return (ipt_system_restore(pIpt));
+    return (0);
+}
+
+//!
+//! Takes our latest IP table virtual content and puts it into a file in IP tables format that
+//! will be passed to ip_system_restore(). Once completed, the system IP tables should contain
+//! the latest changes we made.
+//!
+//! When we know what the system holds (the handler was repopulated or deployed since), only
+//! the chains that changed are written and applied with iptables-restore --noflush; nothing
+//! is run at all when no chain changed. The whole ruleset is restored otherwise, when a
+//! preload file is configured or if the incremental restore fails.
+//!
+//! @param[in] pIpt pointer to the IP table handler structure
+//!
+//! @return 0 on success or any other value if any failure occured
+//!
+//! @see ipt_system_restore()
+//!
+//! @pre
+//!     - Our given pointers must not be NULL
+//!     - The IP table structure must have been intialized
+//!     - The system must allow us to write to the file configured in the IP table structure
+//!
+//! @post
+//!     On success, the system IP tables will contain what we put in our structure. On failure, the
+//!     system IP tables should remain unchanged.
+//!
+//! @note
+//!
+int ipt_handler_deploy(ipt_handler * pIpt)
+{
+    int rc = 0;
+    int dirty = 0;
+    struct timeval tv = { 0 };
+
+    if (!pIpt || !pIpt->init) {
+        return (1);
+    }
+
+    eucanetd_timer_usec(&tv);
+    ipt_handler_update_refcounts(pIpt);
+    dirty = ipt_handler_hash_chains(pIpt);
+
+    if (pIpt->baseline && !strlen(pIpt->preloadPath)) {
+        if (dirty == 0) {
+            LOGDEBUG("no ipt chain changed, skipping iptables-restore\n");
+            return (0);
+        }
+
+        if (((rc = ipt_handler_write(pIpt, TRUE)) == 0) && ((rc = ipt_system_restore_noflush(pIpt)) == 0)) {
+            ipt_handler_mark_applied(pIpt);
+            LOGDEBUG("ipt deployed %d changed chain(s) in %.2f ms.\n", dirty, eucanetd_timer_usec(&tv) / 1000.0);
+            return (0);
+        }
+        LOGWARN("incremental ipt deploy failed, restoring the full ruleset instead\n");
+    }
+
+    if (((rc = ipt_handler_write(pIpt, FALSE)) != 0) || ((rc = ipt_system_restore(pIpt)) != 0)) {
+        pIpt->baseline = 0;
+        return (rc);
+    }
+    ipt_handler_mark_applied(pIpt);
+    LOGDEBUG("ipt deployed in full in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
+    return (0);
 }
 
 //!
@@ -435,6 +682,8 @@ int ipt_ruleordercmp(const void *p1, const void *p2)
 //!
 int ipt_handler_repopulate(ipt_handler * ipth)
 {
+    int i = 0;
+    int j = 0;
     int rc = 0;
     FILE *FH = NULL;
     char buf[1024] = "";
@@ -510,6 +759,15 @@ int ipt_handler_repopulate(ipt_handler * ipth)
     }
     fclose(FH);
 
+    // what we just read is what the system holds, the next deploy only needs to apply the difference
+    for (i = 0; i < ipth->max_tables; i++) {
+        for (j = 0; j < ipth->tables[i].max_chains; j++) {
+            ipth->tables[i].chains[j].applied = 1;
+            ipth->tables[i].chains[j].applied_hash = ipt_chain_hash(&(ipth->tables[i].chains[j]));
+        }
+    }
+    ipth->baseline = 1;
+
     LOGINFO("ipt populated in %.2f ms.\n", eucanetd_timer_usec(&tv) / 1000.0);
     return (0);
 }
@@ -586,13 +844,27 @@ int ipt_table_add_chain(ipt_handler * ipth, char *tablename, char *chainname, ch
 
     chain = ipt_table_find_chain(ipth, tablename, chainname);
     if (!chain) {
-        table->chains = realloc(table->chains, sizeof(ipt_chain) * (table->max_chains + 1));
-        if (!table->chains) {
+        if (table->max_chains == table->chain_capacity) {
+            table->chain_capacity = IPT_GROW(table->chain_capacity);
+            table->chains = realloc(table->chains, sizeof(ipt_chain) * table->chain_capacity);
+            if (!table->chains) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+        }
+        if (table->chain_index == NULL) {
+            table->chain_index = euca_index_alloc(table->chain_capacity);
+        }
+        if (!table->chain_index || (euca_index_reserve(&(table->chain_index), table->chain_capacity) != EUCA_OK)) {
             LOGFATAL("out of memory!\n");
             exit(1);
         }
         bzero(&(table->chains[table->max_chains]), sizeof(ipt_chain));
+        table->chains[table->max_chains].first_rule = -1;
+        table->chains[table->max_chains].last_rule = -1;
+        table->chains[table->max_chains].last_ordered = -1;
         snprintf(table->chains[table->max_chains].name, 64, "%s", chainname);
+        euca_index_insert(table->chain_index, table->chains[table->max_chains].name, table->max_chains);
         snprintf(table->chains[table->max_chains].policyname, 64, "%s", policyname);
         snprintf(table->chains[table->max_chains].counters, 64, "%s", counters);
         if (!strcmp(table->chains[table->max_chains].name, "INPUT") ||
@@ -679,6 +951,8 @@ int ipt_chain_add_rule_with_counters(ipt_handler * ipth, char *tablename, char *
 int ipt_chain_insert_rule(ipt_handler * ipth, char *tablename, char *chainname, char *newrule, char *counterstr, int order)
 {
     int ret = 0;
+    int slot = 0;
+    boolean linked = TRUE;
     ipt_table *table = NULL;
     ipt_chain *chain = NULL;
     ipt_rule *rule = NULL;
@@ -699,8 +973,18 @@ int ipt_chain_insert_rule(ipt_handler * ipth, char *tablename, char *chainname,
 
     rule = ipt_chain_find_rule(ipth, tablename, chainname, newrule);
     if (!rule) {
-        chain->rules = realloc(chain->rules, sizeof(ipt_rule) * (chain->max_rules + 1));
-        if (!chain->rules) {
+        if (chain->max_rules == chain->rule_capacity) {
+            chain->rule_capacity = IPT_GROW(chain->rule_capacity);
+            chain->rules = realloc(chain->rules, sizeof(ipt_rule) * chain->rule_capacity);
+            if (!chain->rules) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+        }
+        if (chain->rule_index == NULL) {
+            chain->rule_index = euca_index_alloc(chain->rule_capacity);
+        }
+        if (!chain->rule_index || (euca_index_reserve(&(chain->rule_index), chain->rule_capacity) != EUCA_OK)) {
             LOGFATAL("out of memory!\n");
             exit(1);
         }
@@ -708,18 +992,43 @@ int ipt_chain_insert_rule(ipt_handler * ipth, char *tablename, char *chainname,
         bzero(rule, sizeof(ipt_rule));
         snprintf(rule->iptrule, 1024, "%s", newrule);
         snprintf(rule->counterstr, 256, "[0:0]");
+        rule->prev = rule->next = -1;
+        euca_index_insert(chain->rule_index, rule->iptrule, chain->max_rules);
         chain->max_rules++;
+        linked = FALSE;
     }
     if (counterstr && strlen(counterstr)) {
         snprintf(rule->counterstr, 256, "%s", counterstr);
     }
+
+    // Keep the rules linked in deploy order: ordered rules come in increasing order, ahead of
+    // the unordered ones that keep the order they were added in. A new order is always the
+    // highest so far, so a rule only ever moves right after the last ordered one or to the end.
+    slot = (rule - chain->rules);
     chain->ruleorder++;
     if (order == IPT_ORDER) {
         rule->order = chain->ruleorder;
+        if (!linked || (slot != chain->last_ordered)) {
+            if (linked) {
+                ipt_rule_unlink(chain, slot);
+            }
+            ipt_rule_link_after(chain, slot, chain->last_ordered);
+        }
+        chain->last_ordered = slot;
     } else if (order == IPT_NO_ORDER) {
         rule->order = INT_MAX;
+        if (linked) {
+            if (slot == chain->last_ordered) {
+                chain->last_ordered = rule->prev;
+            }
+            ipt_rule_unlink(chain, slot);
+        }
+        ipt_rule_link_after(chain, slot, chain->last_rule);
     } else {
         LOGERROR("BUG: invalid ordering mode passed to routine\n");
+        if (!linked) {
+            ipt_rule_link_after(chain, slot, chain->last_rule);
+        }
     }
 
     rule->flushed = 0;
@@ -777,6 +1086,84 @@ int ipt_handler_update_refcounts(ipt_handler * ipth)
     return (0);
 }
 
+//!
+//! Confirms that a chain slot found in a table's chain index holds the given name.
+//!
+//! @param[in] slot the slot in the table's chains
+//! @param[in] key the chain name looked up
+//! @param[in] ctx pointer to the table
+//!
+//! @return TRUE if the chain at slot has that name
+//!
+static boolean ipt_chain_match(int slot, const char *key, void *ctx)
+{
+    ipt_table *table = ((ipt_table *) ctx);
+    return ((slot < table->max_chains) && !strcmp(table->chains[slot].name, key));
+}
+
+//!
+//! Confirms that a rule slot found in a chain's rule index holds the given rule.
+//!
+//! @param[in] slot the slot in the chain's rules
+//! @param[in] key the rule looked up
+//! @param[in] ctx pointer to the chain
+//!
+//! @return TRUE if the rule at slot is that rule
+//!
+static boolean ipt_rule_match(int slot, const char *key, void *ctx)
+{
+    ipt_chain *chain = ((ipt_chain *) ctx);
+    return ((slot < chain->max_rules) && !strcmp(chain->rules[slot].iptrule, key));
+}
+
+//!
+//! Takes a rule out of its chain's deploy order.
+//!
+//! @param[in] chain pointer to the chain
+//! @param[in] slot the slot of the rule, which must be linked
+//!
+static void ipt_rule_unlink(ipt_chain * chain, int slot)
+{
+    ipt_rule *rule = &(chain->rules[slot]);
+
+    if (rule->prev >= 0) {
+        chain->rules[rule->prev].next = rule->next;
+    } else {
+        chain->first_rule = rule->next;
+    }
+    if (rule->next >= 0) {
+        chain->rules[rule->next].prev = rule->prev;
+    } else {
+        chain->last_rule = rule->prev;
+    }
+    rule->prev = rule->next = -1;
+}
+
+//!
+//! Puts an unlinked rule in its chain's deploy order right after another one.
+//!
+//! @param[in] chain pointer to the chain
+//! @param[in] slot the slot of the rule to link
+//! @param[in] after the slot of the rule it goes after or -1 to make it the first one
+//!
+static void ipt_rule_link_after(ipt_chain * chain, int slot, int after)
+{
+    ipt_rule *rule = &(chain->rules[slot]);
+
+    rule->prev = after;
+    rule->next = ((after >= 0) ? chain->rules[after].next : chain->first_rule);
+    if (rule->next >= 0) {
+        chain->rules[rule->next].prev = slot;
+    } else {
+        chain->last_rule = slot;
+    }
+    if (after >= 0) {
+        chain->rules[after].next = slot;
+    } else {
+        chain->first_rule = slot;
+    }
+}
+
 //!
 //! Function description.
 //!
@@ -831,7 +1218,7 @@ ipt_table *ipt_handler_find_table(ipt_handler * ipth, const char *findtable)
 //!
 ipt_chain *ipt_table_find_chain(ipt_handler * ipth, const char *tablename, const char *findchain)
 {
-    int i, found = 0, chainidx = 0;
+    int chainidx = 0;
     ipt_table *table = NULL;
 
     if (!ipth || !tablename || !findchain || !ipth->init) {
@@ -843,14 +1230,7 @@ ipt_chain *ipt_table_find_chain(ipt_handler * ipth, const char *tablename, const
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < table->max_chains && !found; i++) {
-        chainidx = i;
-        if (!strcmp(table->chains[i].name, findchain))
-            found++;
-    }
-
-    if (!found) {
+    if ((chainidx = euca_index_find(table->chain_index, findchain, ipt_chain_match, table, NULL)) < 0) {
         return (NULL);
     }
 
@@ -917,7 +1297,7 @@ int ipt_table_set_chain_policy(ipt_handler * pIpth, const char *tablename, const
 //!
 ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainname, char *findrule)
 {
-    int i, found = 0, ruleidx = 0;
+    int ruleidx = 0;
     ipt_chain *chain;
 
     if (!ipth || !tablename || !chainname || !findrule || !ipth->init) {
@@ -929,12 +1309,7 @@ ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainna
         return (NULL);
     }
 
-    for (i = 0; i < chain->max_rules && !found; i++) {
-        ruleidx = i;
-        if (!strcmp(chain->rules[i].iptrule, findrule))
-            found++;
-    }
-    if (!found) {
+    if ((ruleidx = euca_index_find(chain->rule_index, findrule, ipt_rule_match, chain, NULL)) < 0) {
         return (NULL);
     }
     return (&(chain->rules[ruleidx]));
@@ -1067,6 +1442,7 @@ int ipt_chain_flush(ipt_handler * ipth, char *tablename, char *chainname)
         chain->rules[i].order = 0;
     }
     chain->ruleorder = 0;
+    chain->last_ordered = -1;
 
     return (0);
 }
@@ -1090,8 +1466,8 @@ int ipt_chain_flush(ipt_handler * ipth, char *tablename, char *chainname)
 //! @note
 //!
 int ipt_chain_flush_rule(ipt_handler * ipth, char *tablename, char *chainname, char *findrule) {
-    int i, found = 0;
     ipt_chain *chain;
+    ipt_rule *rule;
 
     if (!ipth || !tablename || !chainname || !findrule || !ipth->init) {
         return (EUCA_INVALID_ERROR);
@@ -1102,16 +1478,12 @@ int ipt_chain_flush_rule(ipt_handler * ipth, char *tablename, char *chainname, c
         return (EUCA_INVALID_ERROR);
     }
 
-    for (i = 0; i < chain->max_rules && !found; i++) {
-        if (!strcmp(chain->rules[i].iptrule, findrule)) {
-            found++;
-            chain->rules[i].flushed = 1;
-            chain->rules[i].order = 0;
-        }
-    }
-    if (!found) {
+    rule = ipt_chain_find_rule(ipth, tablename, chainname, findrule);
+    if (!rule) {
         return (EUCA_NOT_FOUND_ERROR);
     }
+    rule->flushed = 1;
+    rule->order = 0;
     return (EUCA_OK);
 }
 
@@ -1146,8 +1518,10 @@ int ipt_handler_free(ipt_handler * ipth)
     for (i = 0; i < ipth->max_tables; i++) {
         for (j = 0; j < ipth->tables[i].max_chains; j++) {
             EUCA_FREE(ipth->tables[i].chains[j].rules);
+            EUCA_FREE(ipth->tables[i].chains[j].rule_index);
         }
         EUCA_FREE(ipth->tables[i].chains);
+        EUCA_FREE(ipth->tables[i].chain_index);
     }
     EUCA_FREE(ipth->tables);
     unlink(ipth->ipt_file);
@@ -1183,8 +1557,10 @@ int ipt_handler_close(ipt_handler *ipth)
     for (i = 0; i < ipth->max_tables; i++) {
         for (j = 0; j < ipth->tables[i].max_chains; j++) {
             EUCA_FREE(ipth->tables[i].chains[j].rules);
+            EUCA_FREE(ipth->tables[i].chains[j].rule_index);
         }
         EUCA_FREE(ipth->tables[i].chains);
+        EUCA_FREE(ipth->tables[i].chain_index);
     }
     EUCA_FREE(ipth->tables);
     unlink(ipth->ipt_file);
@@ -1233,3 +1609,377 @@ int ipt_handler_print(ipt_handler * ipth)
     return (0);
 }
 
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+
+#define TEST_CHAINS                              500    //!< Security group chains in the benchmark table
+#define TEST_RULES                               100    //!< Rules per chain, 50k in all
+#define TEST_BIG_RULES                           100000 //!< Rules in the single chain of the build benchmark
+#define TEST_SYS_CHAINS                          8      //!< Chains the stand-in iptables-restore can hold
+#define TEST_SYS_RULES                           16     //!< Rules per chain the stand-in iptables-restore can hold
+
+//! A chain of the filter table as the stand-in iptables-restore keeps it
+typedef struct test_sys_chain_t {
+    char name[64];                     //!< the chain name, empty if the slot is free
+    int nrules;                        //!< the number of rules in the chain
+    char rules[TEST_SYS_RULES][256];   //!< the rules, without their counters
+} test_sys_chain;
+
+static test_sys_chain testSys[TEST_SYS_CHAINS] = { {{0}} }; //!< the filter table of the stand-in iptables-restore
+
+//!
+//! (Re)builds one security group chain and its jump from FORWARD the way eucanetd does on
+//! every cycle: flush, then add every rule back in order.
+//!
+static void test_fill_chain(ipt_handler * pIpt, int idx, int changed)
+{
+    int i = 0;
+    char chainname[64] = "";
+    char rule[1024] = "";
+
+    snprintf(chainname, sizeof(chainname), "EU_%04d", idx);
+    ipt_table_add_chain(pIpt, IPT_TABLE_FILTER, chainname, IPT_CHAIN_USER_POLICY, "[0:0]");
+    ipt_chain_flush(pIpt, IPT_TABLE_FILTER, chainname);
+    for (i = 0; i < TEST_RULES; i++) {
+        snprintf(rule, sizeof(rule), "-A %s -s 10.%d.%d.0/24 -p tcp -m tcp --dport %d -j ACCEPT", chainname, (i / 256), (i % 256), (((i == 0) && changed) ? 8443 : 1000 + i));
+        ipt_chain_add_rule(pIpt, IPT_TABLE_FILTER, chainname, rule);
+    }
+    snprintf(rule, sizeof(rule), "-A FORWARD -d 172.%d.%d.0/24 -j %s", (idx / 256), (idx % 256), chainname);
+    ipt_chain_add_rule(pIpt, IPT_TABLE_FILTER, IPT_CHAIN_FORWARD, rule);
+}
+
+//!
+//! Rebuilds the whole benchmark table, optionally changing one rule of one chain and leaving
+//! one chain out.
+//!
+static void test_fill(ipt_handler * pIpt, int changedIdx, int droppedIdx)
+{
+    int i = 0;
+    char chainname[64] = "";
+
+    ipt_table_add_chain(pIpt, IPT_TABLE_FILTER, IPT_CHAIN_INPUT, IPT_CHAIN_POLICY_ACCEPT, "[0:0]");
+    ipt_table_add_chain(pIpt, IPT_TABLE_FILTER, IPT_CHAIN_FORWARD, IPT_CHAIN_POLICY_ACCEPT, "[0:0]");
+    ipt_table_add_chain(pIpt, IPT_TABLE_FILTER, IPT_CHAIN_OUTPUT, IPT_CHAIN_POLICY_ACCEPT, "[0:0]");
+    ipt_chain_flush(pIpt, IPT_TABLE_FILTER, IPT_CHAIN_FORWARD);
+    for (i = 0; i < TEST_CHAINS; i++) {
+        if (i != droppedIdx) {
+            test_fill_chain(pIpt, i, (i == changedIdx));
+        }
+    }
+    if (droppedIdx >= 0) {
+        snprintf(chainname, sizeof(chainname), "EU_%04d", droppedIdx);
+        ipt_table_deletechainmatch(pIpt, IPT_TABLE_FILTER, chainname);
+    }
+}
+
+//!
+//! Counts the lines written to the handler file and checks for one of them.
+//!
+static int test_lines(ipt_handler * pIpt, const char *find, int *found)
+{
+    int lines = 0;
+    char buf[1024] = "";
+    FILE *pFh = NULL;
+
+    *found = 0;
+    assert((pFh = fopen(pIpt->ipt_file, "r")) != NULL);
+    while (fgets(buf, sizeof(buf), pFh)) {
+        if (!strncmp(buf, find, strlen(find)))
+            (*found)++;
+        lines++;
+    }
+    fclose(pFh);
+    return (lines);
+}
+
+//!
+//! Times iptables-restore --test on the handler file, when the tool is usable here.
+//!
+static void test_restore(ipt_handler * pIpt, int noflush)
+{
+    int rc = 0;
+    struct timeval tv = { 0 };
+
+    eucanetd_timer_usec(&tv);
+    if (noflush) {
+        rc = euca_execlp_redirect(NULL, pIpt->ipt_file, "/dev/null", FALSE, "/dev/null", FALSE, pIpt->cmdprefix, "iptables-restore", "--test", "--noflush", "-c", NULL);
+    } else {
+        rc = euca_execlp_redirect(NULL, pIpt->ipt_file, "/dev/null", FALSE, "/dev/null", FALSE, pIpt->cmdprefix, "iptables-restore", "--test", "-c", NULL);
+    }
+    if (rc != EUCA_OK) {
+        printf(", iptables-restore --test unavailable\n");
+    } else {
+        printf(", iptables-restore --test %.2f ms\n", eucanetd_timer_usec(&tv) / 1000.0);
+    }
+}
+
+//!
+//! Finds a chain of the stand-in filter table, adding it when asked to.
+//!
+static test_sys_chain *test_sys_chain_find(const char *name, int add)
+{
+    int i = 0;
+
+    for (i = 0; i < TEST_SYS_CHAINS; i++) {
+        if (!strcmp(testSys[i].name, name))
+            return (&(testSys[i]));
+    }
+    for (i = 0; add && (i < TEST_SYS_CHAINS); i++) {
+        if (testSys[i].name[0] == '\0') {
+            euca_strncpy(testSys[i].name, name, sizeof(testSys[i].name));
+            testSys[i].nrules = 0;
+            return (&(testSys[i]));
+        }
+    }
+    assert(!add);
+    return (NULL);
+}
+
+//!
+//! Applies the handler file to the stand-in filter table the way iptables-restore does,
+//! keeping what the file does not touch under --noflush. Declaring a user defined chain
+//! flushes it, declaring a built-in one only sets its policy.
+//!
+static void test_sys_restore(ipt_handler * pIpt, int noflush)
+{
+    char buf[1024] = "";
+    char name[64] = "";
+    char policy[64] = "";
+    char *rule = NULL;
+    FILE *pFh = NULL;
+    test_sys_chain *chain = NULL;
+
+    if (!noflush)
+        bzero(testSys, sizeof(testSys));
+
+    assert((pFh = fopen(pIpt->ipt_file, "r")) != NULL);
+    while (fgets(buf, sizeof(buf), pFh)) {
+        buf[strcspn(buf, "\n")] = '\0';
+        rule = ((buf[0] == '[') ? (strchr(buf, ' ') + 1) : buf);
+        if (buf[0] == ':') {
+            assert(sscanf(buf + 1, "%63s %63s", name, policy) == 2);
+            chain = test_sys_chain_find(name, TRUE);
+            if (!strcmp(policy, IPT_CHAIN_USER_POLICY))
+                chain->nrules = 0;
+        } else if (sscanf(buf, "-F %63s", name) == 1) {
+            assert((chain = test_sys_chain_find(name, FALSE)) != NULL);
+            chain->nrules = 0;
+        } else if (sscanf(buf, "-X %63s", name) == 1) {
+            assert((chain = test_sys_chain_find(name, FALSE)) != NULL);
+            chain->name[0] = '\0';
+        } else if (sscanf(rule, "-A %63s", name) == 1) {
+            assert(((chain = test_sys_chain_find(name, FALSE)) != NULL) && (chain->nrules < TEST_SYS_RULES));
+            euca_strncpy(chain->rules[chain->nrules++], rule, sizeof(chain->rules[0]));
+        }
+    }
+    fclose(pFh);
+}
+
+//!
+//! Counts the copies of a rule in a chain of the stand-in filter table.
+//!
+static int test_sys_count(const char *chainname, const char *rule)
+{
+    int i = 0;
+    int found = 0;
+    test_sys_chain *chain = test_sys_chain_find(chainname, FALSE);
+
+    for (i = 0; chain && (i < chain->nrules); i++) {
+        if (!strcmp(chain->rules[i], rule))
+            found++;
+    }
+    return (found);
+}
+
+//!
+//! Builds a small filter table with a built-in and a user defined chain, deploys it in full
+//! to the stand-in iptables-restore, then changes both chains and applies the same
+//! incremental file twice. Each rule must end up in its chain exactly once.
+//!
+static void test_noflush(void)
+{
+    int i = 0;
+    int fd = 0;
+    int pass = 0;
+    const char *rules[] = {
+        "-A FORWARD -d 172.16.0.0/24 -j EU_SYS",
+        "-A FORWARD -d 172.16.1.0/24 -j EU_SYS",
+        "-A EU_SYS -p tcp -m tcp --dport 22 -j ACCEPT",
+        "-A EU_SYS -p tcp -m tcp --dport 443 -j ACCEPT",
+    };
+    ipt_handler ipt = { 0 };
+
+    snprintf(ipt.ipt_file, EUCA_MAX_PATH, "/tmp/ipt_file-XXXXXX");
+    assert((fd = safe_mkstemp(ipt.ipt_file)) >= 0);
+    close(fd);
+    ipt.init = 1;
+    ipt_handler_add_table(&ipt, IPT_TABLE_FILTER);
+
+    for (pass = 0; pass < 2; pass++) {
+        ipt_table_add_chain(&ipt, IPT_TABLE_FILTER, IPT_CHAIN_FORWARD, IPT_CHAIN_POLICY_ACCEPT, "[0:0]");
+        ipt_table_add_chain(&ipt, IPT_TABLE_FILTER, "EU_SYS", IPT_CHAIN_USER_POLICY, "[0:0]");
+        ipt_chain_flush(&ipt, IPT_TABLE_FILTER, IPT_CHAIN_FORWARD);
+        ipt_chain_flush(&ipt, IPT_TABLE_FILTER, "EU_SYS");
+        // the first pass deploys the first rule of each chain, the second adds the other
+        for (i = 0; i < 4; i++) {
+            if (pass || !(i % 2))
+                ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, ((i < 2) ? IPT_CHAIN_FORWARD : "EU_SYS"), (char *)rules[i]);
+        }
+        ipt_handler_update_refcounts(&ipt);
+        assert(ipt_handler_hash_chains(&ipt) == 2);
+        assert(ipt_handler_write(&ipt, pass) == 0);
+        test_sys_restore(&ipt, pass);
+        if (pass)
+            test_sys_restore(&ipt, pass);
+        ipt_handler_mark_applied(&ipt);
+    }
+
+    for (i = 0; i < 4; i++) {
+        assert(test_sys_count(((i < 2) ? IPT_CHAIN_FORWARD : "EU_SYS"), rules[i]) == 1);
+    }
+    assert(test_sys_chain_find(IPT_CHAIN_FORWARD, FALSE)->nrules == 2);
+    assert(test_sys_chain_find("EU_SYS", FALSE)->nrules == 2);
+    ipt_handler_close(&ipt);
+}
+
+//!
+//! Lists the non-flushed rules of a chain in deploy order, as their first letters.
+//!
+static char *test_order(ipt_handler * pIpt, const char *chainname, char *out)
+{
+    int i = 0;
+    int n = 0;
+    ipt_chain *chain = ipt_table_find_chain(pIpt, IPT_TABLE_FILTER, chainname);
+
+    for (i = chain->first_rule; i >= 0; i = chain->rules[i].next) {
+        if (!chain->rules[i].flushed)
+            out[n++] = chain->rules[i].iptrule[0];
+    }
+    out[n] = '\0';
+    return (out);
+}
+
+//!
+//! Builds a chain of TEST_BIG_RULES rules, then flushes it and adds them all back the way the
+//! next eucanetd cycle would.
+//!
+static void test_build(ipt_handler * pIpt)
+{
+    int i = 0;
+    int pass = 0;
+    char rule[1024] = "";
+    struct timeval tv = { 0 };
+
+    ipt_table_add_chain(pIpt, IPT_TABLE_FILTER, "EU_BIG", IPT_CHAIN_USER_POLICY, "[0:0]");
+    for (pass = 0; pass < 2; pass++) {
+        eucanetd_timer_usec(&tv);
+        ipt_chain_flush(pIpt, IPT_TABLE_FILTER, "EU_BIG");
+        for (i = 0; i < TEST_BIG_RULES; i++) {
+            snprintf(rule, sizeof(rule), "-A EU_BIG -s 10.%d.%d.%d/32 -p udp -m udp --dport 53 -j ACCEPT", (i >> 16), ((i >> 8) & 0xff), (i & 0xff));
+            ipt_chain_add_rule(pIpt, IPT_TABLE_FILTER, "EU_BIG", rule);
+        }
+        printf("%s a %d-rule chain: %.2f ms\n", (pass ? "rebuilt" : "built"), TEST_BIG_RULES, eucanetd_timer_usec(&tv) / 1000.0);
+    }
+    assert(ipt_table_find_chain(pIpt, IPT_TABLE_FILTER, "EU_BIG")->max_rules == TEST_BIG_RULES);
+    assert(ipt_chain_find_rule(pIpt, IPT_TABLE_FILTER, "EU_BIG", rule) == &(ipt_table_find_chain(pIpt, IPT_TABLE_FILTER, "EU_BIG")->rules[TEST_BIG_RULES - 1]));
+}
+
+int main(int argc, char **argv)
+{
+    int fd = 0;
+    int found = 0;
+    int fullLines = 0;
+    int incrLines = 0;
+    long fullUsec = 0;
+    long incrUsec = 0;
+    char order[16] = "";
+    struct timeval tv = { 0 };
+    ipt_handler ipt = { 0 };
+
+    log_file_set(NULL, NULL);
+    snprintf(ipt.ipt_file, EUCA_MAX_PATH, "/tmp/ipt_file-XXXXXX");
+    assert((fd = safe_mkstemp(ipt.ipt_file)) >= 0);
+    close(fd);
+    ipt.init = 1;
+    ipt_handler_add_table(&ipt, IPT_TABLE_FILTER);
+
+    // what a deploy of the full table leaves as the system state
+    test_fill(&ipt, -1, -1);
+    ipt_handler_update_refcounts(&ipt);
+    assert(ipt_handler_hash_chains(&ipt) == (TEST_CHAINS + 3));
+    ipt_handler_mark_applied(&ipt);
+
+    // the same rules built again on the next cycle leave nothing to deploy
+    test_fill(&ipt, -1, -1);
+    ipt_handler_update_refcounts(&ipt);
+    assert(ipt_handler_hash_chains(&ipt) == 0);
+
+    // one changed rule only rewrites its chain
+    test_fill(&ipt, 42, -1);
+    ipt_handler_update_refcounts(&ipt);
+    assert(ipt_handler_hash_chains(&ipt) == 1);
+
+    eucanetd_timer_usec(&tv);
+    assert(ipt_handler_write(&ipt, FALSE) == 0);
+    fullUsec = eucanetd_timer_usec(&tv);
+    fullLines = test_lines(&ipt, ":EU_", &found);
+    assert(found == TEST_CHAINS);
+    printf("one rule changed in a %d-rule table:\n", (TEST_CHAINS * (TEST_RULES + 1)));
+    printf("\tfull restore:        %6d lines written in %.2f ms", fullLines, fullUsec / 1000.0);
+    test_restore(&ipt, FALSE);
+
+    eucanetd_timer_usec(&tv);
+    assert(ipt_handler_write(&ipt, TRUE) == 0);
+    incrUsec = eucanetd_timer_usec(&tv);
+    incrLines = test_lines(&ipt, ":EU_0042 ", &found);
+    assert((found == 1) && (incrLines == (TEST_RULES + 3)));
+    printf("\tincremental restore: %6d lines written in %.2f ms", incrLines, incrUsec / 1000.0);
+    test_restore(&ipt, TRUE);
+    ipt_handler_mark_applied(&ipt);
+
+    // a chain that goes away is flushed and deleted after what jumped to it is rewritten
+    test_fill(&ipt, -1, 7);
+    ipt_handler_update_refcounts(&ipt);
+    assert(ipt_handler_hash_chains(&ipt) == 3);
+    assert(ipt_handler_write(&ipt, TRUE) == 0);
+    test_lines(&ipt, ":FORWARD ", &found);
+    assert(found == 1);
+    test_lines(&ipt, ":EU_0007 ", &found);
+    assert(found == 1);
+    test_lines(&ipt, "-X EU_0007", &found);
+    assert(found == 1);
+    test_lines(&ipt, "[0:0] -A EU_0007", &found);
+    assert(found == 0);
+
+    // deploy order: ordered rules first, in the order they were added, then unordered ones
+    ipt_table_add_chain(&ipt, IPT_TABLE_FILTER, "EU_ORDER", IPT_CHAIN_USER_POLICY, "[0:0]");
+    ipt_chain_insert_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "a", NULL, IPT_NO_ORDER);
+    ipt_chain_insert_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "b", NULL, IPT_NO_ORDER);
+    ipt_chain_insert_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "c", NULL, IPT_NO_ORDER);
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "x");
+    assert(!strcmp(test_order(&ipt, "EU_ORDER", order), "xabc"));
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "b");
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "y");
+    assert(!strcmp(test_order(&ipt, "EU_ORDER", order), "xbyac"));
+    ipt_chain_insert_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "y", NULL, IPT_NO_ORDER);
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "z");
+    assert(!strcmp(test_order(&ipt, "EU_ORDER", order), "xbzacy"));
+    assert(ipt_chain_flush_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "a") == EUCA_OK);
+    assert(ipt_chain_flush_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "q") == EUCA_NOT_FOUND_ERROR);
+    assert(!strcmp(test_order(&ipt, "EU_ORDER", order), "xbzcy"));
+    ipt_chain_flush(&ipt, IPT_TABLE_FILTER, "EU_ORDER");
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "c");
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "q");
+    ipt_chain_add_rule(&ipt, IPT_TABLE_FILTER, "EU_ORDER", "a");
+    assert(!strcmp(test_order(&ipt, "EU_ORDER", order), "cqa"));
+
+    test_build(&ipt);
+    test_noflush();
+
+    ipt_handler_close(&ipt);
+    printf("functional tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
@@ -80,6 +80,8 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <euca_index.h>
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -142,6 +144,8 @@ typedef struct ipt_rule_t {
     char counterstr[256];
     int flushed;
     int order;
+    int prev;                          //!< slot of the rule deployed before this one, -1 for the first
+    int next;                          //!< slot of the rule deployed after this one, -1 for the last
 } ipt_rule;
 
 typedef struct ipt_chain_t {
@@ -150,15 +154,25 @@ typedef struct ipt_chain_t {
     char counters[64];
     ipt_rule *rules;
     int max_rules;
+    int rule_capacity;                 //!< number of rules allocated, grown by doubling
+    int first_rule;                    //!< slot of the first rule in deploy order, -1 if none
+    int last_rule;                     //!< slot of the last rule in deploy order, -1 if none
+    int last_ordered;                  //!< slot after which the next ordered rule goes, -1 for the head
+    euca_index *rule_index;            //!< rule text -> slot in rules
     int ruleorder;
     int ref_count;
     int flushed;
+    int applied;                       //!< set when the chain is known to exist in the system
+    unsigned long long applied_hash;   //!< fingerprint of the chain content the system holds, valid when applied is set
+    unsigned long long hash;           //!< fingerprint of the chain content computed by the deploy in progress
 } ipt_chain;
 
 typedef struct ipt_table_t {
     char name[64];
     ipt_chain *chains;
     int max_chains;
+    int chain_capacity;                //!< number of chains allocated, grown by doubling
+    euca_index *chain_index;           //!< chain name -> slot in chains
 } ipt_table;
 
 typedef struct ipt_handler_t {
@@ -168,6 +182,7 @@ typedef struct ipt_handler_t {
     char ipt_file[EUCA_MAX_PATH];
     char cmdprefix[EUCA_MAX_PATH];
     char preloadPath[EUCA_MAX_PATH];
+    int baseline;                      //!< set when the chains' applied state reflects the system (last repopulate or deploy)
 } ipt_handler;
 
 /*----------------------------------------------------------------------------*\
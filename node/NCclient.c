@@ -76,6 +76,11 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
 
 #include <data.h>
 
@@ -179,6 +184,7 @@ static int ncClientMigrateInstance(ncStub * pStub, ncMetadata * pMeta, char *psI
 static int ncClientStartInstance(ncStub * pStub, ncMetadata * pMeta, char *psInstanceId);
 static int ncClientStopInstance(ncStub * pStub, ncMetadata * pMeta, char *psInstanceId);
 static int ncClientConvertTimeStamp(ncStub * pStub, char *psTimeStamp);
+static int ncClientBenchmarkStubs(ncMetadata * pMeta, char *psNcURL, boolean useWSSEC, char *psPolicyFile, int nbCalls);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -226,6 +232,7 @@ static void usage(void)
             "\t\tmigrateInstances\t\t[-i -M]\n"
             "\t\tstartInstance\t\t[-i]\n"
             "\t\tstopInstance\t\t[-i]\n"
+            "\t\tbenchmarkStubs\t\t[-c]\n"
             "\toptions:\n"
             "\t\t-d \t\t- print debug output\n"
             "\t\t-l \t\t- local invocation => do not use WSSEC\n"
@@ -246,7 +253,7 @@ static void usage(void)
             "\t\t-k [id:path] \t- id and manifest path of kernel image\n"
             "\t\t-r [id:path] \t- id and manifest path of ramdisk image\n"
             "\t\t-a [address] \t- MAC address for instance to use\n"
-            "\t\t-c [number] \t- number of instances to start\n"
+            "\t\t-c [number] \t- number of instances to start (number of calls for benchmarkStubs)\n"
             "\t\t-V [name] \t- name of the volume (for reference)\n"
             "\t\t-R [device] \t- remote/source device (e.g. /dev/etherd/e0.0)\n"
             "\t\t-L [device] \t- local/target device (e.g. hda)\n"
@@ -1096,6 +1103,140 @@ static int ncClientConvertTimeStamp(ncStub * pStub, char *psTimeStamp)
     return (EUCA_OK);
 }
 
+//!
+//! Measures NC calls per second through the ways the CC can issue them: a forked
+//! child building its own stub for every call (the original ncClientCall() path),
+//! a forked child inheriting a stub that was built once by the parent (the warm
+//! stub cache, still used for the calls that are not polls), and one persistent
+//! worker that makes every call with the same stub and is driven over pipes (how
+//! the CC fan-outs poll the nodes). Each call is a DescribeResource request.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] psNcURL the NC endpoint URL
+//! @param[in] useWSSEC set to TRUE if WS-Security should be initialized on the stubs
+//! @param[in] psPolicyFile the WS-Security policy file
+//! @param[in] nbCalls the number of calls to make in each mode
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if any of the calls failed
+//!
+static int ncClientBenchmarkStubs(ncMetadata * pMeta, char *psNcURL, boolean useWSSEC, char *psPolicyFile, int nbCalls)
+{
+    int i = 0;
+    int mode = 0;
+    int status = 0;
+    int failed = 0;
+    int rc = 0;
+    int reqPipe[2] = { -1, -1 };
+    int rspPipe[2] = { -1, -1 };
+    char req = 'x';
+    pid_t pid = 0;
+    double elapsed = 0.0;
+    double rate[3] = { 0.0 };
+    struct timeval start = { 0 };
+    struct timeval end = { 0 };
+    ncStub *pWarmStub = NULL;
+    ncStub *pStub = NULL;
+    ncResource *pOutRes = NULL;
+    char *psType = "TYPE";
+    const char *modes[3] = { "fork + new stub", "fork + warm stub", "persistent worker" };
+
+    if (nbCalls < 1)
+        nbCalls = 1;
+
+    for (mode = 0; mode < 3; mode++) {
+        if (mode == 1) {
+            if ((pWarmStub = ncStubCreate(psNcURL, NULL, NULL)) == NULL) {
+                fprintf(stderr, "ERROR: failed to create stub for %s\n", psNcURL);
+                return (EUCA_ERROR);
+            }
+            if (useWSSEC && (InitWSSEC(pWarmStub->env, pWarmStub->stub, psPolicyFile) != 0)) {
+                fprintf(stderr, "ERROR: cannot initialize WS-SEC policy from %s\n", psPolicyFile);
+                ncStubDestroy(pWarmStub);
+                return (EUCA_ERROR);
+            }
+        }
+
+        if (mode == 2) {
+            // the worker reuses the warm stub, and with it the connection, for all of its calls
+            if ((pipe(reqPipe) != 0) || (pipe(rspPipe) != 0)) {
+                fprintf(stderr, "ERROR: failed to create pipes: %s\n", strerror(errno));
+                ncStubDestroy(pWarmStub);
+                return (EUCA_ERROR);
+            }
+            if ((pid = fork()) == 0) {
+                close(reqPipe[1]);
+                close(rspPipe[0]);
+                while (read(reqPipe[0], &req, 1) == 1) {
+                    rc = ncDescribeResourceStub(pWarmStub, pMeta, psType, &pOutRes);
+                    if (write(rspPipe[1], &rc, sizeof(int)) != sizeof(int))
+                        break;
+                }
+                _exit(0);
+            } else if (pid < 0) {
+                fprintf(stderr, "ERROR: failed to fork: %s\n", strerror(errno));
+                ncStubDestroy(pWarmStub);
+                return (EUCA_ERROR);
+            }
+            close(reqPipe[0]);
+            close(rspPipe[1]);
+            signal(SIGPIPE, SIG_IGN);  // a worker that died shows up as failed calls
+
+            gettimeofday(&start, NULL);
+            for (i = 0; i < nbCalls; i++) {
+                if ((write(reqPipe[1], &req, 1) != 1) || (read(rspPipe[0], &rc, sizeof(int)) != sizeof(int)) || (rc != EUCA_OK)) {
+                    failed++;
+                }
+            }
+            gettimeofday(&end, NULL);
+
+            close(reqPipe[1]);
+            close(rspPipe[0]);
+            waitpid(pid, &status, 0);
+
+            elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+            rate[mode] = (elapsed > 0.0) ? (nbCalls / elapsed) : 0.0;
+            printf("%-18s: %d calls in %.3f sec, %.1f calls/sec\n", modes[mode], nbCalls, elapsed, rate[mode]);
+            continue;
+        }
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < nbCalls; i++) {
+            if ((pid = fork()) == 0) {
+                if ((pStub = pWarmStub) == NULL) {
+                    if ((pStub = ncStubCreate(psNcURL, NULL, NULL)) == NULL)
+                        _exit(1);
+                    if (useWSSEC && (InitWSSEC(pStub->env, pStub->stub, psPolicyFile) != 0))
+                        _exit(1);
+                }
+                _exit((ncDescribeResourceStub(pStub, pMeta, psType, &pOutRes) == EUCA_OK) ? 0 : 1);
+            } else if (pid < 0) {
+                fprintf(stderr, "ERROR: failed to fork: %s\n", strerror(errno));
+                failed++;
+                continue;
+            }
+
+            if ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+                failed++;
+            }
+        }
+        gettimeofday(&end, NULL);
+
+        elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+        rate[mode] = (elapsed > 0.0) ? (nbCalls / elapsed) : 0.0;
+        printf("%-18s: %d calls in %.3f sec, %.1f calls/sec\n", modes[mode], nbCalls, elapsed, rate[mode]);
+    }
+
+    if (rate[0] > 0.0) {
+        printf("warm stub speedup : %.2fx\n", (rate[1] / rate[0]));
+        printf("worker speedup    : %.2fx\n", (rate[2] / rate[0]));
+    }
+    if (failed)
+        printf("failed calls      : %d\n", failed);
+
+    ncStubDestroy(pWarmStub);
+    return ((failed == 0) ? EUCA_OK : EUCA_ERROR);
+}
+
 //!
 //! Main entry point of the application
 //!
@@ -1453,6 +1594,8 @@ int main(int argc, char *argv[])
     } else if (!strcmp(psCommand, "stopInstance")) {
         CHECK_PARAM(psInstanceId, "instance ID");
         ncClientStopInstance(pStub, &meta, psInstanceId);
+    } else if (!strcmp(psCommand, "benchmarkStubs")) {
+        ncClientBenchmarkStubs(&meta, sNcURL, (useWSSEC && !local), sPolicyFile, nbInstances);
     } else if (!strcmp(psCommand, "_convertTimestamp")) {
         CHECK_PARAM(psTimeStamp, "timestamp");
         ncClientConvertTimeStamp(pStub, psTimeStamp);
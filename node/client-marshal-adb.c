@@ -661,6 +661,107 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return (status);
 }
 
+//!
+//! Handles the client incremental describe instance request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the previous call, 0 for all instances
+//! @param[out] outInsts a pointer the list of instances that changed
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//! @param[out] outRemovedIds the identifiers of the instances gone since sinceGeneration
+//! @param[out] outRemovedIdsLen the number of identifiers in the outRemovedIds list
+//! @param[out] outGeneration the generation to pass on the next call (0 if the NC does not support it)
+//! @param[out] outDelta TRUE if only changes were returned, FALSE if all instances were
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***outRemovedIds,
+                                 int *outRemovedIdsLen, long long *outGeneration, boolean * outDelta)
+{
+    int i = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    adb_instanceType_t *instance = NULL;
+    adb_ncDescribeInstances_t *input = NULL;
+    adb_ncDescribeInstancesType_t *request = NULL;
+    adb_ncDescribeInstancesResponse_t *output = NULL;
+    adb_ncDescribeInstancesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    *outInsts = NULL;
+    *outInstsLen = 0;
+    *outRemovedIds = NULL;
+    *outRemovedIdsLen = 0;
+    *outGeneration = 0;
+    *outDelta = FALSE;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncDescribeInstances_create(env);
+    request = adb_ncDescribeInstancesType_create(env);
+
+    /* set input fields */
+    adb_ncDescribeInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = create_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncDescribeInstancesType, request, pMeta);
+    }
+    if (correlation_id != NULL)
+        adb_ncDescribeInstancesType_set_correlationId(request, env, correlation_id);
+
+    adb_ncDescribeInstancesType_set_sinceGeneration(request, env, sinceGeneration);
+    adb_ncDescribeInstances_set_ncDescribeInstances(input, env, request);
+
+    if ((output = axis2_stub_op_EucalyptusNC_ncDescribeInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncDescribeInstancesResponse_get_ncDescribeInstancesResponse(output, env);
+        if (adb_ncDescribeInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+
+        if ((*outInstsLen = adb_ncDescribeInstancesResponseType_sizeof_instances(response, env)) != 0) {
+            if ((*outInsts = EUCA_ZALLOC(*outInstsLen, sizeof(ncInstance *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outInstsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outInstsLen; i++) {
+                    instance = adb_ncDescribeInstancesResponseType_get_instances_at(response, env, i);
+                    (*outInsts)[i] = copy_instance_from_adb(instance, env);
+                }
+            }
+        }
+
+        // NCs that predate incremental describes leave these out
+        if (!adb_ncDescribeInstancesResponseType_is_generation_nil(response, env)) {
+            *outGeneration = adb_ncDescribeInstancesResponseType_get_generation(response, env);
+        }
+        if (!adb_ncDescribeInstancesResponseType_is_delta_nil(response, env)) {
+            *outDelta = (adb_ncDescribeInstancesResponseType_get_delta(response, env) == AXIS2_TRUE);
+        }
+
+        if ((*outDelta) && ((*outRemovedIdsLen = adb_ncDescribeInstancesResponseType_sizeof_removedInstanceIds(response, env)) != 0)) {
+            if ((*outRemovedIds = EUCA_ZALLOC(*outRemovedIdsLen, sizeof(char *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outRemovedIdsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outRemovedIdsLen; i++) {
+                    (*outRemovedIds)[i] = strdup(adb_ncDescribeInstancesResponseType_get_removedInstanceIds_at(response, env, i));
+                }
+            }
+        }
+    }
+
+    return (status);
+}
+
 //!
 //! Handle the client describe resource request
 //!
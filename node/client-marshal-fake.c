@@ -733,6 +733,32 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return (EUCA_OK);
 }
 
+//!
+//! Handles the client incremental describe instance request. The fake NC does not keep
+//! generations, so it always returns all of its instances.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration UNUSED
+//! @param[out] outInsts a pointer the list of instances for which we have data
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//! @param[out] outRemovedIds always set to NULL
+//! @param[out] outRemovedIdsLen always set to 0
+//! @param[out] outGeneration always set to 0
+//! @param[out] outDelta always set to FALSE
+//!
+//! @return the result of ncDescribeInstancesStub()
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***outRemovedIds,
+                                 int *outRemovedIdsLen, long long *outGeneration, boolean * outDelta)
+{
+    *outRemovedIds = NULL;
+    *outRemovedIdsLen = 0;
+    *outGeneration = 0;
+    *outDelta = FALSE;
+    return (ncDescribeInstancesStub(pStub, pMeta, NULL, 0, outInsts, outInstsLen));
+}
+
 //!
 //! Handles the client bundle instance request.
 //!
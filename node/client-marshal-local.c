@@ -301,6 +301,29 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return doDescribeInstances(pMeta, instIds, instIdsLen, outInsts, outInstsLen);
 }
 
+//!
+//! Handles the client incremental describe instance request.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the previous call, 0 for all instances
+//! @param[out] outInsts a pointer the list of instances that changed
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//! @param[out] outRemovedIds the identifiers of the instances gone since sinceGeneration
+//! @param[out] outRemovedIdsLen the number of identifiers in the outRemovedIds list
+//! @param[out] outGeneration the generation to pass on the next call
+//! @param[out] outDelta TRUE if only changes were returned, FALSE if all instances were
+//!
+//! @return the result of doDescribeInstancesDelta()
+//!
+//! @see doDescribeInstancesDelta()
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***outRemovedIds,
+                                 int *outRemovedIdsLen, long long *outGeneration, boolean * outDelta)
+{
+    return doDescribeInstancesDelta(pMeta, sinceGeneration, outInsts, outInstsLen, outRemovedIds, outRemovedIdsLen, outGeneration, outDelta);
+}
+
 //!
 //! Handles the client bundle instance request.
 //!
@@ -131,6 +131,8 @@
 #include "message_sensor.h"
 #include "message_stats.h"
 #include "service_sensor.h"
+#include "lock_sensor.h"
+#include <nc_push.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -150,6 +152,8 @@
 #define FS_BUFFER_PERCENT                            0.03   //!< leave 3% extra when deciding on blobstore sizes automatically
 #define WORK_BS_PERCENT                              0.33   //!< give a third of available space to work, the rest to cache
 #define MAX_CONNECTION_ERRORS                        5
+#define PUSH_COALESCE_USEC                           100000 //!< changes made within this long of each other are pushed together
+#define DESCRIBE_TOMBSTONES                          256    //!< how many removed instances incremental describes can report
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -169,6 +173,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! An instance that disappeared, kept so that incremental describes can report it
+typedef struct describeTombstone_t {
+    char instanceId[CHAR_BUFFER_SIZE];
+    long long generation;              //!< describe generation at which it disappeared
+} describeTombstone;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -214,6 +224,9 @@ const int default_bundling_cleanup_threshold = 60 * 60 * 2; //!< after this many
 const int default_createImage_cleanup_threshold = 60 * 60 * 2;  //!< after this many seconds any CREATEIMAGE domains will be cleaned up
 const int default_teardown_state_duration = 60 * 3; //!< after this many seconds in TEARDOWN state (no resources), we'll forget about the instance
 const int default_migration_ready_threshold = 60 * 15;  //!< after this many seconds ready (and waiting) to migrate, migration will terminate and roll back
+const int default_cache_reclaim_high = 90;  //!< above this percentage of its limit, the cache is cleaned up in the background
+const int default_cache_reclaim_low = 80;   //!< down to this percentage of its limit
+const int default_ephemeral_pool = 4;  //!< kinds of blank partitions kept formatted in the cache ahead of launches
 
 struct nc_state_t nc_state = { 0 };    //!< Global NC state structure
 
@@ -222,6 +235,8 @@ configEntry configKeysRestartNC[] = {
     {"EUCALYPTUS", "/"},
     {"NC_PORT", "8775"},
     {"NC_SERVICE", "axis2/services/EucalyptusNC"},
+    {CONFIG_NC_PUSH_ENABLE, "N"},
+    {CONFIG_NC_PUSH_PORT, "8779"},
     {NULL, NULL},
 };
 
@@ -264,6 +279,15 @@ static struct handlers *available_handlers[] = {
 static json_object *stats_json = NULL; //!< The json object that holds all of the internal message counters
 static int stats_sensor_interval_sec;  //!< Keeps the current value for sensor interval. Set during init
 static int hypervisor_conn_errors = 0;
+static sem_t push_wakeup;              //!< posted whenever there may be something to push to the CC
+
+//! @{
+//! @name incremental describe state, protected by inst_copy_sem
+static long long describe_generation = 0;   //!< bumped whenever copy_instances() sees a described field change
+static long long describe_horizon = 0; //!< oldest generation a delta can still be computed from
+static describeTombstone describe_tombstones[DESCRIBE_TOMBSTONES];
+static int describe_tombstones_next = 0;
+//! @}
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -272,6 +296,12 @@ static int hypervisor_conn_errors = 0;
 \*----------------------------------------------------------------------------*/
 
 static void *libvirt_thread(void *ptr);
+static void push_kick(void);
+static int get_cc_host(char *ccHost, int len);
+static void instance_to_push_record(ncInstance * instance, nc_push_instance * rec);
+static u32 instance_describe_digest(ncInstance * instance);
+static void describe_tombstone_add(const char *instanceId, long long generation);
+static void *push_thread(void *arg);
 static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance);
 static void update_log_params(void);
 static void update_ebs_params(void);
@@ -284,6 +314,7 @@ static void printMsgServiceStateInfo(ncMetadata * pMeta);
 //! Helpers for internal stats handling in the NC
 static json_object **message_stats_getter();
 static void message_stats_setter();
+static json_object *lock_stats_getter();
 static int initialize_stats_system(int interval_sec);
 static void *nc_run_stats(void *ignored_arg);
 
@@ -360,6 +391,44 @@ static void message_stats_setter()
     return;
 }
 
+//! Gets the counters of the blobstore lock manager and of the image downloads into the cache for the lock stats sensor
+static json_object *lock_stats_getter()
+{
+    json_object *values = NULL;
+    json_object *lock_json = NULL;
+    json_object *download_json = NULL;
+    blobstore_lock_stats stats = { 0 };
+    art_download_stats dl_stats = { 0 };
+
+    blobstore_get_lock_stats(&stats);
+    lock_json = json_object_new_object();
+    json_object_object_add(lock_json, "acquired", json_object_new_int64(stats.acquired));
+    json_object_object_add(lock_json, "contended", json_object_new_int64(stats.contended));
+    json_object_object_add(lock_json, "process_contended", json_object_new_int64(stats.proc_contended));
+    json_object_object_add(lock_json, "wait_usec", json_object_new_int64(stats.wait_usec));
+    json_object_object_add(lock_json, "wait_max_usec", json_object_new_int64(stats.wait_max_usec));
+    json_object_object_add(lock_json, "timeouts", json_object_new_int64(stats.timeouts));
+    json_object_object_add(lock_json, "errors", json_object_new_int64(stats.errors));
+    json_object_object_add(lock_json, "paths", json_object_new_int64(stats.paths));
+
+    art_get_download_stats(&dl_stats);
+    download_json = json_object_new_object();
+    json_object_object_add(download_json, "started", json_object_new_int64(dl_stats.started));
+    json_object_object_add(download_json, "completed", json_object_new_int64(dl_stats.completed));
+    json_object_object_add(download_json, "failed", json_object_new_int64(dl_stats.failed));
+    json_object_object_add(download_json, "shared", json_object_new_int64(dl_stats.shared));
+    json_object_object_add(download_json, "handoffs", json_object_new_int64(dl_stats.handoffs));
+    json_object_object_add(download_json, "in_flight", json_object_new_int(dl_stats.in_flight));
+    json_object_object_add(download_json, "waiting", json_object_new_int(dl_stats.waiting));
+    json_object_object_add(download_json, "in_flight_bytes", json_object_new_int64(dl_stats.in_flight_bytes));
+    json_object_object_add(download_json, "in_flight_done_bytes", json_object_new_int64(dl_stats.in_flight_done_bytes));
+
+    values = json_object_new_object();
+    json_object_object_add(values, "blobstore", lock_json);
+    json_object_object_add(values, "downloads", download_json);
+    return values;
+}
+
 void nc_lock_stats()
 {
     sem_p(stats_sem);
@@ -418,6 +487,13 @@ static int initialize_stats_system(int interval_sec)
             goto cleanup;
         }
 
+        //Init the lock contention sensor with the counters of the blobstore locks
+        ret = initialize_lock_stats_sensor(euca_this_component_name, interval_sec, stats_ttl, lock_stats_getter);
+        if (ret != EUCA_OK) {
+            LOGERROR("Error initializing internal lock stats sensor: %d\n", ret);
+            goto cleanup;
+        }
+
         ret = init_stats(nc_state.home, euca_this_component_name, nc_lock_stats, nc_unlock_stats);
         if (ret != EUCA_OK) {
             LOGERROR("Could not initialize CC stats system: %d\n", ret);
@@ -1067,6 +1143,7 @@ void change_state(ncInstance * instance, instance_states state)
     if (old_state != state) {
         LOGDEBUG("[%s] state change for instance: %s -> %s (%s)\n",
                  instance->instanceId, instance_state_names[old_state], instance_state_names[instance->state], instance_state_names[instance->stateCode]);
+        push_kick();
     }
 }
 
@@ -1335,6 +1412,8 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
 //!
 void copy_instances(void)
 {
+    u32 digest = 0;
+    boolean changed = FALSE;
     ncInstance *instance = NULL;
     ncInstance *src_instance = NULL;
     ncInstance *dst_instance = NULL;
@@ -1343,11 +1422,19 @@ void copy_instances(void)
 
     sem_p(inst_copy_sem);
     {
-        // free the old linked list copy
+        // generations of a new NC process start past those of any previous one
+        if (describe_generation == 0)
+            describe_horizon = describe_generation = (((long long)time(NULL)) << 20);
+
+        // free the old linked list copy, remembering the instances that are gone
         for (head = global_instances_copy; head;) {
             container = head;
             instance = head->instance;
             head = head->next;
+            if (find_instance(&global_instances, instance->instanceId) == NULL) {
+                describe_tombstone_add(instance->instanceId, describe_generation + 1);
+                changed = TRUE;
+            }
             EUCA_FREE(instance);
             EUCA_FREE(container);
         }
@@ -1357,14 +1444,114 @@ void copy_instances(void)
         // make a fresh copy
         for (head = global_instances; head; head = head->next) {
             src_instance = head->instance;
+            digest = instance_describe_digest(src_instance);
+            if ((src_instance->describeGeneration == 0) || (src_instance->describeDigest != digest)) {
+                src_instance->describeGeneration = describe_generation + 1;
+                src_instance->describeDigest = digest;
+                changed = TRUE;
+            }
             dst_instance = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
             memcpy(dst_instance, src_instance, sizeof(ncInstance));
             add_instance(&global_instances_copy, dst_instance);
         }
+
+        if (changed)
+            describe_generation++;
     }
     sem_v(inst_copy_sem);
 }
 
+//!
+//! Digests the fields of an instance that ncDescribeInstances reports (see copy_instance_to_adb()),
+//! so that copy_instances() can tell which instances an incremental describe has to include.
+//!
+//! @param[in] instance the instance to digest
+//!
+//! @return the digest
+//!
+static u32 instance_describe_digest(ncInstance * instance)
+{
+#define DIGEST_STR(_s)                         digest = nc_push_digest(digest, (_s), strlen(_s) + 1)
+#define DIGEST_VAL(_v)                         digest = nc_push_digest(digest, &(_v), sizeof(_v))
+
+    int i = 0;
+    u32 digest = 0;
+    ncVolume *volume = NULL;
+
+    DIGEST_STR(instance->uuid);
+    DIGEST_STR(instance->reservationId);
+    DIGEST_STR(instance->instanceId);
+    DIGEST_STR(instance->imageId);
+    DIGEST_STR(instance->kernelId);
+    DIGEST_STR(instance->ramdiskId);
+    DIGEST_STR(instance->userId);
+    DIGEST_STR(instance->ownerId);
+    DIGEST_STR(instance->accountId);
+    DIGEST_STR(instance->keyName);
+    DIGEST_VAL(instance->params.mem);
+    DIGEST_VAL(instance->params.cores);
+    DIGEST_VAL(instance->params.disk);
+    DIGEST_STR(instance->params.name);
+    for (i = 0; ((i < instance->params.virtualBootRecordLen) && (i < EUCA_MAX_VBRS)); i++) {
+        DIGEST_VAL(instance->params.virtualBootRecord[i]);
+    }
+    DIGEST_VAL(instance->ncnet);
+    DIGEST_VAL(instance->secNetCfgs);
+    DIGEST_STR(instance->stateName);
+    DIGEST_STR(instance->guestStateName);
+    DIGEST_STR(instance->bundleTaskStateName);
+    DIGEST_VAL(instance->bundleTaskProgress);
+    DIGEST_STR(instance->createImageTaskStateName);
+    DIGEST_VAL(instance->launchTime);
+    DIGEST_VAL(instance->blkbytes);
+    DIGEST_VAL(instance->netbytes);
+    DIGEST_VAL(instance->migration_state);
+    DIGEST_STR(instance->migration_src);
+    DIGEST_STR(instance->migration_dst);
+    DIGEST_STR(instance->userData);
+    DIGEST_STR(instance->launchIndex);
+    DIGEST_STR(instance->platform);
+    for (i = 0; ((i < instance->groupNamesSize) && (i < EUCA_MAX_GROUPS)); i++) {
+        DIGEST_STR(instance->groupNames[i]);
+    }
+    for (i = 0; ((i < instance->groupIdsSize) && (i < EUCA_MAX_GROUPS)); i++) {
+        DIGEST_STR(instance->groupIds[i]);
+    }
+    for (i = 0; i < EUCA_MAX_VOLUMES; i++) {
+        volume = &(instance->volumes[i]);
+        if (strlen(volume->volumeId) == 0)
+            continue;
+        DIGEST_STR(volume->volumeId);
+        DIGEST_STR(volume->attachmentToken);
+        DIGEST_STR(volume->devName);
+        DIGEST_STR(volume->stateName);
+    }
+    DIGEST_VAL(instance->hasFloppy);
+    return (digest);
+
+#undef DIGEST_STR
+#undef DIGEST_VAL
+}
+
+//!
+//! Remembers that an instance disappeared. Must be called with inst_copy_sem held.
+//!
+//! @param[in] instanceId the instance that disappeared
+//! @param[in] generation the describe generation at which it disappeared
+//!
+static void describe_tombstone_add(const char *instanceId, long long generation)
+{
+    describeTombstone *tombstone = &(describe_tombstones[describe_tombstones_next]);
+
+    // the oldest tombstone is overwritten, callers that have not seen it have to describe everything
+    if (tombstone->generation > describe_horizon)
+        describe_horizon = tombstone->generation;
+
+    euca_strncpy(tombstone->instanceId, instanceId, CHAR_BUFFER_SIZE);
+    tombstone->generation = generation;
+    describe_tombstones_next = ((describe_tombstones_next + 1) % DESCRIBE_TOMBSTONES);
+}
+
 //!
 //! helper that is used during initialization and by monitornig thread
 //!
@@ -1698,6 +1885,7 @@ void *monitoring_thread(void *arg)
 
         copy_instances();              // copy global_instances to global_instances_copy
         sem_v(inst_sem);
+        push_kick();                   // refresh_instance_info() may have changed things, and resources follow the copy
 
         if (head) {
             // we got out because of modified list, no need to sleep now
@@ -1723,11 +1911,21 @@ void *monitoring_thread(void *arg)
                     //! @todo pick up other NC options dynamically?
                 }
             }
+
+            // clean up the image cache ahead of launches that would otherwise have to
+            if (nc_state.cache_reclaim_high > 0) {
+                reclaim_backing_cache(nc_state.cache_reclaim_high, nc_state.cache_reclaim_low);
+            }
         }
         // do this every 10th iteration (every 10*MONITORING_PERIOD seconds)
         if ((iteration % 10) == 0) {
             //! @todo 3.2 change 1 to 10
 
+            // format the ephemeral and swap partitions that launches keep asking for before the next launch does
+            if (nc_state.ephemeral_pool > 0) {
+                provision_backing_cache(nc_state.ephemeral_pool);
+            }
+
             // check file system state and blobstore state
             blobstore_meta work_meta, cache_meta;
             if (stat_backing_store(NULL, &work_meta, &cache_meta) == EUCA_OK) {
@@ -1743,6 +1941,10 @@ void *monitoring_thread(void *arg)
                 if (cache_fs_size_mb > 0 && cache_fs_avail_mb < ((cache_fs_size_mb * DISK_TOO_LOW_PERCENT) / 100)) {
                     log_eucafault("1003", "component", euca_this_component_name, "file", cache_meta.path, NULL);
                 }
+                if (cache_meta.dedup_blocks_stored > 0) {
+                    LOGDEBUG("image cache holds %lldMB of images in %lldMB of chunks (ratio %.2f)\n", (long long)(cache_meta.dedup_blocks_logical / 2048),
+                             (long long)(cache_meta.dedup_blocks_stored / 2048), cache_meta.dedup_ratio);
+                }
                 //! @todo add more faults (cache or work reserved exceeds available space on file system)
             }
         }
@@ -1754,6 +1956,171 @@ void *monitoring_thread(void *arg)
 #undef EUCANETD_SERVICE_NAME
 }
 
+//!
+//! Wakes up the push thread, if there is one. Safe to call with any lock held.
+//!
+static void push_kick(void)
+{
+    if (nc_state.push_enabled)
+        sem_post(&push_wakeup);
+}
+
+//!
+//! Finds the CC of this node in the service topology the CC sends us
+//!
+//! @param[out] ccHost buffer receiving the host name or address of the CC
+//! @param[in]  len size of the ccHost buffer
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if we do not know about a CC yet
+//!
+static int get_cc_host(char *ccHost, int len)
+{
+    int i = 0;
+    int port = 0;
+    char URL[512] = "";
+    char tmpbuf[512] = "";
+    char host[512] = "";
+
+    for (i = 0; i < nc_state.servicesLen; i++) {
+        if (!strcmp(nc_state.services[i].type, "cluster") && (nc_state.services[i].urisLen > 0)) {
+            euca_strncpy(URL, nc_state.services[i].uris[0], sizeof(URL));
+            if (strlen(URL) && !tokenize_uri(URL, tmpbuf, host, &port, tmpbuf) && strlen(host)) {
+                euca_strncpy(ccHost, host, len);
+                return (EUCA_OK);
+            }
+        }
+    }
+    return (EUCA_NOT_FOUND_ERROR);
+}
+
+//!
+//! Fills in the record through which the CC learns about changes of an instance
+//! without describing this node (see util/nc_push.c)
+//!
+//! @param[in]  instance the instance
+//! @param[out] rec the record to fill in
+//!
+static void instance_to_push_record(ncInstance * instance, nc_push_instance * rec)
+{
+    netConfig ncnet = { 0 };
+
+    bzero(rec, sizeof(nc_push_instance));
+    euca_strncpy(rec->instanceId, instance->instanceId, sizeof(rec->instanceId));
+    euca_strncpy(rec->stateName, instance->stateName, sizeof(rec->stateName));
+    euca_strncpy(rec->guestStateName, instance->guestStateName, sizeof(rec->guestStateName));
+    euca_strncpy(rec->bundleTaskStateName, instance->bundleTaskStateName, sizeof(rec->bundleTaskStateName));
+    euca_strncpy(rec->createImageTaskStateName, instance->createImageTaskStateName, sizeof(rec->createImageTaskStateName));
+    euca_strncpy(rec->publicIp, instance->ncnet.publicIp, sizeof(rec->publicIp));
+    euca_strncpy(rec->privateIp, instance->ncnet.privateIp, sizeof(rec->privateIp));
+    rec->bundleTaskProgress = (u32) (instance->bundleTaskProgress * 1000.0);
+
+    // the CC only gets the rest of what it keeps about the instance from ncDescribeInstances,
+    // so the digest lets it know when it has to call it
+    memcpy(&ncnet, &(instance->ncnet), sizeof(netConfig));
+    bzero(ncnet.publicIp, sizeof(ncnet.publicIp));
+    bzero(ncnet.privateIp, sizeof(ncnet.privateIp));
+    rec->digest = nc_push_digest(0, &ncnet, sizeof(netConfig));
+    rec->digest = nc_push_digest(rec->digest, instance->volumes, sizeof(instance->volumes));
+    rec->digest = nc_push_digest(rec->digest, instance->secNetCfgs, sizeof(instance->secNetCfgs));
+    rec->digest = nc_push_digest(rec->digest, instance->groupNames, sizeof(instance->groupNames));
+    rec->digest = nc_push_digest(rec->digest, &(instance->params), sizeof(virtualMachine));
+
+    // migrations are coordinated by the CC from what it describes
+    if (instance->migration_state != NOT_MIGRATING)
+        rec->flags |= NC_PUSH_PULL;
+}
+
+//!
+//! Pushes changes of our instances and resources to the CC, so it does not have
+//! to poll us for them. Woken up by push_kick() whenever an instance changes state
+//! and after every pass of the monitoring thread.
+//!
+//! @param[in] arg a transparent pointer to the global NC state structure
+//!
+//! @return Always return NULL
+//!
+static void *push_thread(void *arg)
+{
+    int i = 0;
+    int rc = 0;
+    int len = 0;
+    int max = 0;
+    char ccHost[HOSTNAME_SIZE] = "";
+    char keyPath[EUCA_MAX_PATH] = "";
+    unsigned char key[NC_PUSH_KEY_LEN] = { 0 };
+    struct timespec ts = { 0 };
+    struct nc_state_t *nc = ((struct nc_state_t *)arg);
+    bunchOfInstances *head = NULL;
+    nc_push_instance *insts = NULL;
+    nc_push_instance *tmp = NULL;
+    nc_push_resource res = { 0 };
+    nc_push_sender sender = { 0 };
+    ncResource *ncRes = NULL;
+
+    // the CC drops datagrams that are not authenticated with the key we share with it
+    snprintf(keyPath, sizeof(keyPath), NC_PUSH_KEY_FILE, nc->home);
+    if ((nc_push_key_load(keyPath, key) != EUCA_OK) || (nc_push_sender_init(&sender, NULL, key) != EUCA_OK)) {
+        LOGERROR("cannot push state changes, the CC will poll this node\n");
+        return (NULL);
+    }
+    bzero(key, sizeof(key));
+    LOGINFO("pushing state changes to the CC on port %d\n", nc->push_port);
+
+    while (TRUE) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += NC_PUSH_HEARTBEAT_SEC / 2;
+        if (sem_timedwait(&push_wakeup, &ts) == 0) {
+            // let changes made together go out together
+            usleep(PUSH_COALESCE_USEC);
+            while (sem_trywait(&push_wakeup) == 0) ;
+        }
+
+        if ((get_cc_host(ccHost, sizeof(ccHost)) != EUCA_OK) || (nc_push_sender_connect(&sender, ccHost, nc->push_port) != EUCA_OK))
+            continue;
+
+        sem_p(inst_sem);
+        if ((len = total_instances(&global_instances)) > max) {
+            if ((tmp = EUCA_REALLOC(insts, len, sizeof(nc_push_instance))) == NULL) {
+                sem_v(inst_sem);
+                LOGERROR("out of memory\n");
+                continue;
+            }
+            insts = tmp;
+            max = len;
+        }
+        for (i = 0, head = global_instances; head && (i < len); head = head->next, i++)
+            instance_to_push_record(head->instance, &(insts[i]));
+        sem_v(inst_sem);
+
+        // resources as ncDescribeResource would report them
+        ncRes = NULL;
+        if (nc->H->doDescribeResource)
+            rc = nc->H->doDescribeResource(nc, NULL, NULL, &ncRes);
+        else
+            rc = nc->D->doDescribeResource(nc, NULL, NULL, &ncRes);
+        if ((rc != EUCA_OK) || (ncRes == NULL))
+            continue;
+
+        bzero(&res, sizeof(res));
+        res.memMax = ncRes->memorySizeMax;
+        res.memAvail = ncRes->memorySizeAvailable;
+        res.diskMax = ncRes->diskSizeMax;
+        res.diskAvail = ncRes->diskSizeAvailable;
+        res.coresMax = ncRes->numberOfCoresMax;
+        res.coresAvail = ncRes->numberOfCoresAvailable;
+        euca_strncpy(res.nodeStatus, ncRes->nodeStatus, sizeof(res.nodeStatus));
+        free_resource(&ncRes);
+
+        if ((rc = nc_push_send_state(&sender, &res, insts, i, FALSE)) > 0) {
+            LOGTRACE("pushed %d datagram(s) to %s\n", rc, ccHost);
+        } else if (rc < 0) {
+            LOGDEBUG("failed to push state changes to %s\n", ccHost);
+        }
+    }
+
+    return (NULL);
+}
+
 //!
 //! Fills in some of the fields of instance struct
 //!
@@ -2435,10 +2802,26 @@ static int init(void)
     GET_VAR_INT(nc_state.createImage_cleanup_threshold, CONFIG_NC_CREATEIMAGE_CLEANUP_THRESHOLD, default_createImage_cleanup_threshold);
     GET_VAR_INT(nc_state.teardown_state_duration, CONFIG_NC_TEARDOWN_STATE_DURATION, default_teardown_state_duration);
     GET_VAR_INT(nc_state.migration_ready_threshold, CONFIG_NC_MIGRATION_READY_THRESHOLD, default_migration_ready_threshold);
+    GET_VAR_INT(nc_state.cache_reclaim_high, CONFIG_NC_CACHE_RECLAIM_HIGH, default_cache_reclaim_high);
+    GET_VAR_INT(nc_state.cache_reclaim_low, CONFIG_NC_CACHE_RECLAIM_LOW, default_cache_reclaim_low);
+    if ((nc_state.cache_reclaim_high < 0) || (nc_state.cache_reclaim_high > 100) || (nc_state.cache_reclaim_low < 0)
+        || (nc_state.cache_reclaim_low > nc_state.cache_reclaim_high)) {
+        LOGWARN("ignoring invalid %s=%d and %s=%d, using %d and %d\n", CONFIG_NC_CACHE_RECLAIM_HIGH, nc_state.cache_reclaim_high, CONFIG_NC_CACHE_RECLAIM_LOW,
+                nc_state.cache_reclaim_low, default_cache_reclaim_high, default_cache_reclaim_low);
+        nc_state.cache_reclaim_high = default_cache_reclaim_high;
+        nc_state.cache_reclaim_low = default_cache_reclaim_low;
+    }
+    GET_VAR_INT(nc_state.ephemeral_pool, CONFIG_NC_EPHEMERAL_POOL, default_ephemeral_pool);
     int max_attempts;
     GET_VAR_INT(max_attempts, CONFIG_WALRUS_DOWNLOAD_MAX_ATTEMPTS, -1);
     if (max_attempts > 0 && max_attempts < 99)
         objectstorage_set_max_download_attempts(max_attempts);
+    int parallel_parts, part_size_mb;
+    GET_VAR_INT(parallel_parts, CONFIG_WALRUS_DOWNLOAD_PARALLEL_PARTS, 0);
+    GET_VAR_INT(part_size_mb, CONFIG_WALRUS_DOWNLOAD_PART_SIZE, 0);
+    if (objectstorage_set_parallel_download(parallel_parts, part_size_mb) != EUCA_OK) {
+        LOGWARN("ignoring invalid %s=%d and %s=%d\n", CONFIG_WALRUS_DOWNLOAD_PARALLEL_PARTS, parallel_parts, CONFIG_WALRUS_DOWNLOAD_PART_SIZE, part_size_mb);
+    }
 
     // add three eucalyptus directories with executables to PATH of this process
     add_euca_to_path(nc_state.home);
@@ -2844,6 +3227,25 @@ static int init(void)
         snprintf(nc_state.ncDeleteBundleCmd, EUCA_MAX_PATH, "%s", EUCALYPTUS_NC_DELETE_BUNDLE); // default value
     }
 
+    {
+        // push instance and resource changes to the CC?
+        tmp = getConfString(nc_state.configFiles, 2, CONFIG_NC_PUSH_ENABLE);
+        nc_state.push_enabled = ((tmp && !strcmp(tmp, "Y")) ? TRUE : FALSE);
+        EUCA_FREE(tmp);
+        GET_VAR_INT(nc_state.push_port, CONFIG_NC_PUSH_PORT, NC_PUSH_DEFAULT_PORT);
+        if (nc_state.push_enabled && (sem_init(&push_wakeup, 0, 0) != 0)) {
+            LOGERROR("cannot initialize the push semaphore, the CC will poll this node\n");
+            nc_state.push_enabled = FALSE;
+        }
+    }
+
+    {
+        // store downloaded disk images in the cache as chunks shared between them?
+        tmp = getConfString(nc_state.configFiles, 2, CONFIG_NC_CACHE_DEDUP);
+        art_set_cache_dedup((tmp && !strcmp(tmp, "Y")) ? TRUE : FALSE);
+        EUCA_FREE(tmp);
+    }
+
     {
         // set enable ws-security
         tmp = getConfString(nc_state.configFiles, 2, CONFIG_ENABLE_WS_SECURITY);
@@ -2957,6 +3359,13 @@ static int init(void)
         }
     }
 
+    if (nc_state.push_enabled) {       // start the thread pushing state changes to the CC
+        pthread_t tcb;
+        if (pthread_create(&tcb, NULL, push_thread, &nc_state) || pthread_detach(tcb)) {
+            LOGERROR("failed to spawn the push thread, the CC will poll this node\n");
+        }
+    }
+
     {
 
         if (initialize_stats_system(DEFAULT_SENSOR_INTERVAL_SEC) != EUCA_OK) {
@@ -3202,6 +3611,93 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncIn
     return (EUCA_OK);
 }
 
+//!
+//! Handles the incremental describe instance request: like doDescribeInstances() for all the
+//! instances, but when the caller passes the generation returned by a previous call, only the
+//! instances that changed since then and the identifiers of the ones that disappeared are returned.
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by the caller's previous call, 0 for all instances
+//! @param[out] outInsts a pointer the list of instances that changed
+//! @param[out] outInstsLen the number of instances in the outInsts list
+//! @param[out] outRemovedIds the identifiers of the instances gone since sinceGeneration (delta only)
+//! @param[out] outRemovedIdsLen the number of identifiers in the outRemovedIds list
+//! @param[out] outGeneration the generation to pass on the next call
+//! @param[out] outDelta TRUE if only changes are returned, FALSE if all instances are
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_ERROR,
+//!         EUCA_MEMORY_ERROR
+//!
+//! @see doDescribeInstances()
+//!
+int doDescribeInstancesDelta(ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***outRemovedIds, int *outRemovedIdsLen,
+                             long long *outGeneration, boolean * outDelta)
+{
+    int i = 0;
+    int j = 0;
+    int ret = EUCA_OK;
+    int removedLen = 0;
+    boolean found = FALSE;
+    long long generation = 0;
+    char **removedIds = NULL;
+    describeTombstone *tombstone = NULL;
+
+    *outRemovedIds = NULL;
+    *outRemovedIdsLen = 0;
+    *outGeneration = 0;
+    *outDelta = FALSE;
+
+    // taken before the instances are, so the caller sees at least what this generation says
+    sem_p(inst_copy_sem);
+    generation = describe_generation;
+    *outDelta = ((sinceGeneration > 0) && (sinceGeneration >= describe_horizon) && (sinceGeneration <= generation)
+                 && (pMeta->userId != NULL) && !strcmp(pMeta->userId, nc_state.admin_user_id));
+    sem_v(inst_copy_sem);
+
+    if ((ret = doDescribeInstances(pMeta, NULL, 0, outInsts, outInstsLen)) != EUCA_OK)
+        return (ret);
+    *outGeneration = generation;
+    if (!(*outDelta))
+        return (EUCA_OK);
+
+    sem_p(inst_copy_sem);
+    {
+        if ((removedIds = EUCA_ZALLOC(DESCRIBE_TOMBSTONES, sizeof(char *))) == NULL) {
+            sem_v(inst_copy_sem);
+            return (EUCA_MEMORY_ERROR);
+        }
+
+        for (i = 0; i < DESCRIBE_TOMBSTONES; i++) {
+            tombstone = &(describe_tombstones[i]);
+            if (tombstone->generation <= sinceGeneration)
+                continue;
+
+            // an instance that came back is not reported as gone
+            for (j = 0, found = FALSE; ((j < (*outInstsLen)) && !found); j++) {
+                found = !strcmp((*outInsts)[j]->instanceId, tombstone->instanceId);
+            }
+            if (!found && ((removedIds[removedLen] = strdup(tombstone->instanceId)) != NULL))
+                removedLen++;
+        }
+    }
+    sem_v(inst_copy_sem);
+
+    // drop what the caller already has, except for migrating instances: the CC acts on every report of those
+    for (i = 0, j = 0; i < (*outInstsLen); i++) {
+        if (((*outInsts)[i]->describeGeneration > sinceGeneration) || ((*outInsts)[i]->migration_state != NOT_MIGRATING)) {
+            (*outInsts)[j++] = (*outInsts)[i];
+        } else {
+            EUCA_FREE((*outInsts)[i]);
+        }
+    }
+    LOGDEBUG("%d of %d instances changed since generation %lld\n", j, (*outInstsLen), sinceGeneration);
+    *outInstsLen = j;
+
+    *outRemovedIds = removedIds;
+    *outRemovedIdsLen = removedLen;
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the broadcast network info request
 //!
@@ -151,6 +151,11 @@ struct nc_state_t {
     int migration_ready_threshold;
     int shutdown_grace_period_sec;
     boolean migration_capable;
+    int cache_reclaim_high;            //!< percent of the cache limit above which unused images are revoked in the background (0 = never)
+    int cache_reclaim_low;             //!< percent of the cache limit that background revocation brings the cache down to
+    int ephemeral_pool;                //!< kinds of ephemeral and swap partitions, by recent demand, kept formatted in the cache (0 = none)
+    boolean push_enabled;              //!< whether instance and resource changes are pushed to the CC
+    int push_port;                     //!< UDP port of the CC to push them to
     //! @}
 
     //! @{
@@ -315,6 +320,8 @@ int doBroadcastNetworkInfo(ncMetadata * pMeta, char *networkInfo);
 int doAssignAddress(ncMetadata * pMeta, char *instanceId, char *publicIp);
 int doPowerDown(ncMetadata * pMeta);
 int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen);
+int doDescribeInstancesDelta(ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***outRemovedIds, int *outRemovedIdsLen,
+                              long long *outGeneration, boolean * outDelta);
 int doRunInstance(ncMetadata * pMeta, char *uuid, char *instanceId, char *reservationId, virtualMachine * params, char *imageId, char *imageURL,
                   char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId, char *accountId, char *keyName,
                   netConfig * netparams, char *userData, char *credential, char *launchIndex, char *platform, int expiryTime, char **groupNames, int groupNamesSize,
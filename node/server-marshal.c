@@ -650,7 +650,13 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
     int error = EUCA_OK;
     int instIdsLen = 0;
     int outInstsLen = 0;
+    int removedIdsLen = 0;
     char **instIds = NULL;
+    char **removedIds = NULL;
+    boolean incremental = FALSE;
+    boolean delta = FALSE;
+    long long sinceGeneration = 0;
+    long long generation = 0;
     ncMetadata meta = { 0 };
     ncInstance **outInsts = NULL;
     adb_instanceType_t *instance = NULL;
@@ -674,10 +680,21 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
                 instIds[i] = adb_ncDescribeInstancesType_get_instanceIds_at(input, env, i);
             }
 
+            // callers that pass a generation (even 0) understand incremental replies
+            if ((instIdsLen == 0) && !adb_ncDescribeInstancesType_is_sinceGeneration_nil(input, env)) {
+                incremental = TRUE;
+                sinceGeneration = adb_ncDescribeInstancesType_get_sinceGeneration(input, env);
+            }
             // do it
             EUCA_MESSAGE_UNMARSHAL(ncDescribeInstancesType, input, (&meta));
             threadCorrelationId *corr_id = set_corrid(meta.correlationId);
-            if ((error = doDescribeInstances(&meta, instIds, instIdsLen, &outInsts, &outInstsLen)) != EUCA_OK) {
+            if (incremental) {
+                error = doDescribeInstancesDelta(&meta, sinceGeneration, &outInsts, &outInstsLen, &removedIds, &removedIdsLen, &generation, &delta);
+            } else {
+                error = doDescribeInstances(&meta, instIds, instIdsLen, &outInsts, &outInstsLen);
+            }
+
+            if (error != EUCA_OK) {
                 LOGERROR("failed error=%d\n", error);
                 adb_ncDescribeInstancesResponseType_set_return(output, env, AXIS2_FALSE);
             } else {
@@ -696,6 +713,16 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
                     adb_ncDescribeInstancesResponseType_add_instances(output, env, instance);
                 }
 
+                if (incremental) {
+                    adb_ncDescribeInstancesResponseType_set_generation(output, env, generation);
+                    adb_ncDescribeInstancesResponseType_set_delta(output, env, ((delta) ? AXIS2_TRUE : AXIS2_FALSE));
+                    for (i = 0; i < removedIdsLen; i++) {
+                        adb_ncDescribeInstancesResponseType_add_removedInstanceIds(output, env, removedIds[i]);
+                        EUCA_FREE(removedIds[i]);
+                    }
+                    EUCA_FREE(removedIds);
+                }
+
                 EUCA_FREE(outInsts);
             }
             unset_corrid(corr_id);
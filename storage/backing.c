@@ -86,6 +86,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -163,6 +164,8 @@ static char instances_path[EUCA_MAX_PATH] = "";
 static blobstore *cache_bs = NULL;
 static blobstore *work_bs = NULL;
 static sem *disk_sem = NULL;
+static pthread_mutex_t provision_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards provision_running
+static boolean provision_running = FALSE;   //!< set while a provision_thread() is formatting partitions
 
 static bunchOfInstances **instances = NULL;
 
@@ -178,6 +181,7 @@ static void set_id(const ncInstance * instance, virtualBootRecord * vbr, char *i
 static void set_id2(const ncInstance * instance, const char *suffix, char *id, unsigned int id_size);
 static void set_path(char *path, unsigned int path_size, const ncInstance * instance, const char *filename);
 static int stale_blob_examiner(const blockblob * bb);
+static void *provision_thread(void *arg);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -281,6 +285,86 @@ int check_backing_store(bunchOfInstances ** global_instances)
     return (EUCA_OK);
 }
 
+//!
+//! Revokes the least recently used images from the cache blobstore, if there is one and it is
+//! filled up past the high watermark, until it is down to the low watermark.
+//!
+//! @param[in] high_pct the high watermark, in percent of the cache limit
+//! @param[in] low_pct the low watermark, in percent of the cache limit
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int reclaim_backing_cache(unsigned int high_pct, unsigned int low_pct)
+{
+    if (cache_bs == NULL)
+        return (EUCA_OK);
+
+    if (blobstore_reclaim(cache_bs, high_pct, low_pct) == -1) {
+        LOGWARN("failed to reclaim space in the cache: %s\n", blobstore_get_error_str(blobstore_get_error()));
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Formats the blank partitions in most demand in the cache, on its own thread
+//! because that may take minutes
+//!
+//! @param[in] arg the number of kinds of partitions to keep formatted, cast to a pointer
+//!
+//! @return NULL
+//!
+static void *provision_thread(void *arg)
+{
+    int max_kinds = (int)((long)arg);
+
+    sem_p(disk_sem);
+    {
+        int kept = art_provision_partitions(work_bs, cache_bs, max_kinds, INSTANCE_PREP_TIMEOUT_USEC);
+        LOGDEBUG("%d kind(s) of blank partitions are formatted in the cache\n", kept);
+    }
+    sem_v(disk_sem);
+
+    pthread_mutex_lock(&provision_mutex);
+    provision_running = FALSE;
+    pthread_mutex_unlock(&provision_mutex);
+    return (NULL);
+}
+
+//!
+//! Starts formatting, in the background, the ephemeral and swap partitions that
+//! recent launches asked for most, unless that is already under way, so that
+//! the next launches find them in the cache instead of formatting their own.
+//!
+//! @param[in] max_kinds how many kinds (sizes and formats) of partitions to keep formatted, 0 for none
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int provision_backing_cache(int max_kinds)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    int ret = EUCA_OK;
+
+    if ((cache_bs == NULL) || (max_kinds < 1))
+        return (EUCA_OK);
+
+    pthread_mutex_lock(&provision_mutex);
+    if (!provision_running) {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, provision_thread, (void *)((long)max_kinds)) == 0) {
+            provision_running = TRUE;
+        } else {
+            LOGWARN("failed to start the thread that provisions partitions in the cache\n");
+            ret = EUCA_ERROR;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    pthread_mutex_unlock(&provision_mutex);
+    return (ret);
+}
+
 //!
 //! Stats the backing blobstores (work and cache) created under the given path.
 //!
@@ -121,6 +121,8 @@
 \*----------------------------------------------------------------------------*/
 
 int check_backing_store(bunchOfInstances ** global_instances);
+int reclaim_backing_cache(unsigned int high_pct, unsigned int low_pct);
+int provision_backing_cache(int max_kinds);
 int stat_backing_store(const char *conf_instances_path, blobstore_meta * work_meta, blobstore_meta * cache_meta);
 int init_backing_store(const char *conf_instances_path, unsigned int conf_work_size_mb, unsigned int conf_cache_size_mb);
 int save_instance_struct(const ncInstance * instance);
@@ -92,11 +92,18 @@
 #include <sys/types.h>                 // gettid
 #include <regex.h>
 #include <libgen.h>                    // basename
+#include <signal.h>                    // kill
+#include <fcntl.h>                     // fallocate
+#include <openssl/md5.h>
+#include <pwd.h>                       // getpwnam_r
+#include <sys/ioctl.h>
+#include <linux/dm-ioctl.h>            // DM_DEV_CREATE, DM_TABLE_LOAD
 
 #include <eucalyptus.h>                // euca user
 #include <misc.h>                      // ensure_...
 #include <ipc.h>
 #include <euca_string.h>
+#include <hash.h>                      // md5digest2str
 
 #include "blobstore.h"
 #include "diskutil.h"
@@ -112,20 +119,35 @@
 \*----------------------------------------------------------------------------*/
 
 #define BLOBSTORE_METADATA_FILE                  ".blobstore"
+#define BLOBSTORE_INDEX_FILE                     ".blobstore.idx"   //!< compacted snapshot of the blob index
+#define BLOBSTORE_JOURNAL_FILE                   ".blobstore.log"   //!< append-only log of blob index changes since the snapshot
+#define BLOBSTORE_CHUNKS_FILE                    ".blobstore.chunks"    //!< digests of the deduplicated chunks and the packs holding them
+#define BLOBSTORE_INDEX_BUCKETS                      256    //!< initial size of the in-memory blob index hash table
+#define BLOBSTORE_JOURNAL_SLACK                     1024    //!< journal records tolerated beyond twice the number of blobs before compacting
 #define BLOBSTORE_METADATA_TIMEOUT_USEC          (1000000LL * 60 * 2)   //!< it may take dozens of seconds to open blobstore when others are LRU-purging it
 #define BLOBSTORE_LOCK_TIMEOUT_USEC               500000LL
 #define BLOBSTORE_FIND_TIMEOUT_USEC                50000LL
 #define BLOBSTORE_DELETE_TIMEOUT_USEC              50000LL
 #define BLOBSTORE_SLEEP_INTERVAL_USEC              99999LL
+#define BLOBSTORE_LOCK_BACKOFF_USEC                 1000LL  //!< first pause when another process holds a file lock, doubled up to BLOBSTORE_SLEEP_INTERVAL_USEC
+#define BLOBSTORE_LOCK_BUCKETS                      1024    //!< size of the lock table hash, a power of two
 #define BLOBSTORE_DMSETUP_TIMEOUT_SEC                 60
 #define BLOBSTORE_MAX_CONCURRENT                      99
 #define BLOBSTORE_NO_TIMEOUT                          -1L
 #define BLOBSTORE_SIG_MAX                         262144
 #define DM_PATH                                  "/dev/mapper/"
 #define DM_FORMAT                                DM_PATH "%s"   //!< @TODO do not hardcode?
+#define DM_CONTROL_PATH                          DM_PATH "control"
+#define DM_NODE_WAIT_USEC                         100000LL  //!< how long to wait for udev to make the node of a new device before making it ourselves
 #define MIN_BLOCKS_SNAPSHOT                      32 //!< otherwise dmsetup fails with device-mapper: reload ioctl failed: Cannot allocate memory OR device-mapper: reload ioctl failed: Input/output error
 #define EUCA_ZERO                                "euca-zero"
 #define EUCA_ZERO_SIZE                           "2199023255552"    //!< is one petabyte enough?
+#define DEDUP_CHUNK_BLOCKS                          2048    //!< size of a deduplicated chunk, in 512-byte blocks (1 MiB)
+#define DEDUP_CHUNK_BYTES                        (DEDUP_CHUNK_BLOCKS * 512LL)
+#define DEDUP_PACK_CHUNKS                           1024    //!< chunks in a pack blob, unless that is over 1/8 of the blobstore limit
+#define DEDUP_PACK_PREFIX                        "dedup-pack-"  //!< IDs of the pack blobs that hold the chunks
+#define DEDUP_PACK_FORMAT                        DEDUP_PACK_PREFIX "%06d"
+#define DEDUP_CHUNKS_LINE                             48    //!< size of one line of the chunks file, to estimate their number
 
 #define __INLINE__                               __inline__
 
@@ -158,6 +180,8 @@
 #define COMPETITIVE_ITERATIONS                        30
 #define COMPETITIVE_PAUSE_USEC                         5
 #define COMPETITIVE_TIMEOUT_USEC                 3000000L
+#define WAKEUP_HOLD_USEC                           50000LL
+#define WAKEUP_SLACK_USEC                          20000LL
 #endif /* _UNIT_TEST */
 
 #ifdef _EUCA_BLOBS
@@ -192,6 +216,7 @@ typedef enum {                         //!< paths to files containing...
     BLOCKBLOB_PATH_SIG,                //!< ...signature of the blob, if provided from outside
     BLOCKBLOB_PATH_REFS,               //!< ...names of blockblobs that depend on this blockblob, if any
     BLOCKBLOB_PATH_HOLLOW,             //!< ...nothing, but the file acts as a marker of 'hollow' blobs
+    BLOCKBLOB_PATH_CHUNKS,             //!< ...digests and locations of the chunks of a deduplicated blob, if any
     BLOCKBLOB_PATH_TOTAL,
 } blockblob_path_t;
 
@@ -207,6 +232,61 @@ enum {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! One blob as recorded in the blobstore index
+typedef struct _blobstore_index_entry {
+    char *id;                          //!< ID of the blob
+    unsigned long long size_bytes;     //!< size of the blob, less the blocks it maps from other blobs
+    unsigned long long blocks_allocated;    //!< actual number of blocks on disk taken by the blob
+    time_t last_accessed;              //!< timestamp of last access, as of the last recorded change
+    time_t last_modified;              //!< timestamp of last modification, as of the last recorded change
+    unsigned int in_use;               //!< in-use flags kept in metadata files (MAPPED, BACKED), never OPENED or ABANDONED
+    unsigned char is_hollow;           //!< blockblob is 'hollow' - its size doesn't count toward the limit
+    unsigned char is_known;            //!< set once a full record of the blob has been seen
+    pid_t pending;                     //!< process that started changing the blob and has not recorded the result yet
+    unsigned int heap_pos;             //!< position of the entry in the LRU heap plus one, or 0 if it is not in the heap
+    struct _blobstore_index_entry *next;    //!< next entry in the same hash bucket
+    struct _blobstore_index_entry *next_pending;    //!< next entry in the list of pending entries
+} blobstore_index_entry;
+
+//! In-memory copy of the blob index of a blobstore, kept up to date by replaying its journal
+typedef struct _blobstore_index {
+    blobstore_index_entry **buckets;   //!< hash table of entries, keyed by blob ID
+    unsigned int nbuckets;             //!< number of buckets, a power of two
+    unsigned int count;                //!< number of entries in the table
+    unsigned int records;              //!< journal records replayed since the last snapshot
+    long long epoch;                   //!< epoch shared by the snapshot and the journal that extends it
+    ino_t journal_ino;                 //!< inode of the journal file the offset below refers to
+    off_t journal_offset;              //!< how far the journal has been replayed
+    blobstore_index_entry **heap;      //!< known blobs as a min-heap on last_modified, so the least recently used one is on top
+    unsigned int heap_len;             //!< number of entries in the heap
+    unsigned int heap_size;            //!< number of slots allocated for the heap
+    blobstore_index_entry *pending;    //!< list of the entries with a change in progress
+    long long blocks_used;             //!< blocks taken up by the known blobs that count toward the limit, as recorded
+} blobstore_index;
+
+//! One deduplicated chunk, as recorded in the chunks file of a blobstore
+typedef struct _blobstore_chunk {
+    char digest[MD5_STR_SIZE];         //!< hex MD5 of the contents of the chunk
+    int pack;                          //!< number of the pack blob that holds the chunk
+    int slot;                          //!< position of the chunk in that pack, in chunks
+    struct _blobstore_chunk *next;     //!< next chunk in the same hash bucket
+} blobstore_chunk;
+
+//! The chunks of a blobstore, loaded from its chunks file, which stays locked until they are freed
+typedef struct _blobstore_chunks {
+    int fd;                            //!< locked descriptor of the chunks file
+    blobstore_chunk **buckets;         //!< hash table of chunks, keyed by digest
+    unsigned int nbuckets;             //!< number of buckets, a power of two
+    int npacks;                        //!< number of pack numbers that the arrays below have room for
+    blockblob **packs;                 //!< pack blobs opened so far, by pack number
+    signed char *pack_state;           //!< by pack number: 0 = no chunks, 1 = pack exists, 2 = written to, -1 = pack is gone
+    long long *pack_first;             //!< by pack number: first block of the blob being deduplicated that maps to the pack
+    long long *pack_blocks;            //!< by pack number: blocks of the blob being deduplicated that map to the pack
+    int max_pack;                      //!< highest pack number ever recorded, so that numbers of lost packs are not reused
+    int fill_pack;                     //!< pack that new chunks go to, or -1 if a new one must be created
+    int fill_slot;                     //!< next free slot in that pack
+} blobstore_chunks;
+
 typedef struct _blobstore_filelock {
     char path[PATH_MAX];               //!< path that the file was open with @TODO canonicalize?
     int refs;                          //!< number of open file descriptors (some holding the lock, some waiting) for this path in this process
@@ -219,7 +299,8 @@ typedef struct _blobstore_filelock {
     pthread_rwlock_t lock;             //!< reader/writer lock for controlling intra-process access
     pthread_mutex_t mutex;             //!< for locking this specific struct during manipulations
     sem *sem;                          //!< semaphore for debugging
-    struct _blobstore_filelock *next;  //!< pointer for constructing a LL
+    unsigned int hash;                 //!< hash of the path, to pick the bucket and skip most string comparisons
+    struct _blobstore_filelock *next;  //!< next lock in the same bucket of the lock table
 } blobstore_filelock;
 
 /*----------------------------------------------------------------------------*\
@@ -282,26 +363,18 @@ static const char *blobstore_metadata_suffixes[] = {
     "sig",
     "refs",
     "hollow",
+    "chunks",
 };
 
 static void (*err_fn) (const char *msg) = NULL;
 static unsigned char _do_print_errors = 1;
 static unsigned char _do_print_trace = 1;
-static pthread_mutex_t _blobstore_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< process-global mutex
-static blobstore_filelock *locks_list = NULL;   //!< process-global LL head @TODO replace this with a hash table
-
-//! @{
-//! @name debugging counters
-//! @TODO remove these
-static long _locks_list_add_ctr = 0L;
-static long _locks_list_rem_ctr = 0L;
-static long _open_success_ctr = 0L;
-static long _close_success_ctr = 0L;
-static long _open_error_ctr = 0L;
-static long _open_timeout_ctr = 0L;
-static long _close_error_ctr = 0L;
+static pthread_mutex_t _blobstore_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< process-global mutex, guarding the lock table
+static blobstore_filelock *lock_table[BLOBSTORE_LOCK_BUCKETS] = { NULL };   //!< process-global table of file locks, hashed by path
+static blobstore_filelock **lock_fds = NULL;    //!< lock table entry of each open file descriptor, indexed by descriptor
+static int lock_fds_size = 0;          //!< number of slots in lock_fds
+static blobstore_lock_stats lock_stats = { 0 }; //!< lock manager counters, guarded by _blobstore_mutex
 static char zero_buf[1] = "\0";
-//! @}
 
 static __thread char _blobstore_last_msg[512] = "";
 static __thread char _blobstore_last_trace[8172] = "";
@@ -313,6 +386,7 @@ static char *helpers[LASTHELPER] = {
 
 static char *helpers_path[LASTHELPER];
 static int initialized = 0;
+static boolean dm_native = TRUE;       //!< drive device mapper with ioctls, until that turns out not to be permitted
 
 #ifdef _UNIT_TEST
 static char *_farray[] = { F1, F2, F3 };
@@ -343,8 +417,12 @@ static __INLINE__ void _err_off(void);
 static void err(blobstore_error_t error, const char *custom_msg, const int src_line_no, const char *src_file_name);
 static __INLINE__ void propagate_system_errno(blobstore_error_t default_errno, const int src_line_no, const char *src_file_name);
 static void gen_id(char *str, unsigned int size);
+static blobstore_filelock *filelock_get(const char *path);
+static void filelock_unlink(blobstore_filelock * l);
+static int filelock_set_fd(int fd, blobstore_filelock * l);
 static void close_filelock(blobstore_filelock * l);
 static void free_filelock(blobstore_filelock * l);
+static int filelock_wait(blobstore_filelock * path_lock, int fd, short l_type, long long timeout_usec, long long started, int *waited);
 static int close_and_unlock(int fd);
 #ifdef _TEST_LOCKS
 static char *path_to_sem_name(const char *path, char *name, int name_size);
@@ -363,16 +441,63 @@ static int read_array_blockblob_metadata_path(blockblob_path_t path_t, const blo
 static int update_entry_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *entry, int removing);
 static int typeof_blockblob_metadata_path(const blobstore * bs, const char *path, char *bb_id, unsigned int bb_id_size);
 static int delete_blockblob_files(const blobstore * bs, const char *bb_id);
+static int delete_blockblob_dirs(const blobstore * bs, const char *bb_id);
 static int ensure_blockblob_metadata_path(const blobstore * bs, const char *bb_id);
 static void free_bbs(blockblob * bbs);
+static unsigned int check_in_use_lock(blobstore * bs, const char *bb_id, long long timeout_usec);
+static unsigned int check_in_use_files(const blobstore * bs, const char *bb_id);
 static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec);
 static void set_device_path(blockblob * bb);
+static void read_blockblob_state(blockblob * bb, const struct stat *sb);
+static unsigned int index_hash(const char *str, int len);
+static void index_file_path(const blobstore * bs, const char *name, char *path, int path_size);
+static const char *index_boot_id(void);
+static int index_format_record(char *line, int line_size, const char *record);
+static int index_append(const blobstore * bs, const char *record);
+static int index_note_begin(const blobstore * bs, const char *bb_id);
+static int index_derive(const blobstore * bs, const char *bb_id, blockblob * bb);
+static int index_note_commit(const blobstore * bs, const char *bb_id);
+static int index_tracks(blockblob_path_t path_t);
+static blobstore_index *index_alloc(void);
+static void index_free(blobstore_index * idx);
+static blobstore_index_entry *index_lookup(blobstore_index * idx, const char *bb_id, boolean create);
+static void index_remove(blobstore_index * idx, const char *bb_id);
+static long long index_entry_blocks(const blobstore_index_entry * e);
+static int index_lru_before(const blobstore_index_entry * e1, const blobstore_index_entry * e2);
+static void index_heap_swap(blobstore_index * idx, unsigned int i, unsigned int j);
+static void index_heap_sift(blobstore_index * idx, unsigned int i);
+static void index_heap_remove(blobstore_index * idx, blobstore_index_entry * e);
+static void index_detach(blobstore_index * idx, blobstore_index_entry * e);
+static void index_attach(blobstore_index * idx, blobstore_index_entry * e);
+static void index_set_pending(blobstore_index * idx, blobstore_index_entry * e, pid_t pid);
+static int index_apply(blobstore_index * idx, const char *record);
+static int index_replay(blobstore_index * idx, int fd, off_t * offset, long long *epoch);
+static int index_write_file(const blobstore * bs, const char *name, blobstore_index * idx, long long epoch, ino_t * ino, off_t * size);
+static int index_compact(blobstore * bs);
+static int index_rebuild(blobstore * bs);
+static int index_load(blobstore * bs);
+static void index_fill_bb(blobstore * bs, const blobstore_index_entry * e, blockblob * bb);
+static int index_scan(blobstore * bs, const blockblob * bb_to_avoid, const regex_t * re, blockblob ** bbs);
+static long long index_blocks_used(blobstore * bs, const char *bb_to_avoid_id);
+static void index_frontier_push(const blobstore_index * idx, unsigned int *frontier, unsigned int *len, unsigned int pos);
+static unsigned int index_frontier_pop(const blobstore_index * idx, unsigned int *frontier, unsigned int *len);
+static long long index_lru_victims(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks, blockblob ** victims);
+static int index_make_room(blobstore * bs, const blockblob * bb, long long size_blocks);
+static int chunks_grow(blobstore_chunks * chunks, int pack);
+static int chunks_pack_exists(blobstore * bs, int pack);
+static blobstore_chunks *chunks_load(blobstore * bs, long long more_chunks, long long timeout_usec);
+static void chunks_free(blobstore_chunks * chunks);
+static blockblob *chunks_open_pack(blobstore * bs, blobstore_chunks * chunks, int pack, long long timeout_usec);
+static blobstore_chunk *chunks_find(blobstore * bs, blobstore_chunks * chunks, const char *digest, long long timeout_usec);
+static blobstore_chunk *chunks_add(blobstore * bs, blobstore_chunks * chunks, const char *digest, const char *buf, long long timeout_usec);
 static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid);
-static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid);
+static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid, const regex_t * re);
 static int compare_bbs(const void *bb1, const void *bb2);
 static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks);
 static int get_stale_refs(const blockblob * bb, char ***refs);
 static int loop_remove(blobstore * bs, const char *bb_id);
+static int dm_ioctl_native(unsigned long request, const char *dev_name, unsigned int flags, const char *dm_table, dev_t * dev);
+static int dm_create_device_native(const char *dev_name, const char *dm_table);
 static int dm_suspend_resume(const char *dev_name);
 static int dm_check_device(const char *dev_name);
 static int dm_delete_device(const char *dev_name);
@@ -382,6 +507,7 @@ static char *dm_get_zero(void);
 static int blockblob_check(const blockblob * bb);
 static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force);
 static int verify_bb(const blockblob * bb, unsigned long long min_size_bytes);
+static int copy_section(const char *src_path, long long src_offset_bytes, const char *dst_path, long long dst_offset_bytes, long long len_bytes);
 
 #ifdef _UNIT_TEST
 static void _fill_blob(blockblob * bb, char c, int use_file);
@@ -393,10 +519,19 @@ static int do_clone_stresstest(const char *base, const char *name, blobstore_for
 static int check_destination(blockblob * bb4, char *op);
 static int do_copy_test(const char *base, const char *name);
 static int do_clone_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation, blobstore_snapshot_t snapshot, int copy_or_snapshot);
+static int do_dedup_test(const char *base, const char *name);
 static int do_metadata_test(const char *base, const char *name);
+static int make_test_blob(blobstore * bs, const char *id, unsigned long long size_bytes);
+static int check_index(blobstore * bs, const char *label);
+static int do_index_test(const char *base, const char *name);
+static int set_test_blob_mtime(blobstore * bs, const char *id, time_t mtime);
+static int check_lru_heap(blobstore_index * idx, const char *label);
+static int do_lru_test(const char *base, const char *name);
 static int do_blobstore_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation);
 static void *competitor_function(void *ptr);
 static void *thread_function(void *ptr);
+static void *holder_function(void *ptr);
+static int do_lock_wakeup_test(void);
 static void dummy_err_fn(const char *msg);
 #endif /* _UNIT_TEST */
 
@@ -766,6 +901,92 @@ struct flock *flock_whole_file(struct flock *l, short type)
     return l;
 }
 
+//!
+//! Finds the lock table entry for a path, adding one if the path is not locked by any
+//! thread of this process
+//!
+//! @param[in] path path of the file to lock
+//!
+//! @return pointer to the entry or NULL if memory could not be allocated
+//!
+//! @pre MUST be called with _blobstore_mutex held.
+//!
+static blobstore_filelock *filelock_get(const char *path)
+{
+    unsigned int hash = index_hash(path, -1);
+    blobstore_filelock **next_ptr = &(lock_table[hash & (BLOBSTORE_LOCK_BUCKETS - 1)]);
+
+    for (blobstore_filelock * l = *next_ptr; l; l = l->next) {
+        if (l->hash == hash && strcmp(path, l->path) == 0)
+            return l;
+        next_ptr = &(l->next);
+    }
+    // next_ptr now points either to the bucket head or
+    // to the last non-matching element's next pointer
+
+    blobstore_filelock *l = EUCA_ZALLOC(1, sizeof(blobstore_filelock));
+    if (l == NULL)
+        return NULL;
+    euca_strncpy(l->path, path, sizeof(l->path));
+    l->hash = hash;
+    pthread_rwlock_init(&(l->lock), NULL);
+    pthread_mutex_init(&(l->mutex), NULL);
+    *next_ptr = l;                     // add at the end of the bucket
+    lock_stats.paths++;
+    return l;
+}
+
+//!
+//! Removes an entry from the lock table
+//!
+//! @param[in] l the entry, which must be in the table
+//!
+//! @pre MUST be called with _blobstore_mutex held.
+//!
+static void filelock_unlink(blobstore_filelock * l)
+{
+    blobstore_filelock **next_ptr = &(lock_table[l->hash & (BLOBSTORE_LOCK_BUCKETS - 1)]);
+
+    while (*next_ptr != l) {
+        assert(*next_ptr != NULL);     // it must be in the bucket
+        next_ptr = &((*next_ptr)->next);
+    }
+    *next_ptr = l->next;
+    l->next = NULL;
+    lock_stats.paths--;
+}
+
+//!
+//! Records which lock table entry an open file descriptor belongs to, so that
+//! close_and_unlock() can find it without searching the table
+//!
+//! @param[in] fd the file descriptor
+//! @param[in] l the entry or NULL to forget the descriptor
+//!
+//! @return 0 on success or -1 if memory could not be allocated
+//!
+//! @pre MUST be called with _blobstore_mutex held.
+//!
+static int filelock_set_fd(int fd, blobstore_filelock * l)
+{
+    if (fd >= lock_fds_size) {
+        if (l == NULL)
+            return 0;
+
+        int new_size = (lock_fds_size > 0) ? (lock_fds_size * 2) : 64;
+        while (new_size <= fd)
+            new_size *= 2;
+        blobstore_filelock **new_fds = EUCA_REALLOC(lock_fds, new_size, sizeof(blobstore_filelock *));
+        if (new_fds == NULL)
+            return -1;
+        bzero(new_fds + lock_fds_size, (new_size - lock_fds_size) * sizeof(blobstore_filelock *));
+        lock_fds = new_fds;
+        lock_fds_size = new_size;
+    }
+    lock_fds[fd] = l;
+    return 0;
+}
+
 //!
 //!
 //!
@@ -783,6 +1004,8 @@ static void close_filelock(blobstore_filelock * l)
     // held by a process)
     for (int i = 0; i < l->next_fd; i++) {
         if (l->fd[i] > -1) {
+            if (l->fd[i] < lock_fds_size && lock_fds[l->fd[i]] == l)
+                filelock_set_fd(l->fd[i], NULL);
             close(l->fd[i]);
             l->fd[i] = -1;
         }
@@ -807,6 +1030,98 @@ static void free_filelock(blobstore_filelock * l)
     EUCA_FREE(l);
 }
 
+//!
+//! Waits for both locks guarding a file: the reader/writer lock that orders the threads of
+//! this process and then the Posix file lock that orders the processes. Threads block on
+//! the former and are woken up as soon as it is released. The kernel offers no timed wait
+//! for the latter, so a bounded wait retries it with pauses that start short and double,
+//! while an unbounded one blocks in the kernel until the other process lets go.
+//!
+//! @param[in]  path_lock the lock table entry of the file
+//! @param[in]  fd file descriptor to lock the file through
+//! @param[in]  l_type F_RDLCK or F_WRLCK
+//! @param[in]  timeout_usec as for open_and_lock()
+//! @param[in]  started time_usec() when the request was made
+//! @param[out] waited set to 0 if the locks were free, 1 if another thread held them, 2 if another process did
+//!
+//! @return 0 once both locks are held or -1 on timeout (BLOBSTORE_ERROR_AGAIN) or error
+//!
+static int filelock_wait(blobstore_filelock * path_lock, int fd, short l_type, long long timeout_usec, long long started, int *waited)
+{
+    int ret = 0;
+    int saved_errno = 0;
+    long long deadline = started + timeout_usec;
+    long long pause_usec = BLOBSTORE_LOCK_BACKOFF_USEC;
+    struct flock l;
+
+    *waited = 0;
+    if (l_type == F_WRLCK)
+        ret = pthread_rwlock_trywrlock(&(path_lock->lock));
+    else
+        ret = pthread_rwlock_tryrdlock(&(path_lock->lock));
+    if (ret == EBUSY && timeout_usec != 0) {
+        *waited = 1;
+        LOGTRACE("{%u} open_and_lock: could not acquire posix lock, waiting on %s\n", (unsigned int)pthread_self(), path_lock->path);
+        if (timeout_usec == BLOBSTORE_NO_TIMEOUT) {
+            if (l_type == F_WRLCK)
+                ret = pthread_rwlock_wrlock(&(path_lock->lock));
+            else
+                ret = pthread_rwlock_rdlock(&(path_lock->lock));
+        } else {
+            long long left_usec = deadline - time_usec();
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts); // the rwlock deadline is on the wall clock
+            if (left_usec > 0) {
+                long long nsec = ts.tv_nsec + (left_usec % 1000000LL) * 1000LL;
+                ts.tv_sec += (left_usec / 1000000LL) + (nsec / 1000000000LL);
+                ts.tv_nsec = nsec % 1000000000LL;
+            }
+            if (l_type == F_WRLCK)
+                ret = pthread_rwlock_timedwrlock(&(path_lock->lock), &ts);
+            else
+                ret = pthread_rwlock_timedrdlock(&(path_lock->lock), &ts);
+        }
+    }
+    if (ret != 0) {                    // timed out or, with EDEADLK, this thread already holds it for writing
+        ERR(BLOBSTORE_ERROR_AGAIN, NULL);
+        return -1;
+    }
+
+    for (;;) {
+        if (fcntl(fd, F_SETLK, flock_whole_file(&l, l_type)) != -1)
+            return 0;                  // success!
+        if (errno != EAGAIN && errno != EACCES)
+            break;                     // any error other than inability to get the lock
+
+        *waited = 2;
+        if (timeout_usec == BLOBSTORE_NO_TIMEOUT) {
+            if (fcntl(fd, F_SETLKW, flock_whole_file(&l, l_type)) != -1)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            if (errno != EDEADLK)      // on a deadlock between processes, back off so that others may give up their locks
+                break;
+        } else {
+            long long left_usec = deadline - time_usec();
+            if (left_usec <= 0) {      // we timed out waiting for the lock
+                pthread_rwlock_unlock(&(path_lock->lock));
+                ERR(BLOBSTORE_ERROR_AGAIN, NULL);
+                return -1;
+            }
+            pause_usec = MIN(pause_usec, left_usec);
+        }
+        LOGTRACE("{%u} open_and_lock: could not acquire file lock, sleeping on %s\n", (unsigned int)pthread_self(), path_lock->path);
+        usleep(pause_usec);
+        pause_usec = MIN((pause_usec * 2), BLOBSTORE_SLEEP_INTERVAL_USEC);
+    }
+
+    saved_errno = errno;
+    pthread_rwlock_unlock(&(path_lock->lock));  // give up the Posix lock
+    errno = saved_errno;
+    PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+    return -1;
+}
+
 //!
 //! This function must be used to close files opened with open_and_lock(). (Simply doing close() will
 //! leave the file locked via pthreads and future open_and_lock() requests from the same process may
@@ -833,28 +1148,22 @@ static int close_and_unlock(int fd)
         pthread_mutex_lock(&_blobstore_mutex);  // grab global lock (we will not block below and we may be deallocating)
         LOGTRACE("{%u} close_and_unlock: obtained global lock for closing of fd=%d\n", (unsigned int)pthread_self(), fd);
 
-        blobstore_filelock *path_lock = NULL;   // lock struct to which this fd belongs
+        blobstore_filelock *path_lock = (fd < lock_fds_size) ? (lock_fds[fd]) : (NULL); // lock struct to which this fd belongs
         int index = -1;                // index of this fd entry in the lock struct
 
-        // traverse all locks, looking for one with fd,
-        // when found, compute index and open_fds
-        blobstore_filelock **next_ptr = &locks_list;
-        for (blobstore_filelock * l = locks_list; l; l = l->next) { // look for the fd
-            assert(l->next_fd >= 0 && l->next_fd <= BLOBSTORE_MAX_CONCURRENT);
-            for (int i = 0; i < l->next_fd; i++) {
-                if (l->fd_status[i] && l->fd[i] == fd) {
-                    path_lock = l;     // found it!
-                    index = i;
+        if (path_lock) {
+            assert(path_lock->next_fd >= 0 && path_lock->next_fd <= BLOBSTORE_MAX_CONCURRENT);
+            for (int i = 0; i < path_lock->next_fd; i++) {
+                if (path_lock->fd_status[i] && path_lock->fd[i] == fd) {
+                    index = i;         // found it!
                     break;
                 }
             }
-            if (index != -1)
-                break;
-            next_ptr = &(l->next);     // list head or prev element
+            if (index == -1)
+                path_lock = NULL;
         }
 
         if (path_lock) {
-            assert(*next_ptr == path_lock);
             assert(index >= 0 && index < BLOBSTORE_MAX_CONCURRENT);
 
             boolean did_close = FALSE;
@@ -876,15 +1185,14 @@ static int close_and_unlock(int fd)
 
                     if (open_fds == 0 && path_lock->refs == 0) {    // no open blockblob file descriptors in this process
                         close_filelock(path_lock);
-                        *next_ptr = path_lock->next;    // remove from LL
+                        filelock_unlink(path_lock); // remove from the lock table
                         do_free = TRUE;
-                        _locks_list_rem_ctr++;
                         LOGTRACE("{%u} close_and_unlock: unlocked and freed fd=%d path=%s\n", (unsigned int)pthread_self(), fd, path_lock->path);
 
                     } else {
                         LOGTRACE("{%u} close_and_unlock: kept fd=%d path=%s open/refs=%d/%d\n", (unsigned int)pthread_self(), fd, path_lock->path, open_fds, path_lock->refs);
                     }
-                    pthread_rwlock_unlock(&(path_lock->lock));  // give up the Posix lock
+                    pthread_rwlock_unlock(&(path_lock->lock));  // give up the Posix lock, waking up a waiting thread, if any
                     /* lock testing code
                        if (path_lock->sem) {
                        sem_v (path_lock->sem);
@@ -908,11 +1216,6 @@ static int close_and_unlock(int fd)
             ret = -1;
         }
 
-        if (ret == 0)
-            _close_success_ctr++;
-        else
-            _close_error_ctr++;
-
         LOGTRACE("{%u} close_and_unlock: releasing global lock for closing of fd=%d ret=%d\n", (unsigned int)pthread_self(), fd, ret);
         pthread_mutex_unlock(&_blobstore_mutex);
     }                                  // end of critical section
@@ -976,8 +1279,8 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
 {
     short l_type;
     int o_flags = 0;
+    int waited = 0;
     long long started = time_usec();
-    long long deadline = started + timeout_usec;
 
     // verify the flags and, based on them,
     // decide what type of lock to use
@@ -1003,41 +1306,23 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
     }
 
     // handle intra-process locking, with a pthreads read-write lock
-    // either find in a global linked list 'locks_list' or
-    // allocate and append to it a 'blobstore_filelock' struct
+    // either find in the global lock table or allocate and add
+    // to it a 'blobstore_filelock' struct
     blobstore_filelock *path_lock = NULL;
     {                                  // critical section
         pthread_mutex_lock(&_blobstore_mutex);  // grab the global mutex
-        blobstore_filelock **next_ptr = &locks_list;
-        for (blobstore_filelock * l = locks_list; l; l = l->next) { // look through existing locks
-            if (strcmp(path, l->path) == 0) {
-                path_lock = l;
-                break;
-            }
-            next_ptr = &(l->next);
+        path_lock = filelock_get(path);
+        if (path_lock == NULL) {
+            lock_stats.errors++;
+            pthread_mutex_unlock(&_blobstore_mutex);
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return -1;
         }
-        // next_ptr now points either to LL head or
-        // to the last non-matching element's next pointer
-
-        if (path_lock == NULL) {       // this path is not locked by any thread
-            path_lock = EUCA_ZALLOC(1, sizeof(blobstore_filelock));
-            if (path_lock == NULL) {
-                pthread_mutex_unlock(&_blobstore_mutex);
-                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-                return -1;
-            }
-            euca_strncpy(path_lock->path, path, sizeof(path_lock->path));
-            pthread_rwlock_init(&(path_lock->lock), NULL);
-            pthread_mutex_init(&(path_lock->mutex), NULL);
-            *next_ptr = path_lock;     // add at the end of LL
-            _locks_list_add_ctr++;
-        } else {
-            assert(*next_ptr == path_lock);
-            if (path_lock->next_fd == BLOBSTORE_MAX_CONCURRENT) {
-                pthread_mutex_unlock(&_blobstore_mutex);
-                ERR(BLOBSTORE_ERROR_MFILE, "too many open file descriptors");   // to be precise, this means too many file descriptors with overlapping lifetimes
-                return -1;
-            }
+        if (path_lock->next_fd == BLOBSTORE_MAX_CONCURRENT) {
+            lock_stats.errors++;
+            pthread_mutex_unlock(&_blobstore_mutex);
+            ERR(BLOBSTORE_ERROR_MFILE, "too many open file descriptors");   // to be precise, this means too many file descriptors with overlapping lifetimes
+            return -1;
         }
         pthread_mutex_lock(&(path_lock->mutex));    // grab path-specific mutex
         {
@@ -1058,8 +1343,9 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
     {                                  // critical section
         pthread_mutex_lock(&_blobstore_mutex);  // grab the global mutex
 
-        // ensure we do not have this file descriptor already in some other list
-        for (blobstore_filelock * l = locks_list; l; l = l->next) {
+        // ensure we do not have this file descriptor already in some other table entry
+        blobstore_filelock *l = (fd < lock_fds_size) ? (lock_fds[fd]) : (NULL);
+        if (l) {
             {                          // inner critical section
                 pthread_mutex_lock(&(l->mutex));    // grab path-specific mutex for atomic update to the table of descriptors
                 for (int i = 0; i < l->next_fd; i++) {
@@ -1074,6 +1360,13 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
             }                          // end of inner critical section
         }
 
+        if (filelock_set_fd(fd, path_lock) == -1) {
+            pthread_mutex_unlock(&_blobstore_mutex);
+            close(fd);
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            goto error;
+        }
+
         {                              // inner critical section
             pthread_mutex_lock(&(path_lock->mutex));    // grab path-specific mutex for atomic update to the table of descriptors
 
@@ -1094,37 +1387,8 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
         pthread_mutex_unlock(&_blobstore_mutex);    // release global mutex
     }                                  // end of critical section
 
-    for (;;) {
-        // first try getting the Posix rwlock
-        int ret;
-        if (l_type == F_WRLCK)
-            ret = pthread_rwlock_trywrlock(&(path_lock->lock));
-        else
-            ret = pthread_rwlock_tryrdlock(&(path_lock->lock));
-        if (ret == 0) {
-            // Posix rwlock succeeded, try the file lock
-            errno = 0;
-            struct flock l;
-            if (fcntl(fd, F_SETLK, flock_whole_file(&l, l_type)) != -1)
-                break;                 // success!
-            pthread_rwlock_unlock(&(path_lock->lock));  // give up the Posix lock
-            if (errno != EAGAIN) {     // any error other than inability to get the lock
-                PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-                goto error;
-            }
-        }
-        long long now = time_usec();
-        if (timeout_usec != BLOBSTORE_NO_TIMEOUT && now >= deadline) {  // we timed out waiting for the lock
-            ERR(BLOBSTORE_ERROR_AGAIN, NULL);
-            pthread_mutex_lock(&_blobstore_mutex);
-            _open_timeout_ctr++;
-            pthread_mutex_unlock(&_blobstore_mutex);
-            goto error;
-        }
-        LOGTRACE("{%u} open_and_lock: could not acquire %s lock, sleeping on %s\n", (unsigned int)pthread_self(), (ret == 0) ? ("file") : ("posix"), path);
-
-        usleep(BLOBSTORE_SLEEP_INTERVAL_USEC);
-    }
+    if (filelock_wait(path_lock, fd, l_type, timeout_usec, started, &waited) == -1)
+        goto error;
 
     // successully acquired both file and Posix locks
 
@@ -1136,9 +1400,20 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
     }
 #endif // _TEST_LOCKS
 
-    pthread_mutex_lock(&_blobstore_mutex);
-    _open_success_ctr++;
-    pthread_mutex_unlock(&_blobstore_mutex);
+    {                                  // critical section
+        long long waited_usec = time_usec() - started;
+        pthread_mutex_lock(&_blobstore_mutex);
+        lock_stats.acquired++;
+        if (waited) {
+            lock_stats.contended++;
+            if (waited == 2)
+                lock_stats.proc_contended++;
+            lock_stats.wait_usec += waited_usec;
+            if (waited_usec > lock_stats.wait_max_usec)
+                lock_stats.wait_max_usec = waited_usec;
+        }
+        pthread_mutex_unlock(&_blobstore_mutex);
+    }                                  // end of critical section
     {                                  // print out information about the newly acquired lock
         struct stat s;
         fstat(fd, &s);
@@ -1155,25 +1430,11 @@ error:
     // due to aproblem above (inability to open the file or
     // to acquire Posix locks within the deadline), the
     // 'blobstore_filelock' struct will be removed from the
-    // global linked list 'locks_list', its files closed,
-    // and its memory freed -- but only if this is the last
-    // thread using it
+    // global lock table, its files closed, and its memory
+    // freed -- but only if this is the last thread using it
 
     {                                  // critical section
-        pthread_mutex_lock(&_blobstore_mutex);  // grab the global lock to protect locks_list traversal
-
-        // we must recalculate next_ptr since the element that it points to
-        // may have been removed from the LL and freed while we were outside
-        // the critical section
-        blobstore_filelock **next_ptr = &locks_list;
-        for (blobstore_filelock * l = locks_list; l; l = l->next) { // look through existing locks
-            if (path_lock == l)
-                break;
-            next_ptr = &(l->next);
-        }
-        // next_ptr must point at the struct we are looking for,
-        // which must be in the list
-        assert(*next_ptr == path_lock);
+        pthread_mutex_lock(&_blobstore_mutex);  // grab the global lock to protect the lock table
 
         boolean do_free = FALSE;
         {                              // inner critical section
@@ -1193,9 +1454,8 @@ error:
 
             if (open_fds == 0 && path_lock->refs == 0) {    // no open blockblob file descriptors in this process
                 close_filelock(path_lock);
-                *next_ptr = path_lock->next;    // remove from LL
+                filelock_unlink(path_lock); // remove from the lock table
                 do_free = TRUE;
-                _locks_list_rem_ctr++;
                 LOGTRACE("{%u} open_and_lock: freed fd=%d path=%s\n", (unsigned int)pthread_self(), fd, path_lock->path);
 
             } else {
@@ -1208,13 +1468,31 @@ error:
         if (do_free)
             free_filelock(path_lock);
 
-        _open_error_ctr++;
+        if (_blobstore_errno == BLOBSTORE_ERROR_AGAIN)
+            lock_stats.timeouts++;
+        else
+            lock_stats.errors++;
         pthread_mutex_unlock(&_blobstore_mutex);
     }                                  // end of critical section
 
     return -1;
 }
 
+//!
+//! Reports the counters of the blobstore lock manager of this process
+//!
+//! @param[out] stats filled in with a snapshot of the counters
+//!
+void blobstore_get_lock_stats(blobstore_lock_stats * stats)
+{
+    if (stats == NULL)
+        return;
+
+    pthread_mutex_lock(&_blobstore_mutex);
+    *stats = lock_stats;
+    pthread_mutex_unlock(&_blobstore_mutex);
+}
+
 //!
 //!
 //!
@@ -1623,6 +1901,8 @@ out:
 //!
 int blobstore_close(blobstore * bs)
 {
+    if (bs)
+        index_free(bs->index);
     EUCA_FREE(bs);
     return 0;
 }
@@ -1702,6 +1982,13 @@ int blobstore_delete(blobstore * bs)
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
     LOGINFO("removing blobstore metadata '%s'\n", meta_path);
     unlink(meta_path);
+    index_file_path(bs, BLOBSTORE_INDEX_FILE, meta_path, sizeof(meta_path));
+    unlink(meta_path);
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, meta_path, sizeof(meta_path));
+    unlink(meta_path);
+    index_file_path(bs, BLOBSTORE_CHUNKS_FILE, meta_path, sizeof(meta_path));
+    unlink(meta_path);
+    index_free(bs->index);
     EUCA_FREE(bs);
 
     return EUCA_OK;
@@ -1774,6 +2061,9 @@ static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore
     case BLOCKBLOB_PATH_HOLLOW:
         euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_HOLLOW], sizeof(name));
         break;
+    case BLOCKBLOB_PATH_CHUNKS:
+        euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_CHUNKS], sizeof(name));
+        break;
     default:
         ERR(BLOBSTORE_ERROR_INVAL, "invalid path_t");
         return -1;
@@ -1814,12 +2104,17 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
     char path[PATH_MAX];
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
 
+    if (index_tracks(path_t))
+        index_note_begin(bs, bb_id);
+
     int fd = open_and_lock(path,
                            BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_RDWR,
                            BLOBSTORE_METADATA_TIMEOUT_USEC,
                            BLOBSTORE_FILE_PERM);
-    if (fd == -1)
-        return -1;
+    if (fd == -1) {
+        ret = -1;
+        goto out;
+    }
     int size = buf_to_fd(fd, str, strlen(str));
     int ret_close = close_and_unlock(fd);
     if (size != strlen(str)) {
@@ -1830,6 +2125,9 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
         ret = -1;                      // close_and_unlock should have set the error code
     }
 
+out:
+    if (index_tracks(path_t))
+        index_note_commit(bs, bb_id);
     return ret;
 }
 
@@ -1898,9 +2196,13 @@ static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const bl
     char path[EUCA_MAX_PATH] = "";
 
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
+    if (index_tracks(path_t))
+        index_note_begin(bs, bb_id);
+
     if ((fd = open_and_lock(path, openFlags, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1) {
         PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-        return (-1);
+        ret = -1;
+        goto out;
     }
 
     for (i = 0; i < array_size; i++) {
@@ -1923,6 +2225,9 @@ static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const bl
         ret = -1;
     }
 
+out:
+    if (index_tracks(path_t))
+        index_note_commit(bs, bb_id);
     return (ret);
 }
 
@@ -2229,6 +2534,7 @@ static int delete_blockblob_files(const blobstore * bs, const char *bb_id)
 {
     int count = 0;
 
+    index_note_begin(bs, bb_id);
     for (int path_t = 1; path_t < BLOCKBLOB_PATH_TOTAL; path_t++) { // go through all types of blob-related files...
         char path[PATH_MAX];
         set_blockblob_metadata_path((blockblob_path_t) path_t, bs, bb_id, path, sizeof(path));
@@ -2237,7 +2543,26 @@ static int delete_blockblob_files(const blobstore * bs, const char *bb_id)
     }
 
     // delete blob's subdirectories if there are any
+    count += delete_blockblob_dirs(bs, bb_id);
+    index_note_commit(bs, bb_id);
+
+    return count;
+}
+
+//!
+//! Helper for deleting the directories of a blob, from the innermost outward, for as
+//! long as they are empty
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the number of directories deleted
+//!
+static int delete_blockblob_dirs(const blobstore * bs, const char *bb_id)
+{
+    int count = 0;
     char path[PATH_MAX];
+
     snprintf(path, sizeof(path), "%s/%s%s", bs->path, bb_id, bs->format == BLOBSTORE_FORMAT_DIRECTORY ? "/" : "");
     for (int i = strlen(path) - 1; i > 0; i--) {
         if (path[i] == '/') {
@@ -2291,19 +2616,19 @@ static void free_bbs(blockblob * bbs)
 }
 
 //!
-//!
+//! Determines the in-use flags of a blob that follow from its .lock file (OPENED, ABANDONED)
 //!
 //! @param[in] bs
 //! @param[in] bb_id
 //! @param[in] timeout_usec
 //!
-//! @return
+//! @return the BLOCKBLOB_STATUS_OPENED and BLOCKBLOB_STATUS_ABANDONED flags that apply
 //!
 //! @pre
 //!
 //! @note
 //!
-static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+static unsigned int check_in_use_lock(blobstore * bs, const char *bb_id, long long timeout_usec)
 {
     unsigned int in_use = 0;
     char path[PATH_MAX];
@@ -2324,7 +2649,29 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
     } else {
         in_use |= BLOCKBLOB_STATUS_OPENED;  //! @TODO check if open failed for other reason?
     }
+    _err_on();
+
+    return in_use;
+}
+
+//!
+//! Determines the in-use flags of a blob that follow from its metadata files (MAPPED, BACKED)
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the BLOCKBLOB_STATUS_MAPPED and BLOCKBLOB_STATUS_BACKED flags that apply
+//!
+//! @pre
+//!
+//! @note These are the flags the blob index keeps, see index_note_commit()
+//!
+static unsigned int check_in_use_files(const blobstore * bs, const char *bb_id)
+{
+    unsigned int in_use = 0;
+    char path[PATH_MAX];
 
+    _err_off();                        // do not complain if metadata files do not exist
     if (read_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb_id, path, sizeof(path)) > 0) {
         in_use |= BLOCKBLOB_STATUS_MAPPED;
     }
@@ -2341,6 +2688,24 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
     return in_use;
 }
 
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//! @param[in] timeout_usec
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+{
+    return (check_in_use_lock(bs, bb_id, timeout_usec) | check_in_use_files(bs, bb_id));
+}
+
 //!
 //!
 //!
@@ -2399,7 +2764,8 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name)
+            || !strcmp(BLOBSTORE_INDEX_FILE, entry_name) || !strcmp(BLOBSTORE_JOURNAL_FILE, entry_name) || !strcmp(BLOBSTORE_CHUNKS_FILE, entry_name))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2487,45 +2853,9 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
         euca_strncpy(bb->id, blob_id, sizeof(bb->id));
         euca_strncpy(bb->blocks_path, entry_path, sizeof(bb->blocks_path));
         set_device_path(bb);           // read .dm and .loopback and set bb->device_path accordingly
-        bb->size_bytes = sb.st_size;
-        bb->blocks_allocated = sb.st_blocks;
-        bb->last_accessed = sb.st_atime;
-        bb->last_modified = sb.st_mtime;
+        read_blockblob_state(bb, &sb);
         bb->snapshot_type = BLOBSTORE_FORMAT_ANY;   // it is not necessary to know whether this is a snapshot
         bb->in_use = check_in_use(bs, bb->id, 0);
-
-        // see if it's hollow
-        char buf[64];
-        if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bb->store, bb->id, buf, sizeof(buf)) != -1) {
-            bb->is_hollow = TRUE;
-        }
-        // if there is a .refs file, subtract the mapped blocks, if any, from the size
-        char **array = NULL;
-        int array_size = 0;
-        if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) != -1) {
-            for (int i = 0; i < array_size; i++) {
-                char *store_path = NULL;
-                char *blob_id = NULL;
-                char *rel_type = NULL;
-                char *start_block = NULL;
-                char *len_blocks = NULL;
-
-                store_path = strtok(array[i], " ");
-                blob_id = strtok(NULL, " ");
-                rel_type = strtok(NULL, " ");
-                start_block = strtok(NULL, " ");
-                len_blocks = strtok(NULL, " ");
-                if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
-                    bb->size_bytes -= strtoull(len_blocks, NULL, 0) * 512LL;
-                }
-            }
-        }
-
-        if (array) {
-            for (int i = 0; i < array_size; i++)
-                EUCA_FREE(array[i]);
-            EUCA_FREE(array);
-        }
     }
 
 free:
@@ -2534,20 +2864,79 @@ free:
 }
 
 //!
-//! Runs through the blobstore and puts all found blockblobs into a linked list, returning its head
+//! Fills in the size, timestamps and hollowness of a blob from the stat() of its
+//! blocks file and from its metadata files
+//!
+//! @param[in,out] bb blob with the store and id set
+//! @param[in]     sb stat() of the blocks file of the blob
+//!
+//! @pre
+//!
+//! @note
+//!
+static void read_blockblob_state(blockblob * bb, const struct stat *sb)
+{
+    bb->size_bytes = sb->st_size;
+    bb->blocks_allocated = sb->st_blocks;
+    bb->last_accessed = sb->st_atime;
+    bb->last_modified = sb->st_mtime;
+
+    // see if it's hollow
+    char buf[64];
+    if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bb->store, bb->id, buf, sizeof(buf)) != -1) {
+        bb->is_hollow = TRUE;
+    }
+    // if there is a .refs file, subtract the mapped blocks, if any, from the size
+    char **array = NULL;
+    int array_size = 0;
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
+            char *store_path = NULL;
+            char *blob_id = NULL;
+            char *rel_type = NULL;
+            char *start_block = NULL;
+            char *len_blocks = NULL;
+
+            store_path = strtok(array[i], " ");
+            blob_id = strtok(NULL, " ");
+            rel_type = strtok(NULL, " ");
+            start_block = strtok(NULL, " ");
+            len_blocks = strtok(NULL, " ");
+            if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
+                bb->size_bytes -= strtoull(len_blocks, NULL, 0) * 512LL;
+            }
+        }
+    }
+
+    if (array) {
+        for (int i = 0; i < array_size; i++)
+            EUCA_FREE(array[i]);
+        EUCA_FREE(array);
+    }
+}
+
+//!
+//! Runs through the blobstore and puts all found blockblobs into a linked list, returning its head.
+//! The blob index is used when it is available, otherwise the directory tree is walked.
 //!
 //! @param[in] bs
 //! @param[in] bb_to_avoid
+//! @param[in] re if not NULL, only blobs with IDs matching this regular expression are needed
 //!
 //! @return A pointer to the head of a linked list containing all found blockblobs
 //!
-//! @pre
+//! @pre The blobstore must be locked.
 //!
-//! @note
+//! @note Blobs found through the index do not have their device_path set.
 //!
-static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
+static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid, const regex_t * re)
 {
     blockblob *bbs = NULL;
+    if (index_scan(bs, bb_to_avoid, re, &bbs) == 0) {
+        return bbs;
+    }
+
+    LOGWARN("index of blobstore %s is not available, scanning its directory tree\n", bs->path);
     if (walk_bs(bs, bs->path, &bbs, bb_to_avoid) == NULL) {
         if (bbs)
             free_bbs(bbs);
@@ -2558,935 +2947,1212 @@ static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
 }
 
 //!
+//! Computes the 32-bit FNV-1a hash of a string, used both for the index hash table
+//! and for the checksums of index records
 //!
+//! @param[in] str the string to hash
+//! @param[in] len the number of characters to hash, or -1 for the whole string
 //!
-//! @param[in] bb1
-//! @param[in] bb2
+//! @return the hash value
 //!
-//! @return
+static unsigned int index_hash(const char *str, int len)
+{
+    unsigned int hash = 2166136261U;
+
+    for (int i = 0; (len < 0) ? (str[i] != '\0') : (i < len); i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 //!
-//! @pre
+//! Sets the path of one of the index files of a blobstore
 //!
-//! @note
+//! @param[in]  bs
+//! @param[in]  name BLOBSTORE_INDEX_FILE, BLOBSTORE_JOURNAL_FILE or BLOBSTORE_CHUNKS_FILE
+//! @param[out] path
+//! @param[in]  path_size
 //!
-static int compare_bbs(const void *bb1, const void *bb2)
+static void index_file_path(const blobstore * bs, const char *name, char *path, int path_size)
 {
-    return (int)((*(blockblob **) bb1)->last_modified - (*(blockblob **) bb2)->last_modified);
+    snprintf(path, path_size, "%s/%s", bs->path, name);
 }
 
 //!
+//! Identifies the current boot of the host. Journal records appended without fsync()
+//! may be lost in a crash of the host, so the index is only trusted within the boot
+//! that wrote it and is rebuilt from the blob files after a reboot.
 //!
+//! @return the boot ID or "unknown"
 //!
-//! @param[in] bs
-//! @param[in] bb_list
-//! @param[in] need_blocks
+static const char *index_boot_id(void)
+{
+    static char boot_id[64] = "";
+
+    if (boot_id[0] == '\0') {
+        char buf[64] = "";
+        FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+        if ((fp == NULL) || (fscanf(fp, "%63s", buf) != 1)) {
+            euca_strncpy(buf, "unknown", sizeof(buf));
+        }
+        if (fp)
+            fclose(fp);
+        euca_strncpy(boot_id, buf, sizeof(boot_id));
+    }
+    return boot_id;
+}
+
 //!
-//! @return
+//! Turns an index record into a line of an index file: the checksum of the record,
+//! the record and a newline
 //!
-//! @pre
+//! @param[out] line
+//! @param[in]  line_size
+//! @param[in]  record
 //!
-//! @note
+//! @return the length of the line or -1 if it does not fit
 //!
-static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks)
+static int index_format_record(char *line, int line_size, const char *record)
 {
-    int list_length = 0;
-    long long purged = 0;
-
-    for (blockblob * bb = bb_list; bb; bb = bb->next) {
-        list_length++;
-    }
+    int len = snprintf(line, line_size, "%08x %s\n", index_hash(record, -1), record);
+    if ((len < 0) || (len >= line_size))
+        return -1;
+    return len;
+}
 
-    if (list_length) {
-        blockblob *bb;
-        int i;
+//!
+//! Appends a record to the journal of a blobstore. The journal is locked for the
+//! duration of the write so records of concurrent writers do not interleave. If the
+//! record cannot be appended, the journal is removed so that the index gets rebuilt
+//! from the blob files rather than trusted.
+//!
+//! @param[in] bs
+//! @param[in] record
+//!
+//! @return 0 on success (or if the blobstore has no index) and -1 on error
+//!
+static int index_append(const blobstore * bs, const char *record)
+{
+    int fd = -1;
+    int len = 0;
+    char path[PATH_MAX] = "";
+    char line[BLOBSTORE_MAX_PATH + 128] = "";
+    struct stat fsb = { 0 };
+    struct stat psb = { 0 };
 
-        blockblob **bb_array = (blockblob **) EUCA_ZALLOC(list_length, sizeof(blockblob *));
-        if (!bb_array)
-            return purged;
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if ((len = index_format_record(line, sizeof(line), record)) == -1) {
+        goto broken;
+    }
 
-        for (i = 0, bb = bb_list; bb; bb = bb->next, i++) {
-            bb_array[i] = bb;
+    for (int tries = 0; tries < 5; tries++) {
+        if ((fd = open(path, O_WRONLY | O_APPEND)) == -1) {
+            if (errno == ENOENT)
+                return 0;              // no index to keep up to date
+            goto broken;
+        }
+        if (flock(fd, LOCK_EX) == -1) {
+            close(fd);
+            goto broken;
         }
+        if (stat(path, &psb) == -1) {
+            close(fd);
+            return 0;                  // the journal was removed while we waited
+        }
+        if ((fstat(fd, &fsb) == 0) && (fsb.st_ino == psb.st_ino)) {
+            ssize_t written = write(fd, line, len);
+            close(fd);                 // also releases the lock
+            if (written != len)
+                goto broken;
+            return 0;
+        }
+        close(fd);                     // the journal was compacted while we waited, append to the new one
+    }
 
-        qsort(bb_array, list_length, sizeof(blockblob *), compare_bbs);
+broken:
+    LOGWARN("failed to record a change in the index of blobstore %s, the index will be rebuilt\n", bs->path);
+    unlink(path);
+    return -1;
+}
 
-        int iteration = 0;
-        int deleted;
-        do {
-            // iterate multiple times in case there are dependencies
-            //! @TODO unify with _fsck's iteration code?
-            deleted = 0;               // deleted in this round
-            for (i = 0; i < list_length; i++) {
-                bb = bb_array[i];
-                if (bb == NULL)        // was either deleted or deemed undeletable on previous iteration
-                    continue;
-                bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+//!
+//! Records that a blob is about to change. Until index_note_commit() is called for
+//! it, the blob is 'pending' and the index will go to its files for its state.
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return 0 on success and -1 on error
+//!
+static int index_note_begin(const blobstore * bs, const char *bb_id)
+{
+    char path[PATH_MAX] = "";
+    char record[BLOBSTORE_MAX_PATH + 32] = "";
+    struct stat sb = { 0 };
 
-                char code = '?';
-                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
-                    // mapped blobs have children, thus cannot be deleted at this iteration
-                    code = 'C';
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if (stat(path, &sb) == -1)
+        return 0;                      // no index to keep up to date
 
-                } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = 'O';
+    snprintf(record, sizeof(record), "B %d %s", getpid(), bb_id);
+    return index_append(bs, record);
+}
 
-                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = '!';
+//!
+//! Reads the state of a blob that the index keeps from the blob's files
+//!
+//! @param[in]  bs
+//! @param[in]  bb_id
+//! @param[out] bb zeroed blob to fill in, with the in_use flags kept in metadata files only
+//!
+//! @return 0 on success and -1 if the blob does not exist
+//!
+static int index_derive(const blobstore * bs, const char *bb_id, blockblob * bb)
+{
+    struct stat sb = { 0 };
 
-                } else {
-                    purged += round_up_sec(bb->size_bytes) / 512;
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = 'D';
-                    deleted++;
-                }
-                LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'), // o = open
-                         (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
-                         (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
-                         (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
-                         code,         // outcome codes: D=deleted, else C=children, !=undeletable, O=open
-                         bb->size_bytes / 512L, // size is in sectors
-                         ctime(&(bb->last_modified)));  // ctime adds a newline
-                if (purged >= need_blocks)
-                    break;
-            }
-            iteration++;
-        } while (deleted && (purged < need_blocks));
-        EUCA_FREE(bb_array);
-    }
+    bb->store = (blobstore *) bs;
+    euca_strncpy(bb->id, bb_id, sizeof(bb->id));
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+    if (stat(bb->blocks_path, &sb) == -1)
+        return -1;
 
-    return purged;
+    _err_off();                        // do not complain if metadata files do not exist
+    read_blockblob_state(bb, &sb);
+    _err_on();
+    bb->in_use = check_in_use_files(bs, bb->id);
+    return 0;
 }
 
 //!
-//!
+//! Records the current state of a blob, as found in its files, after a change
 //!
 //! @param[in] bs
-//! @param[in] meta
-//!
-//! @return
-//!
-//! @pre
+//! @param[in] bb_id
 //!
-//! @note
+//! @return 0 on success and -1 on error
 //!
-int blobstore_stat(blobstore * bs, blobstore_meta * meta)
+static int index_note_commit(const blobstore * bs, const char *bb_id)
 {
     int ret = 0;
+    char path[PATH_MAX] = "";
+    char record[BLOBSTORE_MAX_PATH + 128] = "";
+    struct stat sb = { 0 };
+    blockblob *bb = NULL;
 
-    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
-        return EUCA_ERROR;
-    }
-    // put existing items in the blobstore into a LL
-    _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
-    if (bbs == NULL) {
-        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-            goto unlock;
-        }
-    }
-    // analyze the LL, calculating sizes
-    meta->blocks_allocated = 0;
-    meta->blocks_unlocked = 0;
-    meta->blocks_locked = 0;
-    meta->num_blobs = 0;
-    for (blockblob * abb = bbs; abb;) {
-        //! @TODO unify this with locked/unlocked calculation in open()
-        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
-        if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
-            // these can't be purged if we need space
-            //! @TODO look into recursive purging of unused references?
-            meta->blocks_locked += abb_size_blocks;
-        } else {
-            // these potentially can be purged, unless they are depended on by locked ones
-            meta->blocks_unlocked += abb_size_blocks;
-        }
-        meta->blocks_allocated += abb->blocks_allocated;
-        meta->num_blobs++;
-
-        // free this node and move the pointer
-        blockblob *old_bb = abb;
-        abb = abb->next;
-        EUCA_FREE(old_bb);
-    }
-
-unlock:
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if (stat(path, &sb) == -1)
+        return 0;                      // no index to keep up to date
 
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    if ((bb = EUCA_ZALLOC(1, sizeof(blockblob))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
     }
 
-    euca_strncpy(meta->id, bs->id, sizeof(meta->id));
-    meta->revocation_policy = bs->revocation_policy;
-    meta->snapshot_policy = bs->snapshot_policy;
-    meta->format = bs->format;
-    meta->blocks_limit = bs->limit_blocks;
-    if (realpath(bs->path, meta->path) == NULL) {
-        LOGERROR("failed to resolve the blobstore path %s\n", bs->path);
-        ret = EUCA_ERROR;
+    if (index_derive(bs, bb_id, bb) == -1) {
+        snprintf(record, sizeof(record), "D %s", bb_id);
+    } else {
+        snprintf(record, sizeof(record), "U %llu %llu %lld %lld %u %u %s", bb->size_bytes, bb->blocks_allocated, (long long)bb->last_accessed,
+                 (long long)bb->last_modified, bb->in_use, bb->is_hollow, bb_id);
     }
-
+    ret = index_append(bs, record);
+    EUCA_FREE(bb);
     return ret;
 }
 
 //!
-//! Read .refs file content and return any entries that point to blobs that no longer exist
+//! Tells whether changes to a blob file of the given type are reflected in the index
 //!
-//! @param[in]  bb
-//! @param[out] refs
+//! @param[in] path_t
 //!
-//! @return size of the array placed into *refs, which caller must free, or -1 on error
+//! @return TRUE or FALSE
 //!
-//! @pre
+static int index_tracks(blockblob_path_t path_t)
+{
+    switch (path_t) {
+    case BLOCKBLOB_PATH_BLOCKS:
+    case BLOCKBLOB_PATH_DM:
+    case BLOCKBLOB_PATH_DEPS:
+    case BLOCKBLOB_PATH_REFS:
+    case BLOCKBLOB_PATH_HOLLOW:
+        return TRUE;
+    default:
+        break;
+    }
+    return FALSE;
+}
+
 //!
-//! @note
+//! Allocates an empty in-memory index
 //!
-static int get_stale_refs(const blockblob * bb, char ***refs)
+//! @return a pointer to the index or NULL if out of memory
+//!
+static blobstore_index *index_alloc(void)
 {
-    blobstore *bs = bb->store;
-    char **array = NULL;
-    int array_size = 0;
-    int stale_refs = 0;
-
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, &array, &array_size) != -1) {
-        for (int i = 0; i < array_size; i++) {
-            char ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-            euca_strncpy(ref, array[i], sizeof(ref));
-
-            char *store_path = strtok(array[i], " ");
-            char *blob_id = strtok(NULL, " ");  // the remaining entries in array[i] are ignored
-            char ref_exists = 0;
+    blobstore_index *idx = EUCA_ZALLOC(1, sizeof(blobstore_index));
+    if (idx == NULL)
+        return NULL;
 
-            if (strlen(store_path) < 1 || strlen(blob_id) < 1)
-                goto stale_ref;
+    idx->nbuckets = BLOBSTORE_INDEX_BUCKETS;
+    if ((idx->buckets = EUCA_ZALLOC(idx->nbuckets, sizeof(blobstore_index_entry *))) == NULL) {
+        EUCA_FREE(idx);
+        return NULL;
+    }
+    return idx;
+}
 
-            blobstore *ref_bs = bs;
-            if (strcmp(bs->path, store_path)) { // if deleting reference in a different blobstore
-                // need to open it
-                ref_bs = blobstore_open(store_path, 0, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
-                if (ref_bs == NULL)    // blobstore with a child blob does not exist
-                    goto stale_ref;
-            }
+//!
+//! Frees an in-memory index and all of its entries
+//!
+//! @param[in] idx the index to free, may be NULL
+//!
+static void index_free(blobstore_index * idx)
+{
+    if (idx == NULL)
+        return;
 
-            blockblob *ref_bb = blockblob_open(ref_bs, blob_id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
-            if (ref_bb) {
-                blockblob_close(ref_bb);
-                ref_exists = 1;
-            } else {
-                if (_blobstore_errno != BLOBSTORE_ERROR_NOENT)  // conservatively assume that unless the error says otherwise, the blob exists
-                    ref_exists = 1;
-            }
-            if (ref_bs != bs) {
-                blobstore_close(ref_bs);
-            }
+    for (unsigned int b = 0; b < idx->nbuckets; b++) {
+        for (blobstore_index_entry * e = idx->buckets[b]; e;) {
+            blobstore_index_entry *next = e->next;
+            EUCA_FREE(e->id);
+            EUCA_FREE(e);
+            e = next;
+        }
+    }
+    EUCA_FREE(idx->buckets);
+    EUCA_FREE(idx->heap);
+    EUCA_FREE(idx);
+}
 
-stale_ref:
+//!
+//! Finds the entry of a blob in the in-memory index, optionally adding it
+//!
+//! @param[in] idx
+//! @param[in] bb_id
+//! @param[in] create if TRUE, a missing entry is added
+//!
+//! @return a pointer to the entry or NULL if not found (or out of memory)
+//!
+static blobstore_index_entry *index_lookup(blobstore_index * idx, const char *bb_id, boolean create)
+{
+    blobstore_index_entry *e = NULL;
+    unsigned int b = index_hash(bb_id, -1) & (idx->nbuckets - 1);
 
-            if (ref_exists) {
-                EUCA_FREE(array[i]);   // free names of refs that exist
-            } else {
-                strcpy(array[i], ref); // since strtok() clobbered the original value
-                stale_refs++;
-            }
-        }
+    for (e = idx->buckets[b]; e; e = e->next) {
+        if (!strcmp(e->id, bb_id))
+            return e;
     }
+    if (!create)
+        return NULL;
 
-    if (stale_refs > 0) {
-        if (refs) {
-            *refs = EUCA_ZALLOC(stale_refs, sizeof(char *));
-            if (*refs == NULL) {
-                stale_refs = -1;       // OOM error
-            }
-        }
-        for (int i = 0, j = 0; i < array_size; i++) {
-            if (array[i]) {            // ref does not exist
-                if (refs && *refs) {
-                    (*refs)[j++] = array[i];
-                    assert(j <= stale_refs);
-                } else {
-                    EUCA_FREE(array[i]);
+    if (idx->count >= 2 * idx->nbuckets) {
+        // grow the table, keeping the chains short
+        unsigned int nbuckets = idx->nbuckets * 2;
+        blobstore_index_entry **buckets = EUCA_ZALLOC(nbuckets, sizeof(blobstore_index_entry *));
+        if (buckets != NULL) {
+            for (unsigned int i = 0; i < idx->nbuckets; i++) {
+                for (e = idx->buckets[i]; e;) {
+                    blobstore_index_entry *next = e->next;
+                    unsigned int nb = index_hash(e->id, -1) & (nbuckets - 1);
+                    e->next = buckets[nb];
+                    buckets[nb] = e;
+                    e = next;
                 }
             }
+            EUCA_FREE(idx->buckets);
+            idx->buckets = buckets;
+            idx->nbuckets = nbuckets;
+            b = index_hash(bb_id, -1) & (idx->nbuckets - 1);
         }
     }
 
-    if (array_size > 0)
-        EUCA_FREE(array);
-
-    return stale_refs;
-}
+    if ((e = EUCA_ZALLOC(1, sizeof(blobstore_index_entry))) == NULL)
+        return NULL;
+    if ((e->id = strdup(bb_id)) == NULL) {
+        EUCA_FREE(e);
+        return NULL;
+    }
+    e->next = idx->buckets[b];
+    idx->buckets[b] = e;
+    idx->count++;
+    return e;
+}
 
 //!
-//! Checks the integrity check of the blobstore. With a non-NULL examiner(), each found
-//! blob is passed to it for examination and the blob is deleted if function returns non-zero
-//!
-//! @param[in] bs
-//! @param[in] examiner
-//!
-//! @return
-//!
-//! @pre
+//! Removes the entry of a blob from the in-memory index, if it is there
 //!
-//! @note
+//! @param[in] idx
+//! @param[in] bb_id
 //!
-int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
+static void index_remove(blobstore_index * idx, const char *bb_id)
 {
-    int ret = 0;
-
-    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
-        return -1;
-    }
-    // put existing items in the blobstore into a LL
-    _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
+    unsigned int b = index_hash(bb_id, -1) & (idx->nbuckets - 1);
 
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-        ret = -1;
-        goto free;
-    }
-
-    if (bbs == NULL) {
-        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-            ret = -1;
+    for (blobstore_index_entry ** pe = &(idx->buckets[b]); *pe; pe = &((*pe)->next)) {
+        blobstore_index_entry *e = *pe;
+        if (!strcmp(e->id, bb_id)) {
+            index_set_pending(idx, e, 0);
+            index_detach(idx, e);
+            index_heap_remove(idx, e);
+            *pe = e->next;
+            EUCA_FREE(e->id);
+            EUCA_FREE(e);
+            idx->count--;
+            return;
         }
-        goto free;
     }
+}
 
-    {                                  // check objects in the blobstore
+//!
+//! Returns the number of blocks a blob counts for toward the blobstore limit, as recorded
+//!
+//! @param[in] e
+//!
+//! @return the number of 512-byte blocks, 0 for hollow blobs and blobs not recorded yet
+//!
+static long long index_entry_blocks(const blobstore_index_entry * e)
+{
+    if (!e->is_known || e->is_hollow)
+        return 0;
+    return (round_up_sec(e->size_bytes) / 512);
+}
 
-        unsigned int num_blobs = 0;
-        unsigned int blobs_deleted = 0;
-        unsigned int blobs_undeletable = 0;
-        unsigned int blobs_unopenable = 0;
-        unsigned int to_delete_prev = 0;
-        unsigned int iterations = 1;
-        for (; iterations < 10; iterations++) { // outer loop for multiple iterations over the list
-            unsigned int to_delete = 0;
+//!
+//! Orders index entries for LRU revocation, as compare_bbs() does, with ties broken by ID
+//!
+//! @param[in] e1
+//! @param[in] e2
+//!
+//! @return TRUE if e1 was modified before e2 and should be revoked first
+//!
+static int index_lru_before(const blobstore_index_entry * e1, const blobstore_index_entry * e2)
+{
+    if (e1->last_modified != e2->last_modified)
+        return (e1->last_modified < e2->last_modified);
+    return (strcmp(e1->id, e2->id) < 0);
+}
 
-            // run through LL, examining each blockblob
-            for (blockblob * abb = bbs; abb; abb = abb->next) {
-                if (iterations == 1)
-                    num_blobs++;       // count all blobs on the first iteration
+//!
+//! Swaps two entries of the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] i
+//! @param[in] j
+//!
+static void index_heap_swap(blobstore_index * idx, unsigned int i, unsigned int j)
+{
+    blobstore_index_entry *e = idx->heap[i];
 
-                if (abb->store == NULL) // these were cleared or condemned on a previous iteration
-                    continue;
+    idx->heap[i] = idx->heap[j];
+    idx->heap[j] = e;
+    idx->heap[i]->heap_pos = i + 1;
+    idx->heap[j]->heap_pos = j + 1;
+}
 
-                // examiner(), if specified, tell us whether to delete the blob
-                if (blockblob_check(abb) || // blob state is inconsistent
-                    (examiner && examiner(abb))) {  // blobstore user condemned the blob
+//!
+//! Moves the entry at position 'i' of the LRU heap up or down to where its timestamp puts it
+//!
+//! @param[in] idx
+//! @param[in] i
+//!
+static void index_heap_sift(blobstore_index * idx, unsigned int i)
+{
+    while ((i > 0) && index_lru_before(idx->heap[i], idx->heap[(i - 1) / 2])) {
+        index_heap_swap(idx, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
 
-                    blockblob *bb = blockblob_open(bs, abb->id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
-                    if (bb != NULL) {
-                        if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+    for (;;) {
+        unsigned int least = i;
+        unsigned int left = 2 * i + 1;
+        unsigned int right = 2 * i + 2;
+
+        if ((left < idx->heap_len) && index_lru_before(idx->heap[left], idx->heap[least]))
+            least = left;
+        if ((right < idx->heap_len) && index_lru_before(idx->heap[right], idx->heap[least]))
+            least = right;
+        if (least == i)
+            break;
+        index_heap_swap(idx, i, least);
+        i = least;
+    }
+}
 
-                            // Since we are checking integrity, do not trust .refs file blindly,
-                            // but ensure that the entries -- blobs depending on this one -- exist
+//!
+//! Takes an entry out of the LRU heap, if it is there
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_heap_remove(blobstore_index * idx, blobstore_index_entry * e)
+{
+    unsigned int i = 0;
 
-                            char **stale_refs;
-                            int num_stale_refs = get_stale_refs(bb, &stale_refs);
-                            if (num_stale_refs > 0) {
-                                for (int i = 0; i < num_stale_refs; i++) {
-                                    // update the .refs file to remove this entry
-                                    LOGINFO("removing stale/corrupted reference in blob %s to %s\n", bb->id, stale_refs[i]);
-                                    update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, stale_refs[i], 1);
-                                    EUCA_FREE(stale_refs[i]);
-                                }
-                                EUCA_FREE(stale_refs);
-                            }
-                            // mapped blobs have children, thus cannot be deleted at this iteration
-                            blockblob_close(bb);
-                            to_delete++;
+    if (e->heap_pos == 0)
+        return;
 
-                        } else if (blockblob_delete(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
-                            LOGWARN("WARNING: failed to delete blockblob %s\n", abb->id);
-                            blockblob_close(bb);
-                            abb->store = NULL;  // so it will get skipped on next iteration
-                            blobs_undeletable++;
+    i = e->heap_pos - 1;
+    e->heap_pos = 0;
+    idx->heap_len--;
+    if (i < idx->heap_len) {
+        idx->heap[i] = idx->heap[idx->heap_len];
+        idx->heap[i]->heap_pos = i + 1;
+        index_heap_sift(idx, i);
+    }
+}
 
-                        } else {
-                            LOGINFO("deleted stale/corrupted blob %s\n", abb->id);
-                            abb->store = NULL;  // so it will get skipped on next iteration
-                            blobs_deleted++;
-                        }
-                    } else {
-                        LOGWARN("could not open blockblob %s (it may be in use)\n", abb->id);
-                        abb->store = NULL;  // so it will get skipped on next iteration
-                        blobs_unopenable++;
-                    }
-                }
-            }
-            assert(iterations < 11);
+//!
+//! Takes the recorded state of a blob out of the blobstore totals, before it is changed
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_detach(blobstore_index * idx, blobstore_index_entry * e)
+{
+    idx->blocks_used -= index_entry_blocks(e);
+}
 
-            if (to_delete == to_delete_prev)    // could not delete anything new this iteration
-                break;
-            to_delete_prev = to_delete;
-            if (to_delete == 0)
+//!
+//! Accounts for the newly recorded state of a blob: adds it to the blobstore totals and
+//! puts the entry where its timestamp belongs in the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_attach(blobstore_index * idx, blobstore_index_entry * e)
+{
+    e->is_known = TRUE;
+    index_set_pending(idx, e, 0);
+    idx->blocks_used += index_entry_blocks(e);
+
+    if (e->heap_pos == 0) {
+        if (idx->heap_len == idx->heap_size) {
+            unsigned int heap_size = (idx->heap_size) ? (2 * idx->heap_size) : (BLOBSTORE_INDEX_BUCKETS);
+            blobstore_index_entry **heap = EUCA_REALLOC(idx->heap, heap_size, sizeof(blobstore_index_entry *));
+            if (heap == NULL)
+                return;                // the blob will not be revoked, but is otherwise accounted for
+            idx->heap = heap;
+            idx->heap_size = heap_size;
+        }
+        idx->heap[idx->heap_len++] = e;
+        e->heap_pos = idx->heap_len;
+    }
+    index_heap_sift(idx, e->heap_pos - 1);
+}
+
+//!
+//! Marks an entry as pending on behalf of process 'pid', or as settled if 'pid' is 0,
+//! keeping the list of pending entries up to date
+//!
+//! @param[in] idx
+//! @param[in] e
+//! @param[in] pid
+//!
+static void index_set_pending(blobstore_index * idx, blobstore_index_entry * e, pid_t pid)
+{
+    if (pid && !e->pending) {
+        e->next_pending = idx->pending;
+        idx->pending = e;
+    } else if (!pid && e->pending) {
+        for (blobstore_index_entry ** pe = &(idx->pending); *pe; pe = &((*pe)->next_pending)) {
+            if (*pe == e) {
+                *pe = e->next_pending;
                 break;
+            }
         }
-
-        if (num_blobs > 0)
-            LOGINFO("%s: examined %d blob(s) in %d iteration(s): "
-                    "deleted %d, failed on %d + %d, failed to open %d\n", bs->path, num_blobs, iterations, blobs_deleted, to_delete_prev, blobs_undeletable, blobs_unopenable);
-    }
-free:
-    if (bbs) {
-        free_bbs(bbs);
+        e->next_pending = NULL;
     }
-
-    return ret;
+    e->pending = pid;
 }
 
 //!
+//! Applies one index record to the in-memory index. The records are:
 //!
+//!   B pid id - process 'pid' is about to change blob 'id'
+//!   U size_bytes blocks_allocated last_accessed last_modified in_use is_hollow id - current state of blob 'id'
+//!   D id - blob 'id' no longer exists
 //!
-//! @param[in]  bs
-//! @param[in]  regex
-//! @param[out] results
+//! @param[in] idx
+//! @param[in] record
 //!
-//! @return
+//! @return 0 on success and -1 if the record is malformed (or out of memory)
 //!
-//! @pre
+static int index_apply(blobstore_index * idx, const char *record)
+{
+    int n = 0;
+    int pid = 0;
+    unsigned int in_use = 0;
+    unsigned int is_hollow = 0;
+    long long last_accessed = 0;
+    long long last_modified = 0;
+    unsigned long long size_bytes = 0;
+    unsigned long long blocks_allocated = 0;
+    blobstore_index_entry *e = NULL;
+
+    switch (record[0]) {
+    case 'B':
+        if ((sscanf(record, "B %d %n", &pid, &n) < 1) || (n == 0) || (record[n] == '\0'))
+            return -1;
+        if ((e = index_lookup(idx, record + n, TRUE)) == NULL)
+            return -1;
+        index_set_pending(idx, e, pid);
+        break;
+    case 'U':
+        if ((sscanf(record, "U %llu %llu %lld %lld %u %u %n", &size_bytes, &blocks_allocated, &last_accessed, &last_modified, &in_use, &is_hollow, &n) < 6)
+            || (n == 0) || (record[n] == '\0'))
+            return -1;
+        if ((e = index_lookup(idx, record + n, TRUE)) == NULL)
+            return -1;
+        index_detach(idx, e);
+        e->size_bytes = size_bytes;
+        e->blocks_allocated = blocks_allocated;
+        e->last_accessed = (time_t) last_accessed;
+        e->last_modified = (time_t) last_modified;
+        e->in_use = in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED);
+        e->is_hollow = (is_hollow != 0);
+        index_attach(idx, e);
+        break;
+    case 'D':
+        if ((record[1] != ' ') || (record[2] == '\0'))
+            return -1;
+        index_remove(idx, record + 2);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
 //!
-//! @note
+//! Replays the complete records of an index file, from 'offset' to its end, into the in-memory
+//! index. A file must start with an epoch record 'E epoch boot_id', which may appear nowhere else.
+//! An incomplete last line is left alone, as it may still be being appended.
 //!
-int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results)
+//! @param[in]     idx
+//! @param[in]     fd the index file
+//! @param[in,out] offset where to start, moved past the records replayed
+//! @param[out]    epoch set to the epoch of the file when reading from its start, must be NULL otherwise
+//!
+//! @return the number of records applied or -1 if the file is damaged, from another boot or cannot be read
+//!
+static int index_replay(blobstore_index * idx, int fd, off_t * offset, long long *epoch)
 {
-    blockblob_meta *head = NULL;
-    blockblob *bbs = NULL;
-    int ret = 0;
-    regex_t re;
+    int applied = 0;
+    char *buf = NULL;
+    char *line = NULL;
+    char *end = NULL;
+    ssize_t len = 0;
+    struct stat sb = { 0 };
 
-    if (regcomp(&re, regex, REG_NOSUB) != 0) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to parse search regular expression");
+    if (fstat(fd, &sb) == -1)
         return -1;
-    }
+    if (sb.st_size <= *offset)
+        return ((*offset == 0) ? (-1) : (0));   // an empty file lacks the epoch record
 
-    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
-        ret = -1;
-        goto free;
-    }
-    // put existing items in the blobstore into a LL
-    _blobstore_errno = BLOBSTORE_ERROR_OK;
-    bbs = scan_blobstore(bs, NULL);
-    if (bbs == NULL) {
-        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-            ret = -1;
-            goto free;
-        }
+    if ((buf = EUCA_ALLOC((sb.st_size - *offset + 1), sizeof(char))) == NULL)
+        return -1;
+    if ((len = pread(fd, buf, (sb.st_size - *offset), *offset)) < 0) {
+        EUCA_FREE(buf);
+        return -1;
     }
-    // run through LL, looking for matches
-    unsigned int num_blobs = 0;
-    unsigned int blobs_matched = 0;
-    blockblob_meta *prev = NULL;
-    for (blockblob * abb = bbs; abb; abb = abb->next) {
-        num_blobs++;
-        if (regexec(&re, abb->id, 0, NULL, 0) != 0)
-            continue;
-        blobs_matched++;
-
-        blockblob_meta *bm = EUCA_ZALLOC(1, sizeof(blockblob_meta));
-        if (bm == NULL) {
-            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-            ret = -1;
-            goto free;
-        }
-
-        euca_strncpy(bm->id, abb->id, sizeof(bm->id));
-        bm->bs = bs;
-        bm->size_bytes = abb->size_bytes;
-        bm->in_use = abb->in_use;
-        bm->is_hollow = abb->is_hollow;
-        bm->last_accessed = abb->last_accessed;
-        bm->last_modified = abb->last_modified;
-        if (head == NULL) {
-            head = bm;
+    buf[len] = '\0';
+
+    for (line = buf; line < (buf + len);) {
+        char *nl = memchr(line, '\n', (buf + len) - line);
+        if (nl == NULL)
+            break;                     // incomplete record, still being appended
+        *nl = '\0';
+
+        // every record is prefixed with its checksum, which catches torn and garbled writes
+        unsigned int sum = strtoul(line, &end, 16);
+        if (((nl - line) < 11) || (end != (line + 8)) || (line[8] != ' ') || (sum != index_hash(line + 9, nl - line - 9)))
+            goto bad;
+
+        const char *record = line + 9;
+        boolean at_start = ((*offset == 0) && (line == buf));
+        if (at_start != (record[0] == 'E')) {
+            goto bad;
+        } else if (at_start) {
+            char boot_id[64] = "";
+            if ((epoch == NULL) || (sscanf(record, "E %lld %63s", epoch, boot_id) != 2) || strcmp(boot_id, index_boot_id()))
+                goto bad;
+        } else if (index_apply(idx, record)) {
+            goto bad;
         } else {
-            prev->next = bm;
-            bm->prev = prev;
+            applied++;
         }
-        prev = bm;
-    }
-
-    *results = head;
-    ret = blobs_matched;
-
-free:
-    regfree(&re);                      // free the regular expression
-    if (bbs)
-        free_bbs(bbs);                 // free the blockblobs LL returned by the search function
-
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-        ret = -1;
+        line = nl + 1;
     }
 
-    if (ret < 0) {                     // there were problems, so free the partial linked list, if any
-        for (blockblob_meta * bm = head; bm;) {
-            blockblob_meta *next = bm->next;
-            EUCA_FREE(bm);
-            bm = next;
-        }
-    }
+    *offset += (line - buf);
+    idx->records += applied;
+    EUCA_FREE(buf);
+    return applied;
 
-    return ret;
+bad:
+    EUCA_FREE(buf);
+    return -1;
 }
 
 //!
+//! Writes an index file, through a temporary file that is synced and renamed
+//! over the old one, so that the file is either entirely old or entirely new
 //!
+//! @param[in]  bs
+//! @param[in]  name either BLOBSTORE_INDEX_FILE or BLOBSTORE_JOURNAL_FILE
+//! @param[in]  idx entries to write (a snapshot) or NULL for just the epoch record (a new journal)
+//! @param[in]  epoch
+//! @param[out] ino if not NULL, set to the inode of the new file
+//! @param[out] size if not NULL, set to the size of the new file
 //!
-//! @param[in] bs
-//! @param[in] regex
+//! @return 0 on success and -1 on error
 //!
-//! @return
+static int index_write_file(const blobstore * bs, const char *name, blobstore_index * idx, long long epoch, ino_t * ino, off_t * size)
+{
+    int fd = -1;
+    int len = 0;
+    FILE *fp = NULL;
+    char path[PATH_MAX] = "";
+    char tmp_path[PATH_MAX] = "";
+    char record[BLOBSTORE_MAX_PATH + 128] = "";
+    char line[BLOBSTORE_MAX_PATH + 160] = "";
+    struct stat sb = { 0 };
+
+    index_file_path(bs, name, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (((fd = open(tmp_path, (O_WRONLY | O_CREAT | O_TRUNC), BLOBSTORE_FILE_PERM)) == -1) || ((fp = fdopen(fd, "w")) == NULL)) {
+        if (fd != -1)
+            close(fd);
+        goto error;
+    }
+
+    snprintf(record, sizeof(record), "E %lld %s", epoch, index_boot_id());
+    if (((len = index_format_record(line, sizeof(line), record)) == -1) || (fwrite(line, 1, len, fp) != len))
+        goto error;
+
+    for (unsigned int b = 0; (idx != NULL) && (b < idx->nbuckets); b++) {
+        for (blobstore_index_entry * e = idx->buckets[b]; e; e = e->next) {
+            if (e->is_known) {
+                snprintf(record, sizeof(record), "U %llu %llu %lld %lld %u %u %s", e->size_bytes, e->blocks_allocated, (long long)e->last_accessed,
+                         (long long)e->last_modified, e->in_use, e->is_hollow, e->id);
+                if (((len = index_format_record(line, sizeof(line), record)) == -1) || (fwrite(line, 1, len, fp) != len))
+                    goto error;
+            }
+            if (e->pending) {
+                snprintf(record, sizeof(record), "B %d %s", e->pending, e->id);
+                if (((len = index_format_record(line, sizeof(line), record)) == -1) || (fwrite(line, 1, len, fp) != len))
+                    goto error;
+            }
+        }
+    }
+
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0) || (fstat(fileno(fp), &sb) != 0))
+        goto error;
+    if (fclose(fp) != 0) {
+        fp = NULL;
+        goto error;
+    }
+    fp = NULL;
+    if (rename(tmp_path, path) == -1)
+        goto error;
+
+    if (ino)
+        *ino = sb.st_ino;
+    if (size)
+        *size = sb.st_size;
+    return 0;
+
+error:
+    LOGWARN("failed to write index file %s\n", path);
+    if (fp)
+        fclose(fp);
+    unlink(tmp_path);
+    return -1;
+}
+
 //!
-//! @pre
+//! Writes the in-memory index out as a new snapshot and starts a new, empty journal.
+//! The journal stays locked throughout, so no record gets appended to the old journal
+//! after it has been replayed. Blobs left pending by processes that no longer exist
+//! are settled from their files first.
 //!
-//! @note
+//! @param[in] bs
 //!
-int blobstore_delete_regex(blobstore * bs, const char *regex)
+//! @return 0 on success and -1 on error
+//!
+//! @pre The blobstore must be locked and bs->index loaded.
+//!
+static int index_compact(blobstore * bs)
 {
-    blockblob_meta *matches = NULL;
-    int found = blobstore_search(bs, regex, &matches);
-    int left_to_delete = found;
-    int deleted;
-    do {
-        // iterate multiple times in case there are dependencies
-        //! @TODO unify with _fsck's iteration code?
-        deleted = 0;                   // deleted in this round
-        for (blockblob_meta * bm = matches; bm; bm = bm->next) {
-            blockblob *bb = blockblob_open(bs, bm->id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
-            if (bb != NULL) {
-                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
-                    // mapped blobs have children, thus cannot be deleted at this iteration
-                    blockblob_close(bb);
-                    continue;
-                }
-                if (blockblob_delete(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 0) == -1) {
-                    blockblob_close(bb);
-                } else {
-                    deleted++;
-                }
+    int fd = -1;
+    int ret = -1;
+    ino_t ino = 0;
+    off_t size = 0;
+    char path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+    blobstore_index *idx = bs->index;
+
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    if ((flock(fd, LOCK_EX) == -1) || (fstat(fd, &sb) == -1) || (sb.st_ino != idx->journal_ino))
+        goto out;
+    if (index_replay(idx, fd, &(idx->journal_offset), NULL) < 0)
+        goto out;
+
+    for (blobstore_index_entry * e = idx->pending; e;) {
+        blobstore_index_entry *next = e->next_pending;
+        if ((kill(e->pending, 0) == -1) && (errno == ESRCH)) {
+            blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+            if (bb == NULL)
+                goto out;
+            if (index_derive(bs, e->id, bb) == -1) {
+                index_remove(idx, e->id);
+            } else {
+                index_detach(idx, e);
+                e->size_bytes = bb->size_bytes;
+                e->blocks_allocated = bb->blocks_allocated;
+                e->last_accessed = bb->last_accessed;
+                e->last_modified = bb->last_modified;
+                e->in_use = bb->in_use;
+                e->is_hollow = bb->is_hollow;
+                index_attach(idx, e);
             }
+            EUCA_FREE(bb);
         }
-    } while (deleted && (left_to_delete -= deleted));
-
-    // free the search results
-    for (blockblob_meta * bm = matches; bm;) {
-        blockblob_meta *next = bm->next;
-        EUCA_FREE(bm);
-        bm = next;
+        e = next;
     }
 
-    return (left_to_delete == 0) ? (found) : (-1);
+    // the snapshot goes first: until the new journal replaces the old one, their epochs differ and the index gets rebuilt
+    if (index_write_file(bs, BLOBSTORE_INDEX_FILE, idx, (idx->epoch + 1), NULL, NULL)
+        || index_write_file(bs, BLOBSTORE_JOURNAL_FILE, NULL, (idx->epoch + 1), &ino, &size))
+        goto out;
+
+    LOGDEBUG("compacted index of blobstore %s: %u blob(s), %u journal record(s) folded in\n", bs->path, idx->count, idx->records);
+    idx->epoch++;
+    idx->journal_ino = ino;
+    idx->journal_offset = size;
+    idx->records = 0;
+    ret = 0;
+
+out:
+    close(fd);                         // also releases the lock
+    return ret;
 }
 
 //!
-//!
+//! Rebuilds the index of a blobstore by walking its directory tree. A new journal is
+//! started before the walk, so changes made by others while the walk is in progress
+//! are recorded and replayed on top of what the walk found.
 //!
 //! @param[in] bs
-//! @param[in] id can be NULL if creating, in which case blobstore will pick a random ID
-//! @param[in] size_bytes on create: reserve this size; on open: verify the size, unless set to 0
-//! @param[in] flags BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL - same semantcs as for open() flags, BLOBSTORE_FLAG_HOLLOW - when creating
-//! @param[in] sig if non-NULL, on create sig is recorded, on open it is verified
-//! @param[in] timeout_usec maximum wait, in microseconds
-//!
-//! @return
 //!
-//! @pre
+//! @return 0 on success and -1 on error, in which case bs->index is NULL
 //!
-//! @note
+//! @pre The blobstore must be locked.
 //!
-blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long size_bytes, unsigned int flags, const char *sig, unsigned long long timeout_usec)
+static int index_rebuild(blobstore * bs)
 {
-    long long size_blocks = round_up_sec(size_bytes) / 512;
-    if (flags & ~(BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL | BLOBSTORE_FLAG_HOLLOW)) {
-        ERR(BLOBSTORE_ERROR_INVAL, "only _CREAT, _EXCL, & _HOLLOW flags are allowed");
-        return NULL;
-    }
-    if (id == NULL && !(flags & BLOBSTORE_FLAG_CREAT)) {
-        ERR(BLOBSTORE_ERROR_INVAL, "NULL id is only allowed with _CREAT");
-        return NULL;
-    }
-    if (size_blocks == 0 && (flags & BLOBSTORE_FLAG_CREAT)) {
-        ERR(BLOBSTORE_ERROR_INVAL, "size_blocks can be 0 only without _CREAT");
-        return NULL;
-    }
-    if (size_blocks != 0 && (flags & BLOBSTORE_FLAG_CREAT) && (size_blocks > bs->limit_blocks) && !(flags && BLOBSTORE_FLAG_HOLLOW)) {
-        ERR(BLOBSTORE_ERROR_NOSPC, NULL);
-        return NULL;
-    }
+    ino_t ino = 0;
+    off_t size = 0;
+    blockblob *bbs = NULL;
+    blobstore_index *idx = NULL;
+    long long epoch = (((long long)random()) << 31) ^ random();
 
-    LOGTRACE("{%u} blockblob_open: opening blob id=%s flags=%d timeout=%lld\n", (unsigned int)pthread_self(), id, flags, timeout_usec);
+    index_free(bs->index);
+    bs->index = NULL;
 
-    blockblob *bbs = NULL;             // a temp LL of blockblobs, used for computing free space and for purging
-    blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
-    if (bb == NULL) {
-        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-        goto out;
-    }
+    if ((idx = index_alloc()) == NULL)
+        return -1;
+    if (index_write_file(bs, BLOBSTORE_JOURNAL_FILE, NULL, epoch, &ino, &size))
+        goto error;
+    idx->epoch = epoch;
+    idx->journal_ino = ino;
+    idx->journal_offset = size;
 
-    bb->store = bs;
-    if (id) {
-        euca_strncpy(bb->id, id, sizeof(bb->id));
-    } else {
-        gen_id(bb->id, sizeof(bb->id));
+    if (walk_bs(bs, bs->path, &bbs, NULL) == NULL)
+        goto error;
+    for (blockblob * bb = bbs; bb; bb = bb->next) {
+        blobstore_index_entry *e = index_lookup(idx, bb->id, TRUE);
+        if (e == NULL)
+            goto error;
+        e->size_bytes = bb->size_bytes;
+        e->blocks_allocated = bb->blocks_allocated;
+        e->last_accessed = bb->last_accessed;
+        e->last_modified = bb->last_modified;
+        e->in_use = bb->in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED);
+        e->is_hollow = bb->is_hollow;
+        index_attach(idx, e);
     }
-    bb->fd_lock = -1;
-    bb->fd_blocks = -1;
-    bb->size_bytes = size_bytes;
-    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+    free_bbs(bbs);
+    bbs = NULL;
 
-    int blobstore_locked = 0;
-    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can create blob's file atomically
-        goto free;                     // failed to obtain a lock on the blobstore
-    } else {
-        blobstore_locked = 1;
-    }
+    bs->index = idx;
+    if (index_compact(bs))
+        goto error;
 
-    //! @TODO maybe don't create directories needlessly if flags==0?
-    int created_directory = ensure_blockblob_metadata_path(bs, bb->id);
-    if (created_directory == -1) {
-        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-        goto unlock;
-    }
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-        goto free;
-    }
-    blobstore_locked = 0;
+    LOGINFO("rebuilt index of blobstore %s with %u blob(s)\n", bs->path, idx->count);
+    return 0;
 
-    int created_blob = 0;
-    char lpath[PATH_MAX];
-    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb->id, lpath, sizeof(lpath));
-    bb->fd_lock = open_and_lock(lpath, flags | BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM); // blobs are always opened with exclusive write access
-    if (bb->fd_lock == -1) {
-        // failed to open/create and lock the blockblob
-        goto clean;
+error:
+    LOGWARN("failed to rebuild index of blobstore %s\n", bs->path);
+    free_bbs(bbs);
+    index_free(idx);
+    bs->index = NULL;
+    return -1;
+}
+
+//!
+//! Brings the in-memory index of a blobstore up to date: loads the snapshot and the
+//! journal the first time, replays what others appended to the journal since on later
+//! calls, rebuilds the index if its files are missing, damaged or inconsistent, and
+//! compacts the journal once it grows long.
+//!
+//! @param[in] bs
+//!
+//! @return 0 on success and -1 on error, in which case bs->index is NULL
+//!
+//! @pre The blobstore must be locked.
+//!
+static int index_load(blobstore * bs)
+{
+    int fd = -1;
+    off_t offset = 0;
+    long long snapshot_epoch = -1;
+    long long journal_epoch = -1;
+    char path[PATH_MAX] = "";
+    char snapshot_path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+    blobstore_index *idx = bs->index;
+
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if (idx != NULL) {
+        // catch up with the records appended since the last look
+        if ((stat(path, &sb) == 0) && (sb.st_ino == idx->journal_ino) && ((fd = open(path, O_RDONLY)) != -1)) {
+            int replayed = index_replay(idx, fd, &(idx->journal_offset), NULL);
+            close(fd);
+            if (replayed >= 0)
+                goto loaded;
+        }
+        // the journal was compacted or rebuilt by another process (or is damaged), so start over
+        index_free(idx);
+        bs->index = NULL;
     }
-    char thread_id[512];
-    int thread_id_len = 0;
-    snprintf(thread_id, sizeof(thread_id), "%d/%u", getpid(), (unsigned int)pthread_self());
-    thread_id_len = strlen(thread_id);
-    if (write(bb->fd_lock, thread_id, thread_id_len) != thread_id_len) {
-        // Fail to write our thread indentifier in the lock file.
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to write to the blobstore");
-        goto clean;
+
+    if ((idx = index_alloc()) == NULL)
+        return -1;
+
+    index_file_path(bs, BLOBSTORE_INDEX_FILE, snapshot_path, sizeof(snapshot_path));
+    if ((fd = open(snapshot_path, O_RDONLY)) != -1) {
+        if (index_replay(idx, fd, &offset, &snapshot_epoch) < 0)
+            snapshot_epoch = -1;
+        close(fd);
     }
-    // convert BLOBSTORE_* flags into standard Posix open() flags and open/create the blocks file
-    int o_flags = 0;
-    if (flags & BLOBSTORE_FLAG_RDONLY) {
-        o_flags |= O_RDONLY;
-    } else if ((flags & BLOBSTORE_FLAG_RDWR) || (flags & BLOBSTORE_FLAG_CREAT)) {
-        o_flags |= O_RDWR;
-        if (flags & BLOBSTORE_FLAG_CREAT) {
-            o_flags |= O_CREAT;
-            // intentionally ignore _EXCL supplied without _CREAT
-            if (flags & BLOBSTORE_FLAG_EXCL)
-                o_flags |= O_EXCL;
+    idx->records = 0;
+
+    offset = 0;
+    if ((snapshot_epoch != -1) && ((fd = open(path, O_RDONLY)) != -1)) {
+        if ((fstat(fd, &sb) == 0) && (index_replay(idx, fd, &offset, &journal_epoch) >= 0) && (journal_epoch == snapshot_epoch)) {
+            idx->epoch = snapshot_epoch;
+            idx->journal_ino = sb.st_ino;
+            idx->journal_offset = offset;
+            bs->index = idx;
         }
+        close(fd);
     }
-    bb->fd_blocks = open(bb->blocks_path, o_flags, BLOBSTORE_FILE_PERM);
-    if (bb->fd_blocks == -1) {         // failed to open/create the content file
-        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-        goto clean;
+
+    if (bs->index == NULL) {
+        index_free(idx);
+        if (index_rebuild(bs))
+            return -1;
     }
 
-    struct stat sb;
-    if (fstat(bb->fd_blocks, &sb) == -1) {
-        goto clean;
+loaded:
+    idx = bs->index;
+    if (idx->records > (BLOBSTORE_JOURNAL_SLACK + 2 * idx->count)) {
+        if (index_compact(bs)) {
+            index_free(bs->index);
+            bs->index = NULL;
+            return -1;
+        }
     }
+    return 0;
+}
 
-    if (sb.st_size == 0) {             // new blob
-        created_blob = 1;
+//!
+//! Fills in a blob structure, in the manner of walk_bs(), from what the index recorded about the blob
+//!
+//! @param[in]  bs
+//! @param[in]  e
+//! @param[out] bb zeroed blob to fill in, with the in_use flags kept in metadata files only
+//!
+static void index_fill_bb(blobstore * bs, const blobstore_index_entry * e, blockblob * bb)
+{
+    bb->store = bs;
+    euca_strncpy(bb->id, e->id, sizeof(bb->id));
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+    bb->size_bytes = e->size_bytes;
+    bb->blocks_allocated = e->blocks_allocated;
+    bb->last_accessed = e->last_accessed;
+    bb->last_modified = e->last_modified;
+    bb->is_hollow = e->is_hollow;
+    bb->in_use = e->in_use;
+}
 
-        if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse blobstore safely
-            goto clean;                // failed to obtain a lock on the blobstore
-        } else {
-            blobstore_locked = 1;
-        }
+//!
+//! Puts the blobs recorded in the index into a linked list, in the manner of walk_bs(), without
+//! reading the directory tree. Only the .lock file of each listed blob is looked at, to find out
+//! whether it is open; blobs in the middle of a change are read from their files.
+//!
+//! @param[in]  bs
+//! @param[in]  bb_to_avoid
+//! @param[in]  re if not NULL, only blobs with IDs matching this regular expression are listed
+//! @param[out] bbs set to the head of the list
+//!
+//! @return 0 on success and -1 if the index is not available
+//!
+//! @pre The blobstore must be locked.
+//!
+static int index_scan(blobstore * bs, const blockblob * bb_to_avoid, const regex_t * re, blockblob ** bbs)
+{
+    blockblob **tail_bb = bbs;
+    blobstore_index *idx = NULL;
 
-        // put existing items in the blobstore into a LL
-        _blobstore_errno = BLOBSTORE_ERROR_OK;
-        bbs = scan_blobstore(bs, bb);
-        if (bbs == NULL) {
-            if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-                goto clean;
-            }
-        }
-        // a bit of a hack: HOLLOW blobs skip the blobstore limit check upon creation
-        if (flags & BLOBSTORE_FLAG_HOLLOW) {
-            bb->is_hollow = TRUE;
-            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, "this blob is hollow\n"))
-                goto clean;
+    *bbs = NULL;
+    if (index_load(bs))
+        return -1;
 
-        } else {                       // enforce blobstore limits
+    idx = bs->index;
+    for (unsigned int b = 0; b < idx->nbuckets; b++) {
+        for (blobstore_index_entry * e = idx->buckets[b]; e; e = e->next) {
+            if (!e->is_known && !e->pending)
+                continue;
+            if (bb_to_avoid != NULL && strcmp(e->id, bb_to_avoid->id) == 0)
+                continue;              // avoid that particular blockblob
+            if (re != NULL && regexec(re, e->id, 0, NULL, 0) != 0)
+                continue;
 
-            // analyze the LL, calculating sizes
-            long long blocks_unlocked = 0;
-            long long blocks_locked = 0;
-            unsigned int num_blobs = 0;
-            for (blockblob * abb = bbs; abb; abb = abb->next) {
-                long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
-                if (abb->is_hollow)
-                    abb_size_blocks = 0;
-                if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
-                    // these can't be purged if we need space
-                    //! @TODO look into recursive purging of unused references?
-                    blocks_locked += abb_size_blocks;
-                } else {
-                    blocks_unlocked += abb_size_blocks; // these potentially can be purged, unless they are depended on by locked ones
-                }
-                num_blobs++;
+            blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+            if (bb == NULL) {
+                free_bbs(*bbs);
+                *bbs = NULL;
+                return -1;
             }
 
-            long long blocks_free = bs->limit_blocks - (blocks_unlocked + blocks_locked);
-            if (blocks_free < size_blocks) {
-                if (!(bs->revocation_policy == BLOBSTORE_REVOCATION_LRU)    // not allowed to purge
-                    || (blocks_free + blocks_unlocked) < size_blocks) { // not enough purgeable material
-                    ERR(BLOBSTORE_ERROR_NOSPC, NULL);
-                    goto clean;
-                }
-                long long blocks_needed = size_blocks - blocks_free;
-                _err_off();            // do not care about errors duing purging
-                long long blocks_freed = purge_blockblobs_lru(bs, bbs, blocks_needed);
-                _err_on();
-                if (blocks_freed < blocks_needed) {
-                    ERR(BLOBSTORE_ERROR_NOSPC, "could not purge enough from cache");
-                    goto clean;
+            if (e->pending) {
+                // the blob is being changed, or a change was interrupted, so its files are the authority
+                if (index_derive(bs, e->id, bb) == -1) {
+                    EUCA_FREE(bb);
+                    continue;
                 }
+            } else {
+                index_fill_bb(bs, e, bb);
             }
-        }
-
-        if (lseek(bb->fd_blocks, size_bytes - 1, SEEK_CUR) == (off_t) - 1) {    // create a file with a hole
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto clean;
-        }
-        if (write(bb->fd_blocks, zero_buf, 1) != (ssize_t) 1) {
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto clean;
-        }
-        if (sig)
-            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, sig)) {
-                goto clean;
-            }
-        bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;    // just created, so not a snapshot
-
-        if (blobstore_unlock(bs) == -1) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-        }
-        blobstore_locked = 0;
-
-    } else {                           // blob existed
-
-        char buf[BLOBSTORE_SIG_MAX];
-
-        if (bb->size_bytes == 0) {     // find out the size from the file size
-            bb->size_bytes = sb.st_size;
-        } else if (bb->size_bytes != sb.st_size) {  // verify the size specified by the user
-            LOGERROR("{%u} encountered a size mismatch when opening a blob (requested %lld, found %ld)\n", (unsigned int)pthread_self(), bb->size_bytes, sb.st_size);
-            ERR(BLOBSTORE_ERROR_SIGNATURE, "size of the existing blockblob does not match");
-            goto clean;
-        }
-        // determine whether this blob is a map of another,
-        // in which case the blocks are backing and should
-        // not be accessed directly
-        if (read_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bs, bb->id, buf, sizeof(buf)) > 0) {
-            bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;
-        } else {
-            bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;
-        }
-
-        // check if its hollow
-        if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, buf, sizeof(buf)) != -1) {
-            bb->is_hollow = TRUE;
-        }
-
-        if (sig && (strlen(sig) > 0)) { // check the signature, if there
-            int sig_size;
-            if ((sig_size = read_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, buf, sizeof(buf))) != strlen(sig)
-                || (strncmp(sig, buf, sig_size) != 0)) {
-                LOGERROR("{%u} encountered signature mismatch when opening a blob (requested size [%ld], found [%d])\n", (unsigned int)pthread_self(), strlen(sig), sig_size);
-                ERR(BLOBSTORE_ERROR_SIGNATURE, NULL);
-                goto clean;
-            }
-        }
-        // check its in-use status
-        bb->in_use = check_in_use(bs, bb->id, 0);
-    }
-
-    {                                  // create a loopback device, if there isn't a valid one already (this may happen whether the blob is new or old)
-        char lo_dev[PATH_MAX] = "";
-        struct stat sb;
-
-        _err_off();                    // do not care if loopback file does not exist
-        read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb->id, lo_dev, sizeof(lo_dev));
-        _err_on();
-        if ((strlen(lo_dev) < 1)       // nothing in .loopback file
-            || (stat(lo_dev, &sb) == -1)    // something in .loopback that does not exist
-            || (!S_ISBLK(sb.st_mode))) {    // something in .loopback that is not block device
+            bb->snapshot_type = BLOBSTORE_FORMAT_ANY;   // it is not necessary to know whether this is a snapshot
+            bb->in_use |= check_in_use_lock(bs, bb->id, 0);
 
-            if (diskutil_loop(bb->blocks_path, 0, lo_dev, sizeof(lo_dev))) {
-                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to obtain a loopback device for a blockblob");
-                goto clean;
-            }
-            write_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb->id, lo_dev);
+            *tail_bb = bb;             // add to LL
+            tail_bb = &(bb->next);
         }
     }
 
-    set_device_path(bb);               // read .dm and .loopback and set bb->device_path accordingly
-
-    goto out;                          // all is well
-
-clean:
-    {
-        int saved_errno = _blobstore_errno; // save it because close_and_unlock() or delete_blockblob_files() may reset it
-        if (bb->fd_lock != -1) {
-            if (ftruncate(bb->fd_lock, 0) != 0) {
-                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
-            }
-            close_and_unlock(bb->fd_lock);
-        }
-        if (bb->fd_blocks != -1) {
-            close(bb->fd_blocks);
-        }
-        if (created_directory || created_blob) {    // only delete disk state if we created it
-            delete_blockblob_files(bs, bb->id);
-        }
-        if (saved_errno) {
-            _blobstore_errno = saved_errno;
-        }
-    }
+    _blobstore_errno = BLOBSTORE_ERROR_OK;  // missing metadata files of pending blobs are not errors
+    return 0;
+}
 
-unlock:
-    {
-        int saved_errno = _blobstore_errno;
-        if (blobstore_locked && blobstore_unlock(bs) == -1) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-            if (saved_errno) {
-                _blobstore_errno = saved_errno;
-            }
-        }
-    }
+//!
+//! Adds up the blocks taken up by the blobs in a blobstore that count toward its limit, as the
+//! blobstore_stat() and blockblob_open() walks would, without looking at every blob. Only the
+//! blobs in the middle of a change are read from their files.
+//!
+//! @param[in] bs
+//! @param[in] bb_to_avoid_id if not NULL, the blob with this ID is left out
+//!
+//! @return the number of 512-byte blocks
+//!
+//! @pre The blobstore must be locked and bs->index loaded.
+//!
+static long long index_blocks_used(blobstore * bs, const char *bb_to_avoid_id)
+{
+    blockblob *bb = NULL;
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry *e = NULL;
+    long long blocks_used = idx->blocks_used;
 
-free:
-    EUCA_FREE(bb);
+    if ((bb_to_avoid_id != NULL) && ((e = index_lookup(idx, bb_to_avoid_id, FALSE)) != NULL) && !e->pending)
+        blocks_used -= index_entry_blocks(e);
 
-out:
-    LOGTRACE("{%u} blockblob_open: done with blob id=%s ret=%p\n", (unsigned int)pthread_self(), id, bb);
-    if (bb == NULL) {
-        LOGTRACE("{%u} blockblob_open: errno=%d msg=%s\n", (unsigned int)pthread_self(), _blobstore_errno, blobstore_get_last_msg());
+    for (e = idx->pending; e; e = e->next_pending) {
+        blocks_used -= index_entry_blocks(e);   // what was recorded before the change may no longer hold
+        if ((bb_to_avoid_id != NULL) && !strcmp(e->id, bb_to_avoid_id))
+            continue;
+        if ((bb = EUCA_ZALLOC(1, sizeof(blockblob))) == NULL)
+            continue;
+        if ((index_derive(bs, e->id, bb) == 0) && !bb->is_hollow)
+            blocks_used += round_up_sec(bb->size_bytes) / 512;
+        EUCA_FREE(bb);
     }
 
-    free_bbs(bbs);
-    return bb;
+    _blobstore_errno = BLOBSTORE_ERROR_OK;  // missing metadata files of pending blobs are not errors
+    return blocks_used;
 }
 
 //!
+//! Adds a position of the LRU heap to the frontier used by index_lru_victims(), itself a
+//! min-heap of heap positions ordered by the entries at those positions
 //!
+//! @param[in]     idx
+//! @param[in]     frontier
+//! @param[in,out] len number of positions in the frontier
+//! @param[in]     pos position in idx->heap
 //!
-//! @param[in] bs
-//! @param[in] bb_id
+static void index_frontier_push(const blobstore_index * idx, unsigned int *frontier, unsigned int *len, unsigned int pos)
+{
+    unsigned int i = (*len)++;
+
+    for (; (i > 0) && index_lru_before(idx->heap[pos], idx->heap[frontier[(i - 1) / 2]]); i = (i - 1) / 2)
+        frontier[i] = frontier[(i - 1) / 2];
+    frontier[i] = pos;
+}
+
 //!
-//! @return
+//! Takes the position of the least recently used entry off the frontier
 //!
-//! @pre
+//! @param[in]     idx
+//! @param[in]     frontier
+//! @param[in,out] len number of positions in the frontier, must not be 0
 //!
-//! @note
+//! @return a position in idx->heap
 //!
-static int loop_remove(blobstore * bs, const char *bb_id)
+static unsigned int index_frontier_pop(const blobstore_index * idx, unsigned int *frontier, unsigned int *len)
 {
-    char path[PATH_MAX] = "";
-    int ret = 0;
-
-    _err_off();                        // do not care if loopback file does not exist
-    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));   // loads path of /dev/loop?
-    _err_on();
+    unsigned int i = 0;
+    unsigned int top = frontier[0];
+    unsigned int last = frontier[--(*len)];
 
-    if (strlen(path)) {
-        if (diskutil_unloop(path)) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove loopback device for blockblob");
-            ret = -1;
-        } else {
-            set_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));    // load path of .../loopback file itself
-            unlink(path);
-        }
+    for (;;) {
+        unsigned int child = 2 * i + 1;
+        if (child >= *len)
+            break;
+        if (((child + 1) < *len) && index_lru_before(idx->heap[frontier[child + 1]], idx->heap[frontier[child]]))
+            child++;
+        if (!index_lru_before(idx->heap[frontier[child]], idx->heap[last]))
+            break;
+        frontier[i] = frontier[child];
+        i = child;
     }
-
-    return ret;
+    frontier[i] = last;
+    return top;
 }
 
 //!
-//! releases the blob locks, allowing others to open() it, and frees the blockblob handle
-//!
-//! @param[in] bb
+//! Picks the least recently used blobs that could be revoked to free up 'need_blocks' blocks, in
+//! LRU order. The LRU heap is visited from the top, through a frontier of positions whose parents
+//! have been looked at, so only the candidates up to the last one picked are touched and nothing is
+//! sorted. Blobs that are open, have children or are in the middle of a change are passed over.
 //!
-//! @return
+//! @param[in]  bs
+//! @param[in]  bb_to_avoid
+//! @param[in]  need_blocks
+//! @param[out] victims set to the head of a list of the picked blobs, to be freed with free_bbs()
 //!
-//! @pre
+//! @return the number of blocks the picked blobs take up, which falls short of 'need_blocks' if there is not enough to revoke
 //!
-//! @note
+//! @pre The blobstore must be locked and bs->index loaded.
 //!
-int blockblob_close(blockblob * bb)
+static long long index_lru_victims(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks, blockblob ** victims)
 {
-    if (bb == NULL) {
-        ERR(BLOBSTORE_ERROR_INVAL, NULL);
-        return -1;
-    }
-    int ret = 0;
-    LOGTRACE("{%u} blockblob_close: closing blob id=%s\n", (unsigned int)pthread_self(), bb->id);
+    unsigned int len = 0;
+    unsigned int *frontier = NULL;
+    long long found_blocks = 0;
+    blockblob **tail_bb = victims;
+    blobstore_index *idx = bs->index;
+
+    *victims = NULL;
+    if ((idx->heap_len == 0) || ((frontier = EUCA_ALLOC(idx->heap_len, sizeof(unsigned int))) == NULL))
+        return 0;
 
-    // do not remove /dev/loop* if it is used by device mapper
-    // (we do not care about BLOCKBLOB_STATUS_OPENED because
-    // it should be only this thread that has the blob open)
-    int in_use = check_in_use(bb->store, bb->id, 0);
-    if (!(in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED))) {
-        ret = loop_remove(bb->store, bb->id);
-    }
-    ret |= close(bb->fd_blocks);
-    if (ftruncate(bb->fd_lock, 0) != 0) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+    _err_off();                        // do not complain about lock files of blobs that went away
+    index_frontier_push(idx, frontier, &len, 0);
+    while ((len > 0) && (found_blocks < need_blocks)) {
+        unsigned int pos = index_frontier_pop(idx, frontier, &len);
+        blobstore_index_entry *e = idx->heap[pos];
+
+        if ((2 * pos + 1) < idx->heap_len)
+            index_frontier_push(idx, frontier, &len, 2 * pos + 1);
+        if ((2 * pos + 2) < idx->heap_len)
+            index_frontier_push(idx, frontier, &len, 2 * pos + 2);
+
+        if (e->pending || (index_entry_blocks(e) == 0) || (e->in_use & BLOCKBLOB_STATUS_MAPPED))
+            continue;
+        if ((bb_to_avoid != NULL) && !strcmp(e->id, bb_to_avoid->id))
+            continue;
+        unsigned int in_use = check_in_use_lock(bs, e->id, 0);
+        if (in_use & BLOCKBLOB_STATUS_OPENED)
+            continue;
+
+        blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+        if (bb == NULL)
+            break;
+        index_fill_bb(bs, e, bb);
+        bb->snapshot_type = BLOBSTORE_FORMAT_ANY;
+        bb->in_use |= in_use;
+        found_blocks += index_entry_blocks(e);
+
+        *tail_bb = bb;                 // add to LL
+        tail_bb = &(bb->next);
     }
-    ret |= close_and_unlock(bb->fd_lock);
-    EUCA_FREE(bb);                     // we free the blob regardless of whether closing succeeds or not
-    return ret;
+    _err_on();
+
+    EUCA_FREE(frontier);
+    return found_blocks;
 }
 
 //!
+//! Checks, with the help of the index, whether there is room in the blobstore for a new blob
+//! and, under the LRU revocation policy, tries to make room by revoking the least recently
+//! used blobs. Neither the directory tree nor every blob is looked at.
 //!
+//! @param[in] bs
+//! @param[in] bb the blob being created
+//! @param[in] size_blocks its size
 //!
-//! @param[in] dev_name
-//!
-//! @return
-//!
-//! @pre
+//! @return 0 if there is room now and -1 if the blobstore has to be examined in full to find out
 //!
-//! @note
+//! @pre The blobstore must be locked.
 //!
-static int dm_suspend_resume(const char *dev_name)
+static int index_make_room(blobstore * bs, const blockblob * bb, long long size_blocks)
 {
-    int ret = EUCA_OK;
+    long long blocks_free = 0;
+    long long blocks_needed = 0;
+    long long blocks_freed = 0;
+    blockblob *victims = NULL;
 
-    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "suspend", dev_name, NULL)) != EUCA_OK) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with 'dmsetup'");
-        return (-1);
-    }
+    if (index_load(bs))
+        return -1;
 
-    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "resume", dev_name, NULL)) != EUCA_OK) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to resume device with 'dmsetup'");
-        return (-1);
-    }
+    blocks_free = bs->limit_blocks - index_blocks_used(bs, bb->id);
+    if (blocks_free >= size_blocks)
+        return 0;
+    if (bs->revocation_policy != BLOBSTORE_REVOCATION_LRU)
+        return -1;
 
-    return (0);
+    blocks_needed = size_blocks - blocks_free;
+    if (index_lru_victims(bs, bb, blocks_needed, &victims) >= blocks_needed) {
+        _err_off();                    // do not care about errors during purging
+        blocks_freed = purge_blockblobs_lru(bs, victims, blocks_needed);
+        _err_on();
+    }
+    free_bbs(victims);
+    return ((blocks_freed >= blocks_needed) ? 0 : -1);
 }
 
 //!
 //!
 //!
-//! @param[in] dev_name
+//! @param[in] bb1
+//! @param[in] bb2
 //!
 //! @return
 //!
@@ -3494,18 +4160,17 @@ static int dm_suspend_resume(const char *dev_name)
 //!
 //! @note
 //!
-static int dm_check_device(const char *dev_name)
+static int compare_bbs(const void *bb1, const void *bb2)
 {
-    // see if the device exists
-    char dm_path[MAX_DM_PATH];
-    snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_name);
-    return check_path(dm_path);        // we do not use check_block() because /dev/mapper/... entries can be sym links
+    return (int)((*(blockblob **) bb1)->last_modified - (*(blockblob **) bb2)->last_modified);
 }
 
 //!
 //!
 //!
-//! @param[in] dev_name
+//! @param[in] bs
+//! @param[in] bb_list
+//! @param[in] need_blocks
 //!
 //! @return
 //!
@@ -3513,36 +4178,83 @@ static int dm_check_device(const char *dev_name)
 //!
 //! @note
 //!
-static int dm_delete_device(const char *dev_name)
+static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks)
 {
-    int ret = 0;
-    int retries = 1;
-    char dm_path[MAX_DM_PATH] = "";
+    int list_length = 0;
+    long long purged = 0;
 
-    // see if the device to delete exists
-    snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_name);
-    errno = 0;
-    if (check_path(dm_path) && (errno == ENOENT))   // we do not use check_block() because /dev/mapper/... entries can be sym links
-        return (0);
+    for (blockblob * bb = bb_list; bb; bb = bb->next) {
+        list_length++;
+    }
 
-try_again:
-    myprintf(EUCA_LOG_INFO, "removing device %s (retries=%d)\n", dev_name, retries);
-    if ((euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "remove", dev_name, NULL)) != EUCA_OK) {
-        if (retries--) {
-            usleep(100);
-            goto try_again;
+    if (list_length) {
+        blockblob *bb;
+        int i;
+
+        blockblob **bb_array = (blockblob **) EUCA_ZALLOC(list_length, sizeof(blockblob *));
+        if (!bb_array)
+            return purged;
+
+        for (i = 0, bb = bb_list; bb; bb = bb->next, i++) {
+            bb_array[i] = bb;
         }
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with 'dmsetup'");
-        ret = -1;
+
+        qsort(bb_array, list_length, sizeof(blockblob *), compare_bbs);
+
+        int iteration = 0;
+        int deleted;
+        do {
+            // iterate multiple times in case there are dependencies
+            //! @TODO unify with _fsck's iteration code?
+            deleted = 0;               // deleted in this round
+            for (i = 0; i < list_length; i++) {
+                bb = bb_array[i];
+                if (bb == NULL)        // was either deleted or deemed undeletable on previous iteration
+                    continue;
+                bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+
+                char code = '?';
+                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+                    // mapped blobs have children, thus cannot be deleted at this iteration
+                    code = 'C';
+
+                } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = 'O';
+
+                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = '!';
+
+                } else {
+                    purged += round_up_sec(bb->size_bytes) / 512;
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = 'D';
+                    deleted++;
+                }
+                LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'), // o = open
+                         (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
+                         (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
+                         (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
+                         code,         // outcome codes: D=deleted, else C=children, !=undeletable, O=open
+                         bb->size_bytes / 512L, // size is in sectors
+                         ctime(&(bb->last_modified)));  // ctime adds a newline
+                if (purged >= need_blocks)
+                    break;
+            }
+            iteration++;
+        } while (deleted && (purged < need_blocks));
+        EUCA_FREE(bb_array);
     }
-    return (ret);
+
+    return purged;
 }
 
 //!
 //!
 //!
-//! @param[in] dev_names
-//! @param[in] size
+//! @param[in] bs
+//! @param[in] meta
 //!
 //! @return
 //!
@@ -3550,191 +4262,235 @@ try_again:
 //!
 //! @note
 //!
-static int dm_delete_devices(char *dev_names[], int size)
+int blobstore_stat(blobstore * bs, blobstore_meta * meta)
 {
-    if (size < 1)
-        return 0;
     int ret = 0;
 
-    // construct list of device names in the order that they should be removed
-    int devices = 0;
-    char **dev_names_removable = EUCA_ZALLOC(size, sizeof(char *));
-    if (dev_names_removable == NULL) {
-        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-        return -1;
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        return EUCA_ERROR;
     }
-    for (int i = size - 1; i >= 0; i--) {
-        char *name = dev_names[i];
-        int seen = 0;
-        for (int j = i + 1; j < size; j++) {
-            if (!strcmp(name, dev_names[j])) {
-                seen = 1;
-                break;
-            }
-        }
-        if (!seen) {
-            dev_names_removable[devices++] = name;
+    // put existing items in the blobstore into a LL
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    blockblob *bbs = scan_blobstore(bs, NULL, NULL);
+    if (bbs == NULL) {
+        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+            goto unlock;
         }
     }
+    // analyze the LL, calculating sizes
+    meta->blocks_allocated = 0;
+    meta->blocks_unlocked = 0;
+    meta->blocks_locked = 0;
+    meta->num_blobs = 0;
+    meta->dedup_blocks_logical = 0;
+    meta->dedup_blocks_stored = 0;
+    meta->dedup_ratio = 0;
+    for (blockblob * abb = bbs; abb;) {
+        //! @TODO unify this with locked/unlocked calculation in open()
+        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+        if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
+            // these can't be purged if we need space
+            //! @TODO look into recursive purging of unused references?
+            meta->blocks_locked += abb_size_blocks;
+        } else {
+            // these potentially can be purged, unless they are depended on by locked ones
+            meta->blocks_unlocked += abb_size_blocks;
+        }
+        meta->blocks_allocated += abb->blocks_allocated;
+        meta->num_blobs++;
 
-    // run through devices and remove them
-    for (int i = 0; i < devices; i++) {
-
-        // some of these devices may have children devices that were created
-        // by GNU parted for each of the partitions inside; here we look for
-        // those devices and remove them so the main device is not 'busy'.
-        for (int j = 1; j < 10; j++) {
-            char name_p[1024];         // device mapper name of a potential partition entry
-            char path_p[1024];         // path to the device mapper file
-            // just append 'pN' to the name, e.g., sda -> sdap1
-            snprintf(name_p, sizeof(name_p), "%sp%d", dev_names_removable[i], j);
-            snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
-            if (check_path(path_p) == 0) {
-                dm_delete_device(name_p);
-            }
-            // also try appending just 'N', since that may be the name format, too
-            snprintf(name_p, sizeof(name_p), "%s%d", dev_names_removable[i], j);
-            snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
-            if (check_path(path_p) == 0) {
-                dm_delete_device(name_p);
+        // the packs hold the distinct chunks of the deduplicated blobs, whose files are
+        // the size of their contents but, with the blocks mapped from the packs, empty
+        if (!strncmp(abb->id, DEDUP_PACK_PREFIX, strlen(DEDUP_PACK_PREFIX))) {
+            meta->dedup_blocks_stored += abb->blocks_allocated;
+        } else {
+            char path[PATH_MAX];
+            struct stat sb;
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, abb->id, path, sizeof(path));
+            if (stat(path, &sb) == 0) {
+                set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, abb->id, path, sizeof(path));
+                if (stat(path, &sb) == 0)
+                    meta->dedup_blocks_logical += round_up_sec(sb.st_size) / 512;
             }
         }
-        ret = dm_delete_device(dev_names_removable[i]);
+
+        // free this node and move the pointer
+        blockblob *old_bb = abb;
+        abb = abb->next;
+        EUCA_FREE(old_bb);
+    }
+
+unlock:
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    }
+
+    euca_strncpy(meta->id, bs->id, sizeof(meta->id));
+    meta->revocation_policy = bs->revocation_policy;
+    meta->snapshot_policy = bs->snapshot_policy;
+    meta->format = bs->format;
+    meta->blocks_limit = bs->limit_blocks;
+    if (meta->dedup_blocks_stored > 0)
+        meta->dedup_ratio = (double)meta->dedup_blocks_logical / meta->dedup_blocks_stored;
+    if (realpath(bs->path, meta->path) == NULL) {
+        LOGERROR("failed to resolve the blobstore path %s\n", bs->path);
+        ret = EUCA_ERROR;
     }
-    EUCA_FREE(dev_names_removable);
 
     return ret;
 }
 
 //!
+//! Revokes blobs ahead of need, so that creating a blob seldom has to: if the blobs in a blobstore
+//! with the LRU revocation policy take up more than 'high_pct' percent of its limit, the least
+//! recently used ones are deleted until they take up no more than 'low_pct' percent of it (or
+//! until only blobs that are open or have children are left).
 //!
+//! @param[in] bs
+//! @param[in] high_pct the high watermark, in percent of the limit
+//! @param[in] low_pct the low watermark, in percent of the limit, no greater than 'high_pct'
 //!
-//! @param[in] dev_names
-//! @param[in] dm_tables
-//! @param[in] size
-//!
-//! @return
-//!
-//! @pre
+//! @return the number of blocks freed or -1 on error
 //!
-//! @note
+//! @note Meant to be called periodically, from a thread that is not starting instances
 //!
-static int dm_create_devices(char *dev_names[], char *dm_tables[], int size)
+long long blobstore_reclaim(blobstore * bs, unsigned int high_pct, unsigned int low_pct)
 {
-    int i = 0;
-    int fd = 0;
-    int status = 0;
-    int rc = EUCA_OK;
-    int rbytes = 0;
-    pid_t cpid = 0;
-    char tmpfile[EUCA_MAX_PATH] = "";
-    char dm_path[MAX_DM_PATH] = "";
-
-    for (i = 0; i < size; i++) {
-        // create devices one by one
-        myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
-
-        if ((cpid = fork()) < 0) {
-            // fork error
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto cleanup;
-        } else if (cpid == 0) {
-            // child process - runs `dmsetup` using system()
-            bzero(tmpfile, sizeof(tmpfile));
-            snprintf(tmpfile, sizeof(tmpfile) - 1, "/tmp/dmsetup.XXXXXX");
-            if ((fd = safe_mkstemp(tmpfile)) >= 0) {
-                if ((rbytes = write(fd, dm_tables[i], strlen(dm_tables[i]))) != strlen(dm_tables[i])) {
-                    // if write error
-                    LOGERROR("{%u} error: dm_create_devices: write returned number of bytes != write buffer: %d/%ld\n", (unsigned int)pthread_self(), rbytes, strlen(dm_tables[i]));
-                    unlink(tmpfile);
-                    exit(1);
-                }
-                close(fd);
-            } else {
-                // couldn't get fd
-                LOGERROR("{%u} error: dm_create_devices: couldn't open temporary file %s: %s\n", (unsigned int)pthread_self(), tmpfile, strerror(errno));
-                unlink(tmpfile);
-                exit(1);
-            }
+    long long blocks_used = 0;
+    long long blocks_needed = 0;
+    long long blocks_found = 0;
+    long long blocks_freed = 0;
+    blockblob *victims = NULL;
 
-            // invoke `dmsetup create ...`
-            rc = euca_execlp(&status, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "create", dev_names[i], tmpfile, NULL);
+    if ((bs == NULL) || (high_pct > 100) || (low_pct > high_pct)) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+    if (bs->revocation_policy != BLOBSTORE_REVOCATION_LRU)
+        return 0;
 
-            // free out temp file
-            unlink(tmpfile);
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        return -1;
+    }
+    if (index_load(bs)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "blob index is not available");
+        blocks_freed = -1;
+        goto unlock;
+    }
 
-            // pass back dmsetup's return code
-            exit(WEXITSTATUS(status));
-        }
-        // parent - waits for child, reacts to status
-        if ((rc = timewait(cpid, &status, BLOBSTORE_DMSETUP_TIMEOUT_SEC)) <= 0) {
-            LOGERROR("{%u} error: dm_create_devices: bad exit from dmsetup child: %d\n", (unsigned int)pthread_self(), rc);
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto cleanup;
-        }
+    blocks_used = index_blocks_used(bs, NULL);
+    if ((blocks_used * 100) <= (bs->limit_blocks * high_pct))
+        goto unlock;
 
-        if (WEXITSTATUS(status) != 0) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper table with 'dmsetup'");
-            myprintf(EUCA_LOG_INFO, "{%u} command: %s %s create %s\n", (unsigned int)pthread_self(), helpers_path[ROOTWRAP], helpers_path[DMSETUP], dev_names[i]);
-            myprintf(EUCA_LOG_INFO, "{%u} input: %s", (unsigned int)pthread_self(), dm_tables[i]);
-            goto cleanup;
-        }
+    blocks_needed = blocks_used - ((bs->limit_blocks * low_pct) / 100);
+    blocks_found = index_lru_victims(bs, NULL, blocks_needed, &victims);
+    _err_off();                        // do not care about errors during purging
+    blocks_freed = purge_blockblobs_lru(bs, victims, blocks_needed);
+    _err_on();
+    free_bbs(victims);
+    LOGINFO("reclaimed %lld of %lld block(s) over the low watermark in blobstore %s (%lld found revocable)\n", blocks_freed, blocks_needed, bs->path, blocks_found);
 
-        snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_names[i]);
-        if (diskutil_ch(dm_path, get_username(), NULL, BLOBSTORE_FILE_PERM) != EUCA_OK) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to change permissions on the device mapper file\n");
-            goto cleanup;
-        }
+unlock:
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
     }
-
-    return (0);
-cleanup:
-    _err_off();
-    dm_delete_devices(dev_names, i + 1);
-    _err_on();
-    return (-1);
-}
+    return blocks_freed;
+}
 
 //!
+//! Read .refs file content and return any entries that point to blobs that no longer exist
 //!
+//! @param[in]  bb
+//! @param[out] refs
 //!
-//! @return
+//! @return size of the array placed into *refs, which caller must free, or -1 on error
 //!
 //! @pre
 //!
 //! @note
 //!
-static char *dm_get_zero(void)
+static int get_stale_refs(const blockblob * bb, char ***refs)
 {
-    static char dev_zero[] = DM_PATH EUCA_ZERO;
+    blobstore *bs = bb->store;
+    char **array = NULL;
+    int array_size = 0;
+    int stale_refs = 0;
 
-    struct stat sb;
-    int tried = 0;
-    while (stat(dev_zero, &sb) == -1) {
-        if (tried) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to create blockblob zero block device");
-            return NULL;
-        }
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
+            char ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+            euca_strncpy(ref, array[i], sizeof(ref));
 
-        char *dm_tables[1] = { "0 " EUCA_ZERO_SIZE " zero" };
-        char *dm_names[1] = { EUCA_ZERO };
-        dm_create_devices(dm_names, dm_tables, 1);
+            char *store_path = strtok(array[i], " ");
+            char *blob_id = strtok(NULL, " ");  // the remaining entries in array[i] are ignored
+            char ref_exists = 0;
 
-        tried = 1;
+            if (strlen(store_path) < 1 || strlen(blob_id) < 1)
+                goto stale_ref;
+
+            blobstore *ref_bs = bs;
+            if (strcmp(bs->path, store_path)) { // if deleting reference in a different blobstore
+                // need to open it
+                ref_bs = blobstore_open(store_path, 0, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+                if (ref_bs == NULL)    // blobstore with a child blob does not exist
+                    goto stale_ref;
+            }
+
+            blockblob *ref_bb = blockblob_open(ref_bs, blob_id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
+            if (ref_bb) {
+                blockblob_close(ref_bb);
+                ref_exists = 1;
+            } else {
+                if (_blobstore_errno != BLOBSTORE_ERROR_NOENT)  // conservatively assume that unless the error says otherwise, the blob exists
+                    ref_exists = 1;
+            }
+            if (ref_bs != bs) {
+                blobstore_close(ref_bs);
+            }
+
+stale_ref:
+
+            if (ref_exists) {
+                EUCA_FREE(array[i]);   // free names of refs that exist
+            } else {
+                strcpy(array[i], ref); // since strtok() clobbered the original value
+                stale_refs++;
+            }
+        }
     }
 
-    if (!S_ISBLK(sb.st_mode)) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "blockblob zero is not a block device");
-        return NULL;
+    if (stale_refs > 0) {
+        if (refs) {
+            *refs = EUCA_ZALLOC(stale_refs, sizeof(char *));
+            if (*refs == NULL) {
+                stale_refs = -1;       // OOM error
+            }
+        }
+        for (int i = 0, j = 0; i < array_size; i++) {
+            if (array[i]) {            // ref does not exist
+                if (refs && *refs) {
+                    (*refs)[j++] = array[i];
+                    assert(j <= stale_refs);
+                } else {
+                    EUCA_FREE(array[i]);
+                }
+            }
+        }
     }
 
-    return dev_zero;
+    if (array_size > 0)
+        EUCA_FREE(array);
+
+    return stale_refs;
 }
 
 //!
+//! Checks the integrity check of the blobstore. With a non-NULL examiner(), each found
+//! blob is passed to it for examination and the blob is deleted if function returns non-zero
 //!
-//!
-//! @param[in] bb
+//! @param[in] bs
+//! @param[in] examiner
 //!
 //! @return
 //!
@@ -3742,53 +4498,121 @@ static char *dm_get_zero(void)
 //!
 //! @note
 //!
-static int blockblob_check(const blockblob * bb)
+int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
 {
-    char **array = NULL;
-    int array_size = 0;
-    int err = 0;
-    _err_off();                        // do not care if metadata files do not exist
+    int ret = 0;
 
-    // check on dm devices listed in .dm of this blob, if any
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) != -1) {
-        for (int i = 0; i < array_size; i++) {
-            if (dm_check_device(array[i]))
-                err++;
-            EUCA_FREE(array[i]);
-        }
-        EUCA_FREE(array);
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+        return -1;
     }
-    // check on the loop device listed in .loopback of the blob, if any
-    char lo_dev[PATH_MAX] = "";
-    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bb->store, bb->id, lo_dev, sizeof(lo_dev));
-    if (strlen(lo_dev) > 0) {
-        struct stat sb;
-        if (stat(lo_dev, &sb) == -1) {
-            err++;
-        } else if (!S_ISBLK(sb.st_mode)) {
-            err++;
-        } else if (diskutil_loop_check(bb->blocks_path, lo_dev)) {
-            err++;
+    // put existing items in the blobstore into a LL
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    blockblob *bbs = scan_blobstore(bs, NULL, NULL);
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        ret = -1;
+        goto free;
+    }
+
+    if (bbs == NULL) {
+        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+            ret = -1;
         }
+        goto free;
     }
-    // check on .refs that point to blobs that no longer exist
-    if (get_stale_refs(bb, NULL) > 0)
-        err++;
 
-    // check on .lock files that are non-zero => blobs that were not closed properly
-    if (bb->in_use & BLOCKBLOB_STATUS_ABANDONED)
-        err++;
+    {                                  // check objects in the blobstore
 
-    _err_on();
-    return err;
+        unsigned int num_blobs = 0;
+        unsigned int blobs_deleted = 0;
+        unsigned int blobs_undeletable = 0;
+        unsigned int blobs_unopenable = 0;
+        unsigned int to_delete_prev = 0;
+        unsigned int iterations = 1;
+        for (; iterations < 10; iterations++) { // outer loop for multiple iterations over the list
+            unsigned int to_delete = 0;
+
+            // run through LL, examining each blockblob
+            for (blockblob * abb = bbs; abb; abb = abb->next) {
+                if (iterations == 1)
+                    num_blobs++;       // count all blobs on the first iteration
+
+                if (abb->store == NULL) // these were cleared or condemned on a previous iteration
+                    continue;
+
+                // examiner(), if specified, tell us whether to delete the blob
+                if (blockblob_check(abb) || // blob state is inconsistent
+                    (examiner && examiner(abb))) {  // blobstore user condemned the blob
+
+                    blockblob *bb = blockblob_open(bs, abb->id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
+                    if (bb != NULL) {
+                        if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+
+                            // Since we are checking integrity, do not trust .refs file blindly,
+                            // but ensure that the entries -- blobs depending on this one -- exist
+
+                            char **stale_refs;
+                            int num_stale_refs = get_stale_refs(bb, &stale_refs);
+                            if (num_stale_refs > 0) {
+                                for (int i = 0; i < num_stale_refs; i++) {
+                                    // update the .refs file to remove this entry
+                                    LOGINFO("removing stale/corrupted reference in blob %s to %s\n", bb->id, stale_refs[i]);
+                                    update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bb->store, bb->id, stale_refs[i], 1);
+                                    EUCA_FREE(stale_refs[i]);
+                                }
+                                EUCA_FREE(stale_refs);
+                            }
+                            // mapped blobs have children, thus cannot be deleted at this iteration
+                            blockblob_close(bb);
+                            to_delete++;
+
+                        } else if (blockblob_delete(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+                            LOGWARN("WARNING: failed to delete blockblob %s\n", abb->id);
+                            blockblob_close(bb);
+                            abb->store = NULL;  // so it will get skipped on next iteration
+                            blobs_undeletable++;
+
+                        } else {
+                            LOGINFO("deleted stale/corrupted blob %s\n", abb->id);
+                            abb->store = NULL;  // so it will get skipped on next iteration
+                            blobs_deleted++;
+                        }
+                    } else {
+                        LOGWARN("could not open blockblob %s (it may be in use)\n", abb->id);
+                        abb->store = NULL;  // so it will get skipped on next iteration
+                        blobs_unopenable++;
+                    }
+                }
+            }
+            assert(iterations < 11);
+
+            if (to_delete == to_delete_prev)    // could not delete anything new this iteration
+                break;
+            to_delete_prev = to_delete;
+            if (to_delete == 0)
+                break;
+        }
+
+        if (num_blobs > 0)
+            LOGINFO("%s: examined %d blob(s) in %d iteration(s): "
+                    "deleted %d, failed on %d + %d, failed to open %d\n", bs->path, num_blobs, iterations, blobs_deleted, to_delete_prev, blobs_undeletable, blobs_unopenable);
+    }
+free:
+    if (bbs) {
+        free_bbs(bbs);
+    }
+
+    return ret;
 }
 
 //!
 //!
 //!
-//! @param[in] bb
-//! @param[in] timeout_usec
-//! @param[in] do_force
+//! @param[in]  bs
+//! @param[in]  regex
+//! @param[out] results
 //!
 //! @return
 //!
@@ -3796,690 +4620,2396 @@ static int blockblob_check(const blockblob * bb)
 //!
 //! @note
 //!
-static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force)
+int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results)
 {
-    blobstore *bs = bb->store;
-    char **array = NULL;
-    int array_size = 0;
+    blockblob_meta *head = NULL;
+    blockblob *bbs = NULL;
     int ret = 0;
+    regex_t re;
 
-    // delete dm devices listed in .dm of this blob
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) == -1 || dm_delete_devices(array, array_size) == -1) {
-        if (!do_force) {
-            ret = -1;
-            goto free;
-        }
+    if (regcomp(&re, regex, REG_NOSUB) != 0) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to parse search regular expression");
+        return -1;
     }
-    for (int i = 0; i < array_size; i++) {
-        EUCA_FREE(array[i]);
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+        ret = -1;
+        goto free;
     }
-    EUCA_FREE(array);
-    array_size = 0;
-    array = NULL;
+    // put existing items in the blobstore into a LL
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    bbs = scan_blobstore(bs, NULL, &re);
+    if (bbs == NULL) {
+        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+            ret = -1;
+            goto free;
+        }
+    }
+    // run through LL, looking for matches
+    unsigned int num_blobs = 0;
+    unsigned int blobs_matched = 0;
+    blockblob_meta *prev = NULL;
+    for (blockblob * abb = bbs; abb; abb = abb->next) {
+        num_blobs++;
+        if (regexec(&re, abb->id, 0, NULL, 0) != 0)
+            continue;
+        blobs_matched++;
 
-    // Read in .deps (blobs that this blob depends on),
-    // so as to update their .refs (blobs depending on them).
-    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) == -1) {
+        blockblob_meta *bm = EUCA_ZALLOC(1, sizeof(blockblob_meta));
+        if (bm == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+            goto free;
+        }
+
+        euca_strncpy(bm->id, abb->id, sizeof(bm->id));
+        bm->bs = bs;
+        bm->size_bytes = abb->size_bytes;
+        bm->in_use = abb->in_use;
+        bm->is_hollow = abb->is_hollow;
+        bm->last_accessed = abb->last_accessed;
+        bm->last_modified = abb->last_modified;
+        if (head == NULL) {
+            head = bm;
+        } else {
+            prev->next = bm;
+            bm->prev = prev;
+        }
+        prev = bm;
+    }
+
+    *results = head;
+    ret = blobs_matched;
+
+free:
+    regfree(&re);                      // free the regular expression
+    if (bbs)
+        free_bbs(bbs);                 // free the blockblobs LL returned by the search function
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
         ret = -1;
-        if (!do_force) {
+    }
+
+    if (ret < 0) {                     // there were problems, so free the partial linked list, if any
+        for (blockblob_meta * bm = head; bm;) {
+            blockblob_meta *next = bm->next;
+            EUCA_FREE(bm);
+            bm = next;
+        }
+    }
+
+    return ret;
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] regex
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blobstore_delete_regex(blobstore * bs, const char *regex)
+{
+    blockblob_meta *matches = NULL;
+    int found = blobstore_search(bs, regex, &matches);
+    int left_to_delete = found;
+    int deleted;
+    do {
+        // iterate multiple times in case there are dependencies
+        //! @TODO unify with _fsck's iteration code?
+        deleted = 0;                   // deleted in this round
+        for (blockblob_meta * bm = matches; bm; bm = bm->next) {
+            blockblob *bb = blockblob_open(bs, bm->id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
+            if (bb != NULL) {
+                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+                    // mapped blobs have children, thus cannot be deleted at this iteration
+                    blockblob_close(bb);
+                    continue;
+                }
+                if (blockblob_delete(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 0) == -1) {
+                    blockblob_close(bb);
+                } else {
+                    deleted++;
+                }
+            }
+        }
+    } while (deleted && (left_to_delete -= deleted));
+
+    // free the search results
+    for (blockblob_meta * bm = matches; bm;) {
+        blockblob_meta *next = bm->next;
+        EUCA_FREE(bm);
+        bm = next;
+    }
+
+    return (left_to_delete == 0) ? (found) : (-1);
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] id can be NULL if creating, in which case blobstore will pick a random ID
+//! @param[in] size_bytes on create: reserve this size; on open: verify the size, unless set to 0
+//! @param[in] flags BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL - same semantcs as for open() flags, BLOBSTORE_FLAG_HOLLOW - when creating
+//! @param[in] sig if non-NULL, on create sig is recorded, on open it is verified
+//! @param[in] timeout_usec maximum wait, in microseconds
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long size_bytes, unsigned int flags, const char *sig, unsigned long long timeout_usec)
+{
+    long long size_blocks = round_up_sec(size_bytes) / 512;
+    if (flags & ~(BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL | BLOBSTORE_FLAG_HOLLOW)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "only _CREAT, _EXCL, & _HOLLOW flags are allowed");
+        return NULL;
+    }
+    if (id == NULL && !(flags & BLOBSTORE_FLAG_CREAT)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "NULL id is only allowed with _CREAT");
+        return NULL;
+    }
+    if (size_blocks == 0 && (flags & BLOBSTORE_FLAG_CREAT)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "size_blocks can be 0 only without _CREAT");
+        return NULL;
+    }
+    if (size_blocks != 0 && (flags & BLOBSTORE_FLAG_CREAT) && (size_blocks > bs->limit_blocks) && !(flags && BLOBSTORE_FLAG_HOLLOW)) {
+        ERR(BLOBSTORE_ERROR_NOSPC, NULL);
+        return NULL;
+    }
+
+    LOGTRACE("{%u} blockblob_open: opening blob id=%s flags=%d timeout=%lld\n", (unsigned int)pthread_self(), id, flags, timeout_usec);
+
+    blockblob *bbs = NULL;             // a temp LL of blockblobs, used for computing free space and for purging
+    char noted_id[BLOBSTORE_MAX_PATH] = "";    // ID of the blob whose creation has been noted in the index
+    blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto out;
+    }
+
+    bb->store = bs;
+    if (id) {
+        euca_strncpy(bb->id, id, sizeof(bb->id));
+    } else {
+        gen_id(bb->id, sizeof(bb->id));
+    }
+    bb->fd_lock = -1;
+    bb->fd_blocks = -1;
+    bb->size_bytes = size_bytes;
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+
+    int blobstore_locked = 0;
+    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can create blob's file atomically
+        goto free;                     // failed to obtain a lock on the blobstore
+    } else {
+        blobstore_locked = 1;
+    }
+
+    //! @TODO maybe don't create directories needlessly if flags==0?
+    int created_directory = ensure_blockblob_metadata_path(bs, bb->id);
+    if (created_directory == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        goto unlock;
+    }
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        goto free;
+    }
+    blobstore_locked = 0;
+
+    int created_blob = 0;
+    char lpath[PATH_MAX];
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb->id, lpath, sizeof(lpath));
+    bb->fd_lock = open_and_lock(lpath, flags | BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM); // blobs are always opened with exclusive write access
+    if (bb->fd_lock == -1) {
+        // failed to open/create and lock the blockblob
+        goto clean;
+    }
+    char thread_id[512];
+    int thread_id_len = 0;
+    snprintf(thread_id, sizeof(thread_id), "%d/%u", getpid(), (unsigned int)pthread_self());
+    thread_id_len = strlen(thread_id);
+    if (write(bb->fd_lock, thread_id, thread_id_len) != thread_id_len) {
+        // Fail to write our thread indentifier in the lock file.
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to write to the blobstore");
+        goto clean;
+    }
+    // convert BLOBSTORE_* flags into standard Posix open() flags and open/create the blocks file
+    if (flags & BLOBSTORE_FLAG_CREAT) {
+        euca_strncpy(noted_id, bb->id, sizeof(noted_id));
+        index_note_begin(bs, noted_id);
+    }
+    int o_flags = 0;
+    if (flags & BLOBSTORE_FLAG_RDONLY) {
+        o_flags |= O_RDONLY;
+    } else if ((flags & BLOBSTORE_FLAG_RDWR) || (flags & BLOBSTORE_FLAG_CREAT)) {
+        o_flags |= O_RDWR;
+        if (flags & BLOBSTORE_FLAG_CREAT) {
+            o_flags |= O_CREAT;
+            // intentionally ignore _EXCL supplied without _CREAT
+            if (flags & BLOBSTORE_FLAG_EXCL)
+                o_flags |= O_EXCL;
+        }
+    }
+    bb->fd_blocks = open(bb->blocks_path, o_flags, BLOBSTORE_FILE_PERM);
+    if (bb->fd_blocks == -1) {         // failed to open/create the content file
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        goto clean;
+    }
+
+    struct stat sb;
+    if (fstat(bb->fd_blocks, &sb) == -1) {
+        goto clean;
+    }
+
+    if (sb.st_size == 0) {             // new blob
+        created_blob = 1;
+
+        if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse blobstore safely
+            goto clean;                // failed to obtain a lock on the blobstore
+        } else {
+            blobstore_locked = 1;
+        }
+
+        // a bit of a hack: HOLLOW blobs skip the blobstore limit check upon creation
+        if (flags & BLOBSTORE_FLAG_HOLLOW) {
+            bb->is_hollow = TRUE;
+            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, "this blob is hollow\n"))
+                goto clean;
+
+        } else if (index_make_room(bs, bb, size_blocks) == -1) {    // enforce blobstore limits, going through all blobs unless the index settles it
+
+            // put existing items in the blobstore into a LL
+            _blobstore_errno = BLOBSTORE_ERROR_OK;
+            bbs = scan_blobstore(bs, bb, NULL);
+            if (bbs == NULL) {
+                if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+                    goto clean;
+                }
+            }
+            // analyze the LL, calculating sizes
+            long long blocks_unlocked = 0;
+            long long blocks_locked = 0;
+            unsigned int num_blobs = 0;
+            for (blockblob * abb = bbs; abb; abb = abb->next) {
+                long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+                if (abb->is_hollow)
+                    abb_size_blocks = 0;
+                if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                    // these can't be purged if we need space
+                    //! @TODO look into recursive purging of unused references?
+                    blocks_locked += abb_size_blocks;
+                } else {
+                    blocks_unlocked += abb_size_blocks; // these potentially can be purged, unless they are depended on by locked ones
+                }
+                num_blobs++;
+            }
+
+            long long blocks_free = bs->limit_blocks - (blocks_unlocked + blocks_locked);
+            if (blocks_free < size_blocks) {
+                if (!(bs->revocation_policy == BLOBSTORE_REVOCATION_LRU)    // not allowed to purge
+                    || (blocks_free + blocks_unlocked) < size_blocks) { // not enough purgeable material
+                    ERR(BLOBSTORE_ERROR_NOSPC, NULL);
+                    goto clean;
+                }
+                long long blocks_needed = size_blocks - blocks_free;
+                _err_off();            // do not care about errors duing purging
+                long long blocks_freed = purge_blockblobs_lru(bs, bbs, blocks_needed);
+                _err_on();
+                if (blocks_freed < blocks_needed) {
+                    ERR(BLOBSTORE_ERROR_NOSPC, "could not purge enough from cache");
+                    goto clean;
+                }
+            }
+        }
+
+        if (lseek(bb->fd_blocks, size_bytes - 1, SEEK_CUR) == (off_t) - 1) {    // create a file with a hole
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto clean;
+        }
+        if (write(bb->fd_blocks, zero_buf, 1) != (ssize_t) 1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto clean;
+        }
+        if (sig)
+            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, sig)) {
+                goto clean;
+            }
+        bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;    // just created, so not a snapshot
+
+        if (blobstore_unlock(bs) == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        }
+        blobstore_locked = 0;
+
+    } else {                           // blob existed
+
+        char buf[BLOBSTORE_SIG_MAX];
+
+        if (bb->size_bytes == 0) {     // find out the size from the file size
+            bb->size_bytes = sb.st_size;
+        } else if (bb->size_bytes != sb.st_size) {  // verify the size specified by the user
+            LOGERROR("{%u} encountered a size mismatch when opening a blob (requested %lld, found %ld)\n", (unsigned int)pthread_self(), bb->size_bytes, sb.st_size);
+            ERR(BLOBSTORE_ERROR_SIGNATURE, "size of the existing blockblob does not match");
+            goto clean;
+        }
+        // determine whether this blob is a map of another,
+        // in which case the blocks are backing and should
+        // not be accessed directly
+        if (read_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bs, bb->id, buf, sizeof(buf)) > 0) {
+            bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;
+        } else {
+            bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;
+        }
+
+        // check if its hollow
+        if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, buf, sizeof(buf)) != -1) {
+            bb->is_hollow = TRUE;
+        }
+
+        if (sig && (strlen(sig) > 0)) { // check the signature, if there
+            int sig_size;
+            if ((sig_size = read_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, buf, sizeof(buf))) != strlen(sig)
+                || (strncmp(sig, buf, sig_size) != 0)) {
+                LOGERROR("{%u} encountered signature mismatch when opening a blob (requested size [%ld], found [%d])\n", (unsigned int)pthread_self(), strlen(sig), sig_size);
+                ERR(BLOBSTORE_ERROR_SIGNATURE, NULL);
+                goto clean;
+            }
+        }
+        // check its in-use status
+        bb->in_use = check_in_use(bs, bb->id, 0);
+    }
+
+    {                                  // create a loopback device, if there isn't a valid one already (this may happen whether the blob is new or old)
+        char lo_dev[PATH_MAX] = "";
+        struct stat sb;
+
+        _err_off();                    // do not care if loopback file does not exist
+        read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb->id, lo_dev, sizeof(lo_dev));
+        _err_on();
+        if ((strlen(lo_dev) < 1)       // nothing in .loopback file
+            || (stat(lo_dev, &sb) == -1)    // something in .loopback that does not exist
+            || (!S_ISBLK(sb.st_mode))) {    // something in .loopback that is not block device
+
+            if (diskutil_loop(bb->blocks_path, 0, lo_dev, sizeof(lo_dev))) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to obtain a loopback device for a blockblob");
+                goto clean;
+            }
+            write_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb->id, lo_dev);
+        }
+    }
+
+    set_device_path(bb);               // read .dm and .loopback and set bb->device_path accordingly
+
+    goto out;                          // all is well
+
+clean:
+    {
+        int saved_errno = _blobstore_errno; // save it because close_and_unlock() or delete_blockblob_files() may reset it
+        boolean held_lock = (bb->fd_lock != -1);
+        if (bb->fd_lock != -1) {
+            if (ftruncate(bb->fd_lock, 0) != 0) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+            }
+            close_and_unlock(bb->fd_lock);
+        }
+        if (bb->fd_blocks != -1) {
+            close(bb->fd_blocks);
+        }
+        if (created_blob || (created_directory && held_lock)) { // only delete disk state if we created it
+            delete_blockblob_files(bs, bb->id);
+        } else if (created_directory) {
+            // the directory was created for a blob that was not there, but another
+            // thread or process may have created the blob in it since, so it goes
+            // only if it is still empty
+            delete_blockblob_dirs(bs, bb->id);
+        }
+        if (saved_errno) {
+            _blobstore_errno = saved_errno;
+        }
+    }
+
+unlock:
+    {
+        int saved_errno = _blobstore_errno;
+        if (blobstore_locked && blobstore_unlock(bs) == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+            if (saved_errno) {
+                _blobstore_errno = saved_errno;
+            }
+        }
+    }
+
+free:
+    EUCA_FREE(bb);
+
+out:
+    if (noted_id[0] != '\0') {
+        index_note_commit(bs, noted_id);
+    }
+    LOGTRACE("{%u} blockblob_open: done with blob id=%s ret=%p\n", (unsigned int)pthread_self(), id, bb);
+    if (bb == NULL) {
+        LOGTRACE("{%u} blockblob_open: errno=%d msg=%s\n", (unsigned int)pthread_self(), _blobstore_errno, blobstore_get_last_msg());
+    }
+
+    free_bbs(bbs);
+    return bb;
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int loop_remove(blobstore * bs, const char *bb_id)
+{
+    char path[PATH_MAX] = "";
+    int ret = 0;
+
+    _err_off();                        // do not care if loopback file does not exist
+    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));   // loads path of /dev/loop?
+    _err_on();
+
+    if (strlen(path)) {
+        if (diskutil_unloop(path)) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove loopback device for blockblob");
+            ret = -1;
+        } else {
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));    // load path of .../loopback file itself
+            unlink(path);
+        }
+    }
+
+    return ret;
+}
+
+//!
+//! releases the blob locks, allowing others to open() it, and frees the blockblob handle
+//!
+//! @param[in] bb
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blockblob_close(blockblob * bb)
+{
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+    int ret = 0;
+    LOGTRACE("{%u} blockblob_close: closing blob id=%s\n", (unsigned int)pthread_self(), bb->id);
+
+    // do not remove /dev/loop* if it is used by device mapper
+    // (we do not care about BLOCKBLOB_STATUS_OPENED because
+    // it should be only this thread that has the blob open)
+    int in_use = check_in_use(bb->store, bb->id, 0);
+    if (!(in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED))) {
+        ret = loop_remove(bb->store, bb->id);
+    }
+    index_note_commit(bb->store, bb->id);   // record the timestamps and allocation the blob was left with
+    ret |= close(bb->fd_blocks);
+    if (ftruncate(bb->fd_lock, 0) != 0) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+    }
+    ret |= close_and_unlock(bb->fd_lock);
+    EUCA_FREE(bb);                     // we free the blob regardless of whether closing succeeds or not
+    return ret;
+}
+
+//!
+//! Issues a device mapper ioctl, the way 'dmsetup' does, without the cost of
+//! spawning it through the root wrapper. A lack of privileges, or of the
+//! control device, turns the native path off for good, so the callers fall
+//! back on 'dmsetup'.
+//!
+//! @param[in] request DM_DEV_CREATE, DM_TABLE_LOAD, DM_DEV_SUSPEND, DM_DEV_REMOVE...
+//! @param[in] dev_name device mapper name, its path under DM_PATH or the path of another node of the device
+//! @param[in] flags DM_*_FLAG values for the request
+//! @param[in] dm_table OPTIONAL table, in the format 'dmsetup' takes, for DM_TABLE_LOAD
+//! @param[out] dev OPTIONAL device number that the kernel returned
+//!
+//! @return 0 on success or -1 with errno set
+//!
+static int dm_ioctl_native(unsigned long request, const char *dev_name, unsigned int flags, const char *dm_table, dev_t * dev)
+{
+    int fd = -1;
+    int ret = -1;
+    int err = 0;
+    int targets = 0;
+    size_t size = sizeof(struct dm_ioctl);
+    struct dm_ioctl *io = NULL;
+    struct stat sb = { 0 };
+
+    if (dm_table) {                    // every line can take up a target spec, its parameters and padding
+        targets = 1;
+        for (const char *p = dm_table; *p; p++) {
+            if (*p == '\n')
+                targets++;
+        }
+        size += (targets * (sizeof(struct dm_target_spec) + 8)) + strlen(dm_table) + 1;
+    }
+    if ((io = EUCA_ZALLOC(1, size)) == NULL) {
+        errno = ENOMEM;
+        return (-1);
+    }
+    io->version[0] = DM_VERSION_MAJOR;
+    io->version[1] = DM_VERSION_MINOR;
+    io->version[2] = DM_VERSION_PATCHLEVEL;
+    io->data_size = size;
+    io->data_start = sizeof(struct dm_ioctl);
+    io->flags = flags;
+
+    if (!strncmp(dev_name, DM_PATH, strlen(DM_PATH)))
+        dev_name += strlen(DM_PATH);
+    if (dev_name[0] == '/') {          // some other node of the device, such as /dev/dm-3, identifies it by number
+        if (stat(dev_name, &sb) == -1) {
+            err = errno;
+            goto out;
+        }
+        io->dev = sb.st_rdev;
+    } else {
+        euca_strncpy(io->name, dev_name, sizeof(io->name));
+    }
+
+    if (dm_table) {                    // turn each 'start length type params' line into a target spec
+        char *pos = (char *)io + io->data_start;
+        targets = 0;
+        for (const char *line = dm_table; *line != '\0';) {
+            const char *eol = strchrnul(line, '\n');
+            if (eol > line) {
+                unsigned long long start = 0;
+                unsigned long long length = 0;
+                char type[DM_MAX_TYPE_NAME] = "";
+                int consumed = 0;
+                if (sscanf(line, "%llu %llu %15s %n", &start, &length, type, &consumed) < 3) {
+                    err = EINVAL;
+                    goto out;
+                }
+                const char *params = ((line + consumed) < eol) ? (line + consumed) : (eol); // the space before %n may have swallowed the newline
+                struct dm_target_spec *spec = (struct dm_target_spec *)pos;
+                spec->sector_start = start;
+                spec->length = length;
+                euca_strncpy(spec->target_type, type, sizeof(spec->target_type));
+                memcpy(pos + sizeof(*spec), params, (eol - params));
+                spec->next = (sizeof(*spec) + (eol - params) + 1 + 7) & ~7;
+                pos += spec->next;
+                targets++;
+            }
+            line = (*eol == '\0') ? (eol) : (eol + 1);
+        }
+        io->target_count = targets;
+    }
+
+    if ((fd = open(DM_CONTROL_PATH, O_RDWR | O_CLOEXEC)) == -1) {
+        err = errno;
+        if (dm_native) {
+            LOGINFO("cannot open %s (%s), will manage device mapper devices with %s\n", DM_CONTROL_PATH, strerror(err), helpers[DMSETUP]);
+            dm_native = FALSE;
+        }
+        goto out;
+    }
+    if (ioctl(fd, request, io) == -1) {
+        err = errno;
+        if (((err == EPERM) || (err == EACCES) || (err == ENOTTY)) && dm_native) {
+            LOGINFO("device mapper ioctls are not permitted (%s), will manage device mapper devices with %s\n", strerror(err), helpers[DMSETUP]);
+            dm_native = FALSE;
+        }
+        goto out;
+    }
+    if (dev)
+        *dev = (dev_t) io->dev;
+    ret = 0;
+
+out:
+    if (fd != -1)
+        close(fd);
+    EUCA_FREE(io);
+    errno = err;
+    return (ret);
+}
+
+//!
+//! Creates a device mapper device with ioctls: creates it, loads its table and
+//! resumes it, which activates the table. Where udev does not make the node
+//! under DM_PATH promptly, it is made here, as 'dmsetup' does without udev.
+//!
+//! @param[in] dev_name
+//! @param[in] dm_table
+//!
+//! @return 0 on success or -1 with errno set
+//!
+static int dm_create_device_native(const char *dev_name, const char *dm_table)
+{
+    int err = 0;
+    dev_t dev = 0;
+    char dm_path[MAX_DM_PATH] = "";
+    char pw_buf[16384] = "";
+    struct passwd pwd = { 0 };
+    struct passwd *result = NULL;
+    struct stat sb = { 0 };
+
+    if (dm_ioctl_native(DM_DEV_CREATE, dev_name, 0, NULL, &dev) == -1)
+        return (-1);
+
+    // a "suspend" without DM_SUSPEND_FLAG is a resume
+    if ((dm_ioctl_native(DM_TABLE_LOAD, dev_name, 0, dm_table, NULL) == -1) || (dm_ioctl_native(DM_DEV_SUSPEND, dev_name, 0, NULL, &dev) == -1)) {
+        err = errno;
+        dm_ioctl_native(DM_DEV_REMOVE, dev_name, 0, NULL, NULL);
+        errno = err;
+        return (-1);
+    }
+
+    snprintf(dm_path, sizeof(dm_path), DM_FORMAT, dev_name);
+    for (long long waited = 0; (lstat(dm_path, &sb) == -1) && (waited < DM_NODE_WAIT_USEC); waited += 5000)
+        usleep(5000);
+    if ((lstat(dm_path, &sb) == -1) && (mknod(dm_path, (S_IFBLK | BLOBSTORE_FILE_PERM), dev) == -1) && (errno != EEXIST))
+        goto fail;
+
+    if ((getpwnam_r(get_username(), &pwd, pw_buf, sizeof(pw_buf), &result) != 0) || (result == NULL)) {
+        errno = ENOENT;
+        goto fail;
+    }
+    if ((chown(dm_path, pwd.pw_uid, -1) == -1) || (chmod(dm_path, BLOBSTORE_FILE_PERM) == -1))
+        goto fail;
+    return (0);
+
+fail:
+    err = errno;
+    dm_ioctl_native(DM_DEV_REMOVE, dev_name, 0, NULL, NULL);
+    unlink(dm_path);
+    errno = err;
+    return (-1);
+}
+
+//!
+//!
+//!
+//! @param[in] dev_name
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int dm_suspend_resume(const char *dev_name)
+{
+    int ret = EUCA_OK;
+
+    if (dm_native) {
+        if ((dm_ioctl_native(DM_DEV_SUSPEND, dev_name, DM_SUSPEND_FLAG, NULL, NULL) == 0) && (dm_ioctl_native(DM_DEV_SUSPEND, dev_name, 0, NULL, NULL) == 0))
+            return (0);
+        if (dm_native) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend and resume device");
+            return (-1);
+        }
+    }
+
+    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "suspend", dev_name, NULL)) != EUCA_OK) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with 'dmsetup'");
+        return (-1);
+    }
+
+    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "resume", dev_name, NULL)) != EUCA_OK) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to resume device with 'dmsetup'");
+        return (-1);
+    }
+
+    return (0);
+}
+
+//!
+//!
+//!
+//! @param[in] dev_name
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int dm_check_device(const char *dev_name)
+{
+    // see if the device exists
+    char dm_path[MAX_DM_PATH];
+    snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_name);
+    return check_path(dm_path);        // we do not use check_block() because /dev/mapper/... entries can be sym links
+}
+
+//!
+//!
+//!
+//! @param[in] dev_name
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int dm_delete_device(const char *dev_name)
+{
+    int ret = 0;
+    int retries = 1;
+    char dm_path[MAX_DM_PATH] = "";
+
+    // see if the device to delete exists
+    snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_name);
+    errno = 0;
+    if (check_path(dm_path) && (errno == ENOENT))   // we do not use check_block() because /dev/mapper/... entries can be sym links
+        return (0);
+
+try_again:
+    myprintf(EUCA_LOG_INFO, "removing device %s (retries=%d)\n", dev_name, retries);
+    if (dm_native) {
+        if ((dm_ioctl_native(DM_DEV_REMOVE, dev_name, 0, NULL, NULL) == 0) || (errno == ENXIO)) {
+            unlink(dm_path);           // left behind where udev does not manage the nodes, as 'dmsetup' would remove it
+            return (0);
+        }
+        if (dm_native) {
+            if (retries--) {
+                usleep(100);
+                goto try_again;
+            }
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device");
+            return (-1);
+        }
+    }
+    if ((euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "remove", dev_name, NULL)) != EUCA_OK) {
+        if (retries--) {
+            usleep(100);
+            goto try_again;
+        }
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with 'dmsetup'");
+        ret = -1;
+    }
+    return (ret);
+}
+
+//!
+//!
+//!
+//! @param[in] dev_names
+//! @param[in] size
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int dm_delete_devices(char *dev_names[], int size)
+{
+    if (size < 1)
+        return 0;
+    int ret = 0;
+
+    // construct list of device names in the order that they should be removed
+    int devices = 0;
+    char **dev_names_removable = EUCA_ZALLOC(size, sizeof(char *));
+    if (dev_names_removable == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+    for (int i = size - 1; i >= 0; i--) {
+        char *name = dev_names[i];
+        int seen = 0;
+        for (int j = i + 1; j < size; j++) {
+            if (!strcmp(name, dev_names[j])) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen) {
+            dev_names_removable[devices++] = name;
+        }
+    }
+
+    // run through devices and remove them
+    for (int i = 0; i < devices; i++) {
+
+        // some of these devices may have children devices that were created
+        // by GNU parted for each of the partitions inside; here we look for
+        // those devices and remove them so the main device is not 'busy'.
+        for (int j = 1; j < 10; j++) {
+            char name_p[1024];         // device mapper name of a potential partition entry
+            char path_p[1024];         // path to the device mapper file
+            // just append 'pN' to the name, e.g., sda -> sdap1
+            snprintf(name_p, sizeof(name_p), "%sp%d", dev_names_removable[i], j);
+            snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
+            if (check_path(path_p) == 0) {
+                dm_delete_device(name_p);
+            }
+            // also try appending just 'N', since that may be the name format, too
+            snprintf(name_p, sizeof(name_p), "%s%d", dev_names_removable[i], j);
+            snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
+            if (check_path(path_p) == 0) {
+                dm_delete_device(name_p);
+            }
+        }
+        ret = dm_delete_device(dev_names_removable[i]);
+    }
+    EUCA_FREE(dev_names_removable);
+
+    return ret;
+}
+
+//!
+//!
+//!
+//! @param[in] dev_names
+//! @param[in] dm_tables
+//! @param[in] size
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int dm_create_devices(char *dev_names[], char *dm_tables[], int size)
+{
+    int i = 0;
+    int fd = 0;
+    int status = 0;
+    int rc = EUCA_OK;
+    int rbytes = 0;
+    pid_t cpid = 0;
+    char tmpfile[EUCA_MAX_PATH] = "";
+    char dm_path[MAX_DM_PATH] = "";
+    long long started = time_usec();
+
+    for (i = 0; i < size; i++) {
+        // create devices one by one
+        myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
+
+        if (dm_native) {
+            if (dm_create_device_native(dev_names[i], dm_tables[i]) == 0)
+                continue;
+            if (dm_native) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper table");
+                myprintf(EUCA_LOG_INFO, "{%u} error: %s, input: %s", (unsigned int)pthread_self(), strerror(errno), dm_tables[i]);
+                goto cleanup;
+            }
+        }
+
+        if ((cpid = fork()) < 0) {
+            // fork error
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto cleanup;
+        } else if (cpid == 0) {
+            // child process - runs `dmsetup` using system()
+            bzero(tmpfile, sizeof(tmpfile));
+            snprintf(tmpfile, sizeof(tmpfile) - 1, "/tmp/dmsetup.XXXXXX");
+            if ((fd = safe_mkstemp(tmpfile)) >= 0) {
+                if ((rbytes = write(fd, dm_tables[i], strlen(dm_tables[i]))) != strlen(dm_tables[i])) {
+                    // if write error
+                    LOGERROR("{%u} error: dm_create_devices: write returned number of bytes != write buffer: %d/%ld\n", (unsigned int)pthread_self(), rbytes, strlen(dm_tables[i]));
+                    unlink(tmpfile);
+                    exit(1);
+                }
+                close(fd);
+            } else {
+                // couldn't get fd
+                LOGERROR("{%u} error: dm_create_devices: couldn't open temporary file %s: %s\n", (unsigned int)pthread_self(), tmpfile, strerror(errno));
+                unlink(tmpfile);
+                exit(1);
+            }
+
+            // invoke `dmsetup create ...`
+            rc = euca_execlp(&status, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "create", dev_names[i], tmpfile, NULL);
+
+            // free out temp file
+            unlink(tmpfile);
+
+            // pass back dmsetup's return code
+            exit(WEXITSTATUS(status));
+        }
+        // parent - waits for child, reacts to status
+        if ((rc = timewait(cpid, &status, BLOBSTORE_DMSETUP_TIMEOUT_SEC)) <= 0) {
+            LOGERROR("{%u} error: dm_create_devices: bad exit from dmsetup child: %d\n", (unsigned int)pthread_self(), rc);
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto cleanup;
+        }
+
+        if (WEXITSTATUS(status) != 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper table with 'dmsetup'");
+            myprintf(EUCA_LOG_INFO, "{%u} command: %s %s create %s\n", (unsigned int)pthread_self(), helpers_path[ROOTWRAP], helpers_path[DMSETUP], dev_names[i]);
+            myprintf(EUCA_LOG_INFO, "{%u} input: %s", (unsigned int)pthread_self(), dm_tables[i]);
+            goto cleanup;
+        }
+
+        snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_names[i]);
+        if (diskutil_ch(dm_path, get_username(), NULL, BLOBSTORE_FILE_PERM) != EUCA_OK) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to change permissions on the device mapper file\n");
+            goto cleanup;
+        }
+    }
+
+    LOGDEBUG("created %d device mapper device(s) with %s in %lldms\n", size, (dm_native ? "ioctls" : helpers[DMSETUP]), ((time_usec() - started) / 1000));
+    return (0);
+cleanup:
+    _err_off();
+    dm_delete_devices(dev_names, i + 1);
+    _err_on();
+    return (-1);
+}
+
+//!
+//!
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static char *dm_get_zero(void)
+{
+    static char dev_zero[] = DM_PATH EUCA_ZERO;
+
+    struct stat sb;
+    int tried = 0;
+    while (stat(dev_zero, &sb) == -1) {
+        if (tried) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to create blockblob zero block device");
+            return NULL;
+        }
+
+        char *dm_tables[1] = { "0 " EUCA_ZERO_SIZE " zero" };
+        char *dm_names[1] = { EUCA_ZERO };
+        dm_create_devices(dm_names, dm_tables, 1);
+
+        tried = 1;
+    }
+
+    if (!S_ISBLK(sb.st_mode)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "blockblob zero is not a block device");
+        return NULL;
+    }
+
+    return dev_zero;
+}
+
+//!
+//!
+//!
+//! @param[in] bb
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int blockblob_check(const blockblob * bb)
+{
+    char **array = NULL;
+    int array_size = 0;
+    int err = 0;
+    _err_off();                        // do not care if metadata files do not exist
+
+    // check on dm devices listed in .dm of this blob, if any
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
+            if (dm_check_device(array[i]))
+                err++;
+            EUCA_FREE(array[i]);
+        }
+        EUCA_FREE(array);
+    }
+    // check on the loop device listed in .loopback of the blob, if any
+    char lo_dev[PATH_MAX] = "";
+    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bb->store, bb->id, lo_dev, sizeof(lo_dev));
+    if (strlen(lo_dev) > 0) {
+        struct stat sb;
+        if (stat(lo_dev, &sb) == -1) {
+            err++;
+        } else if (!S_ISBLK(sb.st_mode)) {
+            err++;
+        } else if (diskutil_loop_check(bb->blocks_path, lo_dev)) {
+            err++;
+        }
+    }
+    // check on .refs that point to blobs that no longer exist
+    if (get_stale_refs(bb, NULL) > 0)
+        err++;
+
+    // check on .lock files that are non-zero => blobs that were not closed properly
+    if (bb->in_use & BLOCKBLOB_STATUS_ABANDONED)
+        err++;
+
+    _err_on();
+    return err;
+}
+
+//!
+//!
+//!
+//! @param[in] bb
+//! @param[in] timeout_usec
+//! @param[in] do_force
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force)
+{
+    blobstore *bs = bb->store;
+    char **array = NULL;
+    int array_size = 0;
+    int ret = 0;
+
+    // delete dm devices listed in .dm of this blob
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) == -1 || dm_delete_devices(array, array_size) == -1) {
+        if (!do_force) {
+            ret = -1;
+            goto free;
+        }
+    }
+    for (int i = 0; i < array_size; i++) {
+        EUCA_FREE(array[i]);
+    }
+    EUCA_FREE(array);
+    array_size = 0;
+    array = NULL;
+
+    // Read in .deps (blobs that this blob depends on),
+    // so as to update their .refs (blobs depending on them).
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) == -1) {
+        ret = -1;
+        if (!do_force) {
+            ret = -1;
+            goto free;
+        }
+    }
+    char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+    snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id);
+    for (int i = 0; i < array_size; i++) {
+        char *store_path = strtok(array[i], " ");
+        char *blob_id = strtok(NULL, " ");  // the remaining entries in array[i] are ignored
+
+        if (strlen(store_path) < 1 || strlen(blob_id) < 1) {
+            continue;                  //! @TODO print a warning about store/blob corruption?
+        }
+
+        blobstore *dep_bs = bs;
+        if (strcmp(bs->path, store_path)) { // if deleting reference in a different blobstore
+            // need to open it
+            dep_bs = blobstore_open(store_path, 0, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+            if (dep_bs == NULL)
+                continue;              //! @TODO print a warning about store/blob corruption?
+            if (blobstore_lock(dep_bs, timeout_usec) == -1) {   // lock this (different) blobstore, too, so .refs are updated atomically
+                blobstore_close(dep_bs);
+                continue;              //! @TODO print a warning about store/blob corruption?
+            }
+        }
+        // update .refs file on each of the dependencies
+        if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, dep_bs, blob_id, my_ref, 1) == -1) {
+            //! @TODO print a warning about store/blob corruption?
+        }
+
+        if (!(check_in_use(dep_bs, blob_id, 0) & ~(BLOCKBLOB_STATUS_ABANDONED))) {  // in use except abandoned
+            loop_remove(dep_bs, blob_id);   //! @TODO do we care about errors?
+        }
+        if (dep_bs != bs) {
+            blobstore_unlock(dep_bs);
+            blobstore_close(dep_bs);
+        }
+    }
+
+    // remove the loopback entry for this blob
+    if (loop_remove(bs, bb->id) == -1) {
+        ret = -1;
+    }
+    // remove the files, data and metadata, for of this blob
+    if (delete_blockblob_files(bs, bb->id) < 1) {
+        ret = -1;
+    }
+
+free:
+    for (int i = 0; i < array_size; i++) {
+        EUCA_FREE(array[i]);
+    }
+    EUCA_FREE(array);
+
+    return ret;
+}
+
+//!
+//! If no outside references to the blob exist, and blob is not protected,
+//! deletes the blob and its metadata
+//!
+//! @param[in] bb
+//! @param[in] timeout_usec
+//! @param[in] do_force
+//!
+//! @return 0 if cleanup was successful and frees the blockblob handle, -1 otherwise,
+//!         and DOES NOT free the blockblob handle (so that it can be closed and freed
+//!         with blockblob_close)
+//!
+//! @pre
+//!
+//! @note
+//!
+int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force)
+{
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+    blobstore *bs = bb->store;
+    int ret = 0;
+    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse it
+        return -1;                     // failed to obtain a lock on the blobstore
+    }
+    // do not delete the blob if it is used by another one
+    bb->in_use = check_in_use(bs, bb->id, 0);   // update in_use status
+    // if in use other than opened (by this thread), backed, or abandoned
+    if (!do_force && (bb->in_use & ~(BLOCKBLOB_STATUS_OPENED | BLOCKBLOB_STATUS_BACKED | BLOCKBLOB_STATUS_ABANDONED))) {
+        ERR(BLOBSTORE_ERROR_AGAIN, NULL);
+        ret = -1;
+    } else {
+        ret = delete_blob_state(bb, timeout_usec, do_force);    // do the bulk of the cleanup
+
+        // close the open file descriptors
+        if (ftruncate(bb->fd_lock, 0) != 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+        }
+
+        if (close_and_unlock(bb->fd_lock) == -1) {
+            ret = -1;
+        } else {
+            bb->fd_lock = 0;           //! @TODO needed? maybe -1?
+        }
+
+        if (close(bb->fd_blocks) == -1) {
+            ret = -1;
+        } else {
+            bb->fd_blocks = 0;         //! @TODO needed? maybe -1?
+        }
+
+        // free the blob struct if everything above was OK
+        if (ret == 0) {
+            EUCA_FREE(bb);
+        }
+    }
+
+    int saved_errno = 0;
+    saved_errno = _blobstore_errno;    // save it because blobstore_unlock may overwrite it
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    }
+    if (saved_errno) {
+        _blobstore_errno = saved_errno;
+    }
+
+    return ret;
+}
+
+//!
+//!
+//!
+//! @param[in] bb
+//! @param[in] min_size_bytes
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int verify_bb(const blockblob * bb, unsigned long long min_size_bytes)
+{
+    if (bb->fd_lock == -1) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob lock involved in operation is not open");
+        return -1;
+    }
+    if (bb->fd_blocks == -1) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation is not open");
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(bb->fd_blocks, &sb) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
+        return -1;
+    }
+    if (sb.st_size < bb->size_bytes) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "blockblob involved in operation has backing of unexpected size");
+        LOGERROR("sb.st_size=%ld bb->size_bytes=%lld\n", sb.st_size, bb->size_bytes);
+        return -1;
+    }
+    if (sb.st_size < min_size_bytes) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation has backing that is too small");
+        return -1;
+    }
+    if (stat(bb->device_path, &sb) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
+        return -1;
+    }
+    if (!S_ISBLK(sb.st_mode)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation is missing a loopback block device");
+        return -1;
+    }
+    return 0;
+}
+
+//!
+//! Copies a section between two paths, files or block devices, in-process via
+//! diskutil_copy(), which clones, skips holes and keeps several I/Os in flight.
+//! Devices that only root can open are copied with dd through the root wrapper,
+//! as before.
+//!
+//! @param[in] src_path path of the source file or device
+//! @param[in] src_offset_bytes start offset in source
+//! @param[in] dst_path path of the destination file or device
+//! @param[in] dst_offset_bytes start offset in destination
+//! @param[in] len_bytes number of bytes to copy
+//!
+//! @return EUCA_OK on success or the error code from diskutil
+//!
+static int copy_section(const char *src_path, long long src_offset_bytes, const char *dst_path, long long dst_offset_bytes, long long len_bytes)
+{
+    int error = EUCA_OK;
+    diskutil_copy_stats stats = { 0 };
+
+    mode_t old_umask = umask(~BLOBSTORE_FILE_PERM);
+    error = diskutil_copy(src_path, dst_path, src_offset_bytes, dst_offset_bytes, len_bytes, &stats);
+    if (error == EUCA_ACCESS_ERROR) {
+        // determine the largest acceptable block size for dd, all the way down to a byte possibly
+        int granularity = 4096;
+        while (src_offset_bytes % granularity || dst_offset_bytes % granularity || len_bytes % granularity) {
+            granularity /= 2;
+        }
+        error = diskutil_dd2(src_path, dst_path, granularity, len_bytes / granularity, dst_offset_bytes / granularity, src_offset_bytes / granularity);
+    }
+    umask(old_umask);
+
+    return error;
+}
+
+//!
+//!
+//!
+//! @param[in] src_bb pointer to source blob to copy data from
+//! @param[in] src_offset_bytes start offset in source
+//! @param[in] dst_bb pointer to destination blob to copy data to
+//! @param[in] dst_offset_bytes start offset in destination
+//! @param[in] len_bytes 0 = copy until EOF of source
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, blockblob * dst_bb, unsigned long long dst_offset_bytes, unsigned long long len_bytes)  //
+{
+    int ret = 0;
+
+    if (src_bb == NULL || dst_bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
+        return -1;
+    }
+
+    long long copy_len_bytes = len_bytes;
+    if (copy_len_bytes == 0) {
+        copy_len_bytes = src_bb->size_bytes - src_offset_bytes;
+    }
+    if (copy_len_bytes < 1) {
+        ERR(BLOBSTORE_ERROR_INVAL, "copy source offset outside of range");
+        return -1;
+    }
+    // make sure both source and destination blobs are in good shape and big enough
+    if (verify_bb(src_bb, src_offset_bytes + copy_len_bytes) || verify_bb(dst_bb, dst_offset_bytes + copy_len_bytes)) {
+        return -1;
+    }
+    // do the copy (with block devices dd will silently omit to copy bytes outside the block boundary, so we use paths for uncloned blobs)
+    const char *src_path = (src_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(src_bb)) : (blockblob_get_file(src_bb));
+    const char *dst_path = (dst_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(dst_bb)) : (blockblob_get_file(dst_bb));
+    if (copy_section(src_path, src_offset_bytes, dst_path, dst_offset_bytes, copy_len_bytes)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
+        return -1;
+    }
+
+    return ret;
+}
+
+//!
+//! Sorts the device mapper table string sent to dmsetup. In some case, the table is
+//! sent in partition ordering rather than start block ordering. This cause dmsetup to
+//! get sick and puke some errors. For example, the following table will cause some
+//! errors:
+//! \li 0 63 linear /dev/mapper/euca-dsk-3AE63D3B-d6320e89-p0-snap 0
+//! \li 204863 2764800 linear /dev/loop0 0
+//! \li 2969663 6516 linear /dev/loop1 0
+//! \li 2976179 1024 linear /dev/loop2 0
+//! \li 63 204800 linear /dev/loop3 0
+//! This function will take the previous table and re-order it in starting block order
+//! as in the following:
+//! \li 0 63 linear /dev/mapper/euca-dsk-3AE63D3B-d6320e89-p0-snap 0
+//! \li 63 204800 linear /dev/loop3 0
+//! \li 204863 2764800 linear /dev/loop0 0
+//! \li 2969663 6516 linear /dev/loop1 0
+//! \li 2976179 1024 linear /dev/loop2 0
+//!
+//! @param[in,out] pOldTable the table string to sort
+//!
+//! @return a pointer to the newly allocated table string if successful or NULL if any
+//!         error occured.
+//!
+//! @pre The provided table field must not be NULL and must contain more than 1 entry
+//!      separated by the newline character.
+//!
+//! @post On success the given table will be freed and a newly constructed table will be
+//!       returned. The original table pointer will be set to the newly returned table too.
+//!
+static char *dm_sort_table(char **pOldTable)
+{
+#define DM_MAX_LINES          32
+#define DM_LINE_LENGTH       256
+
+    unsigned int i = 0;
+    unsigned int lineId = UINT32_MAX;
+    unsigned long long minVal = UINT64_MAX;
+    unsigned long long curVal = 0;
+    char *aLines[DM_MAX_LINES] = { NULL };  //!< TODO: Turn this into a dynamic re-alloc'ed array?
+    char sLine[DM_LINE_LENGTH] = "";
+    char *pNewTable = NULL;
+    char *pDupTable = NULL;
+    register unsigned int j = 0;
+    register unsigned int count = 0;
+
+    if (pOldTable == NULL)
+        return (NULL);
+
+    // Make sure our given table isn't NULL.
+    if ((*pOldTable) != NULL) {
+        // Duplicate the original table in case we need it later. strtok() will mess it up
+        pDupTable = strdup((*pOldTable));
+
+        // Split in lines and count
+        aLines[count] = strtok((*pOldTable), "\n");
+        while ((aLines[count] != NULL) && (count < (DM_MAX_LINES - 1))) {
+            count++;
+            aLines[count] = strtok(NULL, "\n");
+        }
+
+        // Will we need to sort?
+        if (aLines[count] != NULL) {
+            // hmmm. This sounds list we has more than DM_MAX_LINES... Just return the table as is
+            pNewTable = pDupTable;
+        } else if (count == 1) {
+            // So we have 1 line. Because strtok() messed up the original table
+            // lets return the duplicate version of the original
+            pNewTable = pDupTable;
+        } else {
+            // we need more than 1 line in this table to sort. At this point we know
+            // we have less than DM_MAX_LINES so we don't have to worry 'bout it.
+            if (count > 1) {
+                // Sort every lines in the 'lines' array
+                for (i = 0; i < count; i++) {
+                    // Search for the smaller starting block value in the lefover lines
+                    lineId = UINT32_MAX;
+                    minVal = UINT64_MAX;
+                    for (j = 0; j < count; j++) {
+                        // As we pick lines from the array, they become NULLs
+                        if (aLines[j] != NULL) {
+                            // Retrieve the starting block number which is the first item on the line
+                            if (sscanf(aLines[j], "%llu", &curVal) == 1) {
+                                // Is this a newest low?
+                                if (curVal < minVal) {
+                                    lineId = j;
+                                    minVal = curVal;
+                                }
+                            }
+                        }
+                    }
+
+                    // Since we set line ID to UINT32_MAX, its safe to assume its valid if less than count
+                    if (lineId < count) {
+                        // Re-add the newline character at the end of this string.
+                        if (snprintf(sLine, DM_LINE_LENGTH, "%s\n", aLines[lineId]) > 0) {
+                            // Add it to our new table.
+                            if ((pNewTable = euca_strdupcat(pNewTable, sLine)) == NULL) {
+                                EUCA_FREE(pDupTable);
+                                EUCA_FREE((*pOldTable));
+                                return (NULL);
+                            }
+                        }
+                        // Lets no longer consider this line.
+                        aLines[lineId] = NULL;
+                    }
+                }
+            }
+            // If count is anything else than 1, we no longer need pDupTable
+            EUCA_FREE(pDupTable);
+        }
+    }
+    // Free our given table and return the new one.
+    EUCA_FREE((*pOldTable));
+
+    // Set our in/out parameter properly on our way out
+    (*pOldTable) = pNewTable;
+    return (pNewTable);
+
+#undef DM_MAX_LINES
+#undef DM_LINE_LENGTH
+}
+
+//!
+//!
+//!
+//! @param[in] bb pointer to destination blob, which blocks may be used as backing
+//! @param[in] map pointer to map of blocks from other blobs/devices to be copied/mapped/snapshotted
+//! @param[in] map_size size of the map[]
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
+{
+    int ret = 0;
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
+        return -1;
+    }
+
+    if (map == NULL || map_size < 1 || map_size > MAX_BLOCKMAP_SIZE) {
+        ERR(BLOBSTORE_ERROR_INVAL, "invalid blockbmap or its size");
+        return -1;
+    }
+    long long bb_size_blocks = round_down_sec(bb->size_bytes) / 512;    // dmsetup will not map partial blocks, so we conservatively round down
+
+    // verify dependencies (block devices present, blob sizes make sense, zero device present)
+    char *zero_dev = NULL;
+    for (int i = 0; i < map_size; i++) {
+        const blockmap *m = map + i;
+        if (m->relation_type != BLOBSTORE_COPY && bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_DM) {
+            ERR(BLOBSTORE_ERROR_INVAL, "relation type is incompatible with snapshot policy");
+            return -1;
+        }
+
+        switch (m->source_type) {
+        case BLOBSTORE_DEVICE:{
+                const char *path = m->source.device_path;
+                if (path == NULL) {
+                    ERR(BLOBSTORE_ERROR_INVAL, "one of the device paths is NULL");
+                    return -1;
+                }
+                struct stat sb;
+                if (stat(path, &sb) == -1) {
+                    PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
+                    return -1;
+                }
+                if (!S_ISBLK(sb.st_mode)) {
+                    ERR(BLOBSTORE_ERROR_INVAL, "one of the device paths is not a block device");
+                    return -1;
+                }
+                break;
+            }
+        case BLOBSTORE_BLOCKBLOB:{
+                const blockblob *sbb = m->source.blob;
+                if (sbb == NULL) {
+                    ERR(BLOBSTORE_ERROR_INVAL, "one of the source blockblob pointers is NULL");
+                    return -1;
+                }
+                long long sbb_size_blocks = round_down_sec(sbb->size_bytes) / 512;  // dmsetup will not map partial blocks, so we conservatively round down
+                if (verify_bb(sbb, sbb_size_blocks)) {
+                    return -1;
+                }
+                if (sbb_size_blocks < (m->first_block_src + m->len_blocks)) {
+                    LOGWARN("source size = %lld mappped size = %lld\n", sbb_size_blocks, (m->first_block_src + m->len_blocks));
+                    ERR(BLOBSTORE_ERROR_INVAL, "one of the source blockblobs is too small for the map");
+                    return -1;
+                }
+                if (bb_size_blocks < (m->first_block_dst + m->len_blocks)) {
+                    ERR(BLOBSTORE_ERROR_INVAL, "the destination blockblob is too small for the map");
+                    return -1;
+                }
+                if (m->relation_type == BLOBSTORE_SNAPSHOT && m->len_blocks < MIN_BLOCKS_SNAPSHOT) {
+                    ERR(BLOBSTORE_ERROR_INVAL, "snapshot size is too small");
+                    return -1;
+                }
+                break;
+            }
+        case BLOBSTORE_ZERO:
+            zero_dev = dm_get_zero();
+            if (zero_dev == NULL) {
+                return -1;
+            }
+
+            break;
+        default:
+            ERR(BLOBSTORE_ERROR_INVAL, "invalid map entry type");
+            return -1;
+        }
+    }
+
+    // compute the base name of the device mapper device
+    char dm_base[MAX_DM_LINE];
+    snprintf(dm_base, sizeof(dm_base), "euca-%s", bb->id);
+    for (char *c = dm_base; *c != '\0'; c++) {
+        if (*c == '/')                 // if the ID has slashes,
+            *c = '-';                  // replace them with hyphens
+    }
+
+    int devices = 0;
+    int mapped_or_snapshotted = 0;
+    char buf[MAX_DM_LINE];
+    char *main_dm_table = NULL;
+    char **dev_names = EUCA_ZALLOC(map_size * 4 + 1, sizeof(char *));   // for device mapper dev names we will create
+    if (dev_names == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+    char **dm_tables = EUCA_ZALLOC(map_size * 4 + 1, sizeof(char *));   // for device mapper tables
+    if (dm_tables == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        EUCA_FREE(dev_names);
+        return -1;
+    }
+    // either does copies or computes the device mapper tables
+    for (int i = 0; i < map_size; i++) {
+        const blockmap *m = map + i;
+        const char *dev;
+
+        switch (m->source_type) {
+        case BLOBSTORE_DEVICE:
+            dev = m->source.device_path;
+            break;
+        case BLOBSTORE_BLOCKBLOB:
+            dev = m->source.blob->device_path;
+            break;
+        case BLOBSTORE_ZERO:
+            dev = zero_dev;
+            break;
+        default:
+            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
+            ret = -1;
+            goto free;
+        }
+
+        long long first_block_src = m->first_block_src;
+        switch (m->relation_type) {
+        case BLOBSTORE_COPY:
+            // do the copy
+            if (copy_section(dev, (m->first_block_src * 512LL), bb->device_path, (m->first_block_dst * 512LL), (m->len_blocks * 512LL))) {
+                ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
+                ret = -1;
+                goto free;
+            }
+            // append to the main dm table (we do this here even if we never end up using the device mapper because all segments were copied)
+            snprintf(buf, sizeof(buf), "%lld %lld linear %s %lld\n", m->first_block_dst, m->len_blocks, bb->device_path, m->first_block_dst);
+            main_dm_table = euca_strdupcat(main_dm_table, buf);
+            break;
+
+        case BLOBSTORE_SNAPSHOT:{
+                int granularity = 16;  // coarser granularity does not work
+                while (m->len_blocks % granularity) {   // do we need to do this?
+                    granularity /= 2;
+                }
+
+                // with a linear map, create a backing device for the snapshot
+                snprintf(buf, sizeof(buf), "%s-p%d-back", dm_base, i);
+                dev_names[devices] = strdup(buf);
+                char *backing_dev = dev_names[devices];
+                snprintf(buf, sizeof(buf), "0 %lld linear %s %lld\n", m->len_blocks, bb->device_path, m->first_block_dst);
+                dm_tables[devices] = strdup(buf);
+                devices++;
+
+                // if there is an offset in the source device, create another map (since snapshots cannot be done at offsets)
+                const char *snapshotted_dev = dev;
+                if (m->first_block_src > 0 && m->source_type != BLOBSTORE_ZERO) {
+                    snprintf(buf, sizeof(buf), "%s-p%d-real", dm_base, i);
+                    dev_names[devices] = strdup(buf);
+                    snapshotted_dev = dev_names[devices];
+                    snprintf(buf, sizeof(buf), "0 %lld linear %s %lld\n", m->len_blocks, ((dev) ? dev : 0), m->first_block_src);
+                    dm_tables[devices] = strdup(buf);
+                    devices++;
+                }
+                // take a snapshot of the source
+                snprintf(buf, sizeof(buf), "%s-p%d-snap", dm_base, i);
+                dev_names[devices] = strdup(buf);
+                dev = dev_names[devices];
+                // We use 'n' for a non-persistent snapshot, which will not persist across a reboot.
+                // With 'p' we could get a persistent snapshot at the cost of 0.2-3.0% overhead in
+                // disk space, depending on chunksize [1-16], but then we would need to rebuild
+                // device mapper entries and change space management to accommodate the overhead.
+                snprintf(buf, sizeof(buf), "0 %lld snapshot %s%s " DM_PATH "%s n %d\n", m->len_blocks, snapshotted_dev[0] == 'e' ? DM_PATH : "",
+                         snapshotted_dev, backing_dev, granularity);
+                dm_tables[devices] = strdup(buf);
+                devices++;
+
+                first_block_src = 0;   // for snapshots the mapping goes from the -snap device at offset 0
+                // yes, fall through
+            }
+
+        case BLOBSTORE_MAP:
+            // append to the main dm table
+            snprintf(buf, sizeof(buf), "%lld %lld linear %s%s %lld\n", m->first_block_dst, m->len_blocks, dev[0] == 'e' ? DM_PATH : "", dev, first_block_src);
+            main_dm_table = euca_strdupcat(main_dm_table, buf);
+            mapped_or_snapshotted++;
+            break;
+
+        default:
+            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
             ret = -1;
             goto free;
         }
     }
-    char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-    snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id);
-    for (int i = 0; i < array_size; i++) {
-        char *store_path = strtok(array[i], " ");
-        char *blob_id = strtok(NULL, " ");  // the remaining entries in array[i] are ignored
 
-        if (strlen(store_path) < 1 || strlen(blob_id) < 1) {
-            continue;                  //! @TODO print a warning about store/blob corruption?
+    if (mapped_or_snapshotted) {       // we must use the device mapper
+        if ((main_dm_table = dm_sort_table(&main_dm_table)) == NULL) {
+            ret = -1;
+            goto free;
         }
 
-        blobstore *dep_bs = bs;
-        if (strcmp(bs->path, store_path)) { // if deleting reference in a different blobstore
-            // need to open it
-            dep_bs = blobstore_open(store_path, 0, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
-            if (dep_bs == NULL)
-                continue;              //! @TODO print a warning about store/blob corruption?
-            if (blobstore_lock(dep_bs, timeout_usec) == -1) {   // lock this (different) blobstore, too, so .refs are updated atomically
-                blobstore_close(dep_bs);
-                continue;              //! @TODO print a warning about store/blob corruption?
-            }
-        }
-        // update .refs file on each of the dependencies
-        if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, dep_bs, blob_id, my_ref, 1) == -1) {
-            //! @TODO print a warning about store/blob corruption?
-        }
+        euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
+        dev_names[devices] = strdup(dm_base);
+        dm_tables[devices] = main_dm_table;
+        devices++;
 
-        if (!(check_in_use(dep_bs, blob_id, 0) & ~(BLOCKBLOB_STATUS_ABANDONED))) {  // in use except abandoned
-            loop_remove(dep_bs, blob_id);   //! @TODO do we care about errors?
+        // change device_path from loopback to the device-mapper path
+        snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+
+        if (dm_create_devices(dev_names, dm_tables, devices)) {
+            ret = -1;
+            goto free;
         }
-        if (dep_bs != bs) {
-            blobstore_unlock(dep_bs);
-            blobstore_close(dep_bs);
+        // record new devices in .dm of this blob
+        if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, devices) == -1) {
+            ret = -1;
+            goto cleanup;
         }
-    }
+        bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;  // remember that blobstore uses device mapper
 
-    // remove the loopback entry for this blob
-    if (loop_remove(bs, bb->id) == -1) {
-        ret = -1;
-    }
-    // remove the files, data and metadata, for of this blob
-    if (delete_blockblob_files(bs, bb->id) < 1) {
-        ret = -1;
-    }
+        // update .refs on dependencies and create .deps for this blob
+        char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+        snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id); //! @TODO use store ID to proof against moving blobstore?
+        for (int i = 0; i < map_size; i++) {
+            const blockmap *m = map + i;
+            const blockblob *sbb = m->source.blob;
 
-free:
-    for (int i = 0; i < array_size; i++) {
-        EUCA_FREE(array[i]);
-    }
-    EUCA_FREE(array);
+            if (m->source_type != BLOBSTORE_BLOCKBLOB)  // only blobstores have references
+                continue;
 
-    return ret;
-}
+            if (m->relation_type == BLOBSTORE_COPY) // copies do not create references
+                continue;
 
-//!
-//! If no outside references to the blob exist, and blob is not protected,
-//! deletes the blob and its metadata
-//!
-//! @param[in] bb
-//! @param[in] timeout_usec
-//! @param[in] do_force
-//!
-//! @return 0 if cleanup was successful and frees the blockblob handle, -1 otherwise,
-//!         and DOES NOT free the blockblob handle (so that it can be closed and freed
-//!         with blockblob_close)
-//!
-//! @pre
-//!
-//! @note
-//!
-int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force)
-{
-    if (bb == NULL) {
-        ERR(BLOBSTORE_ERROR_INVAL, NULL);
-        return -1;
-    }
-    blobstore *bs = bb->store;
-    int ret = 0;
-    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse it
-        return -1;                     // failed to obtain a lock on the blobstore
-    }
-    // do not delete the blob if it is used by another one
-    bb->in_use = check_in_use(bs, bb->id, 0);   // update in_use status
-    // if in use other than opened (by this thread), backed, or abandoned
-    if (!do_force && (bb->in_use & ~(BLOCKBLOB_STATUS_OPENED | BLOCKBLOB_STATUS_BACKED | BLOCKBLOB_STATUS_ABANDONED))) {
-        ERR(BLOBSTORE_ERROR_AGAIN, NULL);
-        ret = -1;
-    } else {
-        ret = delete_blob_state(bb, timeout_usec, do_force);    // do the bulk of the cleanup
+            if (blobstore_lock(sbb->store, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock the source blobstore so the .refs are updated atomically
+                LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
+            // update .refs
+            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, sbb->store, sbb->id, my_ref, 0) == -1) {
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
 
-        // close the open file descriptors
-        if (ftruncate(bb->fd_lock, 0) != 0) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+            if (blobstore_unlock(sbb->store) == -1) {
+                ret = -1;
+                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
+            }
+            // record the dependency in .deps (redundant entries will be filtered out)
+            char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
+            snprintf(dep_ref, sizeof(dep_ref), "%s %s %s %llu %llu", sbb->store->path, sbb->id, blobstore_relation_type_name[m->relation_type], m->first_block_dst, m->len_blocks);
+            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, dep_ref, 0) == -1) {
+                ret = -1;
+                goto cleanup;          // ditto
+            }
         }
+    } else {
+        EUCA_FREE(main_dm_table);
+    }
 
-        if (close_and_unlock(bb->fd_lock) == -1) {
-            ret = -1;
-        } else {
-            bb->fd_lock = 0;           //! @TODO needed? maybe -1?
-        }
+    goto free;
 
-        if (close(bb->fd_blocks) == -1) {
-            ret = -1;
-        } else {
-            bb->fd_blocks = 0;         //! @TODO needed? maybe -1?
-        }
+cleanup:                              // this is failure cleanup code path
+    {
+        int saved_errno;
 
-        // free the blob struct if everything above was OK
-        if (ret == 0) {
-            EUCA_FREE(bb);
+        saved_errno = _blobstore_errno; // save it because dm_delete_devices may overwrite it
+        LOGERROR("error: blockblob_clone: %s (%d)\n", blobstore_get_last_msg(), _blobstore_errno);
+
+        // remove dm devices that may have been created
+        if (dm_delete_devices(dev_names, devices) == 0) {
+
+            // remove the .dm file so that others do not
+            // needlessly attempt to remove dm devices later
+            char path[PATH_MAX];
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, path, sizeof(path));
+            index_note_begin(bb->store, bb->id);
+            unlink(path);
+            index_note_commit(bb->store, bb->id);
         }
+        _blobstore_errno = saved_errno;
     }
 
-    int saved_errno = 0;
-    saved_errno = _blobstore_errno;    // save it because blobstore_unlock may overwrite it
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+free:
+    // Only free main_dm_table if mapped_or_snapshotted is 0. If its greater than
+    // 0, it would be assigned to the dm_tables array.
+    if (mapped_or_snapshotted == 0) {
+        EUCA_FREE(main_dm_table);
     }
-    if (saved_errno) {
-        _blobstore_errno = saved_errno;
+
+    for (int i = 0; i < devices; i++) {
+        EUCA_FREE(dev_names[i]);
+        EUCA_FREE(dm_tables[i]);
     }
+    EUCA_FREE(dev_names);
+    EUCA_FREE(dm_tables);
 
     return ret;
 }
 
 //!
+//! Makes room in the per-pack arrays of the chunks for the given pack number
 //!
+//! @param[in] chunks
+//! @param[in] pack
 //!
-//! @param[in] bb
-//! @param[in] min_size_bytes
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success and -1 if out of memory
 //!
-static int verify_bb(const blockblob * bb, unsigned long long min_size_bytes)
+static int chunks_grow(blobstore_chunks * chunks, int pack)
 {
-    if (bb->fd_lock == -1) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob lock involved in operation is not open");
-        return -1;
-    }
-    if (bb->fd_blocks == -1) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation is not open");
-        return -1;
-    }
-    struct stat sb;
-    if (fstat(bb->fd_blocks, &sb) == -1) {
-        PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
-        return -1;
-    }
-    if (sb.st_size < bb->size_bytes) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "blockblob involved in operation has backing of unexpected size");
-        LOGERROR("sb.st_size=%ld bb->size_bytes=%lld\n", sb.st_size, bb->size_bytes);
-        return -1;
-    }
-    if (sb.st_size < min_size_bytes) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation has backing that is too small");
-        return -1;
-    }
-    if (stat(bb->device_path, &sb) == -1) {
-        PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
-        return -1;
-    }
-    if (!S_ISBLK(sb.st_mode)) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob involved in operation is missing a loopback block device");
-        return -1;
-    }
+    int npacks = chunks->npacks;
+    void *p = NULL;
+
+    if (pack < chunks->npacks)
+        return 0;
+    while (npacks <= pack)
+        npacks = (npacks > 0) ? (npacks * 2) : 16;
+
+    if ((p = EUCA_REALLOC(chunks->packs, npacks, sizeof(blockblob *))) == NULL)
+        goto nomem;
+    chunks->packs = p;
+    if ((p = EUCA_REALLOC(chunks->pack_state, npacks, sizeof(signed char))) == NULL)
+        goto nomem;
+    chunks->pack_state = p;
+    if ((p = EUCA_REALLOC(chunks->pack_first, npacks, sizeof(long long))) == NULL)
+        goto nomem;
+    chunks->pack_first = p;
+    if ((p = EUCA_REALLOC(chunks->pack_blocks, npacks, sizeof(long long))) == NULL)
+        goto nomem;
+    chunks->pack_blocks = p;
+
+    for (int i = chunks->npacks; i < npacks; i++) {
+        chunks->packs[i] = NULL;
+        chunks->pack_state[i] = 0;
+        chunks->pack_first[i] = 0;
+        chunks->pack_blocks[i] = 0;
+    }
+    chunks->npacks = npacks;
     return 0;
+
+nomem:
+    ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+    return -1;
 }
 
 //!
+//! Tells whether the pack blob with the given number is in the blobstore
 //!
+//! @param[in] bs
+//! @param[in] pack
 //!
-//! @param[in] src_bb pointer to source blob to copy data from
-//! @param[in] src_offset_bytes start offset in source
-//! @param[in] dst_bb pointer to destination blob to copy data to
-//! @param[in] dst_offset_bytes start offset in destination
-//! @param[in] len_bytes 0 = copy until EOF of source
+//! @return TRUE or FALSE
 //!
-//! @return
+static int chunks_pack_exists(blobstore * bs, int pack)
+{
+    char id[BLOBSTORE_MAX_PATH] = "";
+    char path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+
+    snprintf(id, sizeof(id), DEDUP_PACK_FORMAT, pack);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, id, path, sizeof(path));
+    return (stat(path, &sb) == 0);
+}
+
 //!
-//! @pre
+//! Locks the chunks file of a blobstore and loads the chunks recorded in it. Chunks in packs
+//! that have since been revoked are dropped from the file. The lock serializes deduplication
+//! within the blobstore, across threads and processes, until chunks_free() is called.
 //!
-//! @note
+//! @param[in] bs
+//! @param[in] more_chunks number of chunks that may be added, for sizing the hash table
+//! @param[in] timeout_usec how long to wait for the lock
 //!
-int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, blockblob * dst_bb, unsigned long long dst_offset_bytes, unsigned long long len_bytes)  //
+//! @return the chunks or NULL on error
+//!
+static blobstore_chunks *chunks_load(blobstore * bs, long long more_chunks, long long timeout_usec)
 {
-    int ret = 0;
+    int fd = -1;
+    int dropped = 0;
+    char path[PATH_MAX] = "";
+    char *buf = NULL;
+    char *line = NULL;
+    char *saveptr = NULL;
+    long long expected = 0;
+    struct stat sb = { 0 };
+    blobstore_chunks *chunks = NULL;
+
+    // open_and_lock() truncates the files it creates, so the file is created separately
+    index_file_path(bs, BLOBSTORE_CHUNKS_FILE, path, sizeof(path));
+    if ((fd = open(path, (O_CREAT | O_RDWR), BLOBSTORE_FILE_PERM)) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_ACCES);
+        return NULL;
+    }
+    close(fd);
 
-    if (src_bb == NULL || dst_bb == NULL) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
-        return -1;
+    if ((chunks = EUCA_ZALLOC(1, sizeof(blobstore_chunks))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return NULL;
+    }
+    chunks->max_pack = -1;
+    chunks->fill_pack = -1;
+    if ((chunks->fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM)) == -1) {
+        EUCA_FREE(chunks);
+        return NULL;
     }
 
-    long long copy_len_bytes = len_bytes;
-    if (copy_len_bytes == 0) {
-        copy_len_bytes = src_bb->size_bytes - src_offset_bytes;
+    if (fstat(chunks->fd, &sb) == -1) {
+        ERR(BLOBSTORE_ERROR_ACCES, "failed to stat the chunks file");
+        goto fail;
     }
-    if (copy_len_bytes < 1) {
-        ERR(BLOBSTORE_ERROR_INVAL, "copy source offset outside of range");
-        return -1;
+    expected = (sb.st_size / DEDUP_CHUNKS_LINE) + more_chunks;
+    for (chunks->nbuckets = BLOBSTORE_INDEX_BUCKETS; chunks->nbuckets < expected; chunks->nbuckets *= 2) ;
+    if (((chunks->buckets = EUCA_ZALLOC(chunks->nbuckets, sizeof(blobstore_chunk *))) == NULL)
+        || ((buf = EUCA_ALLOC((sb.st_size + 1), sizeof(char))) == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto fail;
     }
-    // make sure both source and destination blobs are in good shape and big enough
-    if (verify_bb(src_bb, src_offset_bytes + copy_len_bytes) || verify_bb(dst_bb, dst_offset_bytes + copy_len_bytes)) {
-        return -1;
+    if ((sb.st_size > 0) && (fd_to_buf(chunks->fd, buf, sb.st_size) != sb.st_size)) {
+        goto fail;
     }
-    // determine the largest acceptable block size for dd, all the way down to a byte possibly
-    int granularity = 4096;
-    while (src_offset_bytes % granularity || dst_offset_bytes % granularity || copy_len_bytes % granularity) {
-        granularity /= 2;
+    buf[sb.st_size] = '\0';
+
+    for (line = strtok_r(buf, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+        char digest[MD5_STR_SIZE] = "";
+        int pack = -1;
+        int slot = -1;
+        blobstore_chunk *c = NULL;
+
+        if ((sscanf(line, "%32s %d %d", digest, &pack, &slot) != 3) || (strlen(digest) != (MD5_STR_SIZE - 1)) || (pack < 0) || (slot < 0)) {
+            dropped++;
+            continue;
+        }
+        if (chunks_grow(chunks, pack))
+            goto fail;
+        if (pack > chunks->max_pack)
+            chunks->max_pack = pack;
+        if (chunks->pack_state[pack] == 0)
+            chunks->pack_state[pack] = chunks_pack_exists(bs, pack) ? 1 : -1;
+        if (chunks->pack_state[pack] < 0) { // the pack was revoked, and its chunks with it
+            dropped++;
+            continue;
+        }
+
+        if ((c = EUCA_ZALLOC(1, sizeof(blobstore_chunk))) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            goto fail;
+        }
+        euca_strncpy(c->digest, digest, sizeof(c->digest));
+        c->pack = pack;
+        c->slot = slot;
+        unsigned int b = index_hash(c->digest, -1) & (chunks->nbuckets - 1);
+        c->next = chunks->buckets[b];
+        chunks->buckets[b] = c;
+
+        // new chunks go after the last one in the newest pack
+        if ((pack > chunks->fill_pack) || ((pack == chunks->fill_pack) && (slot >= chunks->fill_slot))) {
+            chunks->fill_pack = pack;
+            chunks->fill_slot = slot + 1;
+        }
     }
+    EUCA_FREE(buf);
 
-    // do the copy (with block devices dd will silently omit to copy bytes outside the block boundary, so we use paths for uncloned blobs)
-    const char *src_path = (src_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(src_bb)) : (blockblob_get_file(src_bb));
-    const char *dst_path = (dst_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(dst_bb)) : (blockblob_get_file(dst_bb));
-    mode_t old_umask = umask(~BLOBSTORE_FILE_PERM);
-    int error = diskutil_dd2(src_path, dst_path, granularity, copy_len_bytes / granularity, dst_offset_bytes / granularity, src_offset_bytes / granularity);
-    umask(old_umask);
-    if (error) {
-        ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
-        return -1;
+    if (dropped > 0) {                 // rewrite the file with just the chunks that are still there
+        LOGDEBUG("dropping %d chunk(s) of revoked packs from %s\n", dropped, path);
+        if ((ftruncate(chunks->fd, 0) == -1) || (lseek(chunks->fd, 0, SEEK_SET) == -1)) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto fail;
+        }
+        for (unsigned int b = 0; b < chunks->nbuckets; b++) {
+            for (blobstore_chunk * c = chunks->buckets[b]; c != NULL; c = c->next) {
+                char record[MD5_STR_SIZE + 32] = "";
+                int len = snprintf(record, sizeof(record), "%s %d %d\n", c->digest, c->pack, c->slot);
+                if (write(chunks->fd, record, len) != len) {
+                    PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+                    goto fail;
+                }
+            }
+        }
     }
+    return chunks;
 
-    return ret;
+fail:
+    EUCA_FREE(buf);
+    chunks_free(chunks);
+    return NULL;
 }
 
 //!
-//! Sorts the device mapper table string sent to dmsetup. In some case, the table is
-//! sent in partition ordering rather than start block ordering. This cause dmsetup to
-//! get sick and puke some errors. For example, the following table will cause some
-//! errors:
-//! \li 0 63 linear /dev/mapper/euca-dsk-3AE63D3B-d6320e89-p0-snap 0
-//! \li 204863 2764800 linear /dev/loop0 0
-//! \li 2969663 6516 linear /dev/loop1 0
-//! \li 2976179 1024 linear /dev/loop2 0
-//! \li 63 204800 linear /dev/loop3 0
-//! This function will take the previous table and re-order it in starting block order
-//! as in the following:
-//! \li 0 63 linear /dev/mapper/euca-dsk-3AE63D3B-d6320e89-p0-snap 0
-//! \li 63 204800 linear /dev/loop3 0
-//! \li 204863 2764800 linear /dev/loop0 0
-//! \li 2969663 6516 linear /dev/loop1 0
-//! \li 2976179 1024 linear /dev/loop2 0
+//! Closes the pack blobs opened for the chunks, unlocks the chunks file and frees the chunks
 //!
-//! @param[in,out] pOldTable the table string to sort
+//! @param[in] chunks
 //!
-//! @return a pointer to the newly allocated table string if successful or NULL if any
-//!         error occured.
+static void chunks_free(blobstore_chunks * chunks)
+{
+    if (chunks == NULL)
+        return;
+
+    for (int i = 0; i < chunks->npacks; i++) {
+        if (chunks->packs[i] != NULL)
+            blockblob_close(chunks->packs[i]);
+    }
+    for (unsigned int b = 0; (chunks->buckets != NULL) && (b < chunks->nbuckets); b++) {
+        for (blobstore_chunk * c = chunks->buckets[b]; c != NULL;) {
+            blobstore_chunk *next = c->next;
+            EUCA_FREE(c);
+            c = next;
+        }
+    }
+    if (chunks->fd != -1)
+        close_and_unlock(chunks->fd);
+    EUCA_FREE(chunks->buckets);
+    EUCA_FREE(chunks->packs);
+    EUCA_FREE(chunks->pack_state);
+    EUCA_FREE(chunks->pack_first);
+    EUCA_FREE(chunks->pack_blocks);
+    EUCA_FREE(chunks);
+}
+
 //!
-//! @pre The provided table field must not be NULL and must contain more than 1 entry
-//!      separated by the newline character.
+//! Opens the pack blob with the given number, unless it is open already. A pack that cannot be
+//! opened is taken to be gone, and its chunks are stored again when they are needed.
 //!
-//! @post On success the given table will be freed and a newly constructed table will be
-//!       returned. The original table pointer will be set to the newly returned table too.
+//! @param[in] bs
+//! @param[in] chunks
+//! @param[in] pack
+//! @param[in] timeout_usec
 //!
-static char *dm_sort_table(char **pOldTable)
+//! @return the pack blob or NULL if it could not be opened
+//!
+static blockblob *chunks_open_pack(blobstore * bs, blobstore_chunks * chunks, int pack, long long timeout_usec)
 {
-#define DM_MAX_LINES          32
-#define DM_LINE_LENGTH       256
-
-    unsigned int i = 0;
-    unsigned int lineId = UINT32_MAX;
-    unsigned long long minVal = UINT64_MAX;
-    unsigned long long curVal = 0;
-    char *aLines[DM_MAX_LINES] = { NULL };  //!< TODO: Turn this into a dynamic re-alloc'ed array?
-    char sLine[DM_LINE_LENGTH] = "";
-    char *pNewTable = NULL;
-    char *pDupTable = NULL;
-    register unsigned int j = 0;
-    register unsigned int count = 0;
+    char id[BLOBSTORE_MAX_PATH] = "";
 
-    if (pOldTable == NULL)
-        return (NULL);
+    if (chunks_grow(chunks, pack))
+        return NULL;
+    if (chunks->packs[pack] != NULL)
+        return chunks->packs[pack];
+    if (chunks->pack_state[pack] < 0)
+        return NULL;
 
-    // Make sure our given table isn't NULL.
-    if ((*pOldTable) != NULL) {
-        // Duplicate the original table in case we need it later. strtok() will mess it up
-        pDupTable = strdup((*pOldTable));
+    snprintf(id, sizeof(id), DEDUP_PACK_FORMAT, pack);
+    if ((chunks->packs[pack] = blockblob_open(bs, id, 0, 0, NULL, timeout_usec)) == NULL) {
+        LOGWARN("failed to open chunk pack %s, its chunks will be stored again: %s\n", id, blobstore_get_last_msg());
+        chunks->pack_state[pack] = -1;
+        return NULL;
+    }
+    if (chunks->pack_state[pack] == 0)
+        chunks->pack_state[pack] = 1;
+    return chunks->packs[pack];
+}
 
-        // Split in lines and count
-        aLines[count] = strtok((*pOldTable), "\n");
-        while ((aLines[count] != NULL) && (count < (DM_MAX_LINES - 1))) {
-            count++;
-            aLines[count] = strtok(NULL, "\n");
-        }
+//!
+//! Finds a stored chunk with the given digest and opens the pack that holds it
+//!
+//! @param[in] bs
+//! @param[in] chunks
+//! @param[in] digest hex MD5 of the chunk
+//! @param[in] timeout_usec
+//!
+//! @return the chunk or NULL if there is no usable copy of it
+//!
+static blobstore_chunk *chunks_find(blobstore * bs, blobstore_chunks * chunks, const char *digest, long long timeout_usec)
+{
+    blockblob *pack_bb = NULL;
+    unsigned int b = index_hash(digest, -1) & (chunks->nbuckets - 1);
 
-        // Will we need to sort?
-        if (aLines[count] != NULL) {
-            // hmmm. This sounds list we has more than DM_MAX_LINES... Just return the table as is
-            pNewTable = pDupTable;
-        } else if (count == 1) {
-            // So we have 1 line. Because strtok() messed up the original table
-            // lets return the duplicate version of the original
-            pNewTable = pDupTable;
-        } else {
-            // we need more than 1 line in this table to sort. At this point we know
-            // we have less than DM_MAX_LINES so we don't have to worry 'bout it.
-            if (count > 1) {
-                // Sort every lines in the 'lines' array
-                for (i = 0; i < count; i++) {
-                    // Search for the smaller starting block value in the lefover lines
-                    lineId = UINT32_MAX;
-                    minVal = UINT64_MAX;
-                    for (j = 0; j < count; j++) {
-                        // As we pick lines from the array, they become NULLs
-                        if (aLines[j] != NULL) {
-                            // Retrieve the starting block number which is the first item on the line
-                            if (sscanf(aLines[j], "%llu", &curVal) == 1) {
-                                // Is this a newest low?
-                                if (curVal < minVal) {
-                                    lineId = j;
-                                    minVal = curVal;
-                                }
-                            }
-                        }
-                    }
+    for (blobstore_chunk * c = chunks->buckets[b]; c != NULL; c = c->next) {
+        if (strcmp(c->digest, digest))
+            continue;
+        if ((pack_bb = chunks_open_pack(bs, chunks, c->pack, timeout_usec)) == NULL)
+            continue;
+        if (((c->slot + 1) * DEDUP_CHUNK_BYTES) > pack_bb->size_bytes)
+            continue;                  // not from this pack, which must have been recreated
+        return c;
+    }
+    return NULL;
+}
 
-                    // Since we set line ID to UINT32_MAX, its safe to assume its valid if less than count
-                    if (lineId < count) {
-                        // Re-add the newline character at the end of this string.
-                        if (snprintf(sLine, DM_LINE_LENGTH, "%s\n", aLines[lineId]) > 0) {
-                            // Add it to our new table.
-                            if ((pNewTable = euca_strdupcat(pNewTable, sLine)) == NULL) {
-                                EUCA_FREE(pDupTable);
-                                EUCA_FREE((*pOldTable));
-                                return (NULL);
-                            }
-                        }
-                        // Lets no longer consider this line.
-                        aLines[lineId] = NULL;
-                    }
-                }
+//!
+//! Stores a new chunk in the pack that is being filled, starting a new pack when there is
+//! none or it is full, and records it in the chunks file
+//!
+//! @param[in] bs
+//! @param[in] chunks
+//! @param[in] digest hex MD5 of the chunk
+//! @param[in] buf contents of the chunk, DEDUP_CHUNK_BYTES long
+//! @param[in] timeout_usec
+//!
+//! @return the chunk or NULL on error
+//!
+static blobstore_chunk *chunks_add(blobstore * bs, blobstore_chunks * chunks, const char *digest, const char *buf, long long timeout_usec)
+{
+    int len = 0;
+    char id[BLOBSTORE_MAX_PATH] = "";
+    char record[MD5_STR_SIZE + 32] = "";
+    long long done = 0;
+    long long offset = 0;
+    long long pack_chunks = DEDUP_PACK_CHUNKS;
+    blockblob *pack_bb = NULL;
+    blobstore_chunk *c = NULL;
+
+    if (chunks->fill_pack >= 0) {
+        pack_bb = chunks_open_pack(bs, chunks, chunks->fill_pack, timeout_usec);
+        if ((pack_bb != NULL) && (((chunks->fill_slot + 1) * DEDUP_CHUNK_BYTES) > pack_bb->size_bytes))
+            pack_bb = NULL;            // this one is full
+    }
+
+    if (pack_bb == NULL) {             // start a new pack, small enough not to crowd out the blobs of a small store
+        if ((pack_chunks * DEDUP_CHUNK_BLOCKS) > (bs->limit_blocks / 8))
+            pack_chunks = bs->limit_blocks / 8 / DEDUP_CHUNK_BLOCKS;
+        if (pack_chunks < 1)
+            pack_chunks = 1;
+
+        for (int tries = 0; (pack_bb == NULL) && (tries < 10); tries++) {
+            int pack = ++chunks->max_pack;
+            if (chunks_grow(chunks, pack))
+                return NULL;
+            snprintf(id, sizeof(id), DEDUP_PACK_FORMAT, pack);
+            if ((pack_bb = blockblob_open(bs, id, (pack_chunks * DEDUP_CHUNK_BYTES), (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL), NULL, timeout_usec)) == NULL) {
+                if (blobstore_get_error() != BLOBSTORE_ERROR_EXIST)
+                    return NULL;       // e.g., there is no room for another pack
+                continue;              // left behind with a lost chunks file, so its number is skipped
             }
-            // If count is anything else than 1, we no longer need pDupTable
-            EUCA_FREE(pDupTable);
+            chunks->packs[pack] = pack_bb;
+            chunks->pack_state[pack] = 1;
+            chunks->fill_pack = pack;
+            chunks->fill_slot = 0;
         }
+        if (pack_bb == NULL)
+            return NULL;
     }
-    // Free our given table and return the new one.
-    EUCA_FREE((*pOldTable));
 
-    // Set our in/out parameter properly on our way out
-    (*pOldTable) = pNewTable;
-    return (pNewTable);
+    offset = chunks->fill_slot * DEDUP_CHUNK_BYTES;
+    while (done < DEDUP_CHUNK_BYTES) {
+        ssize_t wrote = pwrite(pack_bb->fd_blocks, (buf + done), (DEDUP_CHUNK_BYTES - done), (offset + done));
+        if (wrote < 1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to write a chunk into its pack");
+            return NULL;
+        }
+        done += wrote;
+    }
 
-#undef DM_MAX_LINES
-#undef DM_LINE_LENGTH
+    len = snprintf(record, sizeof(record), "%s %d %d\n", digest, chunks->fill_pack, chunks->fill_slot);
+    if ((lseek(chunks->fd, 0, SEEK_END) == -1) || (write(chunks->fd, record, len) != len)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to record a chunk in the chunks file");
+        return NULL;
+    }
+
+    if ((c = EUCA_ZALLOC(1, sizeof(blobstore_chunk))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return NULL;
+    }
+    euca_strncpy(c->digest, digest, sizeof(c->digest));
+    c->pack = chunks->fill_pack;
+    c->slot = chunks->fill_slot++;
+    unsigned int b = index_hash(c->digest, -1) & (chunks->nbuckets - 1);
+    c->next = chunks->buckets[b];
+    chunks->buckets[b] = c;
+    chunks->pack_state[c->pack] = 2;
+    return c;
 }
 
 //!
+//! Stores the contents of a blob as fixed-size chunks, keyed by their digest, in pack blobs
+//! shared by all blobs of the blobstore, and turns the blob into a device mapper map of those
+//! chunks. A chunk that is already in a pack, because another blob or another part of this
+//! one has the same contents, is mapped rather than stored again. The blob file is then
+//! emptied out and, since its blocks are mapped from the packs, the blob no longer counts
+//! toward the limit of the blobstore, while the packs only count the distinct chunks.
 //!
+//! @param[in] bb an open blob, written through its file and not mapped by any other blob yet
+//! @param[in] timeout_usec how long to wait for other blobs of the blobstore to be deduplicated
 //!
-//! @param[in] bb pointer to destination blob, which blocks may be used as backing
-//! @param[in] map pointer to map of blocks from other blobs/devices to be copied/mapped/snapshotted
-//! @param[in] map_size size of the map[]
-//!
-//! @return
+//! @return 0 on success or -1 on error, in which case the blob is left as it was
 //!
-//! @pre
+//! @pre The blobstore uses device mapper snapshots.
 //!
-//! @note
+//! @note Blobs that are read as files (e.g., kernels) should not be deduplicated, since the
+//!       file of a deduplicated blob is no longer accessible, just like that of a clone.
 //!
-int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
+int blockblob_dedup(blockblob * bb, long long timeout_usec)
 {
-    int ret = 0;
-    if (bb == NULL) {
-        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
-        return -1;
-    }
+    int ret = -1;
+    int segments = 0;
+    int refs_added = 0;
+    int dm_created = 0;
+    int deps_size = 0;
+    long long nchunks = 0;
+    long long new_chunks = 0;
+    long long size_blocks = 0;
+    long long run_dst = 0;
+    long long run_src = 0;
+    long long run_len = 0;
+    int run_pack = -1;
+    size_t table_size = 0;
+    size_t table_len = 0;
+    char *buf = NULL;
+    char *table = NULL;
+    char **manifest = NULL;
+    char **deps = NULL;
+    char *dev_names[1] = { NULL };
+    char *dm_tables[1] = { NULL };
+    char dm_base[MAX_DM_LINE] = "";
+    char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1] = "";
+    blobstore *bs = NULL;
+    blobstore_chunks *chunks = NULL;
 
-    if (map == NULL || map_size < 1 || map_size > MAX_BLOCKMAP_SIZE) {
-        ERR(BLOBSTORE_ERROR_INVAL, "invalid blockbmap or its size");
+    if ((bb == NULL) || (bb->store == NULL)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob pointer is NULL");
+        return -1;
+    }
+    bs = bb->store;
+    if (bs->snapshot_policy != BLOBSTORE_SNAPSHOT_DM) {
+        ERR(BLOBSTORE_ERROR_INVAL, "deduplication requires device mapper snapshots");
+        return -1;
+    }
+    if ((bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) || (bb->fd_blocks == -1)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob is not open or is already a clone");
+        return -1;
+    }
+    if ((bb->size_bytes == 0) || (bb->size_bytes % 512) || !strncmp(bb->id, DEDUP_PACK_PREFIX, strlen(DEDUP_PACK_PREFIX))) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob cannot be deduplicated");
+        return -1;
+    }
+    if (check_in_use(bs, bb->id, 0) & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED)) {
+        ERR(BLOBSTORE_ERROR_INVAL, "blockblob is already used by device mapper");
         return -1;
     }
-    long long bb_size_blocks = round_down_sec(bb->size_bytes) / 512;    // dmsetup will not map partial blocks, so we conservatively round down
-
-    // verify dependencies (block devices present, blob sizes make sense, zero device present)
-    char *zero_dev = NULL;
-    for (int i = 0; i < map_size; i++) {
-        const blockmap *m = map + i;
-        if (m->relation_type != BLOBSTORE_COPY && bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_DM) {
-            ERR(BLOBSTORE_ERROR_INVAL, "relation type is incompatible with snapshot policy");
-            return -1;
-        }
-
-        switch (m->source_type) {
-        case BLOBSTORE_DEVICE:{
-                const char *path = m->source.device_path;
-                if (path == NULL) {
-                    ERR(BLOBSTORE_ERROR_INVAL, "one of the device paths is NULL");
-                    return -1;
-                }
-                struct stat sb;
-                if (stat(path, &sb) == -1) {
-                    PROPAGATE_ERR(BLOBSTORE_ERROR_NOENT);
-                    return -1;
-                }
-                if (!S_ISBLK(sb.st_mode)) {
-                    ERR(BLOBSTORE_ERROR_INVAL, "one of the device paths is not a block device");
-                    return -1;
-                }
-                break;
-            }
-        case BLOBSTORE_BLOCKBLOB:{
-                const blockblob *sbb = m->source.blob;
-                if (sbb == NULL) {
-                    ERR(BLOBSTORE_ERROR_INVAL, "one of the source blockblob pointers is NULL");
-                    return -1;
-                }
-                long long sbb_size_blocks = round_down_sec(sbb->size_bytes) / 512;  // dmsetup will not map partial blocks, so we conservatively round down
-                if (verify_bb(sbb, sbb_size_blocks)) {
-                    return -1;
-                }
-                if (sbb_size_blocks < (m->first_block_src + m->len_blocks)) {
-                    LOGWARN("source size = %lld mappped size = %lld\n", sbb_size_blocks, (m->first_block_src + m->len_blocks));
-                    ERR(BLOBSTORE_ERROR_INVAL, "one of the source blockblobs is too small for the map");
-                    return -1;
-                }
-                if (bb_size_blocks < (m->first_block_dst + m->len_blocks)) {
-                    ERR(BLOBSTORE_ERROR_INVAL, "the destination blockblob is too small for the map");
-                    return -1;
-                }
-                if (m->relation_type == BLOBSTORE_SNAPSHOT && m->len_blocks < MIN_BLOCKS_SNAPSHOT) {
-                    ERR(BLOBSTORE_ERROR_INVAL, "snapshot size is too small");
-                    return -1;
-                }
-                break;
-            }
-        case BLOBSTORE_ZERO:
-            zero_dev = dm_get_zero();
-            if (zero_dev == NULL) {
-                return -1;
-            }
 
-            break;
-        default:
-            ERR(BLOBSTORE_ERROR_INVAL, "invalid map entry type");
-            return -1;
-        }
+    size_blocks = bb->size_bytes / 512;
+    nchunks = (size_blocks + DEDUP_CHUNK_BLOCKS - 1) / DEDUP_CHUNK_BLOCKS;
+    if ((chunks = chunks_load(bs, nchunks, timeout_usec)) == NULL)
+        return -1;
+    if (((buf = EUCA_ALLOC(DEDUP_CHUNK_BYTES, sizeof(char))) == NULL) || ((manifest = EUCA_ZALLOC(nchunks, sizeof(char *))) == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto free;
     }
 
-    // compute the base name of the device mapper device
-    char dm_base[MAX_DM_LINE];
     snprintf(dm_base, sizeof(dm_base), "euca-%s", bb->id);
     for (char *c = dm_base; *c != '\0'; c++) {
         if (*c == '/')                 // if the ID has slashes,
             *c = '-';                  // replace them with hyphens
     }
 
-    int devices = 0;
-    int mapped_or_snapshotted = 0;
-    char buf[MAX_DM_LINE];
-    char *main_dm_table = NULL;
-    char **dev_names = EUCA_ZALLOC(map_size * 4 + 1, sizeof(char *));   // for device mapper dev names we will create
-    if (dev_names == NULL) {
-        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-        return -1;
-    }
-    char **dm_tables = EUCA_ZALLOC(map_size * 4 + 1, sizeof(char *));   // for device mapper tables
-    if (dm_tables == NULL) {
-        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
-        EUCA_FREE(dev_names);
-        return -1;
-    }
-    // either does copies or computes the device mapper tables
-    for (int i = 0; i < map_size; i++) {
-        const blockmap *m = map + i;
-        const char *dev;
+    // hash the blob chunk by chunk, storing the chunks not seen before and extending the
+    // map with a segment for each run of chunks that are adjacent in the same pack
+    for (long long i = 0; i <= nchunks; i++) {
+        blobstore_chunk *c = NULL;
+        long long dst = i * DEDUP_CHUNK_BLOCKS;
+        long long len = 0;
+        long long src = 0;
+
+        if (i < nchunks) {
+            unsigned char md5[MD5_DIGEST_LENGTH];
+            char digest[MD5_STR_SIZE] = "";
+            long long done = 0;
+
+            len = ((size_blocks - dst) < DEDUP_CHUNK_BLOCKS) ? (size_blocks - dst) : DEDUP_CHUNK_BLOCKS;
+            while (done < (len * 512)) {
+                ssize_t got = pread(bb->fd_blocks, (buf + done), ((len * 512) - done), ((dst * 512) + done));
+                if (got < 1) {
+                    ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to read the blockblob");
+                    goto free;
+                }
+                done += got;
+            }
+            bzero(buf + done, DEDUP_CHUNK_BYTES - done);    // a short last chunk is padded with zeros
+            MD5((unsigned char *)buf, DEDUP_CHUNK_BYTES, md5);
+            md5digest2str(digest, sizeof(digest), md5);
 
-        switch (m->source_type) {
-        case BLOBSTORE_DEVICE:
-            dev = m->source.device_path;
-            break;
-        case BLOBSTORE_BLOCKBLOB:
-            dev = m->source.blob->device_path;
-            break;
-        case BLOBSTORE_ZERO:
-            dev = zero_dev;
-            break;
-        default:
-            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
-            ret = -1;
-            goto free;
-        }
+            if ((c = chunks_find(bs, chunks, digest, timeout_usec)) == NULL) {
+                if ((c = chunks_add(bs, chunks, digest, buf, timeout_usec)) == NULL)
+                    goto free;
+                new_chunks++;
+            }
+            src = c->slot * DEDUP_CHUNK_BLOCKS;
 
-        long long first_block_src = m->first_block_src;
-        switch (m->relation_type) {
-        case BLOBSTORE_COPY:
-            // do the copy
-            if (diskutil_dd2(dev, bb->device_path, 512, m->len_blocks, m->first_block_dst, m->first_block_src)) {
-                ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
-                ret = -1;
+            if (asprintf(&manifest[i], "%s %d %d", c->digest, c->pack, c->slot) == -1) {
+                manifest[i] = NULL;
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
                 goto free;
             }
-            // append to the main dm table (we do this here even if we never end up using the device mapper because all segments were copied)
-            snprintf(buf, sizeof(buf), "%lld %lld linear %s %lld\n", m->first_block_dst, m->len_blocks, bb->device_path, m->first_block_dst);
-            main_dm_table = euca_strdupcat(main_dm_table, buf);
-            break;
-
-        case BLOBSTORE_SNAPSHOT:{
-                int granularity = 16;  // coarser granularity does not work
-                while (m->len_blocks % granularity) {   // do we need to do this?
-                    granularity /= 2;
-                }
+            if (chunks->pack_blocks[c->pack] == 0)
+                chunks->pack_first[c->pack] = dst;
+            chunks->pack_blocks[c->pack] += len;
 
-                // with a linear map, create a backing device for the snapshot
-                snprintf(buf, sizeof(buf), "%s-p%d-back", dm_base, i);
-                dev_names[devices] = strdup(buf);
-                char *backing_dev = dev_names[devices];
-                snprintf(buf, sizeof(buf), "0 %lld linear %s %lld\n", m->len_blocks, bb->device_path, m->first_block_dst);
-                dm_tables[devices] = strdup(buf);
-                devices++;
+            if ((run_len > 0) && (c->pack == run_pack) && ((run_src + run_len) == src)) {
+                run_len += len;        // the chunk continues the current segment
+                continue;
+            }
+        }
 
-                // if there is an offset in the source device, create another map (since snapshots cannot be done at offsets)
-                const char *snapshotted_dev = dev;
-                if (m->first_block_src > 0 && m->source_type != BLOBSTORE_ZERO) {
-                    snprintf(buf, sizeof(buf), "%s-p%d-real", dm_base, i);
-                    dev_names[devices] = strdup(buf);
-                    snapshotted_dev = dev_names[devices];
-                    snprintf(buf, sizeof(buf), "0 %lld linear %s %lld\n", m->len_blocks, ((dev) ? dev : 0), m->first_block_src);
-                    dm_tables[devices] = strdup(buf);
-                    devices++;
+        if (run_len > 0) {             // end the current segment
+            if ((table_len + MAX_DM_LINE) >= table_size) {
+                char *p = NULL;
+                table_size = (table_size > 0) ? (table_size * 2) : (MAX_DM_LINE * 64);
+                if ((p = EUCA_REALLOC(table, table_size, sizeof(char))) == NULL) {
+                    ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                    goto free;
                 }
-                // take a snapshot of the source
-                snprintf(buf, sizeof(buf), "%s-p%d-snap", dm_base, i);
-                dev_names[devices] = strdup(buf);
-                dev = dev_names[devices];
-                // We use 'n' for a non-persistent snapshot, which will not persist across a reboot.
-                // With 'p' we could get a persistent snapshot at the cost of 0.2-3.0% overhead in
-                // disk space, depending on chunksize [1-16], but then we would need to rebuild
-                // device mapper entries and change space management to accommodate the overhead.
-                snprintf(buf, sizeof(buf), "0 %lld snapshot %s%s " DM_PATH "%s n %d\n", m->len_blocks, snapshotted_dev[0] == 'e' ? DM_PATH : "",
-                         snapshotted_dev, backing_dev, granularity);
-                dm_tables[devices] = strdup(buf);
-                devices++;
-
-                first_block_src = 0;   // for snapshots the mapping goes from the -snap device at offset 0
-                // yes, fall through
+                table = p;
             }
-
-        case BLOBSTORE_MAP:
-            // append to the main dm table
-            snprintf(buf, sizeof(buf), "%lld %lld linear %s%s %lld\n", m->first_block_dst, m->len_blocks, dev[0] == 'e' ? DM_PATH : "", dev, first_block_src);
-            main_dm_table = euca_strdupcat(main_dm_table, buf);
-            mapped_or_snapshotted++;
-            break;
-
-        default:
-            ERR(BLOBSTORE_ERROR_INVAL, "invalid device map source type");
-            ret = -1;
-            goto free;
+            table_len += snprintf(table + table_len, table_size - table_len, "%lld %lld linear %s %lld\n", run_dst, run_len, chunks->packs[run_pack]->device_path, run_src);
+            segments++;
         }
+        run_pack = (c != NULL) ? c->pack : -1;
+        run_dst = dst;
+        run_src = src;
+        run_len = len;
     }
 
-    if (mapped_or_snapshotted) {       // we must use the device mapper
-        if ((main_dm_table = dm_sort_table(&main_dm_table)) == NULL) {
-            ret = -1;
+    // new chunks must be on disk before the blob lets go of its copy of them
+    for (int i = 0; i < chunks->npacks; i++) {
+        if ((chunks->pack_state[i] == 2) && (fdatasync(chunks->packs[i]->fd_blocks) == -1)) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
             goto free;
         }
+    }
 
-        euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
-        dev_names[devices] = strdup(dm_base);
-        dm_tables[devices] = main_dm_table;
-        devices++;
-
-        // change device_path from loopback to the device-mapper path
-        snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+    dev_names[0] = dm_base;
+    dm_tables[0] = table;
+    if (dm_create_devices(dev_names, dm_tables, 1))
+        goto free;
+    dm_created = 1;
+    if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bs, bb->id, dev_names, 1) == -1)
+        goto cleanup;
 
-        if (dm_create_devices(dev_names, dm_tables, devices)) {
-            ret = -1;
-            goto free;
+    // update .refs on the packs and record them in .deps of this blob, one entry
+    // per pack, so that the mapped blocks are not counted toward the limit twice
+    if ((deps = EUCA_ZALLOC(chunks->npacks, sizeof(char *))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto cleanup;
+    }
+    snprintf(my_ref, sizeof(my_ref), "%s %s", bs->path, bb->id);
+    for (int i = 0; i < chunks->npacks; i++) {
+        if (chunks->pack_blocks[i] == 0)
+            continue;
+        if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {
+            LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
+            goto cleanup;
         }
-        // record new devices in .dm of this blob
-        if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, devices) == -1) {
-            ret = -1;
+        if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, chunks->packs[i]->id, my_ref, 0) == -1) {
+            blobstore_unlock(bs);
             goto cleanup;
         }
-        bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;  // remember that blobstore uses device mapper
-
-        // update .refs on dependencies and create .deps for this blob
-        char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-        snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id); //! @TODO use store ID to proof against moving blobstore?
-        for (int i = 0; i < map_size; i++) {
-            const blockmap *m = map + i;
-            const blockblob *sbb = m->source.blob;
-
-            if (m->source_type != BLOBSTORE_BLOCKBLOB)  // only blobstores have references
-                continue;
+        blobstore_unlock(bs);
+        refs_added = i + 1;
 
-            if (m->relation_type == BLOBSTORE_COPY) // copies do not create references
-                continue;
+        if (asprintf(&deps[deps_size], "%s %s %s %lld %lld", bs->path, chunks->packs[i]->id, blobstore_relation_type_name[BLOBSTORE_MAP],
+                     chunks->pack_first[i], chunks->pack_blocks[i]) == -1) {
+            deps[deps_size] = NULL;
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            goto cleanup;
+        }
+        deps_size++;
+    }
+    if ((write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, bb->id, deps, deps_size) == -1)
+        || (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb->id, manifest, nchunks) == -1)) {
+        goto cleanup;
+    }
 
-            if (blobstore_lock(sbb->store, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock the source blobstore so the .refs are updated atomically
-                LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
-            }
-            // update .refs
-            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, sbb->store, sbb->id, my_ref, 0) == -1) {
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
-            }
+    euca_strncpy(bb->dm_name, dm_base, sizeof(bb->dm_name));
+    snprintf(bb->device_path, sizeof(bb->device_path), DM_FORMAT, dm_base);
+    bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;
 
-            if (blobstore_unlock(sbb->store) == -1) {
-                ret = -1;
-                goto cleanup;          //! @TODO remove .refs entries from this batch that succeeded, if any?
-            }
-            // record the dependency in .deps (redundant entries will be filtered out)
-            char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1];
-            snprintf(dep_ref, sizeof(dep_ref), "%s %s %s %llu %llu", sbb->store->path, sbb->id, blobstore_relation_type_name[m->relation_type], m->first_block_dst, m->len_blocks);
-            if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, dep_ref, 0) == -1) {
-                ret = -1;
-                goto cleanup;          // ditto
-            }
+    // the blocks are served from the packs now, so the blob gives back the space it took up
+    {
+        int punched = -1;
+        index_note_begin(bs, bb->id);
+#ifdef FALLOC_FL_PUNCH_HOLE
+        punched = fallocate(bb->fd_blocks, (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE), 0, bb->size_bytes);
+#endif /* FALLOC_FL_PUNCH_HOLE */
+        if ((punched == -1) && ((ftruncate(bb->fd_blocks, 0) == -1) || (ftruncate(bb->fd_blocks, bb->size_bytes) == -1))) {
+            LOGWARN("failed to release the blocks of deduplicated blob %s\n", bb->id);
         }
-    } else {
-        EUCA_FREE(main_dm_table);
+        index_note_commit(bs, bb->id);
     }
 
+    LOGINFO("deduplicated blob %s: %lld chunk(s), %lld of them new, mapped in %d segment(s)\n", bb->id, nchunks, new_chunks, segments);
+    ret = 0;
     goto free;
 
-cleanup:                              // this is failure cleanup code path
+cleanup:                              // this is failure cleanup code path, once device mapper is involved
     {
-        int saved_errno;
-
-        saved_errno = _blobstore_errno; // save it because dm_delete_devices may overwrite it
-        LOGERROR("error: blockblob_clone: %s (%d)\n", blobstore_get_last_msg(), _blobstore_errno);
-
-        // remove dm devices that may have been created
-        if (dm_delete_devices(dev_names, devices) == 0) {
+        int saved_errno = _blobstore_errno; // save it because the calls below may overwrite it
+        LOGERROR("error: blockblob_dedup: %s (%d)\n", blobstore_get_last_msg(), _blobstore_errno);
 
-            // remove the .dm file so that others do not
-            // needlessly attempt to remove dm devices later
+        for (int i = 0; i < refs_added; i++) {
+            if ((chunks->pack_blocks[i] > 0) && (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) != -1)) {
+                update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, chunks->packs[i]->id, my_ref, 1);
+                blobstore_unlock(bs);
+            }
+        }
+        if (dm_created && (dm_delete_devices(dev_names, 1) == 0)) {
             char path[PATH_MAX];
-            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, path, sizeof(path));
+            index_note_begin(bs, bb->id);
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bs, bb->id, path, sizeof(path));
+            unlink(path);
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, bb->id, path, sizeof(path));
+            unlink(path);
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_CHUNKS, bs, bb->id, path, sizeof(path));
             unlink(path);
+            index_note_commit(bs, bb->id);
         }
         _blobstore_errno = saved_errno;
     }
 
 free:
-    // Only free main_dm_table if mapped_or_snapshotted is 0. If its greater than
-    // 0, it would be assigned to the dm_tables array.
-    if (mapped_or_snapshotted == 0) {
-        EUCA_FREE(main_dm_table);
-    }
-
-    for (int i = 0; i < devices; i++) {
-        EUCA_FREE(dev_names[i]);
-        EUCA_FREE(dm_tables[i]);
-    }
-    EUCA_FREE(dev_names);
-    EUCA_FREE(dm_tables);
-
+    for (long long i = 0; (manifest != NULL) && (i < nchunks); i++)
+        EUCA_FREE(manifest[i]);
+    EUCA_FREE(manifest);
+    for (int i = 0; i < deps_size; i++)
+        EUCA_FREE(deps[i]);
+    EUCA_FREE(deps);
+    EUCA_FREE(table);
+    EUCA_FREE(buf);
+    chunks_free(chunks);               // closes the packs, which stay attached while the blob maps them
     return ret;
 }
 
@@ -5188,16 +7718,97 @@ static int do_clone_test(const char *base, const char *name, blobstore_format_t
     } else {
         _DELEBB(bb3, B3, 0);           // NOT referenced in case of _COPY, thus deletable
     }
-    _DELEBB(bb5, B5, 0);               // delete #5
-    if (copy_or_snapshot == BLOBSTORE_SNAPSHOT) {
-        _OPENBB(bb3, B3, 0, NULL, 0, 0, 0); // re-open so we can finally delete it
-        _DELEBB(bb3, B3, 0);           // should work now
+    _DELEBB(bb5, B5, 0);               // delete #5
+    if (copy_or_snapshot == BLOBSTORE_SNAPSHOT) {
+        _OPENBB(bb3, B3, 0, NULL, 0, 0, 0); // re-open so we can finally delete it
+        _DELEBB(bb3, B3, 0);           // should work now
+    }
+
+    blobstore_close(bs);
+    blobstore_close(bs2);
+
+    printf("completed cloning test\n");
+done:
+    return errors;
+}
+
+//!
+//! Deduplicates two blobs that share most of their chunks, then checks their
+//! contents through the device mapper and the ratio reported by blobstore_stat()
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_dedup_test(const char *base, const char *name)
+{
+    int ret;
+    int errors = 0;
+    const char pattern1[] = "1231";    // chunks of the first blob, the last one repeating the first
+    const char pattern2[] = "1234";    // chunks of the second blob, three of them shared with the first
+    char *chunk = NULL;
+    blobstore_meta meta;
+    printf("commencing deduplication test\n");
+
+    blobstore *bs = create_teststore(DEDUP_CHUNK_BLOCKS * 64, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_DM);
+    if (bs == NULL) {
+        errors++;
+        goto done;
+    }
+
+    blockblob *bb1, *bb2;
+    _OPENBB(bb1, B1, DEDUP_CHUNK_BLOCKS * 4, NULL, _CBB, 0, 0);
+    _OPENBB(bb2, B2, DEDUP_CHUNK_BLOCKS * 4, NULL, _CBB, 0, 0);
+    if (errors || ((chunk = EUCA_ALLOC(DEDUP_CHUNK_BYTES, sizeof(char))) == NULL)) {
+        errors++;
+        goto done;
+    }
+    for (int i = 0; i < 4; i++) {
+        memset(chunk, pattern1[i], DEDUP_CHUNK_BYTES);
+        if (pwrite(bb1->fd_blocks, chunk, DEDUP_CHUNK_BYTES, i * DEDUP_CHUNK_BYTES) != DEDUP_CHUNK_BYTES)
+            errors++;
+        memset(chunk, pattern2[i], DEDUP_CHUNK_BYTES);
+        if (pwrite(bb2->fd_blocks, chunk, DEDUP_CHUNK_BYTES, i * DEDUP_CHUNK_BYTES) != DEDUP_CHUNK_BYTES)
+            errors++;
+    }
+    EUCA_FREE(chunk);
+
+    if ((blockblob_dedup(bb1, 0) == -1) || (blockblob_dedup(bb2, 0) == -1)) {
+        printf("ERROR: failed to deduplicate blobs: %s\n", blobstore_get_last_msg());
+        errors++;
+        goto done;
+    }
+    if (blockblob_dedup(bb1, 0) != -1) {
+        printf("ERROR: deduplicated a blob twice\n");
+        errors++;
+    }
+    for (int i = 0; i < 4; i++) {
+        if ((read_byte(bb1, i * DEDUP_CHUNK_BYTES + 1) != pattern1[i]) || (read_byte(bb2, (i + 1) * DEDUP_CHUNK_BYTES - 1) != pattern2[i])) {
+            printf("ERROR: deduplicated blobs have unexpected data in chunk %d\n", i);
+            errors++;
+        }
     }
 
+    if (blobstore_stat(bs, &meta) == -1) {
+        errors++;
+    } else {
+        printf("dedup: logical=%llu stored=%llu ratio=%.2f\n", meta.dedup_blocks_logical, meta.dedup_blocks_stored, meta.dedup_ratio);
+        if ((meta.dedup_blocks_logical != (DEDUP_CHUNK_BLOCKS * 8)) || (meta.dedup_ratio < 1.5)) {
+            printf("ERROR: unexpected deduplication ratio\n");
+            errors++;
+        }
+    }
+
+    _DELEBB(bb1, B1, 0);
+    _DELEBB(bb2, B2, 0);
+    if (blobstore_delete_regex(bs, DEDUP_PACK_PREFIX ".*") < 1) {  // the packs are no longer mapped, so they can go
+        printf("ERROR: failed to delete the chunk packs\n");
+        errors++;
+    }
     blobstore_close(bs);
-    blobstore_close(bs2);
 
-    printf("completed cloning test\n");
+    printf("completed deduplication test\n");
 done:
     return errors;
 }
@@ -5240,6 +7851,7 @@ static int do_metadata_test(const char *base, const char *name)
     _CHKMETA("foo.loopback", BLOCKBLOB_PATH_LOOPBACK);
     _CHKMETA("foo.sig", BLOCKBLOB_PATH_SIG);
     _CHKMETA("foo.refs", BLOCKBLOB_PATH_REFS);
+    _CHKMETA("foo.chunks", BLOCKBLOB_PATH_CHUNKS);
     _CHKMETA("foo.dm.foo.dm", BLOCKBLOB_PATH_DM);
     _CHKMETA("foo/dm/dm.foo.loopback", BLOCKBLOB_PATH_LOOPBACK);
     _CHKMETA("foo/dm/dm.dm.sig", BLOCKBLOB_PATH_SIG);
@@ -5264,6 +7876,7 @@ static int do_metadata_test(const char *base, const char *name)
     _CHKMETA("foo/loopback", BLOCKBLOB_PATH_LOOPBACK);
     _CHKMETA("foo/sig", BLOCKBLOB_PATH_SIG);
     _CHKMETA("foo/refs", BLOCKBLOB_PATH_REFS);
+    _CHKMETA("foo/chunks", BLOCKBLOB_PATH_CHUNKS);
     _CHKMETA("foo.dm.foo/dm", BLOCKBLOB_PATH_DM);
     _CHKMETA("foo/dm/dm.foo/loopback", BLOCKBLOB_PATH_LOOPBACK);
     _CHKMETA("foo/dm/dm.dm/sig", BLOCKBLOB_PATH_SIG);
@@ -5338,6 +7951,405 @@ done:
     return errors;
 }
 
+//!
+//! Creates a blob by hand, without a loopback device, so the index test can run as a regular user
+//!
+//! @param[in] bs
+//! @param[in] id
+//! @param[in] size_bytes
+//!
+//! @return 0 on success and 1 on error
+//!
+static int make_test_blob(blobstore * bs, const char *id, unsigned long long size_bytes)
+{
+    int fd = -1;
+    char path[PATH_MAX] = "";
+
+    if (ensure_blockblob_metadata_path(bs, id) == -1)
+        return 1;
+    index_note_begin(bs, id);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, id, path, sizeof(path));
+    if (((fd = open(path, (O_RDWR | O_CREAT), BLOBSTORE_FILE_PERM)) == -1) || (ftruncate(fd, size_bytes) == -1)) {
+        printf("failed to create %s\n", path);
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+    close(fd);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, id, path, sizeof(path));
+    if ((fd = open(path, (O_RDWR | O_CREAT), BLOBSTORE_FILE_PERM)) == -1) {
+        printf("failed to create %s\n", path);
+        return 1;
+    }
+    close(fd);
+    index_note_commit(bs, id);
+    return 0;
+}
+
+//!
+//! Compares what the blob index lists against what a walk of the directory tree finds
+//!
+//! @param[in] bs
+//! @param[in] label
+//!
+//! @return the number of differences
+//!
+static int check_index(blobstore * bs, const char *label)
+{
+    int errors = 0;
+    int walked_count = 0;
+    int indexed_count = 0;
+    blockblob *walked = NULL;
+    blockblob *indexed = NULL;
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {
+        printf("%s: failed to lock the blobstore\n", label);
+        return 1;
+    }
+    if (index_scan(bs, NULL, NULL, &indexed) == -1) {
+        printf("%s: index is not available\n", label);
+        errors++;
+    }
+    walk_bs(bs, bs->path, &walked, NULL);
+    blobstore_unlock(bs);
+
+    for (blockblob * w = walked; w; w = w->next) {
+        blockblob *i = NULL;
+        walked_count++;
+        for (i = indexed; i && strcmp(i->id, w->id); i = i->next) ;
+        if (i == NULL) {
+            printf("%s: blob %s is missing from the index\n", label, w->id);
+            errors++;
+        } else if ((i->size_bytes != w->size_bytes) || (i->last_modified != w->last_modified) || (i->is_hollow != w->is_hollow) || (i->in_use != w->in_use)) {
+            printf("%s: blob %s differs: size %llu/%llu mtime %ld/%ld hollow %d/%d in_use %o/%o\n", label, w->id, i->size_bytes, w->size_bytes,
+                   (long)i->last_modified, (long)w->last_modified, i->is_hollow, w->is_hollow, i->in_use, w->in_use);
+            errors++;
+        }
+    }
+    for (blockblob * i = indexed; i; i = i->next)
+        indexed_count++;
+    if (indexed_count != walked_count) {
+        printf("%s: index lists %d blob(s), directory has %d\n", label, indexed_count, walked_count);
+        errors++;
+    }
+
+    free_bbs(walked);
+    free_bbs(indexed);
+    printf("%s: %d blob(s), %d difference(s)\n", label, walked_count, errors);
+    return errors;
+}
+
+//!
+//! Tests the blob index: incremental updates, other handles catching up, interrupted
+//! changes, compaction and rebuilding when the index files are damaged or inconsistent
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_index_test(const char *base, const char *name)
+{
+    int fd = -1;
+    int errors = 0;
+    long long epoch = 0;
+    char path[PATH_MAX] = "";
+    char ref[BLOBSTORE_MAX_PATH + 32] = "";
+    char *array[1] = { NULL };
+    blockblob_meta *matches = NULL;
+    blobstore *bs2 = NULL;
+
+    printf("\nTEST: running do_index_test(%s)\n", name);
+    blobstore *bs = create_teststore(BS_SIZE, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL)
+        return 1;
+
+    // blobs created before there is an index are picked up by the first scan, which builds it
+    errors += make_test_blob(bs, "idx/one", 4096);
+    errors += make_test_blob(bs, "idx/two", 8192);
+    errors += make_test_blob(bs, "three", 512);
+    errors += check_index(bs, "initial build");
+    index_file_path(bs, BLOBSTORE_INDEX_FILE, path, sizeof(path));
+    if (access(path, R_OK)) {
+        printf("index snapshot %s was not written\n", path);
+        errors++;
+    }
+    epoch = bs->index->epoch;
+
+    // changes through one handle are picked up by another from the journal
+    bs2 = blobstore_open(bs->path, 0, 0, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+    errors += check_index(bs2, "second handle");
+    errors += make_test_blob(bs, "idx/four", 16384);
+    errors += make_test_blob(bs, "idx/hollow", 32768);
+    if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, "idx/hollow", "this blob is hollow\n"))
+        errors++;
+    snprintf(ref, sizeof(ref), "%s idx/one map 0 4", bs->path);
+    array[0] = ref;
+    if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, "idx/four", array, 1))
+        errors++;
+    snprintf(ref, sizeof(ref), "%s idx/four", bs->path);
+    if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, "idx/one", ref, 0))
+        errors++;
+    if (delete_blockblob_files(bs, "three") < 1)
+        errors++;
+    errors += check_index(bs2, "journal replay");
+    errors += check_index(bs, "own changes");
+    if (bs->index->epoch != epoch) {
+        printf("index was rebuilt or compacted needlessly\n");
+        errors++;
+    }
+
+    // a change interrupted by the death of its process is read from the files, then settled by compaction
+    snprintf(ref, sizeof(ref), "B %d idx/two", 999999);
+    index_append(bs, ref);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, "idx/two", path, sizeof(path));
+    if (truncate(path, 1024) == -1)
+        errors++;
+    errors += check_index(bs, "interrupted change");
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1 || index_compact(bs) || blobstore_unlock(bs) == -1)
+        errors++;
+    blobstore_index_entry *e = index_lookup(bs->index, "idx/two", FALSE);
+    if ((e == NULL) || e->pending || (e->size_bytes != 1024)) {
+        printf("interrupted change was not settled by compaction\n");
+        errors++;
+    }
+    errors += check_index(bs2, "after compaction");
+
+    // a long journal gets compacted
+    for (int i = 0; i < (BLOBSTORE_JOURNAL_SLACK + 20); i++)
+        index_note_commit(bs, "idx/one");
+    epoch = bs->index->epoch;
+    errors += check_index(bs, "long journal");
+    if ((bs->index->epoch != (epoch + 1)) || (bs->index->records != 0)) {
+        printf("long journal was not compacted\n");
+        errors++;
+    }
+
+    // search goes through the index
+    if (blobstore_search(bs, "idx/.*", &matches) != 4) {
+        printf("search did not find the expected blobs\n");
+        errors++;
+    }
+    for (blockblob_meta * bm = matches; bm;) {
+        blockblob_meta *next = bm->next;
+        EUCA_FREE(bm);
+        bm = next;
+    }
+
+    // a damaged journal gets the index rebuilt from the blob files
+    index_file_path(bs, BLOBSTORE_JOURNAL_FILE, path, sizeof(path));
+    if ((fd = open(path, O_WRONLY | O_APPEND)) == -1 || write(fd, "deadbeef U garbage\n", 19) != 19)
+        errors++;
+    if (fd != -1)
+        close(fd);
+    epoch = bs->index->epoch;
+    errors += make_test_blob(bs, "idx/five", 4096);
+    errors += check_index(bs, "damaged journal");
+    if (bs->index->epoch == epoch) {
+        printf("damaged journal did not cause a rebuild\n");
+        errors++;
+    }
+
+    // a compaction interrupted between writing the snapshot and the journal gets the index rebuilt
+    epoch = bs->index->epoch;
+    index_write_file(bs, BLOBSTORE_INDEX_FILE, bs->index, (epoch + 1), NULL, NULL);
+    errors += check_index(bs2, "interrupted compaction");
+    if (bs2->index->epoch == (epoch + 1)) {
+        printf("inconsistent index files were trusted\n");
+        errors++;
+    }
+
+    blobstore_close(bs2);
+    blobstore_close(bs);
+    printf("TEST: completed index test (%s)\n", name);
+    return errors;
+}
+
+//!
+//! Sets the modification time of a blob made with make_test_blob() and records it in the index
+//!
+//! @param[in] bs
+//! @param[in] id
+//! @param[in] mtime
+//!
+//! @return 0 on success and 1 on error
+//!
+static int set_test_blob_mtime(blobstore * bs, const char *id, time_t mtime)
+{
+    char path[PATH_MAX] = "";
+    struct timeval times[2] = { {mtime, 0}, {mtime, 0} };
+
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, id, path, sizeof(path));
+    index_note_begin(bs, id);
+    if (utimes(path, times) == -1) {
+        printf("failed to set the time of %s\n", path);
+        return 1;
+    }
+    index_note_commit(bs, id);
+    return 0;
+}
+
+//!
+//! Checks that the LRU heap of an index is ordered, holds every known entry once and that
+//! the total of the blocks used adds up
+//!
+//! @param[in] idx
+//! @param[in] label
+//!
+//! @return the number of problems found
+//!
+static int check_lru_heap(blobstore_index * idx, const char *label)
+{
+    int errors = 0;
+    unsigned int known = 0;
+    long long blocks_used = 0;
+
+    for (unsigned int i = 0; i < idx->heap_len; i++) {
+        if (idx->heap[i]->heap_pos != (i + 1)) {
+            printf("%s: entry %s at position %u thinks it is at %u\n", label, idx->heap[i]->id, i, idx->heap[i]->heap_pos - 1);
+            errors++;
+        }
+        if ((i > 0) && index_lru_before(idx->heap[i], idx->heap[(i - 1) / 2])) {
+            printf("%s: entry %s is out of order at position %u\n", label, idx->heap[i]->id, i);
+            errors++;
+        }
+    }
+    for (unsigned int b = 0; b < idx->nbuckets; b++) {
+        for (blobstore_index_entry * e = idx->buckets[b]; e; e = e->next) {
+            if (e->is_known) {
+                known++;
+                blocks_used += index_entry_blocks(e);
+            }
+        }
+    }
+    if ((known != idx->heap_len) || (blocks_used != idx->blocks_used)) {
+        printf("%s: heap has %u of %u known entries, %lld/%lld blocks used\n", label, idx->heap_len, known, idx->blocks_used, blocks_used);
+        errors++;
+    }
+    return errors;
+}
+
+//!
+//! Tests LRU revocation through the blob index: the heap staying in order as records come
+//! in, background reclamation between watermarks and making room for a new blob
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_lru_test(const char *base, const char *name)
+{
+    int fd = -1;
+    int errors = 0;
+    char id[BLOBSTORE_MAX_PATH] = "";
+    char path[PATH_MAX] = "";
+    char record[BLOBSTORE_MAX_PATH + 128] = "";
+    blockblob bb = { 0 };
+    blockblob_meta *matches = NULL;
+    blobstore_index *idx = NULL;
+    const char *ids[] = { "lru/a", "lru/b", "lru/c", "lru/d", "lru/e" };
+    time_t mtimes[] = { 1000, 5000, 2000, 4000, 3000 };    // LRU order is a, c, e, d, b
+    const char *survivors[] = { "lru/b", "lru/c" };
+
+    printf("\nTEST: running do_lru_test(%s)\n", name);
+
+    // the heap stays in order through updates, moves and deletions
+    if ((idx = index_alloc()) == NULL)
+        return 1;
+    srandom(42);
+    for (int i = 0; i < 5000; i++) {
+        snprintf(id, sizeof(id), "heap/%ld", random() % 300);
+        switch (random() % 4) {
+        case 0:
+            snprintf(record, sizeof(record), "D %s", id);
+            break;
+        case 1:
+            snprintf(record, sizeof(record), "B %d %s", 999999, id);
+            break;
+        default:
+            snprintf(record, sizeof(record), "U %ld 0 0 %ld 0 %ld %s", (random() % 64) * 512, random() % 100, random() % 2, id);
+            break;
+        }
+        if (index_apply(idx, record)) {
+            printf("record '%s' was not applied\n", record);
+            errors++;
+        }
+    }
+    errors += check_lru_heap(idx, "random records");
+    index_free(idx);
+
+    blobstore *bs = create_teststore(BS_SIZE, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL)
+        return (errors + 1);
+
+    // five blobs fill up the blobstore
+    for (int i = 0; i < 5; i++) {
+        errors += make_test_blob(bs, ids[i], (BS_SIZE / 5) * 512);
+        errors += set_test_blob_mtime(bs, ids[i], mtimes[i]);
+    }
+    errors += check_index(bs, "full store");
+    if ((bs->index == NULL) || (bs->index->heap_len != 5) || strcmp(bs->index->heap[0]->id, "lru/a")) {
+        printf("least recently used blob is not on top of the heap\n");
+        errors++;
+    }
+
+    // an open blob survives reclamation, which goes by the heap until it is under the low watermark
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, "lru/c", path, sizeof(path));
+    if ((fd = open_and_lock(path, (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_RDWR), BLOBSTORE_LOCK_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1)
+        errors++;
+    if (blobstore_reclaim(bs, 100, 50) != 0) {
+        printf("blobstore at the high watermark was reclaimed\n");
+        errors++;
+    }
+    if (blobstore_reclaim(bs, 90, 50) != (3 * (BS_SIZE / 5))) {
+        printf("reclamation did not free the expected blobs\n");
+        errors++;
+    }
+    if (blobstore_search(bs, "lru/.*", &matches) != 2)
+        errors++;
+    for (blockblob_meta * bm = matches; bm;) {
+        blockblob_meta *next = bm->next;
+        int i = 0;
+        for (i = 0; (i < 2) && strcmp(bm->id, survivors[i]); i++) ;
+        if (i == 2) {
+            printf("blob %s should have been reclaimed\n", bm->id);
+            errors++;
+        }
+        EUCA_FREE(bm);
+        bm = next;
+    }
+    errors += check_index(bs, "after reclamation");
+
+    // a new blob gets room by revoking what is not open, or fails without revoking anything
+    bb.store = bs;
+    euca_strncpy(bb.id, "lru/new", sizeof(bb.id));
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1)
+        errors++;
+    if (index_make_room(bs, &bb, (4 * (BS_SIZE / 5))) != 0) {
+        printf("no room was made for a new blob\n");
+        errors++;
+    }
+    if (index_make_room(bs, &bb, BS_SIZE) != -1) {
+        printf("room was made where an open blob is in the way\n");
+        errors++;
+    }
+    blobstore_unlock(bs);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, "lru/c", path, sizeof(path));
+    if (access(path, R_OK)) {
+        printf("open blob was revoked\n");
+        errors++;
+    }
+    if ((fd != -1) && close_and_unlock(fd))
+        errors++;
+    errors += check_index(bs, "after making room");
+    errors += check_lru_heap(bs->index, "after making room");
+
+    blobstore_close(bs);
+    printf("TEST: completed LRU test (%s)\n", name);
+    return errors;
+}
+
 //!
 //!
 //!
@@ -5716,6 +8728,127 @@ int do_file_lock_test(void)
     return errors;
 }
 
+//!
+//! Takes the write lock on F1, holds it for WAKEUP_HOLD_USEC and then releases it
+//!
+//! @param[in] ptr pointer to an int set to the file descriptor of the lock, or to -2 on failure
+//!
+//! @return NULL
+//!
+static void *holder_function(void *ptr)
+{
+    volatile int *held = ptr;
+    int fd = open_and_lock(F1, _W, 0, BLOBSTORE_FILE_PERM);
+
+    *held = (fd == -1) ? (-2) : (fd);
+    if (fd != -1) {
+        usleep(WAKEUP_HOLD_USEC);
+        close_and_unlock(fd);
+    }
+    return NULL;
+}
+
+//!
+//! Checks that a request waiting for a lock gets it soon after the holder, another thread
+//! or another process, lets go, and that the lock manager counts the waits
+//!
+//! @return the number of errors
+//!
+static int do_lock_wakeup_test(void)
+{
+    int errors = 0;
+    int pid = 0;
+    int status = 0;
+    int fd1 = -1;
+    int fd2 = -1;
+    volatile int held = -1;
+    int pipe_fds[2];
+    char c = 0;
+    long long started = 0;
+    long long waited_usec = 0;
+    pthread_t thread;
+    blobstore_lock_stats before = { 0 };
+    blobstore_lock_stats after = { 0 };
+
+    printf("\nTEST: lock wakeups\n");
+    blobstore_get_lock_stats(&before);
+
+    // the lock is held by another thread of this process
+    if ((fd1 = open_and_lock(F1, _C, 0, BLOBSTORE_FILE_PERM)) == -1) {
+        printf("failed to create %s\n", F1);
+        return 1;
+    }
+    close_and_unlock(fd1);
+    pthread_create(&thread, NULL, holder_function, (void *)&held);
+    while (held == -1)
+        usleep(1000);
+    if (held == -2) {
+        printf("ERROR: thread failed to lock %s\n", F1);
+        errors++;
+    }
+    started = time_usec();
+    fd2 = open_and_lock(F1, _W, BLOBSTORE_NO_TIMEOUT, BLOBSTORE_FILE_PERM);
+    waited_usec = time_usec() - started;
+    pthread_join(thread, NULL);
+    printf("waited %lld usec for a lock held by a thread for %lld usec\n", waited_usec, WAKEUP_HOLD_USEC);
+    if (fd2 == -1 || waited_usec > (WAKEUP_HOLD_USEC + WAKEUP_SLACK_USEC)) {
+        printf("ERROR: lock from a thread was not handed over promptly\n");
+        errors++;
+    }
+    if (fd2 != -1)
+        close_and_unlock(fd2);
+
+    // the lock is held by another process, so the wait is bounded
+    if (pipe(pipe_fds) == -1) {
+        printf("failed to create a pipe\n");
+        return (errors + 1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        close(pipe_fds[0]);
+        fd1 = open_and_lock(F1, _W, 0, BLOBSTORE_FILE_PERM);
+        c = (fd1 == -1) ? ('E') : ('L');
+        if (write(pipe_fds[1], &c, 1) != 1)
+            _exit(1);
+        usleep(WAKEUP_HOLD_USEC);
+        _exit((fd1 == -1) ? (1) : (0));    // exiting releases the lock
+    }
+    close(pipe_fds[1]);
+    if (read(pipe_fds[0], &c, 1) != 1 || c != 'L') {
+        printf("ERROR: child process failed to lock %s\n", F1);
+        errors++;
+    }
+    close(pipe_fds[0]);
+    started = time_usec();
+    fd2 = open_and_lock(F1, _W, (10 * WAKEUP_HOLD_USEC), BLOBSTORE_FILE_PERM);
+    waited_usec = time_usec() - started;
+    waitpid(pid, &status, 0);
+    errors += WEXITSTATUS(status);
+    printf("waited %lld usec for a lock held by a process for %lld usec\n", waited_usec, WAKEUP_HOLD_USEC);
+    if (fd2 == -1 || waited_usec > (2 * WAKEUP_HOLD_USEC)) {
+        printf("ERROR: lock from a process was not handed over promptly\n");
+        errors++;
+    }
+    if (fd2 != -1)
+        close_and_unlock(fd2);
+
+    // both waits were counted and the table has no leftover entries
+    blobstore_get_lock_stats(&after);
+    printf("locks acquired=%lld contended=%lld/%lld wait=%lld usec (max %lld) timeouts=%lld errors=%lld paths=%lld\n",
+           after.acquired, after.contended, after.proc_contended, after.wait_usec, after.wait_max_usec, after.timeouts, after.errors, after.paths);
+    if ((after.contended - before.contended) < 2 || (after.proc_contended - before.proc_contended) < 1 || after.wait_usec <= before.wait_usec) {
+        printf("ERROR: lock waits were not counted\n");
+        errors++;
+    }
+    if (after.paths != before.paths) {
+        printf("ERROR: lock table has %lld entries instead of %lld\n", after.paths, before.paths);
+        errors++;
+    }
+    remove(F1);
+    return errors;
+}
+
 //!
 //!
 //!
@@ -5793,10 +8926,22 @@ int main(int argc, char **argv)
     if (errors)
         goto done;                     // no point in doing blobstore test if above isn't working
 
+    errors += do_lock_wakeup_test();
+    if (errors)
+        goto done;                     // no point in doing blobstore test if above isn't working
+
     errors += do_metadata_test(cwd, "directory-meta");
     if (errors)
         goto done;                     // no point in doing blobstore test if above isn't working
 
+    errors += do_index_test(cwd, "index");
+    if (errors)
+        goto done;                     // no point in doing blobstore test if above isn't working
+
+    errors += do_lru_test(cwd, "lru-index");
+    if (errors)
+        goto done;                     // no point in doing blobstore test if above isn't working
+
     errors += do_blobstore_test(cwd, "directory-norevoc", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_NONE);
     if (errors)
         goto done;                     // no point in continuing blobstore test if above isn't working
@@ -5821,6 +8966,10 @@ int main(int argc, char **argv)
     if (errors)
         goto done;                     // no point in doing clone stress test test if above isn't working
 
+    errors += do_dedup_test(cwd, "dedup");
+    if (errors)
+        goto done;                     // no point in doing clone stress test test if above isn't working
+
     errors += do_clone_stresstest(cwd, "clonestress", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_DM);
     if (errors)
         goto done;                     // no point in continuing
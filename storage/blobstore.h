@@ -202,6 +202,7 @@ typedef struct _blobstore {
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
     int fd;                            //!< file descriptor of the blobstore metadata file
+    struct _blobstore_index *index;    //!< in-memory copy of the blob index, loaded on first use
 } blobstore;
 
 typedef struct _blockblob {
@@ -262,11 +263,26 @@ typedef struct _blobstore_meta {
     unsigned long long fs_bytes_available;  //!< bytes available on the file system that blobstore resides on
     int fs_id;                         //!< hash of file system ID, as returned by statfs()
     unsigned int num_blobs;            //!< count of blobs in the blobstore
+    unsigned long long dedup_blocks_logical;    //!< size, in blocks, of the blobs that are stored as shared chunks
+    unsigned long long dedup_blocks_stored; //!< blocks allocated on disk to the packs holding those chunks
+    double dedup_ratio;                //!< dedup_blocks_logical over dedup_blocks_stored, or 0 if no blob is stored as chunks
     blobstore_revocation_t revocation_policy;
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
 } blobstore_meta;
 
+//! Counters kept by the lock manager of a process, across all the blobstores it has open
+typedef struct _blobstore_lock_stats {
+    long long acquired;                //!< number of file locks granted
+    long long contended;               //!< number of those that had to wait for another thread or process
+    long long proc_contended;          //!< number of those that had to wait for another process
+    long long wait_usec;               //!< total time spent waiting for the contended locks
+    long long wait_max_usec;           //!< longest wait for a lock that was granted
+    long long timeouts;                //!< number of requests that gave up waiting
+    long long errors;                  //!< number of requests that failed for other reasons
+    long long paths;                   //!< number of paths in the lock table right now
+} blobstore_lock_stats;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -305,9 +321,11 @@ int blobstore_lock(blobstore * bs, long long timeout_usec);
 int blobstore_unlock(blobstore * bs);
 int blobstore_delete(blobstore * bs);
 int blobstore_get_error(void);
+void blobstore_get_lock_stats(blobstore_lock_stats * stats);
 ssize_t get_line_desc(char **ppLine, size_t * n, int fd);
 int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path);
 int blobstore_stat(blobstore * bs, blobstore_meta * meta);
+long long blobstore_reclaim(blobstore * bs, unsigned int high_pct, unsigned int low_pct);
 int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb));
 int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results);
 int blobstore_delete_regex(blobstore * bs, const char *regex);
@@ -320,6 +338,7 @@ int blockblob_close(blockblob * bb);
 int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force);
 int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, blockblob * dst_bb, unsigned long long dst_offset_bytes, unsigned long long len_bytes); //
 int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size);
+int blockblob_dedup(blockblob * bb, long long timeout_usec);
 const char *blockblob_get_dev(blockblob * bb);
 const char *blockblob_get_file(blockblob * bb);
 blobstore *blockblob_get_blobstore(blockblob * bb);
@@ -86,6 +86,14 @@
 #include <sys/stat.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>                  // FICLONERANGE, BLKZEROOUT
+#include <linux/loop.h>                // LOOP_CTL_GET_FREE, LOOP_CONFIGURE
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl
@@ -101,15 +109,52 @@
 \*----------------------------------------------------------------------------*/
 
 #define LOOP_RETRIES                             9
+#define LOOP_CONTROL_PATH                        "/dev/loop-control"
+#define LOOP_DEV_FORMAT                          "/dev/loop%d"
 #define OUTPUT_ALLOC_CHUNK 1024
 #define MAX_OUTPUT_BYTES 1024*1024
 
+#define COPY_CHUNK_BYTES                         (1024 * 1024)  //!< unit of work of diskutil_copy(), also the size of its buffers
+#define COPY_ALIGN                               4096   //!< alignment of buffers and offsets for O_DIRECT
+#define COPY_THREADS                             4  //!< number of I/Os diskutil_copy() keeps in flight
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A stretch of the source of a copy that has data or is a hole
+typedef struct copy_extent {
+    long long offset;                  //!< offset in the source
+    long long len;                     //!< length in bytes
+    boolean is_data;                   //!< FALSE for a hole
+} copy_extent;
+
+//! State of a diskutil_copy() shared by its threads
+typedef struct copy_job {
+    const char *src_path;              //!< path of the source, for messages
+    const char *dst_path;              //!< path of the destination, for messages
+    int src_fd;                        //!< buffered descriptor of the source
+    int dst_fd;                        //!< buffered descriptor of the destination
+    int src_direct_fd;                 //!< O_DIRECT descriptor of a block device source, or -1
+    int dst_direct_fd;                 //!< O_DIRECT descriptor of a block device destination, or -1
+    boolean src_is_reg;                //!< the source is a regular file
+    boolean dst_is_blk;                //!< the destination is a block device
+    boolean no_kernel_copy;            //!< copy_file_range() turned out not to work for this pair
+    long long src_offset;              //!< start of the range in the source
+    long long delta;                   //!< what to add to a source offset to get the destination offset
+    long long len;                     //!< length of the range
+    copy_extent *extents;              //!< extents of the range, in order
+    int num_extents;                   //!< number of extents
+    int max_extents;                   //!< number of extents allocated
+    pthread_mutex_t mutex;             //!< protects the fields below
+    int next_extent;                   //!< extent the next chunk comes from
+    long long next_offset;             //!< offset in the source of the next chunk
+    int error;                         //!< first error any thread ran into
+    diskutil_copy_stats stats;         //!< how the bytes got to the destination
+} copy_job;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -178,6 +223,7 @@ static char *helpers_path[LASTHELPER] = { NULL };
 
 static int initialized = FALSE;
 static sem *loop_sem = NULL;           //!< semaphore held while attaching/detaching loopback devices
+static boolean loop_native = TRUE;     //!< manage loopback devices with ioctls, until that turns out not to be permitted
 static char euca_home_path[EUCA_MAX_PATH] = "";
 static char cloud_cert_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/cloud-cert.pem";
 static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.pem";
@@ -191,6 +237,19 @@ static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.
 static char *pruntf(boolean log_error, char *format, ...)
 _attribute_wur_ _attribute_format_(2, 3);
 static char *execlp_output(boolean log_error, ...);
+static boolean copy_next_chunk(copy_job * job, long long *offset, long long *len);
+static void copy_account(copy_job * job, int error, long long copied, long long skipped);
+static boolean copy_dst_is_hole(copy_job * job, long long offset, long long len);
+static int copy_zero_range(copy_job * job, long long offset, long long len, char *buf);
+static int copy_chunk_in_kernel(copy_job * job, long long offset, long long len);
+static int copy_chunk_by_hand(copy_job * job, long long offset, long long len, char *buf);
+static void *copy_worker(void *arg);
+static int copy_map_extents(copy_job * job);
+static int loop_native_failed(const char *what, const char *path, int err);
+static int loop_configure(int fd_loop, int fd_file, const char *path, long long offset);
+static int loop_attach_native(const char *path, long long offset, char *lodev, int lodev_size);
+static int loop_detach_native(const char *lodev);
+static int loop_check_native(const char *path, const char *lodev);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -431,6 +490,458 @@ int diskutil_dd2(const char *in, const char *out, const int bs, const long long
     return (EUCA_INVALID_ERROR);
 }
 
+//!
+//! Hands out the next chunk of data to copy, in extent order
+//!
+//! @param[in]  job
+//! @param[out] offset set to the offset of the chunk in the source
+//! @param[out] len set to the length of the chunk
+//!
+//! @return TRUE if there was a chunk left and FALSE otherwise (or if the copy has failed)
+//!
+static boolean copy_next_chunk(copy_job * job, long long *offset, long long *len)
+{
+    boolean found = FALSE;
+
+    pthread_mutex_lock(&(job->mutex));
+    while ((job->error == EUCA_OK) && (job->next_extent < job->num_extents)) {
+        copy_extent *x = job->extents + job->next_extent;
+        if (job->next_offset < x->offset)
+            job->next_offset = x->offset;
+        if (!x->is_data || (job->next_offset >= (x->offset + x->len))) {
+            job->next_extent++;
+            continue;
+        }
+        // chunks end on multiples of the chunk size, so they stay aligned for O_DIRECT
+        *offset = job->next_offset;
+        *len = MIN(((*offset / COPY_CHUNK_BYTES) + 1) * COPY_CHUNK_BYTES, x->offset + x->len) - *offset;
+        job->next_offset += *len;
+        found = TRUE;
+        break;
+    }
+    pthread_mutex_unlock(&(job->mutex));
+    return found;
+}
+
+//!
+//! Records the outcome of one piece of a copy
+//!
+//! @param[in] job
+//! @param[in] error EUCA_OK or the error that stops the copy
+//! @param[in] copied number of bytes read and written
+//! @param[in] skipped number of bytes of zeros that did not have to be written
+//!
+static void copy_account(copy_job * job, int error, long long copied, long long skipped)
+{
+    pthread_mutex_lock(&(job->mutex));
+    if ((error != EUCA_OK) && (job->error == EUCA_OK))
+        job->error = error;
+    job->stats.bytes_copied += copied;
+    job->stats.bytes_skipped += skipped;
+    pthread_mutex_unlock(&(job->mutex));
+}
+
+//!
+//! Tells whether a range of the destination reads as zeros without being written: a hole
+//! in a regular file (or past its end) qualifies, anything on a block device does not
+//!
+//! @param[in] job
+//! @param[in] offset
+//! @param[in] len
+//!
+//! @return TRUE or FALSE
+//!
+static boolean copy_dst_is_hole(copy_job * job, long long offset, long long len)
+{
+#ifdef SEEK_DATA
+    off_t data = 0;
+
+    if (job->dst_is_blk)
+        return FALSE;
+    if ((data = lseek(job->dst_fd, offset, SEEK_DATA)) == -1)
+        return (errno == ENXIO);       // nothing but holes from offset on
+    return (data >= (offset + len));
+#else /* SEEK_DATA */
+    return FALSE;
+#endif /* SEEK_DATA */
+}
+
+//!
+//! Makes a range of the destination read as zeros, doing as little I/O as possible:
+//! holes are left alone or punched into regular files and block devices are asked to
+//! zero the range themselves (loop devices punch holes in their backing files)
+//!
+//! @param[in] job
+//! @param[in] offset in the destination
+//! @param[in] len
+//! @param[in] buf a buffer of COPY_CHUNK_BYTES, used if zeros have to be written after all
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure
+//!
+static int copy_zero_range(copy_job * job, long long offset, long long len, char *buf)
+{
+    if (copy_dst_is_hole(job, offset, len)) {
+        copy_account(job, EUCA_OK, 0, len);
+        return (EUCA_OK);
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (!job->dst_is_blk && (fallocate(job->dst_fd, (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE), offset, len) == 0)) {
+        copy_account(job, EUCA_OK, 0, len);
+        return (EUCA_OK);
+    }
+#endif /* FALLOC_FL_PUNCH_HOLE */
+#ifdef BLKZEROOUT
+    if (job->dst_is_blk && ((offset % SECTOR_SIZE) == 0) && ((len % SECTOR_SIZE) == 0)) {
+        uint64_t range[2] = { offset, len };
+        if (ioctl(job->dst_fd, BLKZEROOUT, range) == 0) {
+            copy_account(job, EUCA_OK, 0, len);
+            return (EUCA_OK);
+        }
+    }
+#endif /* BLKZEROOUT */
+
+    bzero(buf, MIN(len, COPY_CHUNK_BYTES));
+    for (long long done = 0; done < len;) {
+        ssize_t n = pwrite(job->dst_fd, buf, MIN(len - done, COPY_CHUNK_BYTES), offset + done);
+        if (n < 1) {
+            LOGERROR("failed to write zeros to '%s': %s\n", job->dst_path, strerror(errno));
+            return (EUCA_IO_ERROR);
+        }
+        done += n;
+        copy_account(job, EUCA_OK, n, 0);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Copies one chunk with copy_file_range(), which lets the file system share or copy
+//! the blocks without them passing through user space
+//!
+//! @param[in] job
+//! @param[in] offset in the source
+//! @param[in] len
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the chunk has to be copied by hand or EUCA_IO_ERROR on failure
+//!
+static int copy_chunk_in_kernel(copy_job * job, long long offset, long long len)
+{
+#ifdef __NR_copy_file_range
+    long long done = 0;
+
+    while (done < len) {
+        loff_t src_offset = offset + done;
+        loff_t dst_offset = offset + done + job->delta;
+        long n = syscall(__NR_copy_file_range, job->src_fd, &src_offset, job->dst_fd, &dst_offset, (size_t) (len - done), 0);
+        if (n < 1) {
+            if ((n == 0) || (errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP)) {
+                job->no_kernel_copy = TRUE;
+                copy_account(job, EUCA_OK, done, 0);
+                return ((done == 0) ? (EUCA_UNSUPPORTED_ERROR) : (copy_chunk_by_hand(job, offset + done, len - done, NULL)));
+            }
+            LOGERROR("failed to copy from '%s' to '%s': %s\n", job->src_path, job->dst_path, strerror(errno));
+            return (EUCA_IO_ERROR);
+        }
+        done += n;
+    }
+    copy_account(job, EUCA_OK, len, 0);
+    return (EUCA_OK);
+#else /* __NR_copy_file_range */
+    return (EUCA_UNSUPPORTED_ERROR);
+#endif /* __NR_copy_file_range */
+}
+
+//!
+//! Copies one chunk through a buffer, with O_DIRECT on the block device side(s) when the chunk
+//! is aligned, and leaves out writing chunks of zeros that the destination already reads as zeros
+//!
+//! @param[in] job
+//! @param[in] offset in the source
+//! @param[in] len no more than COPY_CHUNK_BYTES
+//! @param[in] buf an aligned buffer of COPY_CHUNK_BYTES, allocated here if NULL
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR (or EUCA_MEMORY_ERROR) on failure
+//!
+static int copy_chunk_by_hand(copy_job * job, long long offset, long long len, char *buf)
+{
+    int ret = EUCA_OK;
+    ssize_t n = 0;
+    long long done = 0;
+    char *own_buf = NULL;
+    long long dst_offset = offset + job->delta;
+    boolean aligned = (((len % COPY_ALIGN) == 0) && ((offset % COPY_ALIGN) == 0));
+    boolean dst_aligned = (((len % COPY_ALIGN) == 0) && ((dst_offset % COPY_ALIGN) == 0));
+    int src_fd = ((aligned && (job->src_direct_fd != -1)) ? (job->src_direct_fd) : (job->src_fd));
+    int dst_fd = ((dst_aligned && (job->dst_direct_fd != -1)) ? (job->dst_direct_fd) : (job->dst_fd));
+
+    if (buf == NULL) {
+        if (posix_memalign((void **)&own_buf, COPY_ALIGN, COPY_CHUNK_BYTES) != 0)
+            return (EUCA_MEMORY_ERROR);
+        buf = own_buf;
+    }
+
+    for (done = 0; done < len; done += n) {
+        if ((n = pread(src_fd, buf + done, (len - done), (offset + done))) < 1) {
+            LOGERROR("failed to read from '%s' at %lld: %s\n", job->src_path, (offset + done), ((n == 0) ? ("end of file") : (strerror(errno))));
+            ret = EUCA_IO_ERROR;
+            goto out;
+        }
+    }
+
+    if ((buf[0] == 0) && !memcmp(buf, buf + 1, (len - 1)) && copy_dst_is_hole(job, dst_offset, len)) {
+        copy_account(job, EUCA_OK, 0, len);
+        goto out;
+    }
+
+    for (done = 0; done < len; done += n) {
+        if ((n = pwrite(dst_fd, buf + done, (len - done), (dst_offset + done))) < 1) {
+            LOGERROR("failed to write to '%s' at %lld: %s\n", job->dst_path, (dst_offset + done), strerror(errno));
+            ret = EUCA_IO_ERROR;
+            goto out;
+        }
+    }
+    copy_account(job, EUCA_OK, len, 0);
+
+out:
+    EUCA_FREE(own_buf);
+    return ret;
+}
+
+//!
+//! Copies chunks until there are none left, in one of the threads of a copy
+//!
+//! @param[in] arg the copy_job
+//!
+//! @return NULL
+//!
+static void *copy_worker(void *arg)
+{
+    int rc = EUCA_OK;
+    long long len = 0;
+    long long offset = 0;
+    char *buf = NULL;
+    copy_job *job = (copy_job *) arg;
+
+    if (posix_memalign((void **)&buf, COPY_ALIGN, COPY_CHUNK_BYTES) != 0) {
+        copy_account(job, EUCA_MEMORY_ERROR, 0, 0);
+        return NULL;
+    }
+
+    while (copy_next_chunk(job, &offset, &len)) {
+        rc = EUCA_UNSUPPORTED_ERROR;
+        if (job->src_is_reg && !job->dst_is_blk && !job->no_kernel_copy)
+            rc = copy_chunk_in_kernel(job, offset, len);
+        if (rc == EUCA_UNSUPPORTED_ERROR)
+            rc = copy_chunk_by_hand(job, offset, len, buf);
+        if (rc != EUCA_OK) {
+            copy_account(job, rc, 0, 0);
+            break;
+        }
+    }
+
+    EUCA_FREE(buf);
+    return NULL;
+}
+
+//!
+//! Lists the data and hole extents of the source range, using SEEK_DATA and SEEK_HOLE on
+//! regular files. Anything else, or a file system that cannot tell, yields a single data extent.
+//!
+//! @param[in] job with the source range set
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR on failure
+//!
+static int copy_map_extents(copy_job * job)
+{
+    long long pos = job->src_offset;
+    long long end = job->src_offset + job->len;
+
+    while (pos < end) {
+        long long data = pos;
+        long long hole = end;
+#ifdef SEEK_DATA
+        if (job->src_is_reg) {
+            if ((data = lseek(job->src_fd, pos, SEEK_DATA)) == -1) {
+                data = ((errno == ENXIO) ? (end) : (pos));  // ENXIO = only holes are left, anything else = cannot tell
+            } else if ((hole = lseek(job->src_fd, data, SEEK_HOLE)) == -1) {
+                hole = end;
+            }
+            data = MIN(data, end);
+            hole = MIN(hole, end);
+        }
+#endif /* SEEK_DATA */
+        for (int is_data = 0; is_data < 2; is_data++) {
+            long long from = (is_data ? data : pos);
+            long long to = (is_data ? hole : data);
+            if (to <= from)
+                continue;
+            if (job->num_extents == job->max_extents) {
+                int max_extents = ((job->max_extents) ? (2 * job->max_extents) : (64));
+                copy_extent *extents = EUCA_REALLOC(job->extents, max_extents, sizeof(copy_extent));
+                if (extents == NULL)
+                    return (EUCA_MEMORY_ERROR);
+                job->extents = extents;
+                job->max_extents = max_extents;
+            }
+            job->extents[job->num_extents].offset = from;
+            job->extents[job->num_extents].len = to - from;
+            job->extents[job->num_extents].is_data = is_data;
+            job->num_extents++;
+        }
+        if (hole <= pos)
+            break;                     // should not happen, but do not loop forever
+        pos = hole;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Copies a range of bytes from one file or block device to another, in process. The range is
+//! reflinked when the file system allows it; otherwise the data extents of the source are copied
+//! by several threads, in the kernel with copy_file_range() or through large aligned buffers
+//! (with O_DIRECT on block devices), and its holes are punched into (or zeroed out on) the
+//! destination instead of being written. The destination must exist; as with 'dd conv=notrunc',
+//! it is never truncated but it grows if the range ends past its end.
+//!
+//! @param[in]  in path of the source
+//! @param[in]  out path of the destination
+//! @param[in]  in_offset offset in the source, in bytes
+//! @param[in]  out_offset offset in the destination, in bytes
+//! @param[in]  len number of bytes to copy
+//! @param[out] stats if not NULL, set to how the bytes got to the destination
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if this process may not open the source or the destination (dd under euca_rootwrap may)
+//!         \li EUCA_IO_ERROR, EUCA_MEMORY_ERROR: if the copy failed, possibly part way through
+//!
+//! @pre Both in and out must not be NULL, the offsets must not be negative and len must be positive.
+//!
+//! @post On success the data from 'in' has been copied in 'out' and flushed to disk.
+//!
+int diskutil_copy(const char *in, const char *out, long long in_offset, long long out_offset, long long len, diskutil_copy_stats * stats)
+{
+    int ret = EUCA_OK;
+    int nthreads = 0;
+    char *buf = NULL;
+    long long data_bytes = 0;
+    struct stat src_sb = { 0 };
+    struct stat dst_sb = { 0 };
+    pthread_t threads[COPY_THREADS];
+    copy_job job = { 0 };
+
+    if (!in || !out || (in_offset < 0) || (out_offset < 0) || (len < 1)) {
+        LOGWARN("bad params: in=%s, out=%s, in_offset=%lld, out_offset=%lld, len=%lld\n", SP(in), SP(out), in_offset, out_offset, len);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    job.src_path = in;
+    job.dst_path = out;
+    job.src_offset = in_offset;
+    job.delta = out_offset - in_offset;
+    job.len = len;
+    job.src_fd = job.dst_fd = job.src_direct_fd = job.dst_direct_fd = -1;
+    pthread_mutex_init(&(job.mutex), NULL);
+
+    if (((job.src_fd = open(in, O_RDONLY)) == -1) || ((job.dst_fd = open(out, O_WRONLY)) == -1)) {
+        ret = (((errno == EACCES) || (errno == EPERM)) ? (EUCA_ACCESS_ERROR) : (EUCA_IO_ERROR));
+        LOGDEBUG("cannot open '%s' for copying: %s\n", ((job.src_fd == -1) ? (in) : (out)), strerror(errno));
+        goto out;
+    }
+    if ((fstat(job.src_fd, &src_sb) == -1) || (fstat(job.dst_fd, &dst_sb) == -1)) {
+        ret = EUCA_IO_ERROR;
+        goto out;
+    }
+    job.src_is_reg = S_ISREG(src_sb.st_mode);
+    job.dst_is_blk = S_ISBLK(dst_sb.st_mode);
+    if (S_ISBLK(src_sb.st_mode))
+        job.src_direct_fd = open(in, (O_RDONLY | O_DIRECT));    // without it, only the buffered descriptor is used
+    if (job.dst_is_blk)
+        job.dst_direct_fd = open(out, (O_WRONLY | O_DIRECT));
+
+    LOGINFO("copying data from '%s'\n", in);
+    LOGINFO("               to '%s'\n", out);
+    LOGINFO("               of %lld bytes, from offset %lld to offset %lld\n", len, in_offset, out_offset);
+
+#ifdef FICLONERANGE
+    // share the blocks outright, if both are files on a file system with reflinks and the range is block-aligned
+    if (job.src_is_reg && S_ISREG(dst_sb.st_mode)) {
+        struct file_clone_range range = { 0 };
+        range.src_fd = job.src_fd;
+        range.src_offset = in_offset;
+        range.src_length = (((in_offset + len) >= src_sb.st_size) ? (0) : (len));  // 0 = to the end of the source
+        range.dest_offset = out_offset;
+        if (((in_offset + len) <= src_sb.st_size) && (ioctl(job.dst_fd, FICLONERANGE, &range) == 0)) {
+            job.stats.bytes_cloned = len;
+            goto sync;
+        }
+    }
+#endif /* FICLONERANGE */
+
+    if ((ret = copy_map_extents(&job)) != EUCA_OK)
+        goto out;
+
+    // holes are dealt with right away, data is left to the threads
+    if (posix_memalign((void **)&buf, COPY_ALIGN, COPY_CHUNK_BYTES) != 0) {
+        ret = EUCA_MEMORY_ERROR;
+        goto out;
+    }
+    for (int i = 0; i < job.num_extents; i++) {
+        if (!job.extents[i].is_data && ((ret = copy_zero_range(&job, job.extents[i].offset + job.delta, job.extents[i].len, buf)) != EUCA_OK))
+            goto out;
+    }
+    for (int i = 0; i < job.num_extents; i++) {
+        if (job.extents[i].is_data)
+            data_bytes += job.extents[i].len;
+    }
+    for (nthreads = 0; (nthreads < COPY_THREADS) && (data_bytes > COPY_CHUNK_BYTES); nthreads++) {
+        if (pthread_create(&threads[nthreads], NULL, copy_worker, &job) != 0)
+            break;                     // the threads that did start (or this one, below) will do
+    }
+    if (nthreads == 0)
+        copy_worker(&job);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    if ((ret = job.error) != EUCA_OK)
+        goto out;
+
+#ifdef FICLONERANGE
+sync:
+#endif /* FICLONERANGE */
+    // like dd, grow the destination if the copy ended past its end (with a hole at the end, nothing may have been written there)
+    if (S_ISREG(dst_sb.st_mode) && ((out_offset + len) > dst_sb.st_size) && (fstat(job.dst_fd, &dst_sb) == 0) && ((out_offset + len) > dst_sb.st_size)
+        && (ftruncate(job.dst_fd, (out_offset + len)) == -1)) {
+        ret = EUCA_IO_ERROR;
+        goto out;
+    }
+    if (fsync(job.dst_fd) == -1) {
+        LOGERROR("failed to flush '%s': %s\n", out, strerror(errno));
+        ret = EUCA_IO_ERROR;
+        goto out;
+    }
+    LOGDEBUG("copied %lld bytes to '%s': %lld cloned, %lld copied, %lld left as holes or zeroed\n", len, out, job.stats.bytes_cloned, job.stats.bytes_copied,
+             job.stats.bytes_skipped);
+
+out:
+    if (ret != EUCA_OK && ret != EUCA_ACCESS_ERROR) {
+        LOGERROR("cannot copy '%s'\n", in);
+        LOGERROR("                to '%s'\n", out);
+    }
+    if (stats != NULL)
+        *stats = job.stats;
+    EUCA_FREE(buf);
+    EUCA_FREE(job.extents);
+    if (job.src_direct_fd != -1)
+        close(job.src_direct_fd);
+    if (job.dst_direct_fd != -1)
+        close(job.dst_direct_fd);
+    if (job.src_fd != -1)
+        close(job.src_fd);
+    if (job.dst_fd != -1)
+        close(job.dst_fd);
+    pthread_mutex_destroy(&(job.mutex));
+    return ret;
+}
+
 //!
 //! Creates a Master Boot Record (MBR) of the given type at the given path
 //!
@@ -591,6 +1102,198 @@ sem *diskutil_get_loop_sem(void)
     return (loop_sem);
 }
 
+//!
+//! Sorts out an error from a native loopback operation: a lack of privileges,
+//! or of the control device, turns the native path off for good, since 'losetup'
+//! through the root wrapper can still do the job, while anything else is just logged
+//!
+//! @param[in] what the operation that failed
+//! @param[in] path the device or file it failed on
+//! @param[in] err the errno value
+//!
+//! @return EUCA_UNSUPPORTED_ERROR if the native path is now off or EUCA_ERROR otherwise
+//!
+static int loop_native_failed(const char *what, const char *path, int err)
+{
+    if ((err == EACCES) || (err == EPERM) || (err == ENOTTY) || !strcmp(path, LOOP_CONTROL_PATH)) {
+        if (loop_native) {
+            LOGINFO("cannot %s %s (%s), will manage loopback devices with %s\n", what, path, strerror(err), helpers[LOSETUP]);
+            loop_native = FALSE;
+        }
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+    LOGDEBUG("cannot %s %s: %s\n", what, path, strerror(err));
+    return (EUCA_ERROR);
+}
+
+//!
+//! Binds an open file to an open loopback device at an offset, with a single
+//! LOOP_CONFIGURE where the kernel has it and LOOP_SET_FD plus LOOP_SET_STATUS64
+//! where it does not
+//!
+//! @param[in] fd_loop descriptor of the loopback device
+//! @param[in] fd_file descriptor of the backing file
+//! @param[in] path path of the backing file, recorded in the device for 'losetup' to show
+//! @param[in] offset offset into the file, in bytes
+//!
+//! @return 0 on success or -1 with errno set
+//!
+static int loop_configure(int fd_loop, int fd_file, const char *path, long long offset)
+{
+    int err = 0;
+    struct loop_info64 info = { 0 };
+
+    info.lo_offset = offset;
+    euca_strncpy((char *)info.lo_file_name, path, sizeof(info.lo_file_name));
+
+#ifdef LOOP_CONFIGURE
+    struct loop_config config = { 0 };
+    config.fd = fd_file;
+    config.info = info;
+    if (ioctl(fd_loop, LOOP_CONFIGURE, &config) == 0)
+        return (0);
+    if ((errno != EINVAL) && (errno != ENOTTY))    // kernels before 5.8 do not know LOOP_CONFIGURE
+        return (-1);
+#endif /* LOOP_CONFIGURE */
+
+    if (ioctl(fd_loop, LOOP_SET_FD, fd_file) == -1)
+        return (-1);
+    if (ioctl(fd_loop, LOOP_SET_STATUS64, &info) == -1) {
+        err = errno;
+        ioctl(fd_loop, LOOP_CLR_FD, 0);
+        errno = err;
+        return (-1);
+    }
+    return (0);
+}
+
+//!
+//! Attaches a file to a free loopback device with ioctls, which costs no
+//! process spawns, unlike 'losetup'. A device that another process grabs
+//! between LOOP_CTL_GET_FREE and its configuration is simply skipped.
+//!
+//! @param[in] path
+//! @param[in] offset
+//! @param[out] lodev name of the loop device
+//! @param[in] lodev_size
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the process may not
+//!         manage loopback devices itself or EUCA_ERROR on other failures
+//!
+static int loop_attach_native(const char *path, long long offset, char *lodev, int lodev_size)
+{
+    int i = 0;
+    int n = 0;
+    int ret = EUCA_ERROR;
+    int fd_ctl = -1;
+    int fd_file = -1;
+    int fd_loop = -1;
+
+    if ((fd_ctl = open(LOOP_CONTROL_PATH, O_RDWR | O_CLOEXEC)) == -1)
+        return (loop_native_failed("open", LOOP_CONTROL_PATH, errno));
+
+    if ((fd_file = open(path, O_RDWR | O_CLOEXEC)) == -1) {
+        LOGERROR("cannot open %s to attach it to a loop device: %s\n", path, strerror(errno));
+        goto out;
+    }
+
+    for (i = 0; i < LOOP_RETRIES; i++) {
+        if ((n = ioctl(fd_ctl, LOOP_CTL_GET_FREE)) < 0) {
+            ret = loop_native_failed("find a free loopback device with", LOOP_CONTROL_PATH, errno);
+            break;
+        }
+
+        snprintf(lodev, lodev_size, LOOP_DEV_FORMAT, n);
+        if ((fd_loop = open(lodev, O_RDWR | O_CLOEXEC)) == -1) {
+            if ((errno != ENOENT) || ((i + 1) == LOOP_RETRIES)) {
+                ret = loop_native_failed("open", lodev, errno);
+                break;
+            }
+            usleep(10000);             // a device added just now may not have its node yet
+            continue;
+        }
+
+        if (loop_configure(fd_loop, fd_file, path, offset) == 0) {
+            LOGDEBUG("attached file %s\n", path);
+            LOGDEBUG("            to %s at offset %lld\n", lodev, offset);
+            ret = EUCA_OK;
+            break;
+        }
+
+        if (errno != EBUSY) {          // busy means another process took this device first
+            ret = loop_native_failed("configure", lodev, errno);
+            break;
+        }
+        close(fd_loop);
+        fd_loop = -1;
+    }
+
+out:
+    if (fd_loop != -1)
+        close(fd_loop);
+    if (fd_file != -1)
+        close(fd_file);
+    close(fd_ctl);
+    return (ret);
+}
+
+//!
+//! Detaches a loopback device with an ioctl
+//!
+//! @param[in] lodev name of the loop device
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the process may not
+//!         manage loopback devices itself or EUCA_ERROR on other failures
+//!
+static int loop_detach_native(const char *lodev)
+{
+    int ret = EUCA_OK;
+    int fd_loop = -1;
+
+    if ((fd_loop = open(lodev, O_RDONLY | O_CLOEXEC)) == -1)
+        return (loop_native_failed("open", lodev, errno));
+
+    if (ioctl(fd_loop, LOOP_CLR_FD, 0) == -1)
+        ret = loop_native_failed("detach", lodev, errno);
+    close(fd_loop);
+    return (ret);
+}
+
+//!
+//! Checks with an ioctl that a loopback device is backed by the given file,
+//! comparing the device and inode numbers rather than the truncated names
+//! that 'losetup' prints
+//!
+//! @param[in] path
+//! @param[in] lodev
+//!
+//! @return EUCA_OK if the device is backed by the file, EUCA_UNSUPPORTED_ERROR
+//!         if the process may not query loopback devices or EUCA_ERROR otherwise
+//!
+static int loop_check_native(const char *path, const char *lodev)
+{
+    int fd_loop = -1;
+    struct stat sb = { 0 };
+    struct loop_info64 info = { 0 };
+
+    if (stat(path, &sb) == -1)
+        return (EUCA_ERROR);
+
+    if ((fd_loop = open(lodev, O_RDONLY | O_CLOEXEC)) == -1)
+        return (loop_native_failed("open", lodev, errno));
+
+    if (ioctl(fd_loop, LOOP_GET_STATUS64, &info) == -1) {
+        int err = errno;
+        close(fd_loop);
+        return ((err == ENXIO) ? (EUCA_ERROR) : (loop_native_failed("query", lodev, err)));   // ENXIO means nothing is attached
+    }
+    close(fd_loop);
+
+    if ((info.lo_device != sb.st_dev) || (info.lo_inode != sb.st_ino))
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
@@ -603,8 +1306,9 @@ sem *diskutil_get_loop_sem(void)
 //!
 //! @pre Both path and lodev parameters must not be NULL.
 //!
-//! @todo since 'losetup' truncates paths in its output, this check is not perfect. It
-//!       may approve loopback devices that are actually pointing at a different path.
+//! @todo since 'losetup' truncates paths in its output, the check through it is not
+//!       perfect. It may approve loopback devices that are actually pointing at a
+//!       different path. The native check compares inodes and has no such problem.
 //!
 int diskutil_loop_check(const char *path, const char *lodev)
 {
@@ -614,6 +1318,10 @@ int diskutil_loop_check(const char *path, const char *lodev)
     char *cparen = NULL;
 
     if (path && lodev) {
+        if (loop_native && ((ret = loop_check_native(path, lodev)) != EUCA_UNSUPPORTED_ERROR))
+            return (ret);
+        ret = EUCA_OK;
+
         output = pruntf(TRUE, "%s %s %s", helpers_path[ROOTWRAP], helpers_path[LOSETUP], lodev);
         if (output == NULL)
             return (EUCA_ERROR);
@@ -679,6 +1387,16 @@ int diskutil_loop(const char *path, const long long offset, char *lodev, int lod
     boolean do_log = FALSE;
 
     if (path && lodev) {
+        if (loop_native) {
+            sem_p(loop_sem);
+            {
+                ret = loop_attach_native(path, offset, lodev, lodev_size);
+            }
+            sem_v(loop_sem);
+            if (ret == EUCA_OK)
+                return (ret);
+            ret = EUCA_OK;             // fall back on 'losetup', which retries on its own
+        }
         // we retry because we cannot atomically obtain a free loopback device on all distros (some
         // versions of 'losetup' allow a file argument with '-f' options, but some do not)
         for (i = 0, done = FALSE, found = FALSE; i < LOOP_RETRIES; i++) {
@@ -764,6 +1482,17 @@ int diskutil_unloop(const char *lodev)
     if (lodev) {
         LOGDEBUG("detaching from loop device %s\n", lodev);
 
+        if (loop_native) {
+            sem_p(loop_sem);
+            {
+                ret = loop_detach_native(lodev);
+            }
+            sem_v(loop_sem);
+            if (ret == EUCA_OK)
+                return (ret);
+            ret = EUCA_OK;             // fall back on 'losetup', which retries on its own
+        }
+
         // we retry because we have seen spurious errors from 'losetup -d' on Xen:
         //     ioctl: LOOP_CLR_FD: Device or resource bus
         for (i = 0; i < LOOP_RETRIES; i++) {
@@ -1401,6 +2130,37 @@ long long round_down_sec(long long bytes)
 }
 
 #ifdef _UNIT_TEST
+//!
+//! Compares a range of one file with a range of another
+//!
+//! @param[in] a
+//! @param[in] a_offset
+//! @param[in] b
+//! @param[in] b_offset
+//! @param[in] len
+//!
+//! @return TRUE if the ranges have the same bytes
+//!
+static boolean copy_test_same(const char *a, long long a_offset, const char *b, long long b_offset, long long len)
+{
+    int fd_a = open(a, O_RDONLY);
+    int fd_b = open(b, O_RDONLY);
+    boolean same = ((fd_a != -1) && (fd_b != -1));
+    char buf_a[65536];
+    char buf_b[65536];
+
+    for (long long done = 0; same && (done < len);) {
+        size_t n = MIN(sizeof(buf_a), (size_t) (len - done));
+        same = ((pread(fd_a, buf_a, n, a_offset + done) == n) && (pread(fd_b, buf_b, n, b_offset + done) == n) && !memcmp(buf_a, buf_b, n));
+        done += n;
+    }
+    if (fd_a != -1)
+        close(fd_a);
+    if (fd_b != -1)
+        close(fd_b);
+    return same;
+}
+
 int main(int argc, char *argv[])
 {
     char *output;
@@ -1432,6 +2192,104 @@ int main(int argc, char *argv[])
     output = execlp_output(TRUE, "ls", "a-ridiculously-long-name-that-does-not-exist", NULL);
     assert(output == NULL);
 
+    {                                  // test diskutil_copy() on a sparse image and compare it with dd
+#define COPY_TEST_BYTES          (256LL * 1024 * 1024)
+#define COPY_TEST_STRIDE         (16LL * 1024 * 1024)
+        char src[] = "/tmp/test_diskutil_src_XXXXXX";
+        char dst[] = "/tmp/test_diskutil_dst_XXXXXX";
+        char dd_dst[] = "/tmp/test_diskutil_dd_XXXXXX";
+        char data[65536];
+        int fd = -1;
+        struct stat src_sb = { 0 };
+        struct stat dst_sb = { 0 };
+        struct timeval t0, t1, t2;
+        diskutil_copy_stats stats = { 0 };
+
+        // an image with 1/16 of it allocated: 1MB of data at the start of every 16MB
+        assert((fd = mkstemp(src)) != -1);
+        assert(ftruncate(fd, COPY_TEST_BYTES) == 0);
+        for (long long offset = 0; offset < COPY_TEST_BYTES; offset += COPY_TEST_STRIDE) {
+            for (long long done = 0; done < (1024 * 1024); done += sizeof(data)) {
+                for (int i = 0; i < sizeof(data); i++)
+                    data[i] = (char)(offset + done + i * 7);
+                assert(pwrite(fd, data, sizeof(data), offset + done) == sizeof(data));
+            }
+        }
+        close(fd);
+        assert((fd = mkstemp(dst)) != -1);
+        assert(ftruncate(fd, COPY_TEST_BYTES) == 0);
+        close(fd);
+        assert((fd = mkstemp(dd_dst)) != -1);
+        assert(ftruncate(fd, COPY_TEST_BYTES) == 0);
+        close(fd);
+
+        if (helpers_path[DD] == NULL)  // only the first few helpers were looked up above
+            assert(verify_helpers(helpers + DD, helpers_path + DD, 1) == 0);
+
+        gettimeofday(&t0, NULL);
+        assert(diskutil_copy(src, dst, 0, 0, COPY_TEST_BYTES, &stats) == EUCA_OK);
+        gettimeofday(&t1, NULL);
+        assert(diskutil_dd2(src, dd_dst, 4096, (COPY_TEST_BYTES / 4096), 0, 0) == EUCA_OK);
+        gettimeofday(&t2, NULL);
+        printf("copied %lld bytes: %lld cloned, %lld copied, %lld skipped in %.3fs, dd took %.3fs\n", COPY_TEST_BYTES, stats.bytes_cloned, stats.bytes_copied,
+               stats.bytes_skipped, ((t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6), ((t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1e6));
+        assert((stats.bytes_cloned + stats.bytes_copied + stats.bytes_skipped) == COPY_TEST_BYTES);
+        assert(copy_test_same(src, 0, dst, 0, COPY_TEST_BYTES));
+        assert(copy_test_same(src, 0, dd_dst, 0, COPY_TEST_BYTES));
+        assert(stat(src, &src_sb) == 0 && stat(dst, &dst_sb) == 0);
+        assert(dst_sb.st_blocks <= (src_sb.st_blocks + 64));    // the holes stayed holes
+
+        // unaligned ranges, over data and holes, into a file with data where the source has a hole
+        stats.bytes_cloned = stats.bytes_copied = stats.bytes_skipped = 0;
+        assert(diskutil_copy(src, dst, (COPY_TEST_STRIDE - 4099), 513, (3 * COPY_TEST_STRIDE + 12345), &stats) == EUCA_OK);
+        assert(copy_test_same(src, (COPY_TEST_STRIDE - 4099), dst, 513, (3 * COPY_TEST_STRIDE + 12345)));
+        assert(copy_test_same(src, 0, dst, 0, 513));    // untouched before the range
+        assert((stats.bytes_cloned + stats.bytes_copied + stats.bytes_skipped) == (3 * COPY_TEST_STRIDE + 12345));
+
+        // the destination grows, as with dd, and bad parameters are refused
+        assert(diskutil_copy(src, dst, 0, COPY_TEST_BYTES, 4096, NULL) == EUCA_OK);
+        assert(stat(dst, &dst_sb) == 0 && dst_sb.st_size == (COPY_TEST_BYTES + 4096));
+        assert(diskutil_copy(src, dst, 0, 0, 0, NULL) == EUCA_INVALID_ERROR);
+        assert(diskutil_copy(src, "/tmp/test_diskutil_does_not_exist", 0, 0, 4096, NULL) == EUCA_IO_ERROR);
+
+        unlink(src);
+        unlink(dst);
+        unlink(dd_dst);
+#undef COPY_TEST_BYTES
+#undef COPY_TEST_STRIDE
+    }
+
+    if (access(LOOP_CONTROL_PATH, R_OK | W_OK) == 0) { // test loopback devices, timing the ioctls against 'losetup'
+#define LOOP_TEST_DEVICES        8
+        char file[] = "/tmp/test_diskutil_loop_XXXXXX";
+        char lodevs[LOOP_TEST_DEVICES][32];
+        int fd = -1;
+        struct timeval t0, t1;
+
+        assert((fd = mkstemp(file)) != -1);
+        assert(ftruncate(fd, (LOOP_TEST_DEVICES + 1) * 4096) == 0);
+        close(fd);
+        if (helpers_path[LOSETUP] == NULL)
+            assert(verify_helpers(helpers + LOSETUP, helpers_path + LOSETUP, 1) == 0);
+
+        for (int native = 1; native >= 0; native--) {
+            loop_native = native;
+            gettimeofday(&t0, NULL);
+            for (int i = 0; i < LOOP_TEST_DEVICES; i++)
+                assert(diskutil_loop(file, (i * 4096), lodevs[i], sizeof(lodevs[i])) == EUCA_OK);
+            for (int i = 0; i < LOOP_TEST_DEVICES; i++)
+                assert(diskutil_loop_check(file, lodevs[i]) == EUCA_OK);
+            for (int i = 0; i < LOOP_TEST_DEVICES; i++)
+                assert(diskutil_unloop(lodevs[i]) == EUCA_OK);
+            gettimeofday(&t1, NULL);
+            printf("attached, checked and detached %d loop devices %s in %.3fs\n", LOOP_TEST_DEVICES, (native ? "with ioctls" : "with losetup"),
+                   ((t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6));
+        }
+        loop_native = TRUE;
+        unlink(file);
+#undef LOOP_TEST_DEVICES
+    }
+
     {                                  // test diskutil_get_parts()
         struct partition_table_entry parts[5];
         int n = diskutil_get_parts("/dev/sda", parts, 5);
@@ -118,6 +118,13 @@ struct partition_table_entry {
     char filesystem[32];
 };
 
+//! How diskutil_copy() got the bytes of a range to the destination
+typedef struct diskutil_copy_stats {
+    long long bytes_cloned;            //!< shared with the source through a reflink
+    long long bytes_copied;            //!< read and written, by this process or by the kernel
+    long long bytes_skipped;           //!< holes and zeros that did not have to be written
+} diskutil_copy_stats;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -138,6 +145,7 @@ int diskutil_cleanup(void);
 int diskutil_ddzero(const char *path, const long long sectors, boolean zero_fill);
 int diskutil_dd(const char *in, const char *out, const int bs, const long long count);
 int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip);
+int diskutil_copy(const char *in, const char *out, long long in_offset, long long out_offset, long long len, diskutil_copy_stats * stats);
 int diskutil_mbr(const char *path, const char *type);
 int diskutil_part(const char *path, char *part_type, const char *fs_type, const long long first_sector, const long long last_sector);
 int diskutil_get_parts(const char *path, struct partition_table_entry entries[], int num_entries);
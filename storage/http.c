@@ -86,16 +86,23 @@
 #include <sys/stat.h>                  // stat
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <openssl/md5.h>
+#ifdef _UNIT_TEST
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif /* _UNIT_TEST */
 
 #include <eucalyptus.h>
 #include <log.h>
+#include <euca_auth.h>                 // base64_enc
+#include <hash.h>                      // md5digest2str
+#include <euca_string.h>               // euca_strncpy
 #include "misc.h"
-
-#ifndef _UNIT_TEST
-// http_ functions aren't part of the unit test
 #include <config.h>
 #include "http.h"
-#endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -103,13 +110,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 #define TOTAL_RETRIES                             40    //!< download is retried in case of connection problems (2.5hrs+)
 #define FIRST_TIMEOUT                              4    //!< in seconds, goes in powers of two afterwards
 #define MAX_TIMEOUT                              300    //!< in seconds, the cap for growing timeout values
 #define STRSIZE                                  245    //!< for short strings: files, hosts, URLs
-#endif /* ! _UNIT_TEST */
 #define RANDOM_DELAY_PERCENT                    0.01    //!< 1% of current timeout determines max delay duration
+#define RESUME_OVERLAP                          4096    //!< bytes of saved data a resumed download fetches again, to check that they match
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -129,7 +135,6 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 struct read_request {
     FILE *fp;                          //!< input file pointer to be used by curl READERs
     long long total_read;              //!< bytes written during the operation
@@ -146,8 +151,23 @@ struct write_request {
     z_stream strm;                     //!< stream struct used by zlib
     int ret;                           //!< return value of last inflate() call
 #endif                                 /* CAN_GZIP */
+    CURL *curl;                        //!< handle of the transfer, to look up the response code
+    boolean streaming;                 //!< TRUE once the body of the response is known to be the object
+    boolean changed;                   //!< TRUE if the object on the server no longer matches what is saved
+    long long offset;                  //!< bytes of the object saved so far, where a retry resumes
+    int overlap;                       //!< bytes at the start of a resumed response that repeat saved data
+    int overlap_checked;               //!< bytes of the overlap compared so far
+    char tail[RESUME_OVERLAP];         //!< last bytes saved before the resumed response
+    MD5_CTX md5;                       //!< rolling digest of the bytes saved so far
+    long long size;                    //!< size of the object, or -1 if not known yet
+    char validator[STRSIZE];           //!< ETag or Last-Modified of the object, sent in If-Range when resuming
+    char digest[STRSIZE];              //!< base64 MD5 of the object announced by the server, if any
+    long long rsp_size;                //!< size of the object according to the current response
+    char rsp_etag[STRSIZE];            //!< ETag of the current response
+    char rsp_last_modified[STRSIZE];   //!< Last-Modified of the current response
+    char rsp_content_md5[STRSIZE];     //!< Content-MD5 of the current response
+    char rsp_digest[STRSIZE];          //!< MD5 from the Digest header of the current response
 };
-#endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -169,9 +189,7 @@ struct write_request {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have already initialize libcurl
-#endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -181,6 +199,8 @@ static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have
 
 static size_t read_data(char *buffer, size_t size, size_t nitems, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params);
+static int restart_download(struct write_request *params);
 static char hch_to_int(char ch);
 static char int_to_hch(char i);
 
@@ -397,29 +417,175 @@ static size_t read_data(char *buffer, size_t size, size_t nitems, void *params)
 //! @param[in] buffer the string buffer we write into when reading.
 //! @param[in] size the size of each members for fread()
 //! @param[in] nmemb the number of items passed to fread()
-//! @param[in] params a transparent pointer to the libcurl read_request structure.
+//! @param[in] params a transparent pointer to the libcurl write_request structure.
 //!
-//! @return The number of bytes written or -1 on failture.
+//! @return The number of bytes handled. Any other value makes libcurl fail the transfer.
 //!
 //! @pre Both params and buffer parameters must not be NULL.
 //!
-//! @post On success, we wrote our buffer content to the file descriptor. If buffer or params is NULL,
-//!       than a SIGABORT signal will be thrown.
+//! @post On success, we wrote our buffer content to the file descriptor and added it to the
+//!       rolling digest. Bytes of a resumed response that repeat saved data are compared
+//!       against it instead. If buffer or params is NULL, than a SIGABORT signal will be thrown.
 //!
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params)
 {
-    FILE *fp = NULL;
-    int wrote = -1;
+    int skip = 0;
+    long httpcode = 0L;
+    size_t len = (size * nmemb);
+    struct write_request *req = NULL;
+
+    assert(buffer != NULL);
+    assert(params != NULL);
+
+    req = ((struct write_request *)params);
+    if (!req->streaming) {
+        curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+        if (httpcode == 200L) {
+            // the server is sending the whole object, either ignoring the range or because it changed
+            if ((req->offset > 0) && (restart_download(req) != EUCA_OK))
+                return (0);
+            req->overlap = 0;
+        } else if (httpcode != 206L) {
+            return (len);              // body of an error response, which is handled once the transfer is over
+        }
+        req->streaming = TRUE;
+    }
+
+    if (req->overlap_checked < req->overlap) {
+        skip = MIN(len, (req->overlap - req->overlap_checked));
+        if (memcmp(buffer, (req->tail + req->overlap_checked), skip)) {
+            LOGWARN("resumed download does not match the %d byte(s) saved before it\n", req->overlap);
+            req->changed = TRUE;
+            return (0);
+        }
+        req->overlap_checked += skip;
+    }
+
+    if (len > skip) {
+        if (fwrite(((char *)buffer + skip), 1, (len - skip), req->fp) != (len - skip)) {
+            LOGERROR("failed to write downloaded data\n");
+            return (0);
+        }
+        MD5_Update(&(req->md5), ((char *)buffer + skip), (len - skip));
+        req->offset += (len - skip);
+        req->total_wrote += (len - skip);
+    }
+    req->total_calls++;
+    return (len);
+}
+
+//!
+//! libcurl header handler, which records the validators, size and digest of
+//! the object from each response. At the end of the headers of a partial
+//! response, it makes sure that the response is for the object being resumed.
+//!
+//! @param[in] buffer the header line, not NUL-terminated
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the libcurl write_request structure.
+//!
+//! @return The number of bytes handled. Any other value makes libcurl fail the transfer.
+//!
+static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    int i = 0;
+    long httpcode = 0L;
+    size_t len = (size * nmemb);
+    char *value = NULL;
+    char *md5 = NULL;
+    char line[STRSIZE] = "";
+    long long first = 0;
+    long long last = 0;
+    long long total = 0;
+    struct write_request *req = NULL;
 
     assert(buffer != NULL);
     assert(params != NULL);
 
-    fp = ((struct write_request *)params)->fp;
-    wrote = fwrite(buffer, size, nmemb, fp);
-    ((struct write_request *)params)->total_wrote += wrote;
-    ((struct write_request *)params)->total_calls++;
+    req = ((struct write_request *)params);
+    if (len >= STRSIZE)
+        return (len);                  // none of the headers we look at are this long
+
+    memcpy(line, buffer, len);
+    for (i = len - 1; (i >= 0) && isspace(line[i]); i--)
+        line[i] = '\0';
+
+    if (!strncasecmp(line, "HTTP/", 5)) {
+        // a new response, maybe after an interim one
+        req->rsp_size = -1;
+        req->rsp_etag[0] = req->rsp_last_modified[0] = req->rsp_content_md5[0] = req->rsp_digest[0] = '\0';
+        return (len);
+    }
+
+    if (line[0] != '\0') {
+        if ((value = strchr(line, ':')) == NULL)
+            return (len);
+        for (*value++ = '\0'; isspace(*value); value++) ;
+
+        if (!strcasecmp(line, "ETag")) {
+            euca_strncpy(req->rsp_etag, value, STRSIZE);
+        } else if (!strcasecmp(line, "Last-Modified")) {
+            euca_strncpy(req->rsp_last_modified, value, STRSIZE);
+        } else if (!strcasecmp(line, "Content-MD5")) {
+            euca_strncpy(req->rsp_content_md5, value, STRSIZE);
+        } else if (!strcasecmp(line, "Digest")) {
+            if (((md5 = strcasestr(value, "md5=")) != NULL) && (sscanf(md5 + 4, "%[A-Za-z0-9+/=]", req->rsp_digest) != 1))
+                req->rsp_digest[0] = '\0';
+        } else if (!strcasecmp(line, "Content-Range")) {
+            if (sscanf(value, "bytes %lld-%lld/%lld", &first, &last, &total) == 3)
+                req->rsp_size = total;
+        } else if (!strcasecmp(line, "Content-Length")) {
+            if ((req->rsp_size < 0) && (sscanf(value, "%lld", &total) == 1))
+                req->rsp_size = total;
+        }
+        return (len);
+    }
+    // end of the headers of a response; If-Range only takes strong validators
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    value = ((req->rsp_etag[0] && strncmp(req->rsp_etag, "W/", 2)) ? req->rsp_etag : req->rsp_last_modified);
+    if (httpcode == 206L) {
+        // a server that ignores If-Range must at least not send a part of something else
+        if ((value[0] && req->validator[0] && strcmp(value, req->validator)) || ((req->size >= 0) && (req->rsp_size >= 0) && (req->rsp_size != req->size))) {
+            LOGWARN("object changed on the server since the download started\n");
+            req->changed = TRUE;
+            return (0);
+        }
+    } else if (httpcode != 200L) {
+        return (len);
+    }
+
+    if ((httpcode == 200L) || !req->validator[0])
+        euca_strncpy(req->validator, value, STRSIZE);
+    if (httpcode == 200L || (req->size < 0))
+        req->size = req->rsp_size;
+    if (req->rsp_digest[0]) {
+        euca_strncpy(req->digest, req->rsp_digest, STRSIZE);
+    } else if (httpcode == 200L) {
+        // in a partial response, Content-MD5 is the digest of the part only
+        euca_strncpy(req->digest, req->rsp_content_md5, STRSIZE);
+    }
+    return (len);
+}
 
-    return (wrote);
+//!
+//! discards what has been saved of a download, so that the saved data and the
+//! rolling digest start over from the first byte of the object
+//!
+//! @param[in] params the write_request structure of the download
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the output file could not be reset
+//!
+static int restart_download(struct write_request *params)
+{
+    LOGDEBUG("discarding %lld byte(s) saved so far\n", params->offset);
+    params->offset = 0;
+    params->overlap = params->overlap_checked = 0;
+    MD5_Init(&(params->md5));
+    if ((fseeko(params->fp, 0L, SEEK_SET) == -1) || (ftruncate(fileno(params->fp), 0) == -1)) {
+        LOGERROR("failed to truncate the output file\n");
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
 }
 
 //!
@@ -585,7 +751,7 @@ char *http_get2str(const char *url, boolean * bail_flag)
 //!
 int http_get(const char *url, const char *outfile, boolean * bail_flag)
 {
-    return (http_get_timeout(url, outfile, TOTAL_RETRIES, FIRST_TIMEOUT, 0, 0, bail_flag));
+    return (http_get_timeout_md5(url, outfile, TOTAL_RETRIES, FIRST_TIMEOUT, 0, 0, bail_flag, NULL));
 }
 
 //!
@@ -597,6 +763,34 @@ int http_get(const char *url, const char *outfile, boolean * bail_flag)
 //! @param[in] first_timeout number of seconds to wait between attemps. Each attemp will multiply the value by 2.
 //! @param[in] connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
 //! @param[in] total_timeout the libcurl total timeout value (libcurl option CURLOPT_TIMEOUT)
+//! @param[in] bail_flag if set to TRUE while waiting to retry, the download is abandoned
+//!
+//! @return The result of http_get_timeout_md5()
+//!
+//! @see http_get_timeout_md5()
+//!
+int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag)
+{
+    return (http_get_timeout_md5(url, outfile, total_retries, first_timeout, connect_timeout, total_timeout, bail_flag, NULL));
+}
+
+//!
+//! Process an HTTP get request to the given URL with a given timeout. A retry
+//! resumes after the bytes saved by earlier attempts with a ranged request,
+//! conditional on the object being unchanged, and fetches a few saved bytes
+//! again to check that they match. An MD5 digest of the saved bytes is kept
+//! across attempts and checked against Content-MD5 or Digest headers if the
+//! server sends them. The digest is also handed back to the caller, who thus
+//! need not read the file again to hash it.
+//!
+//! @param[in] url the request URL
+//! @param[in] outfile path to the input file to be used by curl WRITERs
+//! @param[in] total_retries number of retries to execute the get operation
+//! @param[in] first_timeout number of seconds to wait between attemps. Each attemp will multiply the value by 2.
+//! @param[in] connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//! @param[in] total_timeout the libcurl total timeout value (libcurl option CURLOPT_TIMEOUT)
+//! @param[in] bail_flag if set to TRUE while waiting to retry, the download is abandoned
+//! @param[out] md5_str buffer of MD5_STR_SIZE bytes for the hex MD5 of outfile, or NULL
 //!
 //! @return EUCA_OK on success or the following error codes:
 //!         \li EUCA_ERROR: on failure
@@ -609,16 +803,22 @@ int http_get(const char *url, const char *outfile, boolean * bail_flag)
 //!
 //! @post On success, the get request has been processed successfully
 //!
-int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag)
+int http_get_timeout_md5(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag,
+                         char *md5_str)
 {
     int code = EUCA_ERROR;
     int retries = 0;
     int timeout = 0;
     long httpcode = 0L;
+    char *md5_b64 = NULL;
+    char range[STRSIZE] = "";
+    char if_range[STRSIZE] = "";
     char error_msg[CURL_ERROR_SIZE] = { 0 };
+    unsigned char md5[MD5_DIGEST_LENGTH] = { 0 };
     FILE *fp = NULL;
     CURL *curl = NULL;
     CURLcode result = CURLE_OK;
+    struct curl_slist *headers = NULL;
     struct write_request params = { 0 };
 
     if (!url || !outfile) {
@@ -635,7 +835,8 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
         return (EUCA_INVALID_ERROR);
     }
 
-    if ((fp = fopen64(outfile, "w")) == NULL) {
+    // opened for reading as well, to check resumed downloads against what is saved
+    if ((fp = fopen64(outfile, "w+")) == NULL) {
         LOGERROR("failed to open %s for writing\n", outfile);
         return (EUCA_ACCESS_ERROR);
     }
@@ -654,8 +855,13 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
 
     /* set up the default write function, but possibly override it below, if compression is desired and possible */
     params.fp = fp;
+    params.curl = curl;
+    params.size = -1;
+    MD5_Init(&(params.md5));
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &params);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &params);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header);
 
     if (connect_timeout > 0) {
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
@@ -672,6 +878,35 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
     do {
         params.total_wrote = 0L;
         params.total_calls = 0L;
+        params.streaming = FALSE;
+        params.changed = FALSE;
+        params.overlap = params.overlap_checked = 0;
+
+        // pick up after the bytes saved by earlier attempts, fetching the last few of them
+        // again to check that the server is still sending the same object
+        curl_slist_free_all(headers);
+        headers = NULL;
+        if (params.offset > 0) {
+            params.overlap = MIN(params.offset, RESUME_OVERLAP);
+            if (pread(fileno(fp), params.tail, params.overlap, (params.offset - params.overlap)) != params.overlap) {
+                LOGWARN("failed to read back the end of %s, downloading it from the start\n", outfile);
+                if (restart_download(&params) != EUCA_OK)
+                    break;
+            }
+        }
+
+        if (params.offset > 0) {
+            snprintf(range, sizeof(range), "%lld-", (params.offset - params.overlap));
+            curl_easy_setopt(curl, CURLOPT_RANGE, range);
+            if (params.validator[0]) {
+                snprintf(if_range, sizeof(if_range), "If-Range: %s", params.validator);
+                headers = curl_slist_append(headers, if_range);
+            }
+            LOGINFO("resuming download of %s at byte %lld\n", url, params.offset);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_RANGE, NULL);
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
         // Introduce a small random delay before each download to
         // spread out parallel download attemps from multiple NCs.
@@ -686,7 +921,14 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
         result = curl_easy_perform(curl);   /* do it */
         LOGDEBUG("wrote %lld bytes in %lld writes\n", params.total_wrote, params.total_calls);
 
-        if (result) {
+        if (params.changed) {
+            // what is saved belongs to an older version of the object
+            LOGWARN("%s changed during the download, downloading it from the start\n", url);
+            params.validator[0] = params.digest[0] = '\0';
+            params.size = -1;
+            if (restart_download(&params) != EUCA_OK)
+                break;
+        } else if (result) {
             // curl error (connection or transfer failed)
             LOGERROR("%s (%d)\n", error_msg, result);
         } else {
@@ -694,9 +936,25 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
             //! @TODO pull out response message, too
             switch (httpcode) {
             case 200L:
-                // all good
-                LOGDEBUG("saved image in %s\n", outfile);
-                code = EUCA_OK;
+            case 206L:
+                // all there, and correct if the server told us what to expect
+                MD5_Final(md5, &(params.md5));
+                if ((md5_b64 = base64_enc(md5, MD5_DIGEST_LENGTH)) == NULL) {
+                    LOGERROR("failed to encode the digest of %s\n", outfile);
+                    retries = 0;
+                } else if (params.digest[0] && strcmp(md5_b64, params.digest)) {
+                    LOGWARN("digest of %s is %s instead of %s, downloading it again\n", outfile, md5_b64, params.digest);
+                    params.digest[0] = '\0';
+                    if (restart_download(&params) != EUCA_OK)
+                        retries = 0;
+                } else if ((md5_str != NULL) && (md5digest2str(md5_str, MD5_STR_SIZE, md5) != EUCA_OK)) {
+                    LOGERROR("failed to encode the digest of %s\n", outfile);
+                    retries = 0;
+                } else {
+                    LOGDEBUG("saved image in %s (%lld bytes, md5 %s%s)\n", outfile, params.offset, md5_b64, (params.digest[0] ? ", verified" : ""));
+                    code = EUCA_OK;
+                }
+                EUCA_FREE(md5_b64);
                 break;
             case 408L:
                 // timeout, retry
@@ -706,6 +964,14 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
             case 404L:
                 LOGWARN("server responded with HTTP code %ld (file not found) for %s\n", httpcode, url);
                 break;
+            case 416L:
+                // the saved bytes do not fit the object any more
+                LOGWARN("server responded with HTTP code %ld (range not satisfiable) for %s\n", httpcode, url);
+                params.validator[0] = params.digest[0] = '\0';
+                params.size = -1;
+                if (restart_download(&params) != EUCA_OK)
+                    retries = 0;
+                break;
             default:
                 // some kind of error
                 LOGERROR("server responded with HTTP code %ld for %s\n", httpcode, url);
@@ -728,7 +994,7 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
             if (timeout > MAX_TIMEOUT)
                 timeout = MAX_TIMEOUT;
 
-            fseek(fp, 0L, SEEK_SET);   // move the file pointer to the beginning for the retry
+            fseeko(fp, params.offset, SEEK_SET);    // the retry resumes after the bytes saved so far
         }
 
         retries--;
@@ -739,21 +1005,235 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
         LOGWARN("removing %s\n", outfile);
         remove(outfile);
     }
+    curl_slist_free_all(headers);
     curl_easy_cleanup(curl);
     return (code);
 }
 
 #ifdef _UNIT_TEST
+#define TEST_OBJECT_SIZE                (3 * 1024 * 1024 + 17)  //!< size of the object served by the stand-in server
+#define TEST_DROP_PERCENT                         40    //!< how much of a response the stand-in server sends before cutting it short
+
+//! Describes how the stand-in HTTP server behaves during one download test
+typedef struct test_scenario_t {
+    const char *name;                  //!< name of the test
+    int drops;                         //!< number of connections cut short before the rest succeed
+    boolean ranges;                    //!< TRUE if the server honors Range
+    boolean ignore_if_range;           //!< TRUE if the server sends a part even when If-Range does not match
+    boolean md5;                       //!< TRUE if the server sends Content-MD5
+    boolean bad_md5;                   //!< TRUE if the Content-MD5 sent is that of another object
+    int change_at;                     //!< connection from which the server has a new version of the object, 0 for never
+    int total_retries;                 //!< number of attempts http_get_timeout() is given
+    boolean expect_ok;                 //!< TRUE if the download is expected to succeed
+    boolean expect_resume;             //!< TRUE if the server must have sent little more than one object
+} test_scenario;
+
+static test_scenario test_scenarios[] = {
+    {"resume after drops", 2, TRUE, FALSE, TRUE, FALSE, 0, 4, TRUE, TRUE},
+    {"resume without digest", 2, TRUE, FALSE, FALSE, FALSE, 0, 4, TRUE, TRUE},
+    {"restart without ranges", 1, FALSE, FALSE, TRUE, FALSE, 0, 4, TRUE, FALSE},
+    {"restart after change", 1, TRUE, FALSE, TRUE, FALSE, 2, 4, TRUE, FALSE},
+    {"restart after change, If-Range ignored", 1, TRUE, TRUE, TRUE, FALSE, 2, 4, TRUE, FALSE},
+    {"fail on bad digest", 0, TRUE, FALSE, TRUE, TRUE, 0, 2, FALSE, FALSE},
+    {NULL},
+};
+
+//!
+//! fills in the content of a version of the test object
+//!
+//! @param[out] buf the buffer of TEST_OBJECT_SIZE bytes to fill
+//! @param[in] version the version of the object
+//!
+static void test_object(unsigned char *buf, int version)
+{
+    for (long long i = 0; i < TEST_OBJECT_SIZE; i++)
+        buf[i] = (unsigned char)((i * 31) + (i >> 12) + (version * 7));
+}
+
+//!
+//! serves the test object over connections accepted on sock, one request per
+//! connection, behaving as the scenario says. The number of body bytes sent
+//! for each request is reported on report_fd. Never returns.
+//!
+//! @param[in] sock the listening socket
+//! @param[in] ts the scenario
+//! @param[in] report_fd the pipe to report on
+//!
+static void test_server(int sock, const test_scenario * ts, int report_fd)
+{
+    int fd = -1;
+    int got = 0;
+    int version = 0;
+    char *p = NULL;
+    char *md5_str[2] = { NULL };
+    char req[4096] = "";
+    char hdr[1024] = "";
+    char etag[32] = "";
+    unsigned char md5[MD5_DIGEST_LENGTH] = { 0 };
+    unsigned char *objects[2] = { NULL };
+    long long start = 0;
+    long long len = 0;
+    long long sent = 0;
+    boolean partial = FALSE;
+
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < 2; i++) {
+        objects[i] = EUCA_ALLOC(TEST_OBJECT_SIZE, 1);
+        test_object(objects[i], i + 1);
+        MD5(objects[i], TEST_OBJECT_SIZE, md5);
+        md5_str[i] = base64_enc(md5, MD5_DIGEST_LENGTH);
+    }
+
+    for (int conn = 1;; conn++) {
+        if ((fd = accept(sock, NULL, NULL)) < 0)
+            continue;
+
+        for (got = 0, req[0] = '\0'; (got < (sizeof(req) - 1)) && !strstr(req, "\r\n\r\n"); req[got] = '\0') {
+            int n = read(fd, req + got, sizeof(req) - 1 - got);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+
+        version = (((ts->change_at > 0) && (conn >= ts->change_at)) ? 2 : 1);
+        snprintf(etag, sizeof(etag), "\"v%d\"", version);
+        start = 0;
+        partial = FALSE;
+        if (ts->ranges && ((p = strcasestr(req, "\r\nRange: bytes=")) != NULL) && (sscanf(p + 15, "%lld-", &start) == 1)) {
+            partial = TRUE;
+            if (!ts->ignore_if_range && ((p = strcasestr(req, "\r\nIf-Range: ")) != NULL) && strncmp(p + 12, etag, strlen(etag))) {
+                partial = FALSE;       // the object changed, so send all of it
+                start = 0;
+            }
+        }
+
+        len = TEST_OBJECT_SIZE - start;
+        if (partial) {
+            snprintf(hdr, sizeof(hdr), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%d/%d\r\n", start, (TEST_OBJECT_SIZE - 1), TEST_OBJECT_SIZE);
+        } else {
+            snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\n");
+        }
+        snprintf(hdr + strlen(hdr), sizeof(hdr) - strlen(hdr), "ETag: %s\r\nContent-Length: %lld\r\n", etag, len);
+        if (ts->md5 && !partial) {
+            snprintf(hdr + strlen(hdr), sizeof(hdr) - strlen(hdr), "Content-MD5: %s\r\n", md5_str[(ts->bad_md5 ? (2 - version) : (version - 1))]);
+        }
+        snprintf(hdr + strlen(hdr), sizeof(hdr) - strlen(hdr), "Connection: close\r\n\r\n");
+
+        if (conn <= ts->drops)
+            len = (len * TEST_DROP_PERCENT) / 100;
+        sent = 0;
+        if (write(fd, hdr, strlen(hdr)) == strlen(hdr)) {
+            while (sent < len) {
+                int n = write(fd, objects[version - 1] + start + sent, MIN((len - sent), 65536));
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+        }
+        close(fd);
+        if (write(report_fd, &sent, sizeof(sent)) != sizeof(sent))
+            exit(1);
+    }
+}
+
+//!
+//! downloads the test object from a stand-in server behaving as the scenario
+//! says, and checks the outcome
+//!
+//! @param[in] ts the scenario
+//!
+//! @return the number of errors found
+//!
+static int test_download(const test_scenario * ts)
+{
+    int rc = 0;
+    int sock = -1;
+    int errors = 0;
+    int requests = 0;
+    int report[2] = { -1, -1 };
+    char url[STRSIZE] = "";
+    char path[] = "/tmp/euca-http-test-XXXXXX";
+    unsigned char *expected = NULL;
+    char *saved = NULL;
+    char *file_md5 = NULL;
+    char md5_str[MD5_STR_SIZE] = "";
+    long long sent = 0;
+    long long total_sent = 0;
+    pid_t pid = -1;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_in addr = { 0 };
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) || bind(sock, (struct sockaddr *)&addr, addr_len) || listen(sock, 8)
+        || getsockname(sock, (struct sockaddr *)&addr, &addr_len) || pipe(report)) {
+        printf("FAIL %s: could not set up the stand-in server\n", ts->name);
+        return (1);
+    }
+
+    if ((pid = fork()) == 0) {
+        close(report[0]);
+        test_server(sock, ts, report[1]);
+        exit(0);
+    }
+    close(sock);
+    close(report[1]);
+
+    close(safe_mkstemp(path));
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/object", ntohs(addr.sin_port));
+    rc = http_get_timeout_md5(url, path, ts->total_retries, 1, 5, 60, NULL, md5_str);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    while (read(report[0], &sent, sizeof(sent)) == sizeof(sent)) {
+        total_sent += sent;
+        requests++;
+    }
+    close(report[0]);
+
+    if ((rc == EUCA_OK) != ts->expect_ok) {
+        printf("FAIL %s: download returned %d\n", ts->name, rc);
+        errors++;
+    } else if (rc == EUCA_OK) {
+        expected = EUCA_ALLOC(TEST_OBJECT_SIZE, 1);
+        test_object(expected, (((ts->change_at > 0) && (requests >= ts->change_at)) ? 2 : 1));
+        if (((saved = file2strn(path, (TEST_OBJECT_SIZE + 1))) == NULL) || memcmp(saved, expected, TEST_OBJECT_SIZE)) {
+            printf("FAIL %s: saved file differs from the object\n", ts->name);
+            errors++;
+        }
+        if (((file_md5 = file2md5str(path)) == NULL) || strcmp(file_md5, md5_str)) {
+            printf("FAIL %s: digest computed during the download is '%s' instead of '%s'\n", ts->name, md5_str, SP(file_md5));
+            errors++;
+        }
+        EUCA_FREE(file_md5);
+        EUCA_FREE(saved);
+        EUCA_FREE(expected);
+        if (ts->expect_resume && (total_sent > (TEST_OBJECT_SIZE + requests * RESUME_OVERLAP))) {
+            printf("FAIL %s: server sent %lld bytes for a %d-byte object\n", ts->name, total_sent, TEST_OBJECT_SIZE);
+            errors++;
+        }
+    } else if (access(path, F_OK) == 0) {
+        printf("FAIL %s: failed download left %s behind\n", ts->name, path);
+        errors++;
+    }
+    unlink(path);
+
+    printf("%s %s: %d request(s), %lld of %d byte(s) sent\n", (errors ? "FAIL" : "PASS"), ts->name, requests, total_sent, TEST_OBJECT_SIZE);
+    return (errors);
+}
+
 //!
 //! Main entry point of the application
 //!
 //! @param[in] argc the number of parameter passed on the command line
 //! @param[in] argv the list of arguments
 //!
-//! @return EUCA_OK
+//! @return the number of errors
 //!
 int main(int argc, char **argv)
 {
+    int errors = 0;
+
 #define _T(_S)                                                \
 {                                                             \
 	char *__e = url_encode (_S);                              \
@@ -766,8 +1246,13 @@ int main(int argc, char **argv)
     _T("hello world");
     _T("~`!1@2#3$4%5^6&7*8(9)0_-+={[}]|\\:;\"'<,>.?/");
     _T("[datastore1 (1)] windows 2003 enterprise/windows 2003 enterprise.vmx");
-    return (EUCA_OK);
 
 #undef _T
+
+    for (int i = 0; test_scenarios[i].name != NULL; i++)
+        errors += test_download(&test_scenarios[i]);
+
+    printf("done testing http.c (errors=%d)\n", errors);
+    return (errors);
 }
 #endif /* _UNIT_TEST */
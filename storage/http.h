@@ -118,6 +118,8 @@ char *url_encode(const char *unencoded);
 char *url_decode(const char *encoded);
 int http_get(const char *url, const char *outfile, boolean * bail_flag);
 int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag);
+int http_get_timeout_md5(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag,
+                         char *md5_str);
 char *http_get2str(const char *url, boolean * bail_flag);
 
 /*----------------------------------------------------------------------------*\
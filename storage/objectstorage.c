@@ -87,6 +87,13 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef _UNIT_TEST
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif /* _UNIT_TEST */
 #if defined(HAVE_ZLIB_H)
 #include <zlib.h>
 #endif /* HAVE_ZLIB_H */
@@ -114,6 +121,10 @@
 #define BUFSIZE                                  262144 //!< should be big enough for CERT and the signature
 #define STRSIZE                                    1024 //!< for short strings: files, hosts, URLs
 #define PROGRESS_UPDATE_SEC                           3 //!< how often to report on progress of long downloads
+#define PARALLEL_PARTS                                4 //!< default number of image parts downloaded at once
+#define MAX_PARALLEL_PARTS                           64 //!< upper bound on the configurable number of parts in flight
+#define PART_SIZE_MB                                 16 //!< default size of an image part, in MB
+#define MAX_PART_SIZE_MB                           1024 //!< upper bound on the configurable part size, in MB
 
 #define OBJECT_STORAGE_ENDPOINT                          "/services/objectstorage"
 #define DEFAULT_HOST_PORT                        "localhost:8773"
@@ -159,6 +170,45 @@ struct progress_data_t {
     time_t last_update;
 };
 
+//! Defines one byte range of an image fetched by the parallel downloader
+struct image_part {
+    struct image_download *dl;         //!< the download this part belongs to
+    int index;                         //!< position of this part within the image
+    long long start;                   //!< offset of the first byte of the part
+    long long end;                     //!< offset of the last byte of the part, or -1 if the server ignores ranges
+    long long received;                //!< bytes of the part received so far, across all attempts
+    boolean ranged;                    //!< TRUE if the response of the current attempt carries a Content-Range
+    long long range_first;             //!< first byte in the Content-Range of the current attempt
+    long long range_total;             //!< size of the image in the Content-Range of the current attempt, or -1 if not given
+    long long content_length;          //!< Content-Length of the response of the current attempt, or -1 if not given
+    boolean streaming;                 //!< TRUE once the response of the current attempt is known to be the part
+    boolean done;                      //!< TRUE once every byte of the part has been received
+    int attempts;                      //!< number of requests issued for this part
+    int timeout;                       //!< back-off before the next attempt, in seconds
+    time_t retry_at;                   //!< earliest time of the next attempt
+    unsigned char *buf;                //!< bytes received ahead of their turn in the inflate stream
+    size_t buf_len;                    //!< number of bytes in buf
+    size_t buf_size;                   //!< allocated size of buf
+    CURL *curl;                        //!< handle of the attempt in flight, or NULL if none
+    struct curl_slist *headers;        //!< signed headers of the attempt in flight
+    char error_msg[CURL_ERROR_SIZE];   //!< curl error message of the attempt in flight
+};
+
+//! Defines the state of a parallel ranged download of an image
+struct image_download {
+    const char *objectstorage_op;      //!< operation header to sign with each part request
+    const char *url;                   //!< URL of the image, including any query
+    int do_compress;                   //!< TRUE if the parts are slices of one gzip stream
+    struct request params;             //!< output file and inflate state, as used by the serial write handlers
+    long long total_size;              //!< size of the image on the wire, or -1 until the server reports it
+    struct image_part **parts;         //!< parts of the image, in order of their offsets
+    int nparts;                        //!< number of entries in parts
+    int head;                          //!< lowest part that has not been completely written out
+    int active;                        //!< number of parts with a request in flight
+    boolean failed;                    //!< TRUE once the download cannot succeed
+    boolean unsized;                   //!< TRUE if the first part completed without the server reporting the size of the image
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -182,6 +232,8 @@ struct progress_data_t {
 //! objectstorage_request internal lock to prevent apparent race in curl ssl dependency
 static pthread_mutex_t wreq_mutex = PTHREAD_MUTEX_INITIALIZER;
 static unsigned short total_attempts = TOTAL_ATTEMPTS;
+static int parallel_parts = PARALLEL_PARTS;   //!< number of image parts downloaded at once, 1 disables ranged downloads
+static long long part_size = (PART_SIZE_MB * 1024LL * 1024LL);  //!< size of an image part, in bytes
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -189,14 +241,25 @@ static unsigned short total_attempts = TOTAL_ATTEMPTS;
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static struct curl_slist *objectstorage_signed_headers(const char *objectstorage_op, const char *verb, const char *url);
 static int objectstorage_request_timeout(const char *objectstorage_op, const char *verb, const char *requested_url, const char *outfile, const int do_compress,
                                          int connect_timeout, int total_timeout);
+static struct image_part *image_part_alloc(struct image_download *dl, int index, long long start, long long end);
+static void image_part_free(struct image_part *part, CURLM * multi);
+static int image_part_start(struct image_part *part, CURLM * multi, int connect_timeout);
+static void image_part_finish(struct image_part *part, CURLM * multi, CURLcode result);
+static void image_download_split(struct image_download *dl);
+static void image_download_advance(struct image_download *dl);
+static int objectstorage_parallel_request(const char *objectstorage_op, const char *requested_url, const char *outfile, const int do_compress, int connect_timeout);
 static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_part_header(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_part(void *buffer, size_t size, size_t nmemb, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
 
 #if defined(CAN_GZIP)
 static void print_data(unsigned char *buf, const int size);
 static void zerr(int ret, char *where);
+static int request_inflate_init(struct request *params);
 static size_t write_data_zlib(void *buffer, size_t size, size_t nmemb, void *params);
 #endif /* CAN_GZIP */
 
@@ -214,6 +277,76 @@ static int progress_function(void *clientp, double dltotal, double dlnow, double
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//!
+//! builds the list of headers for an objectstorage request, signed with
+//! EucaV2 signing. The date header is taken at the time of the call.
+//!
+//! @param[in] objectstorage_op the EucaOperation header value, or NULL for none
+//! @param[in] verb the HTTP verb of the request
+//! @param[in] url the complete URL of the request
+//!
+//! @return the list of headers, which the caller must free with curl_slist_free_all(),
+//!         or NULL on error.
+//!
+static struct curl_slist *objectstorage_signed_headers(const char *objectstorage_op, const char *verb, const char *url)
+{
+    char *newline = NULL;
+    char *url_host = NULL;
+    char *auth_str = NULL;
+    char host_hdr[STRSIZE] = "";
+    char date_hdr[STRSIZE] = "";
+    char date_str[17] = "";
+    char op_hdr[STRSIZE] = "";
+    time_t t = 0;
+    struct tm tmp_t = { 0 };
+    struct curl_slist *headers = NULL;
+
+    if (objectstorage_op != NULL) {
+        snprintf(op_hdr, STRSIZE, "EucaOperation: %s", objectstorage_op);
+        headers = curl_slist_append(headers, op_hdr);
+    }
+
+    t = time(&t);
+    gmtime_r(&t, &tmp_t);
+
+    //Format for time
+    if (strftime(date_str, 17, "%Y%m%dT%H%M%SZ", &tmp_t) == 0) {
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    assert(strlen(date_str) + 7 <= STRSIZE);
+
+    // remove newline if found
+    if ((newline = strchr(date_str, '\n')) != NULL) {
+        *newline = '\0';
+    }
+
+    snprintf(date_hdr, STRSIZE, "Date: %s", date_str);
+    headers = curl_slist_append(headers, date_hdr);
+
+    if ((url_host = process_url(url, URL_HOSTNAME)) == NULL) {
+        LOGERROR("objectstorage URL has no host\n");
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    snprintf(host_hdr, STRSIZE, "Host: %s", url_host);
+    headers = curl_slist_append(headers, host_hdr);
+    EUCA_FREE(url_host);
+
+    // create objectstorage-compliant sig
+    if ((auth_str = eucav2_sign_request(verb, url, headers)) == NULL) {
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    assert(strlen(auth_str) + 16 <= BUFSIZE);
+    headers = curl_slist_append(headers, auth_str);
+    EUCA_FREE(auth_str);
+    return (headers);
+}
+
 //!
 //! downloads a decrypted image from objectstorage based on the manifest URL,
 //! saves it to outfile. Uses EucaV2 signing for the request. We keep
@@ -237,19 +370,10 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     int timeout = FIRST_TIMEOUT;
     long httpcode = 0;
     char *url_path = NULL;
-    char *newline = NULL;
-    char *url_host = NULL;
-    char *auth_str = NULL;
-    char host_hdr[STRSIZE] = "";
-    char date_hdr[STRSIZE] = "";
-    char date_str[17] = "";
     char url[BUFSIZE] = "";
-    char op_hdr[STRSIZE] = "";
     char error_msg[CURL_ERROR_SIZE] = "";
     CURL *curl = 0;
     CURLcode result = CURLE_OK;
-    time_t t = 0;
-    struct tm tmp_t = { 0 };
     struct request params = { 0 };
     struct curl_slist *headers = NULL; // beginning of a DLL with headers
 
@@ -344,51 +468,14 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     }
 #endif
 
-    if (objectstorage_op != NULL) {
-        snprintf(op_hdr, STRSIZE, "EucaOperation: %s", objectstorage_op);
-        headers = curl_slist_append(headers, op_hdr);
-    }
-
-    t = time(&t);
-    gmtime_r(&t, &tmp_t);
-
-    //Format for time
-    if (strftime(date_str, 17, "%Y%m%dT%H%M%SZ", &tmp_t) == 0) {
-        close(fd);
-        pthread_mutex_unlock(&wreq_mutex);
-        return (EUCA_ERROR);
-    }
-
-    assert(strlen(date_str) + 7 <= STRSIZE);
-
-    // remove newline if found
-    if ((newline = strchr(date_str, '\n')) != NULL) {
-        *newline = '\0';
-    }
-
-    snprintf(date_hdr, STRSIZE, "Date: %s", date_str);
-    headers = curl_slist_append(headers, date_hdr);
-
-    if ((url_host = process_url(url, URL_HOSTNAME)) == NULL) {
-        LOGERROR("objectstorage URL has no host\n");
-        pthread_mutex_unlock(&wreq_mutex);
-        return code;
-    }
-
-    snprintf(host_hdr, STRSIZE, "Host: %s", url_host);
-    headers = curl_slist_append(headers, host_hdr);
-
     // create objectstorage-compliant sig
-    if ((auth_str = eucav2_sign_request(verb, url, headers)) == NULL) {
+    if ((headers = objectstorage_signed_headers(objectstorage_op, verb, url)) == NULL) {
         close(fd);
+        curl_easy_cleanup(curl);
         pthread_mutex_unlock(&wreq_mutex);
-        EUCA_FREE(url_host);
         return (EUCA_ERROR);
     }
 
-    assert(strlen(auth_str) + 16 <= BUFSIZE);
-    headers = curl_slist_append(headers, auth_str);
-
     // register headers
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     if (objectstorage_op) {
@@ -479,14 +566,449 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         remove(outfile);
     }
 
-    EUCA_FREE(auth_str);
-    EUCA_FREE(url_host);
     curl_slist_free_all(headers);
     curl_easy_cleanup(curl);
     pthread_mutex_unlock(&wreq_mutex);
     return (code);
 }
 
+//!
+//! allocates a part of an image download covering bytes start to end
+//!
+//! @param[in] dl the download the part belongs to
+//! @param[in] index the position of the part within the image
+//! @param[in] start offset of the first byte of the part
+//! @param[in] end offset of the last byte of the part, or -1 for the rest of the image
+//!
+//! @return a pointer to the new part or NULL on allocation failure
+//!
+static struct image_part *image_part_alloc(struct image_download *dl, int index, long long start, long long end)
+{
+    struct image_part *part = NULL;
+
+    if ((part = EUCA_ZALLOC(1, sizeof(struct image_part))) == NULL) {
+        LOGERROR("out of memory (failed to allocate image part)\n");
+        return (NULL);
+    }
+
+    part->dl = dl;
+    part->index = index;
+    part->start = start;
+    part->end = end;
+    part->timeout = FIRST_TIMEOUT;
+    return (part);
+}
+
+//!
+//! frees a part of an image download, aborting its request if one is in flight
+//!
+//! @param[in] part the part to free
+//! @param[in] multi the multi handle the request of the part was added to
+//!
+static void image_part_free(struct image_part *part, CURLM * multi)
+{
+    if (part == NULL)
+        return;
+
+    if (part->curl != NULL) {
+        curl_multi_remove_handle(multi, part->curl);
+        curl_easy_cleanup(part->curl);
+    }
+    if (part->headers != NULL)
+        curl_slist_free_all(part->headers);
+    EUCA_FREE(part->buf);
+    EUCA_FREE(part);
+}
+
+//!
+//! issues a signed ranged request for the bytes of a part not received yet
+//!
+//! @param[in] part the part to request
+//! @param[in] multi the multi handle to add the request to
+//! @param[in] connect_timeout the connection timeout, in seconds, or 0 for none
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the request could not be set up
+//!
+static int image_part_start(struct image_part *part, CURLM * multi, int connect_timeout)
+{
+    char range[STRSIZE] = "";
+    struct image_download *dl = part->dl;
+
+    // each part is signed separately, so that parts started late in a long download carry a fresh date
+    if ((part->headers = objectstorage_signed_headers(dl->objectstorage_op, "GET", dl->url)) == NULL) {
+        LOGERROR("failed to sign request for part %d of %s\n", part->index, dl->url);
+        return (EUCA_ERROR);
+    }
+
+    if ((part->curl = curl_easy_init()) == NULL) {
+        LOGERROR("could not initialize libcurl\n");
+        curl_slist_free_all(part->headers);
+        part->headers = NULL;
+        return (EUCA_ERROR);
+    }
+
+    if (part->end >= 0) {
+        snprintf(range, sizeof(range), "%lld-%lld", (part->start + part->received), part->end);
+    } else {
+        snprintf(range, sizeof(range), "%lld-", (part->start + part->received));
+    }
+
+    part->error_msg[0] = '\0';
+    curl_easy_setopt(part->curl, CURLOPT_PRIVATE, part);
+    curl_easy_setopt(part->curl, CURLOPT_ERRORBUFFER, part->error_msg);
+    curl_easy_setopt(part->curl, CURLOPT_URL, dl->url);
+    curl_easy_setopt(part->curl, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(part->curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(part->curl, CURLOPT_HTTPHEADER, part->headers);
+    curl_easy_setopt(part->curl, CURLOPT_HEADERFUNCTION, write_part_header);
+    curl_easy_setopt(part->curl, CURLOPT_HEADERDATA, part);
+    curl_easy_setopt(part->curl, CURLOPT_WRITEFUNCTION, write_part);
+    curl_easy_setopt(part->curl, CURLOPT_WRITEDATA, part);
+    curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+    curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+    curl_easy_setopt(part->curl, CURLOPT_FOLLOWLOCATION, 1);
+    if (connect_timeout > 0) {
+        curl_easy_setopt(part->curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+    }
+
+    if (curl_multi_add_handle(multi, part->curl) != CURLM_OK) {
+        LOGERROR("failed to add request for part %d of %s\n", part->index, dl->url);
+        curl_easy_cleanup(part->curl);
+        curl_slist_free_all(part->headers);
+        part->curl = NULL;
+        part->headers = NULL;
+        return (EUCA_ERROR);
+    }
+
+    LOGDEBUG("requesting bytes %s of %s\n", range, dl->url);
+    part->attempts++;
+    part->streaming = FALSE;
+    part->retry_at = 0;
+    dl->active++;
+    return (EUCA_OK);
+}
+
+//!
+//! handles the completion of the request of a part: marks the part done,
+//! schedules another attempt for the rest of the part, or fails the download
+//!
+//! @param[in] part the part whose request completed
+//! @param[in] multi the multi handle the request was added to
+//! @param[in] result the result of the transfer
+//!
+static void image_part_finish(struct image_part *part, CURLM * multi, CURLcode result)
+{
+    long httpcode = 0;
+    boolean retry = FALSE;
+    struct image_download *dl = part->dl;
+
+    curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    curl_multi_remove_handle(multi, part->curl);
+    curl_easy_cleanup(part->curl);
+    curl_slist_free_all(part->headers);
+    part->curl = NULL;
+    part->headers = NULL;
+    dl->active--;
+
+    if (dl->failed)
+        return;
+
+    if (result) {                      // curl error (connection or transfer failed)
+        LOGWARN("connection to objectstorage failed for part %d of %s: %s (%d)\n", part->index, dl->url, part->error_msg, result);
+        retry = TRUE;
+    } else if (part->streaming) {      // a range of the image, or the whole of it when the server does not do ranges
+        if (dl->total_size < 0) {
+            // only the first part is ever requested before the size is known
+            LOGDEBUG("server did not report the size of %s\n", dl->url);
+            dl->unsized = TRUE;
+            dl->failed = TRUE;
+        } else if ((part->end >= 0) && ((part->start + part->received) <= part->end)) {
+            LOGWARN("received %lld of %lld byte(s) of part %d of %s\n", part->received, (part->end - part->start + 1), part->index, dl->url);
+            retry = TRUE;
+        } else if ((part->end < 0) && ((part->start + part->received) != dl->total_size)) {
+            LOGWARN("received %lld of %lld byte(s) of %s\n", (part->start + part->received), dl->total_size, dl->url);
+            retry = TRUE;
+        } else {
+            part->done = TRUE;
+        }
+    } else {
+        switch (httpcode) {
+        case 408L:                    // timeout, retry
+            LOGWARN("server responded with HTTP code %ld (timeout) for part %d of %s\n", httpcode, part->index, dl->url);
+            retry = TRUE;
+            break;
+        default:                      // some kind of error
+            LOGERROR("server responded with HTTP code %ld for part %d of %s\n", httpcode, part->index, dl->url);
+            dl->failed = TRUE;
+            break;
+        }
+    }
+
+    if (retry) {
+        if (part->attempts >= total_attempts) {
+            LOGERROR("giving up on part %d of %s after %d attempt(s)\n", part->index, dl->url, part->attempts);
+            dl->failed = TRUE;
+        } else {
+            // the next attempt only asks for the bytes of the part that are still missing
+            LOGWARN("download attempt %d of %d will commence in %d sec for part %d of %s\n", (part->attempts + 1), total_attempts, part->timeout, part->index,
+                    dl->url);
+            part->retry_at = time(NULL) + part->timeout;
+            part->timeout <<= 1;
+            if (part->timeout > MAX_TIMEOUT)
+                part->timeout = MAX_TIMEOUT;
+        }
+    }
+}
+
+//!
+//! splits the rest of the image into parts, once the response to the ranged
+//! request of the first part reveals the size of the image
+//!
+//! @param[in] dl the download to split up
+//!
+static void image_download_split(struct image_download *dl)
+{
+    int nparts = 0;
+    long long start = 0;
+    long long end = 0;
+    struct image_part **parts = NULL;
+
+    dl->parts[0]->end = ((dl->total_size < part_size) ? dl->total_size : part_size) - 1;
+    if ((nparts = (int)((dl->total_size + part_size - 1) / part_size)) <= 1)
+        return;
+
+    if ((parts = EUCA_REALLOC(dl->parts, nparts, sizeof(struct image_part *))) == NULL) {
+        LOGERROR("out of memory (failed to allocate %d image parts)\n", nparts);
+        dl->failed = TRUE;
+        return;
+    }
+    dl->parts = parts;
+
+    for (int i = 1; i < nparts; i++) {
+        start = i * part_size;
+        end = (((start + part_size) < dl->total_size) ? (start + part_size) : dl->total_size) - 1;
+        if ((dl->parts[i] = image_part_alloc(dl, i, start, end)) == NULL) {
+            dl->failed = TRUE;
+            return;
+        }
+        dl->nparts = i + 1;
+    }
+    LOGDEBUG("downloading %lld byte(s) of %s in %d parts\n", dl->total_size, dl->url, dl->nparts);
+}
+
+//!
+//! moves the head of the download past the parts that are complete. When
+//! inflating, the bytes buffered for the new head part are fed to the
+//! inflate stream, after which the part streams into it directly.
+//!
+//! @param[in] dl the download to advance
+//!
+static void image_download_advance(struct image_download *dl)
+{
+#if defined(CAN_GZIP)
+    struct image_part *part = NULL;
+#endif /* CAN_GZIP */
+
+    while (!dl->failed && (dl->head < dl->nparts) && dl->parts[dl->head]->done) {
+        dl->head++;
+#if defined(CAN_GZIP)
+        if (dl->do_compress && (dl->head < dl->nparts)) {
+            part = dl->parts[dl->head];
+            if ((part->buf_len > 0) && (write_data_zlib(part->buf, 1, part->buf_len, &(dl->params)) != part->buf_len)) {
+                dl->failed = TRUE;
+            }
+            EUCA_FREE(part->buf);
+            part->buf_len = part->buf_size = 0;
+        }
+#endif /* CAN_GZIP */
+    }
+}
+
+//!
+//! downloads a decrypted image from objectstorage based on the manifest URL,
+//! fetching up to parallel_parts byte ranges of it at once, and saves it to
+//! outfile. Parts are written at their offsets as they arrive or, when the
+//! image is compressed, passed through a single inflate stream in order, with
+//! parts that arrive ahead of their turn held in memory. If the server does not
+//! honor ranges, the whole image streams through the first request.
+//!
+//! @param[in] objectstorage_op
+//! @param[in] requested_url
+//! @param[in] outfile
+//! @param[in] do_compress
+//! @param[in] connect_timeout
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_ERROR
+//!         and EUCA_UNSUPPORTED_ERROR, if the server did not report the size of the image.
+//!
+//! @see objectstorage_request_timeout()
+//!
+static int objectstorage_parallel_request(const char *objectstorage_op, const char *requested_url, const char *outfile, const int do_compress, int connect_timeout)
+{
+    int fd = -1;
+    int running = 0;
+    int queued = 0;
+    int code = EUCA_ERROR;
+    char url[BUFSIZE] = "";
+    char *priv = NULL;
+    long long received = 0;
+    time_t now = 0;
+    time_t last_update = 0;
+    CURL *curl = NULL;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+    CURLcode result = CURLE_OK;
+    struct image_part *part = NULL;
+    struct image_download dl = { 0 };
+
+    //! @todo as in objectstorage_request_timeout(), curl operations are serialized
+    //! across threads, but all requests of this download are driven from this thread
+    pthread_mutex_lock(&wreq_mutex);
+
+    euca_strncpy(url, requested_url, BUFSIZE);
+#if defined(CAN_GZIP)
+    if (do_compress)
+        snprintf(url, BUFSIZE, "%s%s", requested_url, "?IsCompressed=true");
+    dl.do_compress = do_compress;
+#endif
+
+    if (strncasecmp(url, "http://", 7) != 0 && strncasecmp(url, "https://", 8) != 0) {
+        LOGERROR("objectstorage URL must start with http(s)://...\n");
+        pthread_mutex_unlock(&wreq_mutex);
+        return (code);
+    }
+
+    if (strchr(url + 8, '/') == NULL) {
+        LOGERROR("objectstorage URL has no path\n");
+        pthread_mutex_unlock(&wreq_mutex);
+        return (code);
+    }
+
+    if (euca_init_cert()) {
+        LOGERROR("failed to initialize certificate for objectstorage request\n");
+        pthread_mutex_unlock(&wreq_mutex);
+        return (code);
+    }
+    // we do not truncate the file because its size was set at blobstore allocation and
+    // it should reflect the size of the stored blob for accounting to work
+    fd = open(outfile, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    if ((fd == -1) || (lseek(fd, 0, SEEK_SET) == -1)) {
+        LOGERROR("failed to open %s for writing result of objectstorage request\n", outfile);
+        pthread_mutex_unlock(&wreq_mutex);
+        if (fd >= 0)
+            close(fd);
+        return (code);
+    }
+
+    dl.objectstorage_op = objectstorage_op;
+    dl.url = url;
+    dl.params.fd = fd;
+    dl.total_size = -1;
+#if defined(CAN_GZIP)
+    if (dl.do_compress && (request_inflate_init(&(dl.params)) != EUCA_OK)) {
+        zerr(dl.params.ret, "objectstorage_parallel_request");
+        dl.failed = TRUE;
+    }
+#endif
+
+    // the size of the image is not known until the server answers the ranged
+    // request of the first part, which is when the rest of the parts are set up
+    if ((dl.parts = EUCA_ZALLOC(1, sizeof(struct image_part *))) != NULL) {
+        if ((dl.parts[0] = image_part_alloc(&dl, 0, 0, (part_size - 1))) != NULL)
+            dl.nparts = 1;
+    }
+    if ((dl.nparts == 0) || ((multi = curl_multi_init()) == NULL)) {
+        LOGERROR("failed to set up the download of %s\n", url);
+        dl.failed = TRUE;
+    }
+
+    LOGINFO("downloading %s, up to %d part(s) of %lld byte(s) at a time\n", url, parallel_parts, part_size);
+    LOGDEBUG("        to %s\n", outfile);
+    last_update = time(NULL);
+    while (!dl.failed && (dl.head < dl.nparts)) {
+        // keep parts in flight, but only near the head when they have to be held in memory
+        now = time(NULL);
+        for (int i = dl.head; !dl.failed && (i < dl.nparts) && (dl.active < parallel_parts); i++) {
+            if (dl.do_compress && (i >= (dl.head + parallel_parts)))
+                break;
+
+            part = dl.parts[i];
+            if (part->done || (part->curl != NULL) || (part->retry_at > now))
+                continue;
+
+            if (image_part_start(part, multi, connect_timeout) != EUCA_OK)
+                dl.failed = TRUE;
+        }
+
+        if (dl.failed)
+            break;
+
+        if (dl.active == 0) {
+            sleep(1);                  // every part that is left is backing off
+            continue;
+        }
+
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg == CURLMSG_DONE) {
+                // the message does not survive the removal of its handle
+                curl = msg->easy_handle;
+                result = msg->data.result;
+                curl_easy_getinfo(curl, CURLINFO_PRIVATE, &priv);
+                image_part_finish((struct image_part *)priv, multi, result);
+            }
+        }
+        image_download_advance(&dl);
+
+        if ((dl.total_size > 0) && ((last_update + PROGRESS_UPDATE_SEC) <= now)) {
+            received = 0;
+            for (int i = 0; i < dl.nparts; i++)
+                received += dl.parts[i]->received;
+            LOGINFO("downloaded %.1f%% of %s (%d part(s) in flight)\n", ((double)received / (double)dl.total_size) * 100.0, url, dl.active);
+            last_update = now;
+        }
+
+        if ((dl.active > 0) && (dl.head < dl.nparts)) {
+            curl_multi_wait(multi, NULL, 0, 1000, NULL);
+        }
+    }
+
+    if (!dl.failed) {
+#if defined(CAN_GZIP)
+        if (dl.do_compress && (dl.params.ret != Z_STREAM_END)) {
+            zerr(dl.params.ret, "objectstorage_parallel_request");
+        }
+#endif
+        LOGINFO("downloaded %s\n", outfile);
+        code = EUCA_OK;
+    } else if (dl.unsized) {
+        code = EUCA_UNSUPPORTED_ERROR;
+    }
+    LOGDEBUG("wrote %lld byte(s) in %lld write(s)\n", dl.params.total_wrote, dl.params.total_calls);
+
+    for (int i = 0; i < dl.nparts; i++)
+        image_part_free(dl.parts[i], multi);
+    EUCA_FREE(dl.parts);
+    if (multi != NULL)
+        curl_multi_cleanup(multi);
+#if defined(CAN_GZIP)
+    if (dl.do_compress)
+        inflateEnd(&(dl.params.strm));
+#endif
+    close(fd);
+
+    // the file is left for the serial download to overwrite when the size of the image is unknown
+    if ((code != EUCA_OK) && (code != EUCA_UNSUPPORTED_ERROR)) {
+        LOGINFO("due to error, removing %s\n", outfile);
+        remove(outfile);
+    }
+
+    pthread_mutex_unlock(&wreq_mutex);
+    return (code);
+}
+
 //!
 //! Sets the maximum number of connection attempts that the library will make
 //! to objectstorage. The default is MAX_ATTEMPTS value defined above. The attempts
@@ -505,6 +1027,28 @@ int objectstorage_set_max_download_attempts(unsigned short new_max_attempts)
     return old_max_attempts;
 }
 
+//!
+//! Sets how many byte ranges of an image objectstorage_image_by_manifest_url()
+//! downloads at once, each over its own connection, and how big those ranges
+//! are. Each range is retried on its own, within the limit on attempts.
+//!
+//! @param[in] new_parallel_parts the number of parts to keep in flight, 1 to download images over a single connection, 0 to keep the current value
+//! @param[in] new_part_size_mb the size of a part, in MB, or 0 to keep the current value
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if either value is out of range, in which case neither is set
+//!
+int objectstorage_set_parallel_download(int new_parallel_parts, int new_part_size_mb)
+{
+    if ((new_parallel_parts < 0) || (new_parallel_parts > MAX_PARALLEL_PARTS) || (new_part_size_mb < 0) || (new_part_size_mb > MAX_PART_SIZE_MB))
+        return (EUCA_INVALID_ERROR);
+
+    if (new_parallel_parts > 0)
+        parallel_parts = new_parallel_parts;
+    if (new_part_size_mb > 0)
+        part_size = new_part_size_mb * 1024LL * 1024LL;
+    return (EUCA_OK);
+}
+
 //!
 //! downloads a objectstorage object from the URL, saves it to outfile
 //!
@@ -543,18 +1087,29 @@ int objectstorage_object_by_path(const char *path, const char *outfile, const in
 
 //!
 //! downloads a decrypted image from objectstorage based on the manifest URL,
-//! saves it to outfile
+//! saves it to outfile. Unless parallel downloads are turned off, the image
+//! is fetched as several byte ranges at once.
 //!
 //! @param[in] url
 //! @param[in] outfile
 //! @param[in] do_compress
 //!
-//! @return the result of the objectstorage_request_timeout() call.
+//! @return the result of the objectstorage_parallel_request() or objectstorage_request_timeout() call.
 //!
+//! @see objectstorage_parallel_request()
 //! @see objectstorage_request_timeout()
+//! @see objectstorage_set_parallel_download()
 //!
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress)
 {
+    int rc = EUCA_ERROR;
+
+    if (parallel_parts > 1) {
+        // without the size of the image the parts cannot be laid out, nor a truncated image told from a complete one
+        if ((rc = objectstorage_parallel_request(GET_IMAGE_CMD, url, outfile, do_compress, CONNECT_TIMEOUT_SEC)) != EUCA_UNSUPPORTED_ERROR)
+            return (rc);
+        LOGWARN("size of %s is unknown, downloading it serially\n", url);
+    }
     return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC);
 }
 
@@ -691,6 +1246,183 @@ static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params)
     return wrote;
 }
 
+//!
+//! libcurl header handler for image parts. Once the headers of a response are
+//! in, it decides whether the body carries the part: any response with a
+//! Content-Range is taken as the range it names, with or without the "bytes"
+//! unit, and a 200 without one as the whole image. The size of the image is
+//! learnt from the response to the first part, at which point the rest of the
+//! image is split into parts.
+//!
+//! @param[in] buffer
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params
+//!
+//! @return the number of bytes handled in the header, or 0 to abort the request
+//!
+static size_t write_part_header(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    assert(params != NULL);
+    struct image_part *part = (struct image_part *)params;
+    struct image_download *dl = part->dl;
+    size_t len = size * nmemb;
+    long httpcode = 0;
+    long long first = 0;
+    long long last = 0;
+    long long total = 0;
+    char *p = NULL;
+    char line[STRSIZE] = "";
+
+    if (len >= STRSIZE)
+        return (len);
+    memcpy(line, buffer, len);
+
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        // status line of a new response, possibly one following a redirect
+        part->ranged = FALSE;
+        part->range_first = 0;
+        part->range_total = -1;
+        part->content_length = -1;
+        part->streaming = FALSE;
+        return (len);
+    }
+
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        if (sscanf(line + 15, " %lld", &total) == 1)
+            part->content_length = total;
+        return (len);
+    }
+
+    if (strncasecmp(line, "Content-Range:", 14) == 0) {
+        p = line + 14;
+        while ((*p == ' ') || (*p == '\t'))
+            p++;
+        if (strncasecmp(p, "bytes", 5) == 0)
+            p += 5;
+        if (sscanf(p, " %lld-%lld/", &first, &last) == 2) {
+            part->ranged = TRUE;
+            part->range_first = first;
+            // a total of '*' or one that cannot be parsed leaves the size of the image unknown
+            if (((p = strchr(p, '/')) != NULL) && (sscanf(p + 1, "%lld", &total) == 1) && (total > 0))
+                part->range_total = total;
+        }
+        return (len);
+    }
+
+    if ((line[0] != '\r') && (line[0] != '\n'))
+        return (len);
+
+    // end of the headers of a response
+    curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &httpcode);
+    if ((httpcode < 200L) || (httpcode >= 300L))
+        return (len);                  // a redirect or an error, whose body is not the part
+
+    if (part->ranged) {
+        if (part->range_first != (part->start + part->received)) {
+            LOGERROR("server sent bytes from %lld instead of %lld for part %d of %s\n", part->range_first, (part->start + part->received), part->index, dl->url);
+            dl->failed = TRUE;
+            return (0);
+        }
+        if ((part->index == 0) && (dl->total_size < 0) && (part->range_total > 0)) {
+            dl->total_size = part->range_total;
+            if (part->end >= 0)
+                image_download_split(dl);
+        }
+    } else if (httpcode == 200L) {
+        // the server ignored the range and is sending the whole image
+        if ((part->index > 0) || (dl->nparts > 1)) {
+            LOGERROR("server ignored the range requested for part %d of %s\n", part->index, dl->url);
+            dl->failed = TRUE;
+            return (0);
+        }
+
+        part->end = -1;
+        if (part->received > 0) {
+            LOGWARN("server cannot resume %s, downloading it from the start\n", dl->url);
+            part->received = 0;
+            dl->params.total_wrote = 0;
+#if defined(CAN_GZIP)
+            if (dl->do_compress) {
+                inflateEnd(&(dl->params.strm));
+                if ((request_inflate_init(&(dl->params)) != EUCA_OK) || (lseek(dl->params.fd, 0L, SEEK_SET) == -1)) {
+                    dl->failed = TRUE;
+                    return (0);
+                }
+            }
+#endif /* CAN_GZIP */
+        }
+        // without a Content-Length there is no telling a complete image from a truncated one
+        dl->total_size = part->content_length;
+    } else {
+        return (len);                  // not something the part can be taken from
+    }
+    part->streaming = TRUE;
+    return (len);
+}
+
+//!
+//! libcurl write handler for image parts. Bytes are written at their offset
+//! in the image or, when inflating, passed to the inflate stream if the part
+//! is at the head of the download and buffered otherwise.
+//!
+//! @param[in] buffer
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params
+//!
+//! @return the number of bytes handled. If the returned value does not match
+//!         size*nmemb, then libcurl will return an error.
+//!
+static size_t write_part(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    assert(params != NULL);
+    struct image_part *part = (struct image_part *)params;
+    struct image_download *dl = part->dl;
+    size_t len = size * nmemb;
+
+    if (dl->failed)
+        return (0);
+
+    if (!part->streaming)
+        return (len);                  // body of a response that does not carry the part, which is handled once the request completes
+
+#if defined(CAN_GZIP)
+    if (dl->do_compress) {
+        if (part->index == dl->head) {
+            if (write_data_zlib(buffer, size, nmemb, &(dl->params)) != len) {
+                dl->failed = TRUE;
+                return (0);
+            }
+        } else {
+            if ((part->buf == NULL) && ((part->buf = EUCA_ALLOC((part->end - part->start + 1), sizeof(unsigned char))) != NULL)) {
+                part->buf_size = part->end - part->start + 1;
+            }
+            if ((part->buf == NULL) || ((part->buf_len + len) > part->buf_size)) {
+                LOGERROR("failed to buffer part %d of %s\n", part->index, dl->url);
+                dl->failed = TRUE;
+                return (0);
+            }
+            memcpy(part->buf + part->buf_len, buffer, len);
+            part->buf_len += len;
+        }
+        part->received += len;
+        return (len);
+    }
+#endif /* CAN_GZIP */
+
+    // any blocking in this call is not subject to connection timeouts
+    if (pwrite(dl->params.fd, buffer, len, (part->start + part->received)) != (ssize_t) len) {
+        LOGERROR("failed to write part %d of %s\n", part->index, dl->url);
+        dl->failed = TRUE;
+        return (0);
+    }
+    dl->params.total_wrote += len;
+    dl->params.total_calls++;
+    part->received += len;
+    return (len);
+}
+
 #if defined(CAN_GZIP)
 //!
 //! unused testing function
@@ -712,6 +1444,25 @@ static void print_data(unsigned char *buf, const int size)
     printf("\n");
 }
 
+//!
+//! allocates the zlib inflate state of a request, for gzip streams
+//!
+//! @param[in] params the request whose stream to initialize
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if zlib failed, with its code in params->ret
+//!
+static int request_inflate_init(struct request *params)
+{
+    params->strm.zalloc = Z_NULL;
+    params->strm.zfree = Z_NULL;
+    params->strm.opaque = Z_NULL;
+    params->strm.avail_in = 0;
+    params->strm.next_in = Z_NULL;
+    if ((params->ret = inflateInit2(&(params->strm), 31)) != Z_OK)
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
 //!
 //! report on a zlib error
 //!
@@ -808,3 +1559,235 @@ static int progress_function(void *clientp, double dltotal, double dlnow, double
     }
     return 0;
 }
+
+#ifdef _UNIT_TEST
+#define TEST_OBJECT_SIZE                (3 * 1024 * 1024 + 17)  //!< size of the image served by the stand-in server
+#define TEST_PART_SIZE_MB                          1    //!< size of the parts the image is downloaded in
+#define TEST_DROP_PERCENT                         40    //!< how much of a response the stand-in server sends before cutting it short
+
+//! Describes how the stand-in objectstorage server behaves during one download test
+typedef struct test_scenario_t {
+    const char *name;                  //!< name of the test
+    boolean ranges;                    //!< TRUE if the server honors Range
+    boolean range_unit;                //!< TRUE if the Content-Range starts with the "bytes" unit
+    int range_code;                    //!< HTTP code of a response to a ranged request
+    boolean range_total;               //!< TRUE if the Content-Range gives the size of the image, '*' otherwise
+    boolean content_length;            //!< TRUE if the server sends Content-Length
+    int drops;                         //!< number of connections cut short before the rest succeed
+    int expect_requests;               //!< number of requests the download is expected to take
+} test_scenario;
+
+static test_scenario test_scenarios[] = {
+    {"Content-Range with unit in a 206", TRUE, TRUE, 206, TRUE, TRUE, 0, 4},
+    {"Content-Range without unit in a 200", TRUE, FALSE, 200, TRUE, TRUE, 0, 4},
+    {"Content-Range of unknown size", TRUE, TRUE, 206, FALSE, TRUE, 0, 2},
+    {"whole image", FALSE, FALSE, 200, FALSE, TRUE, 0, 1},
+    {"truncated whole image", FALSE, FALSE, 200, FALSE, TRUE, 1, 2},
+    {"whole image without Content-Length", FALSE, FALSE, 200, FALSE, FALSE, 0, 2},
+    {NULL},
+};
+
+//!
+//! fills in the content of the test image
+//!
+//! @param[out] buf the buffer of TEST_OBJECT_SIZE bytes to fill
+//!
+static void test_object(unsigned char *buf)
+{
+    for (long long i = 0; i < TEST_OBJECT_SIZE; i++)
+        buf[i] = (unsigned char)((i * 31) + (i >> 12));
+}
+
+//!
+//! serves the test image over connections accepted on sock, one request per
+//! connection, behaving as the scenario says. The number of requests served
+//! is reported on report_fd. Never returns.
+//!
+//! @param[in] sock the listening socket
+//! @param[in] ts the scenario
+//! @param[in] report_fd the pipe to report on
+//!
+static void test_server(int sock, const test_scenario * ts, int report_fd)
+{
+    int fd = -1;
+    int got = 0;
+    char *p = NULL;
+    char req[4096] = "";
+    char hdr[1024] = "";
+    char total[32] = "";
+    unsigned char *object = NULL;
+    long long first = 0;
+    long long last = 0;
+    long long len = 0;
+    long long sent = 0;
+    boolean partial = FALSE;
+
+    signal(SIGPIPE, SIG_IGN);
+    object = EUCA_ALLOC(TEST_OBJECT_SIZE, 1);
+    test_object(object);
+
+    for (int conn = 1;; conn++) {
+        if ((fd = accept(sock, NULL, NULL)) < 0)
+            continue;
+
+        for (got = 0, req[0] = '\0'; (got < (sizeof(req) - 1)) && !strstr(req, "\r\n\r\n"); req[got] = '\0') {
+            int n = read(fd, req + got, sizeof(req) - 1 - got);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+        // counted before answering, so the client cannot finish ahead of the count
+        if (write(report_fd, &conn, sizeof(conn)) != sizeof(conn))
+            exit(1);
+
+        first = 0;
+        last = TEST_OBJECT_SIZE - 1;
+        partial = FALSE;
+        if (ts->ranges && ((p = strcasestr(req, "\r\nRange: bytes=")) != NULL) && (sscanf(p + 15, "%lld-", &first) == 1)) {
+            partial = TRUE;
+            if ((sscanf(p + 15, "%*d-%lld", &last) != 1) || (last >= TEST_OBJECT_SIZE))
+                last = TEST_OBJECT_SIZE - 1;
+        }
+
+        len = last - first + 1;
+        if (partial) {
+            snprintf(total, sizeof(total), (ts->range_total ? "%d" : "*"), TEST_OBJECT_SIZE);
+            snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Range: %s%lld-%lld/%s\r\n", ts->range_code, ((ts->range_code == 206) ? "Partial Content" : "OK"),
+                     (ts->range_unit ? "bytes " : ""), first, last, total);
+        } else {
+            snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\n");
+        }
+        if (ts->content_length)
+            snprintf(hdr + strlen(hdr), sizeof(hdr) - strlen(hdr), "Content-Length: %lld\r\n", len);
+        snprintf(hdr + strlen(hdr), sizeof(hdr) - strlen(hdr), "Connection: close\r\n\r\n");
+
+        if (conn <= ts->drops)
+            len = (len * TEST_DROP_PERCENT) / 100;
+        sent = 0;
+        if (write(fd, hdr, strlen(hdr)) == strlen(hdr)) {
+            while (sent < len) {
+                int n = write(fd, object + first + sent, MIN((len - sent), 65536));
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+        }
+        close(fd);
+    }
+}
+
+//!
+//! downloads the test image from a stand-in server behaving as the scenario
+//! says, and checks the outcome
+//!
+//! @param[in] ts the scenario
+//!
+//! @return the number of errors found
+//!
+static int test_download(const test_scenario * ts)
+{
+    int rc = 0;
+    int sock = -1;
+    int conn = 0;
+    int errors = 0;
+    int requests = 0;
+    int report[2] = { -1, -1 };
+    char url[STRSIZE] = "";
+    char path[] = "/tmp/euca-objectstorage-test-XXXXXX";
+    char *saved = NULL;
+    unsigned char *expected = NULL;
+    pid_t pid = -1;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_in addr = { 0 };
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) || bind(sock, (struct sockaddr *)&addr, addr_len) || listen(sock, 8)
+        || getsockname(sock, (struct sockaddr *)&addr, &addr_len) || pipe(report)) {
+        printf("FAIL %s: could not set up the stand-in server\n", ts->name);
+        return (1);
+    }
+
+    if ((pid = fork()) == 0) {
+        close(report[0]);
+        test_server(sock, ts, report[1]);
+        exit(0);
+    }
+    close(sock);
+    close(report[1]);
+
+    close(safe_mkstemp(path));
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s/image.manifest.xml", ntohs(addr.sin_port), OBJECT_STORAGE_ENDPOINT);
+    rc = objectstorage_image_by_manifest_url(url, path, FALSE);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    while (read(report[0], &conn, sizeof(conn)) == sizeof(conn))
+        requests++;
+    close(report[0]);
+
+    if (rc != EUCA_OK) {
+        printf("FAIL %s: download returned %d\n", ts->name, rc);
+        errors++;
+    } else {
+        expected = EUCA_ALLOC(TEST_OBJECT_SIZE, 1);
+        test_object(expected);
+        if (((saved = file2strn(path, (TEST_OBJECT_SIZE + 1))) == NULL) || memcmp(saved, expected, TEST_OBJECT_SIZE)) {
+            printf("FAIL %s: saved file differs from the image\n", ts->name);
+            errors++;
+        }
+        EUCA_FREE(saved);
+        EUCA_FREE(expected);
+    }
+    if (requests != ts->expect_requests) {
+        printf("FAIL %s: download took %d request(s) instead of %d\n", ts->name, requests, ts->expect_requests);
+        errors++;
+    }
+    unlink(path);
+
+    printf("%s %s: %d request(s)\n", (errors ? "FAIL" : "PASS"), ts->name, requests);
+    return (errors);
+}
+
+//!
+//! Main entry point of the application. Requests are signed with a throwaway
+//! node key and certificate made with the openssl tool under a temporary
+//! $EUCALYPTUS directory.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+int main(int argc, char **argv)
+{
+    int errors = 0;
+    char home[] = "/tmp/euca-objectstorage-home-XXXXXX";
+    char keys[STRSIZE] = "";
+    char cmd[BUFSIZE] = "";
+
+    if (mkdtemp(home) == NULL) {
+        printf("failed to create a temporary $EUCALYPTUS\n");
+        return (1);
+    }
+    snprintf(keys, sizeof(keys), EUCALYPTUS_KEYS_DIR, home);
+    snprintf(cmd, sizeof(cmd), "mkdir -p %s && openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=test -days 1 -keyout %s/node-pk.pem -out %s/node-cert.pem "
+             ">/dev/null 2>&1 && cp %s/node-cert.pem %s/cloud-cert.pem", keys, keys, keys, keys, keys);
+    if (system(cmd)) {
+        printf("failed to create a node key and certificate in %s\n", keys);
+        return (1);
+    }
+    setenv("EUCALYPTUS", home, 1);
+    objectstorage_set_parallel_download(PARALLEL_PARTS, TEST_PART_SIZE_MB);
+    objectstorage_set_max_download_attempts(3);
+
+    for (int i = 0; test_scenarios[i].name != NULL; i++)
+        errors += test_download(&test_scenarios[i]);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", home);
+    if (system(cmd))
+        printf("failed to remove %s\n", home);
+    printf("done testing objectstorage.c (errors=%d)\n", errors);
+    return (errors);
+}
+#endif /* _UNIT_TEST */
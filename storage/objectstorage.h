@@ -114,6 +114,7 @@
 \*----------------------------------------------------------------------------*/
 
 int objectstorage_set_max_download_attempts(unsigned short max_attempts);
+int objectstorage_set_parallel_download(int parallel_parts, int part_size_mb);
 int objectstorage_object_by_url(const char *url, const char *outfile, const int do_compress);
 int objectstorage_object_by_path(const char *path, const char *outfile, const int do_compress);
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress);
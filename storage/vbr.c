@@ -89,6 +89,8 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>                      // clock_gettime
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -115,11 +117,20 @@
 
 #define FIND_BLOB_TIMEOUT_USEC                   50000LL    //!< @TODO: use 100 or less to induce rare timeouts
 #define DELETE_BLOB_TIMEOUT_USEC                 50000LL
+#define DEDUP_BLOB_TIMEOUT_USEC                  30000000LL //!< contention bound for the chunk index of the cache
 
 #define FIND                                     0
 #define CREATE                                   1
 
 #define ARTIFACT_RETRY_SLEEP_USEC                500000LL
+#define ARTIFACT_MAX_WORKERS                     8  //!< worker threads implementing dependency subtrees, across all launches
+#define ARTIFACT_HELD_TIMEOUT_USEC               30000000LL //!< contention bound for a dependency built alongside held siblings
+#define ARTIFACT_PROGRESS_USEC                   10000000LL //!< how often a launch waiting for a download reports its progress
+
+#define PARTITION_POOL_KINDS                     16 //!< kinds of blank partitions whose recent demand is remembered
+#define PARTITION_POOL_WINDOW_USEC               (24LL * 60 * 60 * 1000000) //!< launches longer ago than this no longer count as demand
+#define PARTITION_POOL_MIN_LAUNCHES              2  //!< launches within the window that make a kind worth keeping formatted
+#define PARTITION_POOL_PREFIX                    "pool" //!< instance ID for the logs, and work prefix, of partitions made ahead of launches
 
 #ifdef _UNIT_TEST
 #define BS_SIZE                                  20000000000 / 512
@@ -132,6 +143,10 @@
 #define SERIAL_ITERATIONS                        3
 #define COMPETITIVE_PARTICIPANTS                 3
 #define COMPETITIVE_ITERATIONS                   3
+#define PARALLEL_DEPS                            4
+#define PARALLEL_CREATOR_USEC                    200000LL
+#define SINGLE_FLIGHT_LAUNCHES                   5
+#define SINGLE_FLIGHT_ID                         "sf-1EFG567-0000abcd"
 
 #define TOTAL_VMS                                1 + SERIAL_ITERATIONS + COMPETITIVE_ITERATIONS * COMPETITIVE_PARTICIPANTS
 #define VBR_SIZE                                 ( 2LL * MEGABYTE )
@@ -156,6 +171,46 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A shared blob that a thread of this process is building, so that others that need it wait for it
+typedef struct _art_claim {
+    char id[EUCA_MAX_PATH];            //!< ID of the blob in the cache, derived from the signature of its content
+    const artifact *owner;             //!< artifact that builds the blob and holds it open, NULL once done
+    char instanceId[32];               //!< launch of the owner, for logging
+    boolean failed;                    //!< set if the owner is done without building the blob
+    boolean is_download;               //!< set if the owner downloads the content of the blob
+    boolean is_downloading;            //!< set while the owner downloads it
+    char path[EUCA_MAX_PATH];          //!< file the content is downloaded into
+    long long size_bytes;              //!< size of the download
+    long long started_usec;            //!< time_usec() when the download began
+    int waiters;                       //!< number of threads waiting for the owner to be done
+    pthread_cond_t done;               //!< signalled when the owner is done
+    struct _art_claim *next;           //!< next claim in the list
+} art_claim;
+
+//! A dependency subtree to implement, possibly on a worker thread
+typedef struct _art_job {
+    artifact *a;                       //!< root of the subtree
+    blobstore *work_bs;                //!< work blobstore
+    blobstore *cache_bs;               //!< OPTIONAL cache blobstore
+    const char *work_prefix;           //!< OPTIONAL instance-specific prefix for forming work blob IDs
+    long long timeout_usec;            //!< timeout for the subtree, in microseconds or 0 for no timeout
+    boolean do_release;                //!< close the blob once it is implemented, as only its existence matters
+    boolean on_thread;                 //!< set if the job runs on a worker thread
+    pthread_t thread;                  //!< the worker thread, if any
+    int ret;                           //!< RESULT: what art_implement_subtree() returned
+} art_job;
+
+//! Recent demand for one kind of blank (ephemeral or swap) partition
+typedef struct _art_partition_kind {
+    long long size_bytes;              //!< size of the partition, 0 if the slot is free
+    ncResourceType type;               //!< NC_RESOURCE_EPHEMERAL or NC_RESOURCE_SWAP
+    ncResourceFormatType format;       //!< file system to make on it
+    char formatName[SMALL_CHAR_BUFFER_SIZE];    //!< name of the format, which is part of the signature
+    char typeName[SMALL_CHAR_BUFFER_SIZE];  //!< name of the type
+    int launches;                      //!< launches that asked for it since the window last lapsed
+    long long last_usec;               //!< time_usec() of the last of them
+} art_partition_kind;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -187,6 +242,13 @@ const char *euca_client_component_name = "nc";  //!< The client component name
 static __thread char current_instanceId[512] = "";  //!< instance ID that is being serviced, for logging only
 static sem *hostconfig_sem;
 
+static pthread_mutex_t art_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards the claims and the worker count
+static art_claim *art_claims = NULL;   //!< shared blobs being built by threads of this process
+static int art_workers = 0;            //!< worker threads busy implementing subtrees
+static art_download_stats art_dl_stats = { 0 };    //!< counters of the downloads into the cache
+static boolean cache_dedup = FALSE;    //!< store downloaded disk images in the cache as shared chunks
+static art_partition_kind art_partitions[PARTITION_POOL_KINDS] = { {0} };  //!< demand for blank partitions, guarded by art_mutex
+
 #ifdef _UNIT_TEST
 static blobstore *cache_bs = NULL;
 static blobstore *work_bs = NULL;
@@ -198,6 +260,8 @@ static virtualMachine vm_slots[TOTAL_VMS] = { {0} };
 static char vm_ids[TOTAL_VMS][PATH_MAX] = { {0} };
 
 static boolean do_fork = 0;
+static int single_flight_calls = 0;
+static boolean single_flight_fail_first = FALSE;
 #endif /* _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
@@ -242,6 +306,23 @@ static artifact *art_alloc_disk(virtualBootRecord * vbr, artifact * prereqs[], i
                                 artifact * emi_disk, boolean do_make_work_copy, boolean is_migration_dest);
 static int find_or_create_blob(int flags, blobstore * bs, const char *id, long long size_bytes, const char *sig, blockblob ** bbp);
 static int find_or_create_artifact(int do_create, artifact * a, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, blockblob ** bbp);
+static boolean art_is_shared(const artifact * a, blobstore * cache_bs);
+static boolean art_is_download(const artifact * a);
+static void art_abstime(long long usec, struct timespec *ts);
+static long long art_download_progress(const art_claim * c);
+static art_claim *art_find_claim(const artifact * a);
+static boolean art_claim_blob(const artifact * a, blobstore * cache_bs);
+static void art_unclaim_blob(const artifact * a, boolean failed);
+static boolean art_wait_blob(const artifact * a, long long deadline_usec);
+static void art_download_begin(const artifact * a);
+static void art_download_end(const artifact * a, int ret);
+static boolean art_take_worker(void);
+static void art_put_worker(void);
+static void art_run_job(art_job * job);
+static void *art_job_thread(void *arg);
+static void art_run_jobs(art_job * jobs, int num_jobs);
+static int art_implement_subtree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec);
+static void art_note_partition(const virtualBootRecord * vbr);
 
 #ifdef _UNIT_TEST
 static blobstore *create_teststore(int size_blocks, const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation,
@@ -255,6 +336,11 @@ static char *gen_id(char *id, unsigned int id_len, const char *prefix);
 static void *competitor_function(void *ptr);
 static int check_blob(blobstore * bs, const char *keyword, int expect);
 static void dummy_err_fn(const char *msg);
+static int slow_creator(artifact * a);
+static int do_parallel_tree_test(void);
+static int counting_creator(artifact * a);
+static void *single_flight_function(void *ptr);
+static int do_single_flight_test(void);
 #endif /* _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
@@ -2387,6 +2473,16 @@ void art_set_instanceId(const char *instanceId)
     euca_strncpy(current_instanceId, instanceId, sizeof(current_instanceId));
 }
 
+//!
+//! Turns the deduplication of downloaded disk images in the cache on or off
+//!
+//! @param[in] enable TRUE to deduplicate the images downloaded from now on
+//!
+void art_set_cache_dedup(boolean enable)
+{
+    cache_dedup = enable;
+}
+
 //!
 //! Creates a tree of artifacts for a given VBR (caller must free the tree)
 //!
@@ -2466,6 +2562,8 @@ artifact *vbr_alloc_tree(virtualMachine * vm, boolean do_make_work_copy, boolean
                         arts_free(disk_arts, EUCA_MAX_PARTITIONS);
                         goto free;
                     }
+                    if ((vbr->locationType == NC_LOCATION_NONE) && !strcmp(vbr->id, "none") && !is_migration_dest)
+                        art_note_partition(vbr);
                     if (vbr->type == NC_RESOURCE_EBS)   // EBS-backed instances need no additional artifacts
                         continue;
                     if (k > 0) {
@@ -2654,6 +2752,500 @@ try_work:
     return find_or_create_blob(flags, work_bs, id_work, size_bytes, a->sig, bbp);
 }
 
+//!
+//! Tells whether the blob of an artifact may be shared by several launches, in which
+//! case only one thread of this process builds it while the others wait for it
+//!
+//! @param[in] a pointer to the artifact
+//! @param[in] cache_bs pointer to OPTIONAL cache blobstore
+//!
+//! @return TRUE if the blob would be built in the cache
+//!
+static boolean art_is_shared(const artifact * a, blobstore * cache_bs)
+{
+    return (cache_bs != NULL && a->creator != NULL && a->may_be_cached && !a->id_is_path);
+}
+
+//!
+//! Tells whether the creator of an artifact fetches its content over the network
+//!
+//! @param[in] a pointer to the artifact
+//!
+//! @return TRUE for an image download
+//!
+static boolean art_is_download(const artifact * a)
+{
+    return ((a->creator == url_creator || a->creator == objectstorage_creator || a->creator == imaging_creator) && !a->do_not_download);
+}
+
+//!
+//! Converts a delay from now into a deadline for pthread_cond_timedwait()
+//!
+//! @param[in]  usec delay, in microseconds
+//! @param[out] ts RESULT: the deadline, on the wall clock
+//!
+static void art_abstime(long long usec, struct timespec *ts)
+{
+    long long nsec = 0;
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    nsec = ts->tv_nsec + (usec % 1000000LL) * 1000LL;
+    ts->tv_sec += (usec / 1000000LL) + (nsec / 1000000000LL);
+    ts->tv_nsec = nsec % 1000000000LL;
+}
+
+//!
+//! Estimates how much of a download has arrived from the space the blob file takes up,
+//! since the file is created at its full size and filled in as the bytes arrive
+//!
+//! @param[in] c pointer to the claim of the blob being downloaded
+//!
+//! @return the number of bytes downloaded so far
+//!
+static long long art_download_progress(const art_claim * c)
+{
+    struct stat st = { 0 };
+
+    if (stat(c->path, &st) == -1)
+        return (0);
+    return (MIN(((long long)st.st_blocks * 512LL), c->size_bytes));
+}
+
+//!
+//! Finds the claim on the blob that an artifact needs. Must be called with art_mutex held.
+//!
+//! @param[in] a pointer to the artifact
+//!
+//! @return pointer to the claim or NULL if nobody is building the blob
+//!
+static art_claim *art_find_claim(const artifact * a)
+{
+    for (art_claim * c = art_claims; c; c = c->next) {
+        if (!strcmp(c->id, a->id))
+            return (c);
+    }
+    return (NULL);
+}
+
+//!
+//! Claims the building of a shared blob for an artifact, unless another artifact,
+//! from this or another launch, is already building it
+//!
+//! @param[in] a pointer to the artifact about to be built
+//! @param[in] cache_bs pointer to OPTIONAL cache blobstore
+//!
+//! @return TRUE if the caller should build the blob, FALSE if it should wait for it with art_wait_blob()
+//!
+static boolean art_claim_blob(const artifact * a, blobstore * cache_bs)
+{
+    boolean claimed = TRUE;
+    art_claim *c = NULL;
+
+    if (!art_is_shared(a, cache_bs))
+        return (TRUE);
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        if ((c = art_find_claim(a)) != NULL) {
+            claimed = (c->owner == a);
+        } else if ((c = EUCA_ZALLOC(1, sizeof(art_claim))) != NULL) {
+            // without memory for a claim the blob is built the old way, relying on the blob locks alone
+            euca_strncpy(c->id, a->id, sizeof(c->id));
+            euca_strncpy(c->instanceId, a->instanceId, sizeof(c->instanceId));
+            c->owner = a;
+            pthread_cond_init(&(c->done), NULL);
+            c->next = art_claims;
+            art_claims = c;
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+    return (claimed);
+}
+
+//!
+//! Drops the claim of an artifact, if it holds one, and wakes up the threads waiting for its
+//! blob. Called once the blob is closed, or was not built after all, in which case the first
+//! waiter to claim it again takes over.
+//!
+//! @param[in] a pointer to the artifact
+//! @param[in] failed set if the blob was not built
+//!
+static void art_unclaim_blob(const artifact * a, boolean failed)
+{
+    art_claim **next_ptr = NULL;
+    art_claim *c = NULL;
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        for (next_ptr = &art_claims; (c = *next_ptr) != NULL; next_ptr = &(c->next)) {
+            if (c->owner == a) {
+                *next_ptr = c->next;
+                c->owner = NULL;
+                c->failed = failed;
+                if (c->waiters > 0) {  // the last waiter out frees it
+                    if (failed && c->is_download) {
+                        LOGINFO("[%s] download of %s failed, handing it over to one of %d waiting launch(es)\n", a->instanceId, a->id, c->waiters);
+                        art_dl_stats.handoffs++;
+                    }
+                    pthread_cond_broadcast(&(c->done));
+                } else {
+                    pthread_cond_destroy(&(c->done));
+                    EUCA_FREE(c);
+                }
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Waits for another artifact to be done with the shared blob that an artifact needs,
+//! reporting the progress of the download, if that is what the other one is doing
+//!
+//! @param[in] a pointer to the artifact that needs the blob
+//! @param[in] deadline_usec time_usec() by which to give up or 0 to wait for as long as it takes
+//!
+//! @return TRUE if another thread held the blob and the wait is over, FALSE if there was nothing to wait for
+//!
+static boolean art_wait_blob(const artifact * a, long long deadline_usec)
+{
+    boolean waited = FALSE;
+    art_claim *c = NULL;
+    struct timespec ts = { 0 };
+    long long now = 0;
+    long long wait_usec = 0;
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        if ((c = art_find_claim(a)) != NULL && c->owner == a)
+            c = NULL;
+        if (c) {
+            waited = TRUE;
+            LOGDEBUG("[%s] waiting for artifact %03d|%s to be built by [%s]\n", a->instanceId, a->seq, a->id, c->instanceId);
+            c->waiters++;
+            art_dl_stats.waiting++;
+            while (c->owner != NULL) {
+                now = time_usec();
+                wait_usec = ARTIFACT_PROGRESS_USEC;
+                if (deadline_usec > 0) {
+                    if (now >= deadline_usec)
+                        break;
+                    wait_usec = MIN(wait_usec, (deadline_usec - now));
+                }
+                art_abstime(wait_usec, &ts);
+                if ((pthread_cond_timedwait(&(c->done), &art_mutex, &ts) == ETIMEDOUT) && c->owner && c->is_downloading) {
+                    LOGINFO("[%s] waiting for [%s] to download %s: %lld of %lld MB in %lld sec\n", a->instanceId, c->instanceId, a->id,
+                            (art_download_progress(c) / MEGABYTE), (c->size_bytes / MEGABYTE), ((time_usec() - c->started_usec) / 1000000LL));
+                }
+            }
+            art_dl_stats.waiting--;
+            if (c->owner == NULL && !c->failed && c->is_download)
+                art_dl_stats.shared++; // one network fetch saved
+            c->waiters--;
+            if (c->owner == NULL && c->waiters == 0) {
+                pthread_cond_destroy(&(c->done));
+                EUCA_FREE(c);
+            }
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+    return (waited);
+}
+
+//!
+//! Notes that an artifact is about to download its content, so that waiting
+//! launches and the stats can follow its progress
+//!
+//! @param[in] a pointer to the artifact, with its blob open
+//!
+static void art_download_begin(const artifact * a)
+{
+    art_claim *c = NULL;
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        art_dl_stats.started++;
+        art_dl_stats.in_flight++;
+        if ((c = art_find_claim(a)) != NULL && c->owner == a && a->bb) {
+            euca_strncpy(c->path, blockblob_get_file(a->bb), sizeof(c->path));
+            c->size_bytes = a->size_bytes;
+            c->started_usec = time_usec();
+            c->is_download = TRUE;
+            c->is_downloading = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Notes that the download of an artifact's content is over
+//!
+//! @param[in] a pointer to the artifact
+//! @param[in] ret what its creator returned
+//!
+static void art_download_end(const artifact * a, int ret)
+{
+    art_claim *c = NULL;
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        art_dl_stats.in_flight--;
+        if (ret == EUCA_OK) {
+            art_dl_stats.completed++;
+        } else {
+            art_dl_stats.failed++;
+        }
+        if ((c = art_find_claim(a)) != NULL && c->owner == a)
+            c->is_downloading = FALSE;
+    }
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Records that a launch asked for a blank partition, so art_provision_partitions()
+//! can keep the kinds in demand formatted in the cache
+//!
+//! @param[in] vbr the VBR of the partition
+//!
+static void art_note_partition(const virtualBootRecord * vbr)
+{
+    long long now = time_usec();
+    art_partition_kind *kind = NULL;
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        // the matching kind, or else a free slot, or else the one not asked for the longest
+        for (int i = 0; i < PARTITION_POOL_KINDS; i++) {
+            art_partition_kind *k = art_partitions + i;
+            if ((k->size_bytes == vbr->sizeBytes) && (k->type == vbr->type) && (k->format == vbr->format) && !strcmp(k->formatName, vbr->formatName)) {
+                kind = k;
+                break;
+            }
+            if ((kind == NULL) || ((kind->size_bytes != 0) && ((k->size_bytes == 0) || (k->last_usec < kind->last_usec))))
+                kind = k;
+        }
+
+        if ((kind->size_bytes != vbr->sizeBytes) || (kind->type != vbr->type) || (kind->format != vbr->format) || strcmp(kind->formatName, vbr->formatName)) {
+            bzero(kind, sizeof(*kind));
+            kind->size_bytes = vbr->sizeBytes;
+            kind->type = vbr->type;
+            kind->format = vbr->format;
+            euca_strncpy(kind->formatName, vbr->formatName, sizeof(kind->formatName));
+            euca_strncpy(kind->typeName, vbr->typeName, sizeof(kind->typeName));
+        }
+        if ((now - kind->last_usec) > PARTITION_POOL_WINDOW_USEC)
+            kind->launches = 0;
+        kind->launches++;
+        kind->last_usec = now;
+    }
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Makes sure that the kinds of blank partitions that recent launches asked for
+//! most are formatted in the cache, so that the next launches only need to
+//! snapshot them rather than run mkfs or mkswap. Partitions of the same kind
+//! are all snapshots of one cached blob, so one blob per kind is the whole pool.
+//!
+//! @param[in] work_bs pointer to the work blobstore
+//! @param[in] cache_bs pointer to the cache blobstore
+//! @param[in] max_kinds how many of the kinds in most demand to keep formatted
+//! @param[in] timeout_usec timeout for each partition, in microseconds or 0 for no timeout
+//!
+//! @return the number of kinds that are formatted in the cache
+//!
+int art_provision_partitions(blobstore * work_bs, blobstore * cache_bs, int max_kinds, long long timeout_usec)
+{
+    int kept = 0;
+    int num_wanted = 0;
+    long long now = time_usec();
+    art_partition_kind wanted[PARTITION_POOL_KINDS];
+
+    if ((work_bs == NULL) || (cache_bs == NULL) || (max_kinds < 1))
+        return (0);
+
+    pthread_mutex_lock(&art_mutex);
+    {
+        // the kinds in demand, most launches first
+        for (int i = 0; i < PARTITION_POOL_KINDS; i++) {
+            art_partition_kind *k = art_partitions + i;
+            if ((k->size_bytes == 0) || (k->launches < PARTITION_POOL_MIN_LAUNCHES) || ((now - k->last_usec) > PARTITION_POOL_WINDOW_USEC))
+                continue;
+            int j = num_wanted++;
+            for (; (j > 0) && (wanted[j - 1].launches < k->launches); j--)
+                wanted[j] = wanted[j - 1];
+            wanted[j] = *k;
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+
+    art_set_instanceId(PARTITION_POOL_PREFIX);
+    for (int i = 0; (i < num_wanted) && (i < max_kinds); i++) {
+        virtualBootRecord *vbr = NULL;
+        artifact *sentinel = NULL;
+        artifact *a = NULL;
+
+        if ((vbr = EUCA_ZALLOC(1, sizeof(virtualBootRecord))) == NULL)
+            break;
+        euca_strncpy(vbr->id, "none", sizeof(vbr->id));
+        euca_strncpy(vbr->formatName, wanted[i].formatName, sizeof(vbr->formatName));
+        euca_strncpy(vbr->typeName, wanted[i].typeName, sizeof(vbr->typeName));
+        vbr->sizeBytes = wanted[i].size_bytes;
+        vbr->type = wanted[i].type;
+        vbr->format = wanted[i].format;
+        vbr->locationType = NC_LOCATION_NONE;
+
+        // the same artifact a launch would ask for, so it finds this one in the cache
+        if (((sentinel = art_alloc(PARTITION_POOL_PREFIX, NULL, -1, FALSE, FALSE, FALSE, NULL, NULL)) == NULL)
+            || ((a = art_alloc_vbr(vbr, FALSE, FALSE, FALSE, NULL, NULL)) == NULL)) {
+            ART_FREE(sentinel);
+            EUCA_FREE(vbr);
+            break;
+        }
+        if (art_add_dep(sentinel, a) != EUCA_OK) {
+            ART_FREE(a);
+            ART_FREE(sentinel);
+            EUCA_FREE(vbr);
+            break;
+        }
+
+        if (art_implement_tree(sentinel, work_bs, cache_bs, PARTITION_POOL_PREFIX, timeout_usec) == EUCA_OK) {
+            if (a->is_in_cache) {
+                kept++;
+            } else {                   // no room in the cache, so it went to the work blobstore, where it helps no one
+                char id_work[BLOBSTORE_MAX_PATH];
+                snprintf(id_work, sizeof(id_work), "%s/%s", PARTITION_POOL_PREFIX, a->id);
+                blockblob *bb = blockblob_open(work_bs, id_work, 0, 0, NULL, FIND_BLOB_TIMEOUT_USEC);
+                if ((bb != NULL) && (blockblob_delete(bb, DELETE_BLOB_TIMEOUT_USEC, 0) == -1))
+                    blockblob_close(bb);
+            }
+        } else {
+            LOGWARN("[%s] failed to provision a %lld-byte %s partition in the cache\n", PARTITION_POOL_PREFIX, wanted[i].size_bytes, wanted[i].formatName);
+        }
+        ART_FREE(sentinel);
+        EUCA_FREE(vbr);
+    }
+    art_set_instanceId("");
+
+    return (kept);
+}
+
+//!
+//! Gets the counters of the image downloads into the cache, for the stats sensors
+//!
+//! @param[out] stats RESULT: the counters, with the progress of the downloads under way
+//!
+void art_get_download_stats(art_download_stats * stats)
+{
+    pthread_mutex_lock(&art_mutex);
+    {
+        *stats = art_dl_stats;
+        for (art_claim * c = art_claims; c; c = c->next) {
+            if (c->is_downloading) {
+                stats->in_flight_bytes += c->size_bytes;
+                stats->in_flight_done_bytes += art_download_progress(c);
+            }
+        }
+    }
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Reserves one of the ARTIFACT_MAX_WORKERS worker threads shared by all launches
+//!
+//! @return TRUE if a worker was reserved, FALSE if they are all busy
+//!
+static boolean art_take_worker(void)
+{
+    boolean taken = FALSE;
+
+    pthread_mutex_lock(&art_mutex);
+    if (art_workers < ARTIFACT_MAX_WORKERS) {
+        art_workers++;
+        taken = TRUE;
+    }
+    pthread_mutex_unlock(&art_mutex);
+    return (taken);
+}
+
+//!
+//! Returns a worker thread reserved with art_take_worker()
+//!
+static void art_put_worker(void)
+{
+    pthread_mutex_lock(&art_mutex);
+    art_workers--;
+    pthread_mutex_unlock(&art_mutex);
+}
+
+//!
+//! Implements the subtree of one job and, for a job that only needs the artifact
+//! to exist, closes its blob right away
+//!
+//! @param[in] job pointer to the job
+//!
+static void art_run_job(art_job * job)
+{
+    artifact *a = job->a;
+
+    job->ret = art_implement_subtree(a, job->work_bs, job->cache_bs, job->work_prefix, job->timeout_usec);
+    if (job->ret == EUCA_OK && job->do_release) {
+        if (a->bb && (blockblob_close(a->bb) == -1)) {
+            LOGERROR("[%s] failed to close artifact %s: %d %s (potential resource leak!)\n", a->instanceId, a->id, blobstore_get_error(), blobstore_get_last_msg());
+        }
+        a->bb = 0;                     // for debugging
+        art_unclaim_blob(a, FALSE);
+    }
+}
+
+//!
+//! Start routine of a worker thread
+//!
+//! @param[in] arg pointer to the art_job to run
+//!
+//! @return NULL
+//!
+static void *art_job_thread(void *arg)
+{
+    art_job *job = arg;
+
+    art_set_instanceId(job->a->instanceId);
+    art_run_job(job);
+    art_put_worker();
+    return (NULL);
+}
+
+//!
+//! Runs independent jobs, handing all but the first to worker threads while there are
+//! any to spare and running the rest on the calling thread, and waits for all of them
+//!
+//! @param[in] jobs array of jobs
+//! @param[in] num_jobs number of entries in the array
+//!
+static void art_run_jobs(art_job * jobs, int num_jobs)
+{
+    for (int i = 1; i < num_jobs; i++) {
+        if (!art_take_worker())
+            break;
+        if (pthread_create(&(jobs[i].thread), NULL, art_job_thread, &(jobs[i])) != 0) {
+            art_put_worker();
+            break;
+        }
+        jobs[i].on_thread = TRUE;
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (!jobs[i].on_thread)
+            art_run_job(&(jobs[i]));
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].on_thread)
+            pthread_join(jobs[i].thread, NULL);
+    }
+}
+
 //!
 //! Traverse artifact tree and create/download/combine artifacts
 //!
@@ -2671,6 +3263,11 @@ try_work:
 //!
 //! Either way, none of the child blobs are open.
 //!
+//! Dependencies are independent of one another until the creator combines
+//! them, so they are implemented concurrently, on worker threads while any
+//! are free. A shared blob that another thread of this process is building
+//! is waited for rather than polled.
+//!
 //! @param[in] root pointer to root of the tree
 //! @param[in] work_bs pointero to work blobstore
 //! @param[in] cache_bs pointer to OPTIONAL cache blobstore
@@ -2683,22 +3280,25 @@ try_work:
 //!
 //! @note
 //!
-int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec)
+static int art_implement_subtree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec)
 {
     long long started = time_usec();
+    long long deadline = (timeout_usec > 0) ? (started + timeout_usec) : (0);
     assert(root);
 
     LOGDEBUG("[%s] implementing artifact %03d|%s\n", root->instanceId, root->seq, root->id);
 
     int ret = EUCA_OK;
     int tries = 0;
+    boolean do_sleep = TRUE;
     do {                               // we may have to retry multiple times due to competition
-        int num_opened_deps = 0;
+        boolean dep_is_open[MAX_ARTIFACT_DEPS] = { FALSE };
         boolean do_deps = TRUE;
         boolean do_create = TRUE;
 
-        if (tries++)
+        if (tries++ && do_sleep)
             usleep(ARTIFACT_RETRY_SLEEP_USEC);
+        do_sleep = TRUE;
 
         if (!root->creator) {          // sentinel nodes do not have a creator
             do_create = FALSE;
@@ -2707,6 +3307,10 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
             if (root->vbr && root->vbr->type == NC_RESOURCE_EBS)
                 goto create;           // EBS artifacts have no disk manifestation and no dependencies, so skip to creation
 
+            // rather than poll the lock of a blob that another launch is building, wait for it to be done
+            if (art_is_shared(root, cache_bs))
+                art_wait_blob(root, deadline);
+
             // try to open the artifact
             switch (ret = find_or_create_artifact(FIND, root, work_bs, cache_bs, work_prefix, &(root->bb))) {
             case BLOBSTORE_ERROR_OK:
@@ -2716,10 +3320,17 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
                 do_deps = FALSE;
                 do_create = FALSE;
                 break;
-            case BLOBSTORE_ERROR_NOENT:    // doesn't exist yet => ok, create it
+            case BLOBSTORE_ERROR_NOENT:    // doesn't exist yet => ok, create it, unless another thread is already at it
+                if (!art_claim_blob(root, cache_bs)) {
+                    ret = BLOBSTORE_ERROR_AGAIN;
+                    do_sleep = FALSE;  // the wait before opening it again will do
+                    goto retry_or_fail;
+                }
                 break;
             case BLOBSTORE_ERROR_AGAIN:    // timed out the => competition took too long
             case BLOBSTORE_ERROR_MFILE:    // out of file descriptors for locking => same problem
+                if (art_wait_blob(root, deadline))
+                    do_sleep = FALSE;  // the thread holding it is done, so try again right away
                 goto retry_or_fail;
                 break;
             default:                  // all other errors
@@ -2731,42 +3342,66 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
         // at this point the artifact we need does not seem to exist
         // (though it could be created before we get around to that)
 
-        if (do_deps) {                 // recursively go over dependencies, if any
-            for (int i = 0; i < MAX_ARTIFACT_DEPS && root->deps[i]; i++) {
+        if (do_deps) {                 // recursively go over dependencies, if any, all at once
+            art_job jobs[MAX_ARTIFACT_DEPS];
+            int num_deps = 0;
 
-                // recalculate the time that remains in the timeout period
-                long long new_timeout_usec = timeout_usec;
-                if (timeout_usec > 0) {
-                    new_timeout_usec -= time_usec() - started;
-                    if (new_timeout_usec < 1) { // timeout exceeded, so bail out of this function
-                        ret = BLOBSTORE_ERROR_AGAIN;
-                        goto retry_or_fail;
-                    }
+            // recalculate the time that remains in the timeout period
+            long long new_timeout_usec = timeout_usec;
+            if (timeout_usec > 0) {
+                new_timeout_usec -= time_usec() - started;
+                if (new_timeout_usec < 1) { // timeout exceeded, so bail out of this function
+                    ret = BLOBSTORE_ERROR_AGAIN;
+                    goto retry_or_fail;
+                }
+            }
+
+            bzero(jobs, sizeof(jobs));
+            for (num_deps = 0; num_deps < MAX_ARTIFACT_DEPS && root->deps[num_deps]; num_deps++) {
+                jobs[num_deps].a = root->deps[num_deps];
+                jobs[num_deps].work_bs = work_bs;
+                jobs[num_deps].cache_bs = cache_bs;
+                jobs[num_deps].work_prefix = work_prefix;
+                jobs[num_deps].timeout_usec = new_timeout_usec;
+                jobs[num_deps].do_release = !do_create; // this is a sentinel, we're not creating anything, so release the dep immediately
+            }
+            // dependencies that are held open for the creator while siblings are built may
+            // wait on blobs held by other launches, in any order, so they give up on such
+            // contention after a while to let this function release the siblings and retry
+            if (do_create && num_deps > 1) {
+                for (int i = 0; i < num_deps; i++) {
+                    if (new_timeout_usec == 0 || new_timeout_usec > ARTIFACT_HELD_TIMEOUT_USEC)
+                        jobs[i].timeout_usec = ARTIFACT_HELD_TIMEOUT_USEC;
                 }
-                switch (ret = art_implement_tree(root->deps[i], work_bs, cache_bs, work_prefix, new_timeout_usec)) {
+            }
+            art_run_jobs(jobs, num_deps);
+
+            ret = BLOBSTORE_ERROR_OK;
+            for (int i = 0; i < num_deps; i++) {
+                switch (jobs[i].ret) {
                 case BLOBSTORE_ERROR_OK:
-                    if (do_create) {   // we'll hold the dependency open for the creator
-                        num_opened_deps++;
-                    } else {           // this is a sentinel, we're not creating anything, so release the dep immediately
-                        if (root->deps[i]->bb && (blockblob_close(root->deps[i]->bb) == -1)) {
-                            LOGERROR("[%s] failed to close dependency of %s: %d %s (potential resource leak!) on try %d\n",
-                                     root->instanceId, root->id, blobstore_get_error(), blobstore_get_last_msg(), tries);
-                        }
-                        root->deps[i]->bb = 0;  // for debugging
-                    }
+                    if (do_create)     // we'll hold the dependency open for the creator
+                        dep_is_open[i] = TRUE;
                     break;             // out of the switch statement
                 case BLOBSTORE_ERROR_AGAIN:    // timed out => the competition took too long
                 case BLOBSTORE_ERROR_MFILE:    // out of file descriptors for locking => same problem
-                    goto retry_or_fail;
-                default:              // all other errors
-                    LOGERROR("[%s] failed to provision dependency %s for artifact %s (error=%d) on try %d\n", root->instanceId, root->deps[i]->id, root->id, ret, tries);
-                    goto retry_or_fail;
+                    if (ret == BLOBSTORE_ERROR_OK)
+                        ret = jobs[i].ret;
+                    break;
+                default:              // all other errors, which take precedence over the ones above
+                    LOGERROR("[%s] failed to provision dependency %s for artifact %s (error=%d) on try %d\n", root->instanceId, root->deps[i]->id, root->id, jobs[i].ret,
+                             tries);
+                    if (ret == BLOBSTORE_ERROR_OK || ret == BLOBSTORE_ERROR_AGAIN || ret == BLOBSTORE_ERROR_MFILE)
+                        ret = jobs[i].ret;
+                    break;
                 }
             }
+            if (ret != BLOBSTORE_ERROR_OK)
+                goto retry_or_fail;
         }
         // at this point the dependencies, if any, needed to create
         // the artifact, have been created and opened (i.e. locked
-        // for exclusive use by this process and thread)
+        // for exclusive use by this process)
 
         if (do_create) {
             // shortcut for a case where a copy creator has a dependency that
@@ -2780,7 +3415,8 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
                 LOGDEBUG("[%s] bypassing redundant artifact %03d|%s on try %d\n", root->instanceId, root->seq, root->id, tries);
                 root->bb = root->deps[0]->bb;
                 root->deps[0]->bb = NULL;
-                num_opened_deps--;     // so we won't attempt to close deps's blockblob
+                dep_is_open[0] = FALSE; // so we won't attempt to close deps's blockblob
+                art_unclaim_blob(root->deps[0], FALSE);
             } else {
 
                 // try to create the artifact since last time we checked it did not exist
@@ -2804,7 +3440,11 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
             }
 
 create:
+            if (art_is_download(root))
+                art_download_begin(root);
             ret = root->creator(root); // create and open this artifact for exclusive use
+            if (art_is_download(root))
+                art_download_end(root, ret);
             if (ret != EUCA_OK) {
                 LOGERROR("[%s] failed to create artifact %s (error=%d, may retry) on try %d\n", root->instanceId, root->id, ret, tries);
                 // delete the partially created artifact so we can retry with a clean slate
@@ -2828,16 +3468,30 @@ create:
                 if (root->vbr && root->vbr->type != NC_RESOURCE_EBS)
                     if (work_bs && blockblob_get_blobstore(root->bb) == work_bs)
                         update_vbr_with_backing_info(root);
+
+                // kernels, ramdisks and anything that must stay a file are left alone, since a deduplicated blob is only a device
+                if (cache_dedup && art_is_download(root) && !root->must_be_file && root->vbr && root->vbr->type == NC_RESOURCE_IMAGE
+                    && cache_bs && blockblob_get_blobstore(root->bb) == cache_bs) {
+                    if (blockblob_dedup(root->bb, DEDUP_BLOB_TIMEOUT_USEC) == -1) {
+                        LOGWARN("[%s] failed to deduplicate cached artifact %s, keeping it whole: %d %s\n", root->instanceId, root->id,
+                                blobstore_get_error(), blobstore_get_last_msg());
+                    }
+                }
             }
         }
 
 retry_or_fail:
         // close all opened dependent blobs, whether we're trying again or returning
-        for (int i = 0; i < num_opened_deps; i++) {
-            if (root->deps[i]->bb != NULL)
-                blockblob_close(root->deps[i]->bb);
-            root->deps[i]->bb = 0;     // for debugging
+        for (int i = 0; i < MAX_ARTIFACT_DEPS && root->deps[i]; i++) {
+            if (dep_is_open[i]) {
+                if (root->deps[i]->bb != NULL)
+                    blockblob_close(root->deps[i]->bb);
+                root->deps[i]->bb = 0; // for debugging
+                art_unclaim_blob(root->deps[i], FALSE);
+            }
         }
+        if (ret != EUCA_OK)            // whatever this try claimed was not built
+            art_unclaim_blob(root, TRUE);
 
     } while ((ret == BLOBSTORE_ERROR_AGAIN || ret == BLOBSTORE_ERROR_MFILE) // only timeout-type error causes us to keep trying
              && (timeout_usec == 0     // indefinitely if there is no timeout at all
@@ -2852,6 +3506,28 @@ retry_or_fail:
     return (ret);
 }
 
+//!
+//! Traverse artifact tree and create/download/combine artifacts, as described
+//! for art_implement_subtree(), which does the work
+//!
+//! @param[in] root pointer to root of the tree
+//! @param[in] work_bs pointero to work blobstore
+//! @param[in] cache_bs pointer to OPTIONAL cache blobstore
+//! @param[in] work_prefix OPTIONAL instance-specific prefix for forming work blob IDs
+//! @param[in] timeout_usec timeout for the whole process, in microseconds or 0 for no timeout
+//!
+//! @return EUCA_OK or BLOBSTORE_ERROR_ error codes
+//!
+int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec)
+{
+    int ret = art_implement_subtree(root, work_bs, cache_bs, work_prefix, timeout_usec);
+
+    // the caller closes the root blob, so threads that need it can no
+    // longer be told when that happens and go back to polling for it
+    art_unclaim_blob(root, (ret != EUCA_OK));
+    return (ret);
+}
+
 #ifdef _UNIT_TEST
 //!
 //!
@@ -3134,6 +3810,145 @@ static int check_blob(blobstore * bs, const char *keyword, int expect)
     return (0);
 }
 
+//!
+//! Creator for the parallel tree test that takes a while to create a file
+//!
+//! @param[in] a pointer to the artifact
+//!
+//! @return EUCA_OK or EUCA_ERROR
+//!
+static int slow_creator(artifact * a)
+{
+    FILE *fp = NULL;
+
+    usleep(PARALLEL_CREATOR_USEC);
+    if ((fp = fopen(a->id, "w")) == NULL)
+        return (EUCA_ERROR);
+    fclose(fp);
+    return (EUCA_OK);
+}
+
+//!
+//! Implements a tree whose dependencies each take a while to create and checks
+//! that they were created and that it took less time than creating them in turn
+//!
+//! @return the number of errors
+//!
+static int do_parallel_tree_test(void)
+{
+    int errors = 0;
+    char path[EUCA_MAX_PATH] = "";
+    long long started = 0;
+    long long elapsed = 0;
+    artifact *sentinel = NULL;
+    artifact *dep = NULL;
+
+    printf("running parallel artifact tree test\n");
+    sentinel = art_alloc("sentinel", NULL, 0, FALSE, FALSE, FALSE, NULL, NULL);
+    for (int i = 0; i < PARALLEL_DEPS; i++) {
+        snprintf(path, sizeof(path), "/tmp/test_vbr_art_%d_%d", getpid(), i);
+        unlink(path);
+        dep = art_alloc(path, NULL, 0, FALSE, TRUE, FALSE, slow_creator, NULL);
+        dep->id_is_path = TRUE;
+        art_add_dep(sentinel, dep);
+    }
+
+    started = time_usec();
+    if (art_implement_tree(sentinel, work_bs, NULL, NULL, PARALLEL_CREATOR_USEC * PARALLEL_DEPS * 10) != EUCA_OK) {
+        printf("error: failed to implement tree with %d dependencies\n", PARALLEL_DEPS);
+        errors++;
+    }
+    elapsed = time_usec() - started;
+    printf("implemented %d dependencies of %lldus each in %lldus\n", PARALLEL_DEPS, PARALLEL_CREATOR_USEC, elapsed);
+    if (elapsed >= (PARALLEL_CREATOR_USEC * PARALLEL_DEPS)) {
+        printf("error: dependencies were not implemented concurrently\n");
+        errors++;
+    }
+
+    for (int i = 0; i < PARALLEL_DEPS; i++) {
+        if (check_path(sentinel->deps[i]->id)) {
+            printf("error: dependency %s was not created\n", sentinel->deps[i]->id);
+            errors++;
+        }
+        unlink(sentinel->deps[i]->id);
+    }
+    ART_FREE(sentinel);
+    return (errors);
+}
+
+//!
+//! Creator for the single-flight test that takes a while to fill a cached blob, failing
+//! the first time if asked to
+//!
+//! @param[in] a pointer to the artifact
+//!
+//! @return EUCA_OK or EUCA_ERROR
+//!
+static int counting_creator(artifact * a)
+{
+    int call = __sync_add_and_fetch(&single_flight_calls, 1);
+
+    usleep(PARALLEL_CREATOR_USEC);
+    if (single_flight_fail_first && call == 1)
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
+//!
+//! Launch for the single-flight test, implementing a tree with one cached artifact
+//! that all launches share
+//!
+//! @param[in] ptr pointer to an int for the result of art_implement_tree()
+//!
+//! @return NULL
+//!
+static void *single_flight_function(void *ptr)
+{
+    artifact *sentinel = art_alloc("sentinel", NULL, 0, FALSE, FALSE, FALSE, NULL, NULL);
+    artifact *dep = art_alloc(SINGLE_FLIGHT_ID, SINGLE_FLIGHT_ID, 1048576, TRUE, TRUE, FALSE, counting_creator, NULL);
+
+    art_add_dep(sentinel, dep);
+    *((int *)ptr) = art_implement_tree(sentinel, work_bs, cache_bs, NULL, PARALLEL_CREATOR_USEC * SINGLE_FLIGHT_LAUNCHES * 10);
+    ART_FREE(sentinel);
+    return (NULL);
+}
+
+//!
+//! Implements trees that share a cached artifact from several threads at once and checks
+//! that it is built once or, if the first try fails, exactly once more
+//!
+//! @return the number of errors
+//!
+static int do_single_flight_test(void)
+{
+    int errors = 0;
+    int failures = 0;
+    int rets[SINGLE_FLIGHT_LAUNCHES] = { 0 };
+    pthread_t threads[SINGLE_FLIGHT_LAUNCHES];
+
+    for (int fail_first = 0; fail_first < 2; fail_first++) {
+        printf("running single-flight test with %d launches%s\n", SINGLE_FLIGHT_LAUNCHES, (fail_first) ? (" and a failure") : (""));
+        single_flight_calls = 0;
+        single_flight_fail_first = fail_first;
+        for (int i = 0; i < SINGLE_FLIGHT_LAUNCHES; i++) {
+            pthread_create(&threads[i], NULL, single_flight_function, &rets[i]);
+        }
+        failures = 0;
+        for (int i = 0; i < SINGLE_FLIGHT_LAUNCHES; i++) {
+            pthread_join(threads[i], NULL);
+            if (rets[i] != EUCA_OK)
+                failures++;
+        }
+        printf("artifact was built %d time(s) and %d launch(es) failed\n", single_flight_calls, failures);
+        if (single_flight_calls != (1 + fail_first) || failures != fail_first) {
+            printf("error: expected the artifact to be built %d time(s) and %d launch(es) to fail\n", (1 + fail_first), fail_first);
+            errors++;
+        }
+        blobstore_delete_regex(cache_bs, SINGLE_FLIGHT_ID);
+    }
+    return (errors);
+}
+
 //!
 //!
 //!
@@ -3178,6 +3993,11 @@ int main(int argc, char **argv)
             goto out;
         }
 
+        if ((errors += do_parallel_tree_test()) > 0)
+            goto out;
+        if ((errors += do_single_flight_test()) > 0)
+            goto out;
+
         printf("running test that only uses cache blobstore\n");
         if (errors += provision_vm(GEN_ID(), KEY1, EKI1, ERI1, EMI1, cache_bs, work_bs, FALSE))
             goto out;
@@ -135,6 +135,19 @@ typedef struct _artifact {
     void *internal;                    //!< OPTIONAL pointer to any other artifact-specific data 'creator' may need
 } artifact;
 
+//! Counters of the image downloads into the cache, see art_get_download_stats()
+typedef struct _art_download_stats {
+    long long started;                 //!< downloads begun
+    long long completed;               //!< downloads that succeeded
+    long long failed;                  //!< downloads that failed
+    long long shared;                  //!< launches that got a blob another launch downloaded, i.e. downloads saved
+    long long handoffs;                //!< failed downloads that a waiting launch took over
+    int in_flight;                     //!< downloads under way
+    int waiting;                       //!< launches waiting for a shared blob to be built
+    long long in_flight_bytes;         //!< total size of the downloads under way
+    long long in_flight_done_bytes;    //!< bytes of the downloads under way that have arrived
+} art_download_stats;
+
 //! Struct for local host config to use if making remote calls.
 //! Needed for calls to the SC
 typedef struct host_config {
@@ -176,9 +189,12 @@ artifact *art_alloc(const char *id, const char *sig, long long size_bytes, boole
                     int (*creator) (artifact * a), virtualBootRecord * vbr);
 
 void art_set_instanceId(const char *instanceId);
+void art_set_cache_dedup(boolean enable);
 artifact *vbr_alloc_tree(virtualMachine * vm, boolean do_make_work_copy, boolean is_migration_dest, const char *sshkey, boolean * bail_flag,
                          const char *instanceId);
 int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec);
+void art_get_download_stats(art_download_stats * stats);
+int art_provision_partitions(blobstore * work_bs, blobstore * cache_bs, int max_kinds, long long timeout_usec);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
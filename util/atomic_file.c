@@ -78,6 +78,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <openssl/md5.h>
 
 #include <log.h>
 #include <http.h>
@@ -204,8 +205,8 @@ int atomic_file_get(atomic_file * file, boolean * file_updated)
     int fd = 0;
     int ret = 0;
     int rc = 0;
-    char *hash = NULL;
     char type[32] = "";
+    char md5_str[MD5_STR_SIZE] = "";
     char hostname[512] = "";
     char path[EUCA_MAX_PATH] = "";
     char tmpsource[EUCA_MAX_PATH] = "";
@@ -237,7 +238,7 @@ int atomic_file_get(atomic_file * file, boolean * file_updated)
     snprintf(path, EUCA_MAX_PATH, "/%s", tmppath);
 
     if (!strcmp(type, "http")) {
-        rc = http_get_timeout(file->source, file->tmpfile, 0, 0, 10, 15, NULL);
+        rc = http_get_timeout_md5(file->source, file->tmpfile, 0, 0, 10, 15, NULL, md5_str);
         if (rc) {
             LOGERROR("http client failed to fetch file URL=%s: check http server status\n", file->source);
             ret = 1;
@@ -253,21 +254,20 @@ int atomic_file_get(atomic_file * file, boolean * file_updated)
     }
 
     if (!ret) {
+        // do checksum - only copy if file has changed. A download is hashed as it
+        // is saved and sorting hashes what it writes, so only copies are read again
+        EUCA_FREE(file->currhash);
+        file->currhash = (md5_str[0] ? strdup(md5_str) : file2md5str(file->tmpfile));
         if (file->dosort) {
             rc = atomic_file_sort_tmpfile(file);
             if (rc) {
                 LOGWARN("could not sort tmpfile (%s) inplace: continuing without sort\n", file->tmpfile);
             }
         }
-        // do checksum - only copy if file has changed
-        hash = file2md5str(file->tmpfile);
-        if (!hash) {
+        if (!file->currhash) {
             LOGERROR("could not compute hash of tmpfile (%s): check permissions\n", file->tmpfile);
             ret = 1;
         } else {
-            if (file->currhash)
-                EUCA_FREE(file->currhash);
-            file->currhash = hash;
             if (check_file(file->dest) || strcmp(file->currhash, file->lasthash)) {
                 // hashes are different, put new file in place
                 LOGDEBUG("update triggered due to file update (%s)\n", file->dest);
@@ -290,7 +290,8 @@ int atomic_file_get(atomic_file * file, boolean * file_updated)
 }
 
 //!
-//! Function description.
+//! Sorts the lines of the tmpfile in place. On success, file->currhash is
+//! replaced with the MD5 of the sorted file, which is computed as it is written.
 //!
 //! @param[in] file
 //!
@@ -313,8 +314,11 @@ int atomic_file_sort_tmpfile(atomic_file * file)
     char **contents = NULL;
     char buf[4096] = "";
     char tmpfile[EUCA_MAX_PATH] = "";
+    char md5_str[MD5_STR_SIZE] = "";
+    unsigned char md5[MD5_DIGEST_LENGTH] = { 0 };
     FILE *IFH = NULL;
     FILE *OFH = NULL;
+    MD5_CTX md5_ctx = { 0 };
 
     snprintf(tmpfile, EUCA_MAX_PATH, "%s-XXXXXX", file->dest);
     if ((fd = safe_mkstemp(tmpfile)) < 0) {
@@ -341,14 +345,20 @@ int atomic_file_sort_tmpfile(atomic_file * file)
         if (contents) {
             qsort(contents, currlines, sizeof(char *), strcmp_ptr);
             if ((OFH = fopen(tmpfile, "w")) != NULL) {
+                MD5_Init(&md5_ctx);
                 for (i = 0; i < currlines; i++) {
                     fprintf(OFH, "%s", contents[i]);
+                    MD5_Update(&md5_ctx, contents[i], strlen(contents[i]));
                     EUCA_FREE(contents[i]);
                 }
                 fclose(OFH);
+                MD5_Final(md5, &md5_ctx);
                 if (rename(tmpfile, file->tmpfile)) {
                     LOGERROR("could not rename (move) source file '%s' to dest file '%s': check permissions\n", tmpfile, file->tmpfile);
                     ret = 1;
+                } else if (md5digest2str(md5_str, sizeof(md5_str), md5) == EUCA_OK) {
+                    EUCA_FREE(file->currhash);
+                    file->currhash = strdup(md5_str);
                 }
             }
             EUCA_FREE(contents);
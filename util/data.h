@@ -466,6 +466,12 @@ typedef struct ncInstance_t {
     //! @name updated by NC upon Attach/Detach ENI in VPC mode
     netConfig secNetCfgs[EUCA_MAX_NICS]; //!< Instance's attached secondary ENIs
     //! @}
+
+    //! @{
+    //! @name kept by NC to answer incremental describes
+    long long describeGeneration;      //!< describe generation at which the described fields last changed
+    u32 describeDigest;                //!< digest of the described fields at that generation
+    //! @}
 } ncInstance;
 
 //! Structure defining NC resource information
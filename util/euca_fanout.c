@@ -0,0 +1,531 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_fanout.c
+//! Fan-out executor. Each task runs in a child process of its own, so a task
+//! that hangs or crashes cannot take the caller down, and the tasks can share
+//! results through shared memory, as the CC does with resourceCacheStage.
+//!
+//! The parent keeps at most maxRunning children alive and polls them, starting
+//! the next task as soon as one finishes, instead of waiting for the children
+//! in the order they were started. A child still running at its deadline is sent
+//! SIGTERM and given up on: it no longer counts toward maxRunning and is reaped
+//! later on. Tasks that were not started when the overall deadline expires are
+//! cancelled.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <eucalyptus.h>
+#include "misc.h"
+#include "log.h"
+#include "euca_fanout.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define FANOUT_KILL_GRACE_MS                     2000   //!< how long a task terminated at its deadline gets to exit before it is killed
+#define FANOUT_POLL_USEC                         10000  //!< how long to sleep when no child changed state (same as timewait())
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A running task
+typedef struct fanout_slot_t {
+    pid_t pid;                         //!< its process, 0 if the slot is free
+    int idx;                           //!< its task number
+    long long startMs;                 //!< when it started
+    long long deadlineMs;              //!< when it gets terminated, 0 for never
+    long long killMs;                  //!< when it gets killed if it ignores being terminated, 0 until it is terminated
+} fanout_slot;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static long long fanout_now_ms(void);
+static void fanout_kill(fanout_slot * slot);
+static void fanout_finish(euca_fanout * fo, fanout_slot * slot, int result, long long now);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Reads the monotonic clock, immune to wall clock adjustments
+//!
+//! @return the current time in milliseconds
+//!
+static long long fanout_now_ms(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((((long long)ts.tv_sec) * 1000LL) + (ts.tv_nsec / 1000000L));
+}
+
+//!
+//! Kills a task that did not exit after being terminated and reaps it, so that
+//! no process of the fan-out outlives euca_fanout_run()
+//!
+//! @param[in] slot the slot of the task
+//!
+static void fanout_kill(fanout_slot * slot)
+{
+    int status = 0;
+
+    LOGWARN("task %d (pid '%d') did not exit %d ms after being terminated, killing it\n", slot->idx, slot->pid, FANOUT_KILL_GRACE_MS);
+    kill(slot->pid, SIGKILL);
+    while ((waitpid(slot->pid, &status, 0) < 0) && (errno == EINTR)) ;
+}
+
+//!
+//! Accounts for a task that is over and frees its slot
+//!
+//! @param[in] fo the fan-out
+//! @param[in] slot the slot of the task
+//! @param[in] result the exit code of the task or EUCA_FANOUT_CRASHED or EUCA_FANOUT_TIMEDOUT
+//! @param[in] now the current time in milliseconds
+//!
+static void fanout_finish(euca_fanout * fo, fanout_slot * slot, int result, long long now)
+{
+    if (result == EUCA_FANOUT_TIMEDOUT) {
+        fo->timedOut++;
+    } else {
+        if (result == 0)
+            fo->succeeded++;
+        else
+            fo->failed++;
+        if ((fo->slowestIdx < 0) || ((now - slot->startMs) > fo->slowestMs)) {
+            fo->slowestMs = (now - slot->startMs);
+            fo->slowestIdx = slot->idx;
+        }
+    }
+
+    if (fo->done)
+        fo->done(slot->idx, result, fo->ctx);
+    bzero(slot, sizeof(fanout_slot));
+}
+
+//!
+//! Runs the tasks of a fan-out and waits until each of them is over: completed,
+//! terminated at its deadline or cancelled. A task still running at its deadline
+//! gets SIGTERM, then SIGKILL if it has not exited FANOUT_KILL_GRACE_MS later; it
+//! is only reported once its process is gone, so none is left running on return.
+//!
+//! @param[in,out] fo the fan-out, its counters are filled in on return
+//!
+//! @return EUCA_OK if every selected task ran and exited with 0, EUCA_ERROR if
+//!         some did not, or EUCA_INVALID_ERROR on invalid parameters
+//!
+int euca_fanout_run(euca_fanout * fo)
+{
+    int i = 0;
+    int idx = 0;
+    int next = 0;
+    int first = 0;
+    int status = 0;
+    int result = 0;
+    int nrunning = 0;
+    int maxRunning = 0;
+    int progressed = 0;
+    pid_t pid = 0;
+    pid_t rc = 0;
+    long long now = 0;
+    long long endMs = 0;
+    fanout_slot *slots = NULL;
+    fanout_slot *slot = NULL;
+
+    if ((fo == NULL) || (fo->task == NULL) || (fo->numTasks < 0))
+        return (EUCA_INVALID_ERROR);
+
+    fo->launched = fo->succeeded = fo->failed = fo->timedOut = fo->cancelled = 0;
+    fo->slowestMs = 0;
+    fo->slowestIdx = -1;
+    fo->firstCancelled = -1;
+    maxRunning = ((fo->maxRunning < 1) ? 1 : fo->maxRunning);
+
+    if (fo->numTasks == 0)
+        return (EUCA_OK);
+
+    if ((slots = EUCA_ZALLOC(maxRunning, sizeof(fanout_slot))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    first = (((fo->first > 0) && (fo->first < fo->numTasks)) ? fo->first : 0);
+
+    now = fanout_now_ms();
+    endMs = ((fo->totalTimeout > 0) ? (now + (fo->totalTimeout * 1000LL)) : 0);
+
+    while (1) {
+        now = fanout_now_ms();
+
+        // start tasks while there is room and time left
+        while ((nrunning < maxRunning) && (next < fo->numTasks) && (!endMs || (now < endMs))) {
+            idx = ((first + next++) % fo->numTasks);
+            if (fo->mask && !fo->mask[idx])
+                continue;
+
+            for (slot = slots; slot->pid != 0; slot++) ;
+
+            if ((pid = fork()) == 0) {
+                exit(fo->task(idx, fo->ctx));
+            } else if (pid < 0) {
+                LOGERROR("cannot fork for task %d: %s\n", idx, strerror(errno));
+                fo->failed++;
+                if (fo->done)
+                    fo->done(idx, EUCA_FANOUT_FORK_FAILED, fo->ctx);
+                continue;
+            }
+
+            slot->pid = pid;
+            slot->idx = idx;
+            slot->startMs = now;
+            slot->deadlineMs = ((fo->taskTimeout) ? (now + (maxint(fo->taskTimeout(idx, fo->ctx), 1) * 1000LL)) : 0);
+            if (endMs && (!slot->deadlineMs || (slot->deadlineMs > endMs)))
+                slot->deadlineMs = endMs;
+            slot->killMs = 0;
+            fo->launched++;
+            nrunning++;
+        }
+
+        if ((nrunning == 0) && ((next >= fo->numTasks) || (endMs && (now >= endMs))))
+            break;
+
+        // collect whatever finished, terminate whatever ran out of time and kill whatever ignored it
+        progressed = 0;
+        for (i = 0; i < maxRunning; i++) {
+            slot = &(slots[i]);
+            if (slot->pid == 0)
+                continue;
+
+            rc = waitpid(slot->pid, &status, WNOHANG);
+            if ((rc == slot->pid) || ((rc < 0) && (errno == ECHILD))) {
+                if (slot->killMs) {
+                    result = EUCA_FANOUT_TIMEDOUT;
+                } else if (rc < 0) {
+                    result = 0;        // someone else reaped it
+                } else if (WIFEXITED(status)) {
+                    result = WEXITSTATUS(status);
+                } else {
+                    result = EUCA_FANOUT_CRASHED;
+                }
+                fanout_finish(fo, slot, result, now);
+                nrunning--;
+                progressed++;
+            } else if (slot->killMs && (now >= slot->killMs)) {
+                fanout_kill(slot);
+                fanout_finish(fo, slot, EUCA_FANOUT_TIMEDOUT, now);
+                nrunning--;
+                progressed++;
+            } else if (!slot->killMs && slot->deadlineMs && (now >= slot->deadlineMs)) {
+                LOGWARN("task %d (pid '%d') still running after %lld ms, terminating it\n", slot->idx, slot->pid, (now - slot->startMs));
+                kill(slot->pid, SIGTERM);
+                slot->killMs = (now + FANOUT_KILL_GRACE_MS);
+                progressed++;
+            }
+        }
+
+        if (!progressed)
+            usleep(FANOUT_POLL_USEC);
+    }
+
+    // whatever is left was never started
+    for (; next < fo->numTasks; next++) {
+        idx = ((first + next) % fo->numTasks);
+        if (fo->mask && !fo->mask[idx])
+            continue;
+        if (fo->cancelled++ == 0)
+            fo->firstCancelled = idx;
+        if (fo->done)
+            fo->done(idx, EUCA_FANOUT_CANCELLED, fo->ctx);
+    }
+
+    EUCA_FREE(slots);
+
+    if (fo->timedOut || fo->cancelled) {
+        LOGWARN("fan-out deadline expired: %d tasks started, %d timed out, %d cancelled\n", fo->launched, fo->timedOut, fo->cancelled);
+    }
+    return ((fo->failed || fo->timedOut || fo->cancelled) ? EUCA_ERROR : EUCA_OK);
+}
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+#include <sys/mman.h>
+
+//! Shared between the test and its tasks
+typedef struct test_shared_t {
+    int running;                       //!< tasks running right now
+    int maxRunning;                    //!< most tasks seen running at once
+    int ran[64];                       //!< set by each task that ran to completion
+    pid_t pids[64];                    //!< the process of each task that started
+} test_shared;
+
+static test_shared *shared = NULL;
+static int sleepMs[64] = { 0 };
+static int exitCode[64] = { 0 };
+static int ignoreTerm[64] = { 0 };
+static int doneOrder[64] = { 0 };
+static int doneResult[64] = { 0 };
+static int numDone = 0;
+
+static int test_task(int idx, void *ctx)
+{
+    int running = __sync_add_and_fetch(&(shared->running), 1);
+    int seen = 0;
+
+    shared->pids[idx] = getpid();
+    if (ignoreTerm[idx])
+        signal(SIGTERM, SIG_IGN);
+    while ((seen = shared->maxRunning) < running) {
+        if (__sync_bool_compare_and_swap(&(shared->maxRunning), seen, running))
+            break;
+    }
+    usleep(sleepMs[idx] * 1000);
+    __sync_sub_and_fetch(&(shared->running), 1);
+    if (exitCode[idx] < 0)
+        abort();
+    shared->ran[idx] = 1;
+    return (exitCode[idx]);
+}
+
+static void test_done(int idx, int result, void *ctx)
+{
+    doneOrder[numDone++] = idx;
+    doneResult[idx] = result;
+}
+
+static int test_timeout(int idx, void *ctx)
+{
+    return (1);
+}
+
+static void reset(euca_fanout * fo, int numTasks)
+{
+    bzero(shared, sizeof(test_shared));
+    bzero(sleepMs, sizeof(sleepMs));
+    bzero(exitCode, sizeof(exitCode));
+    bzero(ignoreTerm, sizeof(ignoreTerm));
+    bzero(doneOrder, sizeof(doneOrder));
+    bzero(doneResult, sizeof(doneResult));
+    numDone = 0;
+    bzero(fo, sizeof(euca_fanout));
+    fo->numTasks = numTasks;
+    fo->maxRunning = 4;
+    fo->task = test_task;
+    fo->done = test_done;
+}
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    long long t = 0;
+    char mask[64] = { 0 };
+    euca_fanout fo = { 0 };
+
+    shared = mmap(NULL, sizeof(test_shared), (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_ANONYMOUS), -1, 0);
+    assert(shared != MAP_FAILED);
+    log_file_set(NULL, NULL);
+
+    assert(euca_fanout_run(NULL) == EUCA_INVALID_ERROR);
+
+    // concurrency stays bounded and every task reports back
+    reset(&fo, 32);
+    for (i = 0; i < 32; i++)
+        sleepMs[i] = 20;
+    assert(euca_fanout_run(&fo) == EUCA_OK);
+    assert((fo.launched == 32) && (fo.succeeded == 32) && (numDone == 32));
+    assert((shared->maxRunning >= 2) && (shared->maxRunning <= 4));
+    for (i = 0; i < 32; i++)
+        assert(shared->ran[i] == 1);
+
+    // results stream back as tasks finish, not in the order they started
+    reset(&fo, 4);
+    sleepMs[0] = 300;
+    assert(euca_fanout_run(&fo) == EUCA_OK);
+    assert(doneOrder[3] == 0);
+    assert(fo.slowestIdx == 0);
+
+    // masked tasks, exit codes and crashes
+    reset(&fo, 8);
+    for (i = 0; i < 8; i++)
+        mask[i] = ((i % 2) == 0);
+    fo.mask = mask;
+    exitCode[2] = 3;
+    exitCode[4] = -1;
+    assert(euca_fanout_run(&fo) == EUCA_ERROR);
+    assert((fo.launched == 4) && (fo.succeeded == 2) && (fo.failed == 2) && (numDone == 4));
+    assert((doneResult[2] == 3) && (doneResult[4] == EUCA_FANOUT_CRASHED));
+    assert((shared->ran[1] == 0) && (shared->ran[6] == 1));
+
+    // a slow task is terminated at its deadline and does not hold up the rest
+    reset(&fo, 8);
+    sleepMs[1] = 10000;
+    fo.taskTimeout = test_timeout;
+    t = fanout_now_ms();
+    assert(euca_fanout_run(&fo) == EUCA_ERROR);
+    t = (fanout_now_ms() - t);
+    assert((t >= 1000) && (t < 2500));
+    assert((fo.timedOut == 1) && (fo.succeeded == 7) && (doneResult[1] == EUCA_FANOUT_TIMEDOUT));
+    assert(doneOrder[7] == 1);
+
+    // a task that ignores SIGTERM is killed after the grace period, and is gone before the run returns
+    reset(&fo, 4);
+    sleepMs[2] = 10000;
+    ignoreTerm[2] = 1;
+    fo.taskTimeout = test_timeout;
+    t = fanout_now_ms();
+    assert(euca_fanout_run(&fo) == EUCA_ERROR);
+    t = (fanout_now_ms() - t);
+    assert((t >= (1000 + FANOUT_KILL_GRACE_MS)) && (t < (2500 + FANOUT_KILL_GRACE_MS)));
+    assert((fo.timedOut == 1) && (fo.succeeded == 3) && (doneResult[2] == EUCA_FANOUT_TIMEDOUT) && (shared->ran[2] == 0));
+    assert((kill(shared->pids[2], 0) < 0) && (errno == ESRCH));
+
+    // tasks not started by the overall deadline are cancelled
+    reset(&fo, 20);
+    for (i = 0; i < 20; i++)
+        sleepMs[i] = 600;
+    fo.maxRunning = 2;
+    fo.totalTimeout = 1;
+    t = fanout_now_ms();
+    assert(euca_fanout_run(&fo) == EUCA_ERROR);
+    t = (fanout_now_ms() - t);
+    assert(t < 2000);
+    assert((fo.launched == 4) && (fo.cancelled == 16) && (fo.succeeded == 2) && (fo.timedOut == 2) && (numDone == 20));
+    assert((doneResult[19] == EUCA_FANOUT_CANCELLED) && (fo.firstCancelled == 4));
+
+    // the next run can pick up where the cancelled one stopped
+    reset(&fo, 20);
+    fo.maxRunning = 1;
+    fo.first = 18;
+    assert(euca_fanout_run(&fo) == EUCA_OK);
+    assert((doneOrder[0] == 18) && (doneOrder[1] == 19) && (doneOrder[2] == 0) && (doneOrder[19] == 17));
+
+    printf("functional tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
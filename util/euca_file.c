@@ -114,6 +114,7 @@
 \*----------------------------------------------------------------------------*/
 
 #define BUFSIZE                                  1024
+#define ENSURE_DIRECTORIES_RESTARTS              3 //!< how many times ensure_directories_exist() starts over when a parent vanishes
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -1059,12 +1060,18 @@ void dedup_path(char *path)
 //!
 //! @return 0 = path already existed, 1 = created OK, -1 = error
 //!
+//! @note the path may be created, or emptied parts of it removed, by other
+//!       threads or processes at the same time, so a directory that appears
+//!       before it can be created is taken as is and a parent that disappears
+//!       makes the walk start over, a few times
+//!
 int ensure_directories_exist(const char *path, int is_file_path, const char *user, const char *group, mode_t mode)
 {
     int ret = 0;
     int i = 0;
     int len = strlen(path);
     int try_dir = 0;
+    int restarts = 0;
     char *path_copy = NULL;
     struct stat buf = { 0 };
 
@@ -1093,6 +1100,17 @@ int ensure_directories_exist(const char *path, int is_file_path, const char *use
                 LOGINFO("creating path %s\n", path_copy);
 
                 if (mkdir(path_copy, mode) == -1) {
+                    if (errno == EEXIST) {  // someone else created it in the meantime
+                        path_copy[i] = '/';
+                        continue;
+                    }
+                    if ((errno == ENOENT) && (restarts++ < ENSURE_DIRECTORIES_RESTARTS)) {
+                        // someone removed a parent in the meantime
+                        LOGDEBUG("parent of path %s disappeared, retrying\n", path_copy);
+                        strcpy(path_copy, path);
+                        i = -1;
+                        continue;
+                    }
                     LOGERROR("failed to create path %s: %s\n", path_copy, strerror(errno));
 
                     EUCA_FREE(path_copy);
@@ -0,0 +1,607 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_index.c
+//! Open-addressing hash index from string keys to integer slots of an array
+//! kept by the caller. Collisions are resolved with linear probing and entries
+//! are removed with backward shifting, so the index never accumulates tombstones
+//! no matter how many times the array elements are replaced.
+//!
+//! The index only stores key hashes and slot numbers. Lookups confirm candidate
+//! slots through a callback that compares the key against the caller's array, so
+//! the same slot may be indexed under several keys (e.g., public and private IP)
+//! and several slots may share a key.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eucalyptus.h>
+#include "misc.h"
+#include "euca_index.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int euca_index_buckets_for(int capacity);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Home bucket of a hash
+#define HOME_BUCKET(_idx, _hash)                 ((int)((_hash) & (u32)((_idx)->nbuckets - 1)))
+
+//! Bucket following the given one, wrapping around
+#define NEXT_BUCKET(_idx, _i)                    (((_i) + 1) & ((_idx)->nbuckets - 1))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Computes the number of buckets used for a given capacity: the smallest
+//! power of two that keeps the load factor at or below one half.
+//!
+//! @param[in] capacity the maximum number of entries
+//!
+//! @return the number of buckets
+//!
+static int euca_index_buckets_for(int capacity)
+{
+    int nbuckets = 16;
+
+    while (nbuckets < (capacity * 2))
+        nbuckets <<= 1;
+    return (nbuckets);
+}
+
+//!
+//! Hashes a key (32-bit FNV-1a)
+//!
+//! @param[in] key the NULL terminated key
+//!
+//! @return the hash of the key
+//!
+u32 euca_index_hash(const char *key)
+{
+    u32 hash = 2166136261U;
+    const unsigned char *p = NULL;
+
+    for (p = (const unsigned char *)key; p && *p; p++) {
+        hash ^= (u32) (*p);
+        hash *= 16777619U;
+    }
+    return (hash);
+}
+
+//!
+//! Computes the number of bytes needed by an index of the given capacity,
+//! header included.
+//!
+//! @param[in] capacity the maximum number of entries
+//!
+//! @return the size of the index in bytes
+//!
+size_t euca_index_size(int capacity)
+{
+    return (sizeof(euca_index) + (sizeof(euca_index_bucket) * euca_index_buckets_for(capacity)));
+}
+
+//!
+//! Initializes an empty index in caller-provided memory, which must be at
+//! least euca_index_size(capacity) bytes long.
+//!
+//! @param[in] mem the memory to use for the index
+//! @param[in] capacity the maximum number of entries
+//!
+//! @return a pointer to the index (same address as mem) or NULL on invalid parameters
+//!
+euca_index *euca_index_init(void *mem, int capacity)
+{
+    euca_index *idx = ((euca_index *) mem);
+
+    if ((idx == NULL) || (capacity < 1))
+        return (NULL);
+
+    idx->capacity = capacity;
+    idx->nbuckets = euca_index_buckets_for(capacity);
+    euca_index_clear(idx);
+    idx->magic = EUCA_INDEX_MAGIC;
+    return (idx);
+}
+
+//!
+//! Checks whether the memory holds an index that was initialized for the given
+//! capacity, e.g., after mapping a persistent shared memory segment.
+//!
+//! @param[in] idx the index to check
+//! @param[in] capacity the expected capacity
+//!
+//! @return TRUE if the index can be used as is, FALSE if it must be (re)initialized
+//!
+boolean euca_index_is_valid(euca_index * idx, int capacity)
+{
+    if (idx == NULL)
+        return (FALSE);
+    if ((idx->magic != EUCA_INDEX_MAGIC) || (idx->capacity != capacity) || (idx->nbuckets != euca_index_buckets_for(capacity)))
+        return (FALSE);
+    if ((idx->count < 0) || (idx->count > idx->capacity))
+        return (FALSE);
+    return (TRUE);
+}
+
+//!
+//! Allocates an empty index on the heap. Release it with EUCA_FREE().
+//!
+//! @param[in] capacity the initial maximum number of entries
+//!
+//! @return a pointer to the new index or NULL on failure
+//!
+euca_index *euca_index_alloc(int capacity)
+{
+    void *mem = NULL;
+
+    if (capacity < 1)
+        capacity = 1;
+    if ((mem = EUCA_ALLOC(1, euca_index_size(capacity))) == NULL)
+        return (NULL);
+    return (euca_index_init(mem, capacity));
+}
+
+//!
+//! Makes sure a heap-allocated index can hold at least 'capacity' entries,
+//! rehashing it into a larger allocation if needed. The capacity is at least
+//! doubled on growth, so inserting one entry at a time stays amortized O(1).
+//!
+//! @param[in,out] pidx pointer to the heap-allocated index, updated on growth
+//! @param[in]     capacity the number of entries needed
+//!
+//! @return EUCA_OK on success, EUCA_MEMORY_ERROR if the new index cannot be allocated
+//!         or EUCA_INVALID_ERROR on invalid parameters
+//!
+int euca_index_reserve(euca_index ** pidx, int capacity)
+{
+    int i = 0;
+    int j = 0;
+    int newcap = 0;
+    euca_index *idx = NULL;
+    euca_index *bigger = NULL;
+
+    if ((pidx == NULL) || (*pidx == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    idx = *pidx;
+    if (capacity <= idx->capacity)
+        return (EUCA_OK);
+
+    newcap = idx->capacity * 2;
+    if (newcap < capacity)
+        newcap = capacity;
+
+    if ((bigger = euca_index_alloc(newcap)) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    for (i = 0; i < idx->nbuckets; i++) {
+        if (idx->buckets[i].value == 0)
+            continue;
+        for (j = HOME_BUCKET(bigger, idx->buckets[i].hash); bigger->buckets[j].value != 0; j = NEXT_BUCKET(bigger, j)) ;
+        bigger->buckets[j] = idx->buckets[i];
+        bigger->count++;
+    }
+
+    EUCA_FREE(idx);
+    *pidx = bigger;
+    return (EUCA_OK);
+}
+
+//!
+//! Removes all entries from the index
+//!
+//! @param[in] idx the index to clear
+//!
+void euca_index_clear(euca_index * idx)
+{
+    if (idx) {
+        bzero(idx->buckets, (sizeof(euca_index_bucket) * idx->nbuckets));
+        idx->count = 0;
+    }
+}
+
+//!
+//! Adds a key -> slot mapping to the index. Adding a mapping that is already
+//! present is a no-op.
+//!
+//! @param[in] idx the index
+//! @param[in] key the key
+//! @param[in] slot the array slot the key maps to (>= 0)
+//!
+//! @return EUCA_OK on success, EUCA_ERROR if the index is full or EUCA_INVALID_ERROR
+//!         on invalid parameters
+//!
+int euca_index_insert(euca_index * idx, const char *key, int slot)
+{
+    int i = 0;
+    u32 hash = 0;
+
+    if ((idx == NULL) || (key == NULL) || (slot < 0))
+        return (EUCA_INVALID_ERROR);
+
+    hash = euca_index_hash(key);
+    for (i = HOME_BUCKET(idx, hash); idx->buckets[i].value != 0; i = NEXT_BUCKET(idx, i)) {
+        if ((idx->buckets[i].hash == hash) && (idx->buckets[i].value == (slot + 1)))
+            return (EUCA_OK);
+    }
+
+    if (idx->count >= idx->capacity)
+        return (EUCA_ERROR);
+
+    idx->buckets[i].hash = hash;
+    idx->buckets[i].value = (slot + 1);
+    idx->count++;
+    return (EUCA_OK);
+}
+
+//!
+//! Removes a key -> slot mapping from the index, shifting the following entries
+//! of the probe sequence back so that lookups never have to skip deleted buckets.
+//!
+//! @param[in] idx the index
+//! @param[in] key the key, as it was when the mapping was inserted
+//! @param[in] slot the array slot the key maps to
+//!
+//! @return EUCA_OK if the mapping was removed, EUCA_NOT_FOUND_ERROR if it was not
+//!         in the index or EUCA_INVALID_ERROR on invalid parameters
+//!
+int euca_index_remove(euca_index * idx, const char *key, int slot)
+{
+    int i = 0;
+    int j = 0;
+    int home = 0;
+    u32 hash = 0;
+
+    if ((idx == NULL) || (key == NULL) || (slot < 0))
+        return (EUCA_INVALID_ERROR);
+
+    hash = euca_index_hash(key);
+    for (i = HOME_BUCKET(idx, hash); idx->buckets[i].value != 0; i = NEXT_BUCKET(idx, i)) {
+        if ((idx->buckets[i].hash == hash) && (idx->buckets[i].value == (slot + 1)))
+            break;
+    }
+
+    if (idx->buckets[i].value == 0)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    // shift back every following entry whose home bucket does not lie in (i, j]
+    for (j = NEXT_BUCKET(idx, i); idx->buckets[j].value != 0; j = NEXT_BUCKET(idx, j)) {
+        home = HOME_BUCKET(idx, idx->buckets[j].hash);
+        if ((i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j))) {
+            idx->buckets[i] = idx->buckets[j];
+            i = j;
+        }
+    }
+
+    idx->buckets[i].hash = 0;
+    idx->buckets[i].value = 0;
+    idx->count--;
+    return (EUCA_OK);
+}
+
+//!
+//! Looks up the slots mapped to a key. Each call returns the next matching slot
+//! after the position saved in 'cursor', so all the slots sharing a key can be
+//! visited by calling it until it returns -1.
+//!
+//! @param[in]     idx the index
+//! @param[in]     key the key to look up
+//! @param[in]     match callback confirming that a candidate slot really holds the key
+//! @param[in]     ctx opaque pointer handed to the callback
+//! @param[in,out] cursor iteration state, must be set to 0 before the first call (may be NULL)
+//!
+//! @return the next matching slot or -1 if there are no more
+//!
+int euca_index_find(euca_index * idx, const char *key, euca_index_match_fn match, void *ctx, int *cursor)
+{
+    int i = 0;
+    int probes = 0;
+    int slot = -1;
+    u32 hash = 0;
+
+    if ((idx == NULL) || (key == NULL) || (match == NULL) || (idx->count == 0))
+        return (-1);
+
+    hash = euca_index_hash(key);
+    probes = ((cursor != NULL) ? (*cursor) : 0);
+    for (i = ((HOME_BUCKET(idx, hash) + probes) & (idx->nbuckets - 1)); (probes < idx->nbuckets) && (idx->buckets[i].value != 0); i = NEXT_BUCKET(idx, i)) {
+        probes++;
+        if (idx->buckets[i].hash == hash) {
+            slot = (idx->buckets[i].value - 1);
+            if (match(slot, key, ctx)) {
+                if (cursor)
+                    *cursor = probes;
+                return (slot);
+            }
+        }
+    }
+
+    if (cursor)
+        *cursor = probes;
+    return (-1);
+}
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+#include <sys/time.h>
+
+//! Stand-in for a cache array element
+typedef struct test_elem_t {
+    char id[16];
+    char ip[16];
+} test_elem;
+
+static test_elem *elems = NULL;
+
+static boolean id_match(int slot, const char *key, void *ctx)
+{
+    return ((strcmp(((test_elem *) ctx)[slot].id, key) == 0) ? TRUE : FALSE);
+}
+
+static boolean ip_match(int slot, const char *key, void *ctx)
+{
+    return ((strcmp(((test_elem *) ctx)[slot].ip, key) == 0) ? TRUE : FALSE);
+}
+
+static int linear_find(int n, const char *id)
+{
+    int i = 0;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(elems[i].id, id))
+            return (i);
+    }
+    return (-1);
+}
+
+static double now_usec(void)
+{
+    struct timeval tv = { 0 };
+
+    gettimeofday(&tv, NULL);
+    return ((tv.tv_sec * 1000000.0) + tv.tv_usec);
+}
+
+//!
+//! Measures lookups and a full refresh (one lookup and one re-index per element,
+//! as done by refresh_instances()) with linear scans and with the index.
+//!
+static void benchmark(int n)
+{
+    int i = 0;
+    int lookups = 10000;
+    double t = 0.0;
+    double linear_lookup = 0.0;
+    double index_lookup = 0.0;
+    double linear_refresh = 0.0;
+    double index_refresh = 0.0;
+    volatile int sink = 0;
+    euca_index *idx = NULL;
+
+    elems = EUCA_ZALLOC(n, sizeof(test_elem));
+    assert(elems != NULL);
+    assert((idx = euca_index_init(EUCA_ALLOC(1, euca_index_size(n)), n)) != NULL);
+    for (i = 0; i < n; i++) {
+        snprintf(elems[i].id, sizeof(elems[i].id), "i-%08X", (u32) (i * 2654435761U));
+        assert(euca_index_insert(idx, elems[i].id, i) == EUCA_OK);
+    }
+
+    t = now_usec();
+    for (i = 0; i < lookups; i++)
+        sink += linear_find(n, elems[(i * 7919) % n].id);
+    linear_lookup = (now_usec() - t) / lookups;
+
+    t = now_usec();
+    for (i = 0; i < lookups; i++)
+        sink += euca_index_find(idx, elems[(i * 7919) % n].id, id_match, elems, NULL);
+    index_lookup = (now_usec() - t) / lookups;
+
+    t = now_usec();
+    for (i = 0; i < n; i++)
+        sink += linear_find(n, elems[i].id);
+    linear_refresh = (now_usec() - t) / 1000.0;
+
+    t = now_usec();
+    for (i = 0; i < n; i++) {
+        sink += euca_index_find(idx, elems[i].id, id_match, elems, NULL);
+        euca_index_remove(idx, elems[i].id, i);
+        euca_index_insert(idx, elems[i].id, i);
+    }
+    index_refresh = (now_usec() - t) / 1000.0;
+
+    printf("%6d instances: lookup %10.3f usec linear %8.3f usec indexed | refresh %10.3f msec linear %8.3f msec indexed\n",
+           n, linear_lookup, index_lookup, linear_refresh, index_refresh);
+
+    EUCA_FREE(idx);
+    EUCA_FREE(elems);
+}
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int cursor = 0;
+    int found = 0;
+    int n = 1000;
+    char key[16] = "";
+    euca_index *idx = NULL;
+
+    // functional checks
+    elems = EUCA_ZALLOC(n, sizeof(test_elem));
+    assert(elems != NULL);
+    assert((idx = euca_index_alloc(4)) != NULL);
+    for (i = 0; i < n; i++) {
+        snprintf(elems[i].id, sizeof(elems[i].id), "i-%08d", i);
+        snprintf(elems[i].ip, sizeof(elems[i].ip), "10.0.%d.%d", (i % 10), (i / 10));
+        assert(euca_index_reserve(&idx, (idx->count + 1)) == EUCA_OK);
+        assert(euca_index_insert(idx, elems[i].id, i) == EUCA_OK);
+        assert(euca_index_insert(idx, elems[i].id, i) == EUCA_OK);  // duplicates are ignored
+    }
+    assert(idx->count == n);
+    for (i = 0; i < n; i++)
+        assert(euca_index_find(idx, elems[i].id, id_match, elems, NULL) == i);
+    assert(euca_index_find(idx, "i-nothere", id_match, elems, NULL) == -1);
+
+    // remove every other entry and make sure the rest is still reachable
+    for (i = 0; i < n; i += 2)
+        assert(euca_index_remove(idx, elems[i].id, i) == EUCA_OK);
+    assert(euca_index_remove(idx, elems[0].id, 0) == EUCA_NOT_FOUND_ERROR);
+    assert(idx->count == (n / 2));
+    for (i = 0; i < n; i++)
+        assert(euca_index_find(idx, elems[i].id, id_match, elems, NULL) == (((i % 2) == 0) ? -1 : i));
+    EUCA_FREE(idx);
+
+    // fixed capacity index with several slots per key
+    assert((idx = euca_index_init(EUCA_ALLOC(1, euca_index_size(8)), 8)) != NULL);
+    assert(euca_index_is_valid(idx, 8) == TRUE);
+    assert(euca_index_is_valid(idx, 16) == FALSE);
+    for (i = 0; i < 8; i++) {
+        snprintf(elems[i].ip, sizeof(elems[i].ip), "10.0.0.%d", (i % 2));
+        assert(euca_index_insert(idx, elems[i].ip, i) == EUCA_OK);
+    }
+    assert(euca_index_insert(idx, "10.0.0.9", 9) == EUCA_ERROR);    // full
+    snprintf(key, sizeof(key), "10.0.0.1");
+    for (cursor = 0, found = 0; (i = euca_index_find(idx, key, ip_match, elems, &cursor)) >= 0; found++)
+        assert((i % 2) == 1);
+    assert(found == 4);
+    EUCA_FREE(idx);
+    EUCA_FREE(elems);
+    printf("functional tests passed\n");
+
+    if ((argc > 1) && !strcmp(argv[1], "-b")) {
+        benchmark(1000);
+        benchmark(10000);
+        benchmark(50000);
+    }
+    return (0);
+}
+#endif /* _UNIT_TEST */
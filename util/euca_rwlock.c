@@ -0,0 +1,413 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_rwlock.c
+//! Reader/writer lock that can be shared between processes through a shared
+//! memory segment, with counters measuring how much it is contended.
+//!
+//! Readers run in parallel with each other and only wait for writers. Writers
+//! are preferred where the C library allows it, so a steady stream of readers
+//! cannot starve the thread that refreshes the data. Every acquisition first
+//! tries the lock without blocking, so that only the callers that actually had
+//! to wait are counted as contended and timed.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <eucalyptus.h>
+#include "misc.h"
+#include "euca_rwlock.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static u64 monotonic_usec(void);
+static void stat_max(u64 * max, u64 value);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Atomically adds to a shared counter
+#define STAT_ADD(_counter, _value)               __sync_fetch_and_add(&(_counter), (_value))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Reads a clock that does not jump with system time changes
+//!
+//! @return the current monotonic time in microseconds
+//!
+static u64 monotonic_usec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((u64) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+//!
+//! Atomically raises a shared maximum
+//!
+//! @param[in,out] max the maximum to raise
+//! @param[in]     value the new candidate value
+//!
+static void stat_max(u64 * max, u64 value)
+{
+    u64 old = *max;
+
+    while ((value > old) && !__sync_bool_compare_and_swap(max, old, value))
+        old = *max;
+}
+
+//!
+//! Initializes a lock located in shared memory. Must be called by a single process,
+//! before any other process uses the lock.
+//!
+//! @param[in] rwl the lock to initialize
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on invalid parameter or EUCA_ERROR
+//!         if the lock cannot be initialized
+//!
+int euca_rwlock_init(euca_rwlock * rwl)
+{
+    int rc = 0;
+    pthread_rwlockattr_t attr = { {0} };
+
+    if (rwl == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    bzero(rwl, sizeof(euca_rwlock));
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif /* __GLIBC__ */
+    rc = pthread_rwlock_init(&(rwl->lock), &attr);
+    pthread_rwlockattr_destroy(&attr);
+    if (rc != 0) {
+        LOGERROR("cannot initialize reader/writer lock: %s\n", strerror(rc));
+        return (EUCA_ERROR);
+    }
+
+    rwl->magic = EUCA_RWLOCK_MAGIC;
+    return (EUCA_OK);
+}
+
+//!
+//! Checks whether a lock in shared memory was initialized
+//!
+//! @param[in] rwl the lock to check
+//!
+//! @return TRUE if euca_rwlock_init() was called on the lock, FALSE otherwise
+//!
+boolean euca_rwlock_is_initialized(euca_rwlock * rwl)
+{
+    return (((rwl != NULL) && (rwl->magic == EUCA_RWLOCK_MAGIC)) ? TRUE : FALSE);
+}
+
+//!
+//! Takes the lock for reading, waiting for any writer to release it
+//!
+//! @param[in] rwl the lock
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int euca_rwlock_rdlock(euca_rwlock * rwl)
+{
+    int rc = 0;
+    u64 start = 0;
+
+    if ((rc = pthread_rwlock_tryrdlock(&(rwl->lock))) == EBUSY) {
+        start = monotonic_usec();
+        rc = pthread_rwlock_rdlock(&(rwl->lock));
+        STAT_ADD(rwl->stats.rd_contended, 1);
+        STAT_ADD(rwl->stats.rd_wait_usec, (monotonic_usec() - start));
+    }
+
+    if (rc != 0) {
+        LOGERROR("cannot take reader lock: %s\n", strerror(rc));
+        return (EUCA_ERROR);
+    }
+    STAT_ADD(rwl->stats.rd_acquired, 1);
+    return (EUCA_OK);
+}
+
+//!
+//! Takes the lock for writing, waiting for all readers and any writer to release it
+//!
+//! @param[in] rwl the lock
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int euca_rwlock_wrlock(euca_rwlock * rwl)
+{
+    int rc = 0;
+    u64 start = 0;
+
+    if ((rc = pthread_rwlock_trywrlock(&(rwl->lock))) == EBUSY) {
+        start = monotonic_usec();
+        rc = pthread_rwlock_wrlock(&(rwl->lock));
+        STAT_ADD(rwl->stats.wr_contended, 1);
+        STAT_ADD(rwl->stats.wr_wait_usec, (monotonic_usec() - start));
+    }
+
+    if (rc != 0) {
+        LOGERROR("cannot take writer lock: %s\n", strerror(rc));
+        return (EUCA_ERROR);
+    }
+    STAT_ADD(rwl->stats.wr_acquired, 1);
+    rwl->wr_since_usec = monotonic_usec();
+    return (EUCA_OK);
+}
+
+//!
+//! Releases a lock taken with euca_rwlock_rdlock()
+//!
+//! @param[in] rwl the lock
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int euca_rwlock_rdunlock(euca_rwlock * rwl)
+{
+    return ((pthread_rwlock_unlock(&(rwl->lock)) == 0) ? EUCA_OK : EUCA_ERROR);
+}
+
+//!
+//! Releases a lock taken with euca_rwlock_wrlock(), publishing a new generation
+//! of the data it protects
+//!
+//! @param[in] rwl the lock
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int euca_rwlock_wrunlock(euca_rwlock * rwl)
+{
+    u64 held = 0;
+
+    held = (monotonic_usec() - rwl->wr_since_usec);
+    rwl->stats.wr_hold_usec += held;   // the writer is alone, no need for atomics
+    stat_max(&(rwl->stats.wr_hold_max_usec), held);
+    rwl->stats.generation++;
+    return ((pthread_rwlock_unlock(&(rwl->lock)) == 0) ? EUCA_OK : EUCA_ERROR);
+}
+
+//!
+//! Copies the counters of a lock. The copy is not taken under the lock, so the
+//! counters may be slightly out of step with each other.
+//!
+//! @param[in]  rwl the lock
+//! @param[out] out where to copy the counters
+//!
+void euca_rwlock_get_stats(euca_rwlock * rwl, euca_rwlock_stats * out)
+{
+    if (rwl && out) {
+        __sync_synchronize();
+        memcpy(out, &(rwl->stats), sizeof(euca_rwlock_stats));
+    }
+}
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define NB_READERS                               4
+#define NB_ROUNDS                                2000
+
+//! Data protected by the lock in the test, both values must always be equal
+typedef struct test_shared_t {
+    euca_rwlock rwl;
+    volatile long a;
+    volatile long b;
+    volatile long torn;
+} test_shared;
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int status = 0;
+    pid_t pid = 0;
+    euca_rwlock_stats stats = { 0 };
+    test_shared *shared = NULL;
+
+    shared = mmap(NULL, sizeof(test_shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(shared != MAP_FAILED);
+    assert(euca_rwlock_is_initialized(&(shared->rwl)) == FALSE);
+    assert(euca_rwlock_init(&(shared->rwl)) == EUCA_OK);
+    assert(euca_rwlock_is_initialized(&(shared->rwl)) == TRUE);
+
+    // readers can share the lock
+    assert(euca_rwlock_rdlock(&(shared->rwl)) == EUCA_OK);
+    assert(euca_rwlock_rdlock(&(shared->rwl)) == EUCA_OK);
+    assert(pthread_rwlock_trywrlock(&(shared->rwl.lock)) == EBUSY);
+    assert(euca_rwlock_rdunlock(&(shared->rwl)) == EUCA_OK);
+    assert(euca_rwlock_rdunlock(&(shared->rwl)) == EUCA_OK);
+
+    // one writer and several reader processes hammer the lock, readers must never see a torn update
+    for (i = 0; i < NB_READERS; i++) {
+        if ((pid = fork()) == 0) {
+            int j = 0;
+
+            for (j = 0; j < NB_ROUNDS; j++) {
+                euca_rwlock_rdlock(&(shared->rwl));
+                if (shared->a != shared->b)
+                    __sync_fetch_and_add(&(shared->torn), 1);
+                euca_rwlock_rdunlock(&(shared->rwl));
+            }
+            exit(0);
+        }
+    }
+
+    for (i = 0; i < NB_ROUNDS; i++) {
+        euca_rwlock_wrlock(&(shared->rwl));
+        shared->a++;
+        usleep(1);
+        shared->b++;
+        euca_rwlock_wrunlock(&(shared->rwl));
+    }
+
+    while (wait(&status) > 0) ;
+
+    euca_rwlock_get_stats(&(shared->rwl), &stats);
+    assert(shared->torn == 0);
+    assert(stats.generation == NB_ROUNDS);
+    assert(stats.wr_acquired == NB_ROUNDS);
+    assert(stats.rd_acquired == (2 + (NB_READERS * NB_ROUNDS)));
+    printf("reads=%llu (contended %llu, waited %llu usec) writes=%llu (contended %llu, waited %llu usec, held %llu usec, max %llu usec)\n",
+           (unsigned long long)stats.rd_acquired, (unsigned long long)stats.rd_contended, (unsigned long long)stats.rd_wait_usec,
+           (unsigned long long)stats.wr_acquired, (unsigned long long)stats.wr_contended, (unsigned long long)stats.wr_wait_usec,
+           (unsigned long long)stats.wr_hold_usec, (unsigned long long)stats.wr_hold_max_usec);
+    printf("all tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
@@ -214,6 +214,10 @@
 #define CONFIG_NODES                            "NODES"
 #define CONFIG_HYPERVISOR                       "HYPERVISOR"
 #define CONFIG_NC_CACHE_SIZE                    "NC_CACHE_SIZE"
+#define CONFIG_NC_CACHE_RECLAIM_HIGH            "NC_CACHE_RECLAIM_HIGH"
+#define CONFIG_NC_CACHE_RECLAIM_LOW             "NC_CACHE_RECLAIM_LOW"
+#define CONFIG_NC_CACHE_DEDUP                   "NC_CACHE_DEDUP"
+#define CONFIG_NC_EPHEMERAL_POOL                "NC_EPHEMERAL_POOL"
 #define CONFIG_NC_WORK_SIZE                     "NC_WORK_SIZE"
 #define CONFIG_NC_OVERHEAD_SIZE                 "NC_WORK_OVERHEAD_SIZE"
 #define CONFIG_NC_SWAP_SIZE                     "SWAP_SIZE"
@@ -239,9 +243,14 @@
 #define CONFIG_SHUTDOWN_GRACE_PERIOD_SEC        "NC_SHUTDOWN_GRACE_PERIOD_SEC"
 #define CONFIG_ENABLE_WS_SECURITY				"ENABLE_WS_SECURITY"
 #define CONFIG_WALRUS_DOWNLOAD_MAX_ATTEMPTS     "WALRUS_DOWNLOAD_MAX_ATTEMPTS"
+#define CONFIG_WALRUS_DOWNLOAD_PARALLEL_PARTS   "WALRUS_DOWNLOAD_PARALLEL_PARTS"
+#define CONFIG_WALRUS_DOWNLOAD_PART_SIZE        "WALRUS_DOWNLOAD_PART_SIZE"
 #define CONFIG_NC_CEPH_USER                     "CEPH_USER_NAME"
 #define CONFIG_NC_CEPH_KEYS                     "CEPH_KEYRING_PATH"
 #define CONFIG_NC_CEPH_CONF                     "CEPH_CONFIG_PATH"
+#define CONFIG_NC_PUSH_ENABLE                   "NC_PUSH_ENABLE"
+#define CONFIG_NC_PUSH_PORT                     "NC_PUSH_PORT"
+#define CONFIG_NC_ANTI_ENTROPY_INTERVAL         "NC_ANTI_ENTROPY_INTERVAL"
 
 //! @}
 
@@ -228,8 +228,6 @@ int hash_b64enc_string(const char *in, char **out)
 //!
 int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
 {
-    u32 i = 0;
-    char *pBuf = NULL;
     u8 md5digest[MD5_DIGEST_LENGTH + 1] = { 0 };    // +1 for NULL termination.
 
     // Make sure our parameters are valid
@@ -247,10 +245,41 @@ int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
     if (MD5(((const u8 *)sValue), strlen(sValue), md5digest) == NULL)
         return (EUCA_ERROR);
 
+    // Convert the computed hash to readable hex values
+    return (md5digest2str(sBuf, bufSize, md5digest));
+}
+
+//!
+//! Places an MD5 digest, such as one computed incrementally with MD5_Update()
+//! while the data went by, into 'sBuf' in human readable hex values (same as `md5sum`)
+//!
+//! @param[in,out] sBuf      the string buffer that contains the result
+//! @param[in]     bufSize   the size of our output string buffer
+//! @param[in]     md5digest the MD5_DIGEST_LENGTH bytes of the digest
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR if the given paramters do not match our pre-conditions
+//!         \li EUCA_NO_SPACE_ERROR if the provided sBuf is not big enough to contain the data
+//!
+//! @pre \li Both sBuf and md5digest fields must not be NULL
+//!      \li sBuf should be big enough to contain MD5_STR_SIZE characters.
+//!
+int md5digest2str(char *sBuf, u32 bufSize, const u8 * md5digest)
+{
+    u32 i = 0;
+    char *pBuf = NULL;
+
+    // Make sure our parameters are valid
+    if (!sBuf || !md5digest)
+        return (EUCA_INVALID_ERROR);
+
+    // Make sure we have enough space to write the hash in the given buffer
+    if (bufSize < MD5_STR_SIZE)
+        return (EUCA_NO_SPACE_ERROR);
+
     // zero out the buffer
     bzero(sBuf, bufSize);
 
-    // Convert the computed hash to readable hex values
     for (i = 0, pBuf = sBuf; i < MD5_DIGEST_LENGTH; i++, pBuf += 2) {
         sprintf(pBuf, "%02x", md5digest[i]);
     }
@@ -83,6 +83,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MD5_STR_SIZE                                 33 //!< size of a buffer for the hex string of an MD5 digest, including the terminating NULL
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +118,7 @@
 int hash_b64enc_string(const char *in, char **out);
 
 int str2md5str(char *sBuf, u32 bufSize, const char *sValue);
+int md5digest2str(char *sBuf, u32 bufSize, const u8 * md5digest);
 
 char *file2md5str(const char *path);
 
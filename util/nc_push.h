@@ -0,0 +1,254 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_NC_PUSH_H_
+#define _INCLUDE_NC_PUSH_H_
+
+//!
+//! @file util/nc_push.h
+//! Datagram channel on which a NC pushes changes of its instances and resources
+//! to the CC, so that the CC does not have to poll every node for them. Every
+//! datagram ends with an HMAC over the rest of it, keyed from the key the CC and
+//! its nodes already share, so the CC does not take the source address on trust.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <time.h>
+#include <netinet/in.h>
+
+#include "misc.h"                      // boolean, u32
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define NC_PUSH_MAGIC                            0x48535550 //!< "PUSH", first word of every datagram
+#define NC_PUSH_VERSION                          2  //!< wire format version
+#define NC_PUSH_DEFAULT_PORT                     8779   //!< UDP port on which the CC listens by default
+#define NC_PUSH_HEARTBEAT_SEC                    10 //!< a NC sends at least one datagram this often
+#define NC_PUSH_MAX_DATAGRAM                     1400   //!< datagrams are kept below a typical MTU
+#define NC_PUSH_KEY_LEN                          32 //!< size of the key datagrams are authenticated with
+#define NC_PUSH_MAC_LEN                          32 //!< size of the HMAC-SHA256 trailing every datagram
+#define NC_PUSH_KEY_FILE                         EUCALYPTUS_KEYS_DIR "/node-pk.pem" //!< the key the CC and its nodes share, the push key is derived from it
+
+//! @{
+//! @name Sizes of the fields of an instance record
+#define NC_PUSH_ID_LEN                           16
+#define NC_PUSH_STATE_LEN                        16
+#define NC_PUSH_TASK_LEN                         32
+#define NC_PUSH_IP_LEN                           16
+//! @}
+
+//! @{
+//! @name Flags of an instance record
+#define NC_PUSH_REMOVED                          0x0001 //!< the NC no longer knows about the instance
+#define NC_PUSH_PULL                             0x0002 //!< something the record does not carry has changed, describe the node
+//! @}
+
+//! Largest number of instance records a single datagram carries
+#define NC_PUSH_MAX_RECORDS                      ((NC_PUSH_MAX_DATAGRAM - sizeof(nc_push_header) - sizeof(nc_push_resource) - NC_PUSH_MAC_LEN) / sizeof(nc_push_instance))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! What the receiver makes of the sequence number of a datagram
+enum {
+    NC_PUSH_IN_ORDER = 0,              //!< the next datagram of the current epoch
+    NC_PUSH_GAP,                       //!< datagrams were lost, the node must be described
+    NC_PUSH_RESTART,                   //!< first datagram of a new epoch (sender restarted)
+    NC_PUSH_STALE,                     //!< duplicate or late datagram, to be dropped
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Datagram header, integers are in network byte order on the wire
+typedef struct nc_push_header_t {
+    u32 magic;                         //!< NC_PUSH_MAGIC
+    u32 version;                       //!< NC_PUSH_VERSION
+    u32 epoch;                         //!< changes every time the sender is (re)started
+    u32 seq;                           //!< sequence number within the epoch, starting at 1
+    u32 numInstances;                  //!< number of instance records following the resource record
+    u32 reserved;
+} nc_push_header;
+
+//! Resources of the node, included in every datagram
+typedef struct nc_push_resource_t {
+    u32 memMax;
+    u32 memAvail;
+    u32 diskMax;
+    u32 diskAvail;
+    u32 coresMax;
+    u32 coresAvail;
+    char nodeStatus[24];
+} nc_push_resource;
+
+//! The parts of an instance that change over its life time
+typedef struct nc_push_instance_t {
+    char instanceId[NC_PUSH_ID_LEN];
+    char stateName[NC_PUSH_STATE_LEN];
+    char guestStateName[NC_PUSH_TASK_LEN];
+    char bundleTaskStateName[NC_PUSH_TASK_LEN];
+    char createImageTaskStateName[NC_PUSH_TASK_LEN];
+    char publicIp[NC_PUSH_IP_LEN];
+    char privateIp[NC_PUSH_IP_LEN];
+    u32 bundleTaskProgress;            //!< progress in thousandths
+    u32 digest;                        //!< hash of the fields the record does not carry
+    u32 flags;                         //!< NC_PUSH_REMOVED, NC_PUSH_PULL
+} nc_push_instance;
+
+//! A decoded datagram
+typedef struct nc_push_message_t {
+    nc_push_header hdr;
+    nc_push_resource res;
+    nc_push_instance instances[NC_PUSH_MAX_DATAGRAM / sizeof(nc_push_instance)];
+} nc_push_message;
+
+//! Sequence tracking the receiver keeps for each sender
+typedef struct nc_push_peer_t {
+    u32 epoch;
+    u32 seq;
+    time_t lastSeen;                   //!< when the last datagram was accepted
+} nc_push_peer;
+
+//! Sending side, remembers what it has sent so that it only sends changes
+typedef struct nc_push_sender_t {
+    int fd;                            //!< UDP socket, -1 when closed
+    struct sockaddr_in peer;           //!< address of the CC
+    u32 epoch;
+    u32 seq;
+    unsigned char key[NC_PUSH_KEY_LEN];    //!< authenticates the datagrams, see nc_push_key_load()
+    time_t lastSent;                   //!< when the last datagram was sent
+    boolean haveResource;              //!< whether sentResource holds what was sent last
+    nc_push_resource sentResource;
+    nc_push_instance *sent;            //!< last records sent, one per instance the CC knows from us
+    int sentLen;
+    int sentMax;
+    long long datagrams;               //!< datagrams sent since the sender was initialized
+    long long records;                 //!< instance records sent since the sender was initialized
+} nc_push_sender;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+u32 nc_push_digest(u32 hash, const void *buf, size_t len);
+int nc_push_key_load(const char *path, unsigned char *key);
+
+int nc_push_sender_init(nc_push_sender * s, const char *bindIp, const unsigned char *key);
+int nc_push_sender_connect(nc_push_sender * s, const char *host, int port);
+void nc_push_sender_close(nc_push_sender * s);
+int nc_push_send_state(nc_push_sender * s, const nc_push_resource * res, const nc_push_instance * insts, int instsLen, boolean force);
+
+int nc_push_listen(const char *bindIp, int port);
+int nc_push_recv(int fd, const unsigned char *key, int timeoutMs, nc_push_message * msg, char *fromIp, int fromIpLen);
+int nc_push_peer_accept(nc_push_peer * peer, const nc_push_header * hdr);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_NC_PUSH_H_ */
@@ -0,0 +1,916 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/sched_engine.c
+//! Capacity index used by the CC scheduler. Every node that can run instances
+//! is kept in exactly one bucket, chosen by its tier (ready or standby) and its
+//! number of free cores. Each bucket is a bitmap over the node numbers with a
+//! second, smaller bitmap telling which of its words are non-zero, so walking a
+//! bucket in node order skips empty stretches 64 words at a time.
+//!
+//! A placement starts at the bucket of the requested core count and only looks
+//! at non-empty buckets from there on, checking memory and disk of the nodes it
+//! visits. Placing an instance moves its node to a lower bucket in O(1).
+//!
+//! All policies are deterministic, ties always go to the lowest node number,
+//! which keeps the results identical to a linear scan of the nodes (the unit
+//! test checks exactly that).
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <eucalyptus.h>
+#include "misc.h"
+#include "sched_engine.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define SCHED_RR_PROBES                          8  //!< nodes checked one by one from the round-robin cursor before using the buckets
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int sched_bucket_for(int cores);
+static void sched_index_add(sched_index * idx, int node);
+static void sched_index_del(sched_index * idx, int node);
+static int sched_bucket_next(sched_index * idx, int tier, int b, int from);
+static int sched_bucket_up(sched_index * idx, int tier, int b);
+static int sched_bucket_down(sched_index * idx, int tier, int b);
+static int sched_bucket_first_fit(sched_index * idx, int tier, int b, int from, int to, const sched_capacity * req);
+static int sched_bucket_extreme_fit(sched_index * idx, int tier, int b, const sched_capacity * req, boolean most);
+static int sched_first_fit(sched_index * idx, int tier, int from, int to, const sched_capacity * req);
+static int sched_best_fit(sched_index * idx, int tier, const sched_capacity * req);
+static int sched_spread(sched_index * idx, int tier, const sched_capacity * req);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Node bitmap of a bucket
+#define BUCKET_BITS(_idx, _tier, _b)             ((_idx)->bits + ((((_tier) * SCHED_CORE_BUCKETS) + (_b)) * (_idx)->words))
+
+//! Summary bitmap of a bucket
+#define BUCKET_SUMMARY(_idx, _tier, _b)          ((_idx)->summary + ((((_tier) * SCHED_CORE_BUCKETS) + (_b)) * (_idx)->summaryWords))
+
+//! Tier of a node state, only meaningful for indexed states
+#define TIER_OF(_state)                          (((_state) == SCHED_NODE_READY) ? 0 : 1)
+
+//! Tells whether the free capacity of a node covers a request
+#define NODE_FITS(_idx, _node, _req)             (((_idx)->avail[(_node)].cores >= (_req)->cores) && ((_idx)->avail[(_node)].mem >= (_req)->mem) && \
+                                                  ((_idx)->avail[(_node)].disk >= (_req)->disk))
+
+//! Index of the lowest set bit of a non-zero word
+#define LOWEST_BIT(_word)                        (__builtin_ctzll(_word))
+
+//! Index of the highest set bit of a non-zero word
+#define HIGHEST_BIT(_word)                       (63 - __builtin_clzll(_word))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Maps a number of free cores to its bucket
+//!
+//! @param[in] cores the number of free cores
+//!
+//! @return the bucket number
+//!
+static int sched_bucket_for(int cores)
+{
+    if (cores < 0)
+        return (0);
+    if (cores >= (SCHED_CORE_BUCKETS - 1))
+        return (SCHED_CORE_BUCKETS - 1);
+    return (cores);
+}
+
+//!
+//! Adds a node to the bucket matching its state and free cores. The node
+//! must not be indexed already and must not be offline.
+//!
+//! @param[in] idx the index
+//! @param[in] node the node number
+//!
+static void sched_index_add(sched_index * idx, int node)
+{
+    int tier = TIER_OF(idx->state[node]);
+    int b = sched_bucket_for(idx->avail[node].cores);
+    int w = (node >> 6);
+    uint64_t *bits = BUCKET_BITS(idx, tier, b);
+
+    if (bits[w] == 0)
+        BUCKET_SUMMARY(idx, tier, b)[w >> 6] |= (1ULL << (w & 63));
+    bits[w] |= (1ULL << (node & 63));
+    if (idx->count[tier][b]++ == 0)
+        idx->nonempty[tier][b >> 6] |= (1ULL << (b & 63));
+    idx->bucket[node] = b;
+}
+
+//!
+//! Removes a node from its bucket. The node must be indexed.
+//!
+//! @param[in] idx the index
+//! @param[in] node the node number
+//!
+static void sched_index_del(sched_index * idx, int node)
+{
+    int tier = TIER_OF(idx->state[node]);
+    int b = idx->bucket[node];
+    int w = (node >> 6);
+    uint64_t *bits = BUCKET_BITS(idx, tier, b);
+
+    bits[w] &= ~(1ULL << (node & 63));
+    if (bits[w] == 0)
+        BUCKET_SUMMARY(idx, tier, b)[w >> 6] &= ~(1ULL << (w & 63));
+    if (--idx->count[tier][b] == 0)
+        idx->nonempty[tier][b >> 6] &= ~(1ULL << (b & 63));
+    idx->bucket[node] = -1;
+}
+
+//!
+//! Finds the lowest numbered node of a bucket at or after a given node number
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier of the bucket
+//! @param[in] b the bucket number
+//! @param[in] from the first node number to consider
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_bucket_next(sched_index * idx, int tier, int b, int from)
+{
+    int w = 0;
+    int sw = 0;
+    uint64_t word = 0;
+    uint64_t sword = 0;
+    uint64_t *bits = BUCKET_BITS(idx, tier, b);
+    uint64_t *summary = BUCKET_SUMMARY(idx, tier, b);
+
+    if (from >= idx->numNodes)
+        return (-1);
+
+    w = (from >> 6);
+    if ((word = (bits[w] & (~0ULL << (from & 63)))) != 0)
+        return ((w << 6) + LOWEST_BIT(word));
+
+    // use the summary to jump to the next non-zero word
+    if (++w >= idx->words)
+        return (-1);
+    sw = (w >> 6);
+    sword = (summary[sw] & (~0ULL << (w & 63)));
+    while (sword == 0) {
+        if (++sw >= idx->summaryWords)
+            return (-1);
+        sword = summary[sw];
+    }
+    w = ((sw << 6) + LOWEST_BIT(sword));
+    return ((w << 6) + LOWEST_BIT(bits[w]));
+}
+
+//!
+//! Finds the lowest non-empty bucket at or above a given one
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier to look at
+//! @param[in] b the first bucket to consider
+//!
+//! @return the bucket number or -1 if there is none
+//!
+static int sched_bucket_up(sched_index * idx, int tier, int b)
+{
+    uint64_t word = 0;
+
+    for (; b < SCHED_CORE_BUCKETS; b = ((b | 63) + 1)) {
+        if ((word = (idx->nonempty[tier][b >> 6] & (~0ULL << (b & 63)))) != 0)
+            return (((b >> 6) << 6) + LOWEST_BIT(word));
+    }
+    return (-1);
+}
+
+//!
+//! Finds the highest non-empty bucket at or below a given one
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier to look at
+//! @param[in] b the first bucket to consider
+//!
+//! @return the bucket number or -1 if there is none
+//!
+static int sched_bucket_down(sched_index * idx, int tier, int b)
+{
+    uint64_t word = 0;
+
+    for (; b >= 0; b = ((b & ~63) - 1)) {
+        if ((word = (idx->nonempty[tier][b >> 6] & (~0ULL >> (63 - (b & 63))))) != 0)
+            return (((b >> 6) << 6) + HIGHEST_BIT(word));
+    }
+    return (-1);
+}
+
+//!
+//! Finds the lowest numbered node of a bucket, within a range of node numbers,
+//! that can hold a request
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier of the bucket
+//! @param[in] b the bucket number
+//! @param[in] from the first node number to consider
+//! @param[in] to the node number to stop at (excluded)
+//! @param[in] req the request
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_bucket_first_fit(sched_index * idx, int tier, int b, int from, int to, const sched_capacity * req)
+{
+    int node = 0;
+
+    for (node = sched_bucket_next(idx, tier, b, from); (node >= 0) && (node < to); node = sched_bucket_next(idx, tier, b, (node + 1))) {
+        if (NODE_FITS(idx, node, req))
+            return (node);
+    }
+    return (-1);
+}
+
+//!
+//! Finds the node of a bucket with the fewest (or most) free cores that can
+//! hold a request. Only needed for the last bucket, where core counts differ.
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier of the bucket
+//! @param[in] b the bucket number
+//! @param[in] req the request
+//! @param[in] most set to TRUE to look for the most free cores, FALSE for the fewest
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_bucket_extreme_fit(sched_index * idx, int tier, int b, const sched_capacity * req, boolean most)
+{
+    int node = 0;
+    int found = -1;
+
+    for (node = sched_bucket_next(idx, tier, b, 0); node >= 0; node = sched_bucket_next(idx, tier, b, (node + 1))) {
+        if (!NODE_FITS(idx, node, req))
+            continue;
+        if ((found < 0) || (most && (idx->avail[node].cores > idx->avail[found].cores)) || (!most && (idx->avail[node].cores < idx->avail[found].cores)))
+            found = node;
+    }
+    return (found);
+}
+
+//!
+//! Finds the lowest numbered node of a tier, within a range of node numbers,
+//! that can hold a request
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier to look at
+//! @param[in] from the first node number to consider
+//! @param[in] to the node number to stop at (excluded)
+//! @param[in] req the request
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_first_fit(sched_index * idx, int tier, int from, int to, const sched_capacity * req)
+{
+    int b = 0;
+    int node = 0;
+    int found = -1;
+
+    for (b = sched_bucket_up(idx, tier, sched_bucket_for(req->cores)); b >= 0; b = sched_bucket_up(idx, tier, (b + 1))) {
+        // anything found in the next buckets has to beat what we have
+        if ((node = sched_bucket_first_fit(idx, tier, b, from, ((found < 0) ? to : found), req)) >= 0)
+            found = node;
+    }
+    return (found);
+}
+
+//!
+//! Finds the node of a tier left with the fewest free cores after holding a request
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier to look at
+//! @param[in] req the request
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_best_fit(sched_index * idx, int tier, const sched_capacity * req)
+{
+    int b = 0;
+    int node = -1;
+
+    for (b = sched_bucket_up(idx, tier, sched_bucket_for(req->cores)); b >= 0; b = sched_bucket_up(idx, tier, (b + 1))) {
+        if (b == (SCHED_CORE_BUCKETS - 1))
+            node = sched_bucket_extreme_fit(idx, tier, b, req, FALSE);
+        else
+            node = sched_bucket_first_fit(idx, tier, b, 0, idx->numNodes, req);
+        if (node >= 0)
+            return (node);
+    }
+    return (-1);
+}
+
+//!
+//! Finds the node of a tier with the most free cores that can hold a request
+//!
+//! @param[in] idx the index
+//! @param[in] tier the tier to look at
+//! @param[in] req the request
+//!
+//! @return the node number or -1 if there is none
+//!
+static int sched_spread(sched_index * idx, int tier, const sched_capacity * req)
+{
+    int b = 0;
+    int low = sched_bucket_for(req->cores);
+    int node = -1;
+
+    for (b = sched_bucket_down(idx, tier, (SCHED_CORE_BUCKETS - 1)); b >= low; b = sched_bucket_down(idx, tier, (b - 1))) {
+        if (b == (SCHED_CORE_BUCKETS - 1))
+            node = sched_bucket_extreme_fit(idx, tier, b, req, TRUE);
+        else
+            node = sched_bucket_first_fit(idx, tier, b, 0, idx->numNodes, req);
+        if (node >= 0)
+            return (node);
+    }
+    return (-1);
+}
+
+//!
+//! Allocates an empty index for a given number of nodes. All nodes start
+//! offline. Release it with sched_index_free().
+//!
+//! @param[in] numNodes the number of nodes
+//!
+//! @return a pointer to the new index or NULL on failure
+//!
+sched_index *sched_index_alloc(int numNodes)
+{
+    int i = 0;
+    int nbitmaps = (SCHED_TIERS * SCHED_CORE_BUCKETS);
+    sched_index *idx = NULL;
+
+    if ((numNodes < 1) || (numNodes > 32767))
+        return (NULL);
+
+    if ((idx = EUCA_ZALLOC(1, sizeof(sched_index))) == NULL)
+        return (NULL);
+
+    idx->numNodes = numNodes;
+    idx->words = ((numNodes + 63) >> 6);
+    idx->summaryWords = ((idx->words + 63) >> 6);
+    idx->avail = EUCA_ZALLOC(numNodes, sizeof(sched_capacity));
+    idx->state = EUCA_ZALLOC(numNodes, sizeof(char));
+    idx->bucket = EUCA_ZALLOC(numNodes, sizeof(short));
+    idx->bits = EUCA_ZALLOC((nbitmaps * idx->words), sizeof(uint64_t));
+    idx->summary = EUCA_ZALLOC((nbitmaps * idx->summaryWords), sizeof(uint64_t));
+    if (!idx->avail || !idx->state || !idx->bucket || !idx->bits || !idx->summary) {
+        sched_index_free(&idx);
+        return (NULL);
+    }
+
+    for (i = 0; i < numNodes; i++) {
+        idx->state[i] = SCHED_NODE_OFFLINE;
+        idx->bucket[i] = -1;
+    }
+    return (idx);
+}
+
+//!
+//! Releases an index and sets the caller's pointer to NULL
+//!
+//! @param[in,out] pidx a pointer to the index pointer
+//!
+void sched_index_free(sched_index ** pidx)
+{
+    sched_index *idx = NULL;
+
+    if ((pidx == NULL) || ((idx = *pidx) == NULL))
+        return;
+
+    EUCA_FREE(idx->avail);
+    EUCA_FREE(idx->state);
+    EUCA_FREE(idx->bucket);
+    EUCA_FREE(idx->bits);
+    EUCA_FREE(idx->summary);
+    EUCA_FREE(*pidx);
+}
+
+//!
+//! Sets the state and the free capacity of a node, moving it to the matching
+//! bucket. Offline nodes are not indexed and never chosen.
+//!
+//! @param[in] idx the index
+//! @param[in] node the node number
+//! @param[in] state the new state of the node
+//! @param[in] avail the free capacity of the node (ignored for offline nodes, may then be NULL)
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR on invalid parameters
+//!
+int sched_index_set_node(sched_index * idx, int node, sched_node_state state, const sched_capacity * avail)
+{
+    if ((idx == NULL) || (node < 0) || (node >= idx->numNodes))
+        return (EUCA_INVALID_ERROR);
+    if ((state != SCHED_NODE_OFFLINE) && (state != SCHED_NODE_READY) && (state != SCHED_NODE_STANDBY))
+        return (EUCA_INVALID_ERROR);
+    if ((state != SCHED_NODE_OFFLINE) && (avail == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if (idx->bucket[node] >= 0)
+        sched_index_del(idx, node);
+
+    idx->state[node] = state;
+    if (state == SCHED_NODE_OFFLINE) {
+        bzero(&(idx->avail[node]), sizeof(sched_capacity));
+        return (EUCA_OK);
+    }
+
+    idx->avail[node] = *avail;
+    sched_index_add(idx, node);
+    return (EUCA_OK);
+}
+
+//!
+//! Chooses a node for one instance according to a policy and takes the
+//! request out of its free capacity. Ready nodes are always preferred over
+//! standby nodes, except by the round-robin policy which treats them alike.
+//!
+//! @param[in] idx the index
+//! @param[in] policy the placement policy
+//! @param[in] req the capacity the instance needs
+//!
+//! @return the chosen node number or -1 if no node can hold the request
+//!
+int sched_index_place(sched_index * idx, sched_policy policy, const sched_capacity * req)
+{
+    int tier = 0;
+    int node = -1;
+    int other = -1;
+
+    if ((idx == NULL) || (req == NULL))
+        return (-1);
+
+    switch (policy) {
+    case SCHED_POLICY_ROUNDROBIN:
+        if ((idx->cursor < 0) || (idx->cursor >= idx->numNodes))
+            idx->cursor = 0;
+        // the next few nodes usually have room, which is cheaper to check directly
+        for (other = idx->cursor; (other < idx->numNodes) && (other < (idx->cursor + SCHED_RR_PROBES)) && (node < 0); other++) {
+            if ((idx->bucket[other] >= 0) && NODE_FITS(idx, other, req))
+                node = other;
+        }
+        // from the cursor to the end, then from the start to the cursor
+        if (node < 0) {
+            node = sched_first_fit(idx, 0, idx->cursor, idx->numNodes, req);
+            other = sched_first_fit(idx, 1, idx->cursor, ((node < 0) ? idx->numNodes : node), req);
+            if (other >= 0)
+                node = other;
+        }
+        if (node < 0) {
+            node = sched_first_fit(idx, 0, 0, idx->cursor, req);
+            other = sched_first_fit(idx, 1, 0, ((node < 0) ? idx->cursor : node), req);
+            if (other >= 0)
+                node = other;
+        }
+        if (node >= 0)
+            idx->cursor = ((node + 1) % idx->numNodes);
+        break;
+    case SCHED_POLICY_BESTFIT:
+        for (tier = 0; (tier < SCHED_TIERS) && (node < 0); tier++)
+            node = sched_best_fit(idx, tier, req);
+        break;
+    case SCHED_POLICY_SPREAD:
+        for (tier = 0; (tier < SCHED_TIERS) && (node < 0); tier++)
+            node = sched_spread(idx, tier, req);
+        break;
+    case SCHED_POLICY_FIRSTFIT:
+    default:
+        for (tier = 0; (tier < SCHED_TIERS) && (node < 0); tier++)
+            node = sched_first_fit(idx, tier, 0, idx->numNodes, req);
+        break;
+    }
+
+    if (node < 0)
+        return (-1);
+
+    sched_index_del(idx, node);
+    idx->avail[node].cores -= req->cores;
+    idx->avail[node].mem -= req->mem;
+    idx->avail[node].disk -= req->disk;
+    sched_index_add(idx, node);
+    return (node);
+}
+
+//!
+//! Places a batch of identical instances in one pass, one call to
+//! sched_index_place() per instance, stopping at the first one that does
+//! not fit anywhere.
+//!
+//! @param[in]  idx the index
+//! @param[in]  policy the placement policy
+//! @param[in]  req the capacity each instance needs
+//! @param[in]  count the number of instances
+//! @param[out] outNodes the chosen node of each placed instance, must hold count entries
+//!
+//! @return the number of instances placed, from 0 to count
+//!
+int sched_index_place_batch(sched_index * idx, sched_policy policy, const sched_capacity * req, int count, int *outNodes)
+{
+    int i = 0;
+    int node = 0;
+
+    if ((idx == NULL) || (req == NULL) || (outNodes == NULL))
+        return (0);
+
+    for (i = 0; i < count; i++) {
+        if ((node = sched_index_place(idx, policy, req)) < 0)
+            break;
+        outNodes[i] = node;
+    }
+    return (i);
+}
+
+#ifdef _UNIT_TEST
+
+#include <assert.h>
+#include <sys/time.h>
+
+//! Reference implementation: a plain linear scan of the nodes per instance, as the CC used to do
+typedef struct ref_cluster_t {
+    int numNodes;
+    int cursor;
+    sched_capacity *avail;
+    char *state;
+} ref_cluster;
+
+static const char *policy_names[SCHED_POLICY_LAST] = { "FIRSTFIT", "ROUNDROBIN", "BESTFIT", "SPREAD" };
+
+//! Instance types of the synthetic workload (cores, memory, disk)
+static const sched_capacity vm_types[] = {
+    {1, 256, 5}, {1, 512, 10}, {2, 1024, 10}, {2, 2048, 20}, {4, 4096, 20}, {8, 8192, 40}, {16, 16384, 80},
+};
+
+//! Node sizes of the synthetic clusters, the last one lands in the catch-all bucket
+static const sched_capacity node_types[] = {
+    {8, 16384, 500}, {16, 32768, 1000}, {24, 65536, 1000}, {32, 131072, 2000}, {64, 262144, 4000}, {192, 1048576, 8000},
+};
+
+static int ref_place(ref_cluster * ref, sched_policy policy, const sched_capacity * req)
+{
+    int i = 0;
+    int n = 0;
+    int found = -1;
+    char want = SCHED_NODE_READY;
+
+#define REF_FITS(_i) ((ref->state[(_i)] != SCHED_NODE_OFFLINE) && (ref->avail[(_i)].cores >= req->cores) && \
+                      (ref->avail[(_i)].mem >= req->mem) && (ref->avail[(_i)].disk >= req->disk))
+
+    if (policy == SCHED_POLICY_ROUNDROBIN) {
+        for (n = 0, i = ref->cursor; (n < ref->numNodes) && (found < 0); n++, i = ((i + 1) % ref->numNodes)) {
+            if (REF_FITS(i))
+                found = i;
+        }
+        if (found >= 0)
+            ref->cursor = ((found + 1) % ref->numNodes);
+    } else {
+        for (want = SCHED_NODE_READY; (found < 0) && (want <= SCHED_NODE_STANDBY); want++) {
+            for (i = 0; i < ref->numNodes; i++) {
+                if ((ref->state[i] != want) || !REF_FITS(i))
+                    continue;
+                if (found < 0) {
+                    found = i;
+                    if (policy == SCHED_POLICY_FIRSTFIT)
+                        break;
+                } else if ((policy == SCHED_POLICY_BESTFIT) && (ref->avail[i].cores < ref->avail[found].cores)) {
+                    found = i;
+                } else if ((policy == SCHED_POLICY_SPREAD) && (ref->avail[i].cores > ref->avail[found].cores)) {
+                    found = i;
+                }
+            }
+        }
+    }
+#undef REF_FITS
+
+    if (found >= 0) {
+        ref->avail[found].cores -= req->cores;
+        ref->avail[found].mem -= req->mem;
+        ref->avail[found].disk -= req->disk;
+    }
+    return (found);
+}
+
+static double now_usec(void)
+{
+    struct timeval tv = { 0 };
+
+    gettimeofday(&tv, NULL);
+    return ((tv.tv_sec * 1000000.0) + tv.tv_usec);
+}
+
+//!
+//! Builds a synthetic cluster in both the index and the reference
+//!
+static void make_cluster(sched_index * idx, ref_cluster * ref, int numNodes, int standbyPct, int offlinePct)
+{
+    int i = 0;
+    int r = 0;
+    sched_capacity cap = { 0 };
+
+    ref->numNodes = numNodes;
+    ref->cursor = 0;
+    ref->avail = EUCA_ZALLOC(numNodes, sizeof(sched_capacity));
+    ref->state = EUCA_ZALLOC(numNodes, sizeof(char));
+    assert((ref->avail != NULL) && (ref->state != NULL));
+
+    for (i = 0; i < numNodes; i++) {
+        cap = node_types[random() % (sizeof(node_types) / sizeof(node_types[0]))];
+        r = (random() % 100);
+        ref->state[i] = ((r < offlinePct) ? SCHED_NODE_OFFLINE : ((r < (offlinePct + standbyPct)) ? SCHED_NODE_STANDBY : SCHED_NODE_READY));
+        ref->avail[i] = ((ref->state[i] == SCHED_NODE_OFFLINE) ? (sched_capacity) { 0, 0, 0 } : cap);
+        assert(sched_index_set_node(idx, i, ref->state[i], &cap) == EUCA_OK);
+    }
+}
+
+static void free_cluster(ref_cluster * ref)
+{
+    EUCA_FREE(ref->avail);
+    EUCA_FREE(ref->state);
+}
+
+//!
+//! Runs random RunInstances batches against the index and the reference and
+//! checks that every placement matches, with nodes going up and down meanwhile.
+//!
+static void check_policy(sched_policy policy, int numNodes)
+{
+    int i = 0;
+    int j = 0;
+    int node = 0;
+    int count = 0;
+    int placed = 0;
+    int *out = NULL;
+    sched_index *idx = NULL;
+    ref_cluster ref = { 0 };
+    sched_capacity req = { 0 };
+    sched_capacity cap = { 0 };
+
+    assert((idx = sched_index_alloc(numNodes)) != NULL);
+    assert((out = EUCA_ZALLOC(200, sizeof(int))) != NULL);
+    make_cluster(idx, &ref, numNodes, 10, 10);
+
+    for (i = 0; i < 2000; i++) {
+        req = vm_types[random() % (sizeof(vm_types) / sizeof(vm_types[0]))];
+        count = (1 + (random() % 200));
+        placed = sched_index_place_batch(idx, policy, &req, count, out);
+        for (j = 0; j < placed; j++)
+            assert(ref_place(&ref, policy, &req) == out[j]);
+        if (placed < count)
+            assert(ref_place(&ref, policy, &req) == -1);
+        assert(idx->cursor == ref.cursor);
+
+        // a node changes state or reports new capacity
+        node = (random() % numNodes);
+        cap = node_types[random() % (sizeof(node_types) / sizeof(node_types[0]))];
+        ref.state[node] = (1 + (random() % 2));
+        if ((random() % 4) == 0)
+            ref.state[node] = SCHED_NODE_OFFLINE;
+        ref.avail[node] = ((ref.state[node] == SCHED_NODE_OFFLINE) ? (sched_capacity) { 0, 0, 0 } : cap);
+        assert(sched_index_set_node(idx, node, ref.state[node], &cap) == EUCA_OK);
+    }
+
+    free_cluster(&ref);
+    EUCA_FREE(out);
+    sched_index_free(&idx);
+    assert(idx == NULL);
+}
+
+//!
+//! Replays RunInstances batches of random instance types on a synthetic
+//! cluster until it is full, with the linear scan and with the index.
+//!
+static void benchmark(int numNodes, sched_policy policy)
+{
+    int i = 0;
+    int k = 0;
+    int placed = 0;
+    int batches = 0;
+    int count = 0;
+    int total = 0;
+    int *out = NULL;
+    double t = 0.0;
+    double linear = 0.0;
+    double indexed = 0.0;
+    sched_capacity req = { 0 };
+    sched_index *idx = NULL;
+    ref_cluster ref = { 0 };
+
+    assert((idx = sched_index_alloc(numNodes)) != NULL);
+    assert((out = EUCA_ZALLOC(500, sizeof(int))) != NULL);
+
+    // same cluster and same workload for both runs
+    srandom(numNodes);
+    make_cluster(idx, &ref, numNodes, 0, 5);
+    t = now_usec();
+    for (batches = 0, placed = 0;; batches++) {
+        req = vm_types[random() % (sizeof(vm_types) / sizeof(vm_types[0]))];
+        count = (1 + (random() % 500));
+        for (k = 0; (k < count) && (ref_place(&ref, policy, &req) >= 0); k++) ;
+        placed += k;
+        if (k < count)
+            break;
+    }
+    linear = (now_usec() - t);
+    free_cluster(&ref);
+
+    srandom(numNodes);
+    sched_index_free(&idx);
+    assert((idx = sched_index_alloc(numNodes)) != NULL);
+    make_cluster(idx, &ref, numNodes, 0, 5);
+    t = now_usec();
+    for (i = 0, total = 0; i <= batches; i++) {
+        req = vm_types[random() % (sizeof(vm_types) / sizeof(vm_types[0]))];
+        count = (1 + (random() % 500));
+        total += sched_index_place_batch(idx, policy, &req, count, out);
+    }
+    indexed = (now_usec() - t);
+    assert(total == placed);
+
+    printf("%6d nodes %-10s: %7d instances in %5d batches, %10.3f msec linear %8.3f msec indexed (%7.3f usec per instance)\n",
+           numNodes, policy_names[policy], placed, (batches + 1), (linear / 1000.0), (indexed / 1000.0), ((placed > 0) ? (indexed / placed) : 0.0));
+
+    free_cluster(&ref);
+    EUCA_FREE(out);
+    sched_index_free(&idx);
+}
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int policy = 0;
+    int sizes[] = { 1000, 2000, 8000 };
+    sched_index *idx = NULL;
+    sched_capacity cap = { 4, 4096, 100 };
+    sched_capacity req = { 2, 1024, 10 };
+
+    // small hand checked cases
+    assert(sched_index_alloc(0) == NULL);
+    assert((idx = sched_index_alloc(3)) != NULL);
+    assert(sched_index_place(idx, SCHED_POLICY_FIRSTFIT, &req) == -1);
+    assert(sched_index_set_node(idx, 3, SCHED_NODE_READY, &cap) == EUCA_INVALID_ERROR);
+    assert(sched_index_set_node(idx, 0, SCHED_NODE_READY, NULL) == EUCA_INVALID_ERROR);
+    assert(sched_index_set_node(idx, 0, SCHED_NODE_STANDBY, &cap) == EUCA_OK);
+    assert(sched_index_set_node(idx, 1, SCHED_NODE_READY, &cap) == EUCA_OK);
+    cap.cores = 8;
+    assert(sched_index_set_node(idx, 2, SCHED_NODE_READY, &cap) == EUCA_OK);
+    assert(sched_index_place(idx, SCHED_POLICY_FIRSTFIT, &req) == 1);   // ready nodes first
+    assert(sched_index_place(idx, SCHED_POLICY_BESTFIT, &req) == 1);    // 2 cores left on node 1
+    assert(sched_index_place(idx, SCHED_POLICY_SPREAD, &req) == 2);     // 8 cores on node 2
+    assert(sched_index_place(idx, SCHED_POLICY_FIRSTFIT, &req) == 2);   // node 1 is full
+    assert(sched_index_place(idx, SCHED_POLICY_ROUNDROBIN, &req) == 0); // round-robin ignores tiers
+    assert(sched_index_place(idx, SCHED_POLICY_ROUNDROBIN, &req) == 2);
+    assert(sched_index_place(idx, SCHED_POLICY_ROUNDROBIN, &req) == 0);
+    assert(sched_index_place(idx, SCHED_POLICY_ROUNDROBIN, &req) == 2);
+    assert(sched_index_place(idx, SCHED_POLICY_ROUNDROBIN, &req) == -1);
+    assert(sched_index_set_node(idx, 2, SCHED_NODE_READY, &cap) == EUCA_OK);
+    assert(sched_index_place(idx, SCHED_POLICY_FIRSTFIT, &req) == 2);
+    assert(sched_index_set_node(idx, 2, SCHED_NODE_OFFLINE, NULL) == EUCA_OK);
+    assert(sched_index_place(idx, SCHED_POLICY_FIRSTFIT, &req) == -1);
+    sched_index_free(&idx);
+
+    // random workloads against the linear scan, with node counts that are and are not multiples of 64
+    for (policy = 0; policy < SCHED_POLICY_LAST; policy++) {
+        for (i = 0; i < 3; i++) {
+            srandom((policy * 10) + i);
+            check_policy(policy, ((i == 0) ? 64 : ((i == 1) ? 1037 : 5000)));
+        }
+    }
+    printf("functional tests passed\n");
+
+    if ((argc > 1) && !strcmp(argv[1], "-b")) {
+        for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+            for (policy = 0; policy < SCHED_POLICY_LAST; policy++)
+                benchmark(sizes[i], policy);
+        }
+    }
+    return (0);
+}
+#endif /* _UNIT_TEST */
@@ -0,0 +1,186 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2015 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_SCHED_ENGINE_H_
+#define _INCLUDE_SCHED_ENGINE_H_
+
+//!
+//! @file util/sched_engine.h
+//! Capacity index over the nodes of a cluster, used to place instances without
+//! scanning every node for every instance. Nodes are kept in buckets keyed by
+//! their number of free cores, one bitmap of nodes per bucket, so a placement
+//! only visits the buckets that can hold the request.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define SCHED_CORE_BUCKETS                       128    //!< buckets 0..126 hold exact core counts, the last one anything larger
+#define SCHED_TIERS                              2  //!< nodes that can run instances now, then nodes that must be woken up first
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Placement policies
+typedef enum sched_policy_t {
+    SCHED_POLICY_FIRSTFIT,             //!< lowest numbered node that fits (GREEDY)
+    SCHED_POLICY_ROUNDROBIN,           //!< first node that fits at or after the round-robin cursor
+    SCHED_POLICY_BESTFIT,              //!< node left with the fewest free cores (bin-packing)
+    SCHED_POLICY_SPREAD,               //!< node with the most free cores (spread-by-load)
+    SCHED_POLICY_LAST,
+} sched_policy;
+
+//! Node states, as far as placement is concerned
+typedef enum sched_node_state_t {
+    SCHED_NODE_OFFLINE,                //!< cannot run instances (down or disabled)
+    SCHED_NODE_READY,                  //!< can run instances now
+    SCHED_NODE_STANDBY,                //!< can run instances once powered up, used only when no ready node fits
+} sched_node_state;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Free capacity of a node, or the size of a request
+typedef struct sched_capacity_t {
+    int cores;                         //!< number of cores
+    int mem;                           //!< memory in MB
+    int disk;                          //!< disk in GB
+} sched_capacity;
+
+//! The capacity index
+typedef struct sched_index_t {
+    int numNodes;                      //!< number of nodes the index was allocated for
+    int words;                         //!< number of 64-bit words in a node bitmap
+    int summaryWords;                  //!< number of 64-bit words in a summary bitmap (one bit per node bitmap word)
+    int cursor;                        //!< where the next round-robin search starts
+    sched_capacity *avail;             //!< free capacity of each node
+    char *state;                       //!< sched_node_state of each node
+    short *bucket;                     //!< bucket of each node, -1 if the node is not indexed
+    int count[SCHED_TIERS][SCHED_CORE_BUCKETS]; //!< number of nodes in each bucket
+    uint64_t nonempty[SCHED_TIERS][SCHED_CORE_BUCKETS / 64];    //!< one bit per non-empty bucket
+    uint64_t *bits;                    //!< node bitmaps, SCHED_TIERS * SCHED_CORE_BUCKETS of them
+    uint64_t *summary;                 //!< summary bitmaps of the non-zero words of each node bitmap
+} sched_index;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+sched_index *sched_index_alloc(int numNodes);
+void sched_index_free(sched_index ** pidx);
+int sched_index_set_node(sched_index * idx, int node, sched_node_state state, const sched_capacity * avail);
+int sched_index_place(sched_index * idx, sched_policy policy, const sched_capacity * req);
+int sched_index_place_batch(sched_index * idx, sched_policy policy, const sched_capacity * req, int count, int *outNodes);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_SCHED_ENGINE_H_ */
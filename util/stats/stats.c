@@ -86,6 +86,7 @@
 #include "message_sensor.h"
 #include "message_stats.h"
 #include "service_sensor.h"
+#include "lock_sensor.h"
 #include "fs_emitter.h"
 
 /*----------------------------------------------------------------------------*\
@@ -330,6 +331,14 @@ static int register_sensor_set() {
         LOGERROR("Error registering service state sensor\n");
     }
 
+    //Only the components that keep lock counters initialize this one
+    if(strlen(lock_stats_sensor.config_name) > 0) {
+        LOGDEBUG("Registering lock stats sensor\n");
+        if(result += register_sensor(&lock_stats_sensor) > 0) {
+            LOGERROR("Error registering lock stats sensor\n");
+        }
+    }
+
     return result;
 }
 